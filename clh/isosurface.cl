@@ -0,0 +1,311 @@
+/*
+ * Marching cubes kernels for CLVoxeliser, built along with voxelise.cl and reading volumes packed the same way.
+ * A surface vertex sits at the midpoint of every lattice edge whose end voxels differ, as for VoxelVolume in
+ * Mesh::marchingCubes. Vertices are numbered by node row (y, z), then by the axis of the edge, then along x, so the
+ * vertex on any edge follows from per-row counts and a population count of the crossing bits before it, and cells
+ * never search for the vertices they share.
+ *
+ * Extraction runs in passes: mcCountRows counts the vertices and triangles of every row, mcScanRows and
+ * mcScanBlocks prefix-sum those counts into per-row output offsets, and mcEmitVertices and mcEmitTriangles write
+ * each row at its offset, so the output is compact and in the same order however the work is scheduled.
+ */
+
+#pragma OPENCL FP_CONTRACT OFF
+
+#define MC_SCAN_BLOCK 256   /* rows summed by each work item of mcScanRows */
+
+/* cell edge to lattice edge: offset of the node starting the edge and the edge axis, as for Mesh::marchingCubes */
+__constant int mcEdgeLattice[12][4] =
+{
+    {0, 0, 0, 0}, {1, 0, 0, 1}, {0, 1, 0, 0}, {0, 0, 0, 1},
+    {0, 0, 1, 0}, {1, 0, 1, 1}, {0, 1, 1, 0}, {0, 0, 1, 1},
+    {0, 0, 0, 2}, {1, 0, 0, 2}, {1, 1, 0, 2}, {0, 1, 0, 2}
+};
+
+inline uint volumeWord(__global const uint *vol, int4 dim, int xspan, int w, int y, int z)
+{
+    if(w < 0 || w >= xspan || y < 0 || y >= dim.y || z < 0 || z >= dim.z)
+        return 0u;
+    return vol[((size_t) z * dim.y + y) * xspan + w];
+}
+
+inline int volumeVoxel(__global const uint *vol, int4 dim, int xspan, int x, int y, int z)
+{
+    if(x < 0 || x >= dim.x)
+        return 0;
+    return (volumeWord(vol, dim, xspan, x / 32, y, z) >> (31 - x % 32)) & 1u;
+}
+
+/*
+ * Edges along an axis that leave the nodes of word w of row (y, z) and cross the surface, with node x at bit
+ * 31 - x % 32. Nodes on the far face of the volume have no edge along that axis.
+ */
+inline uint crossingWord(__global const uint *vol, int4 dim, int xspan, int w, int y, int z, int axis)
+{
+    uint cur = volumeWord(vol, dim, xspan, w, y, z);
+
+    if(axis == 0)
+    {
+        int n = dim.x - 1 - w * 32; // nodes of this word with a following node
+        uint valid = (n >= 32) ? 0xffffffffu : ((n <= 0) ? 0u : ~(0xffffffffu >> n));
+        return (cur ^ ((cur << 1) | (volumeWord(vol, dim, xspan, w + 1, y, z) >> 31))) & valid;
+    }
+    if(axis == 1)
+        return (y + 1 < dim.y) ? cur ^ volumeWord(vol, dim, xspan, w, y + 1, z) : 0u;
+    return (z + 1 < dim.z) ? cur ^ volumeWord(vol, dim, xspan, w, y, z + 1) : 0u;
+}
+
+/*
+ * Marching cubes codes of the cells of word w of cell row (y, z), bit i of a code set where corner i is outside,
+ * as for VoxelVolume::getMCRowCodes
+ * corner:  the eight corner words, bit 31 - j holding that corner of cell w * 32 + j
+ */
+inline void cornerWords(__global const uint *vol, int4 dim, int xspan, int w, int y, int z, uint *corner)
+{
+    for(int r = 0; r < 4; r++)
+    {
+        int ry = y + (r & 1), rz = z + (r >> 1);
+        uint cur = volumeWord(vol, dim, xspan, w, ry, rz);
+        uint shifted = (cur << 1) | (volumeWord(vol, dim, xspan, w + 1, ry, rz) >> 31);
+
+        if(r == 0 || r == 2) // corners 0, 1 and 4, 5
+        {
+            corner[2*r] = cur;
+            corner[2*r+1] = shifted;
+        }
+        else // corners 3, 2 and 7, 6
+        {
+            corner[2*r+1] = cur;
+            corner[2*r] = shifted;
+        }
+    }
+}
+
+inline int cellCode(const uint *corner, int j)
+{
+    int code = 0;
+
+    for(int i = 0; i < 8; i++)
+        code |= (int) ((~corner[i] >> (31 - j)) & 1u) << i;
+    return code;
+}
+
+inline int cellTriangles(__constant const char *tritable, int code)
+{
+    int t = 0;
+
+    while(t < 5 && tritable[16 * code + 3 * t] >= 0)
+        t++;
+    return t;
+}
+
+/*
+ * Count the surface vertices on the edges leaving each node row and the triangles of the cell row it starts
+ * global size: (dim.y, dim.z)
+ * counts:      per row, x, y and z edge vertices and triangles
+ */
+__kernel void mcCountRows(__global const uint *vol, int4 dim, int xspan, __constant const char *tritable,
+                          __constant const int *edgeflags, __global int4 *counts)
+{
+    int y = get_global_id(0), z = get_global_id(1);
+    int4 c = (int4) (0, 0, 0, 0);
+    uint corner[8];
+
+    for(int w = 0; w < xspan; w++)
+    {
+        c.x += popcount(crossingWord(vol, dim, xspan, w, y, z, 0));
+        c.y += popcount(crossingWord(vol, dim, xspan, w, y, z, 1));
+        c.z += popcount(crossingWord(vol, dim, xspan, w, y, z, 2));
+    }
+    if(y + 1 < dim.y && z + 1 < dim.z)
+        for(int w = 0; w < xspan; w++)
+        {
+            int ncells = min(32, dim.x - 1 - w * 32);
+            uint all = 0xffffffffu, any = 0u;
+
+            cornerWords(vol, dim, xspan, w, y, z, corner);
+            for(int i = 0; i < 8; i++)
+            {
+                all &= corner[i];
+                any |= corner[i];
+            }
+            if(all == any) // every corner of every cell agrees, so no cell is cut
+                continue;
+            for(int j = 0; j < ncells; j++)
+            {
+                int code = cellCode(corner, j);
+                if(edgeflags[code] != 0)
+                    c.w += cellTriangles(tritable, code);
+            }
+        }
+    counts[(size_t) z * dim.y + y] = c;
+}
+
+/*
+ * Exclusive prefix sums of vertices and triangles within each block of MC_SCAN_BLOCK rows
+ * global size: number of blocks
+ * bases:       per row, first vertex and triangle relative to the block
+ * blocksums:   per block, vertex and triangle totals
+ */
+__kernel void mcScanRows(__global const int4 *counts, int rows, __global int2 *bases, __global long2 *blocksums)
+{
+    int b = get_global_id(0), end = min(rows, (b + 1) * MC_SCAN_BLOCK);
+    int2 sum = (int2) (0, 0);
+
+    for(int r = b * MC_SCAN_BLOCK; r < end; r++)
+    {
+        int4 c = counts[r];
+        bases[r] = sum;
+        sum += (int2) (c.x + c.y + c.z, c.w);
+    }
+    blocksums[b] = convert_long2(sum);
+}
+
+/*
+ * Exclusive prefix sum of the block totals in place, with the grand totals after the last block, in 64 bits so
+ * that the host can tell a surface too large for 32-bit indices
+ * global size: 1
+ */
+__kernel void mcScanBlocks(__global long2 *blocksums, int blocks)
+{
+    long2 sum = (long2) (0, 0);
+
+    for(int b = 0; b < blocks; b++)
+    {
+        long2 c = blocksums[b];
+        blocksums[b] = sum;
+        sum += c;
+    }
+    blocksums[blocks] = sum;
+}
+
+inline uint packSnorm10(float c)
+{
+    int q = (int) floor(clamp(c, -1.0f, 1.0f) * 511.0f + 0.5f);
+    return (uint) q & 0x3ffu;
+}
+
+/*
+ * Write the vertices on the crossing edges of each node row, as CompactVertex: float position, then the normal
+ * packed as signed normalised 10:10:10:2. Normals are the occupancy gradient at both ends of the edge, pointing
+ * outward, plus the edge direction from its inside end, so that they are never zero.
+ * global size: (dim.y, dim.z)
+ * edgelen:     spacing between voxel centres, as for Mesh::marchingCubes
+ * verts:       4 words per vertex
+ */
+__kernel void mcEmitVertices(__global const uint *vol, int4 dim, int xspan, __global const int2 *bases,
+                             __global const long2 *blocksums, float4 origin, float4 edgelen, __global uint *verts)
+{
+    int y = get_global_id(0), z = get_global_id(1);
+    size_t r = (size_t) z * dim.y + y;
+    int v = (int) blocksums[r / MC_SCAN_BLOCK].x + bases[r].x;
+
+    for(int axis = 0; axis < 3; axis++)
+        for(int w = 0; w < xspan; w++)
+        {
+            uint m = crossingWord(vol, dim, xspan, w, y, z, axis);
+
+            while(m != 0u)
+            {
+                int j = clz(m), x = w * 32 + j;
+                int4 n0 = (int4) (x, y, z, 0), n1 = n0;
+                float3 pos, nrm;
+                __global uint *dst = verts + 4 * (size_t) v;
+
+                m &= ~(0x80000000u >> j);
+                if(axis == 0) n1.x++; else if(axis == 1) n1.y++; else n1.z++;
+                pos = (float3) (origin.x + ((float) x + (axis == 0 ? 0.5f : 0.0f)) * edgelen.x,
+                                origin.y + ((float) y + (axis == 1 ? 0.5f : 0.0f)) * edgelen.y,
+                                origin.z + ((float) z + (axis == 2 ? 0.5f : 0.0f)) * edgelen.z);
+
+                nrm = (float3) (0.0f, 0.0f, 0.0f);
+                for(int e = 0; e < 2; e++)
+                {
+                    int4 n = (e == 0) ? n0 : n1;
+                    nrm.x += (float) (volumeVoxel(vol, dim, xspan, n.x-1, n.y, n.z) - volumeVoxel(vol, dim, xspan, n.x+1, n.y, n.z));
+                    nrm.y += (float) (volumeVoxel(vol, dim, xspan, n.x, n.y-1, n.z) - volumeVoxel(vol, dim, xspan, n.x, n.y+1, n.z));
+                    nrm.z += (float) (volumeVoxel(vol, dim, xspan, n.x, n.y, n.z-1) - volumeVoxel(vol, dim, xspan, n.x, n.y, n.z+1));
+                }
+                float dir = volumeVoxel(vol, dim, xspan, x, y, z) ? 1.0f : -1.0f;
+                if(axis == 0) nrm.x += dir; else if(axis == 1) nrm.y += dir; else nrm.z += dir;
+                nrm = normalize(nrm);
+
+                dst[0] = as_uint(pos.x);
+                dst[1] = as_uint(pos.y);
+                dst[2] = as_uint(pos.z);
+                dst[3] = packSnorm10(nrm.x) | (packSnorm10(nrm.y) << 10) | (packSnorm10(nrm.z) << 20);
+                v++;
+            }
+        }
+}
+
+/*
+ * Write the triangles of each cell row in triangleTable order. Walking the row along x keeps, for each of the four
+ * node rows about it and each axis, the count of crossing edges before the current cell, which is the position of
+ * a vertex within its row and axis.
+ * global size: (dim.y - 1, dim.z - 1)
+ * indices:     3 vertex indices per triangle
+ */
+__kernel void mcEmitTriangles(__global const uint *vol, int4 dim, int xspan, __constant const char *tritable,
+                              __constant const int *edgeflags, __global const int4 *counts,
+                              __global const int2 *bases, __global const long2 *blocksums, __global uint *indices)
+{
+    int y = get_global_id(0), z = get_global_id(1);
+    size_t r = (size_t) z * dim.y + y;
+    int t = (int) blocksums[r / MC_SCAN_BLOCK].y + bases[r].y;
+    int rowbase[4][3], before[4][3];
+    uint masks[4][3], corner[8];
+
+    if(counts[r].w == 0)
+        return;
+    for(int n = 0; n < 4; n++)
+    {
+        size_t nr = (size_t) (z + (n >> 1)) * dim.y + y + (n & 1);
+        int4 c = counts[nr];
+        int base = (int) blocksums[nr / MC_SCAN_BLOCK].x + bases[nr].x;
+
+        rowbase[n][0] = base;
+        rowbase[n][1] = base + c.x;
+        rowbase[n][2] = base + c.x + c.y;
+        before[n][0] = before[n][1] = before[n][2] = 0;
+    }
+
+    for(int w = 0; w < xspan; w++)
+    {
+        int ncells = min(32, dim.x - 1 - w * 32);
+        uint all = 0xffffffffu, any = 0u;
+
+        for(int n = 0; n < 4; n++)
+            for(int a = 0; a < 3; a++)
+                masks[n][a] = crossingWord(vol, dim, xspan, w, y + (n & 1), z + (n >> 1), a);
+        cornerWords(vol, dim, xspan, w, y, z, corner);
+        for(int i = 0; i < 8; i++)
+        {
+            all &= corner[i];
+            any |= corner[i];
+        }
+
+        for(int j = 0; j < ncells && all != any; j++)
+        {
+            int code = cellCode(corner, j);
+
+            if(edgeflags[code] != 0)
+                for(int k = 0; k < 15 && tritable[16 * code + k] >= 0; k++)
+                {
+                    __constant const int *le = mcEdgeLattice[tritable[16 * code + k]];
+                    int n = le[1] + 2 * le[2], a = le[3];
+                    int rank = before[n][a] + ((le[0] == 1) ? (int) ((masks[n][a] >> (31 - j)) & 1u) : 0);
+
+                    indices[3 * (size_t) t + k] = (uint) (rowbase[n][a] + rank);
+                }
+            t += cellTriangles(tritable, code);
+            for(int n = 0; n < 4; n++)
+                for(int a = 0; a < 3; a++)
+                    before[n][a] += (int) ((masks[n][a] >> (31 - j)) & 1u);
+        }
+        if(all == any) // no cell of the word is cut, but its edges still precede those of later words
+            for(int n = 0; n < 4; n++)
+                for(int a = 0; a < 3; a++)
+                    before[n][a] += popcount(masks[n][a]);
+    }
+}
@@ -0,0 +1,145 @@
+/*
+ * Voxelisation kernels for CLVoxeliser. Volumes are bit-packed as in VoxelVolume: rows of xspan 32-bit words
+ * along x, row (y, z) starting at word (z * ydim + y) * xspan, with voxel x at bit 31 - x % 32 of word x / 32.
+ * Voxel positions repeat the arithmetic of VoxelVolume::getVoxelPos so that containment agrees with the CPU.
+ */
+
+#pragma OPENCL FP_CONTRACT OFF
+
+#define SHAPE_SPHERE 0      /* squared distance from a centre below a bound, which also serves Square */
+#define SHAPE_CYLINDER 1    /* within the radius of a capped spine */
+
+#define MAX_CROSSINGS 64    /* ray crossings held per row, beyond which the row is reported as overflowing */
+
+inline float voxelCoord(int i, int dim, float origin, float diag)
+{
+    return origin + ((float) i / (float) (dim - 1)) * diag;
+}
+
+/*
+ * Analytic leaf containment over a box of voxels, one work item per packed word. Bits of the word outside
+ * [lo.x, hi.x] are left as they are.
+ * global size: (whi - wlo + 1, hi.y - lo.y + 1, hi.z - lo.z + 1)
+ * shape:       SHAPE_SPHERE with (centre, bound) in a and a.w, or SHAPE_CYLINDER with start in a, spine in b,
+ *              squared spine length in b.w and radius in a.w
+ */
+__kernel void primitiveLeaf(__global uint *vol, int4 dim, int xspan, int4 lo, int4 hi,
+                            float4 origin, float4 diag, int shape, float4 a, float4 b)
+{
+    int w = (lo.x / 32) + get_global_id(0), y = lo.y + get_global_id(1), z = lo.z + get_global_id(2);
+    size_t idx = ((size_t) z * dim.y + y) * xspan + w;
+    float py = voxelCoord(y, dim.y, origin.y, diag.y), pz = voxelCoord(z, dim.z, origin.z, diag.z);
+    uint word = vol[idx];
+
+    for(int bit = 0; bit < 32; bit++)
+    {
+        int x = w * 32 + bit;
+        float px = voxelCoord(x, dim.x, origin.x, diag.x);
+        int in;
+
+        if(x < lo.x || x > hi.x)
+            continue;
+        if(shape == SHAPE_SPHERE)
+        {
+            float dx = px - a.x, dy = py - a.y, dz = pz - a.z;
+            in = (dx*dx + dy*dy + dz*dz < a.w);
+        }
+        else
+        {
+            float tval = (b.x * (px - a.x) + b.y * (py - a.y) + b.z * (pz - a.z)) / b.w;
+            float dx = px - (a.x + b.x * tval), dy = py - (a.y + b.y * tval), dz = pz - (a.z + b.z * tval);
+            in = (tval >= 0.0f && tval <= 1.0f && sqrt(dx*dx + dy*dy + dz*dz) <= a.w);
+        }
+        if(in)
+            word |= 0x80000000u >> bit;
+        else
+            word &= ~(0x80000000u >> bit);
+    }
+    vol[idx] = word;
+}
+
+/*
+ * Mesh leaf containment by crossing parity along each row, as for Mesh::scanRow, one work item per row. A ray
+ * along +x is crossed by the triangles listed for its tile of rows, coincident crossings that agree on direction
+ * count once, and voxels strictly between alternate crossings are set. Rows must be empty on entry.
+ * global size: (hi.y - lo.y + 1, hi.z - lo.z + 1)
+ * tris:        9 floats per triangle, its three vertices
+ * tilestart:   index into tiletris of the first triangle of each tile of tile x tile rows, numbered from lo
+ * xrow:        x of voxel 0 and the spacing between voxels, as for Mesh::scanRow
+ * overflow:    set to 1 if a row has more than MAX_CROSSINGS crossings, in which case the row is left empty
+ */
+__kernel void meshParityRows(__global uint *vol, int4 dim, int xspan, int4 lo, int4 hi, float4 origin, float4 diag,
+                             __global const float *tris, __global const int *tilestart, __global const int *tiletris,
+                             int tile, int tilesy, float2 xrow, float mergetol, __global int *overflow)
+{
+    int y = lo.y + get_global_id(0), z = lo.z + get_global_id(1);
+    int t = ((z - lo.z) / tile) * tilesy + (y - lo.y) / tile;
+    float py = voxelCoord(y, dim.y, origin.y, diag.y), pz = voxelCoord(z, dim.z, origin.z, diag.z);
+    float xs[MAX_CROSSINGS];
+    int fr[MAX_CROSSINGS];
+    int n = 0, m = 0;
+    __global uint *row = vol + ((size_t) z * dim.y + y) * xspan;
+
+    for(int i = tilestart[t]; i < tilestart[t+1]; i++)
+    {
+        __global const float *v = tris + 9 * (size_t) tiletris[i];
+        float ay = v[1] - py, az = v[2] - pz, by = v[4] - py, bz = v[5] - pz, cy = v[7] - py, cz = v[8] - pz;
+        float u = by * cz - bz * cy, vv = cy * az - cz * ay, ww = ay * bz - az * by, det, x;
+        int k;
+
+        // the row passes through the triangle, edges included, if the 2D cross products agree in sign
+        if((u < 0.0f || vv < 0.0f || ww < 0.0f) && (u > 0.0f || vv > 0.0f || ww > 0.0f))
+            continue;
+        det = u + vv + ww;
+        if(det == 0.0f) // edge on
+            continue;
+        x = (u * v[0] + vv * v[3] + ww * v[6]) / det;
+        if(n == MAX_CROSSINGS)
+        {
+            *overflow = 1;
+            return;
+        }
+
+        // insertion keeps the crossings sorted along the row
+        for(k = n; k > 0 && xs[k-1] > x; k--)
+        {
+            xs[k] = xs[k-1];
+            fr[k] = fr[k-1];
+        }
+        xs[k] = x;
+        fr[k] = (det > 0.0f);
+        n++;
+    }
+
+    // a row through a shared edge or vertex crosses every incident triangle, which count once if they agree
+    for(int k = 0; k < n; k++)
+        if(k == 0 || xs[k] - xs[k-1] > mergetol || fr[k] != fr[k-1])
+        {
+            xs[m] = xs[k];
+            m++;
+        }
+
+    // voxels strictly between alternate crossings are inside, an unmatched final crossing is ignored
+    for(int k = 0; k + 1 < m; k += 2)
+    {
+        int xstart = max((int) floor((xs[k] - xrow.x) / xrow.y) + 1, 0);
+        int xend = min((int) ceil((xs[k+1] - xrow.x) / xrow.y), dim.x);
+
+        for(int x = xstart; x < xend; x++)
+            row[x / 32] |= 0x80000000u >> (x % 32);
+    }
+}
+
+/*
+ * Combine two volumes a packed word at a time over a box of whole words, as for VoxelVolume::unionWith,
+ * intersectWith and subtract, with op 0, 1 and 2 respectively
+ * global size: (whi - wlo + 1, hi.y - lo.y + 1, hi.z - lo.z + 1)
+ */
+__kernel void setOpWords(__global uint *left, __global const uint *right, int4 dim, int xspan, int4 lo, int op)
+{
+    int w = (lo.x / 32) + get_global_id(0), y = lo.y + get_global_id(1), z = lo.z + get_global_id(2);
+    size_t idx = ((size_t) z * dim.y + y) * xspan + w;
+    uint cur = left[idx], arg = right[idx];
+
+    left[idx] = (op == 0) ? (cur | arg) : ((op == 1) ? (cur & arg) : (cur & ~arg));
+}
@@ -0,0 +1,121 @@
+/**
+ * @file
+ *
+ * Per-thread counts of the queries made in hot paths.
+ */
+
+#include <memory>
+#include <mutex>
+#include "debug_vector.h"
+#include "stats.h"
+#include "counters.h"
+
+namespace stats
+{
+
+static const char * const counterNames[(int) Counter::COUNT] =
+{
+    "containment sphere",
+    "containment cube",
+    "containment cylinder",
+    "containment mesh",
+    "containment instance",
+    "ray-triangle tests",
+    "BVH nodes visited",
+    "voxels skipped by bounds",
+    "MC active cells",
+    "FFD basis evaluations"
+};
+
+#ifdef UTS_QUERY_COUNTERS
+
+namespace detail
+{
+
+thread_local CounterBlock * threadCounters = nullptr;
+
+static uts::vector<std::unique_ptr<CounterBlock> > &getCounterBlocks()
+{
+    // Blocks are never freed, so counts survive the threads that made them
+    static uts::vector<std::unique_ptr<CounterBlock> > blocks;
+    return blocks;
+}
+
+static std::mutex &getCounterMutex()
+{
+    static std::mutex counterMutex;
+    return counterMutex;
+}
+
+CounterBlock * addCounterBlock()
+{
+    std::unique_ptr<CounterBlock> created(new CounterBlock);
+
+    for (auto &value : created->values)
+        value.store(0, std::memory_order_relaxed);
+    threadCounters = created.get();
+    std::lock_guard<std::mutex> lock(getCounterMutex());
+    getCounterBlocks().push_back(std::move(created));
+    return threadCounters;
+}
+
+} // namespace detail
+
+bool isCountingEnabled()
+{
+    return true;
+}
+
+std::uint64_t getCount(Counter counter)
+{
+    std::lock_guard<std::mutex> lock(detail::getCounterMutex());
+    std::uint64_t total = 0;
+
+    for (const auto &block : detail::getCounterBlocks())
+        total += block->values[(int) counter].load(std::memory_order_relaxed);
+    return total;
+}
+
+void resetCounters()
+{
+    std::lock_guard<std::mutex> lock(detail::getCounterMutex());
+
+    for (const auto &block : detail::getCounterBlocks())
+        for (auto &value : block->values)
+            value.store(0, std::memory_order_relaxed);
+}
+
+#else
+
+bool isCountingEnabled()
+{
+    return false;
+}
+
+std::uint64_t getCount(Counter)
+{
+    return 0;
+}
+
+void resetCounters()
+{
+}
+
+#endif
+
+const char * counterName(Counter counter)
+{
+    return counterNames[(int) counter];
+}
+
+void reportCounters()
+{
+    for (int c = 0; c < (int) Counter::COUNT; c++)
+    {
+        std::uint64_t total = getCount((Counter) c);
+        if (total > 0)
+            printAlways("COUNT,", counterNames[c], ",", total, "\n");
+    }
+}
+
+} // namespace stats
@@ -0,0 +1,111 @@
+/**
+ * @file
+ *
+ * Counts of the queries made in hot paths, such as ray-triangle tests and BVH nodes visited, for tuning the
+ * acceleration structures against real workloads.
+ *
+ * Each thread adds to its own block of counters, so counting takes no locks and no atomic read-modify-write, and the
+ * blocks are summed when the counts are read. Counting is compiled in only when UTS_QUERY_COUNTERS is defined (the
+ * QUERY_COUNTERS build option, which debug builds turn on), and otherwise @ref UTS_COUNT expands to nothing.
+ */
+
+#ifndef UTS_COMMON_COUNTERS_H
+#define UTS_COMMON_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace stats
+{
+
+/// Query counted in a hot path
+enum class Counter
+{
+    SPHERE_CONTAINMENT,     ///< points tested against a sphere
+    CUBE_CONTAINMENT,       ///< points tested against a cube
+    CYLINDER_CONTAINMENT,   ///< points tested against a cylinder
+    MESH_CONTAINMENT,       ///< points tested against a mesh
+    INSTANCE_CONTAINMENT,   ///< points tested against a mesh instance
+    RAY_TRIANGLE_TESTS,     ///< rays tested against a triangle, counting each ray of a packet
+    BVH_NODES_VISITED,      ///< BVH nodes taken from the traversal stack
+    VOXELS_SKIPPED,         ///< voxels a csg leaf leaves untested because they lie outside its bounds or row span
+    MC_ACTIVE_CELLS,        ///< marching cubes cells with at least one edge crossing
+    FFD_BASIS_EVALS,        ///< univariate Bernstein or B-spline bases evaluated for deformation, one per point and axis
+    COUNT                   ///< number of counters, not itself a counter
+};
+
+/**
+ * Returns whether queries are being counted, which is fixed when the program is built
+ */
+bool isCountingEnabled();
+
+/**
+ * Returns the name of a counter, as shown by @ref reportCounters
+ */
+const char * counterName(Counter counter);
+
+/**
+ * Returns the total of a counter over every thread, or 0 if counting was not compiled in. Adds made meanwhile on
+ * other threads may or may not be included.
+ */
+std::uint64_t getCount(Counter counter);
+
+/**
+ * Report the totals of all counters that are not zero, one "COUNT,name,value" line each, in the same
+ * comma-separated form as @ref reportTimes. Prints nothing if counting was not compiled in.
+ */
+void reportCounters();
+
+/**
+ * Zero every counter, so that the next report only covers what follows.
+ * @pre No counted work is running on other threads.
+ */
+void resetCounters();
+
+#ifdef UTS_QUERY_COUNTERS
+
+namespace detail
+{
+
+/// Counters of one thread, written only by that thread
+struct CounterBlock
+{
+    std::atomic<std::uint64_t> values[(int) Counter::COUNT];
+};
+
+/// Block of the calling thread, or NULL until its first count
+extern thread_local CounterBlock * threadCounters;
+
+/// Create and register the block of the calling thread
+CounterBlock * addCounterBlock();
+
+/**
+ * Implementation of @ref UTS_COUNT. Only the owning thread writes a block, so a relaxed load and store suffice and
+ * the add compiles to plain moves.
+ */
+inline void count(Counter counter, std::uint64_t n)
+{
+    CounterBlock * block = threadCounters;
+
+    if(block == nullptr)
+        block = addCounterBlock();
+    std::atomic<std::uint64_t> &value = block->values[(int) counter];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+/**
+ * Add @a n to the counter named @a name, one of the members of @ref stats::Counter
+ */
+#define UTS_COUNT(name, n) stats::detail::count(stats::Counter::name, (n))
+
+#else
+
+#define UTS_COUNT(name, n) do {} while (0)
+
+#endif
+
+} // namespace stats
+
+#endif /* !UTS_COMMON_COUNTERS_H */
@@ -0,0 +1,94 @@
+/**
+ * @file
+ *
+ * Diagnostic messages with a verbosity level and a module
+ */
+
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include "log.h"
+
+namespace stats
+{
+
+namespace detail
+{
+
+static const int numLogModules = (int) LogModule::COUNT;
+static const char * logModuleNames[numLogModules] = {"mesh", "csg", "voxels", "render"};   ///< in LogModule order
+static const char * logLevelNames[] = {"error", "warning", "info", "debug"};                 ///< in LogLevel order
+
+static std::atomic<int> logLevel((int) LogLevel::INFO);                    ///< Set by @ref setLogLevel
+static std::atomic<unsigned int> logModules((1u << numLogModules) - 1);     ///< Bit per module, set by @ref setLogModule
+static std::mutex logMutex;                                                 ///< Mutex held by @ref logAlways
+
+std::mutex &getLogMutex()
+{
+    return logMutex;
+}
+
+} // namespace detail
+
+void setLogLevel(LogLevel level)
+{
+    detail::logLevel = (int) level;
+}
+
+LogLevel getLogLevel()
+{
+    return (LogLevel) detail::logLevel.load();
+}
+
+void setLogModule(LogModule module, bool enable)
+{
+    unsigned int bit = 1u << (int) module;
+
+    if (enable)
+        detail::logModules |= bit;
+    else
+        detail::logModules &= ~bit;
+}
+
+bool parseLogLevel(const uts::string &name, LogLevel &level)
+{
+    for (int i = 0; i <= (int) LogLevel::DEBUG; i++)
+        if (name == detail::logLevelNames[i])
+        {
+            level = (LogLevel) i;
+            return true;
+        }
+    return false;
+}
+
+bool setLogModules(const uts::string &list)
+{
+    std::istringstream in(list);
+    std::string name;
+    unsigned int modules = 0;
+
+    if (list == "all")
+    {
+        detail::logModules = (1u << detail::numLogModules) - 1;
+        return true;
+    }
+    while (std::getline(in, name, ','))
+    {
+        int m = 0;
+        while (m < detail::numLogModules && name != detail::logModuleNames[m])
+            m++;
+        if (m == detail::numLogModules)
+            return false;
+        modules |= 1u << m;
+    }
+    detail::logModules = modules;
+    return true;
+}
+
+bool logEnabled(LogModule module, LogLevel level)
+{
+    return (int) level <= detail::logLevel.load(std::memory_order_relaxed)
+        && (detail::logModules.load(std::memory_order_relaxed) & (1u << (int) module)) != 0;
+}
+
+} // namespace stats
@@ -0,0 +1,138 @@
+/**
+ * @file
+ *
+ * Diagnostic messages with a verbosity level and a module, so that detailed output from geometry code costs only a
+ * comparison unless it has been asked for.
+ *
+ * Messages are written through @ref UTS_LOG, which checks the level and module before evaluating its arguments.
+ * Levels above @ref UTS_LOG_MAX_LEVEL are removed at compile time, so that in release builds (where @c NDEBUG is
+ * defined) per-element @c DEBUG messages compile to nothing.
+ */
+
+#ifndef UTS_COMMON_LOG_H
+#define UTS_COMMON_LOG_H
+
+#include <iostream>
+#include <mutex>
+#include <utility>
+#include "debug_string.h"
+
+namespace stats
+{
+
+/// Verbosity of a diagnostic message, from always shown to most detailed
+enum class LogLevel
+{
+    ERROR,      ///< failures, shown at every level
+    WARNING,    ///< recoverable problems
+    INFO,       ///< progress and summaries, one line per stage or file
+    DEBUG       ///< per element detail, such as every vertex of a mesh
+};
+
+/// Subsystem that a diagnostic message comes from, each of which can be silenced separately
+enum class LogModule
+{
+    MESH,       ///< meshes, their files and their repair
+    CSG,        ///< scenes, csg trees and the pipeline stages
+    VOXELS,     ///< voxel volumes and distance fields
+    RENDER,     ///< shaders, geometry upload and drawing
+    COUNT       ///< number of modules, not itself a module
+};
+
+namespace detail
+{
+
+/**
+ * Implementation of @ref logAlways (terminal case).
+ */
+inline void logUnlocked()
+{
+}
+
+/**
+ * Implementation of @ref logAlways (non-terminal case).
+ */
+template<typename T, typename... Args>
+void logUnlocked(T &&value, Args&&... args)
+{
+    std::cerr << std::forward<T>(value);
+    logUnlocked(std::forward<Args>(args)...);
+}
+
+std::mutex &getLogMutex();
+
+} // namespace detail
+
+/**
+ * Set the most detailed level of message that is shown. The default is @c LogLevel::INFO.
+ */
+void setLogLevel(LogLevel level);
+
+/**
+ * Returns the value set by @ref setLogLevel.
+ */
+LogLevel getLogLevel();
+
+/**
+ * Show or silence the messages of one module. Every module is shown by default.
+ */
+void setLogModule(LogModule module, bool enable);
+
+/**
+ * Parse a level name: error, warning, info or debug.
+ * @returns false, leaving @a level unchanged, if the name is not recognised
+ */
+bool parseLogLevel(const uts::string &name, LogLevel &level);
+
+/**
+ * Show only the modules in a comma-separated list of names (mesh, csg, voxels, render), or every module for "all".
+ * @returns false, leaving the modules unchanged, if any name is not recognised
+ */
+bool setLogModules(const uts::string &list);
+
+/**
+ * Returns whether messages from @a module at @a level are shown, so that callers can skip preparing detailed output.
+ */
+bool logEnabled(LogModule module, LogLevel level);
+
+/**
+ * Stream a sequence of items to @c std::cerr, followed by a newline. As for @ref printAlways, concurrent messages are
+ * not interleaved. Use through @ref UTS_LOG so that messages are filtered.
+ */
+template<typename... Args>
+void logAlways(Args&&... args)
+{
+    std::lock_guard<std::mutex> guard(detail::getLogMutex());
+    detail::logUnlocked(std::forward<Args>(args)...);
+    std::cerr << std::endl;
+}
+
+} // namespace stats
+
+/**
+ * Most detailed level of message that is compiled in, as the value of a @ref stats::LogLevel. Defaults to @c DEBUG,
+ * or to @c INFO in release builds, and may be set on the command line.
+ */
+#ifndef UTS_LOG_MAX_LEVEL
+# ifdef NDEBUG
+#  define UTS_LOG_MAX_LEVEL 2
+# else
+#  define UTS_LOG_MAX_LEVEL 3
+# endif
+#endif
+
+/**
+ * True if messages at @a level, one of ERROR, WARNING, INFO or DEBUG, from @a module, one of MESH, CSG, VOXELS or
+ * RENDER, are compiled in and currently shown. A compile-time constant false for levels that are compiled out.
+ */
+#define UTS_LOG_ENABLED(level, module) \
+    ((int) ::stats::LogLevel::level <= UTS_LOG_MAX_LEVEL \
+     && ::stats::logEnabled(::stats::LogModule::module, ::stats::LogLevel::level))
+
+/**
+ * Write a message made of the remaining arguments if @ref UTS_LOG_ENABLED, without evaluating them otherwise.
+ */
+#define UTS_LOG(level, module, ...) \
+    do { if (UTS_LOG_ENABLED(level, module)) ::stats::logAlways(__VA_ARGS__); } while (0)
+
+#endif /* !UTS_COMMON_LOG_H */
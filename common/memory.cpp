@@ -0,0 +1,188 @@
+/**
+ * @file
+ *
+ * Accounting of the bytes held by the large data structures of each subsystem.
+ */
+
+#include <algorithm>
+#include <mutex>
+#include "debug_string.h"
+#include "debug_vector.h"
+#include "memory.h"
+#include "stats.h"
+
+namespace stats
+{
+
+namespace detail
+{
+
+static std::atomic<std::size_t> memoryBudget(0);   ///< Set by @ref setMemoryBudget
+
+static uts::vector<std::shared_ptr<Memory> > &getMemoryRaw()
+{
+    // Wrapped into a function for predictable initialization order, as for times
+    static uts::vector<std::shared_ptr<Memory> > memory;
+    return memory;
+}
+
+static std::mutex &getMemoryMutex()
+{
+    static std::mutex memoryMutex;
+    return memoryMutex;
+}
+
+/// Sum over all subsystems, which keeps its own peak
+static Memory &getMemoryTotalRaw()
+{
+    static Memory total("total");
+    return total;
+}
+
+/// Raise @a peak to at least @a value
+static void raisePeak(std::atomic<std::int64_t> &peak, std::int64_t value)
+{
+    std::int64_t old = peak.load(std::memory_order_relaxed);
+    while (value > old && !peak.compare_exchange_weak(old, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+} // namespace detail
+
+Memory::Memory(const uts::string &name) : name_(name), current_(0), peak_(0)
+{
+}
+
+const uts::string &Memory::name() const
+{
+    return name_;
+}
+
+std::int64_t Memory::current() const
+{
+    return current_.load(std::memory_order_relaxed);
+}
+
+std::int64_t Memory::peak() const
+{
+    return peak_.load(std::memory_order_relaxed);
+}
+
+void Memory::add(std::int64_t delta)
+{
+    std::int64_t now = current_.fetch_add(delta, std::memory_order_relaxed) + delta;
+    detail::raisePeak(peak_, now);
+}
+
+void Memory::resetPeak()
+{
+    peak_.store(current(), std::memory_order_relaxed);
+}
+
+
+MemoryInit::MemoryInit(const uts::string &name)
+{
+    auto &memory = detail::getMemoryRaw();
+    std::lock_guard<std::mutex> lock(detail::getMemoryMutex());
+
+    memory.push_back(std::make_shared<Memory>(name));
+    this->memory = memory.back();
+}
+
+MemoryTally::MemoryTally(const MemoryInit &init) : memory(init.memory), bytes(0)
+{
+}
+
+MemoryTally::MemoryTally(const MemoryTally &other) : memory(other.memory), bytes(0)
+{
+}
+
+MemoryTally &MemoryTally::operator=(const MemoryTally &)
+{
+    return *this;
+}
+
+MemoryTally::~MemoryTally()
+{
+    set(0);
+}
+
+void MemoryTally::set(std::size_t total)
+{
+    add((std::int64_t) total - bytes.load(std::memory_order_relaxed));
+}
+
+void MemoryTally::add(std::int64_t delta)
+{
+    if (delta == 0)
+        return;
+    bytes.fetch_add(delta, std::memory_order_relaxed);
+    memory->add(delta);
+    detail::getMemoryTotalRaw().add(delta);
+}
+
+std::size_t MemoryTally::get() const
+{
+    return (std::size_t) bytes.load(std::memory_order_relaxed);
+}
+
+
+uts::vector<std::shared_ptr<Memory> > getMemory()
+{
+    uts::vector<std::shared_ptr<Memory> > memory;
+    {
+        std::lock_guard<std::mutex> lock(detail::getMemoryMutex());
+        memory = detail::getMemoryRaw();
+    }
+
+    auto cmp = [](const std::shared_ptr<Memory> &a, const std::shared_ptr<Memory> &b)
+    {
+        return a->name() < b->name();
+    };
+    std::sort(memory.begin(), memory.end(), cmp);
+    return memory;
+}
+
+std::size_t getMemoryTotal()
+{
+    return (std::size_t) std::max<std::int64_t>(0, detail::getMemoryTotalRaw().current());
+}
+
+void setMemoryBudget(std::size_t bytes)
+{
+    detail::memoryBudget = bytes;
+}
+
+std::size_t getMemoryBudget()
+{
+    return detail::memoryBudget;
+}
+
+bool memoryFits(std::size_t extra)
+{
+    std::size_t budget = detail::memoryBudget;
+    return budget == 0 || getMemoryTotal() + extra <= budget;
+}
+
+void resetMemoryPeaks()
+{
+    for (const auto &p : getMemory())
+        p->resetPeak();
+    detail::getMemoryTotalRaw().resetPeak();
+}
+
+void reportMemory(const uts::string &stage)
+{
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    const Memory &total = detail::getMemoryTotalRaw();
+
+    for (const auto &p : getMemory())
+    {
+        if (p->peak() > 0)
+            printAlways("MEMORY,", stage, ",", p->name(), ",", p->current() * mb, ",", p->peak() * mb, "\n");
+    }
+    printAlways("MEMORY,", stage, ",", total.name(), ",", total.current() * mb, ",", total.peak() * mb, "\n");
+}
+
+} // namespace stats
@@ -0,0 +1,123 @@
+/**
+ * @file
+ *
+ * Accounting of the bytes held by the large data structures of each subsystem, with peaks and an optional budget.
+ *
+ * A subsystem is registered with a @ref MemoryInit at file scope, in the same way as a @ref TimeInit. Each object
+ * whose storage is counted holds a @ref MemoryTally of the bytes it owns, which it updates whenever its storage
+ * changes size, and which is released when the object is destroyed.
+ */
+
+#ifndef UTS_COMMON_MEMORY_H
+#define UTS_COMMON_MEMORY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "debug_string.h"
+#include "debug_vector.h"
+
+namespace stats
+{
+
+/**
+ * Current and peak bytes held by one subsystem. Updates are atomic, so objects may account from any thread.
+ */
+class Memory
+{
+public:
+    /// Initializes with nothing held
+    explicit Memory(const uts::string &name);
+
+    const uts::string &name() const;
+    std::int64_t current() const;   ///< Bytes held now
+    std::int64_t peak() const;      ///< Most bytes held at once since the last @ref resetMemoryPeaks
+    void add(std::int64_t delta);   ///< Record a change in the bytes held
+    void resetPeak();               ///< Start a new peak from the current holding
+
+private:
+    uts::string name_;
+    std::atomic<std::int64_t> current_;
+    std::atomic<std::int64_t> peak_;
+};
+
+/**
+ * Registration mechanism for subsystems, which is safe to declare at file scope.
+ */
+class MemoryInit
+{
+    friend class MemoryTally;
+private:
+    std::shared_ptr<Memory> memory;
+
+public:
+    explicit MemoryInit(const uts::string &name);
+};
+
+/**
+ * Bytes owned by one object, counted towards its subsystem. A copy starts with nothing, since the copied storage
+ * is accounted for when its new owner next updates its tally.
+ */
+class MemoryTally
+{
+private:
+    std::shared_ptr<Memory> memory;
+    std::atomic<std::int64_t> bytes;
+
+public:
+    explicit MemoryTally(const MemoryInit &init);
+    MemoryTally(const MemoryTally &other);
+    MemoryTally &operator=(const MemoryTally &);   ///< Keeps this object's own count
+    ~MemoryTally();
+
+    /// Record that the owner now holds @a total bytes
+    void set(std::size_t total);
+
+    /// Record a change in the bytes held by the owner, from any thread
+    void add(std::int64_t delta);
+
+    /// Bytes currently held by the owner
+    std::size_t get() const;
+};
+
+/**
+ * Retrieve all subsystems, sorted by name. This is thread-safe in the same sense as @ref getTimes.
+ */
+uts::vector<std::shared_ptr<Memory> > getMemory();
+
+/**
+ * Bytes held across all subsystems
+ */
+std::size_t getMemoryTotal();
+
+/**
+ * Limit the bytes that budget-aware stages, such as voxelisation, may plan to hold across all subsystems.
+ * @param bytes     budget, or 0 for no limit
+ */
+void setMemoryBudget(std::size_t bytes);
+
+/**
+ * Returns the value set by @ref setMemoryBudget.
+ */
+std::size_t getMemoryBudget();
+
+/**
+ * Returns whether @a extra more bytes can be held without exceeding the budget, which is always true without one.
+ */
+bool memoryFits(std::size_t extra);
+
+/**
+ * Start new peaks for every subsystem and the total, typically at the start of a stage.
+ */
+void resetMemoryPeaks();
+
+/**
+ * Report current and peak bytes for every subsystem that has held anything, and for the total, on stdout in the
+ * same comma-separated form as @ref reportTimes.
+ * @param stage     label for the rows, such as the stage that has just finished
+ */
+void reportMemory(const uts::string &stage);
+
+} // namespace stats
+
+#endif /* !UTS_COMMON_MEMORY_H */
@@ -0,0 +1,248 @@
+/**
+ * @file
+ *
+ * Placement and page size of large arrays.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+#include "parallel.h"
+#include "pages.h"
+
+namespace parallel
+{
+
+namespace detail
+{
+
+static std::atomic<int> pagePlacement((int) PagePlacement::FIRST_TOUCH);
+static std::atomic<int> hugePages((int) HugePages::TRANSPARENT);
+
+static const char * const placementNames[] = {"local", "first-touch", "interleave"};
+static const char * const hugePageNames[] = {"off", "transparent", "explicit"};
+
+static const int interleavePolicy = 3;  ///< MPOL_INTERLEAVE of the Linux memory policy interface
+
+/// Size of the mapping backing an array of @a bytes, in whole huge pages so that every mapping can take them
+static std::size_t mappedBytes(std::size_t bytes)
+{
+    return (bytes + hugepagebytes - 1) / hugepagebytes * hugepagebytes;
+}
+
+/**
+ * Bit mask of the online NUMA nodes, read once from sysfs
+ * @returns mask with bit n set for node n, or 0 if the nodes cannot be read, as on a machine without NUMA
+ */
+static unsigned long onlineNodes()
+{
+    static const unsigned long nodes = []()
+    {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string list, range;
+        unsigned long mask = 0;
+
+        // a list of ranges such as 0-1,4
+        if(!std::getline(in, list))
+            return 0ul;
+        size_t start = 0;
+        while(start < list.size())
+        {
+            size_t end = list.find(',', start);
+            range = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            int lo = std::atoi(range.c_str()), hi = lo;
+            size_t dash = range.find('-');
+            if(dash != std::string::npos)
+                hi = std::atoi(range.c_str() + dash + 1);
+            for(int n = lo; n <= hi && n < (int) (8 * sizeof(unsigned long)); n++)
+                mask |= 1ul << n;
+            if(end == std::string::npos)
+                break;
+            start = end + 1;
+        }
+        return mask;
+    }();
+    return nodes;
+}
+
+/// Interleave whole pages of a range over the online nodes, which only affects pages not yet written
+static void interleave(void * ptr, std::size_t bytes)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long nodes = onlineNodes();
+
+    // a single node has nothing to spread over, and a failure leaves the default placement, which is still correct
+    if((nodes & (nodes - 1)) != 0)
+        syscall(SYS_mbind, ptr, bytes, interleavePolicy, &nodes, 8 * sizeof(unsigned long), 0u);
+#else
+    (void) ptr;
+    (void) bytes;
+#endif
+}
+
+/// Mark whole pages of a range for transparent huge pages
+static void transparent(void * ptr, std::size_t bytes)
+{
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+#else
+    (void) ptr;
+    (void) bytes;
+#endif
+}
+
+/**
+ * Map anonymous memory aligned to a huge page, so that transparent huge pages can back all of it
+ * @returns the mapping of mappedBytes(bytes), or NULL if it could not be had
+ */
+static void * mapAligned(std::size_t bytes)
+{
+    std::size_t len = mappedBytes(bytes), head;
+    char * base = (char *) mmap(NULL, len + hugepagebytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(base == (char *) MAP_FAILED)
+        return NULL;
+    // trim the excess on either side of the aligned range
+    head = (hugepagebytes - (std::size_t) ((std::uintptr_t) base % hugepagebytes)) % hugepagebytes;
+    if(head > 0)
+        munmap(base, head);
+    if(hugepagebytes - head > 0)
+        munmap(base + head + len, hugepagebytes - head);
+    return base + head;
+}
+
+} // namespace detail
+
+void setPagePlacement(PagePlacement placement)
+{
+    detail::pagePlacement = (int) placement;
+}
+
+PagePlacement getPagePlacement()
+{
+    return (PagePlacement) detail::pagePlacement.load();
+}
+
+void setHugePages(HugePages huge)
+{
+    detail::hugePages = (int) huge;
+}
+
+HugePages getHugePages()
+{
+    return (HugePages) detail::hugePages.load();
+}
+
+bool parsePagePlacement(const uts::string &name, PagePlacement &placement)
+{
+    for (int i = 0; i <= (int) PagePlacement::INTERLEAVE; i++)
+        if (name == detail::placementNames[i])
+        {
+            placement = (PagePlacement) i;
+            return true;
+        }
+    return false;
+}
+
+bool parseHugePages(const uts::string &name, HugePages &huge)
+{
+    for (int i = 0; i <= (int) HugePages::EXPLICIT; i++)
+        if (name == detail::hugePageNames[i])
+        {
+            huge = (HugePages) i;
+            return true;
+        }
+    return false;
+}
+
+void * allocPages(std::size_t bytes, std::size_t slab)
+{
+    HugePages huge = getHugePages();
+    PagePlacement placement = getPagePlacement();
+    void * ptr = NULL;
+
+    if(bytes < pagesmin)
+        return std::calloc(std::max(bytes, std::size_t(1)), 1);
+
+#ifdef MAP_HUGETLB
+    if(huge == HugePages::EXPLICIT)
+    {
+        ptr = mmap(NULL, detail::mappedBytes(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr == MAP_FAILED) // the pool is empty or not configured
+            ptr = NULL;
+    }
+#endif
+    if(ptr == NULL)
+    {
+        ptr = detail::mapAligned(bytes);
+        if(ptr == NULL)
+            return NULL;
+        if(huge != HugePages::OFF)
+            detail::transparent(ptr, detail::mappedBytes(bytes));
+    }
+
+    // anonymous pages read as zero, so placement only needs the first write to happen in the right place
+    if(placement == PagePlacement::INTERLEAVE)
+        detail::interleave(ptr, detail::mappedBytes(bytes));
+    else if(placement == PagePlacement::FIRST_TOUCH)
+        fillPages(ptr, 0, bytes, slab);
+    return ptr;
+}
+
+void freePages(void * ptr, std::size_t bytes)
+{
+    if(ptr == NULL)
+        return;
+    if(bytes < pagesmin)
+        std::free(ptr);
+    else
+        munmap(ptr, detail::mappedBytes(bytes));
+}
+
+void fillPages(void * ptr, int value, std::size_t bytes, std::size_t slab)
+{
+    char * base = (char *) ptr;
+    std::int64_t numslabs;
+
+    if(slab == 0 || bytes < pagesmin || inParallel())
+    {
+        std::memset(ptr, value, bytes);
+        return;
+    }
+    numslabs = (std::int64_t) ((bytes + slab - 1) / slab);
+    #pragma omp parallel for schedule(static)
+    for(std::int64_t s = 0; s < numslabs; s++)
+    {
+        std::size_t start = (std::size_t) s * slab;
+        std::memset(base + start, value, std::min(slab, bytes - start));
+    }
+}
+
+void advisePages(void * ptr, std::size_t bytes)
+{
+    std::size_t pagesize = (std::size_t) sysconf(_SC_PAGESIZE);
+    std::uintptr_t start, end;
+
+    if(ptr == NULL || bytes < pagesmin)
+        return;
+    // only the whole pages inside the range, so that neighbouring allocations are never affected
+    start = ((std::uintptr_t) ptr + pagesize - 1) / pagesize * pagesize;
+    end = ((std::uintptr_t) ptr + bytes) / pagesize * pagesize;
+    if(end <= start)
+        return;
+    if(getHugePages() != HugePages::OFF)
+        detail::transparent((void *) start, end - start);
+    if(getPagePlacement() == PagePlacement::INTERLEAVE)
+        detail::interleave((void *) start, end - start);
+}
+
+} // namespace parallel
@@ -0,0 +1,109 @@
+/**
+ * @file
+ *
+ * Placement and page size of large arrays, such as dense voxel volumes, on machines with several NUMA nodes.
+ *
+ * By default the kernel places each page on the node of the thread that first writes it, so an array zeroed by one
+ * thread ends up on one node, and the parallel loops that later sweep it all contend for that node's memory
+ * controller. Arrays from @ref allocPages are instead zeroed by the whole team in a static partition of their slabs,
+ * or interleaved over every node, and are backed by huge pages where the system allows, to cut TLB misses on
+ * multi-gigabyte volumes.
+ */
+
+#ifndef UTS_COMMON_PAGES_H
+#define UTS_COMMON_PAGES_H
+
+#include <cstddef>
+#include "debug_string.h"
+
+namespace parallel
+{
+
+const std::size_t pagesmin = std::size_t(1) << 21;     ///< arrays smaller than this come from the heap, unplaced
+const std::size_t hugepagebytes = std::size_t(1) << 21; ///< size of an explicit huge page
+
+/// Where the pages of a large array are placed
+enum class PagePlacement
+{
+    LOCAL,          ///< left to the kernel, on the node of whichever thread first writes each page
+    FIRST_TOUCH,    ///< zeroed by the team with each thread taking the slabs a static loop would give it
+    INTERLEAVE      ///< spread page by page over every NUMA node
+};
+
+/// Page size of a large array
+enum class HugePages
+{
+    OFF,            ///< ordinary pages
+    TRANSPARENT,    ///< ordinary mappings marked for transparent huge pages, which the kernel assembles when it can
+    EXPLICIT        ///< mappings from the reserved huge page pool, falling back to transparent ones if it is empty
+};
+
+/**
+ * Choose where the pages of arrays allocated from now on are placed. The default is @c PagePlacement::FIRST_TOUCH.
+ */
+void setPagePlacement(PagePlacement placement);
+
+/**
+ * Returns the value set by @ref setPagePlacement.
+ */
+PagePlacement getPagePlacement();
+
+/**
+ * Choose the page size of arrays allocated from now on. The default is @c HugePages::TRANSPARENT.
+ */
+void setHugePages(HugePages huge);
+
+/**
+ * Returns the value set by @ref setHugePages.
+ */
+HugePages getHugePages();
+
+/**
+ * Parse a placement name: local, first-touch or interleave.
+ * @returns false, leaving @a placement unchanged, if the name is not recognised
+ */
+bool parsePagePlacement(const uts::string &name, PagePlacement &placement);
+
+/**
+ * Parse a huge page setting: off, transparent or explicit.
+ * @returns false, leaving @a huge unchanged, if the name is not recognised
+ */
+bool parseHugePages(const uts::string &name, HugePages &huge);
+
+/**
+ * Allocate a zeroed array, placed and paged as currently chosen when it is at least @ref pagesmin bytes
+ * @param bytes     size of the array
+ * @param slab      bytes in each unit of the static partition used for first touch, such as one z slice of a volume
+ * @returns the array, which must be released with @ref freePages and the same size, or NULL if it could not be had
+ */
+void * allocPages(std::size_t bytes, std::size_t slab);
+
+/**
+ * Release an array from @ref allocPages
+ * @param ptr       array, or NULL
+ * @param bytes     size it was allocated with
+ */
+void freePages(void * ptr, std::size_t bytes);
+
+/**
+ * Set every byte of an array, in the same static partition of slabs as the first touch of @ref allocPages, so that
+ * each thread writes pages on its own node. Within a running parallel region the array is set by the calling
+ * thread alone.
+ * @param ptr       array
+ * @param value     byte value
+ * @param bytes     size of the array
+ * @param slab      bytes in each unit of the partition
+ */
+void fillPages(void * ptr, int value, std::size_t bytes, std::size_t slab);
+
+/**
+ * Apply the chosen huge pages and interleaving to the whole pages of memory allocated elsewhere, such as the
+ * buffer of a large vector, before it is first written. First touch placement is left to whichever threads write it.
+ * @param ptr       start of the memory
+ * @param bytes     size of the memory, ignored below @ref pagesmin
+ */
+void advisePages(void * ptr, std::size_t bytes);
+
+} // namespace parallel
+
+#endif /* !UTS_COMMON_PAGES_H */
@@ -0,0 +1,78 @@
+/**
+ * @file
+ *
+ * Parallel loops, task groups and per-thread storage on the shared OpenMP thread team
+ */
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+#include "parallel.h"
+
+namespace parallel
+{
+
+namespace detail
+{
+
+static std::atomic<int> threadSetting(0);   ///< Thread count given to @ref setThreads, 0 for the OpenMP default
+
+} // namespace detail
+
+void setThreads(int threads)
+{
+    if(threads <= 0)
+        threads = getHardwareThreads();
+    detail::threadSetting = threads;
+    adoptThreads();
+}
+
+void adoptThreads()
+{
+#ifdef _OPENMP
+    int threads = detail::threadSetting;
+    if(threads > 0)
+        omp_set_num_threads(threads);
+#endif
+}
+
+int getThreads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+int getHardwareThreads()
+{
+#ifdef _OPENMP
+    return std::max(omp_get_num_procs(), 1);
+#else
+    return std::max((int) std::thread::hardware_concurrency(), 1);
+#endif
+}
+
+int threadIndex()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+bool inParallel()
+{
+#ifdef _OPENMP
+    return omp_in_parallel() != 0;
+#else
+    return false;
+#endif
+}
+
+} // namespace parallel
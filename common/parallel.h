@@ -0,0 +1,245 @@
+/**
+ * @file
+ *
+ * Parallel loops, task groups and per-thread storage on the shared OpenMP thread team
+ */
+
+#ifndef UTS_COMMON_PARALLEL_H
+#define UTS_COMMON_PARALLEL_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "debug_vector.h"
+
+/// Scheduling of parallel work. Every primitive runs on the one OpenMP team, so they nest within each other
+/// and within the existing parallel regions and tasks without oversubscribing the machine.
+namespace parallel
+{
+
+/**
+ * Set the number of threads used by parallel regions, taking effect at once on the calling thread and on other
+ * threads when they call @ref adoptThreads.
+ * @param threads   number of threads, or 0 for one per hardware thread
+ * @pre No parallel region is running.
+ */
+void setThreads(int threads);
+
+/**
+ * Apply the thread count last given to @ref setThreads to parallel regions started by the calling thread, which
+ * a thread other than the one that set it must do before starting any, since OpenMP keeps the count per thread.
+ */
+void adoptThreads();
+
+/**
+ * Returns the number of threads a new parallel region started by the calling thread would use.
+ */
+int getThreads();
+
+/**
+ * Returns the number of hardware threads, the default for @ref setThreads.
+ */
+int getHardwareThreads();
+
+/**
+ * Returns the index of the calling thread within its team, from 0 to @ref getThreads - 1, and 0 outside any
+ * parallel region.
+ */
+int threadIndex();
+
+/**
+ * Returns true if the caller is inside an active parallel region, where new loops and tasks are shared with the
+ * threads already running rather than starting a team of their own.
+ */
+bool inParallel();
+
+/**
+ * Run the chunks of a range in parallel. Outside a parallel region a team is started and chunks are handed out
+ * dynamically; inside one, each chunk becomes a task of the running team, which idle threads take from the
+ * others, and the call returns when all of them have finished.
+ * @param begin, end    half-open range of indices
+ * @param grain         indices per chunk, at least 1
+ * @param body          called as body(lo, hi) for each half-open chunk
+ */
+template<typename Body>
+void forRange(int begin, int end, int grain, Body body)
+{
+    int chunks;
+
+    grain = std::max(grain, 1);
+    if(end <= begin)
+        return;
+    chunks = (end - begin + grain - 1) / grain;
+    if(chunks == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    if(inParallel())
+    {
+        for(int c = 0; c < chunks; c++)
+        {
+            #pragma omp task firstprivate(c) shared(body)
+            body(begin + c * grain, std::min(begin + (c + 1) * grain, end));
+        }
+        #pragma omp taskwait
+    }
+    else
+    {
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(int c = 0; c < chunks; c++)
+            body(begin + c * grain, std::min(begin + (c + 1) * grain, end));
+    }
+}
+
+/**
+ * Run the blocks of a 3D range in parallel, as @ref forRange does for chunks, with x varying fastest
+ * @param lo, hi    inclusive lower and upper corners of the range
+ * @param grain     block extent along each axis, each at least 1
+ * @param body      called as body(blo, bhi) with the inclusive corners of each block
+ */
+template<typename Body>
+void forRange3(const int * lo, const int * hi, const int * grain, Body body)
+{
+    int g[3], n[3];
+
+    for(int a = 0; a < 3; a++)
+    {
+        if(hi[a] < lo[a])
+            return;
+        g[a] = std::max(grain[a], 1);
+        n[a] = (hi[a] - lo[a]) / g[a] + 1;
+    }
+    forRange(0, n[0] * n[1] * n[2], 1, [&](int first, int last)
+    {
+        for(int b = first; b < last; b++)
+        {
+            int idx[3] = {b % n[0], (b / n[0]) % n[1], b / (n[0] * n[1])}, blo[3], bhi[3];
+            for(int a = 0; a < 3; a++)
+            {
+                blo[a] = lo[a] + idx[a] * g[a];
+                bhi[a] = std::min(blo[a] + g[a] - 1, hi[a]);
+            }
+            body(blo, bhi);
+        }
+    });
+}
+
+/**
+ * Reduce a range in parallel, giving the same result whatever the number of threads. The range is cut into chunks
+ * of @a grain indices, whose boundaries depend only on the range and the grain, each chunk is reduced in order by
+ * @a body, and the chunk values are then combined in a fixed balanced tree, neighbours first. Floating point sums,
+ * bounds and hashes therefore come out bit for bit the same on any machine, unlike an OpenMP reduction clause.
+ * @param begin, end    half-open range of indices
+ * @param grain         indices per chunk, at least 1
+ * @param identity      value of an empty range
+ * @param body          called as body(lo, hi) for each half-open chunk, returning its value
+ * @param combine       called as combine(a, b), with a covering lower indices than b, returning their combined value
+ * @returns the combined value of every chunk, or @a identity if the range is empty
+ */
+template<typename T, typename Body, typename Combine>
+T reduce(int begin, int end, int grain, const T &identity, Body body, Combine combine)
+{
+    std::vector<T> partial;
+    int chunks;
+
+    grain = std::max(grain, 1);
+    if(end <= begin)
+        return identity;
+    chunks = (end - begin + grain - 1) / grain;
+    partial.assign(chunks, identity);
+    forRange(0, chunks, 1, [&](int first, int last)
+    {
+        for(int c = first; c < last; c++)
+            partial[c] = body(begin + c * grain, std::min(begin + (c + 1) * grain, end));
+    });
+
+    // pairs at doubling strides, so the tree is the same however the chunks were scheduled
+    for(int stride = 1; stride < chunks; stride *= 2)
+        for(int c = 0; c + stride < chunks; c += 2 * stride)
+            partial[c] = combine(partial[c], partial[c + stride]);
+    return partial[0];
+}
+
+/**
+ * A set of tasks that finish together, such as the subtrees of a csg node. Outside a parallel region the tasks
+ * run in turn as they are added; inside one, they are queued for the team and @ref wait takes part in running
+ * them until all have finished.
+ */
+class TaskGroup
+{
+private:
+    bool pending;   ///< tasks have been queued since the last wait
+
+    // Make non-copyable
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+public:
+
+    TaskGroup() : pending(false) {}
+
+    /// Waits for any tasks still running
+    ~TaskGroup(){ wait(); }
+
+    /**
+     * Add a task
+     * @param work  callable run once with no arguments, copied into the task
+     */
+    template<typename Work>
+    void run(Work work)
+    {
+        if(!inParallel())
+        {
+            work();
+            return;
+        }
+        pending = true;
+        #pragma omp task firstprivate(work)
+        work();
+    }
+
+    /// Wait for every task added so far, which a parent task must do before using their results
+    void wait()
+    {
+        if(pending)
+        {
+            #pragma omp taskwait
+            pending = false;
+        }
+    }
+};
+
+/**
+ * One value per thread of the team, for scratch storage and partial results that are reduced afterwards.
+ * Slots are indexed by @ref threadIndex, so a value must not be held across a task scheduling point, where the
+ * thread may start another task that uses the same slot.
+ */
+template<typename T>
+class PerThread
+{
+private:
+    uts::vector<T> values;  ///< value of each thread
+
+public:
+
+    /**
+     * Constructor
+     * @param init  initial value of every slot
+     */
+    explicit PerThread(const T &init = T()) : values(std::max(getThreads(), 1), init) {}
+
+    /// Value of the calling thread
+    T &local(){ return values[std::min(threadIndex(), (int) values.size() - 1)]; }
+
+    /// Number of slots
+    int size() const { return (int) values.size(); }
+
+    /// Value of thread @a t, for reductions once the parallel work is done
+    T &operator[](int t){ return values[t]; }
+};
+
+} // namespace parallel
+
+#endif /* !UTS_COMMON_PARALLEL_H */
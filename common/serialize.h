@@ -4,8 +4,14 @@
  * Serialization helpers.
  */
 
+#ifndef UTS_COMMON_SERIALIZE_H
+#define UTS_COMMON_SERIALIZE_H
+
 #include <array>
 #include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <boost/version.hpp>
 #include <boost/serialization/array.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/split_free.hpp>
@@ -17,11 +23,13 @@ namespace boost
 namespace serialization
 {
 
+#if BOOST_VERSION < 105600 // later versions serialize std::array themselves
 template<typename Archive, typename T, std::size_t N>
 void serialize(Archive &ar, std::array<T, N> &a, const unsigned int)
 {
     ar & make_array(a.data(), N);
 }
+#endif
 
 #if defined(__GLIBCXX__) && defined(UTS_DEBUG_CONTAINERS)
 // This code is adapted from the Boost headers. It is probably a little fragile
@@ -76,3 +84,42 @@ inline void serialize(Archive &ar, uts::list<T, Allocator> &t,
 #endif
 
 }} // namespace boost::serialization
+
+namespace uts
+{
+
+/**
+ * Save a vector of plain data as its length followed by one contiguous block, which a binary archive writes with a
+ * single call rather than element by element when the element type is declared bitwise serializable
+ * @param ar    output archive
+ * @param v     elements to write
+ */
+template<typename Archive, typename T, typename Allocator>
+void saveArray(Archive &ar, const std::vector<T, Allocator> &v)
+{
+    uint64_t n = v.size();
+
+    ar << n;
+    if(n > 0)
+        ar << boost::serialization::make_array(v.data(), v.size());
+}
+
+/**
+ * Load a vector written by saveArray, replacing its contents
+ * @param ar        input archive
+ * @param[out] v    resized to the stored length and filled in one block
+ */
+template<typename Archive, typename T, typename Allocator>
+void loadArray(Archive &ar, std::vector<T, Allocator> &v)
+{
+    uint64_t n;
+
+    ar >> n;
+    v.resize((size_t) n);
+    if(n > 0)
+        ar >> boost::serialization::make_array(v.data(), v.size());
+}
+
+} // namespace uts
+
+#endif /* !UTS_COMMON_SERIALIZE_H */
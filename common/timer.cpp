@@ -14,6 +14,7 @@
 #include "debug_vector.h"
 #include "timer.h"
 #include "stats.h"
+#include "parallel.h"
 
 namespace stats
 {
@@ -73,18 +74,19 @@ uts::vector<std::shared_ptr<Time> > getTimes()
 void reportTimes()
 {
     const auto &times = getTimes();
+    printAlways("THREADS,", parallel::getThreads(), "\n");
     for (const auto &p : times)
     {
         if (p->times() > 0)
         {
             std::chrono::duration<double> t = p->total();
-            printAlways("TOTAL,", p->name(), ",", t.count(), ",", p->times(), "\n");
+            printAlways("TOTAL,", p->name(), ",", t.count(), ",", p->times(), ",", p->parallelTimes(), "\n");
         }
     }
 }
 
 
-Time::Time(const uts::string &name) : name_(name), ticks_(0), times_(0)
+Time::Time(const uts::string &name) : name_(name), ticks_(0), times_(0), parallelTimes_(0)
 {
 }
 
@@ -103,10 +105,17 @@ std::uint64_t Time::times() const
     return times_.load(std::memory_order_relaxed);
 }
 
+std::uint64_t Time::parallelTimes() const
+{
+    return parallelTimes_.load(std::memory_order_relaxed);
+}
+
 Time &Time::operator+=(const clock_type::duration &add)
 {
     ticks_.fetch_add(add.count(), std::memory_order_relaxed);
     times_.fetch_add(1, std::memory_order_relaxed);
+    if (parallel::inParallel())
+        parallelTimes_.fetch_add(1, std::memory_order_relaxed);
     return *this;
 }
 
@@ -25,7 +25,9 @@ typedef std::conditional<
 
 /**
  * Keeps track of total accumulated time. It supports atomic increment of
- * elapsed time.
+ * elapsed time. Samples taken inside a parallel region are also counted
+ * separately, since concurrent samples overlap and their total can exceed
+ * the wall time.
  */
 class Time
 {
@@ -38,12 +40,14 @@ public:
     const uts::string &name() const;
     clock_type::duration total() const;  ///< Total duration of all uses
     std::uint64_t times() const;         ///< Number of times called
+    std::uint64_t parallelTimes() const; ///< Number of times called inside a parallel region
     Time &operator+=(const clock_type::duration &add); ///< Add a new sample
 
 private:
     uts::string name_;
     std::atomic<clock_type::duration::rep> ticks_;
     std::atomic<std::uint64_t> times_;
+    std::atomic<std::uint64_t> parallelTimes_;
 };
 
 /**
@@ -147,9 +151,12 @@ bool isTimingEnabled();
 uts::vector<std::shared_ptr<Time> > getTimes();
 
 /**
- * Report total times for all registered timers. This function is thread-safe,
- * but it does not guarantee an atomic snapshot i.e., another thread may
- * increment some times part-way through the printout.
+ * Report total times for all registered timers, after a line giving the
+ * thread count of parallel regions. Each total is followed by the number of
+ * samples and the number of them taken inside a parallel region. This
+ * function is thread-safe, but it does not guarantee an atomic snapshot
+ * i.e., another thread may increment some times part-way through the
+ * printout.
  */
 void reportTimes();
 
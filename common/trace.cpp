@@ -0,0 +1,241 @@
+/**
+ * @file
+ *
+ * Low-overhead recording of timed events for export as a Chrome trace.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include "debug_string.h"
+#include "debug_vector.h"
+#include "timer.h"
+#include "trace.h"
+
+namespace stats
+{
+
+#ifdef UTS_TRACE_EVENTS
+
+namespace detail
+{
+
+/// Events completed on one thread, written only by that thread
+struct TraceRing
+{
+    int tid;                                ///< small sequential thread number, as shown in the trace
+    const char *lane;                       ///< name of a lane of events recorded by recordTraceEvent, NULL for a thread
+    uts::vector<TraceEvent> events;         ///< circular buffer of traceringsize events
+    std::atomic<std::uint64_t> count;       ///< events ever written, the latest at (count-1) % traceringsize
+};
+
+/// Time zero of the trace, taken when the program starts
+static const clock_type::time_point traceEpoch = clock_type::now();
+
+static uts::vector<std::unique_ptr<TraceRing> > &getTraceRings()
+{
+    // Rings are never freed, so events survive the threads that recorded them
+    static uts::vector<std::unique_ptr<TraceRing> > rings;
+    return rings;
+}
+
+static std::mutex &getTraceMutex()
+{
+    static std::mutex traceMutex;
+    return traceMutex;
+}
+
+/// Register a new ring, with the trace mutex held
+static TraceRing *addRing(const char *lane)
+{
+    std::unique_ptr<TraceRing> created(new TraceRing);
+    auto &rings = getTraceRings();
+    TraceRing *ring = created.get();
+
+    created->tid = int(rings.size()) + 1;
+    created->lane = lane;
+    created->events.resize(traceringsize);
+    created->count = 0;
+    rings.push_back(std::move(created));
+    return ring;
+}
+
+/// Ring buffer of the calling thread, registered on first use
+static TraceRing *threadRing()
+{
+    thread_local TraceRing *ring = nullptr;
+
+    if (ring == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(getTraceMutex());
+        ring = addRing(nullptr);
+    }
+    return ring;
+}
+
+/// Append a completed event to a ring, which only one thread writes at a time
+static void pushEvent(TraceRing *ring, const TraceEvent &event)
+{
+    std::uint64_t c = ring->count.load(std::memory_order_relaxed);
+
+    ring->events[c % traceringsize] = event;
+    ring->count.store(c + 1, std::memory_order_release); // publishes the event to writeTrace
+}
+
+static std::int64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - traceEpoch).count();
+}
+
+/// Write a string literal as a JSON string
+static void writeJSONString(std::ostream &out, const char *str)
+{
+    out << '"';
+    for (const char *c = str; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            out << '\\';
+        out << *c;
+    }
+    out << '"';
+}
+
+} // namespace detail
+
+TraceScope::TraceScope(const char *name, const char *argname, std::int64_t arg)
+{
+    event.name = name;
+    event.argname = argname;
+    event.arg = arg;
+    event.end = 0;
+    event.begin = detail::traceNow();
+}
+
+TraceScope::~TraceScope()
+{
+    event.end = detail::traceNow();
+    detail::pushEvent(detail::threadRing(), event);
+}
+
+bool isTracingEnabled()
+{
+    return true;
+}
+
+std::int64_t traceClock()
+{
+    return detail::traceNow();
+}
+
+void recordTraceEvent(const char *lane, const TraceEvent &event)
+{
+    detail::TraceRing *ring = nullptr;
+
+    {
+        // lanes are few and written at most a few times a frame, so a search under the lock is cheap enough
+        std::lock_guard<std::mutex> lock(detail::getTraceMutex());
+        for (const auto &r : detail::getTraceRings())
+            if (r->lane != nullptr && std::strcmp(r->lane, lane) == 0)
+                ring = r.get();
+        if (ring == nullptr)
+            ring = detail::addRing(lane);
+    }
+    detail::pushEvent(ring, event);
+}
+
+bool writeTrace(const uts::string &filename)
+{
+    std::ofstream out(filename.c_str());
+    bool first = true;
+
+    if (!out)
+    {
+        std::cerr << "Error stats::writeTrace: unable to open " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(detail::getTraceMutex());
+    out << std::fixed;
+    out.precision(3); // microseconds to the nanosecond
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (const auto &ring : detail::getTraceRings())
+    {
+        std::uint64_t n = ring->count.load(std::memory_order_acquire);
+        std::uint64_t start = (n > traceringsize) ? n - traceringsize : 0;
+
+        out << (first ? "" : ",\n");
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+        if (ring->lane != nullptr)
+            detail::writeJSONString(out, ring->lane);
+        else
+            out << "\"thread " << ring->tid << '"';
+        out << "}}";
+        first = false;
+        for (std::uint64_t i = start; i < n; i++)
+        {
+            const TraceEvent &e = ring->events[i % traceringsize];
+
+            // complete events hold both ends, so a wrapped buffer never leaves an unmatched begin or end
+            out << ",\n{\"name\":";
+            detail::writeJSONString(out, e.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->tid
+                << ",\"ts\":" << double(e.begin) * 1.0e-3 << ",\"dur\":" << double(e.end - e.begin) * 1.0e-3;
+            if (e.argname != nullptr)
+            {
+                out << ",\"args\":{";
+                detail::writeJSONString(out, e.argname);
+                out << ':' << e.arg << '}';
+            }
+            out << '}';
+        }
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out)
+    {
+        std::cerr << "Error stats::writeTrace: unable to write " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void clearTrace()
+{
+    std::lock_guard<std::mutex> lock(detail::getTraceMutex());
+    for (const auto &ring : detail::getTraceRings())
+        ring->count = 0;
+}
+
+#else
+
+bool isTracingEnabled()
+{
+    return false;
+}
+
+std::int64_t traceClock()
+{
+    return 0;
+}
+
+void recordTraceEvent(const char *lane, const TraceEvent &event)
+{
+}
+
+bool writeTrace(const uts::string &filename)
+{
+    std::cerr << "Error stats::writeTrace: built without TRACE_EVENTS, so there is nothing to write to " << filename << std::endl;
+    return false;
+}
+
+void clearTrace()
+{
+}
+
+#endif
+
+} // namespace stats
@@ -0,0 +1,115 @@
+/**
+ * @file
+ *
+ * Low-overhead recording of timed events for export as a Chrome trace.
+ *
+ * Each thread writes the events it completes into its own fixed-size ring buffer, so recording takes no locks and
+ * only the most recent events of each thread are kept. The buffers can be written out at any time as Chrome trace
+ * JSON, for viewing in chrome://tracing or Perfetto. Recording is compiled in only when UTS_TRACE_EVENTS is defined
+ * (the TRACE_EVENTS build option), and otherwise @ref UTS_TRACE_SCOPE expands to nothing.
+ */
+
+#ifndef UTS_COMMON_TRACE_H
+#define UTS_COMMON_TRACE_H
+
+#include <cstdint>
+#include "debug_string.h"
+
+namespace stats
+{
+
+const std::size_t traceringsize = 1 << 16;  ///< events kept per thread, older ones are overwritten
+
+/**
+ * A completed event, which covers the interval from its begin to its end on one thread
+ */
+struct TraceEvent
+{
+    const char * name;      ///< event name, which must be a string literal or otherwise outlive the trace
+    const char * argname;   ///< name of the optional argument, or NULL if there is none
+    std::int64_t arg;       ///< value of the optional argument, such as a node or slab index
+    std::int64_t begin;     ///< start time in nanoseconds since the trace epoch
+    std::int64_t end;       ///< end time in nanoseconds since the trace epoch
+};
+
+#ifdef UTS_TRACE_EVENTS
+
+/**
+ * Records an event covering its own lifetime on the current thread. Use through @ref UTS_TRACE_SCOPE so that it
+ * compiles out when tracing is disabled.
+ */
+class TraceScope
+{
+private:
+    TraceEvent event;
+
+    // Make non-copyable
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+public:
+    /**
+     * Begin an event
+     * @param name      event name, a string literal
+     * @param argname   name of an optional argument, a string literal, or NULL
+     * @param arg       value of the optional argument
+     */
+    explicit TraceScope(const char * name, const char * argname = nullptr, std::int64_t arg = 0);
+
+    /// End the event and add it to the ring buffer of the current thread
+    ~TraceScope();
+};
+
+#define UTS_TRACE_CAT2(a, b) a##b
+#define UTS_TRACE_CAT(a, b) UTS_TRACE_CAT2(a, b)
+
+/**
+ * Trace the rest of the enclosing scope as an event, with arguments as for @ref stats::TraceScope
+ */
+#define UTS_TRACE_SCOPE(...) stats::TraceScope UTS_TRACE_CAT(traceScope, __LINE__)(__VA_ARGS__)
+
+#else
+
+#define UTS_TRACE_SCOPE(...) do {} while (0)
+
+#endif
+
+/**
+ * Returns whether events are being recorded, which is fixed when the program is built
+ */
+bool isTracingEnabled();
+
+/**
+ * Returns the time in nanoseconds since the trace epoch, on the clock that timestamps every event, or 0 if tracing
+ * was not compiled in
+ */
+std::int64_t traceClock();
+
+/**
+ * Record an event timed by other means, such as GPU work measured by a timer query, on a named lane of its own
+ * rather than on the calling thread, so that it need not nest within the events of the thread. Each lane must be
+ * written from one thread at a time. Does nothing if tracing was not compiled in.
+ * @param lane      lane name, a string literal, shown in place of a thread name
+ * @param event     completed event, with times from @ref traceClock
+ */
+void recordTraceEvent(const char * lane, const TraceEvent &event);
+
+/**
+ * Write the events held in every thread's ring buffer as Chrome trace JSON. Best called while traced work is idle,
+ * since events that complete during the write may or may not be included, and a thread that wraps its buffer
+ * meanwhile may overwrite an event as it is read.
+ * @param filename  name of the JSON file to write
+ * @retval true  if the file was written,
+ * @retval false if it could not be, or tracing was not compiled in
+ */
+bool writeTrace(const uts::string &filename);
+
+/**
+ * Discard all recorded events, so that the next trace only covers what follows.
+ * @pre No traced scopes are open on other threads.
+ */
+void clearTrace();
+
+} // namespace stats
+
+#endif /* !UTS_COMMON_TRACE_H */
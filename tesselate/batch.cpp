@@ -0,0 +1,599 @@
+/**
+ * @file
+ *
+ * Command line driver that runs the csg, voxel, isosurface and STL export pipeline without a display.
+ */
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <chrono>
+
+#include "csg.h"
+#include "partbatch.h"
+#include "sharedgeom.h"
+#include "common/timer.h"
+#include "common/trace.h"
+#include "common/counters.h"
+#include "common/memory.h"
+#include "common/log.h"
+#include "common/parallel.h"
+#include "common/pages.h"
+
+namespace po = boost::program_options;
+
+const float batchvoxlen = 0.1f;     ///< default voxel side length, as used by the viewer
+const float batchsharetimeout = 30.0f;  ///< default seconds to wait for a shared memory consumer
+
+/**
+ * Read control point positions for a deformation lattice. The file holds the number of control points along
+ * each axis, followed by lines of "i j k x y z" giving a new position for control point (i, j, k). Control points
+ * that are not listed keep their undeformed positions.
+ * @param filename      name of lattice file
+ * @param[out] lat      lattice, framed to the default scene volume
+ * @retval true  if the file was read,
+ * @retval false otherwise
+ */
+static bool readLattice(const std::string &filename, ffd &lat)
+{
+    std::ifstream infile(filename);
+    int dx, dy, dz, i, j, k;
+    float x, y, z;
+
+    if(!(infile >> dx >> dy >> dz) || dx < 2 || dy < 2 || dz < 2)
+    {
+        std::cerr << "Error readLattice: missing or invalid lattice dimensions in " << filename << std::endl;
+        return false;
+    }
+
+    // matches the lattice the viewer places around the default scene
+    lat.setDim(dx, dy, dz);
+    lat.setFrame(cgp::Point(-10.0f, -10.0f, -10.0f), cgp::Vector(20.0f, 20.0f, 20.0f));
+    while(infile >> i >> j >> k >> x >> y >> z)
+    {
+        if(i < 0 || i >= dx || j < 0 || j >= dy || k < 0 || k >= dz)
+        {
+            std::cerr << "Error readLattice: control point (" << i << ", " << j << ", " << k << ") is outside the lattice" << std::endl;
+            return false;
+        }
+        lat.setCP(i, j, k, cgp::Point(x, y, z));
+    }
+    if(!infile.eof())
+    {
+        std::cerr << "Error readLattice: malformed control point in " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Print the occupancy and extent of a voxel volume on stdout, one "name value" line per measure
+ * @param vox   voxelised part
+ */
+static void printStats(VoxelVolume * vox)
+{
+    VoxelStats vs;
+    int dx, dy, dz;
+
+    vox->getStats(vs);
+    vox->getDim(dx, dy, dz);
+    std::cout << "voxels " << dx << " " << dy << " " << dz << '\n';
+    std::cout << "occupied " << vs.occupied << '\n';
+    std::cout << "exposed-faces " << vs.faces[0] << " " << vs.faces[1] << " " << vs.faces[2] << '\n';
+    std::cout << "volume " << vs.volume << '\n';
+    std::cout << "area " << vs.area << '\n';
+    if(vs.occupied > 0)
+    {
+        std::cout << "voxel-bounds " << vs.lo[0] << " " << vs.lo[1] << " " << vs.lo[2] << " " << vs.hi[0] << " " << vs.hi[1] << " " << vs.hi[2] << '\n';
+        std::cout << "bounds " << vs.bounds.min.x << " " << vs.bounds.min.y << " " << vs.bounds.min.z << " "
+                  << vs.bounds.max.x << " " << vs.bounds.max.y << " " << vs.bounds.max.z << '\n';
+        std::cout << "slices";
+        for(int z = vs.lo[2]; z <= vs.hi[2]; z++)
+            std::cout << " " << vs.slices[z];
+        std::cout << '\n';
+    }
+}
+
+/**
+ * Parse a band of voxel layers given as "i/n"
+ * @param text          band to parse
+ * @param[out] tile     band index i
+ * @param[out] numtiles number of bands n
+ * @retval true  if the text is a valid band,
+ * @retval false otherwise
+ */
+static bool parseTile(const std::string &text, int &tile, int &numtiles)
+{
+    char extra;
+
+    return sscanf(text.c_str(), "%d/%d%c", &tile, &numtiles, &extra) == 2 && numtiles > 0 && tile >= 0 && tile < numtiles;
+}
+
+/**
+ * Join STL files into one, as for the bands of a part extracted separately with --tile
+ * @param vm    command line options
+ * @returns exit status, 0 if every file was read and the output written
+ */
+static int mergeSTL(const po::variables_map &vm)
+{
+    STLStreamWriter out;
+    bool ok = out.open(vm["output"].as<std::string>());
+
+    for(const std::string &filename : vm["merge"].as<std::vector<std::string>>())
+    {
+        Mesh part;
+        std::vector<int> faces;
+
+        if(!part.readSTL(filename))
+        {
+            std::cerr << "Error tessbatch: unable to read " << filename << std::endl;
+            ok = false;
+            break;
+        }
+        part.getFaces(faces);
+        ok = ok && out.append(* part.getVerts(), faces);
+    }
+    if(out.isOpen() && !out.close())
+        ok = false;
+    if(!ok)
+    {
+        std::cerr << "Error tessbatch: unable to write " << vm["output"].as<std::string>() << std::endl;
+        return 1;
+    }
+    std::cerr << "tessbatch: wrote " << out.getNumTriangles() << " triangles to " << vm["output"].as<std::string>() << std::endl;
+    return 0;
+}
+
+/**
+ * Cut the part into layers and write their contours to the --slices file, reporting the layer count on stderr
+ * @param vm    command line options
+ * @param voxlen    voxel side length, the layer thickness if --layer is not given
+ * @param vox   voxelised part to slice, or NULL to slice @a mesh instead
+ * @param mesh  surface to slice when @a vox is NULL
+ * @retval true  if every layer was written,
+ * @retval false otherwise
+ */
+static bool writeSlices(const po::variables_map &vm, float voxlen, VoxelVolume * vox, Mesh * mesh)
+{
+    Slicer slicer;
+    CLISliceWriter out;
+    bool ok;
+
+    slicer.setThickness(vm.count("layer") ? vm["layer"].as<float>() : voxlen);
+    ok = out.open(vm["slices"].as<std::string>()) && ((vox != NULL) ? slicer.slice(vox, out) : mesh->slice(slicer, out));
+    if(out.isOpen() && !out.close())
+        ok = false;
+    if(!ok)
+    {
+        std::cerr << "Error tessbatch: unable to write " << vm["slices"].as<std::string>() << std::endl;
+        return false;
+    }
+    std::cerr << "tessbatch: wrote " << out.getNumLayers() << " layers of " << out.getNumContours() << " contours to "
+              << vm["slices"].as<std::string>() << std::endl;
+    return true;
+}
+
+/**
+ * Process the parts listed in a job file, reporting each one on stderr
+ * @param vm    command line options
+ * @returns exit status, 0 if every part was written
+ */
+static int runJobs(const po::variables_map &vm)
+{
+    std::vector<PartJob> jobs;
+    std::vector<PartResult> results;
+    PartBatch batch;
+    int written;
+
+    if(!PartBatch::readJobs(vm["jobs"].as<std::string>(), jobs))
+        return 1;
+    batch.setVoxelLength(vm["voxel"].as<float>());
+    batch.setDistanceField(vm.count("distance") > 0);
+    batch.setKeepLargest(vm.count("keep-largest") > 0);
+    batch.setFillVoids(vm.count("fill-voids") > 0);
+    batch.setDualSurface(vm.count("dual") > 0);
+    batch.setSmoothing(vm["smooth-iter"].as<int>(), vm["smooth-rate"].as<float>(), vm["passband"].as<float>());
+    if(vm.count("cache"))
+        batch.setCacheDirectory(vm["cache"].as<std::string>());
+    batch.setCacheCompression(vm.count("compress-cache") > 0);
+
+    auto start = std::chrono::steady_clock::now();
+    written = batch.run(jobs, results);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for(int j = 0; j < (int) jobs.size(); j++)
+        if(results[j].ok)
+            std::cerr << "tessbatch: wrote " << results[j].triangles << " triangles to " << jobs[j].output << " in " << results[j].seconds << "s" << std::endl;
+    std::cerr << "tessbatch: wrote " << written << " of " << jobs.size() << " parts in " << secs << "s" << std::endl;
+    if(vm.count("timings"))
+    {
+        stats::reportMemory("jobs");
+        stats::reportTimes();
+        stats::reportCounters();
+    }
+    if(vm.count("trace") && !stats::writeTrace(vm["trace"].as<std::string>()))
+        return 1;
+    return (written == (int) jobs.size()) ? 0 : 1;
+}
+
+static po::variables_map processOptions(int argc, const char **argv)
+{
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",                                                "Show help");
+
+    po::options_description io("Input and output");
+    io.add_options()
+        ("input,i", po::value<std::string>(),                 "Mesh to process (STL, OBJ or indexed mesh file)")
+        ("scene", po::value<std::string>(),                   "Scene file to process instead, or a built-in scene: sample or intersect")
+        ("session", po::value<std::string>(),                 "Session written by --save-session to process instead, whose isosurface, if it holds one, is written as it is after any --lattice")
+        ("merge", po::value<std::vector<std::string>>()->multitoken(), "STL files to join into --output instead, such as the bands written with --tile")
+        ("jobs", po::value<std::string>(),                    "File of \"input output\" lines instead, each a mesh or .csg scene processed as its own part, with the parts packed onto the threads")
+        ("output,o", po::value<std::string>(),                "STL file to write")
+        ("save-vdb", po::value<std::string>(),                "OpenVDB file receiving the voxelised part once voxelised, as a level set with --distance and as a bool occupancy grid otherwise, for simulation and lattice tools (needs a build with OPENVDB)")
+        ("save-session", po::value<std::string>(),            "Binary session file receiving the tree, settings, voxel volume and isosurface once the stages are done, for a later run or another process to continue from")
+        ("slices", po::value<std::string>(),                  "CLI file receiving closed contours per layer, cut from the final surface, or from the voxels themselves with --blocks or without --output, for printers that take layers")
+        ("layer", po::value<float>(),                         "Layer thickness for --slices, the voxel side length if not given")
+        ("stats",                                             "Print the occupied voxel count, volume, exposed surface area, bounds and per-layer occupancy of the voxelised part on stdout, without writing a mesh if --output is not given")
+        ("share-mesh", po::value<std::string>(),              "Shared memory segment to publish the final surface into, in indexed mesh file layout, for another process on the machine to use in place, with or without --output")
+        ("share-voxels", po::value<std::string>(),            "Shared memory segment to publish the voxelised part into once voxelised, in binary voxel file layout")
+        ("share-timeout", po::value<float>()->default_value(batchsharetimeout), "Seconds to wait for the consumer of a shared memory segment to release what was last published into it")
+        ("cache", po::value<std::string>(),                   "Directory for cached stage results")
+        ("compress-cache",                                    "Cache meshes quantised and compressed, several times smaller but with positions rounded to 16 bits of the bounding box");
+    desc.add(io);
+
+    po::options_description stages("Pipeline options");
+    stages.add_options()
+        ("voxel", po::value<float>()->default_value(batchvoxlen), "Voxel side length")
+        ("fit-voxel",                                         "Choose the finest voxel side length predicted, from coarse samples of the part, to voxelise and extract the surface within --time-budget and --memory-budget, instead of --voxel")
+        ("time-budget", po::value<float>()->default_value(0.0f), "Seconds that --fit-voxel allows for voxelising and extracting the surface, 0 for no limit")
+        ("distance",                                          "Voxelise to signed distances, for an accurate surface from coarser voxels")
+        ("dual",                                              "Extract a surface with one vertex per surface cell, by surface nets, or by dual contouring with --distance, giving about half the triangles of marching cubes")
+        ("gpu",                                               "Voxelise on an OpenCL device when one is present, falling back to the CPU otherwise")
+        ("out-of-core",                                       "Voxelise and extract the surface a slab at a time, writing triangles as each slab is done, for parts whose volume does not fit in memory")
+        ("tile", po::value<std::string>(),                    "With --out-of-core, extract only band i of n equal bands of voxel layers, given as i/n, so that n processes or machines share the part")
+        ("blocks",                                            "Write the exposed faces of the voxels as cubes instead of the isosurface, streamed a few layers at a time")
+        ("voxel-file", po::value<std::string>(),              "Voxelise into this run-length compressed file a slab at a time and extract the surface from it, so the full volume is never held")
+        ("keep-largest",                                      "Drop every disconnected island of voxels but the largest before extracting the surface")
+        ("fill-voids",                                        "Fill voids trapped inside the part before extracting the surface")
+        ("smooth-iter", po::value<int>()->default_value(smoothiter), "Taubin shrink and inflate pairs, 0 to skip smoothing")
+        ("smooth-rate", po::value<float>()->default_value(smoothrate), "Taubin shrinking factor")
+        ("passband", po::value<float>()->default_value(taubinpassband), "Taubin pass-band frequency")
+        ("lattice", po::value<std::string>(),                 "Deformation lattice file to apply after smoothing");
+    desc.add(stages);
+
+    po::options_description profile("Profiling options");
+    profile.add_options()
+        ("timings",                                           "Time each stage and report totals and call counts on stdout, with current and peak memory after each stage, and query counts if built with QUERY_COUNTERS")
+        ("threads", po::value<int>()->default_value(0),       "Threads for parallel stages, 0 for one per hardware thread")
+        ("memory-budget", po::value<float>()->default_value(0.0f), "Megabytes the voxeliser may plan to hold, 0 for no limit")
+        ("numa", po::value<std::string>()->default_value("first-touch"), "Placement of large volumes over NUMA nodes: local, first-touch (zeroed by the threads that sweep them) or interleave")
+        ("huge-pages", po::value<std::string>()->default_value("transparent"), "Page size of large volumes and meshes: off, transparent or explicit (the reserved pool, else transparent)")
+        ("trace", po::value<std::string>(),                   "Chrome trace JSON file of per-thread events, if built with TRACE_EVENTS");
+    desc.add(profile);
+
+    po::options_description diag("Diagnostic options");
+    diag.add_options()
+        ("log-level", po::value<std::string>()->default_value("info"), "Most detailed messages shown: error, warning, info or debug")
+        ("log-modules", po::value<std::string>()->default_value("all"), "Comma-separated modules whose messages are shown: mesh, csg, voxels, render, or all");
+    desc.add(diag);
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+                  .options(desc)
+                  .run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help"))
+        {
+            std::cout << desc << '\n';
+            exit(0);
+        }
+        if (vm.count("merge"))
+        {
+            if (!vm.count("output") || vm.count("input") || vm.count("scene") || vm.count("session") || vm.count("jobs") || vm.count("stats") || vm.count("save-session") || vm.count("slices"))
+                throw po::error("--merge joins existing STL files into --output, so it needs --output and cannot be combined with --input, --scene, --session, --jobs, --stats, --save-session or --slices");
+        }
+        else if (vm.count("jobs"))
+        {
+            if (vm.count("input") || vm.count("scene") || vm.count("session") || vm.count("output") || vm.count("stats") || vm.count("save-session") || vm.count("slices"))
+                throw po::error("--jobs names the input and output of every part, so it cannot be combined with --input, --scene, --session, --output, --stats, --save-session or --slices");
+            if (vm.count("out-of-core") || vm.count("blocks") || vm.count("voxel-file") || vm.count("lattice") || vm.count("gpu"))
+                throw po::error("--jobs extracts and smooths the isosurface of each part, so it cannot be combined with --out-of-core, --blocks, --voxel-file, --lattice or --gpu");
+        }
+        else if (vm.count("input") + vm.count("scene") + vm.count("session") != 1 || !(vm.count("output") || vm.count("stats") || vm.count("slices") || vm.count("share-mesh") || vm.count("share-voxels")))
+            throw po::error("exactly one of --input, --scene, --session or --jobs, and --output, --stats, --slices, --share-mesh or --share-voxels, are required");
+        if (vm["voxel"].as<float>() <= 0.0f)
+            throw po::error("--voxel must be positive");
+        if (vm.count("out-of-core") && (vm.count("voxel-file") || vm.count("distance") || vm.count("lattice") || vm["smooth-iter"].as<int>() > 0))
+            throw po::error("--out-of-core writes the raw isosurface, so it needs --smooth-iter 0 and cannot be combined with --voxel-file, --distance or --lattice");
+        if (vm.count("blocks") && (vm.count("out-of-core") || vm.count("voxel-file") || vm.count("distance") || vm.count("lattice")))
+            throw po::error("--blocks writes voxel cubes, so it cannot be combined with --out-of-core, --voxel-file, --distance or --lattice");
+        if (vm.count("voxel-file") && vm.count("distance"))
+            throw po::error("--voxel-file holds occupancy only and cannot be combined with --distance");
+        if ((vm.count("keep-largest") || vm.count("fill-voids")) && (vm.count("out-of-core") || vm.count("voxel-file") || vm.count("distance")))
+            throw po::error("--keep-largest and --fill-voids clean the whole occupancy volume, so they cannot be combined with --out-of-core, --voxel-file or --distance");
+        if (vm.count("dual") && (vm.count("out-of-core") || vm.count("voxel-file") || vm.count("blocks")))
+            throw po::error("--dual extracts from the whole volume, so it cannot be combined with --out-of-core, --voxel-file or --blocks");
+        if (vm.count("stats") && (vm.count("out-of-core") || vm.count("voxel-file")))
+            throw po::error("--stats measures the whole voxel volume, so it cannot be combined with --out-of-core or --voxel-file");
+        if (vm.count("save-vdb") && (vm.count("out-of-core") || vm.count("voxel-file") || vm.count("jobs")))
+            throw po::error("--save-vdb writes the whole voxel volume, so it cannot be combined with --out-of-core, --voxel-file or --jobs");
+        if (vm.count("share-mesh") && (vm.count("merge") || vm.count("jobs") || vm.count("out-of-core") || vm.count("blocks")))
+            throw po::error("--share-mesh publishes the whole final surface of one part, so it cannot be combined with --merge, --jobs, --out-of-core or --blocks");
+        if (vm.count("share-voxels") && (vm.count("merge") || vm.count("jobs") || vm.count("out-of-core") || vm.count("voxel-file")))
+            throw po::error("--share-voxels publishes the whole voxel volume of one part, so it cannot be combined with --merge, --jobs, --out-of-core or --voxel-file");
+        if (vm.count("save-session") && (vm.count("out-of-core") || vm.count("voxel-file") || vm.count("blocks")))
+            throw po::error("--save-session needs the whole volume and isosurface, so it cannot be combined with --out-of-core, --voxel-file or --blocks");
+        if (vm.count("slices") && (vm.count("out-of-core") || vm.count("voxel-file")))
+            throw po::error("--slices cuts the whole surface or volume, so it cannot be combined with --out-of-core or --voxel-file");
+        if (vm.count("layer") && (!vm.count("slices") || vm["layer"].as<float>() <= 0.0f))
+            throw po::error("--layer needs --slices and must be positive");
+        int tile, numtiles;
+        if (vm.count("tile") && (!vm.count("out-of-core") || !parseTile(vm["tile"].as<std::string>(), tile, numtiles)))
+            throw po::error("--tile needs --out-of-core and a band i/n with 0 <= i < n");
+        if (vm["memory-budget"].as<float>() < 0.0f)
+            throw po::error("--memory-budget must not be negative");
+        if (vm["time-budget"].as<float>() < 0.0f)
+            throw po::error("--time-budget must not be negative");
+        if (vm.count("fit-voxel") && (vm.count("jobs") || vm.count("session") || vm.count("merge") || (vm["time-budget"].as<float>() == 0.0f && vm["memory-budget"].as<float>() == 0.0f)))
+            throw po::error("--fit-voxel samples a single part against --time-budget or --memory-budget, so it needs one of them and cannot be combined with --jobs, --session or --merge");
+        if (vm["threads"].as<int>() < 0)
+            throw po::error("--threads must not be negative");
+        parallel::PagePlacement placement;
+        if (!parallel::parsePagePlacement(vm["numa"].as<std::string>(), placement))
+            throw po::error("--numa must be one of local, first-touch or interleave");
+        parallel::setPagePlacement(placement);
+        parallel::HugePages huge;
+        if (!parallel::parseHugePages(vm["huge-pages"].as<std::string>(), huge))
+            throw po::error("--huge-pages must be one of off, transparent or explicit");
+        parallel::setHugePages(huge);
+        stats::LogLevel level;
+        if (!stats::parseLogLevel(vm["log-level"].as<std::string>(), level))
+            throw po::error("--log-level must be one of error, warning, info or debug");
+        stats::setLogLevel(level);
+        if (!stats::setLogModules(vm["log-modules"].as<std::string>()))
+            throw po::error("--log-modules must list mesh, csg, voxels or render, or be all");
+        return vm;
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\n\n" << desc << '\n';
+        std::exit(1);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    po::variables_map vm = processOptions(argc, argv);
+    Scene scene;
+    ffd lat;
+
+    parallel::setThreads(vm["threads"].as<int>());
+    if(vm.count("timings"))
+        stats::enableTimers(true);
+    stats::setMemoryBudget((size_t) (vm["memory-budget"].as<float>() * 1024.0f * 1024.0f));
+    if(vm.count("cache"))
+        scene.setCacheDirectory(vm["cache"].as<std::string>());
+    scene.setCacheCompression(vm.count("compress-cache") > 0);
+    scene.setStreamCSG(true); // only the final volume is needed, and no coarse grid is written alongside it
+    if(vm.count("merge"))
+        return mergeSTL(vm);
+    if(vm.count("jobs"))
+        return runJobs(vm);
+
+    if(vm.count("input"))
+    {
+        if(!scene.loadSTLScene(vm["input"].as<std::string>()))
+        {
+            std::cerr << "Error tessbatch: unable to read " << vm["input"].as<std::string>() << std::endl;
+            return 1;
+        }
+    }
+    else if(vm.count("session"))
+    {
+        if(!scene.readSession(vm["session"].as<std::string>()))
+            return 1;
+    }
+    else if(vm["scene"].as<std::string>() == "sample")
+        scene.sampleScene();
+    else if(vm["scene"].as<std::string>() == "intersect")
+        scene.intersectScene();
+    else if(!scene.readSceneFile(vm["scene"].as<std::string>()))
+        return 1;
+    if(vm.count("distance"))
+        scene.setDistanceField(true);
+    if(vm.count("gpu"))
+        scene.setGPUVoxelise(true);
+    scene.setKeepLargest(vm.count("keep-largest") > 0);
+    scene.setFillVoids(vm.count("fill-voids") > 0);
+    scene.setDualSurface(vm.count("dual") > 0);
+    if(vm.count("lattice") && !readLattice(vm["lattice"].as<std::string>(), lat))
+        return 1;
+
+    float voxlen = vm["voxel"].as<float>();
+    if(vm.count("fit-voxel"))
+    {
+        ResolutionEstimate est;
+
+        if(!scene.tuneResolution(vm["time-budget"].as<float>(), stats::getMemoryBudget(), est))
+            return 1;
+        voxlen = est.voxlen;
+        std::cerr << "tessbatch: voxel size " << voxlen << " is predicted to take " << est.seconds << "s and "
+                  << est.bytes / (1024 * 1024) << "MB for " << est.triangles << " triangles" << std::endl;
+    }
+
+    // each stage starts new memory peaks, so that the report after it covers that stage alone
+    auto stageDone = [&](const char * stage){ if(vm.count("timings")) stats::reportMemory(stage); stats::resetMemoryPeaks(); };
+    auto saveVDB = [&](){ return !vm.count("save-vdb") || scene.writeVDB(vm["save-vdb"].as<std::string>()); };
+    auto shareVoxels = [&]()
+    {
+        SharedGeometryWriter shared;
+        return !vm.count("share-voxels") || (shared.open(vm["share-voxels"].as<std::string>()) && shared.publish(scene.getVox(), vm["share-timeout"].as<float>()));
+    };
+    stats::resetMemoryPeaks();
+    if(!vm.count("output") && !vm.count("share-mesh")) // only the statistics or voxels are wanted, so there is no surface to extract
+    {
+        if(!scene.voxelise(voxlen) || !saveVDB() || !shareVoxels())
+            return 1;
+        stageDone("voxelise");
+        if(vm.count("stats") || !(vm.count("slices") || vm.count("share-voxels")))
+            printStats(scene.getVox());
+        if(vm.count("slices"))
+        {
+            if(!writeSlices(vm, voxlen, scene.getVox(), NULL))
+                return 1;
+            stageDone("slice");
+        }
+        if(vm.count("save-session") && !scene.writeSession(vm["save-session"].as<std::string>()))
+            return 1;
+        if(vm.count("timings"))
+        {
+            stats::reportTimes();
+            stats::reportCounters();
+        }
+        if(vm.count("trace") && !stats::writeTrace(vm["trace"].as<std::string>()))
+            return 1;
+        return 0;
+    }
+    if(vm.count("out-of-core")) // the mesh is never held, so it goes straight to the output
+    {
+        STLStreamWriter out;
+        bool ok = out.open(vm["output"].as<std::string>());
+        int tile = 0, numtiles = 1;
+
+        if(vm.count("tile"))
+            parseTile(vm["tile"].as<std::string>(), tile, numtiles);
+        ok = ok && scene.extractSlabs(voxlen, [&out](const std::vector<cgp::Point> &verts, const std::vector<int> &faces){ return out.append(verts, faces); },
+                                      tile, numtiles);
+        if(out.isOpen() && !out.close())
+            ok = false;
+        if(!ok)
+        {
+            std::cerr << "Error tessbatch: unable to write " << vm["output"].as<std::string>() << std::endl;
+            return 1;
+        }
+        stageDone("isoextract");
+        std::cerr << "tessbatch: wrote " << out.getNumTriangles() << " triangles to " << vm["output"].as<std::string>() << std::endl;
+        if(vm.count("timings"))
+        {
+            stats::reportTimes();
+            stats::reportCounters();
+        }
+        if(vm.count("trace") && !stats::writeTrace(vm["trace"].as<std::string>()))
+            return 1;
+        return 0;
+    }
+    if(vm.count("blocks")) // cubes need no isosurface or smoothing, so the mesher writes them as it goes
+    {
+        VoxelMesher mesher;
+        STLStreamWriter out;
+        bool ok;
+
+        if(!scene.voxelise(voxlen) || !saveVDB() || !shareVoxels())
+            return 1;
+        stageDone("voxelise");
+        if(vm.count("stats"))
+            printStats(scene.getVox());
+        ok = out.open(vm["output"].as<std::string>()) && mesher.extract(scene.getVox(), out);
+        if(out.isOpen() && !out.close())
+            ok = false;
+        if(!ok)
+        {
+            std::cerr << "Error tessbatch: unable to write " << vm["output"].as<std::string>() << std::endl;
+            return 1;
+        }
+        stageDone("blocks");
+        std::cerr << "tessbatch: wrote " << out.getNumTriangles() << " triangles to " << vm["output"].as<std::string>() << std::endl;
+        if(vm.count("slices"))
+        {
+            if(!writeSlices(vm, voxlen, scene.getVox(), NULL))
+                return 1;
+            stageDone("slice");
+        }
+        if(vm.count("timings"))
+        {
+            stats::reportTimes();
+            stats::reportCounters();
+        }
+        if(vm.count("trace") && !stats::writeTrace(vm["trace"].as<std::string>()))
+            return 1;
+        return 0;
+    }
+    if(!vm.count("session") || scene.getRep() != SceneRep::ISOSURFACE) // otherwise carry on from where the session was saved
+    {
+        if(vm.count("voxel-file"))
+        {
+            if(!scene.voxeliseToFile(voxlen, vm["voxel-file"].as<std::string>()))
+                return 1;
+            stageDone("voxelise");
+            if(!scene.isoextractFile(vm["voxel-file"].as<std::string>()))
+                return 1;
+        }
+        else
+        {
+            if(!scene.voxelise(voxlen) || !saveVDB() || !shareVoxels())
+                return 1;
+            stageDone("voxelise");
+            if(vm.count("stats"))
+                printStats(scene.getVox());
+            scene.isoextract();
+        }
+        stageDone("isoextract");
+        if(vm["smooth-iter"].as<int>() > 0)
+        {
+            scene.setSmoothing(vm["smooth-iter"].as<int>(), vm["smooth-rate"].as<float>(), vm["passband"].as<float>());
+            scene.smooth();
+            stageDone("smooth");
+        }
+    }
+    if(vm.count("lattice"))
+    {
+        scene.deform(&lat);
+        stageDone("deform");
+    }
+
+    if(vm.count("save-session") && !scene.writeSession(vm["save-session"].as<std::string>()))
+        return 1;
+    if(scene.getMesh()->getNumFaces() == 0)
+    {
+        std::cerr << "Error tessbatch: the isosurface is empty" << std::endl;
+        return 1;
+    }
+    if(vm.count("output"))
+    {
+        if(!scene.getMesh()->writeSTL(vm["output"].as<std::string>()))
+        {
+            std::cerr << "Error tessbatch: unable to write " << vm["output"].as<std::string>() << std::endl;
+            return 1;
+        }
+        std::cerr << "tessbatch: wrote " << scene.getMesh()->getNumFaces() << " triangles to " << vm["output"].as<std::string>() << std::endl;
+    }
+    if(vm.count("share-mesh"))
+    {
+        SharedGeometryWriter shared;
+
+        if(!shared.open(vm["share-mesh"].as<std::string>()) || !shared.publish(scene.getMesh(), vm["share-timeout"].as<float>()))
+            return 1;
+        std::cerr << "tessbatch: published " << scene.getMesh()->getNumFaces() << " triangles to " << vm["share-mesh"].as<std::string>() << std::endl;
+    }
+    if(vm.count("slices"))
+    {
+        if(!writeSlices(vm, voxlen, NULL, scene.getMesh()))
+            return 1;
+        stageDone("slice");
+    }
+    if(vm.count("timings"))
+    {
+        stats::reportTimes();
+        stats::reportCounters();
+    }
+    if(vm.count("trace") && !stats::writeTrace(vm["trace"].as<std::string>()))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,580 @@
+/**
+ * @file
+ *
+ * Command line benchmark driver that times the main pipeline kernels on synthetic volumes of chosen sizes and on
+ * triangle meshes, and writes the results to a CSV file so that runs can be compared.
+ */
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "csg.h"
+#include "mortonvol.h"
+#include "common/timer.h"
+#include "common/parallel.h"
+
+namespace po = boost::program_options;
+
+const int benchcontainlayers = 8;       ///< z layers of voxel centres used as containment queries, to bound their cost
+const float benchsphereradius = 0.8f;   ///< radius of the synthetic sphere, in a volume spanning [-1, 1] on each axis
+const float benchtorusmajor = 0.55f;    ///< distance from the synthetic torus centre to its tube centre
+const float benchtorusminor = 0.25f;    ///< radius of the synthetic torus tube
+const float benchsamplespan = 20.0f;    ///< extent of the sample scene, divided by the size to give its voxel length
+const int benchpickgrid = 32;           ///< targets along each side of the grid of picking rays cast at a mesh
+const int benchscangrid = 128;          ///< voxel rows along each side of the layer grid scanned through a mesh
+const int benchsplinegrid = 16;         ///< control points along each side of the B-spline lattice deforming a mesh
+
+/// Timings of one benchmark on one input
+struct BenchResult
+{
+    std::string name;       ///< benchmark name
+    std::string input;      ///< input name, such as sphere128 or bunny.stl
+    long long items;        ///< work items per run, such as voxels, queries or triangles
+    int repeats;            ///< number of timed runs
+    double best;            ///< fastest run in seconds
+    double mean;            ///< mean run in seconds
+};
+
+/// Runs benchmarks and collects their results
+class BenchRunner
+{
+private:
+    int repeats;                        ///< timed runs per benchmark
+    std::string filter;                 ///< only benchmarks whose name contains this are run
+    std::vector<BenchResult> results;   ///< results in the order the benchmarks ran
+
+public:
+    BenchRunner(int numrepeats, const std::string &namefilter){ repeats = numrepeats; filter = namefilter; }
+
+    /// Whether a benchmark of this name passes the filter, so that its inputs are worth preparing
+    bool wanted(const std::string &name){ return name.find(filter) != std::string::npos; }
+
+    /**
+     * Time a benchmark, with untimed preparation before every run
+     * @param name      benchmark name
+     * @param input     input name
+     * @param items     work items per run
+     * @param setup     restores the input to its starting state before each run
+     * @param body      the work being timed
+     */
+    void run(const std::string &name, const std::string &input, long long items,
+             const std::function<void()> &setup, const std::function<void()> &body)
+    {
+        BenchResult res;
+        double total = 0.0;
+
+        if(!wanted(name))
+            return;
+        res.name = name; res.input = input; res.items = items; res.repeats = repeats;
+        res.best = std::numeric_limits<double>::max();
+        for(int r = 0; r < repeats; r++)
+        {
+            setup();
+            auto start = stats::clock_type::now();
+            body();
+            double elapsed = std::chrono::duration<double>(stats::clock_type::now() - start).count();
+            res.best = std::min(res.best, elapsed);
+            total += elapsed;
+        }
+        res.mean = total / (double) repeats;
+        std::cerr << "tessbench: " << name << " on " << input << " best " << res.best << "s" << std::endl;
+        results.push_back(res);
+    }
+
+    /// Time a benchmark that needs no preparation between runs
+    void run(const std::string &name, const std::string &input, long long items, const std::function<void()> &body)
+    {
+        run(name, input, items, [](){}, body);
+    }
+
+    /**
+     * Write results as CSV, one row per benchmark and input
+     * @param out   stream to write to
+     */
+    void write(std::ostream &out)
+    {
+        out << "benchmark,input,items,repeats,best_s,mean_s,items_per_s\n";
+        for(const BenchResult &res: results)
+            out << res.name << ',' << res.input << ',' << res.items << ',' << res.repeats << ','
+                << res.best << ',' << res.mean << ',' << (res.best > 0.0 ? (double) res.items / res.best : 0.0) << '\n';
+    }
+};
+
+/**
+ * Occupy voxels whose centres lie between two x positions in a row
+ * @param vox       volume to fill
+ * @param x0, x1    world space x range
+ * @param y, z      row index
+ */
+static void fillWorldSpan(VoxelVolume * vox, float x0, float x1, int y, int z)
+{
+    float first = vox->getVoxelPos(0, y, z).x, cell = vox->getVoxelPos(1, y, z).x - first;
+    int xstart = (int) std::ceil((x0 - first) / cell);
+    int xend = (int) std::floor((x1 - first) / cell) + 1;
+
+    if(xstart < xend)
+        vox->setSpan(xstart, xend, y, z, true);
+}
+
+/**
+ * Fill a cubic volume spanning [-1, 1] on each axis with a sphere or a torus, a span at a time
+ * @param vox       volume, already sized and framed
+ * @param torus     fill with a torus about the z axis, rather than a sphere
+ */
+static void fillSynthetic(VoxelVolume * vox, bool torus)
+{
+    int dx, dy, dz;
+
+    vox->getDim(dx, dy, dz);
+    vox->fill(false);
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = 0; z < dz; z++)
+        for(int y = 0; y < dy; y++)
+        {
+            cgp::Point c = vox->getVoxelPos(0, y, z);
+            if(!torus)
+            {
+                float rsq = benchsphereradius * benchsphereradius - c.y * c.y - c.z * c.z;
+                if(rsq >= 0.0f)
+                    fillWorldSpan(vox, -std::sqrt(rsq), std::sqrt(rsq), y, z);
+            }
+            else if(std::fabs(c.z) <= benchtorusminor)
+            {
+                // the tube is crossed where the distance from the z axis is within a of the major radius
+                float a = std::sqrt(benchtorusminor * benchtorusminor - c.z * c.z);
+                float inner = std::max(benchtorusmajor - a, 0.0f), outer = benchtorusmajor + a;
+                float hisq = outer * outer - c.y * c.y, losq = inner * inner - c.y * c.y;
+                if(hisq < 0.0f)
+                    continue;
+                if(losq <= 0.0f)
+                    fillWorldSpan(vox, -std::sqrt(hisq), std::sqrt(hisq), y, z);
+                else
+                {
+                    fillWorldSpan(vox, -std::sqrt(hisq), -std::sqrt(losq), y, z);
+                    fillWorldSpan(vox, std::sqrt(losq), std::sqrt(hisq), y, z);
+                }
+            }
+        }
+}
+
+/// Copy every row of a volume into packed words
+static void saveRows(VoxelVolume * vox, std::vector<unsigned int> &words)
+{
+    int dx, dy, dz, xspan = vox->getXSpan();
+
+    vox->getDim(dx, dy, dz);
+    words.resize((size_t) xspan * dy * dz);
+    for(int z = 0; z < dz; z++)
+        for(int y = 0; y < dy; y++)
+            vox->getRow(y, z, &words[((size_t) z * dy + y) * xspan]);
+}
+
+/// Restore every row of a volume from words saved by saveRows
+static void restoreRows(VoxelVolume * vox, const std::vector<unsigned int> &words)
+{
+    int dx, dy, dz, xspan = vox->getXSpan();
+
+    vox->getDim(dx, dy, dz);
+    for(int z = 0; z < dz; z++)
+        for(int y = 0; y < dy; y++)
+            vox->setRow(y, z, &words[((size_t) z * dy + y) * xspan]);
+}
+
+/**
+ * Centres of the voxels in a few layers through the middle of a volume, as containment queries
+ * @param vox       volume giving the voxel centres
+ * @param[out] pts  query points
+ */
+static void containmentQueries(VoxelVolume * vox, std::vector<cgp::Point> &pts)
+{
+    int dx, dy, dz;
+
+    vox->getDim(dx, dy, dz);
+    int layers = std::min(dz, benchcontainlayers), zstart = (dz - layers) / 2;
+    pts.clear();
+    for(int z = zstart; z < zstart + layers; z++)
+        for(int y = 0; y < dy; y++)
+            for(int x = 0; x < dx; x++)
+                pts.push_back(vox->getVoxelPos(x, y, z));
+}
+
+/**
+ * Time batch containment queries against a shape
+ * @param bench     collects the results
+ * @param shape     shape to query
+ * @param name      benchmark name
+ * @param input     input name
+ * @param pts       query points
+ */
+static void benchContainment(BenchRunner &bench, BaseShape * shape, const std::string &name,
+                             const std::string &input, const std::vector<cgp::Point> &pts)
+{
+    std::vector<uint8_t> inside(pts.size());
+
+    if(!bench.wanted(name))
+        return;
+    shape->pointContainment(cgp::Point(0.0f, 0.0f, 0.0f)); // any acceleration structure is built outside the timing
+    bench.run(name, input, (long long) pts.size(), [&](){ shape->containment(pts.data(), pts.size(), inside.data()); });
+}
+
+/**
+ * Time the mesh kernels that do not depend on where the mesh came from
+ * @param bench     collects the results
+ * @param mesh      mesh, which is left deformed
+ * @param input     input name
+ * @param tmpdir    directory for the written STL file
+ */
+static void benchMesh(BenchRunner &bench, Mesh * mesh, const std::string &input, const std::string &tmpdir)
+{
+    std::vector<cgp::Point> base = * mesh->getVerts(), soupverts;
+    std::vector<Triangle> basetris = * mesh->getCubeTriangles(), souptris;
+    cgp::BoundBox bbox;
+    long long numtris = (long long) basetris.size();
+
+    // unshared vertices, as read from a triangle soup, for welding
+    for(const Triangle &t: basetris)
+    {
+        Triangle s;
+        for(int i = 0; i < 3; i++)
+        {
+            s.v[i] = (int) soupverts.size();
+            soupverts.push_back(base[t.v[i]]);
+        }
+        souptris.push_back(s);
+    }
+    auto restore = [&](){ * mesh->getVerts() = base; * mesh->getCubeTriangles() = basetris; };
+
+    bench.run("mergeVerts", input, numtris, [&](){ * mesh->getVerts() = soupverts; * mesh->getCubeTriangles() = souptris; },
+              [&](){ mesh->mergeAllVerts(); });
+    bench.run("laplacianSmooth", input, numtris, restore, [&](){ mesh->laplacianSmooth(smoothiter, smoothrate); });
+
+    // alternate between two lattices, so that every run moves every vertex
+    restore();
+    mesh->getBounds(bbox);
+    ffd lat(4, 4, 4, bbox.min, bbox.getDiag());
+    int run = 0;
+    bench.run("applyFFD", input, (long long) base.size(), [&](){
+            lat.reset();
+            cgp::Point cp = lat.getCP(1, 2, 2);
+            cp.x += (run++ % 2 == 0 ? 0.1f : -0.1f) * bbox.getDiag().i;
+            lat.setCP(1, 2, 2, cp);
+        }, [&](){ mesh->applyFFD(&lat); });
+
+    // a fine B-spline lattice, where moving one control point only reaches the vertices in the cells around it
+    ffd finelat(benchsplinegrid, benchsplinegrid, benchsplinegrid, bbox.min, bbox.getDiag(), true);
+    restore();
+    bench.run("applyFFDBSpline", input, (long long) base.size(), [&](){
+            finelat.reset();
+            cgp::Point cp = finelat.getCP(benchsplinegrid / 2, benchsplinegrid / 2, benchsplinegrid / 2);
+            cp.x += (run++ % 2 == 0 ? 0.1f : -0.1f) * bbox.getDiag().i;
+            finelat.setCP(benchsplinegrid / 2, benchsplinegrid / 2, benchsplinegrid / 2, cp);
+        }, [&](){ mesh->applyFFD(&finelat); });
+
+    // picking rays from beyond a corner of the bounds to a grid of targets across them, as mouse picks would be cast
+    restore();
+    std::vector<cgp::Point> targets;
+    cgp::Vector diag = bbox.getDiag();
+    cgp::Point eye(bbox.max.x + diag.i, bbox.max.y + diag.j, bbox.max.z + diag.k);
+    MeshPick pick;
+    long long picked = 0;
+    for(int v = 0; v < benchpickgrid; v++)
+        for(int u = 0; u < benchpickgrid; u++)
+            targets.push_back(cgp::Point(bbox.min.x + diag.i * (u + 0.5f) / benchpickgrid, bbox.min.y + diag.j * (v + 0.5f) / benchpickgrid,
+                                         bbox.min.z + 0.5f * diag.k));
+    mesh->pickRay(eye, cgp::Vector(-1.0f, -1.0f, -1.0f), pick); // the hierarchy is built outside the timing
+    bench.run("pickRay", input, (long long) targets.size(), [&](){
+            for(const cgp::Point &t: targets)
+                picked += mesh->pickRay(eye, cgp::Vector(t.x - eye.x, t.y - eye.y, t.z - eye.z), pick) ? 1 : 0;
+        });
+    if(picked < 0)
+        std::cerr << "tessbench: invalid pick count" << std::endl;
+
+    // parity rays along every row of a volume across the bounds, one at a time and in packets
+    VoxelVolume rows(benchscangrid, benchscangrid, benchscangrid, bbox.min, diag);
+    std::vector<int> spans[bvhpacket];
+    long long spancount = 0;
+    bench.run("scanRow", input, (long long) benchscangrid * benchscangrid, [&](){
+            for(int z = 0; z < benchscangrid; z++)
+                for(int y = 0; y < benchscangrid; y++)
+                {
+                    mesh->scanRow(&rows, bbox, y, z, spans[0]);
+                    spancount += (long long) spans[0].size();
+                }
+        });
+    bench.run("scanRows", input, (long long) benchscangrid * benchscangrid, [&](){
+            for(int z = 0; z < benchscangrid; z++)
+                for(int y = 0; y < benchscangrid; y += bvhpacket)
+                {
+                    mesh->scanRows(&rows, bbox, y, z, std::min(bvhpacket, benchscangrid - y), spans);
+                    spancount += (long long) spans[0].size();
+                }
+        });
+    if(spancount < 0)
+        std::cerr << "tessbench: invalid span count" << std::endl;
+
+    std::string stlfile = (boost::filesystem::path(tmpdir) / boost::filesystem::unique_path("tessbench-%%%%%%%%.stl")).string();
+    Mesh readback;
+    restore();
+    bench.run("writeSTL", input, numtris, [&](){ mesh->writeSTL(stlfile); });
+    bench.run("readSTL", input, numtris, [&](){ readback.readSTL(stlfile); });
+    boost::filesystem::remove(stlfile);
+}
+
+/**
+ * Sum the marching cubes corner codes of every cell, so that the queries are not optimised away
+ * @param vox           volume in either layout
+ * @param dx, dy, dz    volume dimensions
+ * @returns sum of the codes
+ */
+template <typename Volume> static long long sumCellCodes(Volume * vox, int dx, int dy, int dz)
+{
+    long long sum = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:sum)
+    for(int z = 0; z < dz-1; z++)
+        for(int y = 0; y < dy-1; y++)
+            for(int x = 0; x < dx-1; x++)
+                sum += vox->getMCVertIdx(x, y, z);
+    return sum;
+}
+
+/**
+ * Time cell and neighbourhood queries on the flat row layout against the same voxels in Morton ordered bricks
+ * @param bench     collects the results
+ * @param vox       filled volume
+ * @param input     input name
+ */
+static void benchLayouts(BenchRunner &bench, VoxelVolume * vox, const std::string &input)
+{
+    MortonVolume morton;
+    std::vector<int> cells;
+    int dx, dy, dz;
+    long long numvox, codes = 0;
+
+    vox->getDim(dx, dy, dz);
+    numvox = (long long) dx * dy * dz;
+    bench.run("mortonConvert", input, numvox, [&](){ morton.fromVolume(vox); });
+    morton.fromVolume(vox);
+
+    // per-cell corner codes, which gather from four rows in the flat layout and mostly from one word in bricks
+    bench.run("cellCodes rows", input, numvox, [&](){ codes += sumCellCodes(vox, dx, dy, dz); });
+    bench.run("cellCodes morton", input, numvox, [&](){ codes += sumCellCodes(&morton, dx, dy, dz); });
+    bench.run("shellVoxels rows", input, numvox, [&](){ vox->getShellVoxels(cells); });
+    bench.run("shellVoxels morton", input, numvox, [&](){ morton.getShellVoxels(cells); });
+    if(codes < 0)
+        std::cerr << "tessbench: invalid cell codes" << std::endl;
+}
+
+/**
+ * Run the benchmarks on synthetic volumes of one size
+ * @param bench     collects the results
+ * @param size      voxels along each side
+ * @param tmpdir    directory for temporary files
+ */
+static void benchSynthetic(BenchRunner &bench, int size, const std::string &tmpdir)
+{
+    cgp::Point corner(-1.0f, -1.0f, -1.0f);
+    cgp::Vector diag(2.0f, 2.0f, 2.0f);
+    VoxelVolume sphere(size, size, size, corner, diag), torus(size, size, size, corner, diag), left(size, size, size, corner, diag);
+    std::vector<unsigned int> spherewords;
+    std::vector<cgp::Point> pts;
+    std::string sz = std::to_string(size);
+    long long numvox = (long long) size * size * size;
+    Mesh spheremesh, torusmesh;
+
+    bench.run("fillSynthetic", "sphere" + sz, numvox, [&](){ fillSynthetic(&sphere, false); });
+    fillSynthetic(&sphere, false);
+    fillSynthetic(&torus, true);
+    saveRows(&sphere, spherewords);
+
+    auto restore = [&](){ restoreRows(&left, spherewords); };
+    bench.run("voxSetOp union", "sphere" + sz, numvox, restore, [&](){ left.unionWith(&torus); });
+    bench.run("voxSetOp intersection", "sphere" + sz, numvox, restore, [&](){ left.intersectWith(&torus); });
+    bench.run("voxSetOp difference", "sphere" + sz, numvox, restore, [&](){ left.subtract(&torus); });
+
+    VoxelStats partstats;
+    bench.run("voxel stats", "sphere" + sz, numvox, [&](){ sphere.getStats(partstats); });
+    std::vector<VoxelComponent> comps;
+    bench.run("voxel components", "torus" + sz, numvox, [&](){ torus.getComponents(comps); });
+    bench.run("voxel fillVoids", "sphere" + sz, numvox, restore, [&](){ left.fillVoids(); });
+
+    // fit-tolerance offsets of two voxels
+    const VoxelMorph elems[3] = {VoxelMorph::BOX, VoxelMorph::CROSS, VoxelMorph::BALL};
+    const char * elemnames[3] = {"box", "cross", "ball"};
+    for(int e = 0; e < 3; e++)
+    {
+        bench.run(std::string("voxel dilate ") + elemnames[e], "sphere" + sz, numvox, restore, [&](){ left.dilate(2, elems[e]); });
+        bench.run(std::string("voxel erode ") + elemnames[e], "sphere" + sz, numvox, restore, [&](){ left.erode(2, elems[e]); });
+    }
+
+    benchLayouts(bench, &sphere, "sphere" + sz);
+
+    bench.run("marchingCubes", "sphere" + sz, numvox, [&](){ spheremesh.marchingCubes(&sphere); });
+    bench.run("marchingCubes", "torus" + sz, numvox, [&](){ torusmesh.marchingCubes(&torus); });
+    bench.run("surfaceNets", "sphere" + sz, numvox, [&](){ spheremesh.surfaceNets(&sphere); });
+    bench.run("surfaceNets", "torus" + sz, numvox, [&](){ torusmesh.surfaceNets(&torus); });
+    spheremesh.clear();
+    if(spheremesh.empty())
+        spheremesh.marchingCubes(&sphere);
+
+    Sphere sphereshape(cgp::Point(0.0f, 0.0f, 0.0f), benchsphereradius);
+    Cylinder cylindershape(cgp::Point(0.0f, 0.0f, -benchsphereradius), cgp::Point(0.0f, 0.0f, benchsphereradius), benchsphereradius);
+    containmentQueries(&sphere, pts);
+    benchContainment(bench, &sphereshape, "containment sphere", "sphere" + sz, pts);
+    benchContainment(bench, &cylindershape, "containment cylinder", "sphere" + sz, pts);
+    benchContainment(bench, &spheremesh, "containment mesh", "sphere" + sz, pts);
+
+    benchMesh(bench, &spheremesh, "sphere" + sz, tmpdir);
+
+    // the whole pipeline on the sample scene, at a voxel length giving about this many voxels along each side
+    std::unique_ptr<Scene> scene;
+    bench.run("pipeline", "sample" + sz, numvox, [&](){ scene.reset(new Scene()); scene->setStreamCSG(true); scene->sampleScene(); },
+              [&](){ scene->voxelise(benchsamplespan / (float) size); scene->isoextract(); scene->smooth(); });
+
+    // voxelisation alone, where the analytic leaves of the sample scene are tested a packed word at a time
+    for(int stream = 0; stream < 2; stream++)
+        bench.run(stream ? "voxelise stream" : "voxelise walk", "sample" + sz, numvox,
+                  [&](){ scene.reset(new Scene()); scene->setStreamCSG(stream == 1); scene->sampleScene(); },
+                  [&](){ scene->voxelise(benchsamplespan / (float) size); });
+}
+
+/**
+ * Run the benchmarks on a triangle mesh read from file
+ * @param bench     collects the results
+ * @param filename  STL, OBJ or indexed mesh file
+ * @param tmpdir    directory for temporary files
+ * @retval true  if the mesh was read,
+ * @retval false otherwise
+ */
+static bool benchMeshFile(BenchRunner &bench, const std::string &filename, const std::string &tmpdir)
+{
+    Mesh mesh;
+    cgp::BoundBox bbox;
+    VoxelVolume grid;
+    std::vector<cgp::Point> pts;
+    std::string input = boost::filesystem::path(filename).filename().string();
+
+    if(!mesh.readMesh(filename) || mesh.getNumFaces() == 0)
+    {
+        std::cerr << "Error tessbench: unable to read " << filename << std::endl;
+        return false;
+    }
+
+    // containment queries on a grid of 64 voxels across the mesh bounds
+    mesh.getBounds(bbox);
+    grid.setDim(64, 64, 64);
+    grid.setFrame(bbox.min, bbox.getDiag());
+    containmentQueries(&grid, pts);
+    benchContainment(bench, &mesh, "containment mesh", input, pts);
+    benchMesh(bench, &mesh, input, tmpdir);
+    return true;
+}
+
+static po::variables_map processOptions(int argc, const char **argv)
+{
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",                                                "Show help");
+
+    po::options_description inputs("Inputs");
+    inputs.add_options()
+        ("size", po::value<std::vector<int> >()->multitoken(), "Voxels along each side of the synthetic volumes, which may be repeated (default 64 128)")
+        ("mesh", po::value<std::vector<std::string> >()->multitoken(), "Triangle mesh to benchmark, which may be repeated")
+        ("meshdir", po::value<std::string>(),                 "Directory whose STL files are all benchmarked, such as meshes/triangle");
+    desc.add(inputs);
+
+    po::options_description control("Benchmark options");
+    control.add_options()
+        ("repeat", po::value<int>()->default_value(3),        "Timed runs of each benchmark, of which the best and mean are reported")
+        ("filter", po::value<std::string>()->default_value(""), "Only run benchmarks whose name contains this")
+        ("output,o", po::value<std::string>(),                "CSV file of results, which is required because the kernels report progress on stdout")
+        ("tmpdir", po::value<std::string>(),                  "Directory for temporary files, instead of the system one")
+        ("threads", po::value<int>()->default_value(0),       "Threads for parallel kernels, 0 for one per hardware thread");
+    desc.add(control);
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+                  .options(desc)
+                  .run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help"))
+        {
+            std::cout << desc << '\n';
+            exit(0);
+        }
+        if (!vm.count("output"))
+            throw po::error("--output is required");
+        if (vm["repeat"].as<int>() < 1)
+            throw po::error("--repeat must be at least 1");
+        if (vm["threads"].as<int>() < 0)
+            throw po::error("--threads must not be negative");
+        if (vm.count("size"))
+            for (int size: vm["size"].as<std::vector<int> >())
+                if (size < 2)
+                    throw po::error("--size must be at least 2");
+        return vm;
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\n\n" << desc << '\n';
+        std::exit(1);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    po::variables_map vm = processOptions(argc, argv);
+    parallel::setThreads(vm["threads"].as<int>());
+    BenchRunner bench(vm["repeat"].as<int>(), vm["filter"].as<std::string>());
+    std::vector<int> sizes = {64, 128};
+    std::vector<std::string> meshes;
+    std::string tmpdir = vm.count("tmpdir") ? vm["tmpdir"].as<std::string>() : boost::filesystem::temp_directory_path().string();
+
+    if(vm.count("size"))
+        sizes = vm["size"].as<std::vector<int> >();
+    if(vm.count("mesh"))
+        meshes = vm["mesh"].as<std::vector<std::string> >();
+    if(vm.count("meshdir"))
+    {
+        std::vector<std::string> found;
+        boost::system::error_code ec;
+        for(boost::filesystem::directory_iterator it(vm["meshdir"].as<std::string>(), ec), end; !ec && it != end; ++it)
+            if(it->path().extension() == ".stl")
+                found.push_back(it->path().string());
+        if(ec)
+        {
+            std::cerr << "Error tessbench: unable to list " << vm["meshdir"].as<std::string>() << std::endl;
+            return 1;
+        }
+        std::sort(found.begin(), found.end()); // directory order varies, and results should line up between runs
+        meshes.insert(meshes.end(), found.begin(), found.end());
+    }
+
+    for(int size: sizes)
+        benchSynthetic(bench, size, tmpdir);
+    for(const std::string &filename: meshes)
+        if(!benchMeshFile(bench, filename, tmpdir))
+            return 1;
+
+    std::ofstream out(vm["output"].as<std::string>());
+    bench.write(out);
+    if(!out)
+    {
+        std::cerr << "Error tessbench: unable to write " << vm["output"].as<std::string>() << std::endl;
+        return 1;
+    }
+    return 0;
+}
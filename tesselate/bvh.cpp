@@ -0,0 +1,891 @@
+//
+// BVH
+//
+
+#include "bvh.h"
+#include <math.h>
+#include <algorithm>
+#include "common/counters.h"
+
+using namespace std;
+
+const float bvhdeteps = 1.0e-12f; ///< determinant below which a ray is treated as parallel to a triangle
+const int bvhpairtasks = 256;     ///< node pairs expanded from the roots before overlapPairs searches in parallel
+
+/// Half surface area of a box, sufficient for comparing split costs
+static float halfArea(const float * bmin, const float * bmax)
+{
+    float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+    if(dx < 0.0f || dy < 0.0f || dz < 0.0f)
+        return 0.0f;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+/// Grow the box (bmin, bmax) to include the box (omin, omax)
+static void growBox(float * bmin, float * bmax, const float * omin, const float * omax)
+{
+    for(int a = 0; a < 3; a++)
+    {
+        bmin[a] = std::min(bmin[a], omin[a]);
+        bmax[a] = std::max(bmax[a], omax[a]);
+    }
+}
+
+void BVH::clear()
+{
+    nodes.clear();
+    tverts.clear();
+    tids.clear();
+    wide.clear();
+}
+
+void BVH::build(const std::vector<cgp::Point> &verts, const std::vector<int> &faces)
+{
+    int t, p, a, numtris;
+    vector<float> cent, tbox;
+
+    clear();
+    numtris = (int) faces.size() / 3;
+    if(numtris == 0)
+        return;
+
+    // per triangle bounding boxes and centroids (of the bounding box) drive the split decisions
+    cent.resize(3 * numtris);
+    tbox.resize(6 * numtris);
+    tids.resize(numtris);
+    for(t = 0; t < numtris; t++)
+    {
+        float * bmin = &tbox[6*t], * bmax = &tbox[6*t+3];
+        for(a = 0; a < 3; a++)
+        {
+            bmin[a] = HUGE_VALF;
+            bmax[a] = -HUGE_VALF;
+        }
+        for(p = 0; p < 3; p++)
+        {
+            const cgp::Point &v = verts[faces[3*t+p]];
+            float c[3] = {v.x, v.y, v.z};
+            growBox(bmin, bmax, c, c);
+        }
+        for(a = 0; a < 3; a++)
+            cent[3*t+a] = 0.5f * (bmin[a] + bmax[a]);
+        tids[t] = t;
+    }
+
+    nodes.reserve(2 * numtris);
+    nodes.push_back(BVHNode());
+    split(0, 0, numtris, 0, cent, tbox);
+
+    // copy triangle vertices into leaf order for coherent access during traversal
+    tverts.resize(9 * numtris);
+    for(t = 0; t < numtris; t++)
+        for(p = 0; p < 3; p++)
+        {
+            const cgp::Point &v = verts[faces[3*tids[t]+p]];
+            tverts[9*t+3*p] = v.x; tverts[9*t+3*p+1] = v.y; tverts[9*t+3*p+2] = v.z;
+        }
+
+    wide.reserve(nodes.size() / 2 + 1);
+    collapse(0);
+}
+
+int BVH::collapse(int node)
+{
+    int slots[bvhwidth], numslots = 1, idx, s, a;
+
+    // open the largest interior node until the wide node is full, so the boxes it tests cover the most area
+    slots[0] = node;
+    while(numslots < bvhwidth)
+    {
+        int open = -1;
+        float area = -1.0f;
+        for(s = 0; s < numslots; s++)
+        {
+            const BVHNode &n = nodes[slots[s]];
+            if(n.count == 0 && halfArea(n.bmin, n.bmax) > area)
+            {
+                area = halfArea(n.bmin, n.bmax);
+                open = s;
+            }
+        }
+        if(open < 0) // only leaves remain
+            break;
+        int first = nodes[slots[open]].first;
+        slots[open] = first;
+        slots[numslots++] = first + 1;
+    }
+
+    idx = (int) wide.size();
+    wide.push_back(BVHWideNode());
+    for(s = 0; s < bvhwidth; s++)
+    {
+        BVHWideNode &w = wide[idx];
+        if(s >= numslots)
+        {
+            for(a = 0; a < 3; a++)
+            {
+                w.bmin[a][s] = HUGE_VALF;
+                w.bmax[a][s] = -HUGE_VALF;
+            }
+            w.first[s] = 0;
+            w.count[s] = -1;
+            continue;
+        }
+        const BVHNode &n = nodes[slots[s]];
+        for(a = 0; a < 3; a++)
+        {
+            w.bmin[a][s] = n.bmin[a];
+            w.bmax[a][s] = n.bmax[a];
+        }
+        w.count[s] = n.count;
+        w.first[s] = n.first;
+        if(n.count == 0)
+        {
+            int child = collapse(slots[s]); // may reallocate wide, so w is not held across the call
+            wide[idx].first[s] = child;
+        }
+    }
+    return idx;
+}
+
+void BVH::split(int node, int start, int end, int depth, std::vector<float> &cent, std::vector<float> &tbox)
+{
+    BVHNode nd;
+    float cmin[3], cmax[3], extent, bestcost, leafcost;
+    int i, a, b, axis, mid, count, bestbin;
+
+    count = end - start;
+
+    // bounds of triangles and of their centroids over the range
+    for(a = 0; a < 3; a++)
+    {
+        nd.bmin[a] = cmin[a] = HUGE_VALF;
+        nd.bmax[a] = cmax[a] = -HUGE_VALF;
+    }
+    for(i = start; i < end; i++)
+    {
+        growBox(nd.bmin, nd.bmax, &tbox[6*tids[i]], &tbox[6*tids[i]+3]);
+        growBox(cmin, cmax, &cent[3*tids[i]], &cent[3*tids[i]]);
+    }
+
+    nd.first = start;
+    nd.count = count;
+    if(count <= bvhleafsize)
+    {
+        nodes[node] = nd;
+        return;
+    }
+
+    // split along the axis with the widest spread of centroids
+    axis = 0;
+    for(a = 1; a < 3; a++)
+        if(cmax[a] - cmin[a] > cmax[axis] - cmin[axis])
+            axis = a;
+    extent = cmax[axis] - cmin[axis];
+
+    mid = start;
+    if(extent > 0.0f && depth < bvhmaxdepth)
+    {
+        // binned surface area heuristic
+        int bincount[bvhbins];
+        float binmin[bvhbins][3], binmax[bvhbins][3], rightarea[bvhbins];
+        float accmin[3], accmax[3];
+        int acccount;
+
+        for(b = 0; b < bvhbins; b++)
+        {
+            bincount[b] = 0;
+            for(a = 0; a < 3; a++)
+            {
+                binmin[b][a] = HUGE_VALF;
+                binmax[b][a] = -HUGE_VALF;
+            }
+        }
+        for(i = start; i < end; i++)
+        {
+            b = std::min(bvhbins-1, (int) ((float) bvhbins * (cent[3*tids[i]+axis] - cmin[axis]) / extent));
+            bincount[b]++;
+            growBox(binmin[b], binmax[b], &tbox[6*tids[i]], &tbox[6*tids[i]+3]);
+        }
+
+        // sweep from the right to get the area of everything beyond each split plane
+        for(a = 0; a < 3; a++)
+        {
+            accmin[a] = HUGE_VALF;
+            accmax[a] = -HUGE_VALF;
+        }
+        for(b = bvhbins-1; b > 0; b--)
+        {
+            growBox(accmin, accmax, binmin[b], binmax[b]);
+            rightarea[b] = halfArea(accmin, accmax);
+        }
+
+        // sweep from the left, combining with the right sweep to cost each split plane
+        for(a = 0; a < 3; a++)
+        {
+            accmin[a] = HUGE_VALF;
+            accmax[a] = -HUGE_VALF;
+        }
+        acccount = 0;
+        bestcost = HUGE_VALF;
+        bestbin = -1;
+        for(b = 0; b < bvhbins-1; b++)
+        {
+            float cost;
+
+            growBox(accmin, accmax, binmin[b], binmax[b]);
+            acccount += bincount[b];
+            if(acccount == 0 || acccount == count)
+                continue;
+            cost = halfArea(accmin, accmax) * (float) acccount + rightarea[b+1] * (float) (count - acccount);
+            if(cost < bestcost)
+            {
+                bestcost = cost;
+                bestbin = b;
+            }
+        }
+
+        // a unit traversal cost against a unit intersection cost per triangle
+        leafcost = (float) count;
+        if(bestbin >= 0)
+        {
+            float area = halfArea(nd.bmin, nd.bmax);
+            if(area > 0.0f && 1.0f + bestcost / area >= leafcost && count <= 4 * bvhleafsize)
+            {
+                nodes[node] = nd; // splitting is not worth it
+                return;
+            }
+
+            float cminaxis = cmin[axis];
+            int * pmid = std::partition(&tids[start], &tids[0] + end, [&](int tri)
+            {
+                int tb = std::min(bvhbins-1, (int) ((float) bvhbins * (cent[3*tri+axis] - cminaxis) / extent));
+                return tb <= bestbin;
+            });
+            mid = (int) (pmid - &tids[0]);
+        }
+    }
+
+    if(mid == start || mid == end) // degenerate or too deep, so fall back to a median split
+    {
+        mid = (start + end) / 2;
+        std::nth_element(&tids[start], &tids[mid], &tids[0] + end, [&](int t0, int t1)
+        {
+            return cent[3*t0+axis] < cent[3*t1+axis];
+        });
+    }
+
+    nd.first = (int) nodes.size();
+    nd.count = 0;
+    nodes[node] = nd;
+    nodes.push_back(BVHNode());
+    nodes.push_back(BVHNode());
+    split(nd.first, start, mid, depth+1, cent, tbox);
+    split(nd.first+1, mid, end, depth+1, cent, tbox);
+}
+
+bool BVH::hitBox(const BVHNode &n, const float * o, const float * d, const float * invd, float &tnear) const
+{
+    float tmin = 0.0f, tmax = HUGE_VALF, t0, t1;
+
+    for(int a = 0; a < 3; a++)
+    {
+        if(d[a] == 0.0f) // ray parallel to slab, so origin must lie within it
+        {
+            if(o[a] < n.bmin[a] || o[a] > n.bmax[a])
+                return false;
+        }
+        else
+        {
+            t0 = (n.bmin[a] - o[a]) * invd[a];
+            t1 = (n.bmax[a] - o[a]) * invd[a];
+            if(t0 > t1)
+                std::swap(t0, t1);
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+            if(tmin > tmax)
+                return false;
+        }
+    }
+    tnear = tmin;
+    return true;
+}
+
+bool BVH::hitTriangle(int t, const float * o, const float * d, float &tval, bool &front, float * uv) const
+{
+    const float * v = &tverts[9*t];
+    float e1[3], e2[3], p[3], s[3], q[3], det, inv, u, w;
+
+    // Moller-Trumbore ray-triangle intersection, independent of triangle winding
+    for(int a = 0; a < 3; a++)
+    {
+        e1[a] = v[3+a] - v[a];
+        e2[a] = v[6+a] - v[a];
+        s[a] = o[a] - v[a];
+    }
+    p[0] = d[1] * e2[2] - d[2] * e2[1];
+    p[1] = d[2] * e2[0] - d[0] * e2[2];
+    p[2] = d[0] * e2[1] - d[1] * e2[0];
+    det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if(det < bvhdeteps && det > -bvhdeteps) // ray lies in the plane of the triangle
+        return false;
+    inv = 1.0f / det;
+    front = (det > 0.0f);
+
+    u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+    if(u < 0.0f || u > 1.0f)
+        return false;
+
+    q[0] = s[1] * e1[2] - s[2] * e1[1];
+    q[1] = s[2] * e1[0] - s[0] * e1[2];
+    q[2] = s[0] * e1[1] - s[1] * e1[0];
+    w = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+    if(w < 0.0f || u + w > 1.0f)
+        return false;
+
+    tval = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+    if(uv != NULL)
+    {
+        uv[0] = u;
+        uv[1] = w;
+    }
+    return true;
+}
+
+unsigned int BVH::hitTrianglePacket(int t, const float (* o)[bvhpacket], unsigned int mask, const float * d, float * tval, bool &front) const
+{
+    const float * v = &tverts[9*t];
+    float e1[3], e2[3], p[3], det, inv;
+    int crossed[bvhpacket];
+    unsigned int hit = 0u;
+
+    // the same steps as hitTriangle, with those that depend only on the shared direction taken once
+    for(int a = 0; a < 3; a++)
+    {
+        e1[a] = v[3+a] - v[a];
+        e2[a] = v[6+a] - v[a];
+    }
+    p[0] = d[1] * e2[2] - d[2] * e2[1];
+    p[1] = d[2] * e2[0] - d[0] * e2[2];
+    p[2] = d[0] * e2[1] - d[1] * e2[0];
+    det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if(det < bvhdeteps && det > -bvhdeteps) // rays lie in the plane of the triangle
+        return 0u;
+    inv = 1.0f / det;
+    front = (det > 0.0f);
+
+    // every lane at once without early exits, with the rays outside the mask discarded afterwards; the shared
+    // values are held in locals, since loads through v and d could otherwise alias tval and block vectorisation
+    float vx = v[0], vy = v[1], vz = v[2], dx = d[0], dy = d[1], dz = d[2];
+    #pragma omp simd
+    for(int r = 0; r < bvhpacket; r++)
+    {
+        float sx = o[0][r] - vx, sy = o[1][r] - vy, sz = o[2][r] - vz, qx, qy, qz, u, w;
+        u = (sx * p[0] + sy * p[1] + sz * p[2]) * inv;
+        qx = sy * e1[2] - sz * e1[1];
+        qy = sz * e1[0] - sx * e1[2];
+        qz = sx * e1[1] - sy * e1[0];
+        w = (dx * qx + dy * qy + dz * qz) * inv;
+        tval[r] = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inv;
+        crossed[r] = (u >= 0.0f) & (u <= 1.0f) & (w >= 0.0f) & (u + w <= 1.0f);
+    }
+    for(int r = 0; r < bvhpacket; r++)
+        if(crossed[r])
+            hit |= (0x1u << r);
+    return hit & mask;
+}
+
+int BVH::countHits(cgp::Point origin, cgp::Vector dir) const
+{
+    int stack[bvhmaxdepth + 64]; // median splits past bvhmaxdepth add at most log2(n) levels
+    int top = 0, hits = 0, i;
+    float o[3] = {origin.x, origin.y, origin.z};
+    float d[3] = {dir.i, dir.j, dir.k};
+    float invd[3], tnear, tval;
+    bool front;
+
+    if(nodes.empty())
+        return 0;
+
+    for(int a = 0; a < 3; a++)
+        invd[a] = (d[a] != 0.0f) ? 1.0f / d[a] : 0.0f;
+
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const BVHNode &n = nodes[stack[--top]];
+        UTS_COUNT(BVH_NODES_VISITED, 1);
+        if(!hitBox(n, o, d, invd, tnear))
+            continue;
+
+        if(n.count > 0) // leaf
+        {
+            UTS_COUNT(RAY_TRIANGLE_TESTS, n.count);
+            for(i = n.first; i < n.first + n.count; i++)
+                if(hitTriangle(i, o, d, tval, front) && tval > 0.0f)
+                    hits++;
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first+1;
+        }
+    }
+    return hits;
+}
+
+void BVH::rayHits(cgp::Point origin, cgp::Vector dir, std::vector<BVHHit> &hits) const
+{
+    int stack[bvhmaxdepth + 64];
+    int top = 0, i;
+    float o[3] = {origin.x, origin.y, origin.z};
+    float d[3] = {dir.i, dir.j, dir.k};
+    float invd[3], tnear;
+    BVHHit hit;
+
+    if(nodes.empty())
+        return;
+
+    for(int a = 0; a < 3; a++)
+        invd[a] = (d[a] != 0.0f) ? 1.0f / d[a] : 0.0f;
+
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const BVHNode &n = nodes[stack[--top]];
+        UTS_COUNT(BVH_NODES_VISITED, 1);
+        if(!hitBox(n, o, d, invd, tnear))
+            continue;
+
+        if(n.count > 0) // leaf
+        {
+            UTS_COUNT(RAY_TRIANGLE_TESTS, n.count);
+            for(i = n.first; i < n.first + n.count; i++)
+                if(hitTriangle(i, o, d, hit.t, hit.front) && hit.t > 0.0f)
+                {
+                    hit.tri = tids[i];
+                    hits.push_back(hit);
+                }
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first+1;
+        }
+    }
+}
+
+void BVH::packetHits(const cgp::Point * origins, int n, cgp::Vector dir, std::vector<BVHHit> * hits) const
+{
+    int stack[(bvhwidth - 1) * (bvhmaxdepth + 64) + 1]; // each level leaves at most bvhwidth - 1 siblings stacked
+    unsigned int stackmask[(bvhwidth - 1) * (bvhmaxdepth + 64) + 1], childmask[bvhwidth], all;
+    float o[3][bvhpacket], d[3] = {dir.i, dir.j, dir.k}, invd[3], tval[bvhpacket];
+    int top = 0, r, c, a, i;
+    bool front;
+    BVHHit hit;
+
+    if(wide.empty() || n <= 0)
+        return;
+    n = std::min(n, bvhpacket);
+    all = (0x1u << n) - 1u;
+    // origins by axis, so that each lane holds one ray, with unused lanes repeating the last ray
+    for(r = 0; r < bvhpacket; r++)
+    {
+        const cgp::Point &p = origins[std::min(r, n - 1)];
+        o[0][r] = p.x; o[1][r] = p.y; o[2][r] = p.z;
+    }
+    for(a = 0; a < 3; a++)
+        invd[a] = (d[a] != 0.0f) ? 1.0f / d[a] : 0.0f;
+
+    stack[top] = 0; stackmask[top++] = all;
+    while(top > 0)
+    {
+        --top;
+        const BVHWideNode &w = wide[stack[top]];
+        unsigned int active = stackmask[top];
+        UTS_COUNT(BVH_NODES_VISITED, 1);
+
+        // each child box against every ray of the packet at once, as in hitBox, keeping only the active rays
+        for(c = 0; c < bvhwidth; c++)
+        {
+            int inside[bvhpacket];
+            float tmin[bvhpacket], tmax[bvhpacket];
+
+            childmask[c] = 0u;
+            if(w.count[c] < 0)
+                continue;
+            #pragma omp simd
+            for(r = 0; r < bvhpacket; r++)
+            {
+                inside[r] = 1;
+                tmin[r] = 0.0f;
+                tmax[r] = HUGE_VALF;
+            }
+            for(a = 0; a < 3; a++)
+            {
+                float lo = w.bmin[a][c], hi = w.bmax[a][c], ia = invd[a];
+                const float * oa = o[a];
+                if(d[a] == 0.0f) // rays parallel to the slab, so their origins must lie within it
+                {
+                    #pragma omp simd
+                    for(r = 0; r < bvhpacket; r++)
+                        inside[r] &= (oa[r] >= lo) & (oa[r] <= hi);
+                }
+                else
+                {
+                    #pragma omp simd
+                    for(r = 0; r < bvhpacket; r++)
+                    {
+                        float t0 = (lo - oa[r]) * ia, t1 = (hi - oa[r]) * ia;
+                        tmin[r] = std::max(tmin[r], std::min(t0, t1));
+                        tmax[r] = std::min(tmax[r], std::max(t0, t1));
+                    }
+                }
+            }
+            for(r = 0; r < n; r++)
+                if(inside[r] && tmin[r] <= tmax[r])
+                    childmask[c] |= (0x1u << r);
+            childmask[c] &= active;
+        }
+
+        for(c = 0; c < bvhwidth; c++)
+        {
+            if(childmask[c] == 0u)
+                continue;
+            if(w.count[c] > 0) // leaf
+            {
+                UTS_COUNT(RAY_TRIANGLE_TESTS, w.count[c] * __builtin_popcount(childmask[c]));
+                for(i = w.first[c]; i < w.first[c] + w.count[c]; i++)
+                {
+                    unsigned int crossed = hitTrianglePacket(i, o, childmask[c], d, tval, front);
+                    for(r = 0; crossed != 0u; r++, crossed >>= 1)
+                        if((crossed & 0x1u) && tval[r] > 0.0f)
+                        {
+                            hit.t = tval[r];
+                            hit.tri = tids[i];
+                            hit.front = front;
+                            hits[r].push_back(hit);
+                        }
+                }
+            }
+            else
+            {
+                stack[top] = w.first[c]; stackmask[top++] = childmask[c];
+            }
+        }
+    }
+}
+
+bool BVH::closestHit(cgp::Point origin, cgp::Vector dir, BVHRayHit &hit) const
+{
+    int stack[bvhmaxdepth + 64];
+    float stackt[bvhmaxdepth + 64]; // entry parameter of each stacked node
+    int top = 0, i, near, far;
+    float o[3] = {origin.x, origin.y, origin.z};
+    float d[3] = {dir.i, dir.j, dir.k};
+    float invd[3], tnear, tfar, tval, uv[2], best = HUGE_VALF;
+    bool front, found = false, hitnear, hitfar;
+
+    if(nodes.empty())
+        return false;
+
+    for(int a = 0; a < 3; a++)
+        invd[a] = (d[a] != 0.0f) ? 1.0f / d[a] : 0.0f;
+
+    if(!hitBox(nodes[0], o, d, invd, tnear))
+        return false;
+    stack[top] = 0; stackt[top++] = tnear;
+    while(top > 0)
+    {
+        --top;
+        if(stackt[top] > best) // entered beyond the nearest crossing found since it was stacked
+            continue;
+        const BVHNode &n = nodes[stack[top]];
+        UTS_COUNT(BVH_NODES_VISITED, 1);
+
+        if(n.count > 0) // leaf
+        {
+            UTS_COUNT(RAY_TRIANGLE_TESTS, n.count);
+            for(i = n.first; i < n.first + n.count; i++)
+                if(hitTriangle(i, o, d, tval, front, uv) && tval > 0.0f && tval < best)
+                {
+                    best = tval;
+                    hit.t = tval;
+                    hit.tri = tids[i];
+                    hit.u = uv[0];
+                    hit.v = uv[1];
+                    hit.front = front;
+                    found = true;
+                }
+        }
+        else
+        {
+            // push the further child first so that the nearer one is searched first and tightens the bound
+            near = n.first; far = n.first+1;
+            hitnear = hitBox(nodes[near], o, d, invd, tnear);
+            hitfar = hitBox(nodes[far], o, d, invd, tfar);
+            if(hitnear && hitfar && tfar < tnear)
+            {
+                std::swap(near, far);
+                std::swap(tnear, tfar);
+            }
+            else if(!hitnear)
+            {
+                std::swap(near, far);
+                std::swap(tnear, tfar);
+                std::swap(hitnear, hitfar);
+            }
+            if(hitfar && tfar <= best)
+            {
+                stack[top] = far; stackt[top++] = tfar;
+            }
+            if(hitnear && tnear <= best)
+            {
+                stack[top] = near; stackt[top++] = tnear;
+            }
+        }
+    }
+    return found;
+}
+
+float BVH::boxSqrDist(const BVHNode &n, const float * p) const
+{
+    float sqrd = 0.0f, gap;
+
+    for(int a = 0; a < 3; a++)
+    {
+        gap = std::max(std::max(n.bmin[a] - p[a], p[a] - n.bmax[a]), 0.0f);
+        sqrd += gap * gap;
+    }
+    return sqrd;
+}
+
+/// Dot product of 3-vectors stored as floats
+static inline float dot3(const float * u, const float * v)
+{
+    return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+}
+
+float BVH::triangleSqrDist(int t, const float * p) const
+{
+    const float * a = &tverts[9*t], * b = a + 3, * c = a + 6;
+    float ab[3], ac[3], ap[3], bp[3], cp[3], q[3], d1, d2, d3, d4, d5, d6, va, vb, vc, v, w, den;
+
+    // closest point by Voronoi region of the triangle (Ericson, Real-Time Collision Detection, 5.1.5)
+    for(int i = 0; i < 3; i++)
+    {
+        ab[i] = b[i] - a[i];
+        ac[i] = c[i] - a[i];
+        ap[i] = p[i] - a[i];
+        bp[i] = p[i] - b[i];
+        cp[i] = p[i] - c[i];
+    }
+    d1 = dot3(ab, ap); d2 = dot3(ac, ap);
+    if(d1 <= 0.0f && d2 <= 0.0f) // vertex a
+        return dot3(ap, ap);
+    d3 = dot3(ab, bp); d4 = dot3(ac, bp);
+    if(d3 >= 0.0f && d4 <= d3) // vertex b
+        return dot3(bp, bp);
+    d5 = dot3(ab, cp); d6 = dot3(ac, cp);
+    if(d6 >= 0.0f && d5 <= d6) // vertex c
+        return dot3(cp, cp);
+
+    vc = d1 * d4 - d3 * d2;
+    vb = d5 * d2 - d1 * d6;
+    va = d3 * d6 - d5 * d4;
+    if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) // edge ab
+    {
+        v = d1 / (d1 - d3);
+        for(int i = 0; i < 3; i++)
+            q[i] = ap[i] - v * ab[i];
+        return dot3(q, q);
+    }
+    if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) // edge ac
+    {
+        w = d2 / (d2 - d6);
+        for(int i = 0; i < 3; i++)
+            q[i] = ap[i] - w * ac[i];
+        return dot3(q, q);
+    }
+    if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) // edge bc
+    {
+        w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        for(int i = 0; i < 3; i++)
+            q[i] = bp[i] - w * (c[i] - b[i]);
+        return dot3(q, q);
+    }
+
+    // face interior, which a degenerate triangle never reaches
+    den = 1.0f / (va + vb + vc);
+    v = vb * den;
+    w = vc * den;
+    for(int i = 0; i < 3; i++)
+        q[i] = ap[i] - v * ab[i] - w * ac[i];
+    return dot3(q, q);
+}
+
+float BVH::closestDistance(cgp::Point pnt, float maxdist) const
+{
+    int stack[bvhmaxdepth + 64];
+    int top = 0, i, near, far;
+    float p[3] = {pnt.x, pnt.y, pnt.z};
+    float best = maxdist * maxdist, dnear, dfar;
+
+    if(nodes.empty())
+        return maxdist;
+
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const BVHNode &n = nodes[stack[--top]];
+        UTS_COUNT(BVH_NODES_VISITED, 1);
+        if(boxSqrDist(n, p) >= best)
+            continue;
+
+        if(n.count > 0) // leaf
+        {
+            for(i = n.first; i < n.first + n.count; i++)
+                best = std::min(best, triangleSqrDist(i, p));
+        }
+        else
+        {
+            // push the further child first so that the nearer one is searched first and tightens the bound
+            near = n.first; far = n.first+1;
+            dnear = boxSqrDist(nodes[near], p);
+            dfar = boxSqrDist(nodes[far], p);
+            if(dfar < dnear)
+            {
+                std::swap(near, far);
+                std::swap(dnear, dfar);
+            }
+            if(dfar < best)
+                stack[top++] = far;
+            if(dnear < best)
+                stack[top++] = near;
+        }
+    }
+    return sqrtf(best);
+}
+
+/**
+ * Test whether two boxes overlap once widened
+ * @param amin, amax    first box
+ * @param bmin, bmax    second box
+ * @param pad           distance by which the boxes are widened
+ */
+static inline bool boxesOverlap(const float * amin, const float * amax, const float * bmin, const float * bmax, float pad)
+{
+    return amin[0] <= bmax[0] + pad && bmin[0] <= amax[0] + pad && amin[1] <= bmax[1] + pad && bmin[1] <= amax[1] + pad
+           && amin[2] <= bmax[2] + pad && bmin[2] <= amax[2] + pad;
+}
+
+/**
+ * Bounding box of a triangle stored as 9 consecutive floats
+ * @param v             triangle vertices
+ * @param[out] bmin, bmax   box corners
+ */
+static inline void triangleBox(const float * v, float * bmin, float * bmax)
+{
+    for(int a = 0; a < 3; a++)
+    {
+        bmin[a] = std::min(v[a], std::min(v[3+a], v[6+a]));
+        bmax[a] = std::max(v[a], std::max(v[3+a], v[6+a]));
+    }
+}
+
+void BVH::overlapPairs(const BVH &other, float pad, std::vector<std::pair<int, int>> &pairs) const
+{
+    std::vector<std::pair<int, int>> frontier, next;
+    std::vector<std::vector<std::pair<int, int>>> found;
+
+    pairs.clear();
+    if(nodes.empty() || other.nodes.empty())
+        return;
+
+    // breadth first from the roots until there are enough node pairs to share out, splitting the larger node
+    frontier.push_back(std::make_pair(0, 0));
+    while(!frontier.empty() && (int) frontier.size() < bvhpairtasks)
+    {
+        bool split = false;
+
+        next.clear();
+        for(const std::pair<int, int> &np : frontier)
+        {
+            const BVHNode &a = nodes[np.first], &b = other.nodes[np.second];
+
+            if(!boxesOverlap(a.bmin, a.bmax, b.bmin, b.bmax, pad))
+                continue;
+            if(a.count == 0 && (b.count > 0 || halfArea(a.bmin, a.bmax) >= halfArea(b.bmin, b.bmax)))
+            {
+                next.push_back(std::make_pair(a.first, np.second));
+                next.push_back(std::make_pair(a.first+1, np.second));
+                split = true;
+            }
+            else if(b.count == 0)
+            {
+                next.push_back(std::make_pair(np.first, b.first));
+                next.push_back(std::make_pair(np.first, b.first+1));
+                split = true;
+            }
+            else
+                next.push_back(np);
+        }
+        frontier.swap(next);
+        if(!split)
+            break;
+    }
+
+    // each node pair is searched on its own, and the results joined in frontier order
+    found.resize(frontier.size());
+    #pragma omp parallel for schedule(dynamic)
+    for(int f = 0; f < (int) frontier.size(); f++)
+    {
+        std::vector<std::pair<int, int>> stack(1, frontier[f]);
+        float amin[3], amax[3], bmin[3], bmax[3];
+
+        while(!stack.empty())
+        {
+            std::pair<int, int> np = stack.back();
+            const BVHNode &a = nodes[np.first], &b = other.nodes[np.second];
+
+            stack.pop_back();
+            if(!boxesOverlap(a.bmin, a.bmax, b.bmin, b.bmax, pad))
+                continue;
+            if(a.count > 0 && b.count > 0) // both leaves
+            {
+                for(int i = a.first; i < a.first + a.count; i++)
+                {
+                    triangleBox(&tverts[9 * (size_t) i], amin, amax);
+                    for(int j = b.first; j < b.first + b.count; j++)
+                    {
+                        triangleBox(&other.tverts[9 * (size_t) j], bmin, bmax);
+                        if(boxesOverlap(amin, amax, bmin, bmax, pad))
+                            found[f].push_back(std::make_pair(tids[i], other.tids[j]));
+                    }
+                }
+            }
+            else if(a.count == 0 && (b.count > 0 || halfArea(a.bmin, a.bmax) >= halfArea(b.bmin, b.bmax)))
+            {
+                stack.push_back(std::make_pair(a.first+1, np.second));
+                stack.push_back(std::make_pair(a.first, np.second));
+            }
+            else
+            {
+                stack.push_back(std::make_pair(np.first, b.first+1));
+                stack.push_back(std::make_pair(np.first, b.first));
+            }
+        }
+    }
+    for(const std::vector<std::pair<int, int>> &f : found)
+        pairs.insert(pairs.end(), f.begin(), f.end());
+}
+
+void BVH::getBounds(cgp::BoundBox &bbox) const
+{
+    bbox.reset();
+    if(!nodes.empty())
+    {
+        bbox.includePnt(cgp::Point(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]));
+        bbox.includePnt(cgp::Point(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+    }
+}
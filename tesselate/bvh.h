@@ -0,0 +1,236 @@
+/**
+ * @file
+ *
+ * Bounding volume hierarchy over triangles, used to accelerate ray and distance queries against meshes.
+ */
+
+#ifndef _BVH
+#define _BVH
+
+#include <vector>
+#include <utility>
+#include "vecpnt.h"
+
+const int bvhleafsize = 4;  ///< maximum number of triangles stored in a leaf
+const int bvhbins = 12;     ///< number of centroid bins used when evaluating split candidates
+const int bvhmaxdepth = 60; ///< depth beyond which splits fall back to the median, bounds the traversal stack
+const int bvhwidth = 4;     ///< children per node of the wide hierarchy used by packet queries
+const int bvhpacket = 8;    ///< maximum number of rays in a packet query
+
+/**
+ * A node in a flattened bounding volume hierarchy. Interior nodes store the index of their first child,
+ * with the second child immediately following it. Leaf nodes store a contiguous range of triangles.
+ */
+struct BVHNode
+{
+    float bmin[3];  ///< minimum corner of the node bounding box
+    float bmax[3];  ///< maximum corner of the node bounding box
+    int first;      ///< index of first child for interior nodes, or first triangle for leaf nodes
+    int count;      ///< number of triangles in a leaf, 0 for interior nodes
+};
+
+/**
+ * A node of the wide hierarchy, formed by collapsing levels of the binary one, with the boxes of its children
+ * stored side by side so that a ray is tested against all of them in one vectorised pass. A child slot is a leaf
+ * when its count is positive, an interior node when its count is 0, and unused when its count is negative.
+ */
+struct BVHWideNode
+{
+    float bmin[3][bvhwidth];    ///< minimum corners of the child bounding boxes, by axis then child
+    float bmax[3][bvhwidth];    ///< maximum corners of the child bounding boxes, by axis then child
+    int first[bvhwidth];        ///< wide node index of an interior child, or first triangle of a leaf
+    int count[bvhwidth];        ///< number of triangles in a leaf, 0 for an interior child, -1 for an unused slot
+};
+
+/**
+ * A single ray-triangle crossing reported by a hierarchy query
+ */
+struct BVHHit
+{
+    float t;        ///< ray parameter at the crossing
+    int tri;        ///< index of the crossed triangle in the original face list
+    bool front;     ///< true if the ray crosses against the counterclockwise winding normal (i.e., enters through the front face)
+};
+
+/**
+ * The nearest triangle crossing of a ray, with where on the triangle it falls
+ */
+struct BVHRayHit
+{
+    float t;        ///< ray parameter at the crossing
+    int tri;        ///< index of the crossed triangle in the original face list
+    float u, v;     ///< barycentric weights of the second and third triangle vertices, with the first taking 1 - u - v
+    bool front;     ///< true if the ray enters through the front face, as for BVHHit
+};
+
+/**
+ * Bounding volume hierarchy built with binned surface area heuristic splitting. Triangle vertex positions
+ * are copied into the hierarchy in leaf order so that traversal touches memory sequentially.
+ */
+class BVH
+{
+private:
+    std::vector<BVHNode> nodes;     ///< flattened tree, root at index 0
+    std::vector<float> tverts;      ///< 9 floats (3 vertices) per triangle, in leaf order
+    std::vector<int> tids;          ///< original triangle index for each triangle in leaf order
+    std::vector<BVHWideNode> wide;  ///< the same tree collapsed to bvhwidth children per node, root at index 0
+
+    /**
+     * Recursively partition a range of triangles and emit nodes
+     * @param node      index of the node covering the range
+     * @param start     first triangle (in tids) of the range
+     * @param end       one past the last triangle of the range
+     * @param depth     depth of the node in the tree
+     * @param cent      triangle centroids, indexed by original triangle
+     * @param tbox      triangle bounding boxes (6 floats each), indexed by original triangle
+     */
+    void split(int node, int start, int end, int depth, std::vector<float> &cent, std::vector<float> &tbox);
+
+    /**
+     * Emit a wide node gathering the binary nodes below a given one, by repeatedly opening the interior node of
+     * largest surface area until there are bvhwidth of them or only leaves remain, and recurse on those left interior
+     * @param node      binary node, opened first unless it is a leaf
+     * @returns index of the wide node
+     */
+    int collapse(int node);
+
+    /**
+     * Intersect a packet of rays sharing a direction with a single triangle, computing the parts of the
+     * Moller-Trumbore test that depend only on the direction once for the whole packet
+     * @param t         triangle index in leaf order
+     * @param o         ray origins by axis, one lane for each of bvhpacket rays
+     * @param mask      bit r set if ray r is to be tested
+     * @param d         shared ray direction
+     * @param[out] tval parameter value of the intersection of each lane, meaningful where the ray crosses
+     * @param[out] front true if the rays pass through the front face of the triangle
+     * @returns bit r set if ray r crosses the triangle
+     */
+    unsigned int hitTrianglePacket(int t, const float (* o)[bvhpacket], unsigned int mask, const float * d, float * tval, bool &front) const;
+
+    /**
+     * Test a ray against a node bounding box
+     * @param n         node to test
+     * @param o         ray origin
+     * @param d         ray direction
+     * @param invd      reciprocal of ray direction components, ignored where the direction component is zero
+     * @param[out] tnear parameter value at which the ray enters the box
+     * @retval true if the ray intersects the box in front of the origin,
+     * @retval false otherwise
+     */
+    bool hitBox(const BVHNode &n, const float * o, const float * d, const float * invd, float &tnear) const;
+
+    /**
+     * Intersect a ray with a single triangle stored in the hierarchy
+     * @param t         triangle index in leaf order
+     * @param o         ray origin
+     * @param d         ray direction
+     * @param[out] tval parameter value of the intersection
+     * @param[out] front true if the ray passes through the front face of the triangle
+     * @param[out] uv   barycentric weights of the second and third vertices at the crossing, if not NULL
+     * @retval true if the ray crosses the triangle,
+     * @retval false otherwise
+     */
+    bool hitTriangle(int t, const float * o, const float * d, float &tval, bool &front, float * uv = NULL) const;
+
+    /**
+     * Squared distance from a point to a node bounding box, zero if the point is inside it
+     * @param n         node to measure
+     * @param p         query point
+     * @returns squared distance to the nearest point of the box
+     */
+    float boxSqrDist(const BVHNode &n, const float * p) const;
+
+    /**
+     * Squared distance from a point to a single triangle stored in the hierarchy
+     * @param t         triangle index in leaf order
+     * @param p         query point
+     * @returns squared distance to the nearest point of the triangle
+     */
+    float triangleSqrDist(int t, const float * p) const;
+
+public:
+
+    /// Default constructor
+    BVH(){}
+
+    /// Remove all nodes and triangles
+    void clear();
+
+    /// Test whether the hierarchy has been built over any triangles
+    bool empty() const { return nodes.empty(); }
+
+    /// Number of triangles stored in the hierarchy
+    int getNumTris() const { return (int) tids.size(); }
+
+    /**
+     * Build the hierarchy over an indexed triangle list
+     * @param verts     vertex positions
+     * @param faces     flattened list of vertex indices, with each group of 3 indices representing a triangle
+     */
+    void build(const std::vector<cgp::Point> &verts, const std::vector<int> &faces);
+
+    /**
+     * Count the number of triangles crossed by a ray in front of its origin
+     * @param origin    start of the ray
+     * @param dir       direction of the ray (need not be unit length)
+     * @return number of ray-triangle crossings with positive parameter value
+     */
+    int countHits(cgp::Point origin, cgp::Vector dir) const;
+
+    /**
+     * Gather all triangle crossings of a ray in front of its origin
+     * @param origin    start of the ray
+     * @param dir       direction of the ray (need not be unit length)
+     * @param[out] hits crossings with positive parameter value, appended in traversal (not parameter) order
+     */
+    void rayHits(cgp::Point origin, cgp::Vector dir, std::vector<BVHHit> &hits) const;
+
+    /**
+     * Gather all triangle crossings of a packet of rays that share a direction, such as the parity rays along
+     * neighbouring voxel rows, descending the wide hierarchy once for the whole packet. Each node tests every
+     * active ray against all of its child boxes at once, and each triangle is set up once for the packet.
+     * @param origins   start of each ray
+     * @param n         number of rays, at most bvhpacket
+     * @param dir       shared direction of the rays (need not be unit length)
+     * @param[out] hits crossings of each ray with positive parameter value, appended as for rayHits
+     */
+    void packetHits(const cgp::Point * origins, int n, cgp::Vector dir, std::vector<BVHHit> * hits) const;
+
+    /**
+     * Find the first triangle crossed by a ray in front of its origin, visiting the nearer child first and skipping
+     * nodes that the ray enters beyond the nearest crossing found so far, so a query touches O(log n) nodes
+     * @param origin    start of the ray
+     * @param dir       direction of the ray (need not be unit length)
+     * @param[out] hit  nearest crossing, with its parameter in units of @a dir
+     * @retval true if the ray crosses any triangle,
+     * @retval false otherwise
+     */
+    bool closestHit(cgp::Point origin, cgp::Vector dir, BVHRayHit &hit) const;
+
+    /**
+     * Find the distance from a point to the nearest triangle, visiting the nearer child first and skipping
+     * nodes that are further away than the best triangle found so far
+     * @param pnt       query point
+     * @param maxdist   distance beyond which triangles are ignored, which also bounds the search
+     * @returns distance to the nearest triangle, or maxdist if none is closer
+     */
+    float closestDistance(cgp::Point pnt, float maxdist) const;
+
+    /**
+     * Find the pairs of triangles, one from each hierarchy, whose bounding boxes overlap, by descending both
+     * hierarchies together. The top levels are expanded into independent node pairs that are searched in parallel.
+     * @param other     second hierarchy
+     * @param pad       distance by which boxes are widened before testing, so that touching triangles are paired
+     * @param[out] pairs    original triangle indices in this and the other hierarchy, in an order that does not
+     *                      depend on the thread count
+     */
+    void overlapPairs(const BVH &other, float pad, std::vector<std::pair<int, int>> &pairs) const;
+
+    /**
+     * Bounding box of the whole hierarchy
+     * @param[out] bbox  box enclosing all triangles, reset if the hierarchy is empty
+     */
+    void getBounds(cgp::BoundBox &bbox) const;
+};
+
+#endif
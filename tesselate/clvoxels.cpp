@@ -0,0 +1,793 @@
+/**
+ * @file
+ *
+ * Voxelisation of csg leaves, set operations and isosurface extraction on an OpenCL device
+ */
+
+#include "clvoxels.h"
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <limits.h>
+#include "common/log.h"
+#ifdef TESS_OPENCL
+#include "common/source2cpp.h"
+#ifndef TESS_HEADLESS
+#include <CL/cl_gl.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif !defined(__APPLE__)
+#include <GL/glx.h>
+#endif
+#endif
+#endif
+
+using namespace std;
+
+#ifdef TESS_OPENCL
+const int clshapesphere = 0;    ///< primitiveLeaf shape code for a bound on squared distance from a centre
+const int clshapecylinder = 1;  ///< primitiveLeaf shape code for a capped cylinder
+const int clscanblock = 256;    ///< rows per block of the surface prefix sums, as MC_SCAN_BLOCK in isosurface.cl
+
+extern int triangleTable[256][16]; // marching cubes tables shared with Mesh and VoxelVolume
+extern int cubeEdgeFlags[256];
+#endif
+
+CLVoxeliser::CLVoxeliser()
+{
+    dim[0] = dim[1] = dim[2] = 0;
+    xspan = 0;
+    tried = false;
+    ready = false;
+    glwanted = false;
+    glshared = false;
+    surfvol = -1;
+    surfverts = surftris = 0;
+#ifdef TESS_OPENCL
+    context = NULL;
+    queue = NULL;
+    program = NULL;
+    primitivekernel = meshkernel = setopkernel = NULL;
+    mccountkernel = mcscanrowskernel = mcscanblockskernel = mcvertkernel = mctrikernel = NULL;
+    mctritable = mcedgeflags = mccounts = mcbases = mcblocks = NULL;
+    glprops[0] = 0;
+    maxalloc = 0;
+#endif
+}
+
+CLVoxeliser::~CLVoxeliser()
+{
+#ifdef TESS_OPENCL
+    release();
+#endif
+}
+
+bool CLVoxeliser::available()
+{
+    if(!tried)
+    {
+        tried = true;
+#ifdef TESS_OPENCL
+        ready = init();
+        if(!ready)
+            release();
+#endif
+        if(ready)
+            UTS_LOG(INFO, VOXELS, "CLVoxeliser: voxelising on ", device);
+        else
+            UTS_LOG(INFO, VOXELS, "CLVoxeliser: no OpenCL device, voxelising on the CPU");
+    }
+    return ready;
+}
+
+void CLVoxeliser::shareGL()
+{
+#if defined(TESS_OPENCL) && !defined(TESS_HEADLESS) && !defined(__APPLE__)
+    int p = 0;
+
+    // the platform is added by init, once the device driving this context is known
+#ifdef _WIN32
+    glprops[p++] = CL_GL_CONTEXT_KHR;
+    glprops[p++] = (cl_context_properties) wglGetCurrentContext();
+    glprops[p++] = CL_WGL_HDC_KHR;
+    glprops[p++] = (cl_context_properties) wglGetCurrentDC();
+#else
+    glprops[p++] = CL_GL_CONTEXT_KHR;
+    glprops[p++] = (cl_context_properties) glXGetCurrentContext();
+    glprops[p++] = CL_GLX_DISPLAY_KHR;
+    glprops[p++] = (cl_context_properties) glXGetCurrentDisplay();
+#endif
+    glprops[p] = 0;
+    if(glprops[1] == 0) // no context is current
+        return;
+    glwanted = true;
+    if(tried && !glshared) // found before the request, so look again on next use
+    {
+        release();
+        tried = ready = false;
+    }
+#endif
+}
+
+bool CLVoxeliser::clip(const int * lo, const int * hi, int * clo, int * chi)
+{
+    bool any = true;
+
+    for(int a = 0; a < 3; a++)
+    {
+        clo[a] = (lo != NULL) ? std::max(lo[a], 0) : 0;
+        chi[a] = (hi != NULL) ? std::min(hi[a], dim[a]-1) : dim[a]-1;
+        any = any && clo[a] <= chi[a];
+    }
+    return any;
+}
+
+bool CLVoxeliser::hasKernel(BaseShape * shape)
+{
+    Mesh * mesh = meshShape(shape);
+
+    if(mesh != NULL)
+        return mesh->getContainment() == MeshContainment::PARITY;
+    return shape != NULL && (shape->getKind() == ShapeKind::SPHERE || shape->getKind() == ShapeKind::CYLINDER
+                             || shape->getKind() == ShapeKind::SQUARE);
+}
+
+#ifdef TESS_OPENCL
+
+bool CLVoxeliser::check(cl_int err, const char * method, const char * what)
+{
+    if(err != CL_SUCCESS)
+        cerr << "Error CLVoxeliser::" << method << ": " << what << " failed with OpenCL error " << err << endl;
+    return err == CL_SUCCESS;
+}
+
+bool CLVoxeliser::init()
+{
+    cl_uint numplat = 0;
+    cl_device_id dev = NULL;
+    cl_device_fp_config fpconfig = 0;
+    cl_ulong alloc = 0;
+    cl_int err;
+    char name[256];
+    string options;
+    vector<cl_context_properties> props;
+
+    // no platform at all is the usual case on machines without a GPU driver, so it is not an error
+    if(clGetPlatformIDs(0, NULL, &numplat) != CL_SUCCESS || numplat == 0)
+        return false;
+    vector<cl_platform_id> platforms(numplat);
+    if(!check(clGetPlatformIDs(numplat, platforms.data(), NULL), "init", "listing platforms"))
+        return false;
+
+    // the device driving the OpenGL context of the viewer, if asked for and supported, so surfaces need no copy
+#ifndef TESS_HEADLESS
+    for(cl_uint p = 0; p < numplat && glwanted && dev == NULL; p++)
+    {
+        clGetGLContextInfoKHR_fn glinfo = (clGetGLContextInfoKHR_fn) clGetExtensionFunctionAddressForPlatform(platforms[p], "clGetGLContextInfoKHR");
+
+        props.assign(glprops, glprops + 4);
+        props.push_back(CL_CONTEXT_PLATFORM);
+        props.push_back((cl_context_properties) platforms[p]);
+        props.push_back(0);
+        if(glinfo == NULL || glinfo(props.data(), CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, sizeof(cl_device_id), &dev, NULL) != CL_SUCCESS)
+            dev = NULL;
+    }
+    glshared = (dev != NULL);
+    if(glwanted && !glshared)
+        UTS_LOG(INFO, VOXELS, "CLVoxeliser: no device shares the OpenGL context, so surfaces are read back");
+#endif
+    if(!glshared)
+        props.clear();
+    for(cl_device_type type : {(cl_device_type) CL_DEVICE_TYPE_GPU, (cl_device_type) CL_DEVICE_TYPE_ALL})
+        for(cl_uint p = 0; p < numplat && dev == NULL; p++)
+            if(clGetDeviceIDs(platforms[p], type, 1, &dev, NULL) != CL_SUCCESS)
+                dev = NULL;
+    if(dev == NULL)
+        return false;
+
+    clGetDeviceInfo(dev, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    name[sizeof(name)-1] = '\0';
+    device = name;
+    clGetDeviceInfo(dev, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &alloc, NULL);
+    maxalloc = (size_t) alloc;
+
+    context = clCreateContext(props.empty() ? NULL : props.data(), 1, &dev, NULL, NULL, &err);
+    if(!check(err, "init", "creating a context"))
+        return false;
+    queue = clCreateCommandQueue(context, dev, 0, &err);
+    if(!check(err, "init", "creating a queue"))
+        return false;
+
+    const uts::string &voxsource = getSource("voxelise.cl"), &isosource = getSource("isosurface.cl");
+    const char * text[2] = {voxsource.c_str(), isosource.c_str()};
+    size_t len[2] = {voxsource.size(), isosource.size()};
+    program = clCreateProgramWithSource(context, 2, text, len, &err);
+    if(!check(err, "init", "loading voxelise.cl and isosurface.cl"))
+        return false;
+
+    // voxel positions must round as getVoxelPos does, or voxel centres on a surface could land differently
+    clGetDeviceInfo(dev, CL_DEVICE_SINGLE_FP_CONFIG, sizeof(fpconfig), &fpconfig, NULL);
+    if(fpconfig & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT)
+        options = "-cl-fp32-correctly-rounded-divide-sqrt";
+    else
+        UTS_LOG(WARNING, VOXELS, "CLVoxeliser: ", device, " rounds division approximately, so voxels on a surface may differ from the CPU");
+    err = clBuildProgram(program, 1, &dev, options.c_str(), NULL, NULL);
+    if(err != CL_SUCCESS)
+    {
+        size_t loglen = 0;
+        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG, 0, NULL, &loglen);
+        vector<char> log(loglen + 1, '\0');
+        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG, loglen, log.data(), NULL);
+        cerr << "Error CLVoxeliser::init: voxelise.cl and isosurface.cl failed to build for " << device << endl << log.data() << endl;
+        return false;
+    }
+
+    primitivekernel = clCreateKernel(program, "primitiveLeaf", &err);
+    if(!check(err, "init", "creating primitiveLeaf"))
+        return false;
+    meshkernel = clCreateKernel(program, "meshParityRows", &err);
+    if(!check(err, "init", "creating meshParityRows"))
+        return false;
+    setopkernel = clCreateKernel(program, "setOpWords", &err);
+    if(!check(err, "init", "creating setOpWords"))
+        return false;
+    for(pair<cl_kernel *, const char *> k : {make_pair(&mccountkernel, "mcCountRows"), make_pair(&mcscanrowskernel, "mcScanRows"),
+                                             make_pair(&mcscanblockskernel, "mcScanBlocks"), make_pair(&mcvertkernel, "mcEmitVertices"),
+                                             make_pair(&mctrikernel, "mcEmitTriangles")})
+    {
+        * k.first = clCreateKernel(program, k.second, &err);
+        if(!check(err, "init", k.second))
+            return false;
+    }
+
+    // the marching cubes tables, with triangle edges narrowed to bytes
+    vector<cl_char> tritable(256 * 16);
+    for(int c = 0; c < 256; c++)
+        for(int e = 0; e < 16; e++)
+            tritable[16 * c + e] = (cl_char) triangleTable[c][e];
+    mctritable = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, tritable.size(), tritable.data(), &err);
+    if(!check(err, "init", "copying triangleTable"))
+        return false;
+    mcedgeflags = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 256 * sizeof(cl_int), cubeEdgeFlags, &err);
+    return check(err, "init", "copying cubeEdgeFlags");
+}
+
+void CLVoxeliser::release()
+{
+    end();
+    for(cl_kernel k : {mccountkernel, mcscanrowskernel, mcscanblockskernel, mcvertkernel, mctrikernel})
+        if(k != NULL)
+            clReleaseKernel(k);
+    for(cl_mem mem : {mctritable, mcedgeflags})
+        if(mem != NULL)
+            clReleaseMemObject(mem);
+    mccountkernel = mcscanrowskernel = mcscanblockskernel = mcvertkernel = mctrikernel = NULL;
+    mctritable = mcedgeflags = NULL;
+    glshared = false;
+    if(primitivekernel != NULL)
+        clReleaseKernel(primitivekernel);
+    if(meshkernel != NULL)
+        clReleaseKernel(meshkernel);
+    if(setopkernel != NULL)
+        clReleaseKernel(setopkernel);
+    if(program != NULL)
+        clReleaseProgram(program);
+    if(queue != NULL)
+        clReleaseCommandQueue(queue);
+    if(context != NULL)
+        clReleaseContext(context);
+    primitivekernel = meshkernel = setopkernel = NULL;
+    program = NULL;
+    queue = NULL;
+    context = NULL;
+    device.clear();
+}
+
+bool CLVoxeliser::runWords(cl_kernel kernel, const int * lo, const int * hi)
+{
+    size_t global[3] = {(size_t) (hi[0] / voxwordbits - lo[0] / voxwordbits + 1), (size_t) (hi[1] - lo[1] + 1), (size_t) (hi[2] - lo[2] + 1)};
+
+    return check(clEnqueueNDRangeKernel(queue, kernel, 3, NULL, global, NULL, 0, NULL, NULL), "runWords", "queueing a kernel");
+}
+
+bool CLVoxeliser::begin(VoxelVolume * like)
+{
+    size_t bytes;
+
+    if(!available())
+        return false;
+    end();
+    like->getDim(dim[0], dim[1], dim[2]);
+    like->getFrame(origin, diagonal);
+    xspan = like->getXSpan();
+    bytes = (size_t) xspan * dim[1] * dim[2] * sizeof(cl_uint);
+    if(bytes == 0 || bytes > maxalloc)
+    {
+        UTS_LOG(INFO, VOXELS, "CLVoxeliser: a volume of ", bytes, " bytes does not fit a single buffer on ", device);
+        return false;
+    }
+    return true;
+}
+
+void CLVoxeliser::end()
+{
+    releaseSurface();
+    for(cl_mem mem : volumes)
+        if(mem != NULL)
+            clReleaseMemObject(mem);
+    for(cl_mem mem : spare)
+        clReleaseMemObject(mem);
+    volumes.clear();
+    spare.clear();
+}
+
+int CLVoxeliser::takeVolume()
+{
+    size_t bytes = (size_t) xspan * dim[1] * dim[2] * sizeof(cl_uint), inuse = 0;
+    cl_uint zero = 0;
+    cl_mem mem = NULL;
+    cl_int err;
+
+    for(cl_mem used : volumes)
+        if(used != NULL)
+            inuse++;
+    if(!spare.empty())
+    {
+        mem = spare.back();
+        spare.pop_back();
+    }
+    else if(inuse < clmaxvolumes)
+    {
+        mem = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        if(err != CL_SUCCESS) // out of device memory is expected for deep trees, and the caller falls back
+        {
+            UTS_LOG(INFO, VOXELS, "CLVoxeliser: no room for another volume on ", device);
+            return -1;
+        }
+    }
+    else
+        return -1;
+    if(!check(clEnqueueFillBuffer(queue, mem, &zero, sizeof(cl_uint), 0, bytes, 0, NULL, NULL), "takeVolume", "clearing a volume"))
+    {
+        clReleaseMemObject(mem);
+        return -1;
+    }
+
+    for(int v = 0; v < (int) volumes.size(); v++)
+        if(volumes[v] == NULL)
+        {
+            volumes[v] = mem;
+            return v;
+        }
+    volumes.push_back(mem);
+    return (int) volumes.size() - 1;
+}
+
+void CLVoxeliser::giveVolume(int vol)
+{
+    if(vol == surfvol)
+        surfvol = -1;
+    if(vol >= 0 && vol < (int) volumes.size() && volumes[vol] != NULL)
+    {
+        spare.push_back(volumes[vol]);
+        volumes[vol] = NULL;
+    }
+}
+
+bool CLVoxeliser::leaf(BaseShape * shape, int vol, const int * lo, const int * hi)
+{
+    Sphere * sphere = (shape != NULL && shape->getKind() == ShapeKind::SPHERE) ? static_cast<Sphere *>(shape) : NULL;
+    Cylinder * cylinder = (shape != NULL && shape->getKind() == ShapeKind::CYLINDER) ? static_cast<Cylinder *>(shape) : NULL;
+    Square * square = (shape != NULL && shape->getKind() == ShapeKind::SQUARE) ? static_cast<Square *>(shape) : NULL;
+    Mesh * mesh = meshShape(shape);
+    cl_int4 vdim = {{dim[0], dim[1], dim[2], 0}}, vlo, vhi;
+    cl_float4 vorigin = {{origin.x, origin.y, origin.z, 0.0f}}, vdiag = {{diagonal.i, diagonal.j, diagonal.k, 0.0f}};
+    cl_float4 a = {{0.0f, 0.0f, 0.0f, 0.0f}}, b = {{0.0f, 0.0f, 0.0f, 0.0f}};
+    cl_int kind = clshapesphere, span = xspan;
+    int clo[3], chi[3];
+    bool ok = true;
+
+    if(vol < 0 || vol >= (int) volumes.size() || volumes[vol] == NULL || !hasKernel(shape))
+        return false;
+    if(vol == surfvol)
+        surfvol = -1;
+    if(!clip(lo, hi, clo, chi))
+        return true;
+    vlo = {{clo[0], clo[1], clo[2], 0}};
+    vhi = {{chi[0], chi[1], chi[2], 0}};
+
+    if(mesh != NULL) // rows of a tile share a list of the triangles whose y-z extent reaches them
+    {
+        int tilesy = (chi[1] - clo[1]) / clrowtile + 1, tilesz = (chi[2] - clo[2]) / clrowtile + 1, numt;
+        vector<float> coords;
+        vector<int> tilestart(tilesy * tilesz + 1, 0), tiletris, fill;
+        vector<int> range; // tiles spanned by each triangle, ylo, yhi, zlo, zhi
+        float x0 = origin.x + ((float) 0 / (float) (dim[0]-1)) * diagonal.i;
+        float x1 = origin.x + ((float) 1 / (float) (dim[0]-1)) * diagonal.i;
+        cl_float2 xrow = {{x0, (dim[0] > 1) ? x1 - x0 : 1.0f}};
+        cl_int tile = clrowtile, tiles = tilesy, overflow = 0;
+        cl_mem trisbuf, startbuf, listbuf, flagbuf;
+        cl_int err = CL_SUCCESS;
+        size_t global[2] = {(size_t) (chi[1] - clo[1] + 1), (size_t) (chi[2] - clo[2] + 1)};
+
+        mesh->packTriangles(coords);
+        numt = (int) coords.size() / 9;
+        range.resize(4 * numt);
+        for(int t = 0; t < numt; t++)
+        {
+            float ylo = coords[9*t+1], yhi = ylo, zlo = coords[9*t+2], zhi = zlo;
+            for(int p = 1; p < 3; p++)
+            {
+                ylo = std::min(ylo, coords[9*t+3*p+1]); yhi = std::max(yhi, coords[9*t+3*p+1]);
+                zlo = std::min(zlo, coords[9*t+3*p+2]); zhi = std::max(zhi, coords[9*t+3*p+2]);
+            }
+            // rows a voxel either side are included, so rounding never drops a row the triangle reaches
+            int rylo = std::max((int) floor((ylo - origin.y) / diagonal.j * (float) (dim[1]-1)) - 1, clo[1]);
+            int ryhi = std::min((int) ceil((yhi - origin.y) / diagonal.j * (float) (dim[1]-1)) + 1, chi[1]);
+            int rzlo = std::max((int) floor((zlo - origin.z) / diagonal.k * (float) (dim[2]-1)) - 1, clo[2]);
+            int rzhi = std::min((int) ceil((zhi - origin.z) / diagonal.k * (float) (dim[2]-1)) + 1, chi[2]);
+            if(rylo > ryhi || rzlo > rzhi)
+            {
+                range[4*t] = 0; range[4*t+1] = -1; range[4*t+2] = 0; range[4*t+3] = -1;
+                continue;
+            }
+            range[4*t] = (rylo - clo[1]) / clrowtile; range[4*t+1] = (ryhi - clo[1]) / clrowtile;
+            range[4*t+2] = (rzlo - clo[2]) / clrowtile; range[4*t+3] = (rzhi - clo[2]) / clrowtile;
+            for(int tz = range[4*t+2]; tz <= range[4*t+3]; tz++)
+                for(int ty = range[4*t]; ty <= range[4*t+1]; ty++)
+                    tilestart[tz * tilesy + ty + 1]++;
+        }
+        for(int i = 0; i < tilesy * tilesz; i++)
+            tilestart[i+1] += tilestart[i];
+        if(tilestart.back() == 0) // no triangle reaches any row
+            return true;
+        tiletris.resize(tilestart.back());
+        fill.assign(tilestart.begin(), tilestart.end() - 1);
+        for(int t = 0; t < numt; t++)
+            for(int tz = range[4*t+2]; tz <= range[4*t+3]; tz++)
+                for(int ty = range[4*t]; ty <= range[4*t+1]; ty++)
+                    tiletris[fill[tz * tilesy + ty]++] = t;
+
+        trisbuf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, coords.size() * sizeof(float), coords.data(), &err);
+        startbuf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, tilestart.size() * sizeof(int), tilestart.data(), &err);
+        listbuf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, tiletris.size() * sizeof(int), tiletris.data(), &err);
+        flagbuf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_int), &overflow, &err);
+        ok = trisbuf != NULL && startbuf != NULL && listbuf != NULL && flagbuf != NULL;
+        if(!ok)
+            check(err, "leaf", "copying a mesh");
+
+        if(ok)
+        {
+            cl_kernel k = meshkernel;
+            err = clSetKernelArg(k, 0, sizeof(cl_mem), &volumes[vol]);
+            err |= clSetKernelArg(k, 1, sizeof(cl_int4), &vdim);
+            err |= clSetKernelArg(k, 2, sizeof(cl_int), &span);
+            err |= clSetKernelArg(k, 3, sizeof(cl_int4), &vlo);
+            err |= clSetKernelArg(k, 4, sizeof(cl_int4), &vhi);
+            err |= clSetKernelArg(k, 5, sizeof(cl_float4), &vorigin);
+            err |= clSetKernelArg(k, 6, sizeof(cl_float4), &vdiag);
+            err |= clSetKernelArg(k, 7, sizeof(cl_mem), &trisbuf);
+            err |= clSetKernelArg(k, 8, sizeof(cl_mem), &startbuf);
+            err |= clSetKernelArg(k, 9, sizeof(cl_mem), &listbuf);
+            err |= clSetKernelArg(k, 10, sizeof(cl_int), &tile);
+            err |= clSetKernelArg(k, 11, sizeof(cl_int), &tiles);
+            err |= clSetKernelArg(k, 12, sizeof(cl_float2), &xrow);
+            err |= clSetKernelArg(k, 13, sizeof(cl_float), &scanmergetol);
+            err |= clSetKernelArg(k, 14, sizeof(cl_mem), &flagbuf);
+            ok = check(err, "leaf", "setting mesh arguments")
+                 && check(clEnqueueNDRangeKernel(queue, k, 2, NULL, global, NULL, 0, NULL, NULL), "leaf", "queueing meshParityRows")
+                 && check(clEnqueueReadBuffer(queue, flagbuf, CL_TRUE, 0, sizeof(cl_int), &overflow, 0, NULL, NULL), "leaf", "reading the overflow flag");
+        }
+        for(cl_mem mem : {trisbuf, startbuf, listbuf, flagbuf})
+            if(mem != NULL)
+                clReleaseMemObject(mem);
+        if(ok && overflow != 0)
+        {
+            UTS_LOG(INFO, VOXELS, "CLVoxeliser: a row crosses the mesh too often for the device");
+            return false;
+        }
+        return ok;
+    }
+
+    if(sphere != NULL)
+        a = {{sphere->c.x, sphere->c.y, sphere->c.z, sphere->r * sphere->r}};
+    else if(square != NULL) // containment is a ball of squared radius l^3
+        a = {{square->c.x, square->c.y, square->c.z, square->l * square->l * square->l}};
+    else
+    {
+        cgp::Vector dirvec;
+        dirvec.diff(cylinder->s, cylinder->e);
+        if(dirvec.sqrdlength() == 0.0f) // degenerate spine, containing nothing
+            return true;
+        kind = clshapecylinder;
+        a = {{cylinder->s.x, cylinder->s.y, cylinder->s.z, cylinder->r}};
+        b = {{dirvec.i, dirvec.j, dirvec.k, dirvec.sqrdlength()}};
+    }
+
+    cl_int err = clSetKernelArg(primitivekernel, 0, sizeof(cl_mem), &volumes[vol]);
+    err |= clSetKernelArg(primitivekernel, 1, sizeof(cl_int4), &vdim);
+    err |= clSetKernelArg(primitivekernel, 2, sizeof(cl_int), &span);
+    err |= clSetKernelArg(primitivekernel, 3, sizeof(cl_int4), &vlo);
+    err |= clSetKernelArg(primitivekernel, 4, sizeof(cl_int4), &vhi);
+    err |= clSetKernelArg(primitivekernel, 5, sizeof(cl_float4), &vorigin);
+    err |= clSetKernelArg(primitivekernel, 6, sizeof(cl_float4), &vdiag);
+    err |= clSetKernelArg(primitivekernel, 7, sizeof(cl_int), &kind);
+    err |= clSetKernelArg(primitivekernel, 8, sizeof(cl_float4), &a);
+    err |= clSetKernelArg(primitivekernel, 9, sizeof(cl_float4), &b);
+    return check(err, "leaf", "setting primitive arguments") && runWords(primitivekernel, clo, chi);
+}
+
+bool CLVoxeliser::setOp(int op, int left, int right, const int * lo, const int * hi)
+{
+    cl_int4 vdim = {{dim[0], dim[1], dim[2], 0}}, vlo;
+    cl_int span = xspan, code = op;
+    int clo[3], chi[3];
+    cl_int err;
+
+    if(left < 0 || left >= (int) volumes.size() || volumes[left] == NULL || right < 0 || right >= (int) volumes.size() || volumes[right] == NULL)
+    {
+        cerr << "Error CLVoxeliser::setOp: invalid volume handles " << left << " and " << right << endl;
+        return false;
+    }
+    if(left == surfvol)
+        surfvol = -1;
+    if(!clip(lo, hi, clo, chi))
+        return true;
+    vlo = {{clo[0], clo[1], clo[2], 0}};
+
+    err = clSetKernelArg(setopkernel, 0, sizeof(cl_mem), &volumes[left]);
+    err |= clSetKernelArg(setopkernel, 1, sizeof(cl_mem), &volumes[right]);
+    err |= clSetKernelArg(setopkernel, 2, sizeof(cl_int4), &vdim);
+    err |= clSetKernelArg(setopkernel, 3, sizeof(cl_int), &span);
+    err |= clSetKernelArg(setopkernel, 4, sizeof(cl_int4), &vlo);
+    err |= clSetKernelArg(setopkernel, 5, sizeof(cl_int), &code);
+    return check(err, "setOp", "setting arguments") && runWords(setopkernel, clo, chi);
+}
+
+bool CLVoxeliser::upload(int vol, VoxelVolume * vox)
+{
+    int dx, dy, dz;
+
+    vox->getDim(dx, dy, dz);
+    if(vol < 0 || vol >= (int) volumes.size() || volumes[vol] == NULL || dx != dim[0] || dy != dim[1] || dz != dim[2])
+    {
+        cerr << "Error CLVoxeliser::upload: invalid volume handle " << vol << " or mismatched dimensions" << endl;
+        return false;
+    }
+    if(vol == surfvol)
+        surfvol = -1;
+
+    vector<unsigned int> words((size_t) xspan * dy * dz);
+
+    #pragma omp parallel for
+    for(int z = 0; z < dz; z++)
+        for(int y = 0; y < dy; y++)
+            vox->getRow(y, z, &words[((size_t) z * dy + y) * xspan]);
+    return check(clEnqueueWriteBuffer(queue, volumes[vol], CL_TRUE, 0, words.size() * sizeof(unsigned int), words.data(), 0, NULL, NULL),
+                 "upload", "writing a volume");
+}
+
+bool CLVoxeliser::download(int vol, VoxelVolume * vox)
+{
+    int dx, dy, dz;
+
+    vox->getDim(dx, dy, dz);
+    if(vol < 0 || vol >= (int) volumes.size() || volumes[vol] == NULL || dx != dim[0] || dy != dim[1] || dz != dim[2])
+    {
+        cerr << "Error CLVoxeliser::download: invalid volume handle " << vol << " or mismatched dimensions" << endl;
+        return false;
+    }
+
+    vector<unsigned int> words((size_t) xspan * dy * dz);
+
+    if(!check(clEnqueueReadBuffer(queue, volumes[vol], CL_TRUE, 0, words.size() * sizeof(unsigned int), words.data(), 0, NULL, NULL),
+              "download", "reading a volume"))
+        return false;
+
+    // a run of voxbrickrows layers per thread, so sparse bricks are never allocated by two threads at once
+    #pragma omp parallel for schedule(dynamic)
+    for(int bz = 0; bz < (dz + voxbrickrows - 1) / voxbrickrows; bz++)
+        for(int z = bz * voxbrickrows; z < std::min(dz, (bz+1) * voxbrickrows); z++)
+            for(int y = 0; y < dy; y++)
+                vox->setRow(y, z, &words[((size_t) z * dy + y) * xspan]);
+    return true;
+}
+
+void CLVoxeliser::releaseSurface()
+{
+    for(cl_mem mem : {mccounts, mcbases, mcblocks})
+        if(mem != NULL)
+            clReleaseMemObject(mem);
+    mccounts = mcbases = mcblocks = NULL;
+    surfvol = -1;
+}
+
+bool CLVoxeliser::surfaceCounts(int vol, int &numverts, int &numtris)
+{
+    cl_int4 vdim = {{dim[0], dim[1], dim[2], 0}};
+    cl_int span = xspan, rows = dim[1] * dim[2], blocks = (rows + clscanblock - 1) / clscanblock;
+    size_t rowglobal[2] = {(size_t) dim[1], (size_t) dim[2]}, blockglobal = (size_t) blocks, one = 1;
+    cl_long totals[2] = {0, 0};
+    cl_int err;
+    bool ok;
+
+    numverts = numtris = 0;
+    if(vol < 0 || vol >= (int) volumes.size() || volumes[vol] == NULL)
+    {
+        cerr << "Error CLVoxeliser::surfaceCounts: invalid volume handle " << vol << endl;
+        return false;
+    }
+
+    // the row tables are kept for the emitting passes
+    releaseSurface();
+    mccounts = clCreateBuffer(context, CL_MEM_READ_WRITE, (size_t) rows * sizeof(cl_int4), NULL, &err);
+    mcbases = clCreateBuffer(context, CL_MEM_READ_WRITE, (size_t) rows * sizeof(cl_int2), NULL, &err);
+    mcblocks = clCreateBuffer(context, CL_MEM_READ_WRITE, (size_t) (blocks + 1) * sizeof(cl_long2), NULL, &err);
+    if(mccounts == NULL || mcbases == NULL || mcblocks == NULL)
+    {
+        check(err, "surfaceCounts", "allocating row tables");
+        releaseSurface();
+        return false;
+    }
+    err = clSetKernelArg(mccountkernel, 0, sizeof(cl_mem), &volumes[vol]);
+    err |= clSetKernelArg(mccountkernel, 1, sizeof(cl_int4), &vdim);
+    err |= clSetKernelArg(mccountkernel, 2, sizeof(cl_int), &span);
+    err |= clSetKernelArg(mccountkernel, 3, sizeof(cl_mem), &mctritable);
+    err |= clSetKernelArg(mccountkernel, 4, sizeof(cl_mem), &mcedgeflags);
+    err |= clSetKernelArg(mccountkernel, 5, sizeof(cl_mem), &mccounts);
+    err |= clSetKernelArg(mcscanrowskernel, 0, sizeof(cl_mem), &mccounts);
+    err |= clSetKernelArg(mcscanrowskernel, 1, sizeof(cl_int), &rows);
+    err |= clSetKernelArg(mcscanrowskernel, 2, sizeof(cl_mem), &mcbases);
+    err |= clSetKernelArg(mcscanrowskernel, 3, sizeof(cl_mem), &mcblocks);
+    err |= clSetKernelArg(mcscanblockskernel, 0, sizeof(cl_mem), &mcblocks);
+    err |= clSetKernelArg(mcscanblockskernel, 1, sizeof(cl_int), &blocks);
+    ok = check(err, "surfaceCounts", "setting arguments")
+         && check(clEnqueueNDRangeKernel(queue, mccountkernel, 2, NULL, rowglobal, NULL, 0, NULL, NULL), "surfaceCounts", "queueing mcCountRows")
+         && check(clEnqueueNDRangeKernel(queue, mcscanrowskernel, 1, NULL, &blockglobal, NULL, 0, NULL, NULL), "surfaceCounts", "queueing mcScanRows")
+         && check(clEnqueueNDRangeKernel(queue, mcscanblockskernel, 1, NULL, &one, NULL, 0, NULL, NULL), "surfaceCounts", "queueing mcScanBlocks")
+         && check(clEnqueueReadBuffer(queue, mcblocks, CL_TRUE, (size_t) blocks * sizeof(cl_long2), sizeof(totals), totals, 0, NULL, NULL),
+                  "surfaceCounts", "reading the totals");
+
+    // totals are summed in 64 bits, but indices and the draw call count in 32
+    if(ok && (totals[0] > INT_MAX || totals[1] > INT_MAX / 3))
+    {
+        UTS_LOG(INFO, VOXELS, "CLVoxeliser: the surface is too large for 32-bit indices");
+        ok = false;
+    }
+    if(!ok)
+    {
+        releaseSurface();
+        return false;
+    }
+    surfvol = vol;
+    surfverts = numverts = (int) totals[0];
+    surftris = numtris = (int) totals[1];
+    return true;
+}
+
+bool CLVoxeliser::emitSurface(cl_mem verts, cl_mem indices)
+{
+    cl_int4 vdim = {{dim[0], dim[1], dim[2], 0}};
+    cl_float4 vorigin = {{origin.x, origin.y, origin.z, 0.0f}};
+    cl_float4 edgelen = {{diagonal.i / (float) (dim[0]-1), diagonal.j / (float) (dim[1]-1), diagonal.k / (float) (dim[2]-1), 0.0f}};
+    cl_int span = xspan;
+    size_t vertglobal[2] = {(size_t) dim[1], (size_t) dim[2]}, triglobal[2] = {(size_t) dim[1] - 1, (size_t) dim[2] - 1};
+    cl_int err;
+    bool ok;
+
+    err = clSetKernelArg(mcvertkernel, 0, sizeof(cl_mem), &volumes[surfvol]);
+    err |= clSetKernelArg(mcvertkernel, 1, sizeof(cl_int4), &vdim);
+    err |= clSetKernelArg(mcvertkernel, 2, sizeof(cl_int), &span);
+    err |= clSetKernelArg(mcvertkernel, 3, sizeof(cl_mem), &mcbases);
+    err |= clSetKernelArg(mcvertkernel, 4, sizeof(cl_mem), &mcblocks);
+    err |= clSetKernelArg(mcvertkernel, 5, sizeof(cl_float4), &vorigin);
+    err |= clSetKernelArg(mcvertkernel, 6, sizeof(cl_float4), &edgelen);
+    err |= clSetKernelArg(mcvertkernel, 7, sizeof(cl_mem), &verts);
+    err |= clSetKernelArg(mctrikernel, 0, sizeof(cl_mem), &volumes[surfvol]);
+    err |= clSetKernelArg(mctrikernel, 1, sizeof(cl_int4), &vdim);
+    err |= clSetKernelArg(mctrikernel, 2, sizeof(cl_int), &span);
+    err |= clSetKernelArg(mctrikernel, 3, sizeof(cl_mem), &mctritable);
+    err |= clSetKernelArg(mctrikernel, 4, sizeof(cl_mem), &mcedgeflags);
+    err |= clSetKernelArg(mctrikernel, 5, sizeof(cl_mem), &mccounts);
+    err |= clSetKernelArg(mctrikernel, 6, sizeof(cl_mem), &mcbases);
+    err |= clSetKernelArg(mctrikernel, 7, sizeof(cl_mem), &mcblocks);
+    err |= clSetKernelArg(mctrikernel, 8, sizeof(cl_mem), &indices);
+    ok = check(err, "emitSurface", "setting arguments")
+         && check(clEnqueueNDRangeKernel(queue, mcvertkernel, 2, NULL, vertglobal, NULL, 0, NULL, NULL), "emitSurface", "queueing mcEmitVertices")
+         && check(clEnqueueNDRangeKernel(queue, mctrikernel, 2, NULL, triglobal, NULL, 0, NULL, NULL), "emitSurface", "queueing mcEmitTriangles");
+    return ok;
+}
+
+bool CLVoxeliser::emitSurfaceGL(unsigned int vbo, unsigned int ibo)
+{
+#ifdef TESS_HEADLESS
+    return false;
+#else
+    cl_mem glbufs[2];
+    cl_int err;
+    bool ok;
+
+    if(!glshared || surfvol < 0)
+        return false;
+    if(surftris == 0) // nothing to write, and empty buffers cannot be shared
+        return true;
+    glbufs[0] = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, vbo, &err);
+    if(!check(err, "emitSurfaceGL", "sharing the vertex buffer"))
+        return false;
+    glbufs[1] = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, ibo, &err);
+    if(!check(err, "emitSurfaceGL", "sharing the index buffer"))
+    {
+        clReleaseMemObject(glbufs[0]);
+        return false;
+    }
+
+    ok = check(clEnqueueAcquireGLObjects(queue, 2, glbufs, 0, NULL, NULL), "emitSurfaceGL", "acquiring the buffers");
+    if(ok)
+    {
+        ok = emitSurface(glbufs[0], glbufs[1]);
+        ok = check(clEnqueueReleaseGLObjects(queue, 2, glbufs, 0, NULL, NULL), "emitSurfaceGL", "releasing the buffers") && ok;
+    }
+    // OpenGL may draw from the buffers as soon as this returns
+    ok = check(clFinish(queue), "emitSurfaceGL", "finishing") && ok;
+    clReleaseMemObject(glbufs[0]);
+    clReleaseMemObject(glbufs[1]);
+    return ok;
+#endif
+}
+
+bool CLVoxeliser::readSurface(std::vector<unsigned int> &verts, std::vector<unsigned int> &indices)
+{
+    cl_mem vbuf, ibuf;
+    cl_int err;
+    bool ok;
+
+    verts.clear();
+    indices.clear();
+    if(surfvol < 0)
+    {
+        cerr << "Error CLVoxeliser::readSurface: no surface has been counted" << endl;
+        return false;
+    }
+    if(surftris == 0)
+        return true;
+    verts.resize(4 * (size_t) surfverts);
+    indices.resize(3 * (size_t) surftris);
+    vbuf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, verts.size() * sizeof(unsigned int), NULL, &err);
+    if(!check(err, "readSurface", "allocating vertices"))
+        return false;
+    ibuf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, indices.size() * sizeof(unsigned int), NULL, &err);
+    if(!check(err, "readSurface", "allocating indices"))
+    {
+        clReleaseMemObject(vbuf);
+        return false;
+    }
+    ok = emitSurface(vbuf, ibuf)
+         && check(clEnqueueReadBuffer(queue, vbuf, CL_TRUE, 0, verts.size() * sizeof(unsigned int), verts.data(), 0, NULL, NULL),
+                  "readSurface", "reading vertices")
+         && check(clEnqueueReadBuffer(queue, ibuf, CL_TRUE, 0, indices.size() * sizeof(unsigned int), indices.data(), 0, NULL, NULL),
+                  "readSurface", "reading indices");
+    clReleaseMemObject(vbuf);
+    clReleaseMemObject(ibuf);
+    if(!ok)
+    {
+        verts.clear();
+        indices.clear();
+    }
+    return ok;
+}
+
+#else // no OpenCL, so there is never a device and nothing is called beyond available
+
+bool CLVoxeliser::begin(VoxelVolume * like){ return false; }
+void CLVoxeliser::end(){}
+int CLVoxeliser::takeVolume(){ return -1; }
+void CLVoxeliser::giveVolume(int vol){}
+bool CLVoxeliser::leaf(BaseShape * shape, int vol, const int * lo, const int * hi){ return false; }
+bool CLVoxeliser::setOp(int op, int left, int right, const int * lo, const int * hi){ return false; }
+bool CLVoxeliser::upload(int vol, VoxelVolume * vox){ return false; }
+bool CLVoxeliser::download(int vol, VoxelVolume * vox){ return false; }
+bool CLVoxeliser::surfaceCounts(int vol, int &numverts, int &numtris){ numverts = numtris = 0; return false; }
+bool CLVoxeliser::emitSurfaceGL(unsigned int vbo, unsigned int ibo){ return false; }
+bool CLVoxeliser::readSurface(std::vector<unsigned int> &verts, std::vector<unsigned int> &indices){ return false; }
+
+#endif
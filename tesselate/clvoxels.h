@@ -0,0 +1,244 @@
+#ifndef _CLVOXELS
+#define _CLVOXELS
+/**
+ * @file
+ *
+ * Voxelisation of csg leaves, set operations and isosurface extraction on an OpenCL device
+ */
+
+#include <vector>
+#include <string>
+#include "mesh.h"
+#include "voxels.h"
+
+#ifdef TESS_OPENCL
+#include <CL/cl.h>
+#endif
+
+const int clrowtile = 8;            ///< rows along y and z sharing a list of candidate triangles for mesh parity
+const size_t clmaxvolumes = 16;     ///< device volumes allowed at once, bounding the depth of csg tree evaluated
+
+/**
+ * Device side voxel volumes, with kernels (clh/voxelise.cl) that fill them from Sphere, Cylinder and Square leaves by
+ * analytic containment and from parity meshes by casting a ray along each row, and that combine them a packed word
+ * at a time as for Scene::voxSetOp. Volumes are bit-packed exactly as dense VoxelVolume storage, so a finished volume
+ * is read back in a single transfer, and leaves without a kernel can be voxelised on the CPU and uploaded.
+ *
+ * A device volume can also be turned into a surface by marching cubes (clh/isosurface.cl), written as CompactVertex
+ * vertices and 32-bit indices. When the device shares the OpenGL context of the viewer the surface is written
+ * straight into its buffers, so no copy of the surface or the volume passes through the host.
+ *
+ * The device is found on first use. Builds without TESS_OPENCL, or machines without an OpenCL device, report the
+ * backend as unavailable and the caller evaluates on the CPU instead.
+ */
+class CLVoxeliser
+{
+private:
+    int dim[3];                     ///< number of voxels in x (padded), y and z dimensions of every volume
+    int xspan;                      ///< number of words per x row
+    cgp::Point origin;              ///< corner point of the volumes in world space
+    cgp::Vector diagonal;           ///< diagonal extent of the volumes in world space
+    bool tried;                     ///< a device has been looked for
+    bool ready;                     ///< a device was found and the kernels built
+    bool glwanted;                  ///< shareGL was called, so the context should share that of OpenGL
+    bool glshared;                  ///< the context shares the OpenGL context, so emitSurfaceGL can write its buffers
+    std::string device;             ///< name of the device in use
+    int surfvol;                    ///< volume whose rows surfaceCounts last counted, or -1
+    int surfverts, surftris;        ///< vertices and triangles counted by surfaceCounts
+#ifdef TESS_OPENCL
+    cl_context context;             ///< context on the device
+    cl_command_queue queue;         ///< in-order queue for every transfer and kernel
+    cl_program program;             ///< kernels built from clh/voxelise.cl
+    cl_kernel primitivekernel;      ///< analytic leaf containment
+    cl_kernel meshkernel;           ///< mesh parity by rows
+    cl_kernel setopkernel;          ///< word by word set operations
+    cl_kernel mccountkernel;        ///< surface vertices and triangles per row
+    cl_kernel mcscanrowskernel;     ///< prefix sums of the row counts within blocks
+    cl_kernel mcscanblockskernel;   ///< prefix sums of the block totals
+    cl_kernel mcvertkernel;         ///< surface vertices per row
+    cl_kernel mctrikernel;          ///< surface triangles per row
+    cl_mem mctritable;              ///< triangleTable narrowed to bytes
+    cl_mem mcedgeflags;             ///< cubeEdgeFlags
+    cl_mem mccounts;                ///< per row counts of the last surfaceCounts
+    cl_mem mcbases;                 ///< per row output offsets within their block
+    cl_mem mcblocks;                ///< per block 64-bit output offsets, then the totals
+    cl_context_properties glprops[5]; ///< OpenGL context captured by shareGL, terminated by 0
+    size_t maxalloc;                ///< largest single buffer the device allows
+    std::vector<cl_mem> volumes;    ///< device volumes, NULL once handed back
+    std::vector<cl_mem> spare;      ///< volumes handed back, for reuse by takeVolume
+
+    /**
+     * Report an OpenCL failure
+     * @param err       error code returned by the call
+     * @param method    method in which the call failed
+     * @param what      description of the call
+     * @retval true if @a err is CL_SUCCESS,
+     * @retval false otherwise, which is reported
+     */
+    bool check(cl_int err, const char * method, const char * what);
+
+    /// Find a device, preferring a GPU, and build the kernels
+    bool init();
+
+    /// Release every device object
+    void release();
+
+    /**
+     * Queue a kernel over a box of voxels, one work item per packed word
+     * @param kernel    kernel whose arguments are set
+     * @param lo, hi    inclusive voxel range
+     */
+    bool runWords(cl_kernel kernel, const int * lo, const int * hi);
+
+    /// Release the row count buffers of surfaceCounts
+    void releaseSurface();
+
+    /**
+     * Write the surface counted by surfaceCounts into device buffers
+     * @param verts     buffer of CompactVertex vertices, surfverts of them
+     * @param indices   buffer of 32-bit indices, 3 * surftris of them
+     */
+    bool emitSurface(cl_mem verts, cl_mem indices);
+#endif
+
+    /**
+     * Clip a voxel range to the volume
+     * @param lo, hi        inclusive voxel range, or NULL for the whole volume
+     * @param[out] clo, chi clipped range
+     * @retval true if the clipped range holds any voxels,
+     * @retval false otherwise
+     */
+    bool clip(const int * lo, const int * hi, int * clo, int * chi);
+
+public:
+
+    /// Default constructor, which does not touch the device until it is needed
+    CLVoxeliser();
+
+    /// Destructor, which releases the device
+    ~CLVoxeliser();
+
+    CLVoxeliser(const CLVoxeliser &) = delete;
+    CLVoxeliser & operator=(const CLVoxeliser &) = delete;
+
+    /**
+     * Find a device on first use
+     * @retval true if there is a device and the kernels built,
+     * @retval false if built without TESS_OPENCL or no device was found, which is only reported once
+     */
+    bool available();
+
+    /// Name of the device in use, empty if there is none
+    std::string getDeviceName(){ return device; }
+
+    /**
+     * Ask for the device context to share the OpenGL context current on the calling thread, so that surfaces can
+     * be written into OpenGL buffers. A device already in use without sharing is found again on next use.
+     * Builds without OpenGL (TESS_HEADLESS) ignore the request.
+     */
+    void shareGL();
+
+    /// Test whether surfaces can be written into OpenGL buffers by emitSurfaceGL
+    bool sharesGL(){ return glshared; }
+
+    /**
+     * Start evaluating a volume, handing back any device volumes from before
+     * @param like  volume whose dimensions and frame every device volume takes
+     * @retval true if a volume of this size fits in a single device buffer,
+     * @retval false otherwise, or if there is no device
+     */
+    bool begin(VoxelVolume * like);
+
+    /// Release the device volumes, and any surface counted from them, once the evaluation is over
+    void end();
+
+    /**
+     * Allocate an empty device volume
+     * @returns handle of the volume, or -1 if the device is out of memory or too many volumes are in use
+     */
+    int takeVolume();
+
+    /**
+     * Hand back a device volume for reuse by takeVolume
+     * @param vol   handle of the volume
+     */
+    void giveVolume(int vol);
+
+    /**
+     * Test whether a shape has a device kernel. Parity meshes do, though a mesh may still be refused by leaf.
+     * @param shape     leaf shape
+     */
+    static bool hasKernel(BaseShape * shape);
+
+    /**
+     * Voxelise a leaf into a device volume, over a box of voxels, as for Scene::voxTile or Mesh::scanRow
+     * @param shape     leaf shape, for which hasKernel is true
+     * @param vol       handle of a device volume, empty within the box
+     * @param lo, hi    inclusive voxel range of the box
+     * @retval true if the leaf was voxelised,
+     * @retval false if it has no kernel, a row of a mesh crosses it too often, or the device failed
+     */
+    bool leaf(BaseShape * shape, int vol, const int * lo, const int * hi);
+
+    /**
+     * Combine two device volumes, as for Scene::voxSetOp
+     * @param op        0 for union, 1 for intersection and 2 for difference, as for VoxelVolume::unionWith,
+     *                  intersectWith and subtract
+     * @param left      handle of the first operand, overwritten with the result
+     * @param right     handle of the second operand
+     * @param lo, hi    inclusive voxel range outside of which @a left is unchanged, whole words in x
+     * @retval true if the operation ran,
+     * @retval false otherwise
+     */
+    bool setOp(int op, int left, int right, const int * lo, const int * hi);
+
+    /**
+     * Copy a host volume into a device volume, in a single transfer
+     * @param vol   handle of the device volume
+     * @param vox   dense or sparse volume with the same dimensions
+     * @retval true if the volume was copied,
+     * @retval false otherwise
+     */
+    bool upload(int vol, VoxelVolume * vox);
+
+    /**
+     * Copy a device volume back into a host volume, in a single transfer
+     * @param vol       handle of the device volume
+     * @param[out] vox  dense or sparse volume with the same dimensions, overwritten
+     * @retval true if the volume was copied,
+     * @retval false otherwise
+     */
+    bool download(int vol, VoxelVolume * vox);
+
+    /**
+     * Count the marching cubes surface of a device volume, as Mesh::marchingCubes would extract it from a
+     * VoxelVolume, ready for emitSurfaceGL or readSurface
+     * @param vol               handle of the device volume
+     * @param[out] numverts     number of surface vertices
+     * @param[out] numtris      number of surface triangles
+     * @retval true if the surface was counted,
+     * @retval false if the device failed or the counts overflow 32-bit indices
+     */
+    bool surfaceCounts(int vol, int &numverts, int &numtris);
+
+    /**
+     * Write the surface counted by surfaceCounts straight into OpenGL buffers. OpenGL must be done with the
+     * buffers, as after glFinish, and may use them as soon as this returns.
+     * @param vbo   vertex buffer with room for the vertices as CompactVertex
+     * @param ibo   index buffer with room for 3 unsigned int indices per triangle
+     * @retval true if the buffers were written,
+     * @retval false if the context does not share OpenGL, no surface was counted or the device failed
+     */
+    bool emitSurfaceGL(unsigned int vbo, unsigned int ibo);
+
+    /**
+     * Read back the surface counted by surfaceCounts, for devices that do not share OpenGL
+     * @param[out] verts    4 words per vertex laid out as CompactVertex
+     * @param[out] indices  3 indices per triangle, with the winding of Mesh::marchingCubes
+     * @retval true if the surface was read,
+     * @retval false if no surface was counted or the device failed
+     */
+    bool readSurface(std::vector<unsigned int> &verts, std::vector<unsigned int> &indices);
+};
+
+#endif
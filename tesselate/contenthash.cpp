@@ -0,0 +1,84 @@
+//
+// ContentHash
+//
+
+#include "contenthash.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+const uint64_t hashbasis = 0xcbf29ce484222325ull;  ///< FNV-1a 64-bit offset basis
+const uint64_t hashprime = 0x100000001b3ull;       ///< FNV-1a 64-bit prime
+const size_t hashfilechunk = 1 << 20;               ///< bytes read from a file at a time
+
+ContentHash::ContentHash()
+{
+    state = hashbasis;
+}
+
+void ContentHash::add(const void * data, size_t len)
+{
+    const unsigned char * bytes = (const unsigned char *) data;
+    uint64_t word;
+    size_t i;
+
+    for(i = 0; i + 8 <= len; i += 8)
+    {
+        memcpy(&word, bytes + i, 8);
+        state = (state ^ word) * hashprime;
+    }
+    for(; i < len; i++)
+        state = (state ^ (uint64_t) bytes[i]) * hashprime;
+}
+
+bool ContentHash::addFile(const std::string &filename)
+{
+    std::vector<char> chunk(hashfilechunk);
+    FILE * fp;
+    size_t got;
+    int64_t total = 0;
+    bool ok;
+
+    fp = fopen(filename.c_str(), "rb");
+    if(fp == NULL)
+        return false;
+    while((got = fread(&chunk[0], 1, hashfilechunk, fp)) > 0)
+    {
+        add(&chunk[0], got);
+        total += (int64_t) got;
+    }
+    ok = !ferror(fp);
+    fclose(fp);
+    addInt(total);
+    return ok;
+}
+
+uint64_t ContentHash::value() const
+{
+    uint64_t h = state;
+
+    // splitmix64 finaliser, so that every input bit affects every output bit
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+std::string ContentHash::hex() const
+{
+    char buf[17];
+
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) value());
+    return std::string(buf);
+}
+
+uint64_t ContentHash::combine(uint64_t a, uint64_t b)
+{
+    ContentHash joined;
+
+    joined.add(&a, sizeof(a));
+    joined.add(&b, sizeof(b));
+    return joined.value();
+}
@@ -0,0 +1,68 @@
+/**
+ * @file
+ *
+ * Incremental 64-bit content hash, used to key cached pipeline results on their inputs.
+ */
+
+#ifndef _CONTENTHASH
+#define _CONTENTHASH
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Accumulates a 64-bit hash over a sequence of values. Data is consumed 8 bytes at a time with an FNV-1a style
+ * multiply, so large buffers and files hash at close to memory speed, and the result is finalised with an avalanche
+ * mix. This is for cache keys and not cryptographically secure. Callers add lengths before variable sized data so
+ * that different sequences of values cannot run together into the same byte stream.
+ */
+class ContentHash
+{
+private:
+    uint64_t state;     ///< running hash
+
+public:
+
+    /// Default constructor
+    ContentHash();
+
+    /**
+     * Add raw bytes to the hash
+     * @param data  start of the bytes
+     * @param len   number of bytes
+     */
+    void add(const void * data, size_t len);
+
+    /// Add a single integer
+    void addInt(int64_t val){ add(&val, sizeof(val)); }
+
+    /// Add a single float, with negative zero treated as zero
+    void addFloat(float val){ if(val == 0.0f) val = 0.0f; add(&val, sizeof(val)); }
+
+    /// Add a string, prefixed by its length
+    void addString(const std::string &str){ addInt((int64_t) str.size()); add(str.data(), str.size()); }
+
+    /**
+     * Add the length and contents of a file
+     * @param filename  name of the file to hash
+     * @retval true if the whole file was read,
+     * @retval false otherwise, in which case the hash should not be used
+     */
+    bool addFile(const std::string &filename);
+
+    /// Finalised hash of everything added so far
+    uint64_t value() const;
+
+    /// Hash value as 16 hexadecimal digits, suitable for a file name
+    std::string hex() const;
+
+    /**
+     * Hash of two hashes in order, for joining the hashes of separately hashed pieces of an array
+     * @param a     hash of the earlier piece
+     * @param b     hash of the later piece
+     */
+    static uint64_t combine(uint64_t a, uint64_t b);
+};
+
+#endif
@@ -3,6 +3,7 @@
 //
 
 #include "csg.h"
+#include "tokenizer.h"
 #define GLM_ENABLE_EXPERIMENTAL
 #include <stdio.h>
 #include <math.h>
@@ -10,81 +11,262 @@
 #include <iostream>
 #include <limits>
 #include <stack>
+#include <unordered_set>
+#include <algorithm>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/rotate_vector.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "common/serialize.h"
+#include "common/timer.h"
+#include "common/trace.h"
+#include "common/counters.h"
+#include "common/memory.h"
+#include "common/log.h"
 
 using namespace std;
 // using namespace cgp;
 
 GLfloat defaultCol[] = {0.243f, 0.176f, 0.75f, 1.0f};
+const int piecegridlen = 32; ///< side length of the voxel grid allocated for procedurally defined pieces
+const float blocklen = 10.0f; ///< side length in mm of the cube emitted for each voxel by the block scenes
+const int voxtilerows = 16; ///< y and z extent of a leaf voxelisation task
+const int voxtilewords = 2; ///< x extent of a leaf voxelisation task in packed words
+const int voxoctreeleaf = 4; ///< side of the adaptive voxelisation cells whose voxels are tested individually
+const int voxoctreetask = 32; ///< side of the smallest adaptive voxelisation cell run as its own task, a whole packed word in x
+const int cacheversion = 1; ///< hashed into every cache key, bump to invalidate results from older code
+
+static stats::TimeInit voxLeafTime("Scene::voxWalk leaf");
+static stats::TimeInit clLeafTime("Scene::clWalk leaf");
+static stats::TimeInit glLeafTime("Scene::glWalk leaf");
+static stats::TimeInit dexelLeafTime("Scene::dexelWalk leaf");
+static stats::TimeInit voxSetOpTime("Scene::voxSetOp");
+static stats::TimeInit evaluateTime("CSGProgram::evaluate");
+static stats::TimeInit cleanVoxelsTime("Scene::cleanVoxels");
+static stats::MemoryInit voxelGridMemory("Scene::writeVoxelGrid");
+
+/**
+ * Call a function object with the prepared containment test of an analytic primitive, so that the function is
+ * instantiated, and the test inlined, for each type of primitive
+ * @param shape     leaf shape
+ * @param fn        function object with a template call operator taking the test
+ * @retval true if the shape is a Sphere, Cylinder or Square,
+ * @retval false otherwise, in which case @a fn is not called
+ */
+template<class Fn>
+static bool withPrimitive(BaseShape * shape, const Fn &fn)
+{
+    switch(shape->getKind())
+    {
+        case ShapeKind::SPHERE:
+            fn(Sphere::Inside(* static_cast<Sphere *>(shape)));
+            return true;
+        case ShapeKind::CYLINDER:
+            fn(Cylinder::Inside(* static_cast<Cylinder *>(shape)));
+            return true;
+        case ShapeKind::SQUARE:
+            fn(Square::Inside(* static_cast<Square *>(shape)));
+            return true;
+        default:
+            return false;
+    }
+}
 
-bool Scene::genVizRender(View * view, ShapeDrawData &sdd)
+/// Count points tested inline against a sphere, by the type of its containment test
+static inline void countInside(const Sphere::Inside &, int64_t n){ UTS_COUNT(SPHERE_CONTAINMENT, n); }
+
+/// Count points tested inline against a cylinder
+static inline void countInside(const Cylinder::Inside &, int64_t n){ UTS_COUNT(CYLINDER_CONTAINMENT, n); }
+
+/// Count points tested inline against a cube
+static inline void countInside(const Square::Inside &, int64_t n){ UTS_COUNT(CUBE_CONTAINMENT, n); }
+
+/**
+ * Spacing of voxel centres along x
+ * @param vox   volume to measure
+ * @returns world distance between neighbouring voxels in x, or 0 if the volume is a single voxel wide
+ */
+static float voxelStepX(VoxelVolume * vox)
 {
-    std::vector<ShapeNode *> leaves;
-    std::stack<SceneNode *> nodes;
-    SceneNode * currnode;
-    OpNode * currop;
-    ShapeNode * currshape;
-    int i;
+    int dx, dy, dz;
 
-    geom.clear();
-    geom.setColour(defaultCol);
+    vox->getDim(dx, dy, dz);
+    if(dx < 2)
+        return 0.0f;
+    return (vox->getVoxelPos(dx - 1, 0, 0).x - vox->getVoxelPos(0, 0, 0).x) / (float) (dx - 1);
+}
 
-    // gather vector of leaf nodes
-    if(csgroot != NULL)
+/**
+ * Narrow a range of voxels along a row to those a primitive could contain, so that its test runs only there
+ * @param inside            containment test of the primitive
+ * @param py, pz            world y and z coordinates of the row
+ * @param x0, xstep         world x coordinate of voxel 0 and spacing between voxels, not narrowed unless positive
+ * @param[in,out] first, last   inclusive range of voxels, left with first > last if the row misses
+ */
+template<class Inside>
+static void primitiveSpan(const Inside &inside, float py, float pz, float x0, float xstep, int &first, int &last)
+{
+    float xmin, xmax;
+    double f, l;
+
+    if(!inside.rowSpan(py, pz, xmin, xmax))
     {
-        if(dynamic_cast<ShapeNode*>( csgroot ) == 0) // OpNode
-        {
-            nodes.push(csgroot);
-        }
-        else // ShapeNode
+        last = first - 1;
+        return;
+    }
+    if(xstep <= 0.0f)
+        return;
+    // a voxel either side covers the rounding of voxel positions
+    f = floor((xmin - x0) / xstep) - 1.0;
+    l = ceil((xmax - x0) / xstep) + 1.0;
+    if(f > (double) first)
+        first = (f > (double) last) ? last + 1 : (int) f;
+    if(l < (double) last)
+        last = (l < (double) first) ? first - 1 : (int) l;
+}
+
+/// Set the needed voxels of a packed row that are inside a primitive, for CSGProgram::evalRow
+struct PrimitiveRow
+{
+    const float * xpos;         ///< world x coordinate of each voxel along the row
+    float xstep;                ///< spacing between voxels along the row
+    float py, pz;               ///< world y and z coordinates of the row
+    int xlo, xhi;               ///< inclusive range of voxels that could be inside
+    const unsigned int * need;  ///< words marking the voxels to test
+    unsigned int * res;         ///< words in which inside voxels are set
+
+    template<class Inside>
+    void operator()(const Inside &inside) const
+    {
+        int first = xlo, last = xhi;
+
+        primitiveSpan(inside, py, pz, xpos[0], xstep, first, last);
+        UTS_COUNT(VOXELS_SKIPPED, (xhi - xlo) - std::max(last - first, -1));
+        if(first > last)
+            return;
+        for(int w = first / 32; w <= last / 32; w++)
         {
-            currshape = dynamic_cast<ShapeNode*>( csgroot );
-            leaves.push_back((ShapeNode *) csgroot);
+            unsigned int word = 0u;
+            int start = std::max(first, w * 32), end = std::min(last, w * 32 + 31);
+
+            if(need[w] == 0u)
+                continue;
+            countInside(inside, end - start + 1);
+            for(int x = start; x <= end; x++)
+                word |= (unsigned int) inside(xpos[x], py, pz) << (31 - x % 32);
+            res[w] |= word & need[w];
         }
+    }
+};
 
-        // explicit walk of csg tree using stack
-        while(!nodes.empty())
-        {
-            currnode = nodes.top();
-            currop = dynamic_cast<OpNode*> (currnode);
-            nodes.pop();
+/// Set every voxel of a box by whether it is inside a primitive, a packed word at a time, for Scene::voxTile
+struct PrimitiveTile
+{
+    VoxelVolume * voxels;       ///< volume being voxelised
+    const float * xpos;         ///< world x coordinate of each voxel along a row, from lo[0]
+    float xstep;                ///< spacing between voxels along a row
+    const int * lo, * hi;       ///< inclusive voxel range of the box
 
-            // left subtree
-            if(dynamic_cast<ShapeNode*>( currop->left ) == 0) // cast fails so it is an OpNode
-            {
-                nodes.push(currop->left);
-            }
-            else // ShapeNode, so treat as leaf
+    template<class Inside>
+    void operator()(const Inside &inside) const
+    {
+        for(int z = lo[2]; z <= hi[2]; z++)
+            for(int y = lo[1]; y <= hi[1]; y++)
             {
-                currshape = dynamic_cast<ShapeNode*>( currop->left );
-                leaves.push_back(currshape);
-            }
+                cgp::Point rowpos = voxels->getVoxelPos(lo[0], y, z);
+                int first = lo[0], last = hi[0];
 
-            // right subtree
-            if(dynamic_cast<ShapeNode*>( currop->right ) == 0) // cast fails so it is an OpNode
-            {
-                nodes.push(currop->right);
-            }
-            else // ShapeNode, so treat as leaf
-            {
-                currshape = dynamic_cast<ShapeNode*>( currop->right );
-                leaves.push_back(currshape);
+                primitiveSpan(inside, rowpos.y, rowpos.z, xpos[0] - lo[0] * xstep, xstep, first, last);
+                countInside(inside, std::max(last - first + 1, 0));
+                UTS_COUNT(VOXELS_SKIPPED, (hi[0] - lo[0]) - std::max(last - first, -1));
+                for(int w = lo[0] / 32; w <= hi[0] / 32; w++)
+                {
+                    int start = std::max(lo[0], w * 32), end = std::min(hi[0], w * 32 + 31);
+                    unsigned int mask = (~0u >> (start - w * 32)) & (~0u << (w * 32 + 31 - end)), word = 0u;
+
+                    for(int x = std::max(start, first); x <= std::min(end, last); x++)
+                        word |= (unsigned int) inside(xpos[x - lo[0]], rowpos.y, rowpos.z) << (31 - x % 32);
+                    voxels->setWordUnchecked(w, y, z, mask, word);
+                }
             }
+    }
+};
+
+bool Scene::genVizRender(View * view, ShapeDrawData &sdd)
+{
+    std::vector<ShapeNode *> leaves;
+    std::stack<SceneNode *> nodes;
+    std::vector<uint64_t> leafkeys;
+    std::unordered_map<uint64_t, std::unique_ptr<ShapeGeometry>> pieces;
+    ContentHash key;
+    int i;
+
+    // gather leaf nodes, left to right, by an explicit walk of the tree
+    if(csgroot != NULL)
+        nodes.push(csgroot);
+    while(!nodes.empty())
+    {
+        SceneNode * node = nodes.top();
+        nodes.pop();
+        if(OpNode * opnode = opNode(node))
+        {
+            nodes.push(opnode->right);
+            nodes.push(opnode->left);
         }
+        else
+            leaves.push_back(shapeNode(node));
+    }
+
+    // the preview depends only on the leaves in order, so it is rebuilt only once one of them changes
+    for(i = 0; i < (int) leaves.size(); i++)
+    {
+        ContentHash leafkey;
+
+        leaves[i]->shape->hashContent(leafkey);
+        leafkeys.push_back(leafkey.value());
+        key.addInt((int64_t) leafkeys.back());
+    }
+    geom.setColour(defaultCol);
+    if(vizbound && key.value() == vizkey && geom.bindBuffers(view))
+    {
+        sdd = geom.getDrawParameters();
+        return true;
     }
+    geom.clear();
+    vizbound = false;
 
-    // traverse leaf shapes generating geometry
+    // assemble from the tessellation of each leaf, generating only those not in the last preview
     for(i = 0; i < (int) leaves.size(); i++)
     {
-        leaves[i]->shape->genGeometry(&geom, view);
+        std::unique_ptr<ShapeGeometry> &piece = pieces[leafkeys[i]];
+
+        if(!piece)
+        {
+            std::unordered_map<uint64_t, std::unique_ptr<ShapeGeometry>>::iterator it = vizpieces.find(leafkeys[i]);
+
+            if(it != vizpieces.end())
+                piece = std::move(it->second);
+            else
+            {
+                piece.reset(new ShapeGeometry());
+                leaves[i]->shape->genGeometry(piece.get(), view);
+            }
+        }
+        geom.append(*piece);
     }
+    vizpieces.swap(pieces); // pieces of leaves no longer in the tree are released
 
     // bind geometry to buffers and return drawing parameters, if possible
     if(geom.bindBuffers(view))
     {
         sdd = geom.getDrawParameters();
+        vizbound = true;
+        vizkey = key.value();
         return true;
     }
     else
@@ -93,33 +275,41 @@ bool Scene::genVizRender(View * view, ShapeDrawData &sdd)
 
 bool Scene::genVoxRender(View * view, ShapeDrawData &sdd)
 {
-    int x, y, z, xdim, ydim, zdim;
-    glm::mat4 tfm, idt;
-    glm::vec3 trs;
-    cgp::Point pnt;
+    int xdim, ydim, zdim;
+    cgp::Point corner;
+    cgp::Vector diag, halfcell;
+    std::vector<cgp::Point> centres;
 
     geom.clear();
+    vizbound = false;
     geom.setColour(defaultCol);
 
-    if(rep == SceneRep::VOXELS)
+    if(rep == SceneRep::VOXELS && marchvox)
     {
-        idt = glm::mat4(1.0f); // identity matrix
+        if(geom.bindVolume(&vox, view))
+        {
+            sdd = geom.getDrawParameters();
+            return true;
+        }
+        UTS_LOG(WARNING, RENDER, "Scene::genVoxRender: the volume cannot be ray marched, so drawing surface voxels instead");
+        geom.clear();
+        geom.setColour(defaultCol);
+    }
 
+    if(rep == SceneRep::VOXELS)
+    {
         vox.getDim(xdim, ydim, zdim);
+        vox.getFrame(corner, diag);
 
-        // place a sphere at filled voxels but subsample to avoid generating too many spheres
-        for(x = 0; x < xdim; x+=10)
-            for(y = 0; y < ydim; y+=10)
-                for(z = 0; z < zdim; z+=10)
-                {
-                    if(vox.get(x, y, z))
-                    {
-                        pnt = vox.getVoxelPos(x, y, z); // convert from voxel space to world coordinates
-                        trs = glm::vec3(pnt.x, pnt.y, pnt.z);
-                        tfm = glm::translate(idt, trs);
-                        geom.genSphere(voxsidelen * 5.0f, 3, 3, tfm);
-                    }
-                }
+        // one voxel sized cube drawn at every surface voxel in a single instanced call, so nothing is subsampled
+        vox.getSurfaceVoxels(centres);
+        if(!centres.empty())
+        {
+            halfcell = cgp::Vector(0.5f * diag.i / (float) std::max(xdim-1, 1), 0.5f * diag.j / (float) std::max(ydim-1, 1),
+                                   0.5f * diag.k / (float) std::max(zdim-1, 1));
+            geom.genBox(halfcell, glm::mat4(1.0f));
+            geom.setInstances(centres);
+        }
     }
 
     // bind geometry to buffers and return drawing parameters, if possible
@@ -132,6 +322,74 @@ bool Scene::genVoxRender(View * view, ShapeDrawData &sdd)
         return false;
 }
 
+bool Scene::genDeviceRender(View * view, ShapeDrawData &sdd)
+{
+    std::vector<unsigned int> dverts, dindices;
+    GLuint vbo, ibo;
+    int vol, numverts = 0, numtris = 0;
+    bool ok;
+
+    if(!devbound)
+    {
+        geom.clear();
+        vizbound = false;
+        geom.setColour(col);
+
+        // only the volume crosses to the device, and only the surface comes back when OpenGL is not shared
+        ok = clvox.begin(&vox);
+        vol = ok ? clvox.takeVolume() : -1;
+        ok = vol >= 0 && clvox.upload(vol, &vox) && clvox.surfaceCounts(vol, numverts, numtris);
+        if(ok && numtris > 0)
+        {
+            if(clvox.sharesGL())
+                ok = geom.bindDeviceBuffers(numverts, 3 * numtris, NULL, NULL, vbo, ibo) && clvox.emitSurfaceGL(vbo, ibo);
+            else
+                ok = clvox.readSurface(dverts, dindices)
+                     && geom.bindDeviceBuffers(numverts, 3 * numtris, dverts.data(), dindices.data(), vbo, ibo);
+        }
+        clvox.end();
+        if(!ok)
+        {
+            UTS_LOG(WARNING, RENDER, "Scene::genDeviceRender: isosurface extraction failed on the device, so extracting on the CPU");
+            geom.clear();
+            hostSurface();
+            return voxmesh.bindGeometry(view, sdd, selectLOD(view));
+        }
+        if(numtris == 0) // nothing to draw
+            return false;
+        devbound = true;
+    }
+    sdd = geom.getDrawParameters();
+    return true;
+}
+
+void Scene::hostSurface()
+{
+    if(!devsurface)
+        return;
+    devsurface = false;
+    devbound = false;
+    voxmesh.marchingCubes(&vox);
+    remeshlo = std::numeric_limits<int>::max(); // until the next edit
+    remeshhi = -1;
+}
+
+/**
+ * Deallocate a csg subtree along with its leaf shapes
+ * @param node  root of the subtree
+ */
+static void deleteTree(SceneNode * node)
+{
+    OpNode * opnode = opNode(node);
+
+    if(opnode != NULL)
+    {
+        deleteTree(opnode->left);
+        deleteTree(opnode->right);
+    }
+    delete node;
+}
+
 Scene::Scene()
 {
     csgroot = NULL;
@@ -139,6 +397,52 @@ Scene::Scene()
     voldiag = cgp::Vector(20.0f, 20.0f, 20.0f);
     voxsidelen = 0.0f;
     rep = SceneRep::TREE;
+    scanmesh = true;
+    greedyblocks = false;
+    streamcsg = false;
+    gpuvox = false;
+    rastervox = false;
+    dexelcsg = false;
+    marchvox = false;
+    simplifycsg = true;
+    sharesubtrees = true;
+    meshbools = false;
+    adaptivevox = true;
+    distfield = false;
+    keeplargest = false;
+    fillvoids = false;
+    dualsurface = false;
+    voxdistances = false;
+    cachedir = "";
+    cachecompress = false;
+    progress = NULL;
+    smoothpairs = smoothiter;
+    smoothshrink = smoothrate;
+    smoothband = taubinpassband;
+    voxleaves = 1;
+    voxdone = 0.0;
+    voxtree = NULL;
+    sharedframe = 0;
+    remeshlo = 0;
+    remeshhi = std::numeric_limits<int>::max();
+    blocknode = NULL;
+    gpusurface = false;
+    devsurface = false;
+    devbound = false;
+    interactive = false;
+    vizbound = false;
+    vizkey = 0;
+    keephistory = false;
+    snapcurrent = -1;
+    publishing = false;
+    stageclock = 0;
+    reqvoxlen = 0.0f;
+    haslattice = false;
+    resetStages();
+    treeChanged();
+
+    // marching cubes emits triangles in scan order, which reuses few vertices from the post-transform cache
+    voxmesh.setCacheOrder(true);
 }
 
 Scene::~Scene()
@@ -148,46 +452,23 @@ Scene::~Scene()
 
 void Scene::clear()
 {
-    std::stack<SceneNode *> nodes;
-    SceneNode * currnode;
-    OpNode * currop;
-    ShapeNode * currleaf;
-
     geom.clear();
+    vizbound = false;
+    vizpieces.clear();
     vox.clear();
+    setRoot(NULL); // sharedvols are kept, so reloading an edited scene reuses them
+}
 
-    // walk csg tree and deallocate nodes
-    if(csgroot != NULL)
-    {
-        nodes.push(csgroot);
-
-        // explicit walk of csg tree using stack
-        while(!nodes.empty())
-        {
-            currnode = nodes.top();
-            nodes.pop(); // calls destructor
-
-            if(dynamic_cast<OpNode*> (currnode))
-            {
-                currop = dynamic_cast<OpNode*> (currnode);
-                nodes.push(currop->right);
-                nodes.push(currop->left);
-                // delete currop;
-            }
-            else
-            {
-                if(dynamic_cast<ShapeNode*> (currnode))
-                {
-                    currleaf = dynamic_cast<ShapeNode*> (currnode);
-                    // delete currleaf;
-                }
-                else
-                {
-                    cerr << "Error Scene::clear(): CSG tree is not properly formed" << endl;
-                }
-            }
-        }
-    }
+void Scene::setRoot(SceneNode * root)
+{
+    if(root != csgroot && csgroot != NULL)
+        deleteTree(csgroot);
+    if(root != blocknode)
+        blocknode = NULL;
+    csgroot = root;
+    voxtree = NULL;
+    dirtybox.reset();
+    treeChanged();
 }
 
 bool Scene::bindGeometry(View * view, ShapeDrawData &sdd)
@@ -204,7 +485,10 @@ bool Scene::bindGeometry(View * view, ShapeDrawData &sdd)
             pass = genVoxRender(view, sdd);
             break;
         case SceneRep::ISOSURFACE:
-            pass = voxmesh.bindGeometry(view, sdd);
+            if(devsurface)
+                pass = genDeviceRender(view, sdd);
+            else
+                pass = voxmesh.bindGeometry(view, sdd, selectLOD(view));
             break;
         default:
             pass = false;
@@ -213,7 +497,33 @@ bool Scene::bindGeometry(View * view, ShapeDrawData &sdd)
     return pass;
 }
 
-void Scene::voxSetOp(SetOp op, VoxelVolume *leftarg, VoxelVolume *rightarg)
+int Scene::selectLOD(View * view)
+{
+    float pixels = view->getProjectedSize(voldiag.length()), budget, numtris;
+    int level = 0;
+
+    // levels are meshlodreduction times coarser in turn, so the level follows from the full triangle count alone
+    budget = pixels * pixels / lodpixelspertri;
+    if(interactive)
+        budget /= lodinteractivescale;
+    numtris = (float) voxmesh.getNumFaces();
+    while(level < meshlodlevels && numtris > budget)
+    {
+        numtris /= (float) meshlodreduction;
+        level++;
+    }
+    return level;
+}
+
+bool Scene::bindDeformGeometry(View * view, ShapeDrawData &sdd, glm::mat4x4 &model)
+{
+    if(rep != SceneRep::ISOSURFACE)
+        return false;
+    hostSurface(); // the lattice warps the vertices of voxmesh
+    return voxmesh.bindBaseGeometry(view, sdd, model);
+}
+
+void Scene::voxSetOp(SetOp op, VoxelVolume *leftarg, VoxelVolume *rightarg, const int * lo, const int * hi)
 {
    /*
     switch based on op
@@ -222,170 +532,3550 @@ void Scene::voxSetOp(SetOp op, VoxelVolume *leftarg, VoxelVolume *rightarg)
     DIFFERENCE: wherever voxel is set in rightarg turn it off in leftarg
     */
 
-    int x, y, z, dx1, dx2, dy1, dy2, dz1, dz2;
+    stats::Timer timer(voxSetOpTime);
+    UTS_TRACE_SCOPE("voxSetOp", "op", (int) op);
 
-    // check that volume sizes match
-    leftarg->getDim(dx1, dy1, dz1);
-    rightarg->getDim(dx2, dy2, dz2);
-    if(dx1 != dx2 || dy1 != dy2 || dz1 != dz2)
+    // operands are combined a packed word at a time, and VoxelVolume reports mismatched sizes
+    switch(op)
     {
+        case SetOp::UNION: // wherever voxel is set in rightarg copy to leftarg
+            leftarg->unionWith(rightarg, lo, hi);
+            break;
+        case SetOp::INTERSECTION: // if voxel is set in leftarg, check to see if it is also set in rightarg, otherwise switch it off
+            leftarg->intersectWith(rightarg, lo, hi);
+            break;
+        case SetOp::DIFFERENCE: // wherever voxel is set in rightarg turn it off in leftarg
+            leftarg->subtract(rightarg, lo, hi);
+            break;
+        default:
+            break;
     }
-    else
+}
+
+/**
+ * Hash every node of a csg subtree by its content, so that structurally identical subtrees, with the same shapes,
+ * transforms and set operations, get the same value wherever they occur
+ * @param node          root of the subtree
+ * @param[out] hashes   content hash of each node
+ * @param[out] counts   occurrences of each content hash
+ * @returns content hash of the subtree
+ */
+static uint64_t hashSubtrees(SceneNode * node, std::unordered_map<SceneNode *, uint64_t> &hashes, std::unordered_map<uint64_t, int> &counts)
+{
+    ContentHash hash;
+
+    if(OpNode * opnode = opNode(node))
     {
-        switch(op)
-        {
-            case SetOp::UNION: // wherever voxel is set in rightarg copy to leftarg
-                for(x = 0; x < dx1; x++)
-                    for(y = 0; y < dy1; y++)
-                        for(z = 0; z < dz1; z++)
-                            if(rightarg->get(x,y,z))
-                                leftarg->set(x,y,z,true);
-                break;
-            case SetOp::INTERSECTION: // if voxel is set in leftarg, check to see if it is also set in rightarg, otherwise switch it off
-                for(x = 0; x < dx1; x++)
-                    for(y = 0; y < dy1; y++)
-                        for(z = 0; z < dz1; z++)
-                             if(leftarg->get(x,y,z))
-                                 if(!rightarg->get(x,y,z))
-                                     leftarg->set(x,y,z,false);
-                break;
-            case SetOp::DIFFERENCE: // wherever voxel is set in rightarg turn it off in leftarg
-                for(x = 0; x < dx1; x++)
-                    for(y = 0; y < dy1; y++)
-                        for(z = 0; z < dz1; z++)
-                            if(rightarg->get(x,y,z))
-                                leftarg->set(x,y,z,false);
-                break;
-            default:
-                break;
-        }
-    } 
+        uint64_t left = hashSubtrees(opnode->left, hashes, counts), right = hashSubtrees(opnode->right, hashes, counts);
+        hash.addString("op");
+        hash.addInt((int64_t) opnode->op);
+        hash.addInt((int64_t) left);
+        hash.addInt((int64_t) right);
+    }
+    else if(ShapeNode * leaf = shapeNode(node))
+        leaf->shape->hashContent(hash);
+    else
+        hash.addString("null");
+    hashes[node] = hash.value();
+    counts[hash.value()]++;
+    return hash.value();
 }
 
-void Scene::voxWalk(SceneNode *root, VoxelVolume *voxels)
+/**
+ * Is a repeated subtree worth evaluating once and copying? Set operations, mesh leaves and placed subtrees are,
+ * whereas an analytic primitive is tested about as fast as its result could be copied.
+ * @param node  root of the subtree
+ */
+static bool worthSharing(SceneNode * node)
 {
-    // traverse csg tree by depth first recursive walk
-    /*
-    if(root is leaf)
-        convert to voxel rep, store in voxels
+    ShapeNode * leaf = shapeNode(node);
+
+    return leaf == NULL || leaf->shape->getKind() == ShapeKind::MESH || leaf->shape->getKind() == ShapeKind::INSTANCE
+           || leaf->shape->getKind() == ShapeKind::SUBTREE;
+}
+
+void CSGProgram::append(SceneNode * node, const std::unordered_map<SceneNode *, uint64_t> &hashes,
+                        const std::unordered_map<uint64_t, int> &rowslots)
+{
+    CSGInstr instr;
+    int idx = (int) instrs.size();
+    auto slot = rowslots.find(hashes.at(node));
+
+    instr.shape = NULL;
+    instr.scan = false;
+    instr.op = SetOp::UNION;
+    instr.right = -1;
+    instr.shared = (slot != rowslots.end()) ? slot->second : -1;
+    instr.overlap = false;
+    if(ShapeNode * leaf = shapeNode(node))
+    {
+        instr.shape = leaf->shape;
+        instr.scan = instr.shape->scansRows(); // rows can only be scanned by parity
+        instrs.push_back(instr);
+    }
     else
-        voxWalk left tree (leftnode, voxels)
-        allocate rightvoxels, copy parameters from voxels
-        voxWalk right tree (rightnode, rightvoxels)
-        apply opp to voxels and rightvoxels store results in voxels
-        deallocate rightvoxels
-    */
+    {
+        OpNode * opnode = opNode(node);
+        instr.op = opnode->op;
+        instrs.push_back(instr);
+        append(opnode->left, hashes, rowslots);
+        instrs[idx].right = (int) instrs.size();
+        append(opnode->right, hashes, rowslots);
+    }
+}
 
-    VoxelVolume * rightvoxels;
-    ShapeNode * shapenode;
-    OpNode * opnode;
-    int dx, dy, dz;
-    cgp::Point o;
-    cgp::Vector d;
+void CSGProgram::compile(SceneNode * root, bool share)
+{
+    std::unordered_map<SceneNode *, uint64_t> hashes;
+    std::unordered_map<uint64_t, int> counts, rowslots;
+
+    instrs.clear();
+    numshared = 0;
+    if(root == NULL)
+        return;
+
+    // a slot for each distinct subtree below the root that occurs more than once
+    hashSubtrees(root, hashes, counts);
+    for(const auto &node : hashes)
+        if(share && node.first != root && counts[node.second] > 1 && worthSharing(node.first) && rowslots.count(node.second) == 0)
+            rowslots[node.second] = numshared++;
+    append(root, hashes, rowslots);
+}
+
+void CSGProgram::evalRow(int i, VoxelVolume * vox, int y, int z, const unsigned int * need, unsigned int * res,
+                         CSGScratch &work, bool scanmesh)
+{
+    int slot = instrs[i].shared, xspan = vox->getXSpan(), dx, dy, dz;
+    int64_t row;
 
-    if(dynamic_cast<ShapeNode*>( root )) // SceneNode
+    if(slot < 0)
     {
-        shapenode = dynamic_cast<ShapeNode*>( root );
-        // needs to be improved by only considering bounding box area
-        voxels->getDim(dx, dy, dz);
+        evalStep(i, vox, y, z, need, res, work, scanmesh);
+        return;
+    }
+
+    // the first occurrence in a row evaluates every voxel, since later ones may need voxels that it does not
+    vox->getDim(dx, dy, dz);
+    row = (int64_t) z * dy + y;
+    unsigned int * shared = &work.shared[(size_t) xspan * slot];
+    if(work.sharedrow[slot] != row)
+    {
+        evalStep(i, vox, y, z, &work.full[0], shared, work, scanmesh);
+        work.sharedrow[slot] = row;
+    }
+    for(int w = 0; w < xspan; w++)
+        res[w] = shared[w] & need[w];
+}
+
+void CSGProgram::evalStep(int i, VoxelVolume * vox, int y, int z, const unsigned int * need, unsigned int * res,
+                          CSGScratch &work, bool scanmesh)
+{
+    CSGInstr &instr = instrs[i];
+    int xspan = vox->getXSpan(), intsize = (int) sizeof(int) * 8, w, x;
+
+    if(instr.shape != NULL) // leaf
+    {
+        for(w = 0; w < xspan; w++)
+            res[w] = 0u;
+        if(!instr.overlap || y < instr.lo[1] || y > instr.hi[1] || z < instr.lo[2] || z > instr.hi[2])
+        {
+            UTS_COUNT(VOXELS_SKIPPED, xspan * intsize);
+            return;
+        }
+        UTS_COUNT(VOXELS_SKIPPED, xspan * intsize - (instr.hi[0] - instr.lo[0] + 1));
 
-        cerr << "xdim = " << dx << endl;
-        for(int x = 0; x < dx; x++)
+        if(instr.scan && scanmesh) // one ray for the whole row
         {
-            #pragma omp parallel for
-            for(int y = 0; y < dy; y++)
-                for(int z = 0; z < dz; z++)
-                    voxels->set(x,y,z, shapenode->shape->pointContainment(voxels->getVoxelPos(x,y,z)));
-            int temp = ((float) x/dx)*100;
-            if (temp > percentDone && (temp%10==0))
+            std::vector<int> &spans = work.spans;
+            instr.shape->scanRow(vox, instr.bbox, y, z, spans);
+            for(int s = 0; s < (int) spans.size(); s += 2)
             {
-                percentDone = temp;
-                cerr << "Percent Complete: " << percentDone << "%" << endl;
+                int first = std::max(spans[s], 0), last = std::min(spans[s+1], xspan * intsize);
+                for(x = first; x < last; x++)
+                    res[x / intsize] |= (0x1u << (intsize - 1 - x % intsize));
             }
+            for(w = 0; w < xspan; w++)
+                res[w] &= need[w];
+        }
+        else
+        {
+            // analytic primitives are tested inline, word by word
+            cgp::Point rowpos = vox->getVoxelPos(0, y, z);
+            PrimitiveRow row = {&work.xpos[0], work.xstep, rowpos.y, rowpos.z, instr.lo[0], instr.hi[0], need, res};
+            if(withPrimitive(instr.shape, row))
+                return;
+
+            // other shapes test the voxels that are needed and could be inside, as a single batch
+            work.pts.clear();
+            work.xs.clear();
+            for(x = instr.lo[0]; x <= instr.hi[0]; x++)
+                if(need[x / intsize] & (0x1u << (intsize - 1 - x % intsize)))
+                {
+                    work.pts.push_back(vox->getVoxelPos(x, y, z));
+                    work.xs.push_back(x);
+                }
+            if(work.pts.empty())
+                return;
+            work.inside.resize(work.pts.size());
+            instr.shape->containment(&work.pts[0], work.pts.size(), &work.inside[0]);
+            for(int k = 0; k < (int) work.xs.size(); k++)
+                if(work.inside[k])
+                    res[work.xs[k] / intsize] |= (0x1u << (intsize - 1 - work.xs[k] % intsize));
         }
     }
-    else // OpNode
+    else
     {
-        opnode = dynamic_cast<OpNode*>( root );
-        voxWalk(opnode->left, voxels);
-        voxels->getDim(dx, dy, dz);
-        voxels->getFrame(o, d);
-        rightvoxels = new VoxelVolume(dx, dy, dz, o, d);
-        voxWalk(opnode->right, rightvoxels);
-        voxSetOp(opnode->op, voxels, rightvoxels);
-        delete rightvoxels;
+        unsigned int * rightneed = &work.words[2 * xspan * i], * rightres = rightneed + xspan;
+        bool active = false;
+
+        evalRow(i+1, vox, y, z, need, res, work, scanmesh);
+
+        // the right operand only matters where the left does not already decide the result
+        for(w = 0; w < xspan; w++)
+        {
+            rightneed[w] = need[w] & ((instr.op == SetOp::UNION) ? ~res[w] : res[w]);
+            if(rightneed[w] != 0u)
+                active = true;
+        }
+        if(!active)
+            return;
+
+        evalRow(instr.right, vox, y, z, rightneed, rightres, work, scanmesh);
+        for(w = 0; w < xspan; w++)
+        {
+            switch(instr.op)
+            {
+                case SetOp::UNION:
+                    res[w] |= rightres[w];
+                    break;
+                case SetOp::INTERSECTION:
+                    res[w] &= rightres[w];
+                    break;
+                case SetOp::DIFFERENCE:
+                    res[w] &= ~rightres[w];
+                    break;
+                default:
+                    break;
+            }
+        }
     }
+}
 
-    /* convert to sizeable voxel grid */
-    int xspan = voxels->getXSpan();
-    int len = dx/xspan;
-    vector<int> voxel1d(len, 0);
-    vector<vector<int>> voxel2d(len, voxel1d);
-    vector<vector<vector<int>>> voxelgrid(len, voxel2d);
-    int xcount = 0, ycount = 0, zcount = 0;
-    for (int z = 0; z < dz; z++)
+void CSGProgram::evaluate(VoxelVolume * vox, bool scanmesh, const int * lo, const int * hi)
+{
+    stats::Timer timer(evaluateTime);
+    int dim[3], rlo[3], rhi[3], numsteps = (int) instrs.size();
+
+    vox->getDim(dim[0], dim[1], dim[2]);
+    for(int a = 0; a < 3; a++)
     {
-        if ((z+1)%xspan == 0) zcount++;   /// if at next xspan, switch to next z voxel
-        for (int y = 0; y < dy; y++)
+        rlo[a] = (lo != NULL) ? std::max(lo[a], 0) : 0;
+        rhi[a] = (hi != NULL) ? std::min(hi[a], dim[a]-1) : dim[a]-1;
+    }
+    if(lo == NULL)
+        vox->fill(false);
+    if(numsteps == 0)
+    {
+        if(lo != NULL)
+            for(int z = rlo[2]; z <= rhi[2]; z++)
+                for(int y = rlo[1]; y <= rhi[1]; y++)
+                    vox->setSpan(rlo[0], rhi[0]+1, y, z, false);
+        return;
+    }
+
+    // leaf bounds are found up front, which also builds any mesh acceleration structures before going parallel
+    for(int i = 0; i < numsteps; i++)
+        if(instrs[i].shape != NULL)
         {
-            if ((y+1)%xspan == 0) ycount++;   /// if at next xspan, switch to next y voxel
-            for (int x = 0; x < dx; x++)
+            instrs[i].shape->getBounds(instrs[i].bbox);
+            instrs[i].overlap = vox->getVoxelRange(instrs[i].bbox, instrs[i].lo, instrs[i].hi);
+        }
+
+    // working rows are allocated once per thread rather than once per layer
+    #pragma omp parallel
+    {
+        int xspan = vox->getXSpan(), wlo = rlo[0] / 32, whi = rhi[0] / 32;
+        std::vector<unsigned int> need(xspan, 0u), res(xspan), row(xspan);
+        CSGScratch work;
+
+        for(int w = wlo; w <= whi; w++)
+            need[w] = ~0u;
+        work.words.resize(2 * xspan * numsteps);
+        work.shared.resize((size_t) xspan * numshared);
+        work.sharedrow.assign(numshared, -1);
+        work.full.assign(xspan, ~0u);
+        work.xpos.resize(dim[0]);
+        for(int x = 0; x < dim[0]; x++)
+            work.xpos[x] = vox->getVoxelPos(x, 0, 0).x;
+        work.xstep = voxelStepX(vox);
+
+        #pragma omp for schedule(dynamic)
+        for(int z = rlo[2]; z <= rhi[2]; z++)
+        {
+            UTS_TRACE_SCOPE("evaluate layer", "z", z);
+            for(int y = rlo[1]; y <= rhi[1]; y++)
             {
-                int xPos = x/xspan, yPos = y/xspan, zPos = z/xspan;
-                if (voxelgrid[xPos][yPos][zPos] == 1) continue;  /// if already identified as a voxel, skip
-                voxelgrid[xPos][yPos][zPos] = voxels->get(x,y,z);
-                if ((x+1)%xspan == 0) xcount++;   /// if at next xspan, switch to next x voxel
+                evalRow(0, vox, y, z, &need[0], &res[0], work, scanmesh);
+                if(lo != NULL) // keep the words outside the range
+                {
+                    vox->getRow(y, z, &row[0]);
+                    std::copy(res.begin() + wlo, res.begin() + whi + 1, row.begin() + wlo);
+                    vox->setRow(y, z, &row[0]);
+                }
+                else
+                    vox->setRow(y, z, &res[0]);
             }
         }
     }
-    cout << "writing to voxelisedgrid" << endl;
-    getMesh()->writeGrid(voxelgrid, "meshes/voxel/voxelisedgrid", len);
 }
 
-void Scene::voxelise(float voxlen)
+void Scene::voxTile(BaseShape * shape, VoxelVolume * voxels, const int * lo, const int * hi)
+{
+    int len = hi[0] - lo[0] + 1;
+    // tiles are small tasks, so each thread keeps its batch storage instead of allocating per tile. Containment
+    // has no task scheduling points, so no other tile can run on this thread while the batch is in use.
+    static thread_local vector<cgp::Point> pts;
+    static thread_local vector<uint8_t> inside;
+    static thread_local vector<float> xpos;
+
+    if((int) pts.size() < len)
+    {
+        pts.resize(len);
+        inside.resize(len);
+        xpos.resize(len);
+    }
+
+    // analytic primitives are tested inline, other shapes a row at a time through their batch containment
+    for(int x = lo[0]; x <= hi[0]; x++)
+        xpos[x - lo[0]] = voxels->getVoxelPos(x, lo[1], lo[2]).x;
+    PrimitiveTile tile = {voxels, &xpos[0], voxelStepX(voxels), lo, hi};
+    if(withPrimitive(shape, tile))
+        return;
+
+    for(int z = lo[2]; z <= hi[2]; z++)
+        for(int y = lo[1]; y <= hi[1]; y++)
+        {
+            for(int x = lo[0]; x <= hi[0]; x++)
+                pts[x - lo[0]] = voxels->getVoxelPos(x, y, z);
+            shape->containment(&pts[0], len, &inside[0]);
+            for(int x = lo[0]; x <= hi[0]; x++)
+                voxels->set(x, y, z, inside[x - lo[0]] != 0);
+        }
+}
+
+void Scene::voxOctree(BaseShape * shape, VoxelVolume * voxels, const int * corner, int size, const int * lo, const int * hi, double share)
+{
+    int clo[3], chi[3], half = size / 2;
+    float ext, dist;
+    cgp::Point p0, p1, c;
+    cgp::Vector diag;
+
+    bool inrange = true;
+
+    for(int a = 0; a < 3; a++)
+    {
+        clo[a] = std::max(corner[a], lo[a]);
+        chi[a] = std::min(corner[a] + size - 1, hi[a]);
+        inrange = inrange && clo[a] <= chi[a];
+    }
+
+    if(inrange && !cancelled())
+    {
+        if(size <= voxoctreeleaf)
+            voxTile(shape, voxels, clo, chi);
+        else
+        {
+            // every voxel centre in the cell lies within ext of its middle, so a surface further away than that misses them all
+            p0 = voxels->getVoxelPos(clo[0], clo[1], clo[2]);
+            p1 = voxels->getVoxelPos(chi[0], chi[1], chi[2]);
+            c = cgp::Point(0.5f * (p0.x + p1.x), 0.5f * (p0.y + p1.y), 0.5f * (p0.z + p1.z));
+            diag.diff(p0, p1);
+            ext = 0.5f * diag.length();
+            dist = shape->signedDistance(c, 2.0f * ext + voxsidelen);
+
+            if(dist < -ext) // wholly inside
+            {
+                for(int z = clo[2]; z <= chi[2]; z++)
+                    for(int y = clo[1]; y <= chi[1]; y++)
+                        voxels->setSpan(clo[0], chi[0] + 1, y, z, true);
+            }
+            else if(dist <= ext) // straddles the surface
+            {
+                // cells of at least a word in x never share words with their siblings, so they can run concurrently
+                for(int oct = 0; oct < 8; oct++)
+                {
+                    int child[3] = {corner[0] + (oct & 1) * half, corner[1] + ((oct >> 1) & 1) * half, corner[2] + ((oct >> 2) & 1) * half};
+                    if(half >= voxoctreetask)
+                    {
+                        double childshare = share / 8.0;
+                        #pragma omp task firstprivate(child, childshare)
+                        voxOctree(shape, voxels, child, half, lo, hi, childshare);
+                    }
+                    else // progress is reported for the whole cell below
+                        voxOctree(shape, voxels, child, half, lo, hi, 0.0);
+                }
+                if(half >= voxoctreetask)
+                {
+                    #pragma omp taskwait
+                    return;
+                }
+            }
+            // otherwise wholly outside, which the volume already is
+        }
+    }
+
+    if(share > 0.0)
+    {
+        #pragma omp critical(voxprogress)
+        {
+            voxdone += share;
+            reportProgress(voxdone);
+        }
+    }
+}
+
+void Scene::reportProgress(double fraction)
+{
+    if(progress != NULL)
+        progress->percent = std::min(100, std::max(0, (int) (fraction * 100.0)));
+}
+
+/**
+ * Count the leaf shapes of a csg subtree
+ * @param node  root of the subtree
+ * @returns number of leaves
+ */
+static int countLeaves(SceneNode * node)
+{
+    OpNode * opnode = opNode(node);
+
+    if(opnode == NULL)
+        return 1;
+    return countLeaves(opnode->left) + countLeaves(opnode->right);
+}
+
+/**
+ * Find a leaf of a csg subtree by its depth-first, left to right position
+ * @param node          root of the subtree
+ * @param[in,out] index position of the leaf within the subtree, reduced by the leaves passed over
+ * @returns the leaf, or NULL if the subtree has no more than index leaves
+ */
+static ShapeNode * findLeaf(SceneNode * node, int &index)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * leaf;
+
+    if(opnode == NULL)
+        return (index-- == 0) ? shapeNode(node) : NULL;
+    leaf = findLeaf(opnode->left, index);
+    return (leaf != NULL) ? leaf : findLeaf(opnode->right, index);
+}
+
+/// Does a box contain no points, as when it is the overlap of disjoint boxes?
+static bool boxEmpty(const cgp::BoundBox &bbox)
+{
+    return bbox.min.x > bbox.max.x || bbox.min.y > bbox.max.y || bbox.min.z > bbox.max.z;
+}
+
+/**
+ * Bounds of the result of a set operation, given the bounds of its operands
+ * @param op            set operation
+ * @param lbox, rbox    bounds of the left and right operands
+ * @param[out] bbox     bounds of the result, which may be empty
+ */
+static void opBounds(SetOp op, const cgp::BoundBox &lbox, const cgp::BoundBox &rbox, cgp::BoundBox &bbox)
+{
+    bbox = lbox;
+    if(op == SetOp::UNION && !boxEmpty(rbox))
+    {
+        if(boxEmpty(lbox))
+            bbox = rbox;
+        else
+        {
+            bbox.includePnt(rbox.min);
+            bbox.includePnt(rbox.max);
+        }
+    }
+    else if(op == SetOp::INTERSECTION)
+    {
+        bbox.min = cgp::Point(max(lbox.min.x, rbox.min.x), max(lbox.min.y, rbox.min.y), max(lbox.min.z, rbox.min.z));
+        bbox.max = cgp::Point(min(lbox.max.x, rbox.max.x), min(lbox.max.y, rbox.max.y), min(lbox.max.z, rbox.max.z));
+    }
+    // a difference lies within its left operand
+}
+
+/**
+ * Bounds of a csg subtree, as recorded by boundTree for set operations
+ * @param node          root of the subtree
+ * @param[out] bbox     bounds of the subtree result
+ */
+static void nodeBounds(SceneNode * node, cgp::BoundBox &bbox)
+{
+    OpNode * opnode = opNode(node);
+
+    if(opnode != NULL)
+        bbox = opnode->bounds;
+    else
+    {
+        bbox.reset();
+        shapeNode(node)->shape->getBounds(bbox);
+    }
+}
+
+/**
+ * Record the bounds of every set operation in a csg subtree
+ * @param node          root of the subtree
+ * @param[out] bbox     bounds of the subtree result
+ */
+static void boundTree(SceneNode * node, cgp::BoundBox &bbox)
+{
+    OpNode * opnode = opNode(node);
+    cgp::BoundBox lbox, rbox;
+
+    if(opnode == NULL)
+    {
+        nodeBounds(node, bbox);
+        return;
+    }
+    boundTree(opnode->left, lbox);
+    boundTree(opnode->right, rbox);
+    opBounds(opnode->op, lbox, rbox, bbox);
+    opnode->bounds = bbox;
+}
+
+/**
+ * Add the content of a csg subtree to a hash, in prefix order
+ * @param node  root of the subtree
+ * @param hash  hash being accumulated
+ */
+static void hashSubtree(SceneNode * node, ContentHash &hash)
+{
+    if(OpNode * opnode = opNode(node))
+    {
+        hash.addString("op");
+        hash.addInt((int64_t) opnode->op);
+        hashSubtree(opnode->left, hash);
+        hashSubtree(opnode->right, hash);
+    }
+    else if(ShapeNode * leaf = shapeNode(node))
+        leaf->shape->hashContent(hash);
+    else
+        hash.addString("null");
+}
+
+/**
+ * Bounds of a csg subtree, found without recording them in its set operations, which may be shared between threads
+ * @param node          root of the subtree
+ * @param[out] bbox     bounds of the subtree result, which may be empty
+ */
+static void subtreeBounds(SceneNode * node, cgp::BoundBox &bbox)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * leaf = shapeNode(node);
+    cgp::BoundBox lbox, rbox;
+
+    bbox.reset();
+    if(opnode != NULL)
+    {
+        subtreeBounds(opnode->left, lbox);
+        subtreeBounds(opnode->right, rbox);
+        opBounds(opnode->op, lbox, rbox, bbox);
+    }
+    else if(leaf != NULL && leaf->shape != NULL)
+        leaf->shape->getBounds(bbox);
+}
+
+/**
+ * Test a batch of points against a csg subtree
+ * @param node      root of the subtree
+ * @param pts       points to test
+ * @param n         number of points
+ * @param[out] out  1 for each point inside the subtree result, 0 otherwise
+ */
+static void subtreeContainment(SceneNode * node, const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * leaf = shapeNode(node);
+    std::vector<size_t> idx;
+    std::vector<cgp::Point> sub;
+    std::vector<uint8_t> res;
+    uint8_t decided;
+
+    if(leaf != NULL && leaf->shape != NULL)
+    {
+        leaf->shape->containment(pts, n, out);
+        return;
+    }
+    if(opnode == NULL)
+    {
+        memset(out, 0, n);
+        return;
+    }
+
+    // the right operand only matters outside the left of a union and inside the left of the other operations
+    subtreeContainment(opnode->left, pts, n, out);
+    decided = (opnode->op == SetOp::UNION) ? 1 : 0;
+    for(size_t i = 0; i < n; i++)
+        if((out[i] != 0) != (decided != 0))
+        {
+            idx.push_back(i);
+            sub.push_back(pts[i]);
+        }
+    if(idx.empty())
+        return;
+    res.resize(idx.size());
+    subtreeContainment(opnode->right, sub.data(), sub.size(), res.data());
+    for(size_t k = 0; k < idx.size(); k++)
+        out[idx[k]] = (opnode->op == SetOp::DIFFERENCE) ? (uint8_t) (res[k] == 0) : (uint8_t) (res[k] != 0);
+}
+
+/**
+ * Signed distance to a csg subtree, combining its leaves by minimum and maximum
+ * @param node  root of the subtree
+ * @param pnt   point to measure
+ * @param band  distance from the surface beyond which only the sign matters
+ * @returns signed distance, negative inside
+ */
+static float subtreeDistance(SceneNode * node, cgp::Point pnt, float band)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * leaf = shapeNode(node);
+    float left, right;
+
+    if(leaf != NULL && leaf->shape != NULL)
+        return leaf->shape->signedDistance(pnt, band);
+    if(opnode == NULL)
+        return band;
+    left = subtreeDistance(opnode->left, pnt, band);
+    right = subtreeDistance(opnode->right, pnt, band);
+    if(opnode->op == SetOp::UNION)
+        return std::min(left, right);
+    if(opnode->op == SetOp::INTERSECTION)
+        return std::max(left, right);
+    return std::max(left, -right);
+}
+
+SubtreeAsset::SubtreeAsset(SceneNode * subtree)
+{
+    ContentHash hash;
+
+    root = subtree;
+    subtreeBounds(root, bounds);
+    hashSubtree(root, hash);
+    digest = hash.value();
+}
+
+SubtreeAsset::~SubtreeAsset()
+{
+    deleteTree(root);
+}
+
+void SubtreeAsset::containment(const cgp::Point * pts, size_t n, uint8_t * out) const
+{
+    subtreeContainment(root, pts, n, out);
+}
+
+float SubtreeAsset::signedDistance(cgp::Point pnt, float band) const
+{
+    return subtreeDistance(root, pnt, band);
+}
+
+SubtreeInstance::SubtreeInstance(std::shared_ptr<const SubtreeAsset> shared)
+    : BaseShape(ShapeKind::SUBTREE), asset(shared)
+{
+    tfm = inv = glm::mat4(1.0f);
+    minscale = 1.0f;
+}
+
+cgp::Point SubtreeInstance::toModel(cgp::Point pnt) const
+{
+    glm::vec4 p = inv * glm::vec4(pnt.x, pnt.y, pnt.z, 1.0f);
+    return cgp::Point(p.x, p.y, p.z);
+}
+
+bool SubtreeInstance::setTransform(const glm::mat4x4 &trm)
+{
+    glm::mat3x3 lin = glm::mat3(trm), linv;
+    float det = glm::determinant(lin), len[3], frob = 0.0f;
+    bool similar = true;
+
+    if(fabsf(det) < 1.0e-12f)
+    {
+        cerr << "Error SubtreeInstance::setTransform: transform is singular" << endl;
+        return false;
+    }
+    tfm = trm;
+    inv = glm::inverse(trm);
+
+    // a similarity has orthogonal columns of equal length, which is its exact stretch, otherwise the inverse
+    // of the Frobenius norm of the inverse bounds the least stretch from below
+    for(int c = 0; c < 3; c++)
+        len[c] = glm::length(lin[c]);
+    for(int c = 0; c < 3; c++)
+        similar = similar && fabsf(len[c] - len[0]) <= 1.0e-5f * len[0]
+                  && fabsf(glm::dot(lin[c], lin[(c+1) % 3])) <= 1.0e-5f * len[0] * len[0];
+    if(similar)
+        minscale = len[0];
+    else
+    {
+        linv = glm::inverse(lin);
+        for(int c = 0; c < 3; c++)
+            frob += glm::dot(linv[c], linv[c]);
+        minscale = 1.0f / sqrtf(frob);
+    }
+    return true;
+}
+
+void SubtreeInstance::genGeometry(ShapeGeometry * geom, View * view)
+{
+    std::stack<SceneNode *> nodes;
+
+    if(asset->getRoot() != NULL)
+        nodes.push(asset->getRoot());
+    while(!nodes.empty())
+    {
+        SceneNode * node = nodes.top();
+        nodes.pop();
+        if(OpNode * opnode = opNode(node))
+        {
+            nodes.push(opnode->right);
+            nodes.push(opnode->left);
+        }
+        else if(ShapeNode * leaf = shapeNode(node))
+        {
+            ShapeGeometry piece;
+
+            if(leaf->shape == NULL)
+                continue;
+            leaf->shape->genGeometry(&piece, view);
+            geom->append(piece, tfm);
+        }
+    }
+}
+
+bool SubtreeInstance::pointContainment(cgp::Point pnt)
+{
+    uint8_t inside;
+
+    containment(&pnt, 1, &inside);
+    return inside != 0;
+}
+
+void SubtreeInstance::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    std::vector<cgp::Point> model(n);
+
+    for(size_t i = 0; i < n; i++)
+        model[i] = toModel(pts[i]);
+    asset->containment(model.data(), n, out);
+}
+
+float SubtreeInstance::signedDistance(cgp::Point pnt, float band)
+{
+    return asset->signedDistance(toModel(pnt), band / minscale) * minscale;
+}
+
+void SubtreeInstance::getBounds(cgp::BoundBox &bbox)
+{
+    const cgp::BoundBox &mbox = asset->getBounds();
+
+    bbox.reset();
+    if(boxEmpty(mbox))
+        return;
+    for(int c = 0; c < 8; c++)
+    {
+        glm::vec4 p = tfm * glm::vec4((c & 1) ? mbox.max.x : mbox.min.x, (c & 2) ? mbox.max.y : mbox.min.y,
+                                      (c & 4) ? mbox.max.z : mbox.min.z, 1.0f);
+        bbox.includePnt(cgp::Point(p.x, p.y, p.z));
+    }
+}
+
+void SubtreeInstance::hashContent(ContentHash &hash)
+{
+    hash.addString("subtree");
+    hash.addInt((int64_t) asset->getDigest());
+    for(int c = 0; c < 4; c++)
+        for(int r = 0; r < 4; r++)
+            hash.addFloat(tfm[c][r]);
+}
+
+void Scene::voxWalk(SceneNode *root, VoxelVolume *voxels)
+{
+    // traverse csg tree by depth first recursive walk
+    /*
+    if(root is leaf)
+        convert to voxel rep, store in voxels
+    else
+        voxWalk left tree (leftnode, voxels)
+        take rightvoxels from the pool, copy parameters from voxels
+        voxWalk right tree (rightnode, rightvoxels)
+        apply opp to voxels and rightvoxels store results in voxels
+        hand rightvoxels back to the pool
+    */
+    // called from within a parallel region: subtrees and leaf tiles become tasks
+
+    VoxelVolume * rightvoxels;
+    ShapeNode * shapenode;
+    OpNode * opnode;
+    int dx, dy, dz, lo[3], hi[3];
+    cgp::BoundBox bbox;
+
+    // a repeated subtree already evaluated by shareSubtrees is copied, which is all a union into an empty volume does
+    auto key = sharedkeys.find(root);
+    if(key != sharedkeys.end())
+    {
+        auto shared = sharedvols.find(key->second);
+        if(shared != sharedvols.end())
+        {
+            nodeBounds(root, bbox);
+            if(voxels->getVoxelRange(bbox, lo, hi))
+                voxSetOp(SetOp::UNION, voxels, shared->second.get(), lo, hi);
+            #pragma omp critical(voxprogress)
+            {
+                voxdone += (double) countLeaves(root) / (double) voxleaves;
+                reportProgress(voxdone);
+            }
+            return;
+        }
+    }
+
+    shapenode = shapeNode(root);
+    if(shapenode != NULL) // leaf
+    {
+        stats::Timer timer(voxLeafTime); // from the start of the leaf until all of its tiles are done
+        UTS_TRACE_SCOPE("voxWalk leaf");
+
+        voxels->getDim(dx, dy, dz);
+
+        // only voxels within the bounding box of the shape can be occupied, this also builds any mesh acceleration structure
+        shapenode->shape->getBounds(bbox);
+        if(!voxels->getVoxelRange(bbox, lo, hi))
+        {
+            UTS_COUNT(VOXELS_SKIPPED, (int64_t) dx * dy * dz);
+            #pragma omp critical(voxprogress)
+            {
+                voxdone += 1.0 / (double) voxleaves;
+                reportProgress(voxdone);
+            }
+            return;
+        }
+        UTS_COUNT(VOXELS_SKIPPED, (int64_t) dx * dy * dz - (int64_t) (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1));
+
+        if(scanmesh && shapenode->shape->scansRows()) // one ray per voxel row, in blocks of whole rows
+        {
+            double share = 1.0 / (double) (((hi[1] - lo[1]) / voxtilerows + 1) * ((hi[2] - lo[2]) / voxtilerows + 1) * voxleaves);
+
+            for(int tz = lo[2]; tz <= hi[2]; tz += voxtilerows)
+                for(int ty = lo[1]; ty <= hi[1]; ty += voxtilerows)
+                {
+                    #pragma omp task firstprivate(tz, ty) shared(lo, hi, bbox, share)
+                    {
+                        UTS_TRACE_SCOPE("scan tile", "z", tz);
+                        vector<int> spans[bvhpacket];
+                        int yend = std::min(ty + voxtilerows - 1, hi[1]);
+                        if(!cancelled())
+                            for(int z = tz; z <= std::min(tz + voxtilerows - 1, hi[2]); z++)
+                                for(int y = ty; y <= yend; y += bvhpacket) // neighbouring rows cast as one packet
+                                {
+                                    int n = std::min(bvhpacket, yend - y + 1);
+                                    shapenode->shape->scanRows(voxels, bbox, y, z, n, spans);
+                                    for(int r = 0; r < n; r++)
+                                        for(int s = 0; s < (int) spans[r].size(); s += 2)
+                                            voxels->setSpan(spans[r][s], spans[r][s+1], y + r, z, true);
+                                }
+
+                        #pragma omp critical(voxprogress)
+                        {
+                            voxdone += share;
+                            reportProgress(voxdone);
+                        }
+                    }
+                }
+        }
+        else if(adaptivevox) // coarse cells first, refined only where they straddle the surface
+        {
+            int corner[3] = {(lo[0] / voxoctreetask) * voxoctreetask, lo[1], lo[2]}, size = voxoctreetask;
+
+            while(corner[0] + size <= hi[0] || corner[1] + size <= hi[1] || corner[2] + size <= hi[2])
+                size *= 2;
+            voxOctree(shapenode->shape, voxels, corner, size, lo, hi, 1.0 / (double) voxleaves);
+        }
+        else
+        {
+            // tiles are aligned to whole words in x, so no two tiles ever write to the same word
+            int xtile = voxtilewords * (int) (sizeof(int) * 8), xstart = (lo[0] / xtile) * xtile, tilesdone = 0, percentDone = 0;
+            int numtiles = ((hi[0] - xstart) / xtile + 1) * ((hi[1] - lo[1]) / voxtilerows + 1) * ((hi[2] - lo[2]) / voxtilerows + 1);
+
+            for(int tz = lo[2]; tz <= hi[2]; tz += voxtilerows)
+                for(int ty = lo[1]; ty <= hi[1]; ty += voxtilerows)
+                    for(int tx = xstart; tx <= hi[0]; tx += xtile)
+                    {
+                        #pragma omp task firstprivate(tx, ty, tz) shared(lo, hi, tilesdone, percentDone)
+                        {
+                            UTS_TRACE_SCOPE("voxTile", "z", tz);
+                            int tlo[3] = {std::max(tx, lo[0]), ty, tz};
+                            int thi[3] = {std::min(tx + xtile - 1, hi[0]), std::min(ty + voxtilerows - 1, hi[1]), std::min(tz + voxtilerows - 1, hi[2])};
+                            if(!cancelled())
+                                voxTile(shapenode->shape, voxels, tlo, thi);
+
+                            #pragma omp critical(voxprogress)
+                            {
+                                voxdone += 1.0 / (double) (numtiles * voxleaves);
+                                reportProgress(voxdone);
+                                int temp = (int) (((float) ++tilesdone / (float) numtiles) * 100);
+                                if (temp > percentDone && (temp%10==0))
+                                {
+                                    percentDone = temp;
+                                    UTS_LOG(INFO, CSG, "Percent Complete: ", percentDone, "%");
+                                }
+                            }
+                        }
+                    }
+        }
+        #pragma omp taskwait
+    }
+    else // OpNode
+    {
+        opnode = opNode(root);
+        rightvoxels = takeVolume(voxels); // sparse trees keep sparse intermediates
+
+        // independent subtrees voxelise concurrently
+        #pragma omp task
+        voxWalk(opnode->left, voxels);
+        #pragma omp task
+        voxWalk(opnode->right, rightvoxels);
+        #pragma omp taskwait
+
+        // outside the right operand a union or difference changes nothing, and outside the left an intersection is already empty
+        nodeBounds((opnode->op == SetOp::INTERSECTION) ? opnode->left : opnode->right, bbox);
+        if(voxels->getVoxelRange(bbox, lo, hi))
+            voxSetOp(opnode->op, voxels, rightvoxels, lo, hi);
+        voxpool.give(rightvoxels);
+    }
+}
+
+void Scene::shareSubtrees(uint64_t frame)
+{
+    std::unordered_map<SceneNode *, uint64_t> hashes;
+    std::unordered_map<uint64_t, int> counts;
+    std::unordered_map<uint64_t, std::shared_ptr<VoxelVolume>> kept;
+    std::vector<SceneNode *> pending;
+    std::stack<std::pair<SceneNode *, bool>> walk;
+
+    sharedkeys.clear();
+    if(frame != sharedframe)
+        sharedvols.clear();
+    sharedframe = frame;
+    voxleaves = (csgroot != NULL) ? countLeaves(csgroot) : 0;
+    voxdone = 0.0;
+    if(csgroot == NULL || frame == 0)
+    {
+        sharedvols.clear();
+        return;
+    }
+
+    // repeated subtrees below the root, in post order so that nested repeats are evaluated before the subtrees
+    // that contain them, with the first occurrence of each standing for all of them
+    hashSubtrees(csgroot, hashes, counts);
+    walk.push(std::make_pair(csgroot, false));
+    while(!walk.empty())
+    {
+        std::pair<SceneNode *, bool> top = walk.top();
+        OpNode * opnode = opNode(top.first);
+        walk.pop();
+        if(opnode != NULL && !top.second)
+        {
+            walk.push(std::make_pair(top.first, true));
+            walk.push(std::make_pair(opnode->right, false));
+            walk.push(std::make_pair(opnode->left, false));
+            continue;
+        }
+        uint64_t hash = hashes[top.first];
+        if(top.first == csgroot || counts[hash] < 2 || !worthSharing(top.first))
+            continue;
+        sharedkeys[top.first] = hash;
+        if(kept.count(hash) == 0)
+        {
+            auto old = sharedvols.find(hash);
+            if(old != sharedvols.end()) // evaluated by an earlier run in the same frame
+                kept[hash] = old->second;
+            else
+            {
+                kept[hash] = std::shared_ptr<VoxelVolume>();
+                pending.push_back(top.first);
+                voxleaves += countLeaves(top.first);
+            }
+        }
+    }
+
+    // volumes of subtrees that are no longer repeated are released here
+    sharedvols.clear();
+    for(const auto &entry : kept)
+        if(entry.second)
+            sharedvols[entry.first] = entry.second;
+
+    for(SceneNode * node : pending)
+    {
+        std::shared_ptr<VoxelVolume> shared(takeVolume(&vox));
+        #pragma omp parallel
+        {
+            #pragma omp single
+            voxWalk(node, shared.get());
+        }
+        if(cancelled()) // an incomplete volume is never kept
+            return;
+        sharedvols[sharedkeys[node]] = shared;
+    }
+    if(!pending.empty())
+        UTS_LOG(INFO, CSG, "Scene::voxelise: evaluated ", (int) pending.size(), " repeated subtrees once each, ",
+                (int) (sharedkeys.size() - pending.size()), " more occurrences are copied");
+}
+
+bool Scene::clWalk(SceneNode *root, int vol)
+{
+    ShapeNode * shapenode = shapeNode(root);
+    OpNode * opnode;
+    VoxelVolume * leafvox;
+    int lo[3], hi[3], right;
+    cgp::BoundBox bbox;
+    bool ok;
+
+    if(cancelled())
+        return false;
+    if(shapenode != NULL)
+    {
+        stats::Timer timer(clLeafTime);
+
+        shapenode->shape->getBounds(bbox);
+        if(vox.getVoxelRange(bbox, lo, hi) && !clvox.leaf(shapenode->shape, vol, lo, hi))
+        {
+            // no kernel for this leaf, or a mesh too intricate for one, so it is voxelised on the CPU and uploaded
+            leafvox = takeVolume(&vox);
+            #pragma omp parallel
+            {
+                #pragma omp single
+                voxWalk(root, leafvox);
+            }
+            ok = !cancelled() && clvox.upload(vol, leafvox);
+            voxpool.give(leafvox);
+            return ok;
+        }
+        voxdone += 1.0 / (double) voxleaves;
+        reportProgress(voxdone);
+        return true;
+    }
+
+    // subtrees run one after the other, since the device already works on a whole leaf at a time
+    opnode = opNode(root);
+    right = clvox.takeVolume();
+    if(right < 0)
+        return false;
+    ok = clWalk(opnode->left, vol) && clWalk(opnode->right, right);
+    nodeBounds((opnode->op == SetOp::INTERSECTION) ? opnode->left : opnode->right, bbox);
+    if(ok && vox.getVoxelRange(bbox, lo, hi))
+        ok = clvox.setOp((opnode->op == SetOp::UNION) ? 0 : ((opnode->op == SetOp::INTERSECTION) ? 1 : 2), vol, right, lo, hi);
+    clvox.giveVolume(right);
+    return ok;
+}
+
+bool Scene::clVoxelise()
+{
+    int root;
+    bool ok;
+
+    if(csgroot == NULL || !clvox.begin(&vox))
+        return false;
+    voxleaves = countLeaves(csgroot);
+    voxdone = 0.0;
+    root = clvox.takeVolume();
+    ok = root >= 0 && clWalk(csgroot, root) && clvox.download(root, &vox);
+    clvox.end();
+    voxpool.reset();
+    if(!ok && !cancelled())
+        UTS_LOG(WARNING, CSG, "Scene::voxelise: evaluation on ", clvox.getDeviceName(), " failed, so the CPU takes over");
+    return ok;
+}
+
+bool Scene::glWalk(SceneNode *root, VoxelVolume *voxels)
+{
+    ShapeNode * shapenode = shapeNode(root);
+    OpNode * opnode;
+    VoxelVolume * rightvoxels;
+    int lo[3], hi[3];
+    cgp::BoundBox bbox;
+    bool ok;
+
+    if(cancelled())
+        return false;
+    if(shapenode != NULL)
+    {
+        stats::Timer timer(glLeafTime);
+
+        shapenode->shape->getBounds(bbox);
+        if(voxels->getVoxelRange(bbox, lo, hi) && !glvox.leaf(shapenode->shape, voxels, lo, hi))
+        {
+            // nothing to draw, or the driver failed, so the leaf is voxelised on the CPU, which counts its progress
+            #pragma omp parallel
+            {
+                #pragma omp single
+                voxWalk(root, voxels);
+            }
+            return !cancelled();
+        }
+        voxdone += 1.0 / (double) voxleaves;
+        reportProgress(voxdone);
+        return true;
+    }
+
+    // subtrees run one after the other, since only this thread can draw
+    opnode = opNode(root);
+    rightvoxels = takeVolume(voxels);
+    ok = glWalk(opnode->left, voxels) && glWalk(opnode->right, rightvoxels);
+    nodeBounds((opnode->op == SetOp::INTERSECTION) ? opnode->left : opnode->right, bbox);
+    if(ok && voxels->getVoxelRange(bbox, lo, hi))
+        voxSetOp(opnode->op, voxels, rightvoxels, lo, hi);
+    voxpool.give(rightvoxels);
+    return ok;
+}
+
+bool Scene::glVoxelise()
+{
+    bool ok;
+
+    if(csgroot == NULL || !glvox.begin())
+        return false;
+    voxleaves = countLeaves(csgroot);
+    voxdone = 0.0;
+    ok = glWalk(csgroot, &vox);
+    glvox.end();
+    voxpool.reset();
+    if(!ok)
+        vox.fill(false); // the CPU starts again from an empty volume
+    return ok;
+}
+
+void Scene::sdfWalk(SceneNode *root, DistanceField *field)
+{
+    DistanceField * rightfield;
+    ShapeNode * shapenode;
+    OpNode * opnode;
+    int lo[3], hi[3];
+    float band = field->getBand();
+    cgp::BoundBox bbox;
+
+    shapenode = shapeNode(root);
+    if(shapenode != NULL) // leaf
+    {
+        // beyond the band around the bounds the field already holds the band, which is exact enough
+        shapenode->shape->getBounds(bbox);
+        cgp::BoundBox meshbox = bbox;
+        bbox.expand(band);
+        if(!field->getVoxelRange(bbox, lo, hi))
+        {
+            #pragma omp critical(voxprogress)
+            {
+                voxdone += 1.0 / (double) voxleaves;
+                reportProgress(voxdone);
+            }
+            return;
+        }
+
+        // mesh signs come from one parity ray per row, with a volume of the same frame to describe the rows, which
+        // vox shares with the field
+        bool scan = (scanmesh && shapenode->shape->scansRows());
+        VoxelVolume * rows = scan ? takeVolume(&vox) : NULL;
+        double share = 1.0 / (double) (((hi[1] - lo[1]) / voxtilerows + 1) * ((hi[2] - lo[2]) / voxtilerows + 1) * voxleaves);
+
+        for(int tz = lo[2]; tz <= hi[2]; tz += voxtilerows)
+            for(int ty = lo[1]; ty <= hi[1]; ty += voxtilerows)
+            {
+                #pragma omp task firstprivate(tz, ty) shared(lo, hi, meshbox, share, rows, scan, band)
+                {
+                    vector<int> spans[bvhpacket];
+                    int yend = std::min(ty + voxtilerows - 1, hi[1]);
+                    if(!cancelled())
+                        for(int z = tz; z <= std::min(tz + voxtilerows - 1, hi[2]); z++)
+                            for(int y = ty; y <= yend; y += bvhpacket)
+                            {
+                                int n = std::min(bvhpacket, yend - y + 1);
+                                if(scan) // neighbouring rows cast as one packet
+                                    shapenode->shape->scanRows(rows, meshbox, y, z, n, spans);
+                                for(int r = 0; r < n; r++)
+                                {
+                                    if(!scan)
+                                    {
+                                        for(int x = lo[0]; x <= hi[0]; x++)
+                                            field->set(x, y + r, z, shapenode->shape->signedDistance(field->getVoxelPos(x, y + r, z), band));
+                                        continue;
+                                    }
+                                    const vector<int> &row = spans[r];
+                                    int s = 0;
+                                    for(int x = lo[0]; x <= hi[0]; x++)
+                                    {
+                                        while(s < (int) row.size() && row[s+1] <= x) // spans are in increasing order
+                                            s += 2;
+                                        bool inside = (s < (int) row.size() && row[s] <= x);
+                                        float dist = shapenode->shape->surfaceDistance(field->getVoxelPos(x, y + r, z), band);
+                                        field->set(x, y + r, z, inside ? -dist : dist);
+                                    }
+                                }
+                            }
+
+                    #pragma omp critical(voxprogress)
+                    {
+                        voxdone += share;
+                        reportProgress(voxdone);
+                    }
+                }
+            }
+        #pragma omp taskwait
+        voxpool.give(rows);
+    }
+    else // OpNode
+    {
+        opnode = opNode(root);
+        rightfield = takeField(field);
+
+        #pragma omp task
+        sdfWalk(opnode->left, field);
+        #pragma omp task
+        sdfWalk(opnode->right, rightfield);
+        #pragma omp taskwait
+
+        // as for voxWalk, but an operand only stops mattering once it is a band clear of its bounds
+        nodeBounds((opnode->op == SetOp::INTERSECTION) ? opnode->left : opnode->right, bbox);
+        bbox.expand(band);
+        if(field->getVoxelRange(bbox, lo, hi))
+            switch(opnode->op)
+            {
+                case SetOp::UNION:
+                    field->unionWith(rightfield, lo, hi);
+                    break;
+                case SetOp::INTERSECTION:
+                    field->intersectWith(rightfield, lo, hi);
+                    break;
+                case SetOp::DIFFERENCE:
+                    field->subtract(rightfield, lo, hi);
+                    break;
+                default:
+                    break;
+            }
+        sdfpool.give(rightfield);
+    }
+}
+
+void Scene::dexelWalk(SceneNode *root, DexelVolume *dexels)
+{
+    DexelVolume * rightdexels;
+    ShapeNode * shapenode;
+    OpNode * opnode;
+    int lo[3], hi[3];
+    cgp::BoundBox bbox;
+
+    shapenode = shapeNode(root);
+    if(shapenode != NULL) // leaf
+    {
+        stats::Timer timer(dexelLeafTime);
+
+        shapenode->shape->getBounds(bbox);
+        if(!dexels->getVoxelRange(bbox, lo, hi))
+        {
+            #pragma omp critical(voxprogress)
+            {
+                voxdone += 1.0 / (double) voxleaves;
+                reportProgress(voxdone);
+            }
+            return;
+        }
+
+        // rows are scanned against vox, which already has the frame of the span volume
+        bool scan = (scanmesh && shapenode->shape->scansRows());
+        double share = 1.0 / (double) (((hi[1] - lo[1]) / voxtilerows + 1) * ((hi[2] - lo[2]) / voxtilerows + 1) * voxleaves);
+
+        for(int tz = lo[2]; tz <= hi[2]; tz += voxtilerows)
+            for(int ty = lo[1]; ty <= hi[1]; ty += voxtilerows)
+            {
+                #pragma omp task firstprivate(tz, ty) shared(lo, hi, bbox, share, scan)
+                {
+                    UTS_TRACE_SCOPE("dexel tile", "z", tz);
+                    vector<int> spans[bvhpacket];
+                    vector<cgp::Point> pts(scan ? 0 : hi[0] - lo[0] + 1);
+                    vector<uint8_t> inside(pts.size());
+                    int yend = std::min(ty + voxtilerows - 1, hi[1]);
+                    if(!cancelled())
+                        for(int z = tz; z <= std::min(tz + voxtilerows - 1, hi[2]); z++)
+                            for(int y = ty; y <= yend; y += bvhpacket)
+                            {
+                                int n = std::min(bvhpacket, yend - y + 1);
+                                if(scan) // neighbouring rows cast as one packet
+                                    shapenode->shape->scanRows(&vox, bbox, y, z, n, spans);
+                                for(int r = 0; r < n; r++)
+                                {
+                                    if(!scan) // runs of the batch containment of the row
+                                    {
+                                        for(int x = lo[0]; x <= hi[0]; x++)
+                                            pts[x - lo[0]] = dexels->getVoxelPos(x, y + r, z);
+                                        shapenode->shape->containment(&pts[0], pts.size(), &inside[0]);
+                                        spans[r].clear();
+                                        for(int x = lo[0]; x <= hi[0]; x++)
+                                            if((inside[x - lo[0]] != 0) != (spans[r].size() % 2 == 1))
+                                                spans[r].push_back(x);
+                                        if(spans[r].size() % 2 == 1)
+                                            spans[r].push_back(hi[0] + 1);
+                                    }
+                                    dexels->setRow(y + r, z, spans[r]);
+                                }
+                            }
+
+                    #pragma omp critical(voxprogress)
+                    {
+                        voxdone += share;
+                        reportProgress(voxdone);
+                    }
+                }
+            }
+        #pragma omp taskwait
+        dexels->accountMemory();
+    }
+    else // OpNode
+    {
+        opnode = opNode(root);
+        rightdexels = takeDexels(dexels);
+
+        // independent subtrees are evaluated concurrently
+        #pragma omp task
+        dexelWalk(opnode->left, dexels);
+        #pragma omp task
+        dexelWalk(opnode->right, rightdexels);
+        #pragma omp taskwait
+
+        // as for voxWalk, only the rows within the bounds of the operand that matters are merged
+        nodeBounds((opnode->op == SetOp::INTERSECTION) ? opnode->left : opnode->right, bbox);
+        if(dexels->getVoxelRange(bbox, lo, hi))
+            switch(opnode->op)
+            {
+                case SetOp::UNION:
+                    dexels->unionWith(rightdexels, lo, hi);
+                    break;
+                case SetOp::INTERSECTION:
+                    dexels->intersectWith(rightdexels, lo, hi);
+                    break;
+                case SetOp::DIFFERENCE:
+                    dexels->subtract(rightdexels, lo, hi);
+                    break;
+                default:
+                    break;
+            }
+        dexpool.give(rightdexels);
+    }
+}
+
+DexelVolume * Scene::takeDexels(DexelVolume * like)
+{
+    DexelVolume * dexels;
+    int dx, dy, dz;
+    bool fit;
+    cgp::Point o;
+    cgp::Vector d;
+
+    like->getDim(dx, dy, dz);
+    like->getFrame(o, d);
+    dexels = dexpool.take([&](DexelVolume * v)
+    {
+        int vx, vy, vz;
+        v->getDim(vx, vy, vz);
+        return vx == dx && vy == dy && vz == dz;
+    }, fit);
+
+    if(dexels == NULL)
+        dexels = new DexelVolume();
+    if(fit)
+        dexels->clear();
+    else
+        dexels->setDim(dx, dy, dz);
+    dexels->setFrame(o, d);
+    return dexels;
+}
+
+VoxelVolume * Scene::takeVolume(VoxelVolume * like)
+{
+    VoxelVolume * voxels;
+    int dx, dy, dz;
+    bool fit;
+    cgp::Point o;
+    cgp::Vector d;
+
+    like->getDim(dx, dy, dz);
+    like->getFrame(o, d);
+    voxels = voxpool.take([&](VoxelVolume * v)
+    {
+        int vx, vy, vz;
+        v->getDim(vx, vy, vz);
+        return vx == dx && vy == dy && vz == dz && v->isSparse() == like->isSparse();
+    }, fit);
+
+    if(voxels == NULL)
+    {
+        voxels = new VoxelVolume();
+        fit = false;
+    }
+    if(fit)
+    {
+        voxels->fill(false);
+    }
+    else // storage mode only changes while empty
+    {
+        voxels->setDim(0, 0, 0);
+        voxels->setSparse(like->isSparse());
+        voxels->setDim(dx, dy, dz);
+    }
+    voxels->setFrame(o, d);
+    return voxels;
+}
+
+DistanceField * Scene::takeField(DistanceField * like)
+{
+    DistanceField * field;
+    int dx, dy, dz;
+    bool fit;
+    cgp::Point o;
+    cgp::Vector d;
+
+    like->getDim(dx, dy, dz);
+    like->getFrame(o, d);
+    field = sdfpool.take([&](DistanceField * f)
+    {
+        int fx, fy, fz;
+        f->getDim(fx, fy, fz);
+        return fx == dx && fy == dy && fz == dz;
+    }, fit);
+
+    if(field == NULL)
+        return new DistanceField(dx, dy, dz, o, d, like->getBand());
+    field->setBand(like->getBand());
+    if(fit)
+        field->fill(like->getBand());
+    else
+        field->setDim(dx, dy, dz);
+    field->setFrame(o, d);
+    return field;
+}
+
+void Scene::writeVoxelGrid()
+{
+    int dx, dy, dz;
+
+    /* convert to sizeable voxel grid */
+    vox.getDim(dx, dy, dz);
+    int xspan = vox.getXSpan();
+    int len = dx/xspan;
+    vector<int> voxel1d(len, 0);
+    vector<vector<int>> voxel2d(len, voxel1d);
+    vector<vector<vector<int>>> voxelgrid(len, voxel2d);
+    stats::MemoryTally gridtally(voxelGridMemory);
+    gridtally.set((size_t) len * len * len * sizeof(int) + (size_t) len * (len + 1) * sizeof(vector<int>));
+    int xcount = 0, ycount = 0, zcount = 0;
+    for (int z = 0; z < dz; z++)
+    {
+        if ((z+1)%xspan == 0) zcount++;   /// if at next xspan, switch to next z voxel
+        for (int y = 0; y < dy; y++)
+        {
+            if ((y+1)%xspan == 0) ycount++;   /// if at next xspan, switch to next y voxel
+            for (int x = 0; x < dx; x++)
+            {
+                int xPos = x/xspan, yPos = y/xspan, zPos = z/xspan;
+                if (voxelgrid[xPos][yPos][zPos] == 1) continue;  /// if already identified as a voxel, skip
+                voxelgrid[xPos][yPos][zPos] = vox.getUnchecked(x,y,z);
+                if ((x+1)%xspan == 0) xcount++;   /// if at next xspan, switch to next x voxel
+            }
+        }
+    }
+    UTS_LOG(INFO, CSG, "writing to voxelisedgrid");
+    getMesh()->writeGrid(voxelgrid, "meshes/voxel/voxelisedgrid", len);
+}
+
+void Scene::setCacheDirectory(std::string dir)
+{
+    if(!dir.empty() && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        cerr << "Error Scene::setCacheDirectory: unable to create " << dir << ", caching disabled" << endl;
+        dir = "";
+    }
+    cachedir = dir;
+}
+
+void Scene::hashTree(SceneNode * node, ContentHash &hash)
+{
+    hashSubtree(node, hash);
+}
+
+std::string Scene::cachePath(const ContentHash &key, const std::string &ext)
+{
+    return cachedir + "/" + key.hex() + "." + ext;
+}
+
+void Scene::commitCache(const std::string &tmpfile, const std::string &cachefile, bool written)
+{
+    if(!written || rename(tmpfile.c_str(), cachefile.c_str()) != 0)
+    {
+        cerr << "Error Scene::commitCache: unable to store " << cachefile << endl;
+        remove(tmpfile.c_str());
+    }
+}
+
+std::string Scene::meshCachePath(const ContentHash &key)
+{
+    return cachePath(key, cachecompress ? "mshz" : "msh");
+}
+
+bool Scene::readMeshCache(Mesh * mesh, const std::string &cachefile)
+{
+    if(cachecompress)
+        return Mesh::isCompressedFile(cachefile) && mesh->readCompressed(cachefile);
+    else
+        return Mesh::isMeshFile(cachefile) && mesh->readMeshFile(cachefile);
+}
+
+void Scene::writeMeshCache(Mesh * mesh, const std::string &cachefile)
+{
+    string tmpfile = cachefile + ".tmp";
+
+    commitCache(tmpfile, cachefile, cachecompress ? mesh->writeCompressed(tmpfile) : mesh->writeMeshFile(tmpfile));
+}
+
+bool Scene::loadMesh(Mesh * mesh, string filename)
+{
+    ContentHash key;
+    string cachefile;
+
+    if(!cachedir.empty() && !Mesh::isMeshFile(filename) && !Mesh::isCompressedFile(filename))
+    {
+        key.addString("load");
+        key.addInt(cacheversion);
+        key.addFloat(weldreltol);
+        if(key.addFile(filename))
+        {
+            cachefile = meshCachePath(key);
+            if(readMeshCache(mesh, cachefile))
+            {
+                UTS_LOG(INFO, CSG, "Scene::loadMesh: ", filename, " loaded from cache ", cachefile);
+                return true;
+            }
+        }
+    }
+
+    if(!mesh->readMesh(filename))
+        return false;
+    if(!cachefile.empty())
+        writeMeshCache(mesh, cachefile);
+    return true;
+}
+
+std::shared_ptr<const MeshAsset> Scene::loadAsset(const std::string &filename)
+{
+    std::shared_ptr<const MeshAsset> asset = assets.find(filename);
+    Mesh mesh;
+
+    if(asset)
+        return asset;
+    if(!loadMesh(&mesh, filename))
+        return asset;
+    asset = std::make_shared<const MeshAsset>(mesh);
+    assets.insert(filename, asset);
+    return asset;
+}
+
+Mesh * Scene::blockMesh()
+{
+    if(blocknode == NULL)
+    {
+        ShapeNode * leaf = new ShapeNode();
+        leaf->shape = new Mesh();
+        blocknode = leaf;
+        setRoot(leaf);
+    }
+    return meshShape(blocknode->shape);
+}
+
+void Scene::meshBlocks()
+{
+    Mesh * blocks = blockMesh();
+    int dimx, dimy, dimz;
+
+    // place voxel centres blocklen apart, so that cubes abut exactly
+    vox.getDim(dimx, dimy, dimz);
+    vox.setFrame(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(blocklen * (float) max(dimx-1, 1),
+                 blocklen * (float) max(dimy-1, 1), blocklen * (float) max(dimz-1, 1)));
+    blocks->setCacheOrder(true);
+    blocks->voxelSurface(&vox, greedyblocks);
+    blocks->boxFit(10.0f);
+    treeChanged(); // the leaf may be reused from the last voxel scene
+}
+
+bool Scene::planVoxelMemory(int xdim, int ydim, int zdim, bool &stream, bool &sparse)
+{
+    size_t dense = (size_t) ((xdim + 31) / 32) * (size_t) ydim * (size_t) zdim * sizeof(int);
+    size_t held = vox.getStorageBytes(); // released when the volume is resized
+    auto fits = [&](size_t bytes){ return stats::memoryFits(bytes > held ? bytes - held : 0); };
+
+    sparse = false;
+    if(distfield) // distances are held alongside the volume, with nothing to fall back on
+    {
+        if(fits(dense + (size_t) xdim * (size_t) ydim * (size_t) zdim * sizeof(float)))
+            return true;
+        cerr << "Error Scene::planVoxelMemory: signed distances need more than the memory budget allows" << endl;
+        return false;
+    }
+    if(!stream && !dexelcsg && csgroot != NULL && !fits(dense * (size_t) countLeaves(csgroot)))
+    {
+        UTS_LOG(INFO, CSG, "Scene::planVoxelMemory: streaming the tree to fit the memory budget");
+        stream = true;
+    }
+    if(!fits(dense))
+    {
+        UTS_LOG(INFO, CSG, "Scene::planVoxelMemory: using sparse bricks to fit the memory budget");
+        sparse = true;
+    }
+    return true;
+}
+
+void Scene::sampleCost(float voxlen, double &voxels, double &voxsecs, double &cellsecs, double &cells, double &tris, double &meshbytes,
+                       double &tests)
+{
+    int dim[3];
+    VoxelVolume sample;
+    CSGProgram prog;
+    Mesh surface;
+    cgp::Point voxorigin;
+    cgp::Vector voxdiag;
+    std::uint64_t cellsbefore, testsbefore = 0;
+
+    // the same preparation and evaluation as extractSlabs, but over the whole volume at once
+    volumeFrame(voxlen, dim, voxorigin, voxdiag);
+    sample.setDim(dim[0], dim[1], dim[2]);
+    sample.setFrame(voxorigin, voxdiag);
+    voxels = (double) dim[0] * (double) dim[1] * (double) dim[2];
+    for(int c = (int) stats::Counter::SPHERE_CONTAINMENT; c <= (int) stats::Counter::INSTANCE_CONTAINMENT; c++)
+        testsbefore += stats::getCount((stats::Counter) c);
+
+    auto start = stats::clock_type::now();
+    if(simplifycsg)
+        simplifyTree();
+    if(meshbools)
+        combineMeshes();
+    if(csgroot != NULL)
+    {
+        cgp::BoundBox bbox;
+        boundTree(csgroot, bbox);
+    }
+    prog.compile(csgroot, sharesubtrees);
+    prog.evaluate(&sample, scanmesh);
+    auto evaluated = stats::clock_type::now();
+    cellsbefore = stats::getCount(stats::Counter::MC_ACTIVE_CELLS);
+    surface.marchingCubes(&sample);
+    auto extracted = stats::clock_type::now();
+
+    voxsecs = std::chrono::duration<double>(evaluated - start).count();
+    cellsecs = std::chrono::duration<double>(extracted - evaluated).count();
+    tris = (double) surface.getNumFaces();
+    meshbytes = (double) surface.getMemoryBytes();
+    tests = 0.0;
+    if(stats::isCountingEnabled())
+    {
+        cells = (double) (stats::getCount(stats::Counter::MC_ACTIVE_CELLS) - cellsbefore);
+        for(int c = (int) stats::Counter::SPHERE_CONTAINMENT; c <= (int) stats::Counter::INSTANCE_CONTAINMENT; c++)
+            tests += (double) stats::getCount((stats::Counter) c);
+        tests -= (double) testsbefore;
+    }
+    else
+        cells = 0.5 * tris; // marching cubes averages about two triangles per active cell
+}
+
+/**
+ * Fit the time of a stage as a cost per voxel plus a cost per active cell through two samples
+ * @param v0, c0, t0    voxels, active cells and seconds of the coarser sample
+ * @param v1, c1, t1    voxels, active cells and seconds of the finer sample
+ * @param[out] pervoxel, percell    seconds per voxel and per active cell, neither negative
+ */
+static void fitCost(double v0, double c0, double t0, double v1, double c1, double t1, double &pervoxel, double &percell)
+{
+    double det = v0 * c1 - v1 * c0;
+
+    pervoxel = percell = 0.0;
+    if(det != 0.0)
+    {
+        pervoxel = (t0 * c1 - t1 * c0) / det;
+        percell = (v0 * t1 - v1 * t0) / det;
+    }
+    // timing noise can tip the fit negative, so the finer sample is then charged to voxels alone, which over-predicts
+    if(det == 0.0 || pervoxel < 0.0 || percell < 0.0)
+    {
+        pervoxel = t1 / std::max(v1, 1.0);
+        percell = 0.0;
+    }
+}
+
+void Scene::predictCost(float voxlen, ResolutionEstimate &est)
+{
+    cgp::Point corner;
+    cgp::Vector diag;
+    double voxels, scale, cells;
+
+    volumeFrame(voxlen, est.dim, corner, diag);
+    voxels = (double) est.dim[0] * (double) est.dim[1] * (double) est.dim[2];
+    scale = ((double) est.samplelen / (double) voxlen) * ((double) est.samplelen / (double) voxlen);
+    cells = est.samplecells * scale;
+
+    est.voxlen = voxlen;
+    est.seconds = (est.voxpervoxel + est.mcpervoxel) * voxels + (est.voxpercell + est.mcpercell) * cells;
+    est.triangles = (size_t) (est.sampletris * scale);
+    est.bytes = (size_t) ((double) (est.dim[0] / voxwordbits) * sizeof(int) * (double) est.dim[1] * (double) est.dim[2]
+                          + (double) est.triangles * est.bytespertri);
+}
+
+bool Scene::estimateResolution(float voxlen, ResolutionEstimate &est)
+{
+    const int numsamples = (int) (sizeof(tunesamples) / sizeof(tunesamples[0]));
+    double voxels[numsamples], voxsecs[numsamples], cellsecs[numsamples], cells[numsamples], tris[numsamples];
+    double meshbytes[numsamples], tests[numsamples];
+    float sidelen = std::max(voldiag.i, std::max(voldiag.j, voldiag.k)), samplelen[numsamples];
+
+    if(csgroot == NULL || voxlen <= 0.0f || sidelen <= 0.0f)
+    {
+        cerr << "Error Scene::estimateResolution: needs a tree and a positive voxel size" << endl;
+        return false;
+    }
+    for(int s = 0; s < numsamples; s++)
+    {
+        samplelen[s] = sidelen / (float) tunesamples[s];
+        sampleCost(samplelen[s], voxels[s], voxsecs[s], cellsecs[s], cells[s], tris[s], meshbytes[s], tests[s]);
+        for(int r = 1; r < tunerepeats; r++)
+        {
+            double repvoxsecs, repcellsecs;
+
+            sampleCost(samplelen[s], voxels[s], repvoxsecs, repcellsecs, cells[s], tris[s], meshbytes[s], tests[s]);
+            voxsecs[s] = std::min(voxsecs[s], repvoxsecs);
+            cellsecs[s] = std::min(cellsecs[s], repcellsecs);
+        }
+        UTS_LOG(INFO, CSG, "Scene::estimateResolution: sample at ", samplelen[s], " took ", voxsecs[s], "s to voxelise and ",
+                cellsecs[s], "s for ", cells[s], " active cells");
+    }
+
+    const int f = numsamples-1;
+    fitCost(voxels[0], cells[0], voxsecs[0], voxels[f], cells[f], voxsecs[f], est.voxpervoxel, est.voxpercell);
+    fitCost(voxels[0], cells[0], cellsecs[0], voxels[f], cells[f], cellsecs[f], est.mcpervoxel, est.mcpercell);
+    est.samplelen = samplelen[f];
+    est.samplecells = cells[f];
+    est.sampletris = tris[f];
+    est.bytespertri = meshbytes[f] / std::max(tris[f], 1.0);
+    est.testspervoxel = tests[f] / std::max(voxels[f], 1.0);
+    predictCost(voxlen, est);
+    return true;
+}
+
+bool Scene::tuneResolution(double seconds, size_t bytes, ResolutionEstimate &est)
+{
+    float coarse, fine, mid;
+
+    if(seconds <= 0.0 && bytes == 0)
+    {
+        cerr << "Error Scene::tuneResolution: needs a time or memory budget" << endl;
+        return false;
+    }
+    coarse = std::max(voldiag.i, std::max(voldiag.j, voldiag.k)) / (float) tunesamples[0];
+    if(!estimateResolution(coarse, est))
+        return false;
+    auto fits = [&](){ return (seconds <= 0.0 || est.seconds <= seconds) && (bytes == 0 || est.bytes <= bytes); };
+    if(!fits())
+    {
+        cerr << "Error Scene::tuneResolution: even a voxel size of " << coarse << " is predicted to exceed the budget" << endl;
+        return false;
+    }
+
+    // the predicted costs only grow as voxels shrink, so bisect on a log scale for the finest size that fits
+    fine = coarse / 4096.0f;
+    for(int i = 0; i < 40; i++)
+    {
+        mid = sqrtf(coarse * fine);
+        predictCost(mid, est);
+        if(fits())
+            coarse = mid;
+        else
+            fine = mid;
+    }
+    predictCost(coarse, est);
+    UTS_LOG(INFO, CSG, "Scene::tuneResolution: voxel size ", est.voxlen, " is predicted to take ", est.seconds, "s and ",
+            est.bytes / (1024 * 1024), "MB for ", est.triangles, " triangles");
+    return true;
+}
+
+bool Scene::voxelise(float voxlen)
+{
+    if(!voxeliseVolume(voxlen))
+    {
+        stamps[(int) SceneStage::VOXELS].version = 0; // left as the tree, so whatever vox holds is not its volume
+        return false;
+    }
+    stampStage(SceneStage::VOXELS, voxelParams(voxlen), stamps[(int) SceneStage::TREE].version);
+    return true;
+}
+
+bool Scene::voxeliseVolume(float voxlen)
+{
+    int xdim, ydim, zdim;
+    ContentHash key;
+    string cachefile;
+    bool stream = streamcsg, sparse;
+
+    /// calculate voxel volume dimensions based on voxlen
+    xdim = ceil(voldiag.i / voxlen)+2; // needs a 1 voxel border to ensure a closed mesh
+    ydim = ceil(voldiag.j / voxlen)+2;
+    zdim = ceil(voldiag.k / voxlen)+2;
+
+    // only replaced leaves have changed, otherwise the whole tree is evaluated again as usual
+    if(voxtree != NULL && voxtree == csgroot && voxlen == voxsidelen && !distfield && !keeplargest && !fillvoids && !boxEmpty(dirtybox))
+    {
+        if(cancelled()) // the edits stay pending
+        {
+            rep = SceneRep::TREE;
+            return false;
+        }
+        voxeliseDirty();
+        rep = SceneRep::VOXELS;
+        reportProgress(1.0);
+        return true;
+    }
+    voxtree = NULL;
+    dirtybox.reset();
+    remeshlo = 0;
+    remeshhi = std::numeric_limits<int>::max();
+
+    if(!planVoxelMemory(xdim, ydim, zdim, stream, sparse))
+    {
+        rep = SceneRep::TREE;
+        return false;
+    }
+    if(vox.isSparse() != sparse) // switch while empty, rather than converting the old contents
+    {
+        vox.setDim(0, 0, 0);
+        vox.setSparse(sparse);
+    }
+    voxsidelen = voxlen;
+    vox.setDim(xdim, ydim, zdim);
+
+    /// account for expansion in x-dimension by adjusting origin and diagonal
+    vox.getDim(xdim, ydim, zdim);
+    cgp::Vector voxdiag = cgp::Vector((float) xdim * voxlen, (float) ydim * voxlen, (float) zdim * voxlen);
+    cgp::Point voxorigin = cgp::Point(-0.5f*voxdiag.i, -0.5f*voxdiag.j, -0.5f*voxdiag.k);
+    vox.setFrame(voxorigin, voxdiag);
+
+    /// map dimensions to closest power of 2
+
+   UTS_LOG(INFO, CSG, "Voxel volume dimensions = ", xdim, " x ", ydim, " x ", zdim);
+
+    if(simplifycsg)
+        simplifyTree();
+    if(meshbools)
+        combineMeshes();
+    if(csgroot != NULL) // set operations are limited to the bounds of their operands
+    {
+        cgp::BoundBox bbox;
+        boundTree(csgroot, bbox);
+    }
+
+    voxdistances = distfield;
+    if(distfield) // evaluate distances and threshold them, which is not cached since isoextract needs the distances
+    {
+        sdf.setBand(sdfbandvoxels * voxlen);
+        sdf.setDim(xdim, ydim, zdim);
+        sdf.setFrame(voxorigin, voxdiag);
+        if(csgroot != NULL)
+        {
+            voxleaves = countLeaves(csgroot);
+            voxdone = 0.0;
+            #pragma omp parallel
+            {
+                #pragma omp single
+                sdfWalk(csgroot, &sdf);
+            }
+            sdfpool.reset();
+            voxpool.reset();
+            if(cancelled())
+            {
+                UTS_LOG(INFO, CSG, "Scene::voxelise: cancelled");
+                rep = SceneRep::TREE;
+                return false;
+            }
+        }
+        sdf.toVoxels(&vox);
+        rep = SceneRep::VOXELS;
+        reportProgress(1.0);
+        return true;
+    }
+
+    if(!cachedir.empty() && csgroot != NULL) // the volume depends only on the tree, its frame and how mesh leaves are scanned
+    {
+        key.addString("voxelise");
+        key.addInt(cacheversion);
+        hashTree(csgroot, key);
+        key.addInt(xdim); key.addInt(ydim); key.addInt(zdim);
+        key.addFloat(voxlen);
+        key.addInt(scanmesh);
+        key.addInt(rastervox); // rasterised primitives follow their tessellation
+        cachefile = cachePath(key, "vox");
+        if(VoxelVolume::isVoxelFile(cachefile) && vox.readVoxels(cachefile))
+        {
+            UTS_LOG(INFO, CSG, "Scene::voxelise: loaded from cache ", cachefile);
+            if(!stream)
+                writeVoxelGrid();
+            cleanVoxels();
+            voxtree = csgroot;
+            rep = SceneRep::VOXELS;
+            reportProgress(1.0);
+            return true;
+        }
+        vox.setDim(xdim, ydim, zdim); // a failed read leaves the volume empty
+        vox.setFrame(voxorigin, voxdiag);
+    }
+
+    if(gpuvox && !sparse && clVoxelise()) // leaves and set operations on the device, read back once
+    {
+        if(!stream)
+            writeVoxelGrid();
+    }
+    else if(rastervox && !cancelled() && glVoxelise()) // leaves drawn with OpenGL, set operations on the CPU
+    {
+        if(!stream)
+            writeVoxelGrid();
+    }
+    else if((gpuvox || rastervox) && cancelled())
+    {
+        UTS_LOG(INFO, CSG, "Scene::voxelise: cancelled");
+        rep = SceneRep::TREE;
+        return false;
+    }
+    else if(stream) // single pass over the final volume
+    {
+        CSGProgram prog;
+        prog.compile(csgroot, sharesubtrees);
+        prog.evaluate(&vox, scanmesh);
+    }
+    else if(dexelcsg && csgroot != NULL) // span lists merged row by row, packed into vox once
+    {
+        DexelVolume dexels;
+
+        dexels.setDim(xdim, ydim, zdim);
+        dexels.setFrame(voxorigin, voxdiag);
+        voxleaves = countLeaves(csgroot);
+        voxdone = 0.0;
+        #pragma omp parallel
+        {
+            #pragma omp single
+            dexelWalk(csgroot, &dexels);
+        }
+        dexpool.reset();
+        if(cancelled())
+        {
+            UTS_LOG(INFO, CSG, "Scene::voxelise: cancelled");
+            rep = SceneRep::TREE;
+            return false;
+        }
+        dexels.toVoxels(&vox);
+        writeVoxelGrid();
+    }
+    else if(csgroot != NULL) // actual recursive depth-first walk of csg tree
+    {
+        ContentHash frame; // everything besides the subtree itself that decides its voxels
+
+        frame.addInt(xdim); frame.addInt(ydim); frame.addInt(zdim);
+        frame.addFloat(voxlen);
+        frame.addInt(scanmesh);
+        frame.addInt(sparse);
+        frame.addInt(adaptivevox);
+        shareSubtrees(sharesubtrees ? frame.value() : 0);
+        if(!cancelled())
+        {
+            #pragma omp parallel
+            {
+                #pragma omp single
+                voxWalk(csgroot, &vox);
+            }
+        }
+        sharedkeys.clear();
+        voxpool.reset();
+        if(cancelled()) // skipped tiles leave the volume incomplete
+        {
+            UTS_LOG(INFO, CSG, "Scene::voxelise: cancelled");
+            rep = SceneRep::TREE;
+            return false;
+        }
+        writeVoxelGrid();
+    }
+    if(sparse && !stats::memoryFits(0))
+    {
+        cerr << "Error Scene::voxelise: the volume does not fit the memory budget, even in sparse bricks" << endl;
+        vox.setDim(0, 0, 0);
+        rep = SceneRep::TREE;
+        return false;
+    }
+
+    if(!cachefile.empty())
+        commitCache(cachefile + ".tmp", cachefile, vox.writeVoxels(cachefile + ".tmp"));
+    cleanVoxels(); // after caching, so the cached volume does not depend on the cleanup
+    voxtree = csgroot;
+    rep = SceneRep::VOXELS;
+    reportProgress(1.0);
+    return true;
+}
+
+void Scene::cleanVoxels()
+{
+    if(!keeplargest && !fillvoids)
+        return;
+
+    stats::Timer timer(cleanVoxelsTime);
+    if(fillvoids)
+    {
+        int voids = vox.fillVoids();
+        UTS_LOG(INFO, CSG, "Scene::voxelise: filled ", voids, " internal voids");
+    }
+    if(keeplargest)
+    {
+        int islands = vox.keepLargest();
+        UTS_LOG(INFO, CSG, "Scene::voxelise: removed ", islands, " disconnected islands");
+    }
+}
+
+bool Scene::voxeliseProgressive(float voxlen, const std::function<bool(int)> &publish)
+{
+    std::vector<int> factors(std::begin(previewfactors), std::end(previewfactors));
+
+    factors.push_back(1); // full resolution last
+    for(int factor : factors)
+    {
+        if(!voxelise(voxlen * (float) factor) || !isoextract())
+            return false;
+        UTS_LOG(INFO, CSG, "Scene::voxeliseProgressive: level at ", factor, "x voxel size has ", voxmesh.getNumFaces(), " triangles");
+        if(!publish(factor) && factor != 1)
+            return false;
+    }
+    return true;
+}
+
+void Scene::voxeliseDirty()
+{
+    CSGProgram prog;
+    int lo[3], hi[3];
+
+    if(simplifycsg) // an edit may have moved a shape clear of the others
+        simplifyTree();
+    if(vox.getVoxelRange(dirtybox, lo, hi))
+    {
+        // the row program only visits the region, whereas voxWalk would sweep whole operand bounds
+        prog.compile(csgroot, sharesubtrees);
+        prog.evaluate(&vox, scanmesh, lo, hi);
+        remeshlo = std::min(remeshlo, lo[2]);
+        remeshhi = std::max(remeshhi, hi[2]);
+        UTS_LOG(INFO, CSG, "Scene::voxelise: re-evaluated voxels (", lo[0], ", ", lo[1], ", ", lo[2], ") to (",
+                   hi[0], ", ", hi[1], ", ", hi[2], ")");
+    }
+    voxtree = csgroot;
+    dirtybox.reset();
+}
+
+int Scene::getNumShapes()
+{
+    return (csgroot != NULL) ? countLeaves(csgroot) : 0;
+}
+
+bool Scene::replaceShape(int leaf, BaseShape * shape)
+{
+    cgp::BoundBox oldbox, newbox;
+    ShapeNode * node = NULL;
+    int index = leaf;
+
+    if(csgroot != NULL && leaf >= 0)
+        node = findLeaf(csgroot, index);
+    if(node == NULL || shape == NULL)
+    {
+        cerr << "Error Scene::replaceShape: no leaf " << leaf << " in a tree of " << getNumShapes() << " shapes" << endl;
+        return false;
+    }
+
+    node->shape->getBounds(oldbox);
+    shape->getBounds(newbox);
+    delete node->shape;
+    node->shape = shape;
+    for(const cgp::BoundBox * box : {&oldbox, &newbox})
+        if(!boxEmpty(*box))
+        {
+            dirtybox.includePnt(box->min);
+            dirtybox.includePnt(box->max);
+        }
+    treeChanged();
+    rep = SceneRep::TREE;
+    return true;
+}
+
+bool Scene::isoextract()
+{
+    if(!extractSurface())
+        return false;
+    stampStage(SceneStage::ISOSURFACE, stageParams(SceneStage::ISOSURFACE), stamps[(int) SceneStage::VOXELS].version);
+    meshstage = SceneStage::ISOSURFACE;
+    return true;
+}
+
+bool Scene::extractSurface()
+{
+    ContentHash key;
+    string cachefile;
+
+    if(cancelled())
+        return false;
+
+    // drawn straight from the device, with voxmesh only extracted if something asks for it
+    if(gpusurface && !voxdistances && !dualsurface && clvox.available())
+    {
+        devsurface = true;
+        devbound = false;
+        rep = SceneRep::ISOSURFACE;
+        reportProgress(1.0);
+        return true;
+    }
+    if(devsurface && !voxdistances && !dualsurface) // extracted afresh, so there are no changed layers left to re-mesh
+    {
+        hostSurface();
+        rep = SceneRep::ISOSURFACE;
+        reportProgress(1.0);
+        return true;
+    }
+    devsurface = false;
+    if(!voxdistances && !dualsurface && remeshhi != std::numeric_limits<int>::max()) // re-mesh only the layers changed by edits
+    {
+        voxmesh.updateMarchingCubes(&vox, remeshlo, remeshhi);
+        remeshlo = std::numeric_limits<int>::max();
+        remeshhi = -1;
+        rep = SceneRep::ISOSURFACE;
+        reportProgress(1.0);
+        return true;
+    }
+
+    if(!cachedir.empty())
+    {
+        key.addString("isoextract");
+        key.addInt(cacheversion);
+        if(dualsurface)
+            key.addString("dual");
+        if(voxdistances)
+            sdf.hashContent(key);
+        else
+            vox.hashContent(key);
+        cachefile = meshCachePath(key);
+        if(readMeshCache(&voxmesh, cachefile))
+        {
+            UTS_LOG(INFO, CSG, "Scene::isoextract: loaded from cache ", cachefile);
+            rep = SceneRep::ISOSURFACE;
+            reportProgress(1.0);
+            return true;
+        }
+    }
+
+    if(voxdistances)
+    {
+        if(dualsurface)
+            voxmesh.dualContouring(&sdf);
+        else
+            voxmesh.marchingCubes(&sdf);
+    }
+    else if(dualsurface) // no slabs are kept for re-meshing, so the next isoextract starts afresh
+    {
+        voxmesh.surfaceNets(&vox);
+        remeshlo = 0;
+        remeshhi = std::numeric_limits<int>::max();
+    }
+    else
+    {
+        voxmesh.marchingCubes(&vox);
+        remeshlo = std::numeric_limits<int>::max(); // until the next edit
+        remeshhi = -1;
+    }
+    if(!cachefile.empty())
+        writeMeshCache(&voxmesh, cachefile);
+    rep = SceneRep::ISOSURFACE;
+    reportProgress(1.0);
+    return true;
+}
+
+void Scene::volumeFrame(float voxlen, int * dim, cgp::Point &corner, cgp::Vector &diag)
+{
+    // as voxelise, with x padded to whole words as VoxelVolume::setDim does
+    dim[0] = ((int) ceil(voldiag.i / voxlen) + 2 + voxwordbits - 1) / voxwordbits * voxwordbits;
+    dim[1] = ceil(voldiag.j / voxlen)+2;
+    dim[2] = ceil(voldiag.k / voxlen)+2;
+    diag = cgp::Vector((float) dim[0] * voxlen, (float) dim[1] * voxlen, (float) dim[2] * voxlen);
+    corner = cgp::Point(-0.5f*diag.i, -0.5f*diag.j, -0.5f*diag.k);
+}
+
+bool Scene::voxeliseToFile(float voxlen, const std::string &filename)
+{
+    int dim[3], xdim, ydim, zdim, slabdim, zstart, zdone = 0;
+    float zstep;
+    VoxelVolume slab;
+    VoxelStreamWriter writer;
+    CSGProgram prog;
+    cgp::Point voxorigin;
+    cgp::Vector voxdiag;
+
+    volumeFrame(voxlen, dim, voxorigin, voxdiag);
+    xdim = dim[0]; ydim = dim[1]; zdim = dim[2];
+    slabdim = std::min(voxslablayers, zdim);
+    slab.setDim(xdim, ydim, slabdim);
+    zstep = voxdiag.k / (float) (zdim-1);
+
+    if(!writer.open(filename, xdim, ydim, zdim, voxorigin, voxdiag))
+        return false;
+    UTS_LOG(INFO, CSG, "Voxel volume dimensions = ", xdim, " x ", ydim, " x ", zdim, ", written to ", filename, " in slabs of ", slabdim, " layers");
+
+    if(simplifycsg)
+        simplifyTree();
+    if(meshbools)
+        combineMeshes();
+    if(csgroot != NULL)
+    {
+        cgp::BoundBox bbox;
+        boundTree(csgroot, bbox);
+    }
+    prog.compile(csgroot, sharesubtrees);
+
+    // the last slab is moved down to end on the last layer, and its layers already written are skipped
+    while(zdone < zdim)
+    {
+        if(cancelled())
+        {
+            UTS_LOG(INFO, CSG, "Scene::voxeliseToFile: cancelled");
+            writer.close();
+            return false;
+        }
+        zstart = std::min(zdone, zdim - slabdim);
+        slab.setFrame(cgp::Point(voxorigin.x, voxorigin.y, voxorigin.z + (float) zstart * zstep),
+                      cgp::Vector(voxdiag.i, voxdiag.j, (float) (slabdim-1) * zstep));
+        prog.evaluate(&slab, scanmesh);
+        if(!writer.writeLayers(&slab, zdone - zstart, slabdim-1))
+            return false;
+        zdone = zstart + slabdim;
+        reportProgress((double) zdone / (double) zdim);
+    }
+    return writer.close();
+}
+
+bool Scene::isoextractFile(const std::string &filename)
+{
+    VoxelStreamReader reader;
+
+    if(cancelled() || !reader.open(filename))
+        return false;
+    voxmesh.marchingCubes(&reader);
+    devsurface = false;
+
+    // the mesh no longer comes from vox, so the next isoextract starts afresh
+    remeshlo = 0;
+    remeshhi = std::numeric_limits<int>::max();
+    rep = SceneRep::ISOSURFACE;
+    reportProgress(1.0);
+    return true;
+}
+
+bool Scene::extractSlabs(float voxlen, const std::function<bool(const std::vector<cgp::Point> &, const std::vector<int> &)> &consume,
+                         int tile, int numtiles)
+{
+    int dim[3], lo[3], hi[3], slabdim, zstart, zlo, zhi;
+    float zstep;
+    VoxelVolume slab;
+    CSGProgram prog;
+    cgp::Point voxorigin;
+    cgp::Vector voxdiag;
+    std::vector<cgp::Point> verts;
+    std::vector<int> faces;
+    std::vector<unsigned int> row;
+
+    volumeFrame(voxlen, dim, voxorigin, voxdiag);
+    slabdim = std::min(voxslablayers + 1, dim[2]);
+    slab.setDim(dim[0], dim[1], slabdim);
+    row.resize(slab.getXSpan());
+    zstep = voxdiag.k / (float) (dim[2]-1);
+    if(numtiles < 1 || tile < 0 || tile >= numtiles)
+    {
+        cerr << "Error Scene::extractSlabs: tile " << tile << " is not one of " << numtiles << endl;
+        return false;
+    }
+    // the cell layers are shared out evenly, and a tile also evaluates the voxel layer it shares with the one below
+    zlo = (int) ((int64_t) tile * (dim[2]-1) / numtiles);
+    zhi = (int) ((int64_t) (tile+1) * (dim[2]-1) / numtiles);
+    UTS_LOG(INFO, CSG, "Voxel volume dimensions = ", dim[0], " x ", dim[1], " x ", dim[2], ", extracted in slabs of ", slabdim, " layers");
+    if(numtiles > 1)
+        UTS_LOG(INFO, CSG, "Tile ", tile, " of ", numtiles, " covers cell layers ", zlo, " to ", zhi);
+
+    if(simplifycsg)
+        simplifyTree();
+    if(meshbools)
+        combineMeshes();
+    if(csgroot != NULL)
+    {
+        cgp::BoundBox bbox;
+        boundTree(csgroot, bbox);
+    }
+    prog.compile(csgroot, sharesubtrees);
+
+    lo[0] = lo[1] = lo[2] = 0;
+    hi[0] = dim[0]-1; hi[1] = dim[1]-1;
+    for(zstart = zlo; zstart < zhi; zstart += slabdim-1)
+    {
+        if(cancelled())
+        {
+            UTS_LOG(INFO, CSG, "Scene::extractSlabs: cancelled");
+            return false;
+        }
+        slab.setFrame(cgp::Point(voxorigin.x, voxorigin.y, voxorigin.z + (float) zstart * zstep),
+                      cgp::Vector(voxdiag.i, voxdiag.j, (float) (slabdim-1) * zstep));
+        hi[2] = std::min(slabdim-1, zhi - zstart); // the last slab may be part full, and its stale layers are never read
+        if(zstart > zlo) // the top slice of the previous slab is the bottom slice of this one
+        {
+            for(int y = 0; y < dim[1]; y++)
+            {
+                slab.getRow(y, slabdim-1, &row[0]);
+                slab.setRow(y, 0, &row[0]);
+            }
+            lo[2] = 1;
+        }
+        prog.evaluate(&slab, scanmesh, lo, hi);
+        Mesh::marchingCubesSlab(&slab, zstart, dim[2], voxorigin, voxdiag, zstart, zstart + hi[2], verts, faces);
+        if(!consume(verts, faces))
+            return false;
+        reportProgress((double) (zstart + hi[2] - zlo) / (double) (zhi - zlo));
+    }
+    return true;
+}
+
+bool Scene::smooth()
+{
+    ContentHash key, params;
+    string cachefile;
+
+    if(cancelled())
+        return false;
+    hostSurface();
+
+    // smoothing an already smoothed surface compounds the two, which require would never build
+    if(holdsStage(SceneStage::ISOSURFACE))
+        stampStage(SceneStage::SMOOTHED, stageParams(SceneStage::SMOOTHED), stamps[(int) SceneStage::ISOSURFACE].version);
+    else
+    {
+        params.addInt((int64_t) stamps[(int) SceneStage::SMOOTHED].params);
+        params.addInt((int64_t) stageParams(SceneStage::SMOOTHED));
+        stampStage(SceneStage::SMOOTHED, params.value(), (meshstage == SceneStage::SMOOTHED) ? stamps[(int) SceneStage::SMOOTHED].input : 0);
+    }
+    meshstage = SceneStage::SMOOTHED;
+
+    if(!cachedir.empty())
+    {
+        key.addString("smooth");
+        key.addInt(cacheversion);
+        voxmesh.hashContent(key);
+        key.addInt((int) SmoothMode::TAUBIN);
+        key.addInt(smoothpairs);
+        key.addFloat(smoothshrink);
+        key.addFloat(smoothband);
+        cachefile = meshCachePath(key);
+        if(readMeshCache(&voxmesh, cachefile))
+        {
+            UTS_LOG(INFO, CSG, "Scene::smooth: loaded from cache ", cachefile);
+            reportProgress(1.0);
+            return true;
+        }
+    }
+
+    voxmesh.taubinSmooth(smoothpairs, smoothshrink, smoothband);
+    if(!cachefile.empty())
+        writeMeshCache(&voxmesh, cachefile);
+    reportProgress(1.0);
+    return true;
+}
+
+void Scene::deform(ffd * def)
+{
+    ContentHash params;
+
+    hostSurface();
+    def->hashContent(params);
+    stampStage(SceneStage::DEFORMED, params.value(), holdsStage(SceneStage::SMOOTHED) ? stamps[(int) SceneStage::SMOOTHED].version : 0);
+    meshstage = SceneStage::DEFORMED;
+    voxmesh.applyFFD(def);
+}
+
+void Scene::resetStages()
+{
+    for(int s = (int) SceneStage::VOXELS; s < numscenestages; s++)
+        stamps[s] = {0, 0, 0};
+    meshstage = SceneStage::TREE;
+    isosnapver = 0;
+    smoothsnapver = 0;
+}
+
+uint64_t Scene::voxelParams(float voxlen)
+{
+    ContentHash key;
+
+    // everything that changes which voxels are set, rather than only how they are found
+    key.addFloat(voxlen);
+    key.addFloat(voldiag.i); key.addFloat(voldiag.j); key.addFloat(voldiag.k);
+    key.addInt(distfield ? 1 : 0);
+    key.addInt(keeplargest ? 1 : 0);
+    key.addInt(fillvoids ? 1 : 0);
+    key.addInt(meshbools ? 1 : 0);
+    key.addInt(scanmesh ? 1 : 0);
+    return key.value();
+}
+
+uint64_t Scene::stageParams(SceneStage stage)
+{
+    ContentHash key;
+
+    switch(stage)
+    {
+        case SceneStage::TREE:
+            return 0;
+        case SceneStage::VOXELS:
+            return voxelParams(reqvoxlen);
+        case SceneStage::ISOSURFACE:
+            key.addInt(dualsurface ? 1 : 0);
+            break;
+        case SceneStage::SMOOTHED:
+            if(smoothpairs <= 0)
+                return 0;
+            key.addInt((int) SmoothMode::TAUBIN);
+            key.addInt(smoothpairs);
+            key.addFloat(smoothshrink);
+            key.addFloat(smoothband);
+            break;
+        case SceneStage::DEFORMED:
+            if(!haslattice)
+                return 0;
+            lattice.hashContent(key);
+            break;
+    }
+    return key.value();
+}
+
+void Scene::setLattice(ffd * def)
+{
+    haslattice = (def != NULL);
+    if(def != NULL)
+        lattice = (* def);
+}
+
+bool Scene::stageCurrent(SceneStage stage)
+{
+    const StageStamp &stamp = stamps[(int) stage];
+
+    if(stage == SceneStage::TREE)
+        return csgroot != NULL;
+    return stamp.version != 0 && stamp.input != 0 && stamp.input == stamps[(int) stage - 1].version
+           && stamp.params == stageParams(stage);
+}
+
+bool Scene::isStale(SceneStage stage)
+{
+    for(int s = 0; s <= (int) stage; s++)
+        if(!stageCurrent((SceneStage) s))
+            return true;
+    return false;
+}
+
+bool Scene::holdsStage(SceneStage stage)
+{
+    if(meshstage == SceneStage::TREE || (int) meshstage > (int) stage)
+        return false;
+    for(int s = (int) stage; s > (int) meshstage; s--) // each later stage must have passed its input through
+        if(stamps[s].version == 0 || stamps[s].params != 0 || stamps[s].input != stamps[s - 1].version)
+            return false;
+    return true;
+}
+
+bool Scene::restoreStage(SceneStage stage)
+{
+    if(holdsStage(stage))
+        return true;
+    for(int s = (int) stage; s >= (int) SceneStage::ISOSURFACE; s--)
+    {
+        const MeshSnapshot * snap = NULL;
+
+        if(s == (int) SceneStage::ISOSURFACE && isosnapver != 0 && isosnapver == stamps[s].version)
+            snap = &isosnap;
+        else if(s == (int) SceneStage::SMOOTHED && smoothsnapver != 0 && smoothsnapver == stamps[s].version)
+            snap = &smoothsnap;
+        if(snap != NULL)
+        {
+            voxmesh.restoreSnapshot(* snap);
+            devsurface = false;
+            meshstage = (SceneStage) s;
+            remeshlo = 0; // the slabs marching cubes kept belong to whatever voxmesh held before
+            remeshhi = std::numeric_limits<int>::max();
+            return true;
+        }
+        if(stamps[s].params != 0) // the output differs from that of the stage before
+            return false;
+    }
+    return false;
+}
+
+bool Scene::buildStage(SceneStage stage)
+{
+    switch(stage)
+    {
+        case SceneStage::TREE:
+            return csgroot != NULL;
+        case SceneStage::VOXELS:
+            if(reqvoxlen <= 0.0f)
+            {
+                cerr << "Error Scene::require: no voxel size has been set" << endl;
+                return false;
+            }
+            return voxelise(reqvoxlen);
+        case SceneStage::ISOSURFACE:
+            if(meshstage != SceneStage::ISOSURFACE) // only the raw surface of the last volume can be re-meshed in part
+            {
+                remeshlo = 0;
+                remeshhi = std::numeric_limits<int>::max();
+            }
+            return isoextract();
+        case SceneStage::SMOOTHED:
+            if(stageParams(stage) == 0)
+                break;
+            hostSurface();
+            if(isosnapver != stamps[(int) SceneStage::ISOSURFACE].version)
+            {
+                voxmesh.takeSnapshot(isosnap);
+                isosnapver = stamps[(int) SceneStage::ISOSURFACE].version;
+            }
+            return smooth();
+        case SceneStage::DEFORMED:
+            if(stageParams(stage) == 0)
+                break;
+            hostSurface();
+            if(smoothsnapver != stamps[(int) SceneStage::SMOOTHED].version)
+            {
+                voxmesh.takeSnapshot(smoothsnap, isosnapver != 0 ? &isosnap : NULL);
+                smoothsnapver = stamps[(int) SceneStage::SMOOTHED].version;
+            }
+            deform(&lattice);
+            return true;
+    }
+    stampStage(stage, 0, stamps[(int) stage - 1].version); // passed through, leaving voxmesh as it is
+    return true;
+}
+
+bool Scene::require(SceneStage stage)
+{
+    int target = (int) stage, fresh, base;
+
+    if(csgroot == NULL)
+    {
+        cerr << "Error Scene::require: there is no tree to build from" << endl;
+        return false;
+    }
+
+    // the run of stages that are up to date, and the latest of them whose output is still to hand
+    for(fresh = 0; fresh < target && stageCurrent((SceneStage) (fresh + 1)); fresh++);
+    for(base = fresh; base >= (int) SceneStage::ISOSURFACE && !restoreStage((SceneStage) base); base--);
+
+    for(int s = base + 1; s <= target; s++)
+        if(!buildStage((SceneStage) s))
+            return false;
+    if(stage == SceneStage::TREE)
+        rep = SceneRep::TREE;
+    else if(stage == SceneStage::VOXELS)
+        rep = SceneRep::VOXELS;
+    else
+        rep = SceneRep::ISOSURFACE;
+    UTS_LOG(DEBUG, CSG, "Scene::require: built ", target - base, " of ", target, " stages");
+    return true;
+}
+
+int Scene::takeSnapshot(const std::string &stage)
+{
+    std::unique_ptr<SceneSnapshot> snap(new SceneSnapshot);
+    const SceneSnapshot * prev = (snapcurrent >= 0) ? history[snapcurrent].get() : NULL;
+
+    hostSurface();
+    snap->parent = snapcurrent;
+    snap->stage = stage;
+    snap->rep = rep;
+    snap->voxsidelen = voxsidelen;
+    snap->bytes = vox.takeSnapshot(snap->vox, prev ? &prev->vox : NULL);
+    snap->bytes += voxmesh.takeSnapshot(snap->mesh, prev ? &prev->mesh : NULL);
+    history.push_back(std::move(snap));
+    snapcurrent = (int) history.size() - 1;
+    UTS_LOG(INFO, CSG, "Scene::takeSnapshot: ", stage, " as snapshot ", snapcurrent, " holding ",
+               history.back()->bytes, " new bytes");
+    return snapcurrent;
+}
+
+bool Scene::restoreSnapshot(int index)
+{
+    if(index < 0 || index >= (int) history.size())
+    {
+        cerr << "Error Scene::restoreSnapshot: no snapshot " << index << " in a history of " << history.size() << endl;
+        return false;
+    }
+
+    const SceneSnapshot &snap = * history[index];
+    vox.restoreSnapshot(snap.vox);
+    voxmesh.restoreSnapshot(snap.mesh);
+    rep = snap.rep;
+    voxsidelen = snap.voxsidelen;
+
+    // nothing derived from the previous volume or surface still applies
+    voxtree = NULL;
+    dirtybox.reset();
+    remeshlo = 0;
+    remeshhi = std::numeric_limits<int>::max();
+    voxdistances = false;
+    devsurface = false;
+    devbound = false;
+    snapcurrent = index;
+    resetStages();
+    return true;
+}
+
+bool Scene::undo()
+{
+    if(snapcurrent < 0 || history[snapcurrent]->parent < 0)
+        return false;
+    return restoreSnapshot(history[snapcurrent]->parent);
+}
+
+bool Scene::redo()
+{
+    for(int s = (int) history.size() - 1; s > snapcurrent; s--)
+        if(history[s]->parent == snapcurrent)
+            return restoreSnapshot(s);
+    return false;
+}
+
+void Scene::publish(const std::string &stage)
+{
+    std::shared_ptr<SceneSnapshot> snap = std::make_shared<SceneSnapshot>();
+    std::shared_ptr<const SceneSnapshot> prev = std::atomic_load(&published);
+    const SceneSnapshot * current = (snapcurrent >= 0) ? history[snapcurrent].get() : NULL;
+
+    hostSurface();
+    snap->parent = -1;
+    snap->stage = stage;
+    snap->rep = rep;
+    snap->voxsidelen = voxsidelen;
+    snap->bytes = vox.takeSnapshot(snap->vox, prev ? &prev->vox : NULL, current ? &current->vox : NULL);
+    snap->bytes += voxmesh.takeSnapshot(snap->mesh, prev ? &prev->mesh : NULL, current ? &current->mesh : NULL);
+    UTS_LOG(INFO, CSG, "Scene::publish: ", stage, " holding ", snap->bytes, " new bytes");
+    std::atomic_store(&published, std::shared_ptr<const SceneSnapshot>(std::move(snap)));
+}
+
+size_t Scene::getHistoryBytes()
+{
+    size_t bytes = 0;
+
+    // every chunk is counted by the snapshot that first allocated it
+    for(const auto &snap : history)
+        bytes += snap->bytes;
+    return bytes;
+}
+
+/// An operand gathered from a chain of set operations, along with its bounds
+struct CSGOperand
+{
+    SceneNode * node;
+    cgp::BoundBox bbox;
+};
+
+/**
+ * Remove subtrees that bounds show to be empty or to have no effect
+ * @param node          root of the subtree, which is deleted in whole or part as necessary
+ * @param[out] bbox     bounds of the simplified subtree
+ * @returns simplified subtree, or NULL if it is empty
+ */
+static SceneNode * pruneTree(SceneNode * node, cgp::BoundBox &bbox)
+{
+    OpNode * opnode = opNode(node);
+    SceneNode * left, * right;
+    cgp::BoundBox lbox, rbox, shared;
+
+    if(opnode == NULL)
+    {
+        nodeBounds(node, bbox);
+        return node;
+    }
+
+    left = pruneTree(opnode->left, lbox);
+    right = pruneTree(opnode->right, rbox);
+    if(left != NULL && boxEmpty(lbox)) // a leaf without extent, such as an empty mesh
+    {
+        deleteTree(left);
+        left = NULL;
+    }
+    if(right != NULL && boxEmpty(rbox))
+    {
+        deleteTree(right);
+        right = NULL;
+    }
+    opnode->left = left;
+    opnode->right = right;
+    opBounds(opnode->op, lbox, rbox, bbox);
+
+    switch(opnode->op)
+    {
+        case SetOp::UNION:
+            if(left == NULL || right == NULL) // the union is whichever operand remains
+            {
+                nodeBounds((left != NULL) ? left : right, bbox);
+                opnode->left = opnode->right = NULL;
+                delete opnode;
+                return (left != NULL) ? left : right;
+            }
+            break;
+        case SetOp::INTERSECTION:
+            if(left == NULL || right == NULL || boxEmpty(bbox)) // operands cannot share a voxel
+            {
+                deleteTree(opnode);
+                bbox.reset();
+                return NULL;
+            }
+            break;
+        case SetOp::DIFFERENCE:
+            if(left == NULL) // nothing to subtract from
+            {
+                deleteTree(opnode);
+                bbox.reset();
+                return NULL;
+            }
+            opBounds(SetOp::INTERSECTION, lbox, rbox, shared);
+            if(right == NULL || boxEmpty(shared)) // nothing is subtracted
+            {
+                deleteTree(right);
+                opnode->left = opnode->right = NULL;
+                delete opnode;
+                return left;
+            }
+            break;
+    }
+    opnode->bounds = bbox;
+    return opnode;
+}
+
+static SceneNode * balanceTree(SceneNode * node);
+
+/**
+ * Collect the operands of a chain of the same set operation, balancing each of them in turn
+ * @param node              root of the chain
+ * @param op                set operation of the chain
+ * @param[out] operands     operands of the chain, in order
+ * @param[out] shells       nodes of the chain, which are reused to rebuild it
+ */
+static void gatherChain(SceneNode * node, SetOp op, std::vector<CSGOperand> &operands, std::vector<OpNode *> &shells)
+{
+    OpNode * opnode = opNode(node);
+    CSGOperand operand;
+
+    if(opnode != NULL && opnode->op == op)
+    {
+        shells.push_back(opnode);
+        gatherChain(opnode->left, op, operands, shells);
+        gatherChain(opnode->right, op, operands, shells);
+        return;
+    }
+    operand.node = balanceTree(node);
+    nodeBounds(operand.node, operand.bbox);
+    operands.push_back(operand);
+}
+
+/**
+ * Build a balanced tree over a range of operands of an associative set operation, splitting at the median of
+ * their bounds centres along the axis on which the centres are most spread out
+ * @param op                set operation
+ * @param operands          operands, reordered by the splits
+ * @param start, end        range of operands [start, end) to combine
+ * @param shells            unused nodes, one of which is taken for each set operation
+ * @returns root of the balanced tree
+ */
+static SceneNode * buildBalanced(SetOp op, std::vector<CSGOperand> &operands, int start, int end, std::vector<OpNode *> &shells)
+{
+    cgp::BoundBox centres, lbox, rbox;
+    OpNode * opnode;
+    int axis, mid;
+    float extent[3];
+
+    if(end - start == 1)
+        return operands[start].node;
+
+    for(int i = start; i < end; i++)
+    {
+        const cgp::BoundBox &b = operands[i].bbox;
+        centres.includePnt(cgp::Point(0.5f * (b.min.x + b.max.x), 0.5f * (b.min.y + b.max.y), 0.5f * (b.min.z + b.max.z)));
+    }
+    extent[0] = centres.max.x - centres.min.x; extent[1] = centres.max.y - centres.min.y; extent[2] = centres.max.z - centres.min.z;
+    axis = (extent[0] >= extent[1] && extent[0] >= extent[2]) ? 0 : ((extent[1] >= extent[2]) ? 1 : 2);
+
+    mid = (start + end) / 2;
+    std::nth_element(operands.begin() + start, operands.begin() + mid, operands.begin() + end,
+        [axis](const CSGOperand &a, const CSGOperand &b)
+        {
+            if(axis == 0)
+                return a.bbox.min.x + a.bbox.max.x < b.bbox.min.x + b.bbox.max.x;
+            if(axis == 1)
+                return a.bbox.min.y + a.bbox.max.y < b.bbox.min.y + b.bbox.max.y;
+            return a.bbox.min.z + a.bbox.max.z < b.bbox.min.z + b.bbox.max.z;
+        });
+
+    opnode = shells.back();
+    shells.pop_back();
+    opnode->op = op;
+    opnode->left = buildBalanced(op, operands, start, mid, shells);
+    opnode->right = buildBalanced(op, operands, mid, end, shells);
+    nodeBounds(opnode->left, lbox);
+    nodeBounds(opnode->right, rbox);
+    opBounds(op, lbox, rbox, opnode->bounds);
+    return opnode;
+}
+
+/**
+ * Rebuild chains of unions and intersections as balanced trees, after turning chains of differences
+ * (a - b) - c into a - (b + c)
+ * @param node  root of the subtree, whose nodes are rearranged but neither added nor removed
+ * @returns root of the rebalanced subtree
+ */
+static SceneNode * balanceTree(SceneNode * node)
+{
+    OpNode * opnode = opNode(node), * link;
+    std::vector<CSGOperand> operands;
+    std::vector<OpNode *> shells;
+    cgp::BoundBox lbox, rbox;
+
+    if(opnode == NULL)
+        return node;
+
+    if(opnode->op == SetOp::DIFFERENCE)
+    {
+        // everything subtracted along the left spine is gathered into one union
+        link = opnode;
+        while(true)
+        {
+            gatherChain(link->right, SetOp::UNION, operands, shells);
+            OpNode * next = opNode(link->left);
+            if(next == NULL || next->op != SetOp::DIFFERENCE)
+                break;
+            link = next;
+            shells.push_back(link);
+        }
+        opnode->left = balanceTree(link->left);
+        opnode->right = buildBalanced(SetOp::UNION, operands, 0, (int) operands.size(), shells);
+    }
+    else
+    {
+        gatherChain(opnode, opnode->op, operands, shells);
+        return buildBalanced(opnode->op, operands, 0, (int) operands.size(), shells);
+    }
+    nodeBounds(opnode->left, lbox);
+    nodeBounds(opnode->right, rbox);
+    opBounds(opnode->op, lbox, rbox, opnode->bounds);
+    return opnode;
+}
+
+void Scene::simplifyTree()
+{
+    cgp::BoundBox bbox;
+    int before;
+
+    if(csgroot == NULL)
+        return;
+    before = countLeaves(csgroot);
+    csgroot = pruneTree(csgroot, bbox);
+    if(csgroot != NULL)
+        csgroot = balanceTree(csgroot);
+    if(csgroot == NULL || countLeaves(csgroot) != before)
+        UTS_LOG(INFO, CSG, "Scene::simplifyTree: pruned ", before - ((csgroot != NULL) ? countLeaves(csgroot) : 0), " of ", before, " leaves");
+}
+
+/// Is a node a leaf whose surface is a triangle mesh, held directly or shared?
+static bool meshLike(ShapeNode * leaf)
+{
+    return leaf != NULL && (meshShape(leaf->shape) != NULL || leaf->shape->getKind() == ShapeKind::INSTANCE);
+}
+
+/**
+ * Mesh of a leaf, copying a shared instance into a mesh of its own that replaces it
+ * @param leaf  leaf holding a mesh or an instance
+ * @returns mesh now held by the leaf
+ */
+static Mesh * leafMesh(ShapeNode * leaf)
+{
+    if(leaf->shape->getKind() == ShapeKind::INSTANCE)
+    {
+        Mesh * mesh = new Mesh();
+        static_cast<MeshInstance *>(leaf->shape)->toMesh(mesh);
+        delete leaf->shape;
+        leaf->shape = mesh;
+    }
+    return meshShape(leaf->shape);
+}
+
+/**
+ * Combine the set operations of a subtree whose operands are both meshes
+ * @param node  root of the subtree
+ * @returns combined subtree, which replaces @a node
+ */
+static SceneNode * combineMeshNodes(SceneNode * node)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * left, * right;
+    Mesh * result;
+
+    if(opnode == NULL)
+        return node;
+    opnode->left = combineMeshNodes(opnode->left);
+    opnode->right = combineMeshNodes(opnode->right);
+    left = shapeNode(opnode->left);
+    right = shapeNode(opnode->right);
+    if(!meshLike(left) || !meshLike(right))
+        return node;
+
+    result = new Mesh();
+    if(!result->booleanOf(leafMesh(left), leafMesh(right), (int) opnode->op))
+    {
+        delete result;
+        return node;
+    }
+    delete left->shape; // the left leaf now holds the result
+    left->shape = result;
+    deleteTree(right);
+    opnode->left = opnode->right = NULL;
+    delete opnode;
+    return left;
+}
+
+void Scene::combineMeshes()
+{
+    int before;
+
+    if(csgroot == NULL)
+        return;
+    before = countLeaves(csgroot);
+    csgroot = combineMeshNodes(csgroot);
+    if(countLeaves(csgroot) != before)
+        UTS_LOG(INFO, CSG, "Scene::combineMeshes: combined ", before, " leaves into ", countLeaves(csgroot));
+}
+
+/**
+ * Read several floating point numbers in a row
+ * @param tok       tokenizer positioned at the first number
+ * @param[out] vals parsed values
+ * @param n         how many to read
+ * @retval true if every number was read,
+ * @retval false otherwise
+ */
+static bool readFloats(TextTokenizer &tok, float * vals, int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        tok.skipSpace();
+        if(!tok.readFloat(vals[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Read the optional scale, rotate and translate modifiers of a placed subtree, given in any order and composed in the
+ * order MeshInstance composes them
+ * @param tok       tokenizer positioned after the keyword or name of the placement
+ * @param[out] trm  model to world transform
+ * @retval true if the modifiers were well formed,
+ * @retval false otherwise
+ */
+static bool readPlacement(TextTokenizer &tok, glm::mat4x4 &trm)
+{
+    float v[3], scale = 1.0f, rot[3] = {0.0f, 0.0f, 0.0f}, trx[3] = {0.0f, 0.0f, 0.0f};
+
+    for(;;)
+    {
+        if(tok.matchWord("scale"))
+        {
+            if(!readFloats(tok, v, 1))
+                return false;
+            scale = v[0];
+        }
+        else if(tok.matchWord("rotate"))
+        {
+            if(!readFloats(tok, rot, 3))
+                return false;
+        }
+        else if(tok.matchWord("translate"))
+        {
+            if(!readFloats(tok, trx, 3))
+                return false;
+        }
+        else
+            break;
+    }
+    trm = glm::translate(glm::mat4(1.0f), glm::vec3(trx[0], trx[1], trx[2]));
+    trm = glm::rotate(trm, rot[2] * PI / 180.0f, glm::vec3(0.0f, 0.0f, 1.0f));
+    trm = glm::rotate(trm, rot[1] * PI / 180.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+    trm = glm::rotate(trm, rot[0] * PI / 180.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    trm = glm::scale(trm, glm::vec3(scale));
+    return true;
+}
+
+SceneNode * Scene::parseNode(TextTokenizer &tok, const std::string &dir, const std::string &filename,
+                             std::unordered_map<std::string, std::shared_ptr<const SubtreeAsset>> &defs)
+{
+    const char * word;
+    int len;
+    float v[7];
+    string keyword;
+
+    tok.skipSpace();
+    if(!tok.readWord(word, len))
+    {
+        cerr << "Error Scene::parseNode: " << filename << " ends where a node was expected" << endl;
+        return NULL;
+    }
+    keyword = string(word, len);
+
+    if(keyword == "union" || keyword == "intersection" || keyword == "difference")
+    {
+        OpNode * opnode;
+        SceneNode * left, * right;
+
+        if((left = parseNode(tok, dir, filename, defs)) == NULL)
+            return NULL;
+        if((right = parseNode(tok, dir, filename, defs)) == NULL)
+        {
+            deleteTree(left);
+            return NULL;
+        }
+        opnode = new OpNode();
+        opnode->op = (keyword == "union") ? SetOp::UNION : (keyword == "intersection") ? SetOp::INTERSECTION : SetOp::DIFFERENCE;
+        opnode->left = left;
+        opnode->right = right;
+        return opnode;
+    }
+
+    if(keyword == "define")
+    {
+        SceneNode * body;
+        string name;
+
+        tok.skipSpace();
+        if(!tok.readWord(word, len))
+        {
+            cerr << "Error Scene::parseNode: missing subtree name on line " << tok.getLine() << " of " << filename << endl;
+            return NULL;
+        }
+        name = string(word, len);
+        if((body = parseNode(tok, dir, filename, defs)) == NULL)
+            return NULL;
+        defs[name] = std::make_shared<const SubtreeAsset>(body);
+        return parseNode(tok, dir, filename, defs); // the node the definition is in scope for
+    }
+
+    if(keyword == "place" || keyword == "transform")
+    {
+        std::shared_ptr<const SubtreeAsset> subtree;
+        SubtreeInstance * instance;
+        ShapeNode * placed;
+        glm::mat4x4 trm;
+
+        if(keyword == "place")
+        {
+            tok.skipSpace();
+            if(!tok.readWord(word, len) || defs.count(string(word, len)) == 0)
+            {
+                cerr << "Error Scene::parseNode: place of an undefined subtree on line " << tok.getLine() << " of " << filename << endl;
+                return NULL;
+            }
+            subtree = defs[string(word, len)];
+        }
+        if(!readPlacement(tok, trm))
+        {
+            cerr << "Error Scene::parseNode: malformed " << keyword << " on line " << tok.getLine() << " of " << filename << endl;
+            return NULL;
+        }
+        if(keyword == "transform")
+        {
+            SceneNode * body = parseNode(tok, dir, filename, defs);
+            if(body == NULL)
+                return NULL;
+            subtree = std::make_shared<const SubtreeAsset>(body);
+        }
+        instance = new SubtreeInstance(subtree);
+        if(!instance->setTransform(trm))
+        {
+            cerr << "Error Scene::parseNode: " << keyword << " on line " << tok.getLine() << " of " << filename << " cannot be inverted" << endl;
+            delete instance;
+            return NULL;
+        }
+        placed = new ShapeNode();
+        placed->shape = instance;
+        return placed;
+    }
+
+    ShapeNode * shapenode = new ShapeNode();
+    bool valid = true;
+
+    if(keyword == "sphere" && (valid = readFloats(tok, v, 4)))
+        shapenode->shape = new Sphere(cgp::Point(v[0], v[1], v[2]), v[3]);
+    else if(keyword == "cylinder" && (valid = readFloats(tok, v, 7)))
+        shapenode->shape = new Cylinder(cgp::Point(v[0], v[1], v[2]), cgp::Point(v[3], v[4], v[5]), v[6]);
+    else if(keyword == "square" && (valid = readFloats(tok, v, 4)))
+        shapenode->shape = new Square(cgp::Point(v[0], v[1], v[2]), v[3]);
+    else if(keyword == "mesh")
+    {
+        std::shared_ptr<const MeshAsset> asset;
+        MeshInstance * instance;
+        string path;
+
+        tok.skipSpace();
+        if(!tok.readWord(word, len))
+        {
+            cerr << "Error Scene::parseNode: missing mesh file on line " << tok.getLine() << " of " << filename << endl;
+            delete shapenode;
+            return NULL;
+        }
+        path = string(word, len);
+        if(path[0] != '/' && !dir.empty())
+            path = dir + "/" + path;
+        asset = loadAsset(path);
+        if(!asset)
+        {
+            cerr << "Error Scene::parseNode: unable to load mesh " << path << " named in " << filename << endl;
+            delete shapenode;
+            return NULL;
+        }
+        instance = new MeshInstance(asset);
+        shapenode->shape = instance;
+
+        // every reference to the same file shares its triangles, and the modifiers set only the instance transform
+        while(valid)
+        {
+            if(tok.matchWord("fit") && (valid = readFloats(tok, v, 1)))
+                instance->boxFit(v[0]);
+            else if(tok.matchWord("scale") && (valid = readFloats(tok, v, 1)))
+                instance->setScale(v[0]);
+            else if(tok.matchWord("rotate") && (valid = readFloats(tok, v, 3)))
+                instance->setRotations(v[0] * PI / 180.0f, v[1] * PI / 180.0f, v[2] * PI / 180.0f);
+            else if(tok.matchWord("translate") && (valid = readFloats(tok, v, 3)))
+                instance->setTranslation(cgp::Vector(v[0], v[1], v[2]));
+            else
+                break;
+        }
+    }
+    else if(valid)
+    {
+        cerr << "Error Scene::parseNode: unknown node " << keyword << " on line " << tok.getLine() << " of " << filename << endl;
+        delete shapenode;
+        return NULL;
+    }
+
+    if(!valid)
+    {
+        cerr << "Error Scene::parseNode: malformed " << keyword << " on line " << tok.getLine() << " of " << filename << endl;
+        delete shapenode;
+        return NULL;
+    }
+    return shapenode;
+}
+
+bool Scene::readSceneFile(std::string filename)
+{
+    ifstream infile(filename, ios::binary);
+    ostringstream contents;
+    string text, dir;
+    SceneNode * root;
+    size_t slash;
+    std::unordered_map<std::string, std::shared_ptr<const SubtreeAsset>> defs; // named subtrees, shared by their placements
+
+    if(!infile)
+    {
+        cerr << "Error Scene::readSceneFile: unable to open " << filename << endl;
+        return false;
+    }
+    contents << infile.rdbuf();
+    text = contents.str();
+
+    // blank out comments, keeping the newlines so that line numbers in errors stay correct
+    for(size_t i = 0; i < text.size(); i++)
+        if(text[i] == '#')
+            for(; i < text.size() && text[i] != '\n'; i++)
+                text[i] = ' ';
+
+    slash = filename.find_last_of('/');
+    if(slash != string::npos)
+        dir = filename.substr(0, slash);
+
+    TextTokenizer tok(text.data(), text.size());
+    if((root = parseNode(tok, dir, filename, defs)) == NULL)
+        return false;
+    tok.skipSpace();
+    if(!tok.atEnd())
+    {
+        cerr << "Error Scene::readSceneFile: unexpected text after the tree on line " << tok.getLine() << " of " << filename << endl;
+        deleteTree(root);
+        return false;
+    }
+
+    clear();
+    setRoot(root);
+    rep = SceneRep::TREE;
+    return true;
+}
+
+/**
+ * List the distinct assets placed by the instance leaves of a subtree, in the order they are first met, including
+ * those within placed subtrees
+ * @param node              root of the subtree
+ * @param[in,out] shared    assets found so far
+ * @param[in,out] ids       position of each found asset in @a shared
+ * @param[in,out] visited   placed subtrees already searched, each searched once however often it is placed
+ */
+static void collectAssets(SceneNode * node, std::vector<const MeshAsset *> &shared, std::unordered_map<const MeshAsset *, int> &ids,
+                          std::unordered_set<const SubtreeAsset *> &visited)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * leaf = shapeNode(node);
+
+    if(opnode != NULL)
+    {
+        collectAssets(opnode->left, shared, ids, visited);
+        collectAssets(opnode->right, shared, ids, visited);
+    }
+    else if(leaf != NULL && leaf->shape != NULL && leaf->shape->getKind() == ShapeKind::INSTANCE)
+    {
+        const MeshAsset * asset = static_cast<MeshInstance *>(leaf->shape)->getAsset().get();
+        if(ids.insert(std::make_pair(asset, (int) shared.size())).second)
+            shared.push_back(asset);
+    }
+    else if(leaf != NULL && leaf->shape != NULL && leaf->shape->getKind() == ShapeKind::SUBTREE)
+    {
+        const SubtreeAsset * subtree = static_cast<SubtreeInstance *>(leaf->shape)->getAsset().get();
+        if(visited.insert(subtree).second)
+            collectAssets(subtree->getRoot(), shared, ids, visited);
+    }
+}
+
+/**
+ * Write a subtree in prefix order, each node tagged with its kind, or -1 for an empty subtree, and each leaf with
+ * the kind of its shape. Instances refer to their asset by position in the asset table written before the tree.
+ * Placed subtrees are numbered in the order first met, and the first placement of each is followed by the subtree
+ * itself, so that a subtree placed many times is written once.
+ * @param ar            output archive
+ * @param node          root of the subtree
+ * @param ids           position of each asset in the table
+ * @param[in,out] subtrees  number of each placed subtree written so far
+ */
+static void saveTree(boost::archive::binary_oarchive &ar, SceneNode * node, const std::unordered_map<const MeshAsset *, int> &ids,
+                     std::unordered_map<const SubtreeAsset *, int> &subtrees)
+{
+    OpNode * opnode = opNode(node);
+    ShapeNode * leaf = shapeNode(node);
+    int32_t tag = (node != NULL) ? (int32_t) node->kind : -1, kind, op;
+
+    ar << tag;
+    if(opnode != NULL)
+    {
+        op = (int32_t) opnode->op;
+        ar << op;
+        saveTree(ar, opnode->left, ids, subtrees);
+        saveTree(ar, opnode->right, ids, subtrees);
+    }
+    else if(leaf != NULL)
+    {
+        kind = (leaf->shape != NULL) ? (int32_t) leaf->shape->getKind() : -1;
+        ar << kind;
+        if(leaf->shape == NULL)
+            return;
+        switch(leaf->shape->getKind())
+        {
+            case ShapeKind::SPHERE:
+                ar << * static_cast<const Sphere *>(leaf->shape);
+                break;
+            case ShapeKind::CYLINDER:
+                ar << * static_cast<const Cylinder *>(leaf->shape);
+                break;
+            case ShapeKind::SQUARE:
+                ar << * static_cast<const Square *>(leaf->shape);
+                break;
+            case ShapeKind::MESH:
+                ar << * static_cast<const Mesh *>(leaf->shape);
+                break;
+            case ShapeKind::INSTANCE:
+            {
+                const MeshInstance * inst = static_cast<const MeshInstance *>(leaf->shape);
+                int32_t id = ids.at(inst->getAsset().get());
+                ar << id << * inst;
+                break;
+            }
+            case ShapeKind::SUBTREE:
+            {
+                const SubtreeInstance * inst = static_cast<const SubtreeInstance *>(leaf->shape);
+                auto found = subtrees.insert(std::make_pair(inst->getAsset().get(), (int) subtrees.size()));
+                int32_t id = found.first->second;
+
+                ar << boost::serialization::make_array(&inst->getTransform()[0][0], 16) << id;
+                if(found.second) // first placement
+                    saveTree(ar, inst->getAsset()->getRoot(), ids, subtrees);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Read a subtree written by saveTree
+ * @param ar        input archive
+ * @param shared    asset table read before the tree
+ * @param[in,out] subtrees  placed subtrees read so far, by number
+ * @returns root of the new subtree, or NULL if it is empty
+ * @throws boost::archive::archive_exception if the archive is damaged, with nothing of the subtree left allocated
+ */
+static SceneNode * loadTree(boost::archive::binary_iarchive &ar, const std::vector<std::shared_ptr<const MeshAsset>> &shared,
+                            std::vector<std::shared_ptr<const SubtreeAsset>> &subtrees)
+{
+    int32_t tag, kind, op, id;
+
+    ar >> tag;
+    if(tag < 0)
+        return NULL;
+    if(tag == (int32_t) NodeKind::OP)
+    {
+        OpNode * opnode = new OpNode();
+        try
+        {
+            ar >> op;
+            if(op < 0 || op > (int32_t) SetOp::DIFFERENCE)
+                throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+            opnode->op = (SetOp) op;
+            opnode->left = loadTree(ar, shared, subtrees);
+            opnode->right = loadTree(ar, shared, subtrees);
+        }
+        catch(...)
+        {
+            deleteTree(opnode);
+            throw;
+        }
+        return opnode;
+    }
+    if(tag != (int32_t) NodeKind::SHAPE)
+        throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+
+    ShapeNode * leaf = new ShapeNode();
+    try
+    {
+        ar >> kind;
+        switch(kind)
+        {
+            case -1:
+                break;
+            case (int32_t) ShapeKind::SPHERE:
+                leaf->shape = new Sphere();
+                ar >> * static_cast<Sphere *>(leaf->shape);
+                break;
+            case (int32_t) ShapeKind::CYLINDER:
+                leaf->shape = new Cylinder();
+                ar >> * static_cast<Cylinder *>(leaf->shape);
+                break;
+            case (int32_t) ShapeKind::SQUARE:
+                leaf->shape = new Square();
+                ar >> * static_cast<Square *>(leaf->shape);
+                break;
+            case (int32_t) ShapeKind::MESH:
+                leaf->shape = new Mesh();
+                ar >> * static_cast<Mesh *>(leaf->shape);
+                break;
+            case (int32_t) ShapeKind::INSTANCE:
+                ar >> id;
+                if(id < 0 || id >= (int32_t) shared.size())
+                    throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+                leaf->shape = new MeshInstance(shared[id]);
+                ar >> * static_cast<MeshInstance *>(leaf->shape);
+                break;
+            case (int32_t) ShapeKind::SUBTREE:
+            {
+                glm::mat4x4 trm;
+
+                ar >> boost::serialization::make_array(&trm[0][0], 16) >> id;
+                if(id == (int32_t) subtrees.size()) // first placement, followed by the subtree
+                {
+                    subtrees.emplace_back(); // numbered before the placements nested within it
+                    subtrees[id] = std::make_shared<const SubtreeAsset>(loadTree(ar, shared, subtrees));
+                }
+                if(id < 0 || id >= (int32_t) subtrees.size() || !subtrees[id])
+                    throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+                leaf->shape = new SubtreeInstance(subtrees[id]);
+                if(!static_cast<SubtreeInstance *>(leaf->shape)->setTransform(trm))
+                    throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+                break;
+            }
+            default:
+                throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+        }
+    }
+    catch(...)
+    {
+        delete leaf;
+        throw;
+    }
+    return leaf;
+}
+
+bool Scene::writeSession(std::ostream &out)
 {
-    int xdim, ydim, zdim;
-
-    /// calculate voxel volume dimensions based on voxlen
-    xdim = ceil(voldiag.i / voxlen)+2; // needs a 1 voxel border to ensure a closed mesh
-    ydim = ceil(voldiag.j / voxlen)+2;
-    zdim = ceil(voldiag.k / voxlen)+2;
-
-    voxsidelen = voxlen;
-    vox.setDim(xdim, ydim, zdim);
-
-    /// account for expansion in x-dimension by adjusting origin and diagonal
-    vox.getDim(xdim, ydim, zdim);
-    cgp::Vector voxdiag = cgp::Vector((float) xdim * voxlen, (float) ydim * voxlen, (float) zdim * voxlen);
-    cgp::Point voxorigin = cgp::Point(-0.5f*voxdiag.i, -0.5f*voxdiag.j, -0.5f*voxdiag.k);
-    vox.setFrame(voxorigin, voxdiag);
-
-    /// map dimensions to closest power of 2
-
-   cerr << "Voxel volume dimensions = " << xdim << " x " << ydim << " x " << zdim << endl;
+    std::vector<const MeshAsset *> shared;
+    std::unordered_map<const MeshAsset *, int> ids;
+    std::unordered_set<const SubtreeAsset *> visited;
+    std::unordered_map<const SubtreeAsset *, int> subtrees;
+    int32_t representation = (int32_t) rep, version = sessionversion;
+    uint64_t numassets;
+
+    hostSurface();
+    collectAssets(csgroot, shared, ids, visited);
+    numassets = shared.size();
+    try
+    {
+        boost::archive::binary_oarchive ar(out);
+
+        ar << boost::serialization::make_array(sessionmagic, 4) << version;
+        ar << voldiag << voxsidelen << representation;
+        ar << scanmesh << greedyblocks << streamcsg << simplifycsg << sharesubtrees << meshbools << adaptivevox;
+        ar << distfield << keeplargest << fillvoids << dualsurface;
+        ar << smoothpairs << smoothshrink << smoothband;
+        ar << numassets;
+        for(const MeshAsset * asset : shared)
+        {
+            uts::saveArray(ar, asset->getVerts());
+            uts::saveArray(ar, asset->getNorms());
+            uts::saveArray(ar, asset->getFaces());
+        }
+        saveTree(ar, csgroot, ids, subtrees);
+        ar << static_cast<const VoxelVolume &>(vox) << static_cast<const Mesh &>(voxmesh);
+    }
+    catch(std::exception &e)
+    {
+        cerr << "Error Scene::writeSession: " << e.what() << endl;
+        return false;
+    }
+    out.flush();
+    if(!out)
+    {
+        cerr << "Error Scene::writeSession: the stream could not be written" << endl;
+        return false;
+    }
+    return true;
+}
 
-   percentDone = 0;
-    // actual recursive depth-first walk of csg tree
-    if(csgroot != NULL)
-        voxWalk(csgroot, &vox);
+bool Scene::writeSession(const std::string &filename)
+{
+    ofstream outfile(filename, ios::binary);
 
-    rep = SceneRep::VOXELS;
+    if(!outfile)
+    {
+        cerr << "Error Scene::writeSession: unable to open " << filename << endl;
+        return false;
+    }
+    return writeSession(outfile);
 }
 
-void Scene::isoextract()
+bool Scene::writeVDB(const std::string &filename)
 {
-    voxmesh.marchingCubes(&vox);
-    rep = SceneRep::ISOSURFACE;
+    if(voxdistances)
+        return sdf.writeVDB(filename);
+    return vox.writeVDB(filename);
 }
 
-void Scene::smooth()
+bool Scene::readSession(std::istream &in)
 {
-    voxmesh.laplacianSmooth(6, 1.0f);
+    std::vector<std::shared_ptr<const MeshAsset>> shared;
+    std::vector<std::shared_ptr<const SubtreeAsset>> subtrees;
+    int32_t representation, version;
+    uint64_t numassets;
+    char magic[4];
+    bool replacing = false;
+
+    try
+    {
+        boost::archive::binary_iarchive ar(in);
+
+        ar >> boost::serialization::make_array(magic, 4) >> version;
+        if(memcmp(magic, sessionmagic, 4) != 0 || version != sessionversion)
+        {
+            cerr << "Error Scene::readSession: the stream does not hold a version " << sessionversion << " session" << endl;
+            return false;
+        }
+
+        replacing = true;
+        clear();
+        clearHistory();
+        ar >> voldiag >> voxsidelen >> representation;
+        ar >> scanmesh >> greedyblocks >> streamcsg >> simplifycsg >> sharesubtrees >> meshbools >> adaptivevox;
+        ar >> distfield >> keeplargest >> fillvoids >> dualsurface;
+        ar >> smoothpairs >> smoothshrink >> smoothband;
+        ar >> numassets;
+        for(uint64_t a = 0; a < numassets; a++)
+        {
+            std::vector<cgp::Point> verts;
+            std::vector<cgp::Vector> norms;
+            std::vector<int> faces;
+
+            uts::loadArray(ar, verts);
+            uts::loadArray(ar, norms);
+            uts::loadArray(ar, faces);
+            shared.push_back(std::make_shared<const MeshAsset>(std::move(verts), std::move(norms), std::move(faces)));
+        }
+        setRoot(loadTree(ar, shared, subtrees));
+        ar >> vox >> voxmesh;
+        if(representation < 0 || representation > (int32_t) SceneRep::ISOSURFACE)
+            throw boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error);
+    }
+    catch(std::exception &e)
+    {
+        cerr << "Error Scene::readSession: " << e.what() << endl;
+        if(replacing)
+        {
+            clear();
+            voxmesh.clear();
+            rep = SceneRep::TREE;
+        }
+        return false;
+    }
+
+    // the volume and isosurface are complete, but nothing derived from them is
+    rep = (SceneRep) representation;
+    resetStages();
+    remeshlo = 0;
+    remeshhi = std::numeric_limits<int>::max();
+    voxdistances = false;
+    devsurface = false;
+    devbound = false;
+    return true;
 }
 
-void Scene::deform(ffd * def)
+bool Scene::readSession(const std::string &filename)
 {
-    voxmesh.applyFFD(def);
+    ifstream infile(filename, ios::binary);
+
+    if(!infile)
+    {
+        cerr << "Error Scene::readSession: unable to open " << filename << endl;
+        return false;
+    }
+    return readSession(infile);
 }
 
 void Scene::sampleScene()
@@ -409,7 +4099,7 @@ void Scene::sampleScene()
     diff->left = combine;
     diff->right = cyl2;
 
-    csgroot = diff;
+    setRoot(diff);
 }
 
 void Scene::intersectScene()
@@ -425,27 +4115,39 @@ void Scene::intersectScene()
     combine->left = sph;
     combine->right = cyl1;
 
-    csgroot = combine;
+    setRoot(combine);
 }
 
-void Scene::loadSTLScene(string filename)
+bool Scene::loadSTLScene(string filename)
 {
-    ShapeNode * mesh = new ShapeNode();
     Mesh * object = new Mesh();
-    object->readSTL(filename);
-    object->boxFit(30.0f);
+    bool loaded = prepareSTL(object, filename);
+    setMeshScene(object);
+    return loaded;
+}
+
+bool Scene::prepareSTL(Mesh * mesh, string filename)
+{
+    bool loaded = loadMesh(mesh, filename);
+    mesh->boxFit(30.0f);
+    return loaded;
+}
+
+void Scene::setMeshScene(Mesh * object)
+{
+    ShapeNode * mesh = new ShapeNode();
     mesh->shape = object;
-    csgroot = mesh;
+    setRoot(mesh);
 }
 
 void Scene::sphereScene()
 {
     ShapeNode * mesh = new ShapeNode();
     Mesh * spheremesh = new Mesh();
-    spheremesh->readSTL("meshes/triangle/sphere.stl");
+    loadMesh(spheremesh, "meshes/triangle/sphere.stl");
     spheremesh->boxFit(10.0f);
     mesh->shape = spheremesh;
-    csgroot = mesh;
+    setRoot(mesh);
 }
 
 void Scene::expensiveScene(string filename)
@@ -458,7 +4160,7 @@ void Scene::expensiveScene(string filename)
 
     ShapeNode * mesh = new ShapeNode();
     Mesh * loadedModel = new Mesh();
-    loadedModel->readSTL(filename);
+    loadMesh(loadedModel, filename);
     loadedModel->boxFit(10.0f);
     mesh->shape = loadedModel;
 
@@ -472,572 +4174,118 @@ void Scene::expensiveScene(string filename)
      diff->left = combine;
      diff->right = sph;
      */
-    csgroot = mesh;
+    setRoot(mesh);
     rep = SceneRep::TREE;
 }
 
-void Scene::readGridVV(std::string filename, int len)
+bool Scene::readGridVV(std::string filename)
 {
     ifstream infile;
-    infile.open(filename, ios::in);
+    vector<string> lines;
     string line;
+    int nx, ny, nz, x, y, z;
+    size_t pos;
+
+    voxtree = NULL; // vox is replaced wholesale
+    if(VoxelVolume::isVoxelFile(filename)) // binary format carries its own dimensions and frame
+        return vox.readVoxels(filename);
+    if(VoxelVolume::isVDBFile(filename))
+        return vox.readVDB(filename);
+
+    // otherwise import the text grid format: one line per slice, comma separated rows, one digit per voxel
+    infile.open(filename, ios::in);
+    if(!infile.is_open())
+    {
+        cerr << "Error Scene::readGridVV: unable to open " << filename << endl;
+        return false;
+    }
+    while(getline(infile, line))
+        if(!line.empty())
+            lines.push_back(line);
+    infile.close();
+    if(lines.empty())
+    {
+        cerr << "Error Scene::readGridVV: " << filename << " is empty" << endl;
+        return false;
+    }
+
+    // grid dimensions are implied by the first slice
+    nz = (int) lines.size();
+    nx = (int) lines[0].find(',');
+    if(nx == (int) string::npos)
+        nx = (int) lines[0].size();
+    ny = (int) count(lines[0].begin(), lines[0].end(), ',') + 1;
+
+    // the text format stores slices along the volume x axis
     vox.clear();
-    vox.setDim(len, len, len);
-    for (int z = 0; z < len; z++) {
-        getline(infile, line);
-        for (int y = 0; y < len; y++) {
-            vector<string> yValues;
-            for (int x = 0; x < len; x++) {
-                if (stoi(line.substr(x, 1)) == 1)
+    vox.setDim(nz, ny, nx);
+    for (z = 0; z < nz; z++) {
+        pos = 0;
+        for (y = 0; y < ny; y++) {
+            for (x = 0; x < nx && pos + x < lines[z].size(); x++)
+                if (lines[z][pos+x] == '1')
                     vox.set(z,y,x, true);
-                else
-                    vox.set(z,y,x, false);
-            }
-            if (y < (len-1))
-                line = line.substr(line.find(",")+1);
+            pos += nx + 1; // skip row and separating comma
         }
     }
-
-    infile.close();
+    return true;
 }
 
 void Scene::displayVoxelScene(string filename)
 {
     /// load grid
-    readGridVV(filename, 32);
-
-    /// load cube mesh
-    ShapeNode * mesh = new ShapeNode();
-    Mesh * loadedModel = new Mesh();
-    loadedModel->readSTL("meshes/triangle/cube5mm.stl");
-    loadedModel->boxFit(2.0f);
-
-    OpNode * combine = new OpNode();
-    combine->op = SetOp::UNION;
-
-    vector<Mesh*> loadedModels;
-    vector<OpNode*> shapeList;
-    vector<ShapeNode*> shapeNodes;
-
-    float offset = 2.0f;
-    cgp::Vector pos(-32.0f, -32.0f, -32.0f);
-    int entryCount = 0, length = 32;
-
-    /// go through voxel grid and render a cube for each voxel value == 1
-    for (int z = 0; z < length; ++z) {
-        pos = cgp::Vector(pos.i, pos.j, pos.k + offset); // update z position
-        for (int y = 0; y < length; ++y) {
-            pos = cgp::Vector(pos.i, pos.j + offset, pos.k); // update y position
-            for (int x = 0; x < length; ++x) {
-                pos = cgp::Vector(pos.i + offset, pos.j, pos.k); // update x position
-                if (vox.get(z, y, x) == 1) { // voxel found, so render cube based on pos
-                    loadedModels.push_back(new Mesh());
-                    *loadedModels[entryCount] = *loadedModel; // copy cube mesh
-                    loadedModels[entryCount]->setTranslation(pos); // place cube at new pos
-                    shapeNodes.push_back(new ShapeNode());
-                    shapeNodes[entryCount]->shape = loadedModels[entryCount];
-
-                    if (entryCount == 0) {
-                        loadedModel->setTranslation(cgp::Vector(pos.i, pos.j, pos.k));
-                        mesh->shape = loadedModel;
-                        combine->left = mesh;
-                        combine->right = mesh;
-                        shapeList.push_back(combine);
-                    } else {
-                        shapeList.push_back(new OpNode());
-                        shapeList[entryCount]->op = SetOp::UNION;
-                        shapeList[entryCount]->left = shapeList[entryCount-1];
-                        shapeList[entryCount]->right = shapeNodes[entryCount];
-                    }
-                    entryCount++;
-                }
-            }
-            pos = cgp::Vector(-34.0f, pos.j, pos.k); /// reset x position
-        }
-        pos = cgp::Vector(pos.i + offset, -32.0f, pos.k); /// reset y position
-    }
+    readGridVV(filename);
 
-    csgroot = shapeList[shapeList.size()-1];
+    /// render a cube for each voxel value == 1. A union of one cube mesh per voxel has the same occupancy, but
+    /// needs a mesh and two nodes per voxel, so the exposed faces of the blocks are meshed instead
+    meshBlocks();
     rep = SceneRep::TREE;
 }
 
-void Scene::voxelScene(string filename)
+void Scene::voxelScene()
 {
-    /// load grid
-    readGridVV(filename, 32);
-
-    /// global voxel rep object
-    VoxelRep * voxelRep = new VoxelRep ();
-
-    /// test merge mesh
-    ShapeNode * finalMesh = new ShapeNode();
-    Mesh * testLoadedModel = new Mesh();
-    testLoadedModel->readSTL("meshes/triangle/10mm_test_cube.stl");
-    Mesh * testLoadedModel2 = new Mesh();
-    testLoadedModel2->readSTL("meshes/triangle/10mm_test_cube.stl");
-    Mesh * testLoadedModel3 = new Mesh();
-    testLoadedModel3->readSTL("meshes/triangle/10mm_test_cube.stl");
-    Mesh * testLoadedModel4 = new Mesh();
-    testLoadedModel4->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-    /// translate vertices (2nd cube)
-    vector<cgp::Point> * vts = testLoadedModel2->getVerts();
-    cgp::Point pointToAdd = cgp::Point(20.0f, 0.0f, 0.0f);
-    for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-        (*i).add(pointToAdd);
-    }
-
-    /// translate vertices (3rd cube)
-    vts = testLoadedModel3->getVerts();
-    pointToAdd = cgp::Point(0.0f, 0.0f, 20.0f);
-    for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-        (*i).add(pointToAdd);
-    }
-
-    /// translate vertices (4th cube)
-    vts = testLoadedModel4->getVerts();
-    pointToAdd = cgp::Point(0.0f, 20.0f, 0.0f);
-    for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-        (*i).add(pointToAdd);
-    }
-
-    /// re-index triangles (2nd cube)
-    vector<Triangle> * trs = testLoadedModel2->getCubeTriangles();
-    for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-        (*i).v[0] += 8;
-        (*i).v[1] += 8;
-        (*i).v[2] += 8;
-    }
-
-    /// re-index triangles (3rd cube)
-    vector<Triangle> * trs3 = testLoadedModel3->getCubeTriangles();
-    for (std::vector<Triangle>::iterator i = trs3->begin() ; i != trs3->end(); ++i) {
-        (*i).v[0] += 16;
-        (*i).v[1] += 16;
-        (*i).v[2] += 16;
-    }
-
-    /// re-index triangles (4th cube)
-    vector<Triangle> * trs4 = testLoadedModel4->getCubeTriangles();
-    for (std::vector<Triangle>::iterator i = trs4->begin() ; i != trs4->end(); ++i) {
-        (*i).v[0] += 24;
-        (*i).v[1] += 24;
-        (*i).v[2] += 24;
-    }
-
-//    cerr << "testLoade/*dModel triangles: " << testLoadedModel->getCubeTriangles()->size() << endl;
-//    vector<Triangle> * triangles = testLoadedModel->getCubeTriangles();
-//    for (vector<Triangle>::iterator i = triangles->begin(); i != triangles->end(); ++i)
-//        i->printVec();
-
-//    scerr << "testLoadedModel verts: " << testLoadedModel->getVerts()->size() << endl;
-//    vector<cgp::Point> * vertices = testLoadedModel->getVerts();
-//    for (vector<cgp::Point>::iterator i = vertices->begin(); i != vertices->end(); ++i)
-//        cerr << i->printPoint() << endl;
-//    cerr << endl;
-
-    voxelRep->add(0, {0, 0, 0});
-    voxelRep->add(0, {2, 0, 0});
-    voxelRep->add(0, {0, 0, 2});
-    voxelRep->add(0, {0, 2, 0});
-
-    ///    merge cube 0 and 1
-    testLoadedModel->mergeMesh(testLoadedModel2);
-
-    /// delete cube 0 triangles
-    cerr << "deleting cube 0 triangles" << endl;
-    vector<Triangle> * tris = testLoadedModel->getCubeTriangles();
-    cerr << "start pos = " << voxelRep->getStartPos(0) + voxelRep->getSideCode("R", {0, 0, 0}) << endl;
-    tris->erase(tris->begin() + voxelRep->getStartPos(0) + voxelRep->getSideCode("R", {0, 0, 0}), tris->begin() + voxelRep->getStartPos(0) + voxelRep->getSideCode("R", {0, 0, 0}) + 2);
-    voxelRep->addRemovedFaceCode(0, {0, 0, 0});
-    cerr << "updating cube 0" << endl;
-    voxelRep->update(2, {0, 0, 0});
-    cerr << "done" << endl;
-
-    /// delete cube 1 triangles
-    cerr << "deleting cube 1 triangles" << endl;
-    tris->erase(tris->begin() + voxelRep->getStartPos(1) + voxelRep->getSideCode("L", {2, 0, 0}), tris->begin() + voxelRep->getStartPos(1) + voxelRep->getSideCode("L", {2, 0, 0}) + 2);
-    voxelRep->addRemovedFaceCode(1, {2, 0, 0});
-    cerr << "updating cube 1" << endl;
-    voxelRep->update(2, {2, 0, 0});
-    cerr << "done" << endl;
-
-    ///    merge cube 0 and 2
-    testLoadedModel->mergeMesh(testLoadedModel3);
-
-    /// delete cube 0 triangles
-    cerr << "deleting cube 0 triangles" << endl;
-    cerr << "start pos = " << voxelRep->getStartPos(0) + voxelRep->getSideCode("F", {0, 0, 0}) << endl;
-    tris->erase(tris->begin() + voxelRep->getStartPos(0) + voxelRep->getSideCode("F", {0, 0, 0}), tris->begin() + voxelRep->getStartPos(0) + voxelRep->getSideCode("F", {0, 0, 0}) + 2);
-    voxelRep->addRemovedFaceCode(0, {0, 0, 0});
-    cerr << "updating cube 0" << endl;
-    voxelRep->update(2, {0, 0, 0});
-    cerr << "done" << endl;
-
-    /// delete cube 2 triangles
-    cerr << "deleting cube 2 triangles" << endl;
-    cerr << "start pos = " << voxelRep->getStartPos(2) + voxelRep->getSideCode("Bk", {0, 0, 2}) << endl;
-    tris->erase(tris->begin() + voxelRep->getStartPos(2) + voxelRep->getSideCode("Bk", {0, 0, 2}), tris->begin() + voxelRep->getStartPos(2) + voxelRep->getSideCode("Bk", {0, 0, 2}) + 2);
-    voxelRep->addRemovedFaceCode(2, {0, 0, 2});
-    cerr << "updating cube 2" << endl;
-    voxelRep->update(2, {0, 0, 2});
-    cerr << "done" << endl;
-
-    ///    merge cube 0 and 3
-    testLoadedModel->mergeMesh(testLoadedModel4, true);
-
-    /// delete cube 0 triangles
-    cerr << "deleting cube 0 triangles" << endl;
-    cerr << "start pos = " << voxelRep->getStartPos(0) + voxelRep->getSideCode("T", {0, 0, 0}) << endl;
-    tris->erase(tris->begin() + voxelRep->getStartPos(0) + voxelRep->getSideCode("T", {0, 0, 0}), tris->begin() + voxelRep->getStartPos(0) + voxelRep->getSideCode("T", {0, 0, 0}) + 2);
-    voxelRep->addRemovedFaceCode(0, {0, 0, 0});
-    cerr << "updating cube 0" << endl;
-    voxelRep->update(2, {0, 0, 0});
-    cerr << "done" << endl;
-
-    /// delete cube 3 triangles
-    cerr << "deleting cube 3 triangles" << endl;
-    cerr << "start pos = " << voxelRep->getStartPos(3) + voxelRep->getSideCode("Bm", {0, 2, 0}) << endl;
-    tris->erase(tris->begin() + voxelRep->getStartPos(3) + voxelRep->getSideCode("Bm", {0, 2, 0}), tris->begin() + voxelRep->getStartPos(3) + voxelRep->getSideCode("Bm", {0, 2, 0}) + 2);
-    voxelRep->addRemovedFaceCode(3, {0, 2, 0});
-    cerr << "updating cube 3" << endl;
-    voxelRep->update(2, {0, 2, 0});
-    cerr << "done" << endl;
-
-    testLoadedModel->boxFit(10.0f);
-    finalMesh->shape = testLoadedModel;
-
-    csgroot = finalMesh;
+    /// four separate cubes, three of which lie a cube's width from the first along x, z and y
+    vox.setDim(3, 3, 3);
+    vox.set(0, 0, 0, true);
+    vox.set(2, 0, 0, true);
+    vox.set(0, 0, 2, true);
+    vox.set(0, 2, 0, true);
+
+    meshBlocks();
     rep = SceneRep::TREE;
 }
 
 void Scene::newTestScene(string filename)
 {
     /// load grid
-    readGridVV(filename, 32);
-
-    /// global voxel rep object
-    VoxelRep * voxelRep = new VoxelRep ();
-
-    /// test merge mesh
-    ShapeNode * finalMesh = new ShapeNode();
-    Mesh * accCube = new Mesh();
-    accCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-    int entryCount = 0, length = 32;
-    cgp::Point pointToAdd = cgp::Point(0.0f, 0.0f, 0.0f);
-
-    /// go through voxel grid and render a cube for each voxel value == 1
-    for (int z = 0; z < length; ++z) {
-        for (int y = 0; y < length; ++y) {
-            for (int x = 0; x < length; ++x) {
-                if (vox.get(x, y, z) == 1) { /// voxel found, so render cube
-
-                    voxelRep->add(0, {x, y, z});
-                    pointToAdd = cgp::Point(x*10, y*10, z*10);
-                    if (entryCount == 0) {
-                        /// translate vertices
-                        vector<cgp::Point> * vts = accCube->getVerts();
-
-                        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                            (*i).add(pointToAdd);
-                        }
-                    } else {
-                        Mesh * newCube = new Mesh();
-                        newCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-                        /// translate vertices of new cube
-                        vector<cgp::Point> * vts = newCube->getVerts();
-
-                        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                            (*i).add(pointToAdd);
-                        }
-
-                        /// change triangle indices in new cube
-                        vector<Triangle> * trs = newCube->getCubeTriangles();
-                        int sizeToAdd = accCube->getNumVerts();
-                        Triangle vecToAdd;
-                        for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-                            (*i).v[0] += sizeToAdd;
-                            (*i).v[1] += sizeToAdd;
-                            (*i).v[2] += sizeToAdd;
-                        }
-
-                        /// merge new cube to accCube
-                        accCube->mergeMesh(newCube);
-
-
-                        ///< delete surrounding cubes' triangles
-
-                        vector<Triangle> * tris = accCube->getCubeTriangles();
-                        int eCount;
-
-                        /// left
-                        if (x != 0  && (vox.get(x-1, y, z) == 1))
-                        {
-                            /// existing cube
-                            eCount = voxelRep->getEntryCount({x-1, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "R");
-                            voxelRep->update(2, {x-1, y, z});
-
-                            /// newly added cube
-                            eCount = voxelRep->getEntryCount({x, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "L");
-                            voxelRep->update(2, {x, y, z});
-                        }
-
-                        /// back
-                        if (z != 0  && (vox.get(x, y, z-1) == 1))
-                        {
-                            /// existing cube
-                            eCount = voxelRep->getEntryCount({x, y, z-1});
-                            cerr << "x, y, z-1 : " << x << ", " << y << ", " << z-1 << endl;
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "F");
-                            voxelRep->update(2, {x, y, z-1});
-
-                            /// newly added cube
-                            eCount = voxelRep->getEntryCount({x, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "Bk");
-                            voxelRep->update(2, {x, y, z});
-                        }
-
-
-                        /// bottom
-                        if (y != 0 && (vox.get(x, y-1, z) == 1))
-                        {
-                            /// existing cube
-                            eCount = voxelRep->getEntryCount({x, y-1, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "T");
-                            voxelRep->update(2, {x, y-1, z});
-
-                            /// newly added cube
-                            eCount = voxelRep->getEntryCount({x, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "Bm");
-                            voxelRep->update(2, {x, y, z});
-                        }
-                    }
-                    entryCount++;
-                }
-            }
-        }
-    }
+    readGridVV(filename);
 
-    accCube->mergeAllVerts();
-
-    for (vector<Triangle>::iterator triangle = accCube->getCubeTriangles()->begin(); triangle != accCube->getCubeTriangles()->end(); ++triangle)
-    {
-        triangle->printVec();
-    }
-
-    accCube->boxFit(10.0f);
-    finalMesh->shape = accCube;
-
-    csgroot = finalMesh;
+    /// render a cube for each voxel value == 1, keeping only the faces that are not shared
+    meshBlocks();
     rep = SceneRep::TREE;
 }
 
 void Scene::anotherVoxelScene(string filename)
 {
-    /// load grid
-    readGridVV(filename, 32);
-
-    /// global voxel rep object
-    VoxelRep * voxelRep = new VoxelRep ();
-
-    /// test merge mesh
-    ShapeNode * finalMesh = new ShapeNode();
-    Mesh * accCube = new Mesh();
-    accCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-    int entryCount = 0, length = 5;
-    cgp::Point pointToAdd = cgp::Point(0.0f, 0.0f, 0.0f);
-
-    /// go through voxel grid and render a cube for each voxel value == 1
-    for (int z = 0; z < length; ++z) {
-        for (int y = 0; y < length; ++y) {
-            for (int x = 0; x < length; ++x) {
-                if (/*vox.get(z, y,x) == 1 x%2==0 && y%2==08*/ true ) { // voxel found, so render cube
-
-                    voxelRep->add(0, {x, y, z});
-                    pointToAdd = cgp::Point(x*10, y*10, z*10);
-                    if (entryCount == 0) {
-                        /// translate vertices
-                        vector<cgp::Point> * vts = accCube->getVerts();
-
-                        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                            (*i).add(pointToAdd);
-                        }
-                    } else {
-                        Mesh * newCube = new Mesh();
-                        newCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-                        /// translate vertices of new cube
-                        vector<cgp::Point> * vts = newCube->getVerts();
-
-                        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                            (*i).add(pointToAdd);
-                        }
+    int length = 5;
 
-                        /// change triangle indices in new cube
-                        vector<Triangle> * trs = newCube->getCubeTriangles();
-                        int sizeToAdd = accCube->getNumVerts();
-                        Triangle vecToAdd;
-                        for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-                            (*i).v[0] += sizeToAdd;
-                            (*i).v[1] += sizeToAdd;
-                            (*i).v[2] += sizeToAdd;
-                        }
-
-                        /// merge new cube to accCube
-                        accCube->mergeMesh(newCube);
-                    }
-                    entryCount++;
-                }
-            }
-        }
-    }
-
-    accCube->mergeAllVerts();
-    accCube->boxFit(10.0f);
-    finalMesh->shape = accCube;
+    /// solid block of cubes
+    vox.setDim(length, length, length);
+    for (int z = 0; z < length; ++z)
+        for (int y = 0; y < length; ++y)
+            vox.setSpan(0, length, y, z, true);
 
-    csgroot = finalMesh;
+    meshBlocks();
     rep = SceneRep::TREE;
 }
 
 void Scene::voxelMeshScene(string filename)
 {
     /// load grid
-    readGridVV(filename, 32);
-
-    /// global voxel rep object
-    VoxelRep * voxelRep = new VoxelRep ();
-
-    /// test merge mesh
-
-    accCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-    int entryCount = 0, length = 32;
-    cgp::Point pointToAdd = cgp::Point(0.0f, 0.0f, 0.0f);
-
-    /// go through voxel grid and render a cube for each voxel value == 1
-    for (int z = 0; z < length; ++z) {
-        for (int y = 0; y < length; ++y) {
-            for (int x = 0; x < length; ++x) {
-                if (vox.get(x, y, z) == 1) { /// voxel found, so render cube
-
-                    voxelRep->add(0, {x, y, z});
-                    pointToAdd = cgp::Point(x*10, y*10, z*10);
-                    if (entryCount == 0) {
-                        /// translate vertices
-                        vector<cgp::Point> * vts = accCube->getVerts();
-
-                        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                            (*i).add(pointToAdd);
-                        }
-                    } else {
-                        Mesh * newCube = new Mesh();
-                        newCube->readSTL("meshes/triangle/10mm_test_cube.stl");
+    readGridVV(filename);
 
-                        /// translate vertices of new cube
-                        vector<cgp::Point> * vts = newCube->getVerts();
-
-                        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                            (*i).add(pointToAdd);
-                        }
-
-                        /// change triangle indices in new cube
-                        vector<Triangle> * trs = newCube->getCubeTriangles();
-                        int sizeToAdd = accCube->getNumVerts();
-                        Triangle vecToAdd;
-                        for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-                            (*i).v[0] += sizeToAdd;
-                            (*i).v[1] += sizeToAdd;
-                            (*i).v[2] += sizeToAdd;
-                        }
-
-                        /// merge new cube to accCube
-                        accCube->mergeMesh(newCube);
-
-                        ///< delete surrounding cubes' triangles
-
-                        vector<Triangle> * tris = accCube->getCubeTriangles();
-                        int eCount;
-
-                        // left
-                        if (x != 0  && (vox.get(x-1, y, z) == 1))
-                        {
-                            // existing cube
-                            eCount = voxelRep->getEntryCount({x-1, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "R");
-                            voxelRep->update(2, {x-1, y, z});
-
-                            // newly added cube
-                            eCount = voxelRep->getEntryCount({x, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "L");
-                            voxelRep->update(2, {x, y, z});
-                        }
-
-                        // back
-                        if (z != 0  && (vox.get(x, y, z-1) == 1))
-                        {
-                            // existing cube
-                            eCount = voxelRep->getEntryCount({x, y, z-1});
-                            cerr << "x, y, z-1 : " << x << ", " << y << ", " << z-1 << endl;
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "F");
-                            voxelRep->update(2, {x, y, z-1});
-
-                            // newly added cube
-                            eCount = voxelRep->getEntryCount({x, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "Bk");
-                            voxelRep->update(2, {x, y, z});
-                        }
-
-
-                        // bottom
-                        if (y != 0 && (vox.get(x, y-1, z) == 1))
-                        {
-                            // existing cube
-                            eCount = voxelRep->getEntryCount({x, y-1, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "T");
-                            voxelRep->update(2, {x, y-1, z});
-
-                            // newly added cube
-                            eCount = voxelRep->getEntryCount({x, y, z});
-                            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}) + 2);
-                            voxelRep->addRemovedFaceCode(eCount, "Bm");
-                            voxelRep->update(2, {x, y, z});
-                        }
-                    }
-                    entryCount++;
-                }
-            }
-        }
-    }
-
-    accCube->mergeAllVerts();
-
-//    cerr << "tris after merge:" << endl;
-//    for (vector<Triangle>::iterator triangle = accCube->getCubeTriangles()->begin(); triangle != accCube->getCubeTriangles()->end(); ++triangle)
-//    {
-//        triangle->printVec();
-//    }
-
-    accCube->boxFit(10.0f);
-    finalMesh->shape = accCube;
-
-    csgroot = finalMesh;
+    /// render a cube for each voxel value == 1, keeping only the faces that are not shared
+    meshBlocks();
     rep = SceneRep::TREE;
 }
 
@@ -1050,77 +4298,25 @@ void Scene::testShrinkScene(bool normalSize)
 
     if (normalSize)
     {
-        accCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-        /// second cube
-        Mesh * newCube = new Mesh();
-        newCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-        cgp::Point pointToAdd = cgp::Point(10, 0, 0);
-
-        ///< translate vertices of new cube
-        vector<cgp::Point> * vts = newCube->getVerts();
-
-        for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-            (*i).add(pointToAdd);
-        }
-
-        ///< change triangle indices in new cube
-        vector<Triangle> * trs = newCube->getCubeTriangles();
-        int sizeToAdd = accCube->getNumVerts();
-        for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-            (*i).v[0] += sizeToAdd;
-            (*i).v[1] += sizeToAdd;
-            (*i).v[2] += sizeToAdd;
-        }
-
-        ///< merge second cube to accCube
-        accCube->mergeMesh(newCube, true);
-
-        ///< global voxel rep object
-        VoxelRep * voxelRep = new VoxelRep ();
-        voxelRep->add(0, {0, 0, 0});
-        voxelRep->add(0, {1, 0, 0});
-
-        ///< delete surrounding cubes' triangles
-
-        vector<Triangle> * tris = accCube->getCubeTriangles();
-        int eCount;
-
-        /// left of cube 2
-        if (true)
-        {
-            /// existing cube
-            eCount = voxelRep->getEntryCount({0, 0, 0});
-            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {0, 0, 0}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {0, 0, 0}) + 2);
-            voxelRep->addRemovedFaceCode(eCount, "R");
-            voxelRep->update(2, {0, 0, 0});
-
-            /// newly added cube
-            eCount = voxelRep->getEntryCount({1, 0, 0});
-            tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {1, 0, 0}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {1, 0, 0}) + 2);
-            voxelRep->addRemovedFaceCode(eCount, "L");
-            voxelRep->update(2, {1, 0, 0});
-        }
-
-//        cerr << "triangle size after face removal: " << tris->size() << endl;
-//        for (vector<Triangle>::iterator iter = tris->begin(); iter != tris->end(); iter++) {
-//            (*iter).printVec();
-//        }
-
-        accCube->boxFit(10.0f);
+        /// two cubes sharing a face
+        vox.setDim(2, 1, 1);
+        vox.set(0, 0, 0, true);
+        vox.set(1, 0, 0, true);
+        meshBlocks();
     }
     else
     {
-        vector<cgp::Point> * vts = accCube->getVerts();
-        vector<Triangle> * trs = accCube->getCubeTriangles();
+        Mesh * blocks = blockMesh();
+        vector<cgp::Point> * vts = blocks->getVerts();
+        vector<Triangle> * trs = blocks->getCubeTriangles();
         vector<cgp::Vector> netVectors;
 
         int index = 0;
 
-        cerr << "##### Shrink Test #####" << endl;
+        UTS_LOG(INFO, CSG, "##### Shrink Test #####");
 
         for (vector<cgp::Point>::iterator vertex = vts->begin(); vertex != vts->end(); ++vertex) {
-            vector<cgp::Vector> normals;
+            NormalPalette palette;
             vector<Triangle> adjacentTris;
 
             ///< find all adjacent faces
@@ -1134,10 +4330,11 @@ void Scene::testShrinkScene(bool normalSize)
 
             ///< calculate normals
             for (vector<Triangle>::iterator triangle = adjacentTris.begin(); triangle != adjacentTris.end(); ++triangle) {
-                triangle->deriveNormal(normals, *vts);
+                triangle->deriveNormal(palette, *vts);
             }
 
             ///< average normals
+            const vector<cgp::Vector> &normals = palette.getNormals();
             cgp::Vector avgNormal = normals[0];
             int n = normals.size();
             for (int i = 1; i < n; ++i) {
@@ -1176,30 +4373,30 @@ void Scene::testShrinkScene(bool normalSize)
         }
     }
 
-    finalMesh->shape = accCube;
-
-    csgroot = finalMesh;
     rep = SceneRep::TREE;
 }
 
 void Scene::pieceA1Scene(bool shrunk)
 {
-    /// global voxel rep object
-    VoxelRep * voxelRep = new VoxelRep ();
-
-    int entryCount = 0, length = 32;
-    cgp::Point pointToAdd = cgp::Point(0.0f, 0.0f, 0.0f);
+    int dimx, dimy, dimz;
     int count = 0;
     bool renderX = true, renderZ = true;
 
     if (!shrunk)
     {
-        accCube->readSTL("meshes/triangle/10mm_test_cube.stl");
+        /// piece is defined procedurally, so only allocate a grid if none has been loaded
+        vox.getDim(dimx, dimy, dimz);
+        if (dimx == 0 || dimy == 0 || dimz == 0)
+        {
+            vox.setDim(piecegridlen, piecegridlen, piecegridlen);
+            vox.getDim(dimx, dimy, dimz);
+        }
+        vox.fill(false);
 
         // go through voxel grid and render a cube for each voxel value == 1
-        for (int z = 0; z < length; ++z) {
-            for (int y = 0; y < length; ++y) {
-                for (int x = 0; x < length; ++x) {
+        for (int z = 0; z < dimz; ++z) {
+            for (int y = 0; y < dimy; ++y) {
+                for (int x = 0; x < dimx; ++x) {
                     if (((x == 15 || x == 17) && (z == 14 || z == 18)) || x == 14 || x == 16 || x == 18) renderX = true; else renderX = false;
                     if (((z == 15 || z == 17) && (x == 14 || x == 18)) || z == 14 || z == 16 || z == 18) renderZ = true; else renderZ = false;
 
@@ -1207,122 +4404,27 @@ void Scene::pieceA1Scene(bool shrunk)
                     {
                         vox.set(x, y, z, true);
                         count++;
-                        voxelRep->add(0, {x, y, z});
-                        pointToAdd = cgp::Point(x*10, y*10, z*10);
-                        if (entryCount == 0) {
-                            /// translate vertices
-                            vector<cgp::Point> * vts = accCube->getVerts();
-
-                            for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                                (*i).add(pointToAdd);
-                            }
-                        } else {
-                            Mesh * newCube = new Mesh();
-                            newCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-                            /// translate vertices of new cube
-                            vector<cgp::Point> * vts = newCube->getVerts();
-
-                            for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                                (*i).add(pointToAdd);
-                            }
-
-                            /// change triangle indices in new cube
-                            vector<Triangle> * trs = newCube->getCubeTriangles();
-                            int sizeToAdd = accCube->getNumVerts();
-                            Triangle vecToAdd;
-                            for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-                                (*i).v[0] += sizeToAdd;
-                                (*i).v[1] += sizeToAdd;
-                                (*i).v[2] += sizeToAdd;
-                            }
-
-                            /// merge new cube to accCube
-                            accCube->mergeMesh(newCube);
-
-                            ///< delete surrounding cubes' triangles
-
-                            vector<Triangle> * tris = accCube->getCubeTriangles();
-                            int eCount;
-
-                            /// left
-                            if (x != 0  && (vox.get(x-1, y, z) == 1))
-                            {
-                                /// existing cube
-                                eCount = voxelRep->getEntryCount({x-1, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "R");
-                                voxelRep->update(2, {x-1, y, z});
-
-                                /// newly added cube
-                                eCount = voxelRep->getEntryCount({x, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "L");
-                                voxelRep->update(2, {x, y, z});
-                            }
-
-                            /// back
-                            if (z != 0  && (vox.get(x, y, z-1) == 1))
-                            {
-                                /// existing cube
-                                eCount = voxelRep->getEntryCount({x, y, z-1});
-                                cerr << "x, y, z-1 : " << x << ", " << y << ", " << z-1 << endl;
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "F");
-                                voxelRep->update(2, {x, y, z-1});
-
-                                /// newly added cube
-                                eCount = voxelRep->getEntryCount({x, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "Bk");
-                                voxelRep->update(2, {x, y, z});
-                            }
-
-
-                            /// bottom
-                            if (y != 0 && (vox.get(x, y-1, z) == 1))
-                            {
-                                /// existing cube
-                                eCount = voxelRep->getEntryCount({x, y-1, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "T");
-                                voxelRep->update(2, {x, y-1, z});
-
-                                /// newly added cube
-                                eCount = voxelRep->getEntryCount({x, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "Bm");
-                                voxelRep->update(2, {x, y, z});
-                            }
-                        }
-                        entryCount++;
                     }
                 }
             }
         }
 
-        accCube->mergeAllVerts();
-
-        //        cerr << "tris after merge:" << endl;
-        //        for (vector<Triangle>::iterator triangle = accCube->getCubeTriangles()->begin(); triangle != accCube->getCubeTriangles()->end(); ++triangle)
-        //        {
-        //            triangle->printVec();
-        //        }
-
-        accCube->boxFit(10.0f);
+        /// render a cube for each voxel value == 1, keeping only the faces that are not shared
+        meshBlocks();
     }
     else
     {
-        vector<cgp::Point> * vts = accCube->getVerts();
-        vector<Triangle> * trs = accCube->getCubeTriangles();
+        Mesh * blocks = blockMesh();
+        vector<cgp::Point> * vts = blocks->getVerts();
+        vector<Triangle> * trs = blocks->getCubeTriangles();
         vector<cgp::Vector> netVectors;
 
         int index = 0;
 
-        cerr << "##### Shrink Test #####" << endl;
+        UTS_LOG(INFO, CSG, "##### Shrink Test #####");
 
         for (vector<cgp::Point>::iterator vertex = vts->begin(); vertex != vts->end(); ++vertex) {
-            vector<cgp::Vector> normals;
+            NormalPalette palette;
             vector<Triangle> adjacentTris;
 
             ///< find all adjacent faces
@@ -1333,10 +4435,11 @@ void Scene::pieceA1Scene(bool shrunk)
 
             ///< calculate normals
             for (vector<Triangle>::iterator triangle = adjacentTris.begin(); triangle != adjacentTris.end(); ++triangle) {
-                triangle->deriveNormal(normals, *vts);
+                triangle->deriveNormal(palette, *vts);
             }
 
             ///< average normals
+            const vector<cgp::Vector> &normals = palette.getNormals();
             cgp::Vector avgNormal = normals[0];
             int n = normals.size();
             for (int i = 1; i < n; ++i) {
@@ -1374,153 +4477,57 @@ void Scene::pieceA1Scene(bool shrunk)
         }
     }
 
-    finalMesh->shape = accCube;
-
-    csgroot = finalMesh;
     rep = SceneRep::TREE;
 }
 
 void Scene::pieceA2Scene(bool shrunk)
 {
-    /// global voxel rep object
-    VoxelRep * voxelRep = new VoxelRep ();
-
-    int entryCount = 0, length = 32;
-    cgp::Point pointToAdd = cgp::Point(0.0f, 0.0f, 0.0f);
+    int dimx, dimy, dimz;
     int count = 0;
     bool renderX = true, renderZ = true;
 
     if (!shrunk)
     {
-        accCube->readSTL("meshes/triangle/10mm_test_cube.stl");
+        /// piece is defined procedurally, so only allocate a grid if none has been loaded
+        vox.getDim(dimx, dimy, dimz);
+        if (dimx == 0 || dimy == 0 || dimz == 0)
+        {
+            vox.setDim(piecegridlen, piecegridlen, piecegridlen);
+            vox.getDim(dimx, dimy, dimz);
+        }
+        vox.fill(false);
 
         /// go through voxel grid and render a cube for each voxel value == 1
-        for (int z = 0; z < length; ++z) {
-            for (int y = 0; y < length; ++y) {
-                for (int x = 0; x < length; ++x) {
+        for (int z = 0; z < dimz; ++z) {
+            for (int y = 0; y < dimy; ++y) {
+                for (int x = 0; x < dimx; ++x) {
                     if (x == 15 || x == 17 || (x == 16 && z != 16)) renderX = true; else renderX = false;
                     if (z == 15 || z == 17 || (z == 16 && x != 16)) renderZ = true; else renderZ = false;
 
                     if (((y >= 14 && y<16) && (x >= 14 && x <= 18) && (z >= 14 && z <= 18)) || ((y >= 16 && y <= 18) && renderX && renderZ)) {
                         vox.set(x, y, z, true);
                         count++;
-                        voxelRep->add(0, {x, y, z});
-                        pointToAdd = cgp::Point(x*10, y*10, z*10);
-                        if (entryCount == 0) {
-                            /// translate vertices
-                            vector<cgp::Point> * vts = accCube->getVerts();
-
-                            for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                                (*i).add(pointToAdd);
-                            }
-                        } else {
-                            Mesh * newCube = new Mesh();
-                            newCube->readSTL("meshes/triangle/10mm_test_cube.stl");
-
-                            /// translate vertices of new cube
-                            vector<cgp::Point> * vts = newCube->getVerts();
-
-                            for (std::vector<cgp::Point>::iterator i = vts->begin() ; i != vts->end(); ++i) {
-                                (*i).add(pointToAdd);
-                            }
-
-                            /// change triangle indices in new cube
-                            vector<Triangle> * trs = newCube->getCubeTriangles();
-                            int sizeToAdd = accCube->getNumVerts();
-                            Triangle vecToAdd;
-                            for (std::vector<Triangle>::iterator i = trs->begin() ; i != trs->end(); ++i) {
-                                (*i).v[0] += sizeToAdd;
-                                (*i).v[1] += sizeToAdd;
-                                (*i).v[2] += sizeToAdd;
-                            }
-
-                            /// merge new cube to accCube
-                            accCube->mergeMesh(newCube);
-
-
-                            ///< delete surrounding cubes' triangles
-
-                            vector<Triangle> * tris = accCube->getCubeTriangles();
-                            int eCount;
-
-                            /// left
-                            if (x != 0  && (vox.get(x-1, y, z) == 1))
-                            {
-                                /// existing cube
-                                eCount = voxelRep->getEntryCount({x-1, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("R", {x-1, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "R");
-                                voxelRep->update(2, {x-1, y, z});
-
-                                /// newly added cube
-                                eCount = voxelRep->getEntryCount({x, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("L", {x, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "L");
-                                voxelRep->update(2, {x, y, z});
-                            }
-
-                            /// back
-                            if (z != 0  && (vox.get(x, y, z-1) == 1))
-                            {
-                                /// existing cube
-                                eCount = voxelRep->getEntryCount({x, y, z-1});
-                                cerr << "x, y, z-1 : " << x << ", " << y << ", " << z-1 << endl;
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("F", {x, y, z-1}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "F");
-                                voxelRep->update(2, {x, y, z-1});
-
-                                /// newly added cube
-                                eCount = voxelRep->getEntryCount({x, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bk", {x, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "Bk");
-                                voxelRep->update(2, {x, y, z});
-                            }
-
-
-                            /// bottom
-                            if (y != 0 && (vox.get(x, y-1, z) == 1))
-                            {
-                                /// existing cube
-                                eCount = voxelRep->getEntryCount({x, y-1, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("T", {x, y-1, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "T");
-                                voxelRep->update(2, {x, y-1, z});
-
-                                /// newly added cube
-                                eCount = voxelRep->getEntryCount({x, y, z});
-                                tris->erase(tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}), tris->begin() + voxelRep->getStartPos(eCount) + voxelRep->getSideCode("Bm", {x, y, z}) + 2);
-                                voxelRep->addRemovedFaceCode(eCount, "Bm");
-                                voxelRep->update(2, {x, y, z});
-                            }
-                        }
-                        entryCount++;
                     }
                 }
             }
         }
 
-        accCube->mergeAllVerts();
-
-//        cerr << "tris after merge:" << endl;
-//        for (vector<Triangle>::iterator triangle = accCube->getCubeTriangles()->begin(); triangle != accCube->getCubeTriangles()->end(); ++triangle)
-//        {
-//            triangle->printVec();
-//        }
-
-        accCube->boxFit(10.0f);
+        /// render a cube for each voxel value == 1, keeping only the faces that are not shared
+        meshBlocks();
     }
     else
     {
-        vector<cgp::Point> * vts = accCube->getVerts();
-        vector<Triangle> * trs = accCube->getCubeTriangles();
+        Mesh * blocks = blockMesh();
+        vector<cgp::Point> * vts = blocks->getVerts();
+        vector<Triangle> * trs = blocks->getCubeTriangles();
         vector<cgp::Vector> netVectors;
 
         int index = 0;
 
-        cerr << "##### Shrink Test #####" << endl;
+        UTS_LOG(INFO, CSG, "##### Shrink Test #####");
 
         for (vector<cgp::Point>::iterator vertex = vts->begin(); vertex != vts->end(); ++vertex) {
-            vector<cgp::Vector> normals;
+            NormalPalette palette;
             vector<Triangle> adjacentTris;
 
             ///< find all adjacent faces
@@ -1531,10 +4538,11 @@ void Scene::pieceA2Scene(bool shrunk)
 
             ///< calculate normals
             for (vector<Triangle>::iterator triangle = adjacentTris.begin(); triangle != adjacentTris.end(); ++triangle) {
-                triangle->deriveNormal(normals, *vts);
+                triangle->deriveNormal(palette, *vts);
             }
 
             ///< average normals
+            const vector<cgp::Vector> &normals = palette.getNormals();
             cgp::Vector avgNormal = normals[0];
             int n = normals.size();
             for (int i = 1; i < n; ++i) {
@@ -1572,8 +4580,5 @@ void Scene::pieceA2Scene(bool shrunk)
         }
     }
 
-    finalMesh->shape = accCube;
-
-    csgroot = finalMesh;
     rep = SceneRep::TREE;
 }
@@ -9,8 +9,28 @@
 #include <vector>
 #include <stdio.h>
 #include <iostream>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 #include "mesh.h"
-#include "voxelrep.h"
+#include "meshasset.h"
+#include "scratch.h"
+#include "clvoxels.h"
+#include "glvoxels.h"
+
+class TextTokenizer;
+
+const float lodpixelspertri = 4.0f;     ///< screen pixels per displayed isosurface triangle before a coarser level of detail is used
+const float lodinteractivescale = 16.0f; ///< factor by which the isosurface triangle budget shrinks while the view is moving
+const int smoothiter = 10;              ///< default Taubin shrink and inflate pairs applied by smooth
+const float smoothrate = 0.5f;          ///< default Taubin shrinking factor applied by smooth
+const int previewfactors[] = {8, 4};    ///< voxel size multiples of the preview levels run ahead of full resolution, coarsest first
+const int voxslablayers = 32;           ///< voxel layers evaluated at a time by voxeliseToFile and extractSlabs
+const char sessionmagic[4] = {'T', 'S', 'E', 'S'}; ///< identifies a binary session written by Scene::writeSession
+const int sessionversion = 1;           ///< current session layout
+const int tunesamples[] = {48, 96};     ///< voxels along the longest side of the scene in the samples taken by Scene::tuneResolution
+const int tunerepeats = 3;              ///< runs of each sample, of which the fastest is kept, since the first is slowed by cold caches
 
 /**
  * Different types of binary set operations on shapes
@@ -32,11 +52,91 @@ enum class SceneRep
     ISOSURFACE, ///< final isosurface mesh representation
 };
 
-/// Base class for csg tree nodes
+/**
+ * Stages of the dependency chain that Scene::require builds on demand, each computed from the one before it
+ */
+enum class SceneStage
+{
+    TREE,       ///< csg tree, which is edited rather than computed
+    VOXELS,     ///< voxel volume, from the tree by Scene::voxelise
+    ISOSURFACE, ///< raw isosurface, from the voxels by Scene::isoextract
+    SMOOTHED,   ///< isosurface after Scene::smooth
+    DEFORMED,   ///< smoothed isosurface after Scene::deform by the lattice of Scene::setLattice
+};
+
+const int numscenestages = 5;   ///< number of SceneStage values
+
+/**
+ * Version stamp of the last build of a SceneStage. A stage is stale once its parameters or the version of the stage
+ * before it no longer match what it was built from.
+ */
+struct StageStamp
+{
+    uint64_t version;       ///< changes whenever the output of the stage does, 0 if there is no valid output
+    uint64_t params;        ///< hash of the parameters the output was built with, 0 for a stage that passed its input through
+    uint64_t input;         ///< version of the stage before it that the output was built from, 0 if unknown
+};
+
+/**
+ * Progress of a long running Scene stage, shared between the thread running the stage and the one watching it
+ */
+struct StageProgress
+{
+    std::atomic<int> percent;   ///< completion of the running stage, from 0 to 100
+    std::atomic<bool> cancel;   ///< set by the watcher to ask the running stage to stop early
+
+    /// Default constructor
+    StageProgress(){ reset(); }
+
+    /// Prepare for a new stage
+    void reset(){ percent = 0; cancel = false; }
+};
+
+/**
+ * Cost of voxelise and isoextract predicted for one voxel size by Scene::estimateResolution, from a model fitted to
+ * coarse samples of the scene. Each stage is taken to cost a constant time per voxel, for containment tests and row
+ * scans, plus a constant time per active marching cubes cell, for work at the surface, with active cells and
+ * triangles growing with the square of the resolution.
+ */
+struct ResolutionEstimate
+{
+    float voxlen;               ///< side length of a voxel
+    int dim[3];                 ///< volume dimensions, with x padded to whole words
+    double seconds;             ///< predicted time to voxelise and extract the isosurface
+    size_t bytes;               ///< predicted memory for the dense volume and the isosurface
+    size_t triangles;           ///< predicted isosurface triangles
+
+    // model fitted to the samples
+    float samplelen;            ///< voxel side length of the finer sample
+    double voxpervoxel, voxpercell; ///< voxelise seconds per voxel and per active cell
+    double mcpervoxel, mcpercell;   ///< isoextract seconds per voxel and per active cell
+    double samplecells;         ///< active marching cubes cells in the finer sample
+    double sampletris;          ///< isosurface triangles in the finer sample
+    double bytespertri;         ///< isosurface bytes per triangle in the finer sample
+    double testspervoxel;       ///< containment tests per voxel in the finer sample, or 0 if counting is not compiled in
+};
+
+/**
+ * Concrete type of a SceneNode
+ */
+enum class NodeKind
+{
+    OP,     ///< OpNode
+    SHAPE,  ///< ShapeNode
+};
+
+/// Base class for csg tree nodes, tagged with their type so that traversals dispatch without dynamic_cast
 class SceneNode
 {
 public:
-    // must have at least one virtual member to allow dynamic casting
+    const NodeKind kind;    ///< concrete type of the node
+
+    /**
+     * Constructor
+     * @param type  concrete type of the inheriting class
+     */
+    SceneNode(NodeKind type) : kind(type) {}
+
     virtual ~SceneNode(){};
 };
 
@@ -46,7 +146,9 @@ class OpNode: public SceneNode
 public:
     SceneNode * left, * right;
     SetOp op;
+    cgp::BoundBox bounds;   ///< bounds of the subtree result, filled in by Scene::voxelise before the tree is walked
 
+    OpNode() : SceneNode(NodeKind::OP), left(NULL), right(NULL), op(SetOp::UNION) {}
     ~OpNode(){}
 };
 
@@ -56,9 +158,272 @@ class ShapeNode: public SceneNode
 public:
     BaseShape * shape;
 
+    ShapeNode() : SceneNode(NodeKind::SHAPE), shape(NULL) {}
     ~ShapeNode(){ delete shape; }
 };
 
+/// A node as a set operation, or NULL if it is a leaf or NULL
+inline OpNode * opNode(SceneNode * node)
+{
+    return (node != NULL && node->kind == NodeKind::OP) ? static_cast<OpNode *>(node) : NULL;
+}
+
+/// A node as a leaf, or NULL if it is a set operation or NULL
+inline ShapeNode * shapeNode(SceneNode * node)
+{
+    return (node != NULL && node->kind == NodeKind::SHAPE) ? static_cast<ShapeNode *>(node) : NULL;
+}
+
+/**
+ * A csg subtree shared between the SubtreeInstance leaves that place it, in its own model space. It owns the
+ * subtree, which is left unchanged from construction on, so that every placement queries the same shapes and their
+ * acceleration structures, and a pattern of hundreds of identical features holds one copy of its geometry.
+ */
+class SubtreeAsset
+{
+private:
+    SceneNode * root;           ///< shared subtree, owned by the asset
+    cgp::BoundBox bounds;       ///< model-space bounds of the subtree result
+    uint64_t digest;            ///< content hash of the subtree, so that instances hash in constant time
+
+public:
+
+    /**
+     * Take ownership of a subtree, finding its bounds and content hash
+     * @param subtree   root of the subtree, which may be NULL for an empty one and must not be part of another tree
+     */
+    SubtreeAsset(SceneNode * subtree);
+
+    /// Destructor, deleting the subtree
+    ~SubtreeAsset();
+
+    SubtreeAsset(const SubtreeAsset &) = delete;
+    SubtreeAsset & operator=(const SubtreeAsset &) = delete;
+
+    /// Root of the shared subtree, which must not be edited
+    SceneNode * getRoot() const { return root; }
+
+    /// Model-space bounds of the subtree result, empty if it has no interior
+    const cgp::BoundBox & getBounds() const { return bounds; }
+
+    /// Content hash of the subtree
+    uint64_t getDigest() const { return digest; }
+
+    /**
+     * Test a batch of model-space points against the subtree, testing each operand of a set operation only on the
+     * points whose result it can still change
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the subtree result, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out) const;
+
+    /**
+     * Signed distance to the subtree result in model space, combining the distances of its leaves by minimum and
+     * maximum, which is exact outside of the regions where operands overlap and a bound elsewhere
+     * @param pnt   point to measure
+     * @param band  distance from the surface beyond which only the sign matters
+     * @returns signed distance, negative inside
+     */
+    float signedDistance(cgp::Point pnt, float band) const;
+};
+
+/**
+ * An affine placement of a shared SubtreeAsset, which is how transforms enter the csg tree. Queries are mapped into
+ * the model space of the subtree by the inverse transform, a batch at a time, and bounds are the transformed box of
+ * the subtree bounds, so repeated features need no copies of their shapes with the transform baked in.
+ */
+class SubtreeInstance: public BaseShape
+{
+private:
+    std::shared_ptr<const SubtreeAsset> asset;  ///< shared subtree
+    glm::mat4x4 tfm;            ///< model to world transform
+    glm::mat4x4 inv;            ///< world to model transform
+    float minscale;             ///< least stretch of tfm in any direction, by which model-space distances are scaled
+
+    /// Map a world-space point into model space
+    cgp::Point toModel(cgp::Point pnt) const;
+
+public:
+
+    /**
+     * Constructor
+     * @param shared    subtree to place, with an identity transform
+     */
+    SubtreeInstance(std::shared_ptr<const SubtreeAsset> shared);
+
+    /// Shared subtree
+    const std::shared_ptr<const SubtreeAsset> & getAsset() const { return asset; }
+
+    /**
+     * Set the model to world transform
+     * @param trm   invertible affine transform
+     * @retval true if the transform was set,
+     * @retval false if it is singular, in which case the previous transform remains
+     */
+    bool setTransform(const glm::mat4x4 &trm);
+
+    /// Model to world transform
+    const glm::mat4x4 & getTransform() const { return tfm; }
+
+    /**
+     * Generate geometry for OpenGL rendering, as the transformed geometry of every leaf of the subtree
+     * @param[out] geom triangle-mesh geometry packed for OpenGL
+     * @param view      current view parameters
+     */
+    void genGeometry(ShapeGeometry * geom, View * view);
+
+    /**
+     * Test whether a point falls inside the placed subtree
+     * @param pnt   point to test for containment
+     * @retval true if the point falls within the subtree result,
+     * @retval false otherwise
+     */
+    bool pointContainment(cgp::Point pnt);
+
+    /**
+     * Test a batch of points for containment, mapping the whole batch into model space before testing it
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the subtree result, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /**
+     * Signed distance to the placed subtree, exact for rigid and uniformly scaled placements, and scaled by the
+     * least stretch of the transform otherwise, so that it never overestimates
+     * @param pnt   point to measure
+     * @param band  distance from the surface beyond which only the sign matters
+     * @returns signed distance, negative inside
+     */
+    float signedDistance(cgp::Point pnt, float band);
+
+    /**
+     * Find the world-space box enclosing the transformed corners of the subtree bounds
+     * @param[out] bbox  enclosing box, reset to empty if the subtree has no interior
+     */
+    void getBounds(cgp::BoundBox &bbox);
+
+    /// Add the subtree digest and the transform to a hash
+    void hashContent(ContentHash &hash);
+};
+
+/**
+ * A single step of a compiled CSG tree. Steps are stored in prefix order, so the left operand of a set operation
+ * immediately follows it and the right operand starts at a recorded index.
+ */
+struct CSGInstr
+{
+    BaseShape * shape;      ///< leaf shape, or NULL for a set operation
+    bool scan;              ///< leaf shape allows rows to be scanned by a single ray, as for parity meshes
+    SetOp op;               ///< set operation, for internal steps
+    int right;              ///< index of the first step of the right operand, for internal steps
+    int shared;             ///< row slot of a subtree repeated elsewhere in the tree, which is evaluated once per row, or -1
+    bool overlap;           ///< leaf bounds overlap the volume being evaluated
+    int lo[3], hi[3];       ///< inclusive voxel range covered by the leaf bounds
+    cgp::BoundBox bbox;     ///< world-space leaf bounds
+};
+
+/**
+ * Per-thread working storage for CSGProgram row evaluation
+ */
+struct CSGScratch
+{
+    std::vector<unsigned int> words;    ///< 2*xspan words per step, for right operand masks and results
+    std::vector<unsigned int> shared;   ///< xspan words per shared slot, holding the whole row of a repeated subtree
+    std::vector<int64_t> sharedrow;     ///< row last evaluated into each shared slot, as z * rows + y, or -1
+    std::vector<unsigned int> full;     ///< xspan words with every voxel needed, for evaluating shared slots
+    std::vector<int> spans;             ///< occupied spans from a mesh row scan
+    std::vector<cgp::Point> pts;        ///< voxel positions in a containment batch
+    std::vector<int> xs;                ///< voxel x index of each batch position
+    std::vector<uint8_t> inside;        ///< containment result for each batch position
+    std::vector<float> xpos;            ///< world x coordinate of every voxel along a row, shared by all rows
+    float xstep;                        ///< spacing between voxels along a row, or 0 if the volume is one voxel wide
+};
+
+/**
+ * CSG tree flattened into a list of steps and evaluated a voxel row at a time, straight into the final volume.
+ * Each step is evaluated only for the voxels whose value can still affect the result (e.g., the right operand of
+ * an intersection is skipped wherever the left operand is empty), and no intermediate volumes are allocated,
+ * so memory use is independent of tree depth.
+ */
+class CSGProgram
+{
+private:
+    std::vector<CSGInstr> instrs;   ///< steps in prefix order
+    int numshared;                  ///< number of distinct repeated subtrees, each with a row slot
+
+    /**
+     * Append the steps for a subtree
+     * @param node      root of the subtree
+     * @param hashes    content hash of every node of the tree
+     * @param rowslots  row slot of each repeated content hash
+     */
+    void append(SceneNode * node, const std::unordered_map<SceneNode *, uint64_t> &hashes,
+                const std::unordered_map<uint64_t, int> &rowslots);
+
+    /**
+     * Evaluate a step over a single row of voxels, as for evalRow but without looking for a shared row
+     */
+    void evalStep(int i, VoxelVolume * vox, int y, int z, const unsigned int * need, unsigned int * res,
+                  CSGScratch &work, bool scanmesh);
+
+    /**
+     * Evaluate the subtree rooted at a step over a single row of voxels
+     * @param i         index of the step
+     * @param vox       volume supplying voxel positions
+     * @param y, z      row being evaluated
+     * @param need      xspan words marking the voxels whose value is required
+     * @param[out] res  xspan words of results, exact where need is set and empty elsewhere
+     * @param work      working storage, with words sized for every step
+     * @param scanmesh  scan mesh leaves by row parity rather than testing voxels individually
+     */
+    void evalRow(int i, VoxelVolume * vox, int y, int z, const unsigned int * need, unsigned int * res,
+                 CSGScratch &work, bool scanmesh);
+
+public:
+
+    CSGProgram() : numshared(0) {}
+
+    /**
+     * Flatten a CSG tree, replacing any previous program. The tree must outlive the program. Subtrees that occur
+     * more than once with the same content are given a shared row slot, so each row of them is evaluated once,
+     * unless they are a single analytic primitive, which is cheaper to test again than to copy.
+     * @param root  root node of the CSG tree, may be NULL
+     * @param share give repeated subtrees a shared row slot
+     */
+    void compile(SceneNode * root, bool share = true);
+
+    /// Number of steps in the program
+    int size(){ return (int) instrs.size(); }
+
+    /**
+     * Evaluate the program into a voxel volume, every voxel of which is overwritten
+     * @param[out] vox  volume with dimensions and frame already set
+     * @param scanmesh  scan mesh leaves by row parity rather than testing voxels individually
+     * @param lo, hi    optional inclusive voxel range to re-evaluate, leaving the rest of the volume unchanged. Whole
+     *                  words around it are rewritten too, with their correct values.
+     */
+    void evaluate(VoxelVolume * vox, bool scanmesh, const int * lo = NULL, const int * hi = NULL);
+};
+
+/**
+ * Voxels and isosurface of a scene after a pipeline stage, recorded by Scene::takeSnapshot. Snapshots form a tree,
+ * each taken from the state its parent left, so undoing a stage and running it again with other settings starts a
+ * new branch rather than discarding the old one. Scene::publish makes the same record, without a parent, for readers
+ * on other threads.
+ */
+struct SceneSnapshot
+{
+    int parent;             ///< snapshot the scene was at when this one was taken, or -1 for the first
+    std::string stage;      ///< name of the stage that produced it
+    SceneRep rep;           ///< representation current at the time
+    float voxsidelen;       ///< side length of a voxel
+    VoxelSnapshot vox;      ///< voxel volume
+    MeshSnapshot mesh;      ///< isosurface and its undistorted base
+    size_t bytes;           ///< storage allocated for this snapshot rather than shared with its parent
+};
+
 /**
  * CSG Tree that can be evaluated to produce a volumetric representation.
  */
@@ -69,11 +434,126 @@ private:
     GLfloat * col;                              ///< (r,g,b,a) colour
     cgp::Vector voldiag;                        ///< diagonal of scene bounding box in cm
     VoxelVolume vox;                            ///< voxel representation of scene
+    DistanceField sdf;                          ///< signed distance representation of scene, if distfield is set
 
     float voxsidelen;                           ///< side length of a single voxel
     SceneRep rep;                               ///< which representation is current (tree, voxel, isosurface)
     Mesh voxmesh;                               ///< isosurface of voxel volume
-    int percentDone = 0;
+    bool scanmesh;                              ///< voxelise mesh leaves by row parity rather than per-voxel containment
+    bool greedyblocks;                          ///< merge coplanar faces when meshing voxel blocks
+    bool streamcsg;                             ///< evaluate the csg tree row by row instead of with intermediate volumes
+    bool gpuvox;                                ///< walk the csg tree on an OpenCL device, when there is one
+    bool rastervox;                             ///< rasterise csg leaves with OpenGL, when there is a context for it
+    bool dexelcsg;                              ///< evaluate the csg tree as span lists per row, packed into vox at the end
+    bool marchvox;                              ///< draw a voxel volume by ray marching its packed words, not as instanced cubes
+    bool gpusurface;                            ///< isoextract leaves the isosurface to be extracted on an OpenCL device when it is drawn
+    bool devsurface;                            ///< the current isosurface is drawn from the device, and voxmesh is not yet extracted
+    bool devbound;                              ///< geom holds the device isosurface of the current vox
+    bool interactive;                           ///< the view is moving, so the isosurface is drawn within a smaller triangle budget
+    bool vizbound;                              ///< geom holds the leaves whose combined hash is vizkey
+    uint64_t vizkey;                            ///< combined hash of the leaves last generated by genVizRender
+    std::unordered_map<uint64_t, std::unique_ptr<ShapeGeometry>> vizpieces; ///< tessellation of each leaf in the last preview, keyed by its hashContent
+    bool simplifycsg;                           ///< prune and rebalance the csg tree before voxelising it
+    bool sharesubtrees;                         ///< evaluate repeated subtrees of the csg tree once and copy them
+    bool meshbools;                             ///< combine mesh leaves by surface set operations before voxelising
+    bool adaptivevox;                           ///< voxelise leaves by octree refinement rather than testing every voxel
+    bool distfield;                             ///< voxelise to signed distances, from which vox is thresholded
+    bool keeplargest;                           ///< remove all but the largest occupied component after voxelising
+    bool fillvoids;                             ///< fill empty components enclosed by the part after voxelising
+    bool dualsurface;                           ///< isoextract by surface nets or dual contouring rather than marching cubes
+    bool voxdistances;                          ///< the current vox was thresholded from sdf, so isoextract uses sdf
+    std::string cachedir;                       ///< directory of cached stage results, empty if caching is disabled
+    bool cachecompress;                         ///< cache meshes in the quantised compressed format rather than exactly
+    MeshAssetCache assets;                      ///< loaded meshes, shared by every mesh leaf that names the same file
+    StageProgress * progress;                   ///< where stages report progress and look for cancellation, or NULL
+    int smoothpairs;                            ///< Taubin shrink and inflate pairs applied by smooth
+    float smoothshrink;                         ///< Taubin shrinking factor applied by smooth
+    float smoothband;                           ///< Taubin pass-band frequency, which sets the inflating factor
+    int voxleaves;                              ///< leaves in the tree being voxelised, each an equal share of the progress
+    double voxdone;                             ///< fraction of the voxelisation completed so far
+    SceneNode * voxtree;                        ///< tree that vox was last evaluated from, or NULL if vox is not an occupancy volume of the tree
+    cgp::BoundBox dirtybox;                     ///< old and new bounds of the leaves replaced since vox was evaluated, empty if there are none
+    int remeshlo, remeshhi;                     ///< voxel layers changed since the last isoextract, with remeshhi at INT_MAX for the whole volume
+    ShapeNode * blocknode;                      ///< leaf holding the block surface of the voxel scenes while it is the whole tree, otherwise NULL
+    ScratchPool<VoxelVolume> voxpool;           ///< intermediate volumes of voxWalk, freed at the end of voxelise
+    std::unordered_map<SceneNode *, uint64_t> sharedkeys;   ///< content hash of every occurrence of a repeated subtree in the tree being walked
+    std::unordered_map<uint64_t, std::shared_ptr<VoxelVolume>> sharedvols; ///< volume of each repeated subtree by content hash, kept between runs in one frame, even through clear
+    uint64_t sharedframe;                       ///< hash of the frame and settings that sharedvols were evaluated with
+    ScratchPool<DistanceField> sdfpool;         ///< intermediate fields of sdfWalk, freed at the end of voxelise
+    ScratchPool<DexelVolume> dexpool;           ///< intermediate span volumes of dexelWalk, freed at the end of voxelise
+    CLVoxeliser clvox;                          ///< device volumes and kernels for gpuvox and gpusurface
+    GLVoxeliser glvox;                          ///< offscreen context and parity shaders for rastervox
+    bool keephistory;                           ///< record a snapshot after each stage run through recordStage
+    std::vector<std::unique_ptr<SceneSnapshot>> history;    ///< snapshots in the order they were taken
+    int snapcurrent;                            ///< snapshot the scene was last recorded at or restored to, or -1
+    bool publishing;                            ///< publish a read-only view after each stage run through recordStage
+    std::shared_ptr<const SceneSnapshot> published; ///< view last published for readers, only ever loaded and stored atomically
+    StageStamp stamps[numscenestages];          ///< last build of each stage, indexed by SceneStage
+    uint64_t stageclock;                        ///< last version handed out to a stage
+    SceneStage meshstage;                       ///< latest stage whose output voxmesh holds, or TREE if it holds none
+    float reqvoxlen;                            ///< voxel side length that require voxelises at
+    ffd lattice;                                ///< lattice that require deforms by, if haslattice is set
+    bool haslattice;                            ///< require deforms the smoothed isosurface rather than passing it through
+    MeshSnapshot isosnap;                       ///< raw isosurface kept by require before smoothing, so that new smoothing starts from it
+    MeshSnapshot smoothsnap;                    ///< smoothed isosurface kept by require before deforming, so that a new lattice starts from it
+    uint64_t isosnapver, smoothsnapver;         ///< stage versions that isosnap and smoothsnap hold, 0 if they hold none
+
+    /// Give a stage's output a new version, built with @a params from version @a input of the stage before it
+    void stampStage(SceneStage stage, uint64_t params, uint64_t input){ stamps[(int) stage] = {++stageclock, params, input}; }
+
+    /// Mark the csg tree edited, which leaves every later stage stale
+    void treeChanged(){ stamps[(int) SceneStage::TREE].version = ++stageclock; }
+
+    /// Forget the provenance of every computed stage, as when the volume and isosurface are replaced wholesale
+    void resetStages();
+
+    /// Hash of the voxelise parameters at voxel side length @a voxlen, as stamped on SceneStage::VOXELS
+    uint64_t voxelParams(float voxlen);
+
+    /// Hash of the parameters require would build a stage with, 0 for a stage that would pass its input through
+    uint64_t stageParams(SceneStage stage);
+
+    /// Does the stamp of a stage match its current parameters and the version of the stage before it?
+    bool stageCurrent(SceneStage stage);
+
+    /**
+     * Does voxmesh hold the output of a mesh stage, either directly or through later stages that passed it through?
+     * @pre the stamps of the stages up to @a stage are current
+     */
+    bool holdsStage(SceneStage stage);
+
+    /**
+     * Put the output of a current mesh stage into voxmesh, from voxmesh itself or from a snapshot kept by require
+     * @retval true if voxmesh now holds it,
+     * @retval false if it would have to be recomputed
+     */
+    bool restoreStage(SceneStage stage);
+
+    /**
+     * Build one stage from the output of the stage before it, which must be in place
+     * @retval true if the stage was built,
+     * @retval false if it failed or was cancelled
+     */
+    bool buildStage(SceneStage stage);
+
+    /// voxelise, without stamping the result
+    bool voxeliseVolume(float voxlen);
+
+    /// isoextract, without stamping the result
+    bool extractSurface();
+
+    /**
+     * Record the completion of the running stage, if anyone is watching
+     * @param fraction  completed fraction, from 0 to 1
+     */
+    void reportProgress(double fraction);
+
+    /**
+     * Has the running stage been asked to stop?
+     * @retval true if cancellation was requested through the attached progress,
+     * @retval false otherwise
+     */
+    bool cancelled(){ return progress != NULL && progress->cancel; }
 
     /**
      * Generate triangle mesh geometry for OpenGL rendering of all leaf nodes. 
@@ -86,9 +566,10 @@ private:
     bool genVizRender(View * view, ShapeDrawData &sdd);
 
     /**
-     * Generate triangle mesh geometry for OpenGL rendering of voxel structure.
-     * Approximates voxel grid as a set of spheres. Extremely expensive to render but more accurate in
-     * capturing set operations
+     * Generate OpenGL geometry for previewing the voxel structure without extracting an isosurface. Either a cube is
+     * instanced at every surface voxel, or, with setRayMarchVoxels, the packed words are uploaded as a 3D texture
+     * and ray marched in the fragment shader, which stays interactive for volumes whose surface voxels are too many
+     * to instance.
      * @param view      current view parameters
      * @param[out] sdd  openGL parameters required to draw this geometry
      * @retval @c true  if buffers are bound successfully, in which case sdd is valid
@@ -96,26 +577,307 @@ private:
      */
     bool genVoxRender(View * view, ShapeDrawData &sdd);
 
+    /**
+     * Generate OpenGL geometry for the isosurface of vox by marching cubes on the device, written straight into
+     * the buffers of geom when the device shares the OpenGL context and read back into them otherwise. Only redone
+     * after the volume changes. Falls back to extracting voxmesh on the CPU if the device fails.
+     * @param view      current view parameters
+     * @param[out] sdd  openGL parameters required to draw this geometry
+     * @retval @c true  if buffers are bound successfully, in which case sdd is valid
+     * @retval @c false otherwise
+     */
+    bool genDeviceRender(View * view, ShapeDrawData &sdd);
+
+    /// Extract voxmesh on the CPU if the current isosurface has so far only been extracted on the device
+    void hostSurface();
+
+    /**
+     * Choose the isosurface level of detail for the current view, so that the triangle count stays within a budget
+     * set by the screen area the scene covers at the current zoom distance
+     * @param view      current view parameters
+     * @returns level of detail for Mesh::bindGeometry, 0 for full resolution
+     */
+    int selectLOD(View * view);
+
     /**
      * Apply a boolean set operator given two volumetric operands.
      * @param op            boolean set operation being applied (union, intersection or difference). Applied as leftarg = leftarg op rightarg
      * @param[out] leftarg  first voxel grid argument. Overwritten as the result for space reasons.
      * @param rightarg      second voxel grid argument.
+     * @param lo, hi        optional inclusive voxel range outside of which the operation leaves leftarg unchanged
      */
-    void voxSetOp(SetOp op, VoxelVolume *leftarg, VoxelVolume *rightarg);
+    void voxSetOp(SetOp op, VoxelVolume *leftarg, VoxelVolume *rightarg, const int * lo = NULL, const int * hi = NULL);
 
     /**
-     * Convert a CSG tree into a VoxelVolume by evaluating it with a recursive depth-first walk
+     * Convert a CSG tree into a VoxelVolume by evaluating it with a recursive depth-first walk.
+     * Must be called from within a parallel region, since independent subtrees and tiles of each leaf are run as tasks.
+     * Set operations only combine voxels within the bounds recorded in the tree, which must be current.
      * @param root          root node of the CSG tree
-     * @param[out] voxels   volumetric representation of the CSG tree
+     * @param[out] voxels   volumetric representation of the CSG tree, which must be empty on entry
      */
     void voxWalk(SceneNode *root, VoxelVolume *voxels);
 
+    /**
+     * Find the subtrees that occur more than once in the csg tree with the same content, and evaluate each of
+     * them once into sharedvols, so that voxWalk copies the volume into every occurrence instead of walking it
+     * again. Volumes kept from the last run are reused if the frame is unchanged, which carries them across edits
+     * elsewhere in the tree, and those of subtrees that are no longer repeated are released. Also starts the
+     * progress count of the walk.
+     * @param frame     hash of the volume frame and of the settings that change the voxels of a subtree, or 0 to
+     *                  share nothing and release any kept volumes
+     */
+    void shareSubtrees(uint64_t frame);
+
+    /**
+     * Convert a CSG tree into a VoxelVolume by a depth-first walk, as for voxWalk, with leaves rasterised by glvox
+     * one after the other on the calling thread, which holds its context. Set operations run on the CPU, and a leaf
+     * glvox cannot draw is voxelised on the CPU by voxWalk.
+     * @param root          root node of the CSG tree
+     * @param[out] voxels   volumetric representation of the CSG tree, which must be empty on entry
+     * @retval true if the tree was evaluated,
+     * @retval false if the stage was cancelled
+     */
+    bool glWalk(SceneNode *root, VoxelVolume *voxels);
+
+    /**
+     * Evaluate the csg tree into vox with leaves rasterised by OpenGL
+     * @retval true if vox holds the tree,
+     * @retval false if there is no context or the stage was cancelled, leaving vox empty to be evaluated on the CPU
+     */
+    bool glVoxelise();
+
+    /**
+     * Convert a CSG tree into a device volume by a depth-first walk, as for voxWalk, with leaves and set operations
+     * run as kernels by clvox. A leaf without a kernel is voxelised on the CPU by voxWalk and uploaded.
+     * @param root  root node of the CSG tree
+     * @param vol   handle of the clvox volume receiving the result, empty on entry
+     * @retval true if the tree was evaluated,
+     * @retval false if the device ran out of volumes or failed, or the stage was cancelled
+     */
+    bool clWalk(SceneNode *root, int vol);
+
+    /**
+     * Evaluate the csg tree into vox on the OpenCL device, reading the finished volume back in one transfer
+     * @retval true if vox holds the tree,
+     * @retval false if there is no device, the volume does not fit it, or the evaluation failed, leaving vox to
+     *         be evaluated on the CPU
+     */
+    bool clVoxelise();
+
+    /**
+     * Convert a CSG tree into a DistanceField by a recursive depth-first walk, as for voxWalk. Leaves write
+     * distances within the band around their bounds and set operations combine only where the operand that
+     * matters lies within the band.
+     * @param root          root node of the CSG tree
+     * @param[out] field    distances to the scene surface, which must be filled with the band on entry
+     */
+    void sdfWalk(SceneNode *root, DistanceField *field);
+
+    /**
+     * Convert a CSG tree into a DexelVolume by a recursive depth-first walk, as for voxWalk. Parity mesh leaves
+     * write the spans found by scanning their rows and other leaves the runs of their batch containment, so no
+     * packed volume is ever made, and set operations merge the spans of the rows within the bounds of the operand
+     * that matters.
+     * Must be called from within a parallel region, since independent subtrees and tiles of each leaf are run as tasks.
+     * @param root          root node of the CSG tree
+     * @param[out] dexels   span representation of the CSG tree, which must be empty on entry
+     */
+    void dexelWalk(SceneNode *root, DexelVolume *dexels);
+
+    /**
+     * Take an empty intermediate span volume from dexpool, or allocate one if there are none spare
+     * @param like  volume whose dimensions and frame are copied
+     * @returns volume with every row empty, to be handed back to dexpool once used
+     */
+    DexelVolume * takeDexels(DexelVolume * like);
+
+    /**
+     * Take an empty intermediate volume from voxpool, or allocate one if there are none spare
+     * @param like  volume whose dimensions, frame and storage mode are copied
+     * @returns volume with every voxel unset, to be handed back to voxpool once used
+     */
+    VoxelVolume * takeVolume(VoxelVolume * like);
+
+    /**
+     * Take an intermediate field from sdfpool, or allocate one if there are none spare
+     * @param like  field whose dimensions, frame and band are copied
+     * @returns field filled with the band, to be handed back to sdfpool once used
+     */
+    DistanceField * takeField(DistanceField * like);
+
+    /**
+     * Voxelise a shape over a box of voxels by point containment, testing a row of voxels per batch
+     * @param shape         leaf shape
+     * @param[out] voxels   volume receiving the containment results
+     * @param lo, hi        inclusive voxel range of the box, aligned to whole words in x when tiles run concurrently
+     */
+    void voxTile(BaseShape * shape, VoxelVolume * voxels, const int * lo, const int * hi);
+
+    /**
+     * Voxelise a shape over an octree cell by refining only where the surface passes through. A cell whose middle
+     * is further from the surface than any of its voxel centres, by BaseShape::signedDistance, is filled or left
+     * empty as a whole, and straddling cells are split into octants down to voxoctreeleaf voxels, which are then
+     * tested individually with voxTile. Cells of at least voxoctreetask voxels run as tasks.
+     * @param shape         leaf shape
+     * @param[out] voxels   volume receiving the containment results, empty on entry
+     * @param corner        lowest voxel index of the cell, aligned to a whole word in x
+     * @param size          side of the cell in voxels, a power of two multiple of voxoctreetask or below it
+     * @param lo, hi        inclusive voxel range to voxelise, to which the cell is clipped
+     * @param share         fraction of the voxelisation progress the cell accounts for
+     */
+    void voxOctree(BaseShape * shape, VoxelVolume * voxels, const int * corner, int size, const int * lo, const int * hi, double share);
+
+    /**
+     * Install a new csg tree, whose voxels vox does not hold, deleting the previous tree unless it is the same one
+     * @param root  root of the new tree, which the scene takes ownership of
+     */
+    void setRoot(SceneNode * root);
+
+    /**
+     * Re-evaluate the csg tree within the dirty box alone, keeping the rest of vox as it is, and widen the range of
+     * voxel layers for isoextract to re-mesh
+     */
+    void voxeliseDirty();
+
+    /**
+     * Dimensions and frame of the volume voxelise would build, with a border of one voxel around the scene
+     * @param voxlen        side length of an individual voxel
+     * @param[out] dim      number of voxels in x (padded to whole words), y and z
+     * @param[out] corner, diag     frame of the volume, as for VoxelVolume::setFrame
+     */
+    void volumeFrame(float voxlen, int * dim, cgp::Point &corner, cgp::Vector &diag);
+
+    /**
+     * Choose how to hold the volume being voxelised so that it fits within any memory budget. The recursive walk
+     * holds an intermediate volume for each operation in flight, so it gives way to streaming, which in turn gives
+     * way to sparse bricks, whose size is only known once they are filled.
+     * @param xdim, ydim, zdim  dimensions of the volume
+     * @param[in,out] stream    evaluate the tree row by row rather than by recursive walk
+     * @param[out] sparse       hold the volume in sparse bricks
+     * @retval true  if the volume is expected to fit,
+     * @retval false if signed distances were asked for and do not fit
+     */
+    bool planVoxelMemory(int xdim, int ydim, int zdim, bool &stream, bool &sparse);
+
+    /**
+     * Voxelise the tree at one coarse voxel size and extract its isosurface as isoextract does, without changing the
+     * scene, timing each
+     * @param voxlen        side length of an individual voxel
+     * @param[out] voxels   voxels in the volume
+     * @param[out] voxsecs, cellsecs    seconds taken to voxelise and to extract the isosurface
+     * @param[out] cells    active marching cubes cells, counted if counting is compiled in and otherwise taken as
+     *                      half the triangles
+     * @param[out] tris     isosurface triangles
+     * @param[out] meshbytes    memory held by the isosurface
+     * @param[out] tests    containment tests made, or 0 if counting is not compiled in
+     */
+    void sampleCost(float voxlen, double &voxels, double &voxsecs, double &cellsecs, double &cells, double &tris, double &meshbytes,
+                    double &tests);
+
+    /**
+     * Fill in the predictions of an estimate from its fitted model
+     * @param voxlen        side length of an individual voxel
+     * @param[in,out] est   estimate with its model fitted
+     */
+    void predictCost(float voxlen, ResolutionEstimate &est);
+
+    /**
+     * Write a coarse occupancy grid of the voxel volume, one cell per xspan voxels, to meshes/voxel/voxelisedgrid
+     */
+    void writeVoxelGrid();
+
+    /// Apply the connected component cleanup chosen by setKeepLargest and setFillVoids to the voxel volume
+    void cleanVoxels();
+
+    /**
+     * Mesh holding the block surface of the voxel scenes. A single leaf for it becomes the tree if it is not
+     * already, so loading one voxel scene after another reuses the same leaf and mesh.
+     * @returns block mesh, owned by the tree
+     */
+    Mesh * blockMesh();
+
+    /**
+     * Replace the tree with a single leaf holding the exposed surface of the voxel volume, treating each occupied
+     * voxel as a cube of side blocklen, and fit the result to the display volume. Uses greedy meshing if enabled.
+     */
+    void meshBlocks();
+
+    /**
+     * Add the structure of a csg subtree and the content of its leaf shapes to a hash
+     * @param node  root of the subtree
+     * @param hash  hash being accumulated
+     */
+    void hashTree(SceneNode * node, ContentHash &hash);
+
+    /**
+     * Location of a cached stage result
+     * @param key   hash of everything the result depends on
+     * @param ext   file extension for the type of result
+     * @returns path within the cache directory
+     */
+    std::string cachePath(const ContentHash &key, const std::string &ext);
+
+    /**
+     * Move a freshly written cache file into place, so that a partially written file is never found under its final name
+     * @param tmpfile   file that has just been written
+     * @param cachefile final cache path
+     * @param written   whether writing tmpfile succeeded
+     */
+    void commitCache(const std::string &tmpfile, const std::string &cachefile, bool written);
+
+    /**
+     * Location of a cached mesh, in the format chosen by setCacheCompression
+     * @param key   hash of everything the mesh depends on
+     * @returns path within the cache directory
+     */
+    std::string meshCachePath(const ContentHash &key);
+
+    /**
+     * Load a cached mesh written by writeMeshCache
+     * @param mesh      mesh to replace
+     * @param cachefile path from meshCachePath
+     * @retval true  if the cache held the mesh and it loaded,
+     * @retval false otherwise
+     */
+    bool readMeshCache(Mesh * mesh, const std::string &cachefile);
+
+    /**
+     * Write a mesh to the cache, in the format chosen by setCacheCompression
+     * @param mesh      mesh to save
+     * @param cachefile path from meshCachePath
+     */
+    void writeMeshCache(Mesh * mesh, const std::string &cachefile);
+
+    /**
+     * Parse one node of a scene description and, for a set operation, its operands
+     * @param tok       tokenizer positioned at the start of the node
+     * @param dir       directory of the scene file, against which relative mesh paths are resolved
+     * @param filename  name of the scene file, for error messages
+     * @param defs      subtrees named by define so far, added to by definitions within the node
+     * @returns root of the parsed subtree, or NULL on a syntax error or unreadable mesh
+     */
+    SceneNode * parseNode(TextTokenizer &tok, const std::string &dir, const std::string &filename,
+                          std::unordered_map<std::string, std::shared_ptr<const SubtreeAsset>> &defs);
+
+    /**
+     * Load a mesh file, or its welded form from the cache if this file has been loaded before
+     * @param[out] mesh     mesh to fill
+     * @param filename      STL, OBJ or indexed mesh file
+     * @retval true  if the mesh was loaded,
+     * @retval false otherwise
+     */
+    bool loadMesh(Mesh * mesh, string filename);
+
+    /**
+     * Find the shared asset for a mesh file, loading it through loadMesh if it is not held or the file has changed
+     * @param filename  STL, OBJ or indexed mesh file
+     * @returns shared asset, or an empty pointer if the file could not be loaded
+     */
+    std::shared_ptr<const MeshAsset> loadAsset(const std::string &filename);
+
 public:
 
     ShapeGeometry geom;         ///< triangle mesh geometry for scene
-    ShapeNode * finalMesh = new ShapeNode();
-    Mesh * accCube = new Mesh();
 
     /// Default constructor
     Scene();
@@ -123,7 +885,7 @@ public:
     /// Destructor
     ~Scene();
 
-    /// Reset CSG tree
+    /// Delete the CSG tree and empty the voxel volume
     void clear();
 
     /**
@@ -135,31 +897,472 @@ public:
      */
     bool bindGeometry(View * view, ShapeDrawData &sdd);
 
+    /**
+     * Bind the extracted isosurface in its undeformed state, to be warped by the lattice in the vertex shader
+     * during interactive editing, with the deformation itself only committed by deform
+     * @param view      current view parameters
+     * @param[out] sdd  openGL parameters required to draw this geometry
+     * @param[out] model    transformation to apply after deformation
+     * @retval @c true  if an isosurface is bound successfully, in which case sdd is valid
+     * @retval @c false otherwise, including for representations other than an isosurface
+     */
+    bool bindDeformGeometry(View * view, ShapeDrawData &sdd, glm::mat4x4 &model);
+
     /**
      * Access voxel volume associated with scene
      */
     VoxelVolume * getVox(){ return &vox; }
 
     /**
-     * Access mesh extracted from voxel volume
+     * Access mesh extracted from voxel volume, extracting it first if it has only been drawn from the device
+     */
+    Mesh * getMesh(){ hostSurface(); return &voxmesh; }
+
+    /**
+     * Choose how leaf nodes holding a Mesh are voxelised
+     * @param scan  if true cast one ray per voxel row (Mesh::scanVoxelise), otherwise test each voxel independently
+     */
+    void setScanVoxelise(bool scan){ scanmesh = scan; }
+
+    /// Number of mesh files currently held as shared assets
+    int numMeshAssets(){ return assets.size(); }
+
+    /**
+     * Choose how the voxel block scenes are meshed
+     * @param greedy    if true merge coplanar exposed faces into maximal rectangles, otherwise emit one quad per voxel face
+     */
+    void setGreedyBlocks(bool greedy){ greedyblocks = greedy; }
+
+    /**
+     * Choose how the csg tree is evaluated by voxelise
+     * @param stream    if true run a compiled CSGProgram row by row, otherwise walk the tree with a volume per subtree
+     */
+    void setStreamCSG(bool stream){ streamcsg = stream; }
+
+    /**
+     * Choose the triangle budget of the isosurface level of detail chosen by bindGeometry
+     * @param moving    if true the view is moving, and the budget is lodinteractivescale times smaller
+     */
+    void setInteractive(bool moving){ interactive = moving; }
+
+    /// Returns true if bindGeometry draws a level of detail that depends on the view, as it does for an isosurface held on the CPU
+    bool hasLevelsOfDetail(){ return rep == SceneRep::ISOSURFACE && !devsurface; }
+
+    /**
+     * Choose whether voxelise evaluates the csg tree as lists of occupied spans along each row, merging the lists
+     * for set operations, which costs the number of surface crossings rather than the number of voxels and keeps
+     * intermediate volumes small at fine resolutions. Ignored when streaming with setStreamCSG, or when a GPU
+     * backend evaluates the tree.
+     * @param dexels    if true evaluate span lists, packed into the voxel volume once the tree is done
+     */
+    void setDexelCSG(bool dexels){ dexelcsg = dexels; }
+
+    /**
+     * Choose whether voxelise walks the csg tree on an OpenCL device, ahead of the choice made by setStreamCSG.
+     * Dense volumes only, and anything the device cannot do is done on the CPU instead.
+     * @param gpu   if true use the first GPU, or other OpenCL device, found
+     */
+    void setGPUVoxelise(bool gpu){ gpuvox = gpu; }
+
+    /**
+     * Look for an OpenCL device for setGPUVoxelise, on first use
+     * @retval true if there is one,
+     * @retval false if there is none or the build has no OpenCL support
+     */
+    bool hasGPUVoxeliser(){ return clvox.available(); }
+
+    /**
+     * Choose whether voxelise rasterises the triangles of csg leaves with OpenGL, for machines without an OpenCL
+     * device. Used only when setGPUVoxelise finds no device, or is off. Primitives are voxelised to their
+     * tessellation, and set operations still run on the CPU.
+     * @param raster    if true rasterise leaves, when shareGL has provided for a context
+     */
+    void setGLVoxelise(bool raster){ rastervox = raster; }
+
+    /**
+     * Try an OpenGL context for setGLVoxelise, on first use
+     * @retval true if there is one,
+     * @retval false if shareGL was never called, the driver is too old or the build has no OpenGL
+     */
+    bool hasGLVoxeliser(){ return glvox.available(); }
+
+    /**
+     * Choose whether isoextract leaves the isosurface of a voxel volume to be extracted on an OpenCL device when it
+     * is next drawn, instead of extracting the mesh on the CPU. The mesh is still extracted on the CPU when smooth,
+     * deform or getMesh need it. Surfaces of signed distances are always extracted on the CPU.
+     * @param gpu   if true extract on the device, when there is one
+     */
+    void setGPUIsosurface(bool gpu){ gpusurface = gpu; }
+
+    /**
+     * Choose how a voxel volume is previewed by bindGeometry, before any isosurface is extracted
+     * @param march     if true ray march the packed words on the GPU, skipping empty blocks, otherwise instance a cube
+     *                  at every surface voxel
+     */
+    void setRayMarchVoxels(bool march){ marchvox = march; }
+
+    /**
+     * Let the OpenCL device write isosurfaces into OpenGL buffers, sharing the OpenGL context current on the
+     * calling thread, which must be the one that binds geometry, and provide for the contexts of setGLVoxelise
+     */
+    void shareGL(){ clvox.shareGL(); glvox.shareGL(); }
+
+    /**
+     * Choose whether voxelise simplifies the csg tree first
+     * @param simplify  if true apply simplifyTree before evaluating the tree
+     */
+    void setSimplifyCSG(bool simplify){ simplifycsg = simplify; }
+
+    /**
+     * Choose whether subtrees that occur more than once in the csg tree, with the same shapes, transforms and set
+     * operations, are evaluated once and copied into each occurrence
+     * @param share     if true evaluate each distinct repeated subtree once
+     */
+    void setShareSubtrees(bool share){ sharesubtrees = share; }
+
+    /// Number of volumes of repeated subtrees kept from the last voxelise for reuse by the next
+    int getNumSharedSubtrees(){ return (int) sharedvols.size(); }
+
+    /// Representation currently held, which follows the last stage run or snapshot restored
+    SceneRep getRep(){ return rep; }
+
+    /**
+     * Choose whether recordStage keeps a snapshot after each stage, so that stages can be undone. Turning it off
+     * discards the history.
+     * @param on    if true keep snapshots
+     */
+    void setHistory(bool on){ keephistory = on; if(!on) clearHistory(); }
+
+    /// Returns true if stages are being recorded for undo
+    bool isHistoryEnabled(){ return keephistory; }
+
+    /**
+     * Snapshot the voxels and isosurface after a stage, if history is enabled, and publish them, if publishing is
+     * @param stage     name of the stage that just completed
+     */
+    void recordStage(const std::string &stage){ if(keephistory) takeSnapshot(stage); if(publishing) publish(stage); }
+
+    /**
+     * Snapshot the voxels and isosurface as a child of the current snapshot. Arrays unchanged since the current
+     * snapshot are shared with it rather than copied, so a smoothing step holds only its new vertices and normals.
+     * @param stage     name of the stage that produced the state
+     * @returns index of the new snapshot, which becomes the current one
+     */
+    int takeSnapshot(const std::string &stage);
+
+    /**
+     * Return the voxels and isosurface to those of a snapshot on any branch. Incremental voxelisation and re-meshing
+     * restart from scratch afterwards, and the isosurface is extracted from the occupancy volume rather than from
+     * signed distances, which are not recorded.
+     * @param index     snapshot index, from 0 to getNumSnapshots()-1
+     * @retval true  if the snapshot was restored,
+     * @retval false if there is no such snapshot
+     */
+    bool restoreSnapshot(int index);
+
+    /**
+     * Restore the parent of the current snapshot
+     * @retval true  if there was a parent to restore,
+     * @retval false otherwise
+     */
+    bool undo();
+
+    /**
+     * Restore the most recently taken child of the current snapshot, following the branch last undone or taken
+     * @retval true  if there was a child to restore,
+     * @retval false otherwise
+     */
+    bool redo();
+
+    /// Index of the current snapshot, or -1 if there is none
+    int getSnapshot(){ return snapcurrent; }
+
+    /// Number of snapshots held
+    int getNumSnapshots(){ return (int) history.size(); }
+
+    /// Snapshot @a index, which must exist
+    const SceneSnapshot & getSnapshotInfo(int index){ return * history[index]; }
+
+    /// Storage held by all snapshots together, counting shared chunks once
+    size_t getHistoryBytes();
+
+    /// Discard every snapshot
+    void clearHistory(){ history.clear(); snapcurrent = -1; }
+
+    /**
+     * Choose whether recordStage publishes each completed stage for readers on other threads
+     * @param on    if true publish after every recorded stage
+     */
+    void setPublishing(bool on){ publishing = on; }
+
+    /**
+     * Make the current voxels and isosurface available to readers on other threads, replacing the last view in one
+     * atomic step. The view shares unchanged chunks with the previous one and with the current snapshot of the
+     * history, so it costs little beyond the arrays the latest stage changed. Only the thread running the stages may
+     * publish, and only between stages.
+     * @param stage     name of the stage that produced the state
+     */
+    void publish(const std::string &stage);
+
+    /**
+     * The view last published, which any thread may take at any time, even while a stage is running. The view never
+     * changes, and stays valid for as long as it is held whatever the scene goes on to do, so viewers, exports and
+     * statistics restore it into a volume or mesh of their own, with VoxelVolume::restoreSnapshot and
+     * Mesh::restoreSnapshot, without locking and without holding up the next stage.
+     * @returns published view, or an empty pointer if nothing has been published
+     */
+    std::shared_ptr<const SceneSnapshot> getPublished() const { return std::atomic_load(&published); }
+
+    /**
+     * Choose whether voxelise applies combineMeshes before evaluating the tree
+     * @param direct    if true set operations between meshes are computed on their surfaces
+     */
+    void setMeshBooleans(bool direct){ meshbools = direct; }
+
+    /**
+     * Choose how leaf shapes that are not scanned by row are voxelised
+     * @param adaptive  if true refine an octree near the surface (voxOctree), so the number of containment queries
+     *                  grows with surface area rather than volume, otherwise test every voxel in the shape bounds
+     */
+    void setAdaptiveVoxelise(bool adaptive){ adaptivevox = adaptive; }
+
+    /**
+     * Choose what voxelise evaluates. Distances let isoextract place vertices to within a fraction of a voxel,
+     * so coarser voxels give the same surface quality, at the cost of a float per voxel. Stage caching of
+     * voxelise and streamed evaluation apply to occupancy only.
+     * @param distances if true evaluate a signed distance field and threshold it for the voxel representation,
+     *                  otherwise evaluate occupancy directly
+     */
+    void setDistanceField(bool distances){ distfield = distances; }
+
+    /**
+     * Choose whether voxelise drops disconnected islands, such as slivers left by csg, so they are not meshed.
+     * Ignored when voxelising to distances, and edits then re-evaluate the whole volume, since removing an island
+     * may change voxels far from the edit.
+     * @param largest   if true keep only the largest face-connected component of occupied voxels
+     */
+    void setKeepLargest(bool largest){ keeplargest = largest; }
+
+    /**
+     * Choose whether voxelise fills voids trapped inside the part. Ignored when voxelising to distances, and
+     * edits then re-evaluate the whole volume, as for setKeepLargest.
+     * @param voids     if true fill every empty component that does not reach a face of the volume
+     */
+    void setFillVoids(bool voids){ fillvoids = voids; }
+
+    /**
+     * Choose how isoextract builds the surface. The dual surface has one vertex per surface cell, by surface nets on
+     * the voxels or by dual contouring on distances, and about half the triangles of marching cubes. It is always
+     * extracted in full on the CPU, rather than re-meshing only the layers changed by edits or drawing from the device.
+     * @param dual      if true extract the dual surface, otherwise use marching cubes
+     */
+    void setDualSurface(bool dual){ dualsurface = dual; }
+
+    /**
+     * Access the signed distance representation, valid after voxelise with setDistanceField(true)
+     */
+    DistanceField * getDistanceField(){ return &sdf; }
+
+    /// Number of leaf shapes in the csg tree, which replaceShape indexes in depth-first, left to right order
+    int getNumShapes();
+
+    /**
+     * Swap the shape at a leaf of the csg tree for another, as when a primitive is moved or resized. The next voxelise
+     * at the same voxel size then re-evaluates only the region covered by the old and new bounds of the shape, and
+     * the isoextract after it re-meshes only the slabs of layers that region touches. That holds for any number of
+     * replacements in between, as long as the tree is otherwise unchanged and distances are not being voxelised.
+     * Leaves are counted in the tree as it stands, which simplifyTree may have pruned.
+     * @param leaf      index of the leaf, from 0 to getNumShapes()-1
+     * @param shape     new shape, which the scene takes ownership of on success
+     * @retval true  if the shape was replaced, and the old one deleted,
+     * @retval false if there is no such leaf
+     */
+    bool replaceShape(int leaf, BaseShape * shape);
+
+    /**
+     * Rewrite the csg tree into a cheaper equivalent using the bounds of its shapes. Intersections of disjoint
+     * operands are removed as empty, differences by an operand clear of the left one are replaced by the left operand,
+     * and left-deep chains of differences become a difference by a union. Chains of unions or intersections are then
+     * rebuilt as balanced trees, split at the median of their operands along the widest axis, so that independent
+     * subtrees voxelise concurrently and nearby shapes are combined first. Removed nodes are deleted along with their
+     * shapes. The tree becomes empty if the whole scene is.
+     */
+    void simplifyTree();
+
+    /**
+     * Replace every set operation whose operands are both meshes, working up from the leaves, with a single mesh
+     * leaf holding the result computed on their surfaces by Mesh::booleanOf. The combined meshes then voxelise as one
+     * leaf, and their exact intersection curves survive into the surface rather than being resampled on the voxel
+     * grid. Operands must be closed and consistently wound. Leaves are counted afterwards as for simplifyTree.
+     */
+    void combineMeshes();
+
+    /**
+     * Enable the on-disk cache of pipeline stage results. Loaded meshes are keyed on the file contents, voxelise on
+     * the csg tree and voxel size, isoextract on the voxel contents, and smooth on the isosurface, so a stage whose
+     * inputs are unchanged is loaded rather than recomputed.
+     * @param dir   directory for cached results, created if necessary, or empty to disable caching
+     */
+    void setCacheDirectory(std::string dir);
+
+    /// Directory of cached stage results, empty if caching is disabled
+    const std::string & getCacheDirectory(){ return cachedir; }
+
+    /**
+     * Toggle caching meshes in the compressed format of MeshCodec, which takes several times less disk and reads
+     * faster for large isosurfaces but quantises positions to 16 bits of the bounding box and normals to 12 bits.
+     * Compressed and exact results are cached separately. Off by default.
+     * @param on    true to compress cached meshes
+     */
+    void setCacheCompression(bool on){ cachecompress = on; }
+
+    /**
+     * Set the Taubin smoothing applied by smooth
+     * @param iter      shrink and inflate pairs
+     * @param rate      shrinking factor
+     * @param passband  pass-band frequency, which sets the inflating factor
+     */
+    void setSmoothing(int iter, float rate, float passband = taubinpassband){ smoothpairs = iter; smoothshrink = rate; smoothband = passband; }
+
+    /**
+     * Set the voxel side length that require voxelises at
+     * @param voxlen    side length of an individual voxel
+     */
+    void setVoxelSize(float voxlen){ reqvoxlen = voxlen; }
+
+    /**
+     * Set the lattice that require deforms the smoothed isosurface by
+     * @param def   lattice, which is copied, or NULL to leave the smoothed isosurface undeformed
+     */
+    void setLattice(ffd * def);
+
+    /**
+     * Is a stage, or any stage it depends on, out of date with the tree and the parameters set for require?
+     * @param stage     stage to check
+     */
+    bool isStale(SceneStage stage);
+
+    /// Version of the current output of a stage, which changes whenever the output does, or 0 if there is none
+    uint64_t getStageVersion(SceneStage stage){ return stamps[(int) stage].version; }
+
+    /**
+     * Bring the scene up to date with a stage for a consumer such as the display, an export or statistics, computing
+     * only the stages that are stale. Parameters come from setVoxelSize, the voxelise and isoextract options,
+     * setSmoothing and setLattice, so they can be changed in any order and only what they affect is recomputed when
+     * next required. The raw and smoothed isosurfaces are kept as snapshots when a later stage is built on them, so
+     * that changing the smoothing or the lattice starts from them rather than extracting again. The voxelise,
+     * isoextract, smooth and deform stages can still be run directly, and stamp their results so that require builds
+     * on them where it can.
+     * @param stage     stage whose output is wanted
+     * @retval true  if the scene holds the output of the stage, as the representation getRep reports,
+     * @retval false if there is no tree, no voxel size, or a stage failed or was cancelled
+     */
+    bool require(SceneStage stage);
+
+    /**
+     * Report the progress of voxelise, isoextract and smooth, which also lets them be cancelled from another thread.
+     * Voxelisation stops between tiles once cancelled, while the other stages only check before they start.
+     * @param track progress shared with the watcher, or NULL to stop reporting. Must outlive any running stage.
      */
-    Mesh * getMesh(){ return &voxmesh; }
+    void setProgress(StageProgress * track){ progress = track; }
 
     /**
      * convert csg tree into a voxel representation
      * @param voxlen    side length of an individual voxel
+     * @retval true  if the volume is complete,
+     * @retval false if the stage was cancelled, which leaves the scene in its tree representation
+     */
+    bool voxelise(float voxlen);
+
+    /**
+     * Voxelise and extract the isosurface progressively, first at each of the coarser previewfactors and then at full
+     * resolution, so that a rough result is available after a small fraction of the full cost. Each level is
+     * evaluated from the tree and replaces the previous one, since deriving it from a finer level would mean
+     * waiting for that level first.
+     * @param voxlen    side length of an individual voxel at full resolution
+     * @param publish   called once the voxels and isosurface of each level are in place, with its voxel size multiple
+     *                  (1 for full resolution). Returning false skips the remaining levels.
+     * @retval true  if the full resolution level was reached,
+     * @retval false if a stage was cancelled or publish stopped early
+     */
+    bool voxeliseProgressive(float voxlen, const std::function<bool(int)> &publish);
+
+    /**
+     * Predict the time, memory and triangle count of voxelise followed by isoextract at a voxel size, by sampling the
+     * tree at each of the tunesamples resolutions, tunerepeats times each, and scaling up. Only the plain occupancy path is modelled, not
+     * signed distances, sparse bricks or the device voxelisers. The scene keeps its current representation.
+     * @param voxlen        side length of an individual voxel
+     * @param[out] est      prediction, along with the fitted model
+     * @retval true  if the prediction was made,
+     * @retval false if the scene has no tree or voxlen is not positive
      */
-    void voxelise(float voxlen);
+    bool estimateResolution(float voxlen, ResolutionEstimate &est);
+
+    /**
+     * Choose the finest voxel size whose predicted cost, as for estimateResolution, fits within a time and memory
+     * budget, so that a run can be sized before it is started
+     * @param seconds       time allowed for voxelise and isoextract, or 0 for no limit
+     * @param bytes         memory allowed for the volume and isosurface, or 0 for no limit
+     * @param[out] est      prediction at the chosen voxel size
+     * @retval true  if a voxel size within the budget was found,
+     * @retval false if there is no tree, neither budget is set, or even the coarsest sample does not fit
+     */
+    bool tuneResolution(double seconds, size_t bytes, ResolutionEstimate &est);
 
     /**
      * convert voxel representation back into a mesh using marching cubes
+     * @retval true  if the isosurface was extracted,
+     * @retval false if the stage was cancelled before it started
+     */
+    bool isoextract();
+
+    /**
+     * Voxelise the csg tree into a run-length compressed voxel file, as for voxelise but evaluating a slab of
+     * voxslablayers layers at a time and appending each to the file as it is done, so that only one slab and the
+     * compressed layers are ever held. The scene keeps its current representation.
+     * @param voxlen    side length of an individual voxel
+     * @param filename  compressed voxel file to write, as read by VoxelStreamReader
+     * @retval true  if the whole volume was written,
+     * @retval false if the file could not be written or the stage was cancelled
      */
-    void isoextract();
+    bool voxeliseToFile(float voxlen, const std::string &filename);
 
     /**
-     * smooth extracted isosurface to improve on aliasing artefacts that result from marching cubes
+     * Extract the isosurface from a compressed voxel file with marching cubes, decompressing rows as they are needed
+     * rather than loading the volume
+     * @param filename  compressed voxel file, as written by voxeliseToFile
+     * @retval true  if the isosurface was extracted,
+     * @retval false if the file could not be read or the stage was cancelled before it started
      */
-    void smooth();
+    bool isoextractFile(const std::string &filename);
+
+    /**
+     * Out of core voxelise and isosurface extraction for parts whose volume does not fit in memory. The tree is
+     * evaluated a slab of voxslablayers cell layers at a time, plus the slice of voxels shared with the next slab,
+     * which is carried over rather than evaluated again. Each slab goes straight through marching cubes and its
+     * triangles are handed on, so peak memory follows the slab rather than the part. The scene keeps its current
+     * representation.
+     * @param voxlen    side length of an individual voxel
+     * @param consume   called with the vertices and flattened triangle vertex indices of each slab in turn, as
+     *                  given by Mesh::marchingCubesSlab. Returning false stops the extraction.
+     * @param tile      index of the band of cell layers to extract, from 0 to numtiles - 1
+     * @param numtiles  number of equal bands the cell layers are divided into, so that separate processes or machines
+     *                  can each extract one. Every band evaluates its own voxel layers, including the layer it shares
+     *                  with the band below, and places vertices in the frame of the whole volume, so the triangles of
+     *                  all the bands together are those of a single extraction.
+     * @retval true  if every slab was extracted and accepted,
+     * @retval false if consume stopped the extraction, the stage was cancelled or the tile does not exist
+     */
+    bool extractSlabs(float voxlen, const std::function<bool(const std::vector<cgp::Point> &, const std::vector<int> &)> &consume,
+                      int tile = 0, int numtiles = 1);
+
+    /**
+     * smooth extracted isosurface to improve on aliasing artefacts that result from marching cubes, using Taubin
+     * smoothing so that the part does not shrink
+     * @retval true  if the isosurface was smoothed,
+     * @retval false if the stage was cancelled before it started
+     */
+    bool smooth();
 
     /**
      * apply free-form deformation to extracted isosurface
@@ -167,6 +1370,66 @@ public:
      */
     void deform(ffd * def);
 
+    /**
+     * Replace the csg tree with one read from a scene description. The tree is listed in prefix order, with each
+     * set operation followed by its left and right operands:
+     *
+     *     union | intersection | difference <left> <right>
+     *     sphere <cx> <cy> <cz> <radius>
+     *     cylinder <sx> <sy> <sz> <ex> <ey> <ez> <radius>
+     *     square <cx> <cy> <cz> <length>
+     *     mesh <file> [fit <length>] [scale <s>] [rotate <ax> <ay> <az>] [translate <x> <y> <z>]
+     *     define <name> <subtree> <node>
+     *     place <name> [scale <s>] [rotate <ax> <ay> <az>] [translate <x> <y> <z>]
+     *     transform [scale <s>] [rotate <ax> <ay> <az>] [translate <x> <y> <z>] <subtree>
+     *
+     * Layout is free and # starts a comment that runs to the end of the line. Mesh paths may not contain spaces and
+     * are relative to the scene file. A mesh is optionally fitted to a cube of the given side, as by Mesh::boxFit,
+     * and then scaled, rotated by angles in degrees about x, y and z, and translated. A define names a subtree for
+     * the node that follows it, in which every place of the name is a SubtreeInstance sharing that one subtree, and
+     * transform places a subtree of its own. Placements are scaled, rotated and translated as meshes are.
+     * @param filename  name of scene file
+     * @retval true  if the whole file was parsed, in which case the tree is replaced,
+     * @retval false otherwise, leaving the current tree in place
+     */
+    bool readSceneFile(std::string filename);
+
+    /**
+     * Write the session, meaning the csg tree, the stage settings, the voxel volume and the isosurface, to a binary
+     * Boost archive, so that it can be restored later or handed to another process as a unit of work. Vertex,
+     * triangle and voxel arrays are written as single blocks, and a mesh placed by several instance leaves is
+     * written once. Signed distances, device settings, the cache directory and the undo history are not written.
+     * @param out   binary output stream
+     * @retval true  if the session was written,
+     * @retval false otherwise
+     */
+    bool writeSession(std::ostream &out);
+
+    /// Write the session to a file, as for writeSession(std::ostream &)
+    bool writeSession(const std::string &filename);
+
+    /**
+     * Write the voxelised part to an OpenVDB file for other tools: the signed distances as a level set when the
+     * last voxelise produced them, otherwise the occupancy volume as a bool grid
+     * @param filename  name of file to save
+     * @retval true  if save succeeds,
+     * @retval false otherwise, including builds without OPENVDB
+     */
+    bool writeVDB(const std::string &filename);
+
+    /**
+     * Replace the scene with a session written by writeSession. The undo history is discarded, and the next
+     * voxelise and isoextract start from scratch, extracting from occupancy since signed distances are not saved.
+     * @param in    binary input stream
+     * @retval true  if the session was read,
+     * @retval false otherwise, leaving the scene as it was if the stream does not hold a session and empty if it
+     *               holds a damaged one
+     */
+    bool readSession(std::istream &in);
+
+    /// Read a session from a file, as for readSession(std::istream &)
+    bool readSession(const std::string &filename);
+
     /**
      * create a sample csg tree to test different shapes and operators
      */
@@ -179,8 +1442,27 @@ public:
 
     /**
      * create a sample csg tree to load a mesh
+     * @param filename  STL, OBJ or indexed mesh file
+     * @retval true  if the mesh was loaded,
+     * @retval false otherwise, leaving an empty mesh in the tree
      */
-    void loadSTLScene(string filename);
+    bool loadSTLScene(string filename);
+
+    /**
+     * Load and fit a mesh file as loadSTLScene does, without touching the tree, so that another scene can do it ahead
+     * of time, as Prefetcher does. Reads and writes the same cache as this scene's other stages.
+     * @param[out] mesh     receives the loaded mesh
+     * @param filename      STL, OBJ or indexed mesh file
+     * @retval true  if the mesh was loaded,
+     * @retval false otherwise
+     */
+    bool prepareSTL(Mesh * mesh, string filename);
+
+    /**
+     * Make a loaded mesh the whole tree, as loadSTLScene does once it has read the file
+     * @param object    mesh, which the tree takes ownership of
+     */
+    void setMeshScene(Mesh * object);
 
     /**
      * create a sample csg tree to hold a sphere mesh
@@ -193,20 +1475,25 @@ public:
     void expensiveScene(string filename);
 
     /**
-    * Read grid from file into voxel volume
-    * @param filename, len      name of local grid file and length of dimensions
+    * Read grid from file into voxel volume. Binary voxel files (see VoxelVolume::writeVoxels) and OpenVDB bool grids
+    * are loaded directly, otherwise the file is parsed as a text grid with one digit per voxel.
+    * Grid dimensions are taken from the binary header, or implied by the first slice of a text grid.
+    * @param filename   name of local grid file
+    * @retval true  if load succeeds,
+    * @retval false otherwise.
     */
-    void readGridVV(std::string filename, int len);
+    bool readGridVV(std::string filename);
 
     /**
-     * Voxel display scene based on new voxel read input
+     * Voxel display scene based on new voxel read input, with a cube for each occupied voxel. Built from the
+     * block surface, as for voxelMeshScene, rather than as a union of one cube mesh per voxel.
      */
     void displayVoxelScene(string filename);
 
     /**
-     * Voxel scene based on new voxel read input
+     * Voxel scene of four separate cubes, three of which lie a cube's width from the first along x, z and y
      */
-    void voxelScene(string filename);
+    void voxelScene();
 
     /**
      * New test voxel scene based on new voxel read input
@@ -0,0 +1,330 @@
+//
+// MeshDecimator
+//
+
+#include "decimate.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+void Quadric::addPlane(double a, double b, double c, double d, double w)
+{
+    q[0] += w*a*a; q[1] += w*a*b; q[2] += w*a*c; q[3] += w*a*d;
+    q[4] += w*b*b; q[5] += w*b*c; q[6] += w*b*d;
+    q[7] += w*c*c; q[8] += w*c*d;
+    q[9] += w*d*d;
+}
+
+double Quadric::error(const cgp::Point &p) const
+{
+    double x = p.x, y = p.y, z = p.z;
+
+    return x*(q[0]*x + 2.0*(q[1]*y + q[2]*z + q[3])) + y*(q[4]*y + 2.0*(q[5]*z + q[6])) + z*(q[7]*z + 2.0*q[8]) + q[9];
+}
+
+bool Quadric::optimum(cgp::Point &p) const
+{
+    // solve A p = -b by Cramer's rule, with the determinant compared against the scale of A
+    double c00 = q[4]*q[7] - q[5]*q[5], c01 = q[2]*q[5] - q[1]*q[7], c02 = q[1]*q[5] - q[2]*q[4];
+    double det = q[0]*c00 + q[1]*c01 + q[2]*c02, scale = q[0] + q[4] + q[7];
+    double c11 = q[0]*q[7] - q[2]*q[2], c12 = q[1]*q[2] - q[0]*q[5], c22 = q[0]*q[4] - q[1]*q[1];
+
+    if(scale <= 0.0 || std::fabs(det) <= 1e-6 * scale * scale * scale)
+        return false;
+    p.x = (float) (-(c00*q[3] + c01*q[6] + c02*q[8]) / det);
+    p.y = (float) (-(c01*q[3] + c11*q[6] + c12*q[8]) / det);
+    p.z = (float) (-(c02*q[3] + c12*q[6] + c22*q[8]) / det);
+    return true;
+}
+
+/// Unnormalised normal of the triangle (a, b, c), with length twice its area
+static void faceNormal(const cgp::Point &a, const cgp::Point &b, const cgp::Point &c, double * n)
+{
+    double e1[3] = {b.x - a.x, b.y - a.y, b.z - a.z}, e2[3] = {c.x - a.x, c.y - a.y, c.z - a.z};
+
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+MeshDecimator::Collapse MeshDecimator::evaluate(int u, int v)
+{
+    Collapse c;
+    Quadric sum = quadrics[u];
+    cgp::Point cand[3], opt;
+    double dx, dy, dz, reach;
+
+    sum.add(quadrics[v]);
+    c.u = u; c.v = v;
+    c.stampu = stamp[u]; c.stampv = stamp[v];
+
+    cand[0] = pos[u];
+    cand[1] = pos[v];
+    cand[2] = cgp::Point(0.5f * (pos[u].x + pos[v].x), 0.5f * (pos[u].y + pos[v].y), 0.5f * (pos[u].z + pos[v].z));
+
+    // a nearly singular quadric can put its minimum far from the edge, so only accept one close to the midpoint
+    reach = (double) (pos[u].x - pos[v].x) * (pos[u].x - pos[v].x) + (double) (pos[u].y - pos[v].y) * (pos[u].y - pos[v].y)
+            + (double) (pos[u].z - pos[v].z) * (pos[u].z - pos[v].z);
+    if(sum.optimum(opt))
+    {
+        dx = opt.x - cand[2].x; dy = opt.y - cand[2].y; dz = opt.z - cand[2].z;
+        if(dx*dx + dy*dy + dz*dz <= reach)
+        {
+            c.pos = opt;
+            c.cost = std::max(sum.error(opt), 0.0);
+            return c;
+        }
+    }
+
+    c.pos = cand[0];
+    c.cost = sum.error(cand[0]);
+    for(int i = 1; i < 3; i++)
+    {
+        double err = sum.error(cand[i]);
+        if(err < c.cost)
+        {
+            c.cost = err;
+            c.pos = cand[i];
+        }
+    }
+    c.cost = std::max(c.cost, 0.0);
+    return c;
+}
+
+void MeshDecimator::neighbours(int v, std::vector<int> &nbrs)
+{
+    nbrs.clear();
+    for(int f : vfaces[v])
+        if(facelive[f])
+            for(int p = 0; p < 3; p++)
+                if(faces[3*f+p] != v)
+                    nbrs.push_back(faces[3*f+p]);
+    std::sort(nbrs.begin(), nbrs.end());
+    nbrs.erase(std::unique(nbrs.begin(), nbrs.end()), nbrs.end());
+}
+
+bool MeshDecimator::allowed(const Collapse &c)
+{
+    std::vector<int> &ringu = ring[0], &ringv = ring[1], &common = ring[2];
+    int shared = 0;
+
+    // link condition: the endpoints may only share the vertices opposite the edge, or the collapse pinches the surface
+    neighbours(c.u, ringu);
+    neighbours(c.v, ringv);
+    common.clear();
+    std::set_intersection(ringu.begin(), ringu.end(), ringv.begin(), ringv.end(), std::back_inserter(common));
+    for(int f : vfaces[c.u])
+        if(facelive[f] && (faces[3*f] == c.v || faces[3*f+1] == c.v || faces[3*f+2] == c.v))
+            shared++;
+    if(shared == 0 || (int) common.size() != shared)
+        return false;
+
+    // every surviving face around either endpoint must keep its orientation and not collapse to a sliver
+    for(int e = 0; e < 2; e++)
+    {
+        int moved = (e == 0) ? c.u : c.v, other = (e == 0) ? c.v : c.u;
+
+        for(int f : vfaces[moved])
+        {
+            const int * fv = &faces[3*f];
+            cgp::Point before[3], after[3];
+            double n0[3], n1[3], dot, len0, len1;
+            bool contains = false;
+
+            if(!facelive[f])
+                continue;
+            for(int p = 0; p < 3; p++)
+            {
+                contains = contains || (fv[p] == other);
+                before[p] = after[p] = pos[fv[p]];
+                if(fv[p] == moved)
+                    after[p] = c.pos;
+            }
+            if(contains) // retired by the collapse
+                continue;
+            faceNormal(before[0], before[1], before[2], n0);
+            faceNormal(after[0], after[1], after[2], n1);
+            dot = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+            len0 = std::sqrt(n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2]);
+            len1 = std::sqrt(n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2]);
+            if(len1 <= 0.0 || dot < (double) decimateflip * len0 * len1)
+                return false;
+        }
+    }
+    return true;
+}
+
+int MeshDecimator::apply(const Collapse &c)
+{
+    std::vector<int> &live = ring[0];
+    int retired = 0;
+
+    for(int f : vfaces[c.v])
+    {
+        int * fv = &faces[3*f];
+
+        if(!facelive[f])
+            continue;
+        if(fv[0] == c.u || fv[1] == c.u || fv[2] == c.u)
+        {
+            facelive[f] = 0;
+            retired++;
+            continue;
+        }
+        for(int p = 0; p < 3; p++)
+            if(fv[p] == c.v)
+                fv[p] = c.u;
+        vfaces[c.u].push_back(f);
+    }
+
+    // drop dead faces from the merged vertex so its list stays proportional to its valence
+    live.clear();
+    for(int f : vfaces[c.u])
+        if(facelive[f])
+            live.push_back(f);
+    vfaces[c.u].assign(live.begin(), live.end());
+    std::vector<int>().swap(vfaces[c.v]);
+
+    pos[c.u] = c.pos;
+    quadrics[c.u].add(quadrics[c.v]);
+    stamp[c.u]++;
+    stamp[c.v] = -1;
+
+    neighbours(c.u, ring[1]);
+    for(int n : ring[1])
+    {
+        heap.push_back(evaluate(c.u, n));
+        std::push_heap(heap.begin(), heap.end());
+    }
+    return retired;
+}
+
+void MeshDecimator::decimate(const MeshTopology &topo, const std::vector<cgp::Point> &verts, int targettris,
+                             std::vector<cgp::Point> &outverts, std::vector<cgp::Vector> &outnorms, std::vector<int> &outfaces)
+{
+    int numverts = topo.getNumVerts(), numtris = topo.getNumTris(), livetris, v;
+    std::vector<int> remap, edgestart;
+    std::vector<double> accum;
+
+    outverts.clear();
+    outnorms.clear();
+    outfaces.clear();
+    if(numverts != (int) verts.size())
+        return;
+
+    pos = verts;
+    faces.resize(3 * numtris);
+    for(int c = 0; c < 3 * numtris; c++)
+        faces[c] = topo.origin(c);
+    facelive.assign(numtris, 1);
+    for(int f = 0; f < numtris; f++) // faces with vertices out of range are left out of the topology, and so from the result
+        for(int p = 0; p < 3; p++)
+            if(faces[3*f+p] < 0 || faces[3*f+p] >= numverts)
+                facelive[f] = 0;
+    stamp.assign(numverts, 0);
+    quadrics.assign(numverts, Quadric());
+    vfaces.assign(numverts, std::vector<int>());
+
+    // area weighted face planes, plus perpendicular planes along boundary edges so that open rims keep their shape
+    #pragma omp parallel for schedule(dynamic, decimatechunksize)
+    for(v = 0; v < numverts; v++)
+    {
+        vfaces[v].reserve(topo.degree(v));
+        for(const int * it = topo.cornerBegin(v); it != topo.cornerEnd(v); it++)
+        {
+            int f = (* it) / 3, edge[2] = {* it, topo.prev(* it)};
+            const int * fv = &faces[3*f];
+            double n[3], len, d;
+
+            vfaces[v].push_back(f);
+            if(!facelive[f])
+                continue;
+            faceNormal(pos[fv[0]], pos[fv[1]], pos[fv[2]], n);
+            len = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            if(len <= 0.0)
+                continue;
+            n[0] /= len; n[1] /= len; n[2] /= len;
+            d = -(n[0]*pos[v].x + n[1]*pos[v].y + n[2]*pos[v].z);
+            quadrics[v].addPlane(n[0], n[1], n[2], d, 0.5 * len);
+
+            // the half-edges leaving and entering v are the two edges of this face that meet at v
+            for(int k = 0; k < 2; k++)
+                if(topo.twin(edge[k]) == topoboundary)
+                {
+                    const cgp::Point &a = pos[topo.origin(edge[k])], &b = pos[topo.dest(edge[k])];
+                    double e[3] = {b.x - a.x, b.y - a.y, b.z - a.z}, m[3], elen;
+
+                    m[0] = e[1]*n[2] - e[2]*n[1]; m[1] = e[2]*n[0] - e[0]*n[2]; m[2] = e[0]*n[1] - e[1]*n[0];
+                    elen = std::sqrt(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+                    if(elen <= 0.0)
+                        continue;
+                    m[0] /= elen; m[1] /= elen; m[2] /= elen;
+                    quadrics[v].addPlane(m[0], m[1], m[2], -(m[0]*a.x + m[1]*a.y + m[2]*a.z), decimateboundary * elen * elen);
+                }
+        }
+    }
+
+    // one candidate per undirected edge, costed in parallel
+    edgestart.resize(numverts+1);
+    edgestart[0] = 0;
+    for(v = 0; v < numverts; v++)
+        edgestart[v+1] = edgestart[v] + (int) (topo.nbrEnd(v) - std::upper_bound(topo.nbrBegin(v), topo.nbrEnd(v), v));
+    heap.resize(edgestart[numverts]);
+    #pragma omp parallel for schedule(dynamic, decimatechunksize)
+    for(v = 0; v < numverts; v++)
+    {
+        int e = edgestart[v];
+        for(const int * it = std::upper_bound(topo.nbrBegin(v), topo.nbrEnd(v), v); it != topo.nbrEnd(v); it++)
+            heap[e++] = evaluate(v, * it);
+    }
+    std::make_heap(heap.begin(), heap.end());
+
+    livetris = (int) std::count(facelive.begin(), facelive.end(), 1);
+    while(livetris > targettris && !heap.empty())
+    {
+        Collapse c = heap.front();
+
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+        if(stamp[c.u] != c.stampu || stamp[c.v] != c.stampv) // an endpoint has moved or gone since this was queued
+            continue;
+        if(!allowed(c))
+            continue;
+        livetris -= apply(c);
+    }
+    heap.clear();
+
+    // compact the surviving vertices and faces, keeping their relative order
+    remap.assign(numverts, -1);
+    for(int f = 0; f < numtris; f++)
+        if(facelive[f])
+            for(int p = 0; p < 3; p++)
+            {
+                int & r = remap[faces[3*f+p]];
+                if(r < 0)
+                {
+                    r = (int) outverts.size();
+                    outverts.push_back(pos[faces[3*f+p]]);
+                }
+                outfaces.push_back(r);
+            }
+
+    accum.assign(3 * outverts.size(), 0.0);
+    for(int f = 0; f < (int) outfaces.size() / 3; f++)
+    {
+        double n[3];
+
+        faceNormal(outverts[outfaces[3*f]], outverts[outfaces[3*f+1]], outverts[outfaces[3*f+2]], n);
+        for(int p = 0; p < 3; p++)
+            for(int d = 0; d < 3; d++)
+                accum[3 * outfaces[3*f+p] + d] += n[d];
+    }
+    outnorms.resize(outverts.size());
+    #pragma omp parallel for schedule(static, decimatechunksize)
+    for(v = 0; v < (int) outverts.size(); v++)
+    {
+        cgp::Vector n((float) accum[3*v], (float) accum[3*v+1], (float) accum[3*v+2]);
+        n.normalize();
+        outnorms[v] = n;
+    }
+}
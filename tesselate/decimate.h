@@ -0,0 +1,127 @@
+/**
+ * @file
+ *
+ * Quadric error metric simplification of triangle meshes by edge collapse, used to build display levels of detail.
+ */
+
+#ifndef _DECIMATE
+#define _DECIMATE
+
+#include <vector>
+#include "vecpnt.h"
+#include "topology.h"
+
+const int decimatechunksize = 4096;     ///< vertices or edges per parallel chunk when setting up a decimation
+const double decimateboundary = 1000.0; ///< weight of the planes that hold boundary edges in place, relative to face planes
+const float decimateflip = 0.2f;        ///< least cosine allowed between a face normal before and after a collapse
+
+/**
+ * Symmetric 4x4 matrix measuring the sum of squared distances of a point to a set of planes, stored as its
+ * upper triangle in the order xx, xy, xz, xw, yy, yz, yw, zz, zw, ww.
+ */
+struct Quadric
+{
+    double q[10];   ///< upper triangle of the matrix
+
+    /// Zero quadric
+    Quadric(){ for(int i = 0; i < 10; i++) q[i] = 0.0; }
+
+    /**
+     * Add the quadric of a plane
+     * @param a, b, c, d    plane coefficients, with (a, b, c) of unit length
+     * @param w             weight, such as the area of the face the plane came from
+     */
+    void addPlane(double a, double b, double c, double d, double w);
+
+    /// Accumulate another quadric
+    void add(const Quadric &other){ for(int i = 0; i < 10; i++) q[i] += other.q[i]; }
+
+    /// Weighted squared distance of point p to the planes
+    double error(const cgp::Point &p) const;
+
+    /**
+     * Find the point of least error
+     * @param[out] p    minimising point, if one exists
+     * @retval true if the quadric has a unique minimum,
+     * @retval false if it is singular, as for a flat or creased neighbourhood
+     */
+    bool optimum(cgp::Point &p) const;
+};
+
+/**
+ * Simplifies a triangle mesh by repeatedly collapsing the edge whose merged vertex lies closest to the planes of
+ * the faces around both endpoints (Garland and Heckbert). Collapses that would pinch the surface or flip a face are
+ * refused, so a closed two-manifold stays closed and manifold. Vertex quadrics and the initial edge costs are
+ * computed in parallel from the shared topology, and collapses then proceed in order of cost through a heap whose
+ * stale entries are skipped lazily. Working storage is kept between calls.
+ */
+class MeshDecimator
+{
+private:
+
+    /// Candidate collapse of edge (u, v), valid while neither endpoint has changed since it was queued
+    struct Collapse
+    {
+        double cost;    ///< quadric error at the merged position
+        int u, v;       ///< endpoints, with v merged into u
+        int stampu, stampv; ///< endpoint versions when the candidate was queued
+        cgp::Point pos; ///< merged position
+
+        bool operator<(const Collapse &other) const { return cost > other.cost; } // least cost at the top of the heap
+    };
+
+    std::vector<cgp::Point> pos;            ///< current vertex positions
+    std::vector<int> faces;                 ///< vertex indices, 3 per triangle
+    std::vector<char> facelive;             ///< has the face survived every collapse so far?
+    std::vector<std::vector<int>> vfaces;   ///< faces incident on each vertex, including some that have since died
+    std::vector<Quadric> quadrics;          ///< error quadric of each vertex
+    std::vector<int> stamp;                 ///< version of each vertex, -1 once it has been merged away
+    std::vector<Collapse> heap;             ///< pending collapses
+    std::vector<int> ring[3];               ///< scratch vertex and face lists for testing and applying a collapse
+
+    /**
+     * Evaluate the collapse of an edge, placing the merged vertex at the quadric minimum if it stays near the edge,
+     * or otherwise at whichever of the endpoints and midpoint has least error
+     * @param u, v  edge endpoints
+     * @returns collapse candidate stamped with the current endpoint versions
+     */
+    Collapse evaluate(int u, int v);
+
+    /**
+     * Gather the distinct vertices sharing a live face with vertex v
+     * @param v         vertex
+     * @param[out] nbrs neighbouring vertices in increasing order
+     */
+    void neighbours(int v, std::vector<int> &nbrs);
+
+    /**
+     * Check that merging v into u at the given position neither pinches the surface nor flips a face
+     * @param c     candidate collapse
+     * @retval true if the collapse is allowed,
+     * @retval false otherwise
+     */
+    bool allowed(const Collapse &c);
+
+    /**
+     * Merge v into u, retiring the faces shared by the edge and queueing new candidates around u
+     * @param c     collapse to apply
+     * @returns number of faces retired
+     */
+    int apply(const Collapse &c);
+
+public:
+
+    /**
+     * Simplify a mesh down to a target number of triangles, or as close to it as the manifold and flip tests allow
+     * @param topo          connectivity of the input mesh, which also supplies its triangles
+     * @param verts         vertex positions of the input mesh
+     * @param targettris    number of triangles wanted
+     * @param[out] outverts vertex positions of the simplified mesh, with unused vertices removed
+     * @param[out] outnorms area weighted vertex normals of the simplified mesh
+     * @param[out] outfaces vertex indices of the simplified mesh, 3 per triangle, with the input winding
+     */
+    void decimate(const MeshTopology &topo, const std::vector<cgp::Point> &verts, int targettris,
+                  std::vector<cgp::Point> &outverts, std::vector<cgp::Vector> &outnorms, std::vector<int> &outfaces);
+};
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * @file
+ *
+ * DexelVolume class for storing a 3d cuboid of voxels as lists of occupied spans along each row
+ */
+
+#include "dexels.h"
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+using namespace std;
+
+static stats::MemoryInit dexelMemory("DexelVolume");
+
+/**
+ * Combine two span lists of a row, sweeping their boundaries in order
+ * @param a, b      spans of the operands, disjoint and increasing
+ * @param op        0 for union, 1 for intersection, 2 for difference
+ * @param[out] out  spans of the result, disjoint, not touching and increasing
+ */
+static void mergeSpans(const vector<int> &a, const vector<int> &b, int op, vector<int> &out)
+{
+    size_t i = 0, j = 0;
+    bool ina = false, inb = false, in = false, now;
+    int x;
+
+    out.clear();
+    while(i < a.size() || j < b.size())
+    {
+        // next boundary, with both operands stepping together where they share one
+        x = (j >= b.size() || (i < a.size() && a[i] <= b[j])) ? a[i] : b[j];
+        while(i < a.size() && a[i] == x)
+        {
+            ina = !ina;
+            i++;
+        }
+        while(j < b.size() && b[j] == x)
+        {
+            inb = !inb;
+            j++;
+        }
+        now = (op == 0) ? (ina || inb) : ((op == 1) ? (ina && inb) : (ina && !inb));
+        if(now != in)
+        {
+            out.push_back(x);
+            in = now;
+        }
+    }
+}
+
+DexelVolume::DexelVolume()
+    : memtally(dexelMemory)
+{
+    xdim = ydim = zdim = 0;
+    origin = cgp::Point(0.0f, 0.0f, 0.0f);
+    diagonal = cgp::Vector(0.0f, 0.0f, 0.0f);
+}
+
+void DexelVolume::setDim(int dimx, int dimy, int dimz)
+{
+    if(dimx <= 0 || dimy <= 0 || dimz <= 0)
+        dimx = dimy = dimz = 0;
+    xdim = ((dimx + voxwordbits - 1) / voxwordbits) * voxwordbits;
+    ydim = dimy;
+    zdim = dimz;
+    rows.clear();
+    rows.shrink_to_fit();
+    rows.resize((size_t) ydim * zdim);
+    accountMemory();
+}
+
+void DexelVolume::clear()
+{
+    #pragma omp parallel for
+    for(int z = 0; z < zdim; z++)
+        for(int y = 0; y < ydim; y++)
+            vector<int>().swap(rows[flatten(y, z)]);
+    accountMemory();
+}
+
+size_t DexelVolume::getStorageBytes() const
+{
+    size_t bytes = rows.capacity() * sizeof(vector<int>);
+
+    for(const vector<int> &row : rows)
+        bytes += row.capacity() * sizeof(int);
+    return bytes;
+}
+
+bool DexelVolume::get(int x, int y, int z) const
+{
+    if(x < 0 || x >= xdim || y < 0 || y >= ydim || z < 0 || z >= zdim)
+        return false;
+
+    // odd number of boundaries at or before x means x is inside a span
+    const vector<int> &row = rows[flatten(y, z)];
+    return ((std::upper_bound(row.begin(), row.end(), x) - row.begin()) & 1) != 0;
+}
+
+bool DexelVolume::setRow(int y, int z, const vector<int> &spans)
+{
+    if(y < 0 || y >= ydim || z < 0 || z >= zdim)
+    {
+        cerr << "Error DexelVolume::setRow: row request (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+
+    vector<int> &row = rows[flatten(y, z)];
+    row.clear();
+    for(size_t s = 0; s + 1 < spans.size(); s += 2)
+    {
+        int first = std::max(spans[s], 0), last = std::min(spans[s+1], xdim);
+
+        if(first >= last)
+            continue;
+        if(!row.empty() && first <= row.back()) // touching or overlapping the previous span
+            row.back() = std::max(row.back(), last);
+        else
+        {
+            row.push_back(first);
+            row.push_back(last);
+        }
+    }
+    return true;
+}
+
+cgp::Point DexelVolume::getVoxelPos(int x, int y, int z) const
+{
+    float px, py, pz;
+
+    px = (xdim > 1) ? (float) x / (float) (xdim-1) : 0.0f;
+    py = (ydim > 1) ? (float) y / (float) (ydim-1) : 0.0f;
+    pz = (zdim > 1) ? (float) z / (float) (zdim-1) : 0.0f;
+    return cgp::Point(origin.x + px * diagonal.i, origin.y + py * diagonal.j, origin.z + pz * diagonal.k);
+}
+
+bool DexelVolume::getVoxelRange(cgp::BoundBox bbox, int * lo, int * hi) const
+{
+    float start[3] = {origin.x, origin.y, origin.z};
+    float extent[3] = {diagonal.i, diagonal.j, diagonal.k};
+    float bmin[3] = {bbox.min.x, bbox.min.y, bbox.min.z};
+    float bmax[3] = {bbox.max.x, bbox.max.y, bbox.max.z};
+    int dim[3] = {xdim, ydim, zdim};
+    float step, flo, fhi;
+
+    // same conservative rounding as VoxelVolume::getVoxelRange
+    for(int a = 0; a < 3; a++)
+    {
+        if(dim[a] <= 0 || bmin[a] > bmax[a])
+            return false;
+        step = (dim[a] > 1) ? extent[a] / (float) (dim[a]-1) : 0.0f;
+        if(step <= 0.0f)
+        {
+            lo[a] = 0; hi[a] = dim[a]-1;
+            continue;
+        }
+        flo = floorf((bmin[a] - start[a]) / step);
+        fhi = ceilf((bmax[a] - start[a]) / step);
+        if(fhi < 0.0f || flo > (float) (dim[a]-1))
+            return false;
+        lo[a] = (flo < 0.0f) ? 0 : (int) flo;
+        hi[a] = (fhi > (float) (dim[a]-1)) ? dim[a]-1 : (int) fhi;
+    }
+    return true;
+}
+
+bool DexelVolume::combineRange(DexelVolume * other, const int * lo, const int * hi, const char * caller, int * rlo, int * rhi)
+{
+    int dim[3] = {xdim, ydim, zdim};
+
+    if(other->xdim != xdim || other->ydim != ydim || other->zdim != zdim)
+    {
+        cerr << "Error DexelVolume::" << caller << ": volume dimensions (" << xdim << ", " << ydim << ", " << zdim << ") and (";
+        cerr << other->xdim << ", " << other->ydim << ", " << other->zdim << ") do not match" << endl;
+        return false;
+    }
+    for(int a = 0; a < 3; a++)
+    {
+        rlo[a] = (lo != NULL) ? std::max(lo[a], 0) : 0;
+        rhi[a] = (hi != NULL) ? std::min(hi[a], dim[a]-1) : dim[a]-1;
+    }
+    return true;
+}
+
+void DexelVolume::combine(DexelVolume * other, int op, const int * rlo, const int * rhi)
+{
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = rlo[2]; z <= rhi[2]; z++)
+    {
+        vector<int> merged;
+
+        for(int y = rlo[1]; y <= rhi[1]; y++)
+        {
+            vector<int> &row = rows[flatten(y, z)];
+            const vector<int> &orow = other->rows[other->flatten(y, z)];
+
+            if(orow.empty() && op != 1) // union and difference with nothing leave the row alone
+                continue;
+            if(row.empty() && op != 0) // nothing to intersect or subtract from
+                continue;
+            mergeSpans(row, orow, op, merged);
+            row.swap(merged);
+        }
+    }
+    accountMemory();
+}
+
+bool DexelVolume::unionWith(DexelVolume * other, const int * lo, const int * hi)
+{
+    int rlo[3], rhi[3];
+
+    if(!combineRange(other, lo, hi, "unionWith", rlo, rhi))
+        return false;
+    combine(other, 0, rlo, rhi);
+    return true;
+}
+
+bool DexelVolume::intersectWith(DexelVolume * other, const int * lo, const int * hi)
+{
+    int rlo[3], rhi[3];
+
+    if(!combineRange(other, lo, hi, "intersectWith", rlo, rhi))
+        return false;
+    combine(other, 1, rlo, rhi);
+    return true;
+}
+
+bool DexelVolume::subtract(DexelVolume * other, const int * lo, const int * hi)
+{
+    int rlo[3], rhi[3];
+
+    if(!combineRange(other, lo, hi, "subtract", rlo, rhi))
+        return false;
+    combine(other, 2, rlo, rhi);
+    return true;
+}
+
+void DexelVolume::toVoxels(VoxelVolume * vox)
+{
+    vox->setDim(xdim, ydim, zdim);
+    vox->setFrame(origin, diagonal);
+
+    #pragma omp parallel for
+    for(int z = 0; z < zdim; z++)
+        for(int y = 0; y < ydim; y++)
+        {
+            const vector<int> &row = rows[flatten(y, z)];
+
+            // a freshly sized volume is empty, so only the spans need writing
+            for(size_t s = 0; s < row.size(); s += 2)
+                vox->setSpan(row[s], row[s+1], y, z, true);
+        }
+}
+
+void DexelVolume::fromVoxels(VoxelVolume * vox)
+{
+    vox->getDim(xdim, ydim, zdim);
+    vox->getFrame(origin, diagonal);
+    rows.clear();
+    rows.shrink_to_fit();
+    rows.resize((size_t) ydim * zdim);
+
+    #pragma omp parallel for
+    for(int z = 0; z < zdim; z++)
+    {
+        int xspan = vox->getXSpan();
+
+        for(int y = 0; y < ydim; y++)
+        {
+            vector<int> &row = rows[flatten(y, z)];
+            bool in = false;
+
+            // uniform words are skipped whole, so only words holding a boundary are examined bit by bit
+            for(int w = 0; w < xspan; w++)
+            {
+                unsigned int word = vox->getWordUnchecked(w, y, z);
+
+                if(word == (in ? 0xFFFFFFFFu : 0u))
+                    continue;
+                for(int b = 0; b < voxwordbits; b++)
+                    if((((word >> (voxwordbits - 1 - b)) & 1u) != 0u) != in)
+                    {
+                        row.push_back(w * voxwordbits + b);
+                        in = !in;
+                    }
+            }
+            if(in)
+                row.push_back(xdim);
+        }
+    }
+    accountMemory();
+}
+
+bool DexelVolume::getMCRowCodes(int y, int z, unsigned char * codes)
+{
+    static thread_local vector<unsigned int> words;
+    const vector<int> * bound[4];
+    const unsigned int * rowptrs[4];
+    bool empty = true, full = true;
+    int xspan = xdim / voxwordbits;
+
+    if(y < 0 || y >= ydim-1 || z < 0 || z >= zdim-1)
+        return false;
+
+    // rows at (y, z), (y+1, z), (y, z+1), (y+1, z+1)
+    bound[0] = &rows[flatten(y, z)];
+    bound[1] = &rows[flatten(y+1, z)];
+    bound[2] = &rows[flatten(y, z+1)];
+    bound[3] = &rows[flatten(y+1, z+1)];
+    for(int r = 0; r < 4; r++)
+    {
+        empty = empty && bound[r]->empty();
+        full = full && bound[r]->size() == 2 && (* bound[r])[0] == 0 && (* bound[r])[1] == xdim;
+    }
+    if(empty || full) // no cell has a mix of corners
+        return false;
+
+    // only rows crossing the surface are unpacked, into words laid out as for VoxelVolume::setRow
+    words.assign(4 * (size_t) xspan, 0u);
+    for(int r = 0; r < 4; r++)
+    {
+        unsigned int * dst = &words[(size_t) r * xspan];
+        const vector<int> &row = * bound[r];
+
+        for(size_t s = 0; s < row.size(); s += 2)
+            for(int x = row[s]; x < row[s+1]; )
+            {
+                int w = x / voxwordbits, b = x % voxwordbits, n = std::min(voxwordbits - b, row[s+1] - x);
+                unsigned int bits = (n == voxwordbits) ? 0xFFFFFFFFu : (((1u << n) - 1u) << (voxwordbits - b - n));
+
+                dst[w] |= bits;
+                x += n;
+            }
+        rowptrs[r] = dst;
+    }
+    return VoxelVolume::rowCodes(rowptrs, xdim, codes);
+}
@@ -0,0 +1,189 @@
+#ifndef _DEXELS
+#define _DEXELS
+/**
+ * @file
+ *
+ * DexelVolume class for storing a 3d cuboid of voxels as lists of occupied spans along each row
+ */
+
+#include <vector>
+#include "vecpnt.h"
+#include "voxels.h"
+#include "common/memory.h"
+
+/**
+ * A volume of voxels, sampled at the same centres as VoxelVolume, held as a sorted list of occupied spans for each
+ * row along x. Set operations merge the span lists of a row, so they cost the number of surface crossings rather
+ * than the number of voxels, and storage grows with the surface area rather than the volume, which makes finely
+ * sampled volumes much smaller than packed words. Spans are what parity scans of mesh rows produce, so
+ * Scene::dexelWalk can evaluate a csg tree into a DexelVolume without any packed intermediate volumes.
+ *
+ * The x dimension is padded to a whole number of words, as for VoxelVolume, so that rows convert to packed words
+ * directly, both by toVoxels and for marching cubes through getMCRowCodes.
+ */
+class DexelVolume
+{
+private:
+    int xdim, ydim, zdim;                   ///< number of voxels along each axis, with x padded as for VoxelVolume
+    cgp::Point origin;                      ///< centre of the voxel at (0, 0, 0)
+    cgp::Vector diagonal;                   ///< offset from the first to the last voxel centre, as for VoxelVolume
+    std::vector<std::vector<int>> rows;     ///< pairs of first and one past last occupied voxel of each (y, z) row, z major
+    stats::MemoryTally memtally;            ///< bytes of rows and their spans
+
+    /// Index into rows of a row that is known to be in range
+    size_t flatten(int y, int z) const { return (size_t) z * ydim + y; }
+
+    /**
+     * Range of rows to combine with another volume
+     * @param other     second argument, checked for matching dimensions
+     * @param lo, hi    optional inclusive voxel range, or NULL for the whole volume
+     * @param caller    method name for error messages
+     * @param[out] rlo, rhi  clipped range
+     * @retval true if the dimensions match,
+     * @retval false otherwise.
+     */
+    bool combineRange(DexelVolume * other, const int * lo, const int * hi, const char * caller, int * rlo, int * rhi);
+
+    /**
+     * Combine the rows of another volume into this one
+     * @param other     second argument, of matching dimensions
+     * @param op        0 for union, 1 for intersection, 2 for difference
+     * @param rlo, rhi  inclusive range of rows in y and z to combine
+     */
+    void combine(DexelVolume * other, int op, const int * rlo, const int * rhi);
+
+public:
+
+    /// Default constructor, with no voxels
+    DexelVolume();
+
+    /**
+     * Change the size of the volume, leaving every voxel empty
+     * @param dimx, dimy, dimz  number of voxels along each axis, with x rounded up to a whole number of words
+     */
+    void setDim(int dimx, int dimy, int dimz);
+
+    /// Get the number of voxels along each axis
+    void getDim(int &dimx, int &dimy, int &dimz){ dimx = xdim; dimy = ydim; dimz = zdim; }
+
+    /**
+     * Set the position of the volume in world space, as for VoxelVolume::setFrame
+     * @param corner    centre of the first voxel
+     * @param diag      offset from the first to the last voxel centre
+     */
+    void setFrame(cgp::Point corner, cgp::Vector diag){ origin = corner; diagonal = diag; }
+
+    /// Get the position of the volume in world space
+    void getFrame(cgp::Point &corner, cgp::Vector &diag){ corner = origin; diag = diagonal; }
+
+    /// Empty every row, releasing the storage of its spans
+    void clear();
+
+    /// Bytes held by the row table and the spans
+    size_t getStorageBytes() const;
+
+    /// Bring the memory count up to date, after rows have been written by setRow
+    void accountMemory(){ memtally.set(getStorageBytes()); }
+
+    /**
+     * Test whether a voxel is occupied
+     * @param x, y, z   3D location, zero indexed
+     * @retval true if the voxel is occupied,
+     * @retval false if it is empty or outside the volume
+     */
+    bool get(int x, int y, int z) const;
+
+    /**
+     * Overwrite a row with occupied spans, as found by BaseShape::scanRow. Different rows can be written concurrently,
+     * and are counted by the next accountMemory or set operation.
+     * @param y, z      row to write, zero indexed
+     * @param spans     pairs of first and one past last occupied voxel, in increasing order, which are clipped to the
+     *                  row and may touch
+     * @retval true if the row is within volume bounds,
+     * @retval false otherwise.
+     */
+    bool setRow(int y, int z, const std::vector<int> &spans);
+
+    /**
+     * Spans of a row, as pairs of first and one past last occupied voxel, disjoint, not touching and in increasing order
+     * @param y, z  row to read, which must be within the volume
+     */
+    const std::vector<int> & getRow(int y, int z) const { return rows[flatten(y, z)]; }
+
+    /**
+     * Find the world-space position of the centre of a voxel, as for VoxelVolume::getVoxelPos
+     * @param x, y, z   3D location, zero indexed
+     * @returns voxel centre point
+     */
+    cgp::Point getVoxelPos(int x, int y, int z) const;
+
+    /**
+     * Find the range of voxels whose centres could fall within a world-space box, as for VoxelVolume::getVoxelRange
+     * @param bbox      world-space axis-aligned box
+     * @param[out] lo   first voxel index in x, y and z, clipped to the volume
+     * @param[out] hi   last voxel index (inclusive) in x, y and z, clipped to the volume
+     * @retval true if the box overlaps the volume, in which case lo and hi are valid,
+     * @retval false otherwise.
+     */
+    bool getVoxelRange(cgp::BoundBox bbox, int * lo, int * hi) const;
+
+    /**
+     * Set union with another volume of the same dimensions, merging the spans of each row
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the union leaves this volume unchanged, so
+     *                  that only the rows inside need combining. Whole rows are combined.
+     * @retval true if the dimensions match and the union was applied,
+     * @retval false otherwise.
+     */
+    bool unionWith(DexelVolume * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Set intersection with another volume of the same dimensions, merging the spans of each row
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which this volume is already empty. Whole rows are
+     *                  combined.
+     * @retval true if the dimensions match and the intersection was applied,
+     * @retval false otherwise.
+     */
+    bool intersectWith(DexelVolume * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Set difference (this volume minus other), merging the spans of each row
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the difference leaves this volume unchanged.
+     *                  Whole rows are combined.
+     * @retval true if the dimensions match and the difference was applied,
+     * @retval false otherwise.
+     */
+    bool subtract(DexelVolume * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Convert to packed words
+     * @param[out] vox  resized to the dimensions and frame of this volume, keeping its storage scheme
+     */
+    void toVoxels(VoxelVolume * vox);
+
+    /**
+     * Replace the contents with the occupied runs of a packed volume
+     * @param vox   volume to convert, whose dimensions and frame are taken
+     */
+    void fromVoxels(VoxelVolume * vox);
+
+    /**
+     * Compute the marching cubes vertex bit codes for a row of cells, as for VoxelVolume::getMCRowCodes. Rows whose
+     * four bounding rows are all empty or all full are settled from their spans alone.
+     * @param y, z      index of the lower, front corner of the cells in the row
+     * @param[out] codes  vertex bit code for each cell x in [0, xdim-1)
+     * @retval true if any cell in the row has a mix of inside and outside corners,
+     * @retval false if the row produces no surface (or is out of bounds)
+     */
+    bool getMCRowCodes(int y, int z, unsigned char * codes);
+
+    /// Marching cubes edge bit code of a vertex bit code, as for VoxelVolume::getMCEdgeIdx
+    int getMCEdgeIdx(int vcode){ return VoxelVolume::getMCEdgeIdx(vcode); }
+
+    /// Marching cubes edge intersection, always at the edge midpoint, as for VoxelVolume::getMCEdgeXsect
+    cgp::Point getMCEdgeXsect(int x, int y, int z, int ebit){ return VoxelVolume::getMCEdgeXsect(ebit); }
+};
+
+#endif
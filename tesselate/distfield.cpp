@@ -0,0 +1,260 @@
+//
+// DistanceField
+//
+
+#include "distfield.h"
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+extern int cubeEdgeFlags[256]; // edge table shared with VoxelVolume
+
+// corner positions and edge end points in the vertex numbering of the marching cubes tables
+static const int cubePos[8][3] =
+{
+    {0, 0, 0},{1, 0, 0},{1, 1, 0},{0, 1, 0},{0, 0, 1},{1, 0, 1},{1, 1, 1},{0, 1, 1}
+};
+
+static const int edgeConnection[12][2] =
+{
+    {0,1}, {1,2}, {2,3}, {3,0},
+    {4,5}, {5,6}, {6,7}, {7,4},
+    {0,4}, {1,5}, {2,6}, {3,7}
+};
+
+DistanceField::DistanceField()
+{
+    xdim = ydim = zdim = 0;
+    band = 1.0f;
+    setFrame(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(0.0f, 0.0f, 0.0f));
+}
+
+DistanceField::DistanceField(int xsize, int ysize, int zsize, cgp::Point corner, cgp::Vector diag, float width)
+{
+    band = width;
+    setDim(xsize, ysize, zsize);
+    setFrame(corner, diag);
+}
+
+void DistanceField::setDim(int xsize, int ysize, int zsize)
+{
+    xdim = std::max(xsize, 0);
+    ydim = std::max(ysize, 0);
+    zdim = std::max(zsize, 0);
+    dist.assign((size_t) xdim * ydim * zdim, band);
+}
+
+void DistanceField::fill(float d)
+{
+    std::fill(dist.begin(), dist.end(), std::min(std::max(d, -band), band));
+}
+
+float DistanceField::get(int x, int y, int z) const
+{
+    if(x < 0 || x >= xdim || y < 0 || y >= ydim || z < 0 || z >= zdim)
+        return band;
+    return dist[flatten(x, y, z)];
+}
+
+bool DistanceField::set(int x, int y, int z, float d)
+{
+    if(x < 0 || x >= xdim || y < 0 || y >= ydim || z < 0 || z >= zdim)
+    {
+        cerr << "Error DistanceField::set: voxel (" << x << ", " << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    dist[flatten(x, y, z)] = std::min(std::max(d, -band), band);
+    return true;
+}
+
+cgp::Point DistanceField::getVoxelPos(int x, int y, int z) const
+{
+    float px = (float) x / (float) (xdim-1), py = (float) y / (float) (ydim-1), pz = (float) z / (float) (zdim-1);
+
+    return cgp::Point(origin.x + px * diagonal.i, origin.y + py * diagonal.j, origin.z + pz * diagonal.k);
+}
+
+bool DistanceField::getVoxelRange(cgp::BoundBox bbox, int * lo, int * hi) const
+{
+    float start[3] = {origin.x, origin.y, origin.z};
+    float extent[3] = {diagonal.i, diagonal.j, diagonal.k};
+    float bmin[3] = {bbox.min.x, bbox.min.y, bbox.min.z};
+    float bmax[3] = {bbox.max.x, bbox.max.y, bbox.max.z};
+    int dim[3] = {xdim, ydim, zdim};
+    float step, flo, fhi;
+
+    // same conservative rounding as VoxelVolume::getVoxelRange
+    for(int a = 0; a < 3; a++)
+    {
+        if(dim[a] <= 0 || bmin[a] > bmax[a])
+            return false;
+        step = (dim[a] > 1) ? extent[a] / (float) (dim[a]-1) : 0.0f;
+        if(step <= 0.0f)
+        {
+            lo[a] = 0; hi[a] = dim[a]-1;
+            continue;
+        }
+        flo = floorf((bmin[a] - start[a]) / step);
+        fhi = ceilf((bmax[a] - start[a]) / step);
+        if(fhi < 0.0f || flo > (float) (dim[a]-1))
+            return false;
+        lo[a] = (flo < 0.0f) ? 0 : (int) flo;
+        hi[a] = (fhi > (float) (dim[a]-1)) ? dim[a]-1 : (int) fhi;
+    }
+    return true;
+}
+
+bool DistanceField::combineRange(DistanceField * other, const int * lo, const int * hi, const char * caller, int * rlo, int * rhi)
+{
+    int dim[3] = {xdim, ydim, zdim};
+
+    if(other->xdim != xdim || other->ydim != ydim || other->zdim != zdim)
+    {
+        cerr << "Error DistanceField::" << caller << ": field dimensions (" << xdim << ", " << ydim << ", " << zdim << ") and (";
+        cerr << other->xdim << ", " << other->ydim << ", " << other->zdim << ") do not match" << endl;
+        return false;
+    }
+    for(int a = 0; a < 3; a++)
+    {
+        rlo[a] = (lo != NULL) ? std::max(lo[a], 0) : 0;
+        rhi[a] = (hi != NULL) ? std::min(hi[a], dim[a]-1) : dim[a]-1;
+    }
+    return true;
+}
+
+bool DistanceField::unionWith(DistanceField * other, const int * lo, const int * hi)
+{
+    int rlo[3], rhi[3];
+
+    if(!combineRange(other, lo, hi, "unionWith", rlo, rhi))
+        return false;
+    #pragma omp parallel for
+    for(int z = rlo[2]; z <= rhi[2]; z++)
+        for(int y = rlo[1]; y <= rhi[1]; y++)
+        {
+            float * dst = &dist[flatten(0, y, z)];
+            const float * src = &other->dist[flatten(0, y, z)];
+            #pragma omp simd
+            for(int x = rlo[0]; x <= rhi[0]; x++)
+                dst[x] = std::min(dst[x], src[x]);
+        }
+    return true;
+}
+
+bool DistanceField::intersectWith(DistanceField * other, const int * lo, const int * hi)
+{
+    int rlo[3], rhi[3];
+
+    if(!combineRange(other, lo, hi, "intersectWith", rlo, rhi))
+        return false;
+    #pragma omp parallel for
+    for(int z = rlo[2]; z <= rhi[2]; z++)
+        for(int y = rlo[1]; y <= rhi[1]; y++)
+        {
+            float * dst = &dist[flatten(0, y, z)];
+            const float * src = &other->dist[flatten(0, y, z)];
+            #pragma omp simd
+            for(int x = rlo[0]; x <= rhi[0]; x++)
+                dst[x] = std::max(dst[x], src[x]);
+        }
+    return true;
+}
+
+bool DistanceField::subtract(DistanceField * other, const int * lo, const int * hi)
+{
+    int rlo[3], rhi[3];
+
+    if(!combineRange(other, lo, hi, "subtract", rlo, rhi))
+        return false;
+    #pragma omp parallel for
+    for(int z = rlo[2]; z <= rhi[2]; z++)
+        for(int y = rlo[1]; y <= rhi[1]; y++)
+        {
+            float * dst = &dist[flatten(0, y, z)];
+            const float * src = &other->dist[flatten(0, y, z)];
+            #pragma omp simd
+            for(int x = rlo[0]; x <= rhi[0]; x++)
+                dst[x] = std::max(dst[x], -src[x]);
+        }
+    return true;
+}
+
+void DistanceField::toVoxels(VoxelVolume * vox)
+{
+    int xspan;
+
+    vox->setDim(xdim, ydim, zdim);
+    vox->setFrame(origin, diagonal);
+    xspan = vox->getXSpan();
+
+    #pragma omp parallel for
+    for(int z = 0; z < zdim; z++)
+    {
+        std::vector<unsigned int> words(xspan);
+        for(int y = 0; y < ydim; y++)
+        {
+            const float * row = &dist[flatten(0, y, z)];
+            std::fill(words.begin(), words.end(), 0u);
+            for(int x = 0; x < xdim; x++)
+                if(row[x] < 0.0f)
+                    words[x / 32] |= 0x80000000u >> (x % 32);
+            vox->setRow(y, z, &words[0]);
+        }
+    }
+}
+
+void DistanceField::hashContent(ContentHash &hash)
+{
+    hash.addString("distances");
+    hash.addInt(xdim); hash.addInt(ydim); hash.addInt(zdim);
+    hash.addFloat(origin.x); hash.addFloat(origin.y); hash.addFloat(origin.z);
+    hash.addFloat(diagonal.i); hash.addFloat(diagonal.j); hash.addFloat(diagonal.k);
+    hash.addFloat(band);
+    if(!dist.empty())
+        hash.add(&dist[0], dist.size() * sizeof(float));
+}
+
+bool DistanceField::getMCRowCodes(int y, int z, unsigned char * codes)
+{
+    const float * rows[4];
+    bool active = false;
+
+    if(y < 0 || y >= ydim-1 || z < 0 || z >= zdim-1)
+        return false;
+
+    // rows holding corners 0-1, 3-2, 4-5 and 7-6 of each cell
+    rows[0] = &dist[flatten(0, y, z)];
+    rows[1] = &dist[flatten(0, y+1, z)];
+    rows[2] = &dist[flatten(0, y, z+1)];
+    rows[3] = &dist[flatten(0, y+1, z+1)];
+    for(int x = 0; x < xdim-1; x++)
+    {
+        unsigned int code = 0;
+        for(int i = 0; i < 8; i++) // 1 for outside, 0 for inside, as for VoxelVolume::getMCVertIdx
+            if(rows[cubePos[i][1] + 2 * cubePos[i][2]][x + cubePos[i][0]] >= 0.0f)
+                code |= 1u << i;
+        codes[x] = (unsigned char) code;
+        if(code != 0u && code != 255u)
+            active = true;
+    }
+    return active;
+}
+
+int DistanceField::getMCEdgeIdx(int vcode)
+{
+    return cubeEdgeFlags[vcode];
+}
+
+cgp::Point DistanceField::getMCEdgeXsect(int x, int y, int z, int ebit)
+{
+    const int * a = cubePos[edgeConnection[ebit][0]], * b = cubePos[edgeConnection[ebit][1]];
+    float da = get(x + a[0], y + a[1], z + a[2]), db = get(x + b[0], y + b[1], z + b[2]), t;
+
+    // the end points lie on opposite sides of zero, so the denominator cannot vanish, but a corner exactly on the
+    // surface would otherwise put the crossings of all its edges at the same point
+    t = (da != db) ? da / (da - db) : 0.5f;
+    t = std::min(std::max(t, sdfedgemargin), 1.0f - sdfedgemargin);
+    return cgp::Point((float) a[0] + t * (float) (b[0] - a[0]), (float) a[1] + t * (float) (b[1] - a[1]), (float) a[2] + t * (float) (b[2] - a[2]));
+}
@@ -0,0 +1,208 @@
+#ifndef _DISTANCEFIELD
+#define _DISTANCEFIELD
+/**
+ * @file
+ *
+ * DistanceField class for storing a 3d cuboid of signed distances, sampled at the same voxel centres as VoxelVolume
+ */
+
+#include <vector>
+#include "vecpnt.h"
+#include "contenthash.h"
+#include "voxels.h"
+
+const float sdfbandvoxels = 3.0f;   ///< voxels either side of the surface within which distances are kept exact
+const float sdfedgemargin = 0.02f;  ///< fraction of an edge kept clear of its ends, so crossings around a corner stay further apart than the weld distance
+
+/**
+ * A cuboid volume of signed distances to a surface, negative inside, with one float per voxel. Distances are
+ * truncated to a narrow band around the surface, since marching cubes only interpolates between voxels on either
+ * side of it, and evaluation can skip everything further away. Set operations are the usual minimum and maximum of
+ * distances, which are exact outside the result and bound the distance inside it, so the zero crossings of a csg
+ * tree land where the surfaces of its shapes meet. Marching cubes on the field places vertices at the interpolated
+ * crossing along each edge instead of the midpoint, so surfaces are accurate to a fraction of a voxel.
+ */
+class DistanceField
+{
+private:
+    int xdim, ydim, zdim;       ///< number of voxels along each axis
+    cgp::Point origin;          ///< centre of the voxel at (0, 0, 0)
+    cgp::Vector diagonal;       ///< offset from the first to the last voxel centre, as for VoxelVolume
+    float band;                 ///< distances are clamped to [-band, band]
+    std::vector<float> dist;    ///< distances, with x varying fastest
+
+    /// Index into dist of a voxel that is known to be in range
+    int flatten(int x, int y, int z) const { return (z * ydim + y) * xdim + x; }
+
+    /**
+     * Range of voxels to combine with another field
+     * @param other     second argument, checked for matching dimensions
+     * @param lo, hi    optional inclusive voxel range, or NULL for the whole volume
+     * @param caller    method name for error messages
+     * @param[out] rlo, rhi  clipped range
+     * @retval true if the dimensions match,
+     * @retval false otherwise.
+     */
+    bool combineRange(DistanceField * other, const int * lo, const int * hi, const char * caller, int * rlo, int * rhi);
+
+public:
+
+    /// Default constructor
+    DistanceField();
+
+    /**
+     * Constructor with size parameters, with every voxel set to the band, which is empty space
+     * @param xsize, ysize, zsize   number of voxels along each axis
+     * @param corner    centre of the first voxel
+     * @param diag      offset from the first to the last voxel centre
+     * @param width     band half-width in world units
+     */
+    DistanceField(int xsize, int ysize, int zsize, cgp::Point corner, cgp::Vector diag, float width);
+
+    /**
+     * Change the size of the field, setting every voxel to the band, which is empty space
+     * @param xsize, ysize, zsize   number of voxels along each axis
+     */
+    void setDim(int xsize, int ysize, int zsize);
+
+    /// Get the number of voxels along each axis
+    void getDim(int &xsize, int &ysize, int &zsize){ xsize = xdim; ysize = ydim; zsize = zdim; }
+
+    /**
+     * Set the position of the field in world space, as for VoxelVolume::setFrame
+     * @param corner    centre of the first voxel
+     * @param diag      offset from the first to the last voxel centre
+     */
+    void setFrame(cgp::Point corner, cgp::Vector diag){ origin = corner; diagonal = diag; }
+
+    /// Get the position of the field in world space
+    void getFrame(cgp::Point &corner, cgp::Vector &diag){ corner = origin; diag = diagonal; }
+
+    /**
+     * Set the band half-width beyond which distances are clamped. Takes effect on the next setDim or fill.
+     * @param width     band half-width in world units
+     */
+    void setBand(float width){ band = width; }
+
+    /// Band half-width beyond which distances are clamped
+    float getBand(){ return band; }
+
+    /// Set every voxel to the same distance, clamped to the band
+    void fill(float d);
+
+    /**
+     * Read the first float level set grid of an OpenVDB file, replacing the dimensions, frame, band and distances.
+     * The field encloses the active voxels with a margin, and its band is the grid background. Needs a build with
+     * OPENVDB.
+     * @param filename  name of file to load
+     * @retval true  if load succeeds,
+     * @retval false if the file is unreadable, has no level set, its transform is not axis aligned, or OpenVDB is missing
+     */
+    bool readVDB(std::string filename);
+
+    /**
+     * Write the field as a level set grid named "surface", with the band as background and only distances within
+     * the band stored, placed as for VoxelVolume::writeVDB. Needs a build with OPENVDB.
+     * @param filename  name of file to save
+     * @retval true  if save succeeds,
+     * @retval false otherwise.
+     */
+    bool writeVDB(std::string filename);
+
+    /**
+     * Distance stored at a voxel
+     * @param x, y, z   3D location, zero indexed
+     * @returns distance, or the band for voxels outside the volume
+     */
+    float get(int x, int y, int z) const;
+
+    /**
+     * Store a distance at a voxel, clamped to the band
+     * @param x, y, z   3D location, zero indexed
+     * @param d         signed distance
+     * @retval true if the voxel is within volume bounds,
+     * @retval false otherwise.
+     */
+    bool set(int x, int y, int z, float d);
+
+    /**
+     * Find the world-space position of the centre of a voxel
+     * @param x, y, z   3D location, zero indexed
+     * @returns voxel centre point
+     */
+    cgp::Point getVoxelPos(int x, int y, int z) const;
+
+    /**
+     * Find the range of voxels whose centres could fall within a world-space box
+     * @param bbox      world-space axis-aligned box
+     * @param[out] lo   first voxel index in x, y and z, clipped to the volume
+     * @param[out] hi   last voxel index (inclusive) in x, y and z, clipped to the volume
+     * @retval true if the box overlaps the volume, in which case lo and hi are valid,
+     * @retval false otherwise.
+     */
+    bool getVoxelRange(cgp::BoundBox bbox, int * lo, int * hi) const;
+
+    /**
+     * Set union with another field of the same dimensions, as the minimum distance
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the union leaves this field unchanged
+     * @retval true if the dimensions match and the union was applied,
+     * @retval false otherwise.
+     */
+    bool unionWith(DistanceField * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Set intersection with another field of the same dimensions, as the maximum distance
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the intersection leaves this field unchanged
+     * @retval true if the dimensions match and the intersection was applied,
+     * @retval false otherwise.
+     */
+    bool intersectWith(DistanceField * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Set difference (this field minus other), as the maximum of this distance and the negated other distance
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the difference leaves this field unchanged
+     * @retval true if the dimensions match and the difference was applied,
+     * @retval false otherwise.
+     */
+    bool subtract(DistanceField * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Threshold the field into a boolean volume, with voxels of negative distance occupied
+     * @param[out] vox  resized to the dimensions and frame of this field, so its x dimension is padded
+     *                  to a whole number of words
+     */
+    void toVoxels(VoxelVolume * vox);
+
+    /// Add the dimensions, frame and distances to a hash
+    void hashContent(ContentHash &hash);
+
+    /**
+     * Compute the marching cubes vertex bit codes for a row of cells, as for VoxelVolume::getMCRowCodes
+     * @param y, z      index of the lower, front corner of the cells in the row
+     * @param[out] codes  vertex bit code for each cell x in [0, xdim-1), 1 for a corner outside and 0 inside
+     * @retval true if any cell in the row has a mix of inside and outside corners,
+     * @retval false if the row produces no surface (or is out of bounds)
+     */
+    bool getMCRowCodes(int y, int z, unsigned char * codes);
+
+    /**
+     * Return the marching cubes edge intersection bit code corresponding to a vertex bit code
+     * @param vcode     vertex pattern bit code
+     * @retval  edge bit code index for MC table
+     */
+    int getMCEdgeIdx(int vcode);
+
+    /**
+     * Return the marching cubes edge intersection along an edge of a cell, where the linearly interpolated
+     * distance crosses zero
+     * @param x, y, z   index of the lower, front, left corner of the cell
+     * @param ebit      bit position corresponding to a cube edge
+     * @retval          position in unit cube of the intersection point
+     */
+    cgp::Point getMCEdgeXsect(int x, int y, int z, int ebit);
+};
+
+#endif
@@ -4,116 +4,411 @@
 
 #include "ffd.h"
 #include <stdio.h>
+#include <algorithm>
+#include <stdint.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "common/serialize.h"
+#include "common/counters.h"
+#include "contenthash.h"
 
 using namespace std;
 
 GLfloat defaultLatCol[] = {0.2f, 0.2f, 0.2f, 1.0f};
 GLfloat highlightLatCol[] = {1.0f, 0.176f, 0.176f, 1.0f};
-int maxbezorder = 4;
+int maxbezorder = ffdmaxorder;
+
+/**
+ * Tensor product contraction for a lattice with NX x NY x NZ control points. Weights are summed along z first,
+ * then y, then x, so each control point costs one multiply-add per coordinate and the loops unroll completely.
+ */
+template<int NX, int NY, int NZ>
+static void contractLattice(const cgp::Point * cp, const float * bu, const float * bv, const float * bw, cgp::Point &out)
+{
+    float ox = 0.0f, oy = 0.0f, oz = 0.0f;
 
-void ffd::alloc()
+    for(int i = 0; i < NX; i++)
+    {
+        float px = 0.0f, py = 0.0f, pz = 0.0f;
+        for(int j = 0; j < NY; j++)
+        {
+            const cgp::Point * row = cp + (i * NY + j) * NZ;
+            float qx = 0.0f, qy = 0.0f, qz = 0.0f;
+            for(int k = 0; k < NZ; k++)
+            {
+                qx += bw[k] * row[k].x;
+                qy += bw[k] * row[k].y;
+                qz += bw[k] * row[k].z;
+            }
+            px += bv[j] * qx; py += bv[j] * qy; pz += bv[j] * qz;
+        }
+        ox += bu[i] * px; oy += bu[i] * py; oz += bu[i] * pz;
+    }
+    out = cgp::Point(ox, oy, oz);
+}
+
+/**
+ * Batch counterpart of contractLattice, with the same order of summation in every lane so that results agree
+ * exactly with the single point kernel
+ */
+template<int NX, int NY, int NZ>
+static void contractLatticeBatch(const cgp::Point * cp, const float (* bu)[ffdbatchsize], const float (* bv)[ffdbatchsize],
+                                 const float (* bw)[ffdbatchsize], float * ox, float * oy, float * oz)
 {
-    // allocate memory for a 3D array of control points and highlighting switches
-    if(dimx > 1 && dimy > 1 && dimz > 1 && dimx <= maxbezorder && dimy <= maxbezorder && dimz <= maxbezorder)
+    float px[ffdbatchsize], py[ffdbatchsize], pz[ffdbatchsize];
+    float qx[ffdbatchsize], qy[ffdbatchsize], qz[ffdbatchsize];
+    int l;
+
+    for(l = 0; l < ffdbatchsize; l++)
+        ox[l] = oy[l] = oz[l] = 0.0f;
+    for(int i = 0; i < NX; i++)
     {
-        cp = new cgp::Point **[dimx];
-        highlight = new bool **[dimx];
-        for (int i = 0; i < dimx; i++)
+        for(l = 0; l < ffdbatchsize; l++)
+            px[l] = py[l] = pz[l] = 0.0f;
+        for(int j = 0; j < NY; j++)
+        {
+            const cgp::Point * row = cp + (i * NY + j) * NZ;
+            for(l = 0; l < ffdbatchsize; l++)
+                qx[l] = qy[l] = qz[l] = 0.0f;
+            for(int k = 0; k < NZ; k++)
+            {
+                float cx = row[k].x, cy = row[k].y, cz = row[k].z;
+                #pragma omp simd
+                for(l = 0; l < ffdbatchsize; l++)
+                {
+                    qx[l] += bw[k][l] * cx;
+                    qy[l] += bw[k][l] * cy;
+                    qz[l] += bw[k][l] * cz;
+                }
+            }
+            #pragma omp simd
+            for(l = 0; l < ffdbatchsize; l++)
+            {
+                px[l] += bv[j][l] * qx[l]; py[l] += bv[j][l] * qy[l]; pz[l] += bv[j][l] * qz[l];
+            }
+        }
+        #pragma omp simd
+        for(l = 0; l < ffdbatchsize; l++)
         {
-            cp[i] = new cgp::Point *[dimy];
-            highlight[i] = new bool *[dimy];
+            ox[l] += bu[i][l] * px[l]; oy[l] += bu[i][l] * py[l]; oz[l] += bu[i][l] * pz[l];
+        }
+    }
+}
+
+/**
+ * Contraction of the ffdspan x ffdspan x ffdspan window of a B-spline lattice, in the same order of summation as
+ * contractLattice
+ * @param cp        first control point of the window
+ * @param rowstride, planestride    distance between control points along y and along x
+ * @param bu, bv, bw    ffdspan basis weights along x, y and z
+ * @param[out] out  weighted sum of the window
+ */
+static void contractWindow(const cgp::Point * cp, int rowstride, int planestride, const float * bu, const float * bv,
+                           const float * bw, cgp::Point &out)
+{
+    float ox = 0.0f, oy = 0.0f, oz = 0.0f;
 
-            for (int j = 0; j < dimy; j++)
+    for(int i = 0; i < ffdspan; i++)
+    {
+        float px = 0.0f, py = 0.0f, pz = 0.0f;
+        for(int j = 0; j < ffdspan; j++)
+        {
+            const cgp::Point * row = cp + i * planestride + j * rowstride;
+            float qx = 0.0f, qy = 0.0f, qz = 0.0f;
+            for(int k = 0; k < ffdspan; k++)
             {
-                cp[i][j] = new cgp::Point[dimz];
-                highlight[i][j] = new bool[dimz];
+                qx += bw[k] * row[k].x;
+                qy += bw[k] * row[k].y;
+                qz += bw[k] * row[k].z;
             }
+            px += bv[j] * qx; py += bv[j] * qy; pz += bv[j] * qz;
         }
-        deactivateAllCP();
+        ox += bu[i] * px; oy += bu[i] * py; oz += bu[i] * pz;
     }
+    out = cgp::Point(ox, oy, oz);
 }
 
-void ffd::dealloc()
+/**
+ * Batch counterpart of contractWindow, where each lane gathers the control points of its own window
+ * @param cp        control points of the whole lattice
+ * @param rowstride, planestride    distance between control points along y and along x
+ * @param first     first control point of the window of each lane
+ * @param bu, bv, bw    basis weights along x, y and z, one row per window index and one column per point
+ * @param[out] ox, oy, oz   coordinates of the weighted sums, one per point
+ */
+static void contractWindowBatch(const cgp::Point * cp, int rowstride, int planestride, const int * first,
+                                const float (* bu)[ffdbatchsize], const float (* bv)[ffdbatchsize],
+                                const float (* bw)[ffdbatchsize], float * ox, float * oy, float * oz)
 {
-    // deallocate 3D array of control points and boolean highlighting switches
-    for (int i = 0; i < dimx; i++)
+    float px[ffdbatchsize], py[ffdbatchsize], pz[ffdbatchsize];
+    float qx[ffdbatchsize], qy[ffdbatchsize], qz[ffdbatchsize];
+    int l;
+
+    for(l = 0; l < ffdbatchsize; l++)
+        ox[l] = oy[l] = oz[l] = 0.0f;
+    for(int i = 0; i < ffdspan; i++)
     {
-        for (int j = 0; j < dimy; j++)
+        for(l = 0; l < ffdbatchsize; l++)
+            px[l] = py[l] = pz[l] = 0.0f;
+        for(int j = 0; j < ffdspan; j++)
         {
-            delete [] cp[i][j];
-            delete [] highlight[i][j];
+            int offset = i * planestride + j * rowstride;
+            for(l = 0; l < ffdbatchsize; l++)
+                qx[l] = qy[l] = qz[l] = 0.0f;
+            for(int k = 0; k < ffdspan; k++)
+            {
+                #pragma omp simd
+                for(l = 0; l < ffdbatchsize; l++)
+                {
+                    const cgp::Point &c = cp[first[l] + offset + k];
+                    qx[l] += bw[k][l] * c.x;
+                    qy[l] += bw[k][l] * c.y;
+                    qz[l] += bw[k][l] * c.z;
+                }
+            }
+            #pragma omp simd
+            for(l = 0; l < ffdbatchsize; l++)
+            {
+                px[l] += bv[j][l] * qx[l]; py[l] += bv[j][l] * qy[l]; pz[l] += bv[j][l] * qz[l];
+            }
         }
+        #pragma omp simd
+        for(l = 0; l < ffdbatchsize; l++)
+        {
+            ox[l] += bu[i][l] * px[l]; oy[l] += bu[i][l] * py[l]; oz[l] += bu[i][l] * pz[l];
+        }
+    }
+}
 
-        delete [] cp[i];
-        delete [] highlight[i];
+/// Choose the z order of a specialised batch kernel
+template<int NX, int NY>
+static ffdBatchKernel selectBatchKernelZ(int nz)
+{
+    switch(nz)
+    {
+        case 2: return &contractLatticeBatch<NX, NY, 2>;
+        case 3: return &contractLatticeBatch<NX, NY, 3>;
+        case 4: return &contractLatticeBatch<NX, NY, 4>;
+        default: return NULL;
+    }
+}
+
+/// Choose the y and z orders of a specialised batch kernel
+template<int NX>
+static ffdBatchKernel selectBatchKernelY(int ny, int nz)
+{
+    switch(ny)
+    {
+        case 2: return selectBatchKernelZ<NX, 2>(nz);
+        case 3: return selectBatchKernelZ<NX, 3>(nz);
+        case 4: return selectBatchKernelZ<NX, 4>(nz);
+        default: return NULL;
+    }
+}
+
+/// Choose the specialised batch kernel for a lattice, or NULL if any order lies outside [2, ffdmaxorder]
+static ffdBatchKernel selectBatchKernel(int nx, int ny, int nz)
+{
+    switch(nx)
+    {
+        case 2: return selectBatchKernelY<2>(ny, nz);
+        case 3: return selectBatchKernelY<3>(ny, nz);
+        case 4: return selectBatchKernelY<4>(ny, nz);
+        default: return NULL;
+    }
+}
+
+/// Choose the z order of a specialised kernel
+template<int NX, int NY>
+static ffdKernel selectKernelZ(int nz)
+{
+    switch(nz)
+    {
+        case 2: return &contractLattice<NX, NY, 2>;
+        case 3: return &contractLattice<NX, NY, 3>;
+        case 4: return &contractLattice<NX, NY, 4>;
+        default: return NULL;
+    }
+}
+
+/// Choose the y and z orders of a specialised kernel
+template<int NX>
+static ffdKernel selectKernelY(int ny, int nz)
+{
+    switch(ny)
+    {
+        case 2: return selectKernelZ<NX, 2>(nz);
+        case 3: return selectKernelZ<NX, 3>(nz);
+        case 4: return selectKernelZ<NX, 4>(nz);
+        default: return NULL;
+    }
+}
+
+/**
+ * Choose the specialised kernel for a lattice
+ * @param nx, ny, nz    number of control points along each axis
+ * @returns kernel, or NULL if any order lies outside [2, ffdmaxorder]
+ */
+static ffdKernel selectKernel(int nx, int ny, int nz)
+{
+    switch(nx)
+    {
+        case 2: return selectKernelY<2>(ny, nz);
+        case 3: return selectKernelY<3>(ny, nz);
+        case 4: return selectKernelY<4>(ny, nz);
+        default: return NULL;
     }
-    delete [] cp;
-    delete [] highlight;
-    cp = NULL;
+}
+
+void ffd::alloc()
+{
+    // allocate memory for a 3D array of control points and highlighting switches
+    dealloc();
+    if(bspline)
+    {
+        // the window of every point is contracted by the same kernel, so any size from one cell upwards will do
+        if(dimx >= ffdspan && dimy >= ffdspan && dimz >= ffdspan)
+        {
+            cp.resize((size_t) dimx * dimy * dimz);
+            highlight.resize(cp.size());
+            deactivateAllCP();
+        }
+    }
+    else if(dimx > 1 && dimy > 1 && dimz > 1 && dimx <= maxbezorder && dimy <= maxbezorder && dimz <= maxbezorder)
+    {
+        cp.resize(dimx * dimy * dimz);
+        highlight.resize(dimx * dimy * dimz);
+        kernel = selectKernel(dimx, dimy, dimz);
+        batchkernel = selectBatchKernel(dimx, dimy, dimz);
+        deactivateAllCP();
+    }
+}
+
+void ffd::dealloc()
+{
+    cp.clear();
+    highlight.clear();
+    kernel = NULL;
+    batchkernel = NULL;
 }
 
 bool ffd::inCPBounds(int i, int j, int k)
 {
-    return (i >= 0 && j >= 0 && k >= 0 && i < dimx && j < dimy && k < dimz);
+    return (i >= 0 && j >= 0 && k >= 0 && i < dimx && j < dimy && k < dimz && !cp.empty());
 }
 
-float ffd::basis(float t, int i, int n)
+void ffd::basis(float t, int n, float * b)
 {
-    float b = 0.0f;
     float tinv = 1.0f - t;
 
-    // this could be made more efficienct by calculating the Bernstein polynomials for all indices at the same time
-    // but I have left it this way for readability
+    UTS_COUNT(FFD_BASIS_EVALS, 1);
     switch(n)
     {
-        case 0:
-            break; // b=0
         case 1:
-            switch(i)
+            b[0] = tinv; b[1] = t;
+            break;
+        case 2:
+            b[0] = tinv*tinv; b[1] = 2.0f*tinv*t; b[2] = t*t;
+            break;
+        case 3:
+            b[0] = tinv*tinv*tinv; b[1] = 3.0f*tinv*tinv*t; b[2] = 3.0f*tinv*t*t; b[3] = t*t*t;
+            break;
+        default:
+            break;
+    }
+}
+
+void ffd::basis(const float * t, int n, float (* b)[ffdbatchsize])
+{
+    int l;
+
+    UTS_COUNT(FFD_BASIS_EVALS, ffdbatchsize);
+    // same expressions as the single value version, so that both round identically
+    switch(n)
+    {
+        case 1:
+            #pragma omp simd
+            for(l = 0; l < ffdbatchsize; l++)
             {
-                case 0: b = tinv; break;
-                case 1: b = t; break;
-                default: break; // b=0
+                float tinv = 1.0f - t[l];
+                b[0][l] = tinv; b[1][l] = t[l];
             }
             break;
         case 2:
-            switch(i)
+            #pragma omp simd
+            for(l = 0; l < ffdbatchsize; l++)
             {
-                case 0: b = tinv*tinv; break;
-                case 1: b = 2.0f*tinv*t; break;
-                case 2: b = t*t; break;
-                default: break; // b=0
+                float tinv = 1.0f - t[l];
+                b[0][l] = tinv*tinv; b[1][l] = 2.0f*tinv*t[l]; b[2][l] = t[l]*t[l];
             }
             break;
         case 3:
-            switch(i)
+            #pragma omp simd
+            for(l = 0; l < ffdbatchsize; l++)
             {
-                case 0: b = tinv*tinv*tinv; break;
-                case 1: b = 3.0f*tinv*tinv*t; break;
-                case 2: b = 3.0f*tinv*t*t; break;
-                case 3: b = t*t*t; break;
-                default: break; // b=0
+                float tinv = 1.0f - t[l];
+                b[0][l] = tinv*tinv*tinv; b[1][l] = 3.0f*tinv*tinv*t[l]; b[2][l] = 3.0f*tinv*t[l]*t[l]; b[3][l] = t[l]*t[l]*t[l];
             }
             break;
         default:
-            break; // b=0
+            break;
+    }
+}
+
+int ffd::splineCell(float u, int n, float &t)
+{
+    float s = u * (float) (n - 3);
+    int c = std::min((int) s, n - ffdspan); // u = 1 belongs to the last cell
+
+    t = s - (float) c;
+    return c;
+}
+
+void ffd::splineBasis(float t, float * b)
+{
+    float tinv = 1.0f - t, tsq = t*t, tcube = tsq*t;
+
+    UTS_COUNT(FFD_BASIS_EVALS, 1);
+    b[0] = tinv*tinv*tinv / 6.0f;
+    b[1] = (3.0f*tcube - 6.0f*tsq + 4.0f) / 6.0f;
+    b[2] = (-3.0f*tcube + 3.0f*tsq + 3.0f*t + 1.0f) / 6.0f;
+    b[3] = tcube / 6.0f;
+}
+
+void ffd::splineBasis(const float * t, float (* b)[ffdbatchsize])
+{
+    UTS_COUNT(FFD_BASIS_EVALS, ffdbatchsize);
+    // same expressions as the single value version, so that both round identically
+    #pragma omp simd
+    for(int l = 0; l < ffdbatchsize; l++)
+    {
+        float tinv = 1.0f - t[l], tsq = t[l]*t[l], tcube = tsq*t[l];
+
+        b[0][l] = tinv*tinv*tinv / 6.0f;
+        b[1][l] = (3.0f*tcube - 6.0f*tsq + 4.0f) / 6.0f;
+        b[2][l] = (-3.0f*tcube + 3.0f*tsq + 3.0f*t[l] + 1.0f) / 6.0f;
+        b[3][l] = tcube / 6.0f;
     }
-    return b;
 }
 
 ffd::ffd()
 {
     dimx = dimy = dimz = 0;
+    kernel = NULL;
+    batchkernel = NULL;
+    bspline = false;
     setFrame(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(0.0f, 0.0f, 0.0f));
-    cp = NULL;
-    highlight = NULL;
 }
 
-ffd::ffd(int xnum, int ynum, int znum, cgp::Point corner, cgp::Vector diag)
+ffd::ffd(int xnum, int ynum, int znum, cgp::Point corner, cgp::Vector diag, bool spline)
 {
     dimx = xnum;
     dimy = ynum;
     dimz = znum;
+    kernel = NULL;
+    batchkernel = NULL;
+    bspline = spline;
     alloc();
     setFrame(corner, diag);
 }
@@ -123,19 +418,25 @@ void ffd::reset()
     cgp::Vector step;
     cgp::Point pos;
 
+    if(cp.empty()) // unsupported dimensions, so there is no lattice
+        return;
+
     // use linear precision property of bezier curves to lay out ffd control point in a regular pattern
-    // that is equivalent to an identity deformation
-    step.i = diagonal.i / (float) (dimx-1);
-    step.j = diagonal.j / (float) (dimy-1);
-    step.k = diagonal.k / (float) (dimz-1);
+    // that is equivalent to an identity deformation. B-spline control points are spaced a cell apart, starting
+    // a cell before the frame.
+    float shift = bspline ? 1.0f : 0.0f;
+    int cells = bspline ? 3 : 1;
+    step.i = diagonal.i / (float) (dimx-cells);
+    step.j = diagonal.j / (float) (dimy-cells);
+    step.k = diagonal.k / (float) (dimz-cells);
 
     for(int i = 0; i < dimx; i++)
         for(int j = 0; j < dimy; j++)
             for(int k = 0; k < dimz; k++)
             {
                 pos = origin;
-                pos.x += (float) i * step.i; pos.y += (float) j * step.j; pos.z += (float) k * step.k;
-                cp[i][j][k] = pos;
+                pos.x += ((float) i - shift) * step.i; pos.y += ((float) j - shift) * step.j; pos.z += ((float) k - shift) * step.k;
+                cp[cpIndex(i,j,k)] = pos;
             }
 }
 
@@ -151,6 +452,13 @@ void ffd::setDim(int numx, int numy, int numz)
     reset();
 }
 
+void ffd::setBSpline(bool spline)
+{
+    bspline = spline;
+    alloc();
+    reset();
+}
+
 void ffd::getFrame(cgp::Point &corner, cgp::Vector &diag)
 {
     corner = origin;
@@ -164,97 +472,90 @@ void ffd::setFrame(cgp::Point corner, cgp::Vector diag)
     reset();
 }
 
+template<class Archive> void ffd::save(Archive & ar, const unsigned int version) const
+{
+    ar << dimx << dimy << dimz << bspline << origin << diagonal;
+    uts::saveArray(ar, cp);
+    ar << highlight;
+}
+
+template<class Archive> void ffd::load(Archive & ar, const unsigned int version)
+{
+    size_t numcp;
+
+    ar >> dimx >> dimy >> dimz >> bspline >> origin >> diagonal;
+    alloc();
+    numcp = cp.size(); // zero if the dimensions are unsupported
+    uts::loadArray(ar, cp);
+    ar >> highlight;
+    if(cp.size() != numcp || highlight.size() != numcp)
+    {
+        alloc(); // leave a consistent, undeformed lattice behind
+        reset();
+        throw boost::archive::archive_exception(boost::archive::archive_exception::array_size_too_short);
+    }
+    drawncp.clear(); // the instance buffer is refilled when next bound
+    drawnhighlight.clear();
+}
+
+template void ffd::save(boost::archive::binary_oarchive & ar, const unsigned int version) const;
+template void ffd::load(boost::archive::binary_iarchive & ar, const unsigned int version);
+
 void ffd::activateCP(int i, int j, int k)
 {
     if(inCPBounds(i,j,k))
-        highlight[i][j][k] = true;
+        highlight[cpIndex(i,j,k)] = true;
 }
 
 void ffd::deactivateCP(int i, int j, int k)
 {
     if(inCPBounds(i,j,k))
-        highlight[i][j][k] = false;
+        highlight[cpIndex(i,j,k)] = false;
 }
 
 void ffd::deactivateAllCP()
 {
-    for(int i = 0; i < dimx; i++)
-        for(int j = 0; j < dimy; j++)
-            for(int k = 0; k < dimz; k++)
-                highlight[i][j][k] = false;
+    std::fill(highlight.begin(), highlight.end(), false);
 }
 
-bool ffd::bindGeometry(View * view, ShapeDrawData &sdd, bool active)
+bool ffd::bindGeometry(View * view, ShapeDrawData &sdd)
 {
-    int i, j, k;
-    glm::mat4 tfm, idt;
-    glm::vec3 trs;
-    cgp::Point pnt;
-    bool draw;
+    if(cp.empty())
+        return false;
 
-    if(active)
-    {
-        activegeom.clear();
-        activegeom.setColour(highlightLatCol);
-    }
-    else
+    // one sphere, kept across binds, drawn at every control point
+    if(drawncp.empty())
     {
         geom.clear();
         geom.setColour(defaultLatCol);
+        geom.setHighlightColour(highlightLatCol);
+        geom.genSphere(ffdcpradius, 10, 10, glm::mat4(1.0f));
+    }
+    bool same = drawncp.size() == cp.size() && drawnhighlight == highlight;
+    for(int c = 0; same && c < (int) cp.size(); c++)
+        same = cp[c].x == drawncp[c].x && cp[c].y == drawncp[c].y && cp[c].z == drawncp[c].z;
+    if(!same)
+    {
+        geom.setInstances(cp, highlight);
+        drawncp = cp;
+        drawnhighlight = highlight;
     }
-
-    idt = glm::mat4(1.0f); // identity matrix
-
-    // place a sphere at non-active control point positions with appropriate colour
-    for(i = 0; i < dimx; i++)
-        for(j = 0; j < dimy; j++)
-            for(k = 0; k < dimz; k++)
-            {
-                if(active) // only draw those control points that match active flag
-                    draw = highlight[i][j][k];
-                else
-                    draw = !highlight[i][j][k];
-
-                if(draw)
-                {
-                    pnt = cp[i][j][k];
-                    trs = glm::vec3(pnt.x, pnt.y, pnt.z);
-                    tfm = glm::translate(idt, trs);
-                    if(active)
-                        activegeom.genSphere(0.4, 10, 10, tfm);
-                    else
-                        geom.genSphere(0.4, 10, 10, tfm);
-                }
-            }
 
     // bind geometry to buffers and return drawing parameters, if possible
-    if(active)
+    if(geom.bindBuffers(view))
     {
-        if(activegeom.bindBuffers(view))
-        {
-            sdd = activegeom.getDrawParameters();
-            return true;
-        }
-        else
-            return false;
+        sdd = geom.getDrawParameters();
+        return true;
     }
     else
-    {
-        if(geom.bindBuffers(view))
-        {
-            sdd = geom.getDrawParameters();
-            return true;
-        }
-        else
-            return false;
-    }
+        return false;
 }
 
 cgp::Point ffd::getCP(int i, int j, int k)
 {
     if(inCPBounds(i,j,k))
     {
-        return cp[i][j][k];
+        return cp[cpIndex(i,j,k)];
     }
     else
     {
@@ -263,17 +564,80 @@ cgp::Point ffd::getCP(int i, int j, int k)
     }
 }
 
+bool ffd::pickCP(cgp::Point start, cgp::Vector dirn, int &i, int &j, int &k)
+{
+    cgp::BoundBox bbox;
+    float o[3] = {start.x, start.y, start.z}, d[3], lo[3], hi[3];
+    float tmin = 0.0f, tmax = HUGE_VALF, t0, t1, best = HUGE_VALF, rsq = ffdcpradius * ffdcpradius;
+    int found = -1;
+
+    if(cp.empty() || dirn.sqrdlength() <= 0.0f)
+        return false;
+    dirn.normalize();
+    d[0] = dirn.i; d[1] = dirn.j; d[2] = dirn.k;
+
+    // reject rays that miss the box around every sphere, which is most of them when the lattice is small on screen
+    bbox.includePnts(cp.data(), cp.size());
+    lo[0] = bbox.min.x - ffdcpradius; lo[1] = bbox.min.y - ffdcpradius; lo[2] = bbox.min.z - ffdcpradius;
+    hi[0] = bbox.max.x + ffdcpradius; hi[1] = bbox.max.y + ffdcpradius; hi[2] = bbox.max.z + ffdcpradius;
+    for(int a = 0; a < 3; a++)
+    {
+        if(d[a] == 0.0f)
+        {
+            if(o[a] < lo[a] || o[a] > hi[a])
+                return false;
+            continue;
+        }
+        t0 = (lo[a] - o[a]) / d[a];
+        t1 = (hi[a] - o[a]) / d[a];
+        if(t0 > t1)
+            std::swap(t0, t1);
+        tmin = std::max(tmin, t0);
+        tmax = std::min(tmax, t1);
+        if(tmin > tmax)
+            return false;
+    }
+
+    for(int c = 0; c < (int) cp.size(); c++)
+    {
+        float oc[3] = {cp[c].x - o[0], cp[c].y - o[1], cp[c].z - o[2]};
+        float tc = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+        float perp = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - tc * tc;
+        float half, t;
+
+        if(perp > rsq)
+            continue;
+        half = sqrtf(rsq - perp);
+        if(tc + half < 0.0f) // sphere lies behind the start
+            continue;
+        t = std::max(tc - half, 0.0f); // a start inside a sphere picks it at once
+        if(t < best)
+        {
+            best = t;
+            found = c;
+        }
+    }
+    if(found < 0)
+        return false;
+    i = found / (dimy * dimz);
+    j = (found / dimz) % dimy;
+    k = found % dimz;
+    return true;
+}
+
 void ffd::setCP(int i, int j, int k, cgp::Point pnt)
 {
     if(inCPBounds(i,j,k))
-         cp[i][j][k] = pnt;
+         cp[cpIndex(i,j,k)] = pnt;
 }
 
 void ffd::deform(cgp::Point & pnt)
 {
     float u, v, w; // coordinates of point within the lattice
-    int i, j, k; // control point indices
-    float b; // basis value
+    float bu[ffdmaxorder], bv[ffdmaxorder], bw[ffdmaxorder]; // basis values along each axis
+
+    if(cp.empty())
+        return;
 
     // embed in axis-aligned lattice
     // basically, find the local [0,1]X[0,1]X[0,1] coordinates of the point within the space of the lattice
@@ -284,18 +648,340 @@ void ffd::deform(cgp::Point & pnt)
     // don't change the point if it lies outside the lattice
     if(u >= 0.0f && u <= 1.0f && v >= 0.0f && v <= 1.0f && w >= 0.0f && w <= 1.0f)
     {
-        pnt = cgp::Point(0.0f, 0.0f, 0.0f);
-
         // deformation
         // weighted sum of control points and basis functions that depends on the vertex (u,v,w) coordinates
-        for(i = 0; i < dimx; ++i)
-            for(j = 0; j < dimy; ++j)
-                for(k = 0; k < dimz; ++k)
+        // the trivariate basis is a product of univariate ones, so each axis is evaluated once
+        if(bspline)
+        {
+            float tu, tv, tw;
+            int ci = splineCell(u, dimx, tu), cj = splineCell(v, dimy, tv), ck = splineCell(w, dimz, tw);
+
+            splineBasis(tu, bu);
+            splineBasis(tv, bv);
+            splineBasis(tw, bw);
+            contractWindow(&cp[cpIndex(ci, cj, ck)], dimz, dimy * dimz, bu, bv, bw, pnt);
+        }
+        else
+        {
+            basis(u, dimx-1, bu);
+            basis(v, dimy-1, bv);
+            basis(w, dimz-1, bw);
+            kernel(cp.data(), bu, bv, bw, pnt);
+        }
+    }
+}
+
+void ffd::deform(const cgp::Point * in, cgp::Point * out, size_t n)
+{
+    int numbatches = (int) ((n + ffdbatchsize - 1) / ffdbatchsize);
+
+    if(cp.empty())
+    {
+        if(in != out)
+            std::copy(in, in + n, out);
+        return;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for(int b = 0; b < numbatches; b++)
+    {
+        float u[ffdbatchsize], v[ffdbatchsize], w[ffdbatchsize];
+        float bu[ffdmaxorder][ffdbatchsize], bv[ffdmaxorder][ffdbatchsize], bw[ffdmaxorder][ffdbatchsize];
+        float ox[ffdbatchsize], oy[ffdbatchsize], oz[ffdbatchsize];
+        int first[ffdbatchsize];
+        bool inside[ffdbatchsize];
+        size_t start = (size_t) b * ffdbatchsize;
+        int count = (int) std::min((size_t) ffdbatchsize, n - start), l;
+
+        // embed in the lattice, with unused lanes parked at the origin of the lattice
+        for(l = 0; l < ffdbatchsize; l++)
+        {
+            if(l < count)
+            {
+                u[l] = (in[start+l].x - origin.x) / diagonal.i;
+                v[l] = (in[start+l].y - origin.y) / diagonal.j;
+                w[l] = (in[start+l].z - origin.z) / diagonal.k;
+                inside[l] = (u[l] >= 0.0f && u[l] <= 1.0f && v[l] >= 0.0f && v[l] <= 1.0f && w[l] >= 0.0f && w[l] <= 1.0f);
+            }
+            else
+            {
+                u[l] = v[l] = w[l] = 0.0f;
+                inside[l] = false;
+            }
+        }
+
+        if(bspline)
+        {
+            // parameters are replaced by their positions within the cells, whose windows the lanes gather, with
+            // lanes outside the lattice parked in the first cell
+            for(l = 0; l < ffdbatchsize; l++)
+            {
+                if(!inside[l])
+                    u[l] = v[l] = w[l] = 0.0f;
+                int ci = splineCell(u[l], dimx, u[l]), cj = splineCell(v[l], dimy, v[l]), ck = splineCell(w[l], dimz, w[l]);
+                first[l] = cpIndex(ci, cj, ck);
+            }
+            splineBasis(u, bu);
+            splineBasis(v, bv);
+            splineBasis(w, bw);
+            contractWindowBatch(cp.data(), dimz, dimy * dimz, first, bu, bv, bw, ox, oy, oz);
+        }
+        else
+        {
+            basis(u, dimx-1, bu);
+            basis(v, dimy-1, bv);
+            basis(w, dimz-1, bw);
+            batchkernel(cp.data(), bu, bv, bw, ox, oy, oz);
+        }
+
+        // points outside the lattice are left unchanged
+        for(l = 0; l < count; l++)
+            if(inside[l])
+                out[start+l] = cgp::Point(ox[l], oy[l], oz[l]);
+            else if(in != out)
+                out[start+l] = in[start+l];
+    }
+}
+
+void ffd::hashContent(ContentHash &hash)
+{
+    hash.addString("ffd");
+    hash.addInt(bspline ? 1 : 0);
+    hash.addInt(dimx); hash.addInt(dimy); hash.addInt(dimz);
+    hash.addFloat(origin.x); hash.addFloat(origin.y); hash.addFloat(origin.z);
+    hash.addFloat(diagonal.i); hash.addFloat(diagonal.j); hash.addFloat(diagonal.k);
+    for(const cgp::Point &p : cp)
+    {
+        hash.addFloat(p.x); hash.addFloat(p.y); hash.addFloat(p.z);
+    }
+}
+
+void ffdEmbedding::clear()
+{
+    origin = cgp::Point(0.0f, 0.0f, 0.0f);
+    diagonal = cgp::Vector(0.0f, 0.0f, 0.0f);
+    dimx = dimy = dimz = 0;
+    bspline = false;
+    numpoints = 0;
+    inside.clear();
+    weights.clear();
+    windows.clear();
+    cellstart.clear();
+    cellpoints.clear();
+    lastcp.clear();
+    deltas = 0;
+}
+
+bool ffdEmbedding::matches(ffd &lat, size_t n)
+{
+    return !lat.cp.empty() && numpoints == n && lat.dimx == dimx && lat.dimy == dimy && lat.dimz == dimz && lat.bspline == bspline
+           && lat.origin.x == origin.x && lat.origin.y == origin.y && lat.origin.z == origin.z
+           && lat.diagonal.i == diagonal.i && lat.diagonal.j == diagonal.j && lat.diagonal.k == diagonal.k;
+}
+
+void ffdEmbedding::bind(ffd &lat, const cgp::Point * pts, size_t n)
+{
+    vector<uint8_t> within(n, 0);
+    vector<int> cells;
+    int stride, cx, cy, cz;
+
+    clear();
+    if(lat.cp.empty())
+        return;
+    origin = lat.origin;
+    diagonal = lat.diagonal;
+    dimx = lat.dimx; dimy = lat.dimy; dimz = lat.dimz;
+    bspline = lat.bspline;
+    numpoints = n;
+    stride = bspline ? 3 * ffdspan : dimx + dimy + dimz;
+
+    // embed in axis-aligned lattice, using the same tests as ffd::deform
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < (int) n; v++)
+    {
+        float u = (pts[v].x - origin.x) / diagonal.i;
+        float w = (pts[v].y - origin.y) / diagonal.j;
+        float t = (pts[v].z - origin.z) / diagonal.k;
+        within[v] = (u >= 0.0f && u <= 1.0f && w >= 0.0f && w <= 1.0f && t >= 0.0f && t <= 1.0f);
+    }
+    for(int v = 0; v < (int) n; v++)
+        if(within[v])
+            inside.push_back(v);
+
+    weights.resize(inside.size() * stride);
+    if(bspline)
+    {
+        windows.resize(inside.size());
+        cells.resize(inside.size());
+    }
+    cx = dimx - 3; cy = dimy - 3; cz = dimz - 3;
+    #pragma omp parallel for schedule(static)
+    for(int p = 0; p < (int) inside.size(); p++)
+    {
+        const cgp::Point &pnt = pts[inside[p]];
+        float * b = &weights[(size_t) p * stride];
+
+        if(bspline)
+        {
+            float tu, tv, tw;
+            int ci = ffd::splineCell((pnt.x - origin.x) / diagonal.i, dimx, tu);
+            int cj = ffd::splineCell((pnt.y - origin.y) / diagonal.j, dimy, tv);
+            int ck = ffd::splineCell((pnt.z - origin.z) / diagonal.k, dimz, tw);
+
+            ffd::splineBasis(tu, b);
+            ffd::splineBasis(tv, b + ffdspan);
+            ffd::splineBasis(tw, b + 2 * ffdspan);
+            windows[p] = lat.cpIndex(ci, cj, ck);
+            cells[p] = (ci * cy + cj) * cz + ck;
+        }
+        else
+        {
+            ffd::basis((pnt.x - origin.x) / diagonal.i, dimx-1, b);
+            ffd::basis((pnt.y - origin.y) / diagonal.j, dimy-1, b + dimx);
+            ffd::basis((pnt.z - origin.z) / diagonal.k, dimz-1, b + dimx + dimy);
+        }
+    }
+
+    // counting sort of the points by cell, which keeps them in increasing order within each cell
+    if(bspline)
+    {
+        cellstart.assign((size_t) cx * cy * cz + 1, 0);
+        for(int p = 0; p < (int) inside.size(); p++)
+            cellstart[cells[p] + 1]++;
+        for(int c = 0; c < cx * cy * cz; c++)
+            cellstart[c + 1] += cellstart[c];
+        cellpoints.resize(inside.size());
+        vector<int> fill(cellstart.begin(), cellstart.end() - 1);
+        for(int p = 0; p < (int) inside.size(); p++)
+            cellpoints[fill[cells[p]]++] = p;
+    }
+}
+
+void ffdEmbedding::evaluate(ffd &lat, int p, cgp::Point &pnt)
+{
+    if(bspline)
+    {
+        const float * b = &weights[(size_t) p * 3 * ffdspan];
+        contractWindow(lat.cp.data() + windows[p], dimz, dimy * dimz, b, b + ffdspan, b + 2 * ffdspan, pnt);
+    }
+    else
+    {
+        const float * b = &weights[(size_t) p * (dimx + dimy + dimz)];
+        lat.kernel(lat.cp.data(), b, b + dimx, b + dimx + dimy, pnt);
+    }
+}
+
+void ffdEmbedding::gatherSupport(const std::vector<int> &changed, std::vector<int> &todo)
+{
+    int cx = dimx - 3, cy = dimy - 3, cz = dimz - 3;
+    vector<uint8_t> mark((size_t) cx * cy * cz, 0);
+
+    // control point i lies in the windows of cells i-3 to i along each axis
+    todo.clear();
+    for(int c : changed)
+    {
+        int i = c / (dimy * dimz), j = (c / dimz) % dimy, k = c % dimz;
+        for(int ci = std::max(i - 3, 0); ci <= std::min(i, cx - 1); ci++)
+            for(int cj = std::max(j - 3, 0); cj <= std::min(j, cy - 1); cj++)
+                for(int ck = std::max(k - 3, 0); ck <= std::min(k, cz - 1); ck++)
                 {
-                    b = basis(u, i, dimx-1) * basis(v, j, dimy-1) * basis(w, k, dimz-1);
-                    pnt.x +=  b * cp[i][j][k].x;
-                    pnt.y +=  b * cp[i][j][k].y;
-                    pnt.z +=  b * cp[i][j][k].z;
+                    int cell = (ci * cy + cj) * cz + ck;
+                    if(!mark[cell])
+                    {
+                        mark[cell] = 1;
+                        todo.insert(todo.end(), cellpoints.begin() + cellstart[cell], cellpoints.begin() + cellstart[cell + 1]);
+                    }
                 }
     }
-}
\ No newline at end of file
+    std::sort(todo.begin(), todo.end());
+}
+
+void ffdEmbedding::deform(ffd &lat, const cgp::Point * pts, cgp::Point * out, std::vector<int> &moved)
+{
+    vector<int> changed, todo;
+    vector<uint8_t> flag;
+    int stride = bspline ? 3 * ffdspan : dimx + dimy + dimz, numcp = dimx * dimy * dimz, numtodo;
+    int nx = bspline ? ffdspan : dimx, ny = bspline ? ffdspan : dimy, nz = bspline ? ffdspan : dimz;
+    bool first = lastcp.empty(), full, local;
+
+    moved.clear();
+    if(!matches(lat, numpoints))
+        return;
+
+    // control points that moved since the last evaluation
+    if(!first)
+        for(int c = 0; c < numcp; c++)
+            if(lat.cp[c].x != lastcp[c].x || lat.cp[c].y != lastcp[c].y || lat.cp[c].z != lastcp[c].z)
+                changed.push_back(c);
+    if(!first && changed.empty())
+        return;
+    full = first || (int) changed.size() > ffdmaxdelta || deltas >= ffdrefresh;
+
+    if(first)
+    {
+        // outside points take their undeformed positions, and every point is compared against what was there before
+        vector<cgp::Point> prev(out, out + numpoints);
+
+        #pragma omp parallel for schedule(static)
+        for(int v = 0; v < (int) numpoints; v++)
+            out[v] = pts[v];
+        #pragma omp parallel for schedule(static)
+        for(int p = 0; p < (int) inside.size(); p++)
+            evaluate(lat, p, out[inside[p]]);
+        for(int v = 0; v < (int) numpoints; v++)
+            if(out[v].x != prev[v].x || out[v].y != prev[v].y || out[v].z != prev[v].z)
+                moved.push_back(v);
+    }
+    else
+    {
+        // a B-spline lattice only reaches the points in the cells around the moved control points, except when
+        // a refresh clears the rounding drift of every point
+        local = bspline && deltas < ffdrefresh;
+        if(local)
+            gatherSupport(changed, todo);
+        numtodo = local ? (int) todo.size() : (int) inside.size();
+
+        flag.assign(numtodo, 0);
+        #pragma omp parallel for schedule(static)
+        for(int q = 0; q < numtodo; q++)
+        {
+            int p = local ? todo[q] : q;
+            const float * b = &weights[(size_t) p * stride];
+            cgp::Point pnt = out[inside[p]];
+
+            if(full)
+                evaluate(lat, p, pnt);
+            else
+            {
+                // add the displacement of each moved control point, weighted by its tensor product basis, with
+                // indices taken relative to the window of the point
+                int wi = 0, wj = 0, wk = 0;
+                if(bspline)
+                {
+                    wi = windows[p] / (dimy * dimz); wj = (windows[p] / dimz) % dimy; wk = windows[p] % dimz;
+                }
+                for(int m = 0; m < (int) changed.size(); m++)
+                {
+                    int c = changed[m], i = c / (dimy * dimz) - wi, j = (c / dimz) % dimy - wj, k = c % dimz - wk;
+                    if(i < 0 || i >= nx || j < 0 || j >= ny || k < 0 || k >= nz)
+                        continue;
+                    float wgt = b[i] * b[nx + j] * b[nx + ny + k];
+                    pnt.x += wgt * (lat.cp[c].x - lastcp[c].x);
+                    pnt.y += wgt * (lat.cp[c].y - lastcp[c].y);
+                    pnt.z += wgt * (lat.cp[c].z - lastcp[c].z);
+                }
+            }
+            cgp::Point &dst = out[inside[p]];
+            if(pnt.x != dst.x || pnt.y != dst.y || pnt.z != dst.z)
+            {
+                dst = pnt;
+                flag[q] = 1;
+            }
+        }
+        for(int q = 0; q < numtodo; q++)
+            if(flag[q])
+                moved.push_back(inside[local ? todo[q] : q]);
+    }
+    deltas = full ? 0 : deltas + 1;
+    lastcp = lat.cp;
+}
@@ -3,25 +3,64 @@
 /**
  * @file
  *
- * Free-form Deformation to warp vertices of a mesh. Uses a Bezier basis.
+ * Free-form Deformation to warp vertices of a mesh. Uses a Bezier basis, or a uniform cubic B-spline basis for
+ * finer lattices.
  */
 
 #include <vector>
 #include <stdio.h>
 #include <iostream>
-#include "renderer.h"
+#include "shape.h"
+
+class ContentHash;
+
+const int ffdmaxorder = 4;      ///< maximum number of control points along each axis of a Bezier lattice
+const int ffdspan = 4;          ///< control points along each axis that influence a point of a B-spline lattice
+const int ffdbatchsize = 16;    ///< points deformed together by a batch kernel, as the lanes of vectorised loops
+const int ffdmaxdelta = 4;      ///< moved control points above which an embedding is reevaluated in full rather than updated
+const int ffdrefresh = 32;      ///< delta updates between full reevaluations of an embedding, bounding rounding drift
+const float ffdcpradius = 0.4f; ///< radius of the sphere drawn at each control point, which picking tests against
+
+/**
+ * Deformation kernel specialised for one combination of per-axis lattice orders, contracting the control points
+ * against per-axis basis weights
+ * @param cp        control points, indexed by (i * dimy + j) * dimz + k
+ * @param bu, bv, bw    basis weights along x, y and z
+ * @param[out] out  weighted sum of the control points
+ */
+typedef void (* ffdKernel)(const cgp::Point * cp, const float * bu, const float * bv, const float * bw, cgp::Point &out);
+
+/**
+ * Batch deformation kernel, the vectorised counterpart of ffdKernel for ffdbatchsize points at a time
+ * @param cp        control points, indexed by (i * dimy + j) * dimz + k
+ * @param bu, bv, bw    basis weights along x, y and z, one row per control point index and one column per point
+ * @param[out] ox, oy, oz   coordinates of the weighted sums, one per point
+ */
+typedef void (* ffdBatchKernel)(const cgp::Point * cp, const float (* bu)[ffdbatchsize], const float (* bv)[ffdbatchsize],
+                                const float (* bw)[ffdbatchsize], float * ox, float * oy, float * oz);
 
 /**
  * Free-Form Deformation of geometric models. Supports Bezier bases with n=1,2,3
- * that can be set seperately for each dimension.
+ * that can be set seperately for each dimension, or a uniform cubic B-spline basis with any number of control
+ * points from ffdspan upwards along each axis. A B-spline lattice is divided into (dimx-3) x (dimy-3) x (dimz-3)
+ * cells, and a point in a cell depends only on the ffdspan x ffdspan x ffdspan window of control points around it,
+ * so the cost per point is fixed however fine the lattice and a control point only moves points in the cells
+ * around it.
  */
 class ffd
 {
+    friend class ffdEmbedding;
+
 private:
     cgp::Point origin;      ///< bottom left front corner of lattice
     cgp::Vector diagonal;   ///< diagonal extent of lattice
-    cgp::Point *** cp;      ///< dimx * dimy * dimz lattice of control points
-    bool *** highlight;     ///< highlighting of control points to show selection
+    std::vector<cgp::Point> cp;     ///< dimx * dimy * dimz lattice of control points, contiguous with k varying fastest
+    std::vector<bool> highlight;    ///< highlighting of control points to show selection, indexed like cp
+    std::vector<cgp::Point> drawncp;    ///< control points in the instance buffer of geom, empty before the first bind
+    std::vector<bool> drawnhighlight;   ///< highlighting in the instance buffer of geom
+    ffdKernel kernel;               ///< deformation kernel matching the lattice dimensions, NULL if they are unsupported
+    ffdBatchKernel batchkernel;     ///< batch deformation kernel matching the lattice dimensions, NULL if they are unsupported or B-spline
+    bool bspline;           ///< uniform cubic B-spline basis rather than Bezier
     int dimx;               ///< number of control points in x dimension
     int dimy;               ///< number of control points in y dimension
     int dimz;               ///< number of control points in z dimension
@@ -32,6 +71,9 @@ private:
     /// Memory deallocation of 3D array
     void dealloc();
 
+    /// Position of control point (i, j, k) in the flattened arrays
+    int cpIndex(int i, int j, int k){ return (i * dimy + j) * dimz + k; }
+
     /**
      * Check control point access to see if it is out of bounds
      * @param i, j, k   control point index [0..dimx-1,0..dimy-1,0..dimz-1] in lattice
@@ -42,29 +84,59 @@ private:
 
 
     /**
-     * Evaluate a Bernstein polynomial for a given parameter value
-     * @param t     parameter value, in [0,1]
-     * @param i     control point index, in [0,n]
-     * @param n     polynomial degree, in [1,3]
-     * @return evaluated basis function, or 0 if any parameters are set incorrectly
+     * Evaluate every Bernstein polynomial of a given degree at once for a parameter value
+     * @param t         parameter value, in [0,1]
+     * @param n         polynomial degree, in [1,3]
+     * @param[out] b    n+1 basis values, b[i] weighting control point i
      */
-    float basis(float t, int i, int n);
+    static void basis(float t, int n, float * b);
+
+    /**
+     * Evaluate every Bernstein polynomial of a given degree for a batch of parameter values
+     * @param t         ffdbatchsize parameter values, in [0,1]
+     * @param n         polynomial degree, in [1,3]
+     * @param[out] b    n+1 rows of basis values, b[i][l] weighting control point i for parameter l
+     */
+    static void basis(const float * t, int n, float (* b)[ffdbatchsize]);
+
+    /**
+     * Locate the cell of a B-spline lattice that holds a parameter value along one axis
+     * @param u         parameter value across the lattice, in [0,1]
+     * @param n         number of control points along the axis, at least ffdspan
+     * @param[out] t    parameter value within the cell, in [0,1]
+     * @returns index of the cell, which is also the first control point of its window, in [0, n-ffdspan]
+     */
+    static int splineCell(float u, int n, float &t);
+
+    /**
+     * Evaluate the uniform cubic B-spline basis within a cell
+     * @param t         parameter value within the cell, in [0,1]
+     * @param[out] b    ffdspan basis values, b[i] weighting control point i of the window
+     */
+    static void splineBasis(float t, float * b);
+
+    /**
+     * Evaluate the uniform cubic B-spline basis for a batch of parameter values within their cells
+     * @param t         ffdbatchsize parameter values, in [0,1]
+     * @param[out] b    ffdspan rows of basis values, b[i][l] weighting control point i of the window of parameter l
+     */
+    static void splineBasis(const float * t, float (* b)[ffdbatchsize]);
 
 public:
 
-    ShapeGeometry geom;         ///< renderable version of non-active lattice
-    ShapeGeometry activegeom;   ///< renderable version of active lattice (selected control points)
+    ShapeGeometry geom;         ///< one sphere instanced at every control point, with highlighted control points flagged
 
     /// Default constructor
     ffd();
 
     /**
      * Create FFD lattice with specified dimensions
-     * @param xnum, ynum, znum  number of control point in x, y, z dimensions (2-4)
+     * @param xnum, ynum, znum  number of control point in x, y, z dimensions (2-4, or at least ffdspan for B-spline)
      * @param corner    origin position of the volume
      * @param diag      diagonal extent of the volume
+     * @param spline    use a uniform cubic B-spline basis rather than Bezier
      */
-    ffd(int xnum, int ynum, int znum, cgp::Point corner, cgp::Vector diag);
+    ffd(int xnum, int ynum, int znum, cgp::Point corner, cgp::Vector diag, bool spline = false);
 
     /// Destructor
     ~ffd(){ dealloc(); }
@@ -72,6 +144,8 @@ public:
     /**
      * Reset all control points to their initial underformed positions. These are chosen to ensure that, by
      * linear precision, no deformation happens even if deform is called. In other words, the identity deformation.
+     * The outermost control points of a B-spline lattice lie one cell beyond the frame, since each B-spline control
+     * point sits at the centre of its support rather than at the end of the curve.
      */
     void reset();
 
@@ -87,6 +161,16 @@ public:
      */
     void setDim(int numx, int numy, int numz);
 
+    /// Getter for the B-spline basis
+    bool isBSpline(){ return bspline; }
+
+    /**
+     * Switch between the Bezier and the uniform cubic B-spline basis, keeping the dimensions and resetting the
+     * control points. Dimensions unsupported by the new basis leave no lattice.
+     * @param spline    use a uniform cubic B-spline basis rather than Bezier
+     */
+    void setBSpline(bool spline);
+
     /**
      * Getter for the placement and dimensions of the lattice in 3d space
      * @param[out] corner    bottom, front, left corner of the lattice
@@ -119,14 +203,16 @@ public:
     void deactivateAllCP();
 
     /**
-     * Generate triangle mesh geometry for OpenGL rendering of control points.
+     * Bind geometry for OpenGL rendering of control points, drawn in a single instanced call with highlighted
+     * control points in the highlight colour. The sphere is generated once, and the instance buffer is only
+     * rewritten when a control point or its highlighting differs from what was last bound, so rebinding an
+     * unchanged lattice uploads nothing.
      * @param view      current view parameters
      * @param[out] sdd  openGL parameters required to draw this geometry
-     * @param active    if true then draw highlighted cp, otherwise draw non-active cp
      * @retval @c true  if buffers are bound successfully, in which case sdd is valid
      * @retval @c false otherwise
      */
-    bool bindGeometry(View * view, ShapeDrawData &sdd, bool active);
+    bool bindGeometry(View * view, ShapeDrawData &sdd);
 
     /**
      * Getter for control point positions
@@ -135,6 +221,17 @@ public:
      */
     cgp::Point getCP(int i, int j, int k);
 
+    /**
+     * Pick the control point whose sphere a ray meets first. After a single test against the box around all of the
+     * spheres every sphere is tested directly, which stays cheap for lattices small enough to edit by hand.
+     * @param start         start of the ray, such as the centre of projection from View::projectingRay
+     * @param dirn          direction of the ray
+     * @param[out] i, j, k  index of the picked control point, unchanged if there is none
+     * @retval true if the ray meets a control point sphere in front of @a start,
+     * @retval false otherwise
+     */
+    bool pickCP(cgp::Point start, cgp::Vector dirn, int &i, int &j, int &k);
+
     /**
      * Setter for control point positions
      * @param i, j, k   control point index [0..dimx-1,0..dimy-1,0..dimz-1] in lattice
@@ -147,6 +244,110 @@ public:
      * @param[out] pnt  Point undergoing deformation
      */
     void deform(cgp::Point & pnt);
+
+    /**
+     * Apply free-form deformation to an array of points. Points are processed in groups of ffdbatchsize through
+     * vectorised kernels, with groups spread across threads, and results match the single point version.
+     * @param in        points to deform
+     * @param[out] out  deformed points, which may be the same array as in
+     * @param n         number of points
+     */
+    void deform(const cgp::Point * in, cgp::Point * out, size_t n);
+
+    /**
+     * Add the dimensions, basis, frame and control points to a hash, so that lattices giving the same deformation
+     * hash equally whatever their highlighting
+     * @param hash  hash being accumulated
+     */
+    void hashContent(ContentHash &hash);
+
+    /**
+     * Write the dimensions, basis, frame, control points and highlighting to a Boost archive, with the control
+     * points as one block. Instantiated for the binary archives.
+     * @param ar    output archive
+     */
+    template<class Archive> void save(Archive & ar, const unsigned int version) const;
+
+    /**
+     * Replace the lattice with one written by save
+     * @param ar    input archive
+     */
+    template<class Archive> void load(Archive & ar, const unsigned int version);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+/**
+ * Lattice coordinates and basis weights of a fixed set of points, cached for repeated deformation by the same lattice.
+ * Binding embeds every point once for the lattice frame and dimensions. After that, moving control points needs only
+ * the stored weights: a full weighted sum of the control points, or, when few control points moved, an update by
+ * their displacement alone. Points outside the lattice are never touched after the first evaluation. For a B-spline
+ * lattice the points are also listed by cell, so that only the cells around the moved control points are visited.
+ */
+class ffdEmbedding
+{
+private:
+    cgp::Point origin;              ///< lattice corner at binding
+    cgp::Vector diagonal;           ///< lattice extent at binding
+    int dimx, dimy, dimz;           ///< lattice dimensions at binding
+    bool bspline;                   ///< lattice basis at binding
+    size_t numpoints;               ///< number of points bound
+    std::vector<int> inside;        ///< indices of the bound points that lie within the lattice
+    std::vector<float> weights;     ///< basis values for each inside point along x then y then z, dimx + dimy + dimz of them for Bezier and 3 * ffdspan for B-spline
+    std::vector<int> windows;       ///< first control point of the window of each inside point, B-spline only
+    std::vector<int> cellstart;     ///< start of the points of each cell in cellpoints, with a final end marker, B-spline only
+    std::vector<int> cellpoints;    ///< positions in inside of the points of each cell, in increasing order within a cell, B-spline only
+    std::vector<cgp::Point> lastcp; ///< control points at the last evaluation, empty before the first
+    int deltas;                     ///< delta updates since the last full evaluation
+
+    /**
+     * Weighted sum of the control points for one inside point
+     * @param lat       matching lattice
+     * @param p         position of the point in inside
+     * @param[out] pnt  deformed point
+     */
+    void evaluate(ffd &lat, int p, cgp::Point &pnt);
+
+    /**
+     * Gather the inside points of a B-spline lattice whose windows contain any of a set of control points
+     * @param changed       control point indices
+     * @param[out] todo     positions in inside of the points reached, in increasing order
+     */
+    void gatherSupport(const std::vector<int> &changed, std::vector<int> &todo);
+
+public:
+
+    /// Default constructor
+    ffdEmbedding(){ clear(); }
+
+    /// Forget the bound points
+    void clear();
+
+    /**
+     * Test whether the embedding is bound to the frame and dimensions of a lattice and to a number of points
+     * @param lat   lattice to compare against
+     * @param n     number of points
+     * @retval true if the cached weights can be used with this lattice,
+     * @retval false otherwise
+     */
+    bool matches(ffd &lat, size_t n);
+
+    /**
+     * Embed points in the undeformed lattice and store their basis weights
+     * @param lat   lattice, whose frame and dimensions are recorded
+     * @param pts   undeformed points
+     * @param n     number of points
+     */
+    void bind(ffd &lat, const cgp::Point * pts, size_t n);
+
+    /**
+     * Deform the bound points with the current control points of a matching lattice
+     * @param lat       lattice, which must match the binding
+     * @param pts       undeformed points, as bound
+     * @param[in,out] out   deformed points, holding the result of the previous evaluation after the first
+     * @param[out] moved    indices of the points whose deformed position changed, in increasing order
+     */
+    void deform(ffd &lat, const cgp::Point * pts, cgp::Point * out, std::vector<int> &moved);
 };
 
-#endif
\ No newline at end of file
+#endif
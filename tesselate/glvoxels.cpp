@@ -0,0 +1,278 @@
+/**
+ * @file
+ *
+ * Voxelisation of csg leaves by rasterising their triangles with OpenGL
+ */
+
+#ifndef TESS_HEADLESS
+#include "glheaders.h" // before any Qt OpenGL header
+#endif
+#include "glvoxels.h"
+#include <algorithm>
+#include <iostream>
+#include "common/log.h"
+#ifndef TESS_HEADLESS
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QSurfaceFormat>
+#include "shaderProgram.h"
+#endif
+
+using namespace std;
+
+GLVoxeliser::GLVoxeliser()
+{
+    tried = false;
+    ready = false;
+    surface = NULL;
+    context = NULL;
+    program = NULL;
+    fbo = target = vao = vbo = 0;
+}
+
+GLVoxeliser::~GLVoxeliser()
+{
+    release();
+#ifndef TESS_HEADLESS
+    delete surface;
+#endif
+}
+
+void GLVoxeliser::shareGL()
+{
+#ifndef TESS_HEADLESS
+    QSurfaceFormat format;
+
+    if(surface != NULL || QOpenGLContext::currentContext() == NULL)
+        return;
+    format.setVersion(3, 2); // integer render targets and the shaders of the renderer
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    surface = new QOffscreenSurface();
+    surface->setFormat(format);
+    surface->create();
+    if(!surface->isValid())
+    {
+        delete surface;
+        surface = NULL;
+        return;
+    }
+    if(tried && !ready) // looked for before the surface existed, so look again on next use
+        tried = false;
+#endif
+}
+
+bool GLVoxeliser::available()
+{
+    if(!tried)
+    {
+        tried = true;
+        ready = begin();
+        end();
+        if(ready)
+            UTS_LOG(INFO, VOXELS, "GLVoxeliser: voxelising on ", device);
+        else
+            UTS_LOG(INFO, VOXELS, "GLVoxeliser: no OpenGL context for voxelisation, voxelising on the CPU");
+    }
+    return ready;
+}
+
+bool GLVoxeliser::begin()
+{
+#ifdef TESS_HEADLESS
+    return false;
+#else
+    GLenum status;
+
+    if(surface == NULL)
+        return false;
+    release();
+    context = new QOpenGLContext();
+    context->setFormat(surface->format());
+    if(!context->create() || !context->makeCurrent(surface))
+    {
+        cerr << "Error GLVoxeliser::begin: unable to make an OpenGL context current" << endl;
+        release();
+        return false;
+    }
+    if(context->format().majorVersion() < 3)
+    {
+        cerr << "Error GLVoxeliser::begin: OpenGL " << context->format().majorVersion() << "." << context->format().minorVersion()
+             << " has no integer render targets" << endl;
+        release();
+        return false;
+    }
+    device = (const char *) glGetString(GL_RENDERER);
+
+    program = new shaderProgram();
+    program->setShaderSources(std::string("voxelise.frag"), std::string("voxelise.vert"));
+    if(!program->compileAndLink())
+    {
+        cerr << "Error GLVoxeliser::begin: the voxelise shaders did not build" << endl;
+        release();
+        return false;
+    }
+
+    glGenTextures(1, &target);
+    glBindTexture(GL_TEXTURE_2D, target);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, glvoxmaxtile, glvoxmaxtile, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cerr << "Error GLVoxeliser::begin: framebuffer incomplete, status " << status << endl;
+        release();
+        return false;
+    }
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+
+    // every fragment counts, whichever way its triangle faces and however deep it lies
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    glDisable(GL_MULTISAMPLE);
+    glEnable(GL_DEPTH_CLAMP);
+    glEnable(GL_COLOR_LOGIC_OP);
+    glLogicOp(GL_XOR);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    if(glGetError() != GL_NO_ERROR)
+    {
+        cerr << "Error GLVoxeliser::begin: setting up the framebuffer failed" << endl;
+        release();
+        return false;
+    }
+    return true;
+#endif
+}
+
+void GLVoxeliser::end()
+{
+    release();
+}
+
+void GLVoxeliser::release()
+{
+#ifndef TESS_HEADLESS
+    if(context == NULL)
+        return;
+    if(QOpenGLContext::currentContext() == context) // the objects go with the context, but are freed promptly
+    {
+        if(vbo != 0)
+            glDeleteBuffers(1, &vbo);
+        if(vao != 0)
+            glDeleteVertexArrays(1, &vao);
+        if(fbo != 0)
+            glDeleteFramebuffers(1, &fbo);
+        if(target != 0)
+            glDeleteTextures(1, &target);
+        if(program != NULL && program->getProgramID() != 0)
+            glDeleteProgram(program->getProgramID());
+        context->doneCurrent();
+    }
+    delete program;
+    delete context;
+    program = NULL;
+    context = NULL;
+    fbo = target = vao = vbo = 0;
+#endif
+}
+
+bool GLVoxeliser::leaf(BaseShape * shape, VoxelVolume * voxels, const int * lo, const int * hi)
+{
+#ifdef TESS_HEADLESS
+    return false;
+#else
+    Mesh * mesh = meshShape(shape);
+    vector<float> coords;
+    vector<GLuint> texels;
+    const GLuint zero[4] = {0u, 0u, 0u, 0u};
+    int dim[3], numt, wlo, whi;
+    cgp::Point origin;
+    cgp::Vector diagonal;
+    float sy, sz;
+
+    if(context == NULL || shape == NULL)
+        return false;
+    if(shape->getKind() == ShapeKind::SUBTREE) // the leaves of a placed subtree overlap and subtract, so have no single surface to rasterise
+        return false;
+    if(mesh != NULL)
+        mesh->packTriangles(coords);
+    else
+    {
+        ShapeGeometry geom;
+
+        shape->genGeometry(&geom, NULL);
+        geom.packTriangles(coords);
+    }
+    numt = (int) coords.size() / 9;
+    if(numt == 0)
+        return false;
+
+    voxels->getDim(dim[0], dim[1], dim[2]);
+    voxels->getFrame(origin, diagonal);
+    sy = (dim[1] > 1) ? diagonal.j / (float) (dim[1]-1) : 1.0f;
+    sz = (dim[2] > 1) ? diagonal.k / (float) (dim[2]-1) : 1.0f;
+    wlo = lo[0] / voxwordbits;
+    whi = hi[0] / voxwordbits;
+
+    glUseProgram(program->getProgramID());
+    glUniform2f(program->getUniformLocation("xrow"), origin.x, (dim[0] > 1) ? diagonal.i / (float) (dim[0]-1) : 1.0f);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * coords.size(), coords.data(), GL_STREAM_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(0));
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    for(int tz = lo[2]; tz <= hi[2]; tz += glvoxmaxtile)
+        for(int ty = lo[1]; ty <= hi[1]; ty += glvoxmaxtile)
+        {
+            int w = std::min(glvoxmaxtile, hi[1] - ty + 1), h = std::min(glvoxmaxtile, hi[2] - tz + 1);
+
+            // pixel centres fall on voxel centres, so each pixel samples exactly the row of its voxels
+            glViewport(0, 0, w, h);
+            glUniform4f(program->getUniformLocation("tile"), origin.y + ((float) ty - 0.5f) * sy, origin.z + ((float) tz - 0.5f) * sz,
+                        2.0f / ((float) w * sy), 2.0f / ((float) h * sz));
+            texels.resize((size_t) w * h * glvoxwords);
+
+            for(int first = wlo; first <= whi; first += glvoxwords)
+            {
+                glUniform1i(program->getUniformLocation("firstword"), first);
+                glClearBufferuiv(GL_COLOR, 0, zero);
+                glDrawArrays(GL_TRIANGLES, 0, 3 * numt);
+                glReadPixels(0, 0, w, h, GL_RGBA_INTEGER, GL_UNSIGNED_INT, texels.data());
+                if(glGetError() != GL_NO_ERROR) // words already written hold the same parity the CPU would find
+                {
+                    cerr << "Error GLVoxeliser::leaf: drawing the triangles failed" << endl;
+                    glBindVertexArray(0);
+                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                    return false;
+                }
+
+                for(int c = 0; c < glvoxwords && first + c <= whi; c++)
+                {
+                    int wd = first + c;
+                    unsigned int mask = 0xFFFFFFFFu;
+
+                    // only the voxels of the box are written, as the CPU leaves those beyond it alone
+                    if(wd == wlo)
+                        mask &= 0xFFFFFFFFu >> (lo[0] % voxwordbits);
+                    if(wd == whi)
+                        mask &= 0xFFFFFFFFu << (voxwordbits - 1 - hi[0] % voxwordbits);
+                    for(int z = 0; z < h; z++)
+                        for(int y = 0; y < w; y++)
+                            voxels->setWordUnchecked(wd, ty + y, tz + z, mask, texels[((size_t) z * w + y) * glvoxwords + c]);
+                }
+            }
+        }
+
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return true;
+#endif
+}
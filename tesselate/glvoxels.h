@@ -0,0 +1,103 @@
+#ifndef _GLVOXELS
+#define _GLVOXELS
+/**
+ * @file
+ *
+ * Voxelisation of csg leaves by rasterising their triangles with OpenGL
+ */
+
+#include <vector>
+#include <string>
+#include "mesh.h"
+#include "voxels.h"
+
+const int glvoxwords = 4;           ///< packed words of a row found per pass, one per channel of an RGBA32UI texel
+const int glvoxmaxtile = 1024;      ///< most voxel rows along each of y and z rasterised at once
+
+class QOpenGLContext;
+class QOffscreenSurface;
+class shaderProgram;
+
+/**
+ * Solid voxelisation on the graphics card, for machines whose driver offers OpenGL but no OpenCL device. The
+ * triangles of a leaf are drawn looking along the x axis, with one pixel per voxel row in y and z placed exactly on
+ * the voxel centres. Each fragment sets, with an XOR logic op, every voxel of its row beyond the surface crossing,
+ * so once all triangles are drawn each pixel holds the parity of its row. The four channels of an RGBA32UI target
+ * carry four packed words of a row, laid out as dense VoxelVolume storage, so a pass settles 128 voxels along x
+ * for a whole tile of rows and is read back straight into the volume.
+ *
+ * Mesh leaves are drawn from their triangles, and other shapes from the tessellation genGeometry gives them, so
+ * primitives are voxelised to their tessellation rather than exactly. As for parity meshes on the CPU, surfaces must
+ * be closed.
+ *
+ * Voxelisation runs on a worker thread, which has no context of its own, so the voxeliser draws into its own
+ * context on an offscreen surface created by shareGL on the GUI thread. Builds without OpenGL (TESS_HEADLESS), or
+ * viewers that never called shareGL, report the backend as unavailable and the caller evaluates on the CPU instead.
+ */
+class GLVoxeliser
+{
+private:
+    bool tried;                     ///< a context has been tried
+    bool ready;                     ///< a context was made and the program built
+    std::string device;             ///< renderer string of the driver in use
+    QOffscreenSurface * surface;    ///< surface made by shareGL, which contexts are made current on
+    QOpenGLContext * context;       ///< context between begin and end, current on the thread that called begin
+    shaderProgram * program;        ///< parity shaders, shaders/voxelise.vert and shaders/voxelise.frag
+    unsigned int fbo;               ///< framebuffer rendering into target
+    unsigned int target;            ///< RGBA32UI texture of glvoxmaxtile squared texels
+    unsigned int vao, vbo;          ///< vertex array and buffer of the triangles of the current leaf
+
+    /// Release the GL objects and the context of begin
+    void release();
+
+public:
+
+    /// Default constructor, which does not touch OpenGL until it is needed
+    GLVoxeliser();
+
+    /// Destructor, which releases the context and surface
+    ~GLVoxeliser();
+
+    GLVoxeliser(const GLVoxeliser &) = delete;
+    GLVoxeliser & operator=(const GLVoxeliser &) = delete;
+
+    /**
+     * Create the offscreen surface for later contexts. Must be called on the GUI thread while the viewer's context
+     * is current. Builds without OpenGL (TESS_HEADLESS) ignore the request.
+     */
+    void shareGL();
+
+    /**
+     * Try a context on first use
+     * @retval true if a context supporting integer targets and logic ops was made and the shaders built,
+     * @retval false if built with TESS_HEADLESS, shareGL was never called or the driver is too old, which is
+     *         only reported once
+     */
+    bool available();
+
+    /// Renderer string of the driver in use, empty if there is none
+    std::string getDeviceName(){ return device; }
+
+    /**
+     * Make a context current on the calling thread, which every leaf call until end must come from
+     * @retval true if the context is ready to draw,
+     * @retval false otherwise
+     */
+    bool begin();
+
+    /// Release the context once the evaluation is over
+    void end();
+
+    /**
+     * Voxelise a leaf by rasterising its triangles, over a box of voxels, as for Scene::voxTile. Only voxels
+     * within the box are written.
+     * @param shape     leaf shape
+     * @param voxels    volume receiving the parity of each row, dense or sparse
+     * @param lo, hi    inclusive voxel range of the box, which must lie within the volume
+     * @retval true if the box was filled,
+     * @retval false if the shape has no triangles or drawing failed, leaving the box to be evaluated on the CPU
+     */
+    bool leaf(BaseShape * shape, VoxelVolume * voxels, const int * lo, const int * hi);
+};
+
+#endif
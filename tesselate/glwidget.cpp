@@ -12,6 +12,7 @@
 #include <QImage>
 #include <QCoreApplication>
 #include <QMessageBox>
+#include "common/log.h"
 
 #include <fstream>
 
@@ -37,12 +38,24 @@ GLWidget::GLWidget(const QGLFormat& format, QWidget *parent)
 
     viewing = false;
     glewSetupDone = false;
+    surfacePicked = false;
     updateGeometry = true;
+    updateLattice = false;
+    updateView = true;
+    interacting = false;
     meshVisible = false;
+    deformPreview = false;
+    sceneBusy = false;
+    sceneBound = false;
+    scenePreview = false;
+
+    // reopening a previously processed part reloads its stage results rather than recomputing them
+    scene.setCacheDirectory("meshes/cache");
+    renderer->setShaderCache("meshes/cache");
 
     //scene.sampleScene();
     //scene.intersectScene();
-    //scene.voxelScene("meshes/voxel/voxelisedgrid");
+    //scene.voxelScene();
     //scene.voxelMeshScene("meshes/voxel/voxelisedgrid");
     scene.testShrinkScene();
     //scene.pieceA1Scene(false);
@@ -54,6 +67,17 @@ GLWidget::GLWidget(const QGLFormat& format, QWidget *parent)
 
     setMouseTracking(true);
     setFocusPolicy(Qt::StrongFocus);
+
+    refineTimer.setSingleShot(true);
+    connect(&refineTimer, SIGNAL(timeout()), this, SLOT(refineView()));
+
+    statsLabel = new QLabel(this);
+    statsLabel->setStyleSheet("QLabel { background-color : rgba(255, 255, 255, 192); color : black; padding : 4px; }");
+    statsLabel->setAttribute(Qt::WA_TransparentForMouseEvents);
+    statsLabel->move(8, 8);
+    statsLabel->hide();
+    statsTimer.setSingleShot(true);
+    connect(&statsTimer, SIGNAL(timeout()), this, SLOT(pollFrameStats()));
 }
 
 GLWidget::~GLWidget()
@@ -92,7 +116,7 @@ void GLWidget::initializeGL()
 
     int mu;
     glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &mu);
-    cerr << "max texture units = " << mu << endl;
+    UTS_LOG(INFO, RENDER, "max texture units = ", mu);
 
     // set up light
     cgp::Vector dl = cgp::Vector(0.6f, 1.0f, 0.6f);
@@ -109,6 +133,9 @@ void GLWidget::initializeGL()
     // initialise renderer/compile shaders
     renderer->initShaders();
 
+    // before any OpenCL device is found, so that it can write isosurfaces into the buffers of this context
+    scene.shareGL();
+
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
     glEnable(GL_MULTISAMPLE);
@@ -119,6 +146,7 @@ void GLWidget::initializeGL()
 void GLWidget::paintGL()
 {
     ShapeDrawData sdd;
+    glm::mat4x4 model;
 
     glewExperimental = GL_TRUE;
     if(!glewSetupDone)
@@ -132,29 +160,126 @@ void GLWidget::paintGL()
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderer->beginFrame();
 
-    if(updateGeometry)
+    // a background stage owns a busy scene, but the buffers of its last bind are still resident on the GPU
+    if(updateGeometry && meshVisible && !sceneBusy)
     {
-        drawParams.clear();
-
-        if(meshVisible)
+        // while previewing, the base buffers stay resident and the lattice is applied on the GPU
+        scene.setInteractive(interacting);
+        sceneBound = true;
+        scenePreview = false;
+        if(deformPreview && scene.bindDeformGeometry(getView(), sdd, model))
         {
-            if(scene.bindGeometry(getView(), sdd))
-                drawParams.push_back(sdd);
+            scenePreview = true;
+            sceneModel = model;
         }
-        if(latVisible)
+        else
+            sceneBound = scene.bindGeometry(getView(), sdd);
+        if(sceneBound)
+            sceneParams = sdd;
+    }
+
+    // a lattice change alone leaves the scene buffers as they are
+    if(updateGeometry || updateLattice)
+    {
+        drawParams.clear();
+        if(meshVisible && sceneBound)
         {
-            if(def.bindGeometry(getView(), sdd, true)) // highlighted cp
-                 drawParams.push_back(sdd);
-            if(def.bindGeometry(getView(), sdd, false)) // non-highlighted cp
-                drawParams.push_back(sdd);
+            if(scenePreview)
+                renderer->setLattice(&def, sceneModel);
+            drawParams.push_back(sceneParams);
         }
+        if(latVisible && def.bindGeometry(getView(), sdd)) // rewritten only when control points or their highlighting change
+            drawParams.push_back(sdd);
+        renderer->setDrawParams(drawParams);
         updateGeometry = false;
+        updateLattice = false;
     }
+    updateView = false;
+    renderer->endBind();
 
-    // pass in draw params for geometry
-    renderer->setDrawParams(drawParams);
+    renderer->setInteractive(interacting);
     renderer->draw(getView());
+
+    if(renderer->isTiming())
+    {
+        showFrameStats();
+        if(!statsTimer.isActive())
+            statsTimer.start(statspolldelay); // GPU times are read once the GPU has caught up
+    }
+}
+
+void GLWidget::setFrameStats(bool show)
+{
+    renderer->setTiming(show);
+    statsLabel->setVisible(show);
+    if(!show)
+        statsTimer.stop();
+    updateView = true; // repaint to produce the first figures
+    requestRedraw();
+}
+
+void GLWidget::pollFrameStats()
+{
+    if(!renderer->isTiming())
+        return;
+    makeCurrent();
+    if(renderer->collectGPUTimes())
+        statsTimer.start(statspolldelay);
+    showFrameStats();
+}
+
+void GLWidget::showFrameStats()
+{
+    const FrameStats &fs = renderer->getFrameStats();
+    QString text;
+
+    text = QString("frame %1 ms (bind %2, draw %3)\n").arg(fs.cpuBindMs + fs.cpuDrawMs, 0, 'f', 2)
+            .arg(fs.cpuBindMs, 0, 'f', 2).arg(fs.cpuDrawMs, 0, 'f', 2);
+    if(fs.gpuDrawMs >= 0.0)
+        text += QString("GPU %1 ms (upload %2, draw %3)\n").arg(fs.gpuUploadMs + fs.gpuDrawMs, 0, 'f', 2)
+                .arg(fs.gpuUploadMs, 0, 'f', 2).arg(fs.gpuDrawMs, 0, 'f', 2);
+    else
+        text += "GPU -\n";
+    text += QString("upload %1 MB/frame\n").arg(fs.uploadMB, 0, 'f', 3);
+    text += QString("%1 triangles, %2 draw calls").arg(fs.triangles).arg(fs.drawCalls);
+    statsLabel->setText(text);
+    statsLabel->adjustSize();
+}
+
+void GLWidget::requestRedraw(bool immediate)
+{
+    if(!updateGeometry && !updateLattice && !updateView)
+        return;
+    if(immediate)
+        repaint();
+    else
+        update(); // repeated requests before the next frame are merged into one paint
+}
+
+void GLWidget::viewMoved()
+{
+    updateView = true;
+    if(!interacting)
+    {
+        // coarser levels of detail are cached on the GPU, so switching to one costs a single rebind
+        interacting = true;
+        if(scene.hasLevelsOfDetail() && !sceneBusy)
+            updateGeometry = true;
+    }
+    refineTimer.start(refinedelay);
+    update();
+}
+
+void GLWidget::refineView()
+{
+    interacting = false;
+    if(scene.hasLevelsOfDetail() && !sceneBusy)
+    {
+        updateGeometry = true;
+        update();
+    }
 }
 
 void GLWidget::resizeGL(int width, int height)
@@ -165,6 +290,8 @@ void GLWidget::resizeGL(int width, int height)
 
     view.setDim((float) ((width - side) / 2), (float) ((height - side) / 2), (float) side, (float) side);
     view.apply();
+    updateView = true;
+    updateGeometry = true; // the screen area covered by the scene sets its level of detail
 }
 
 
@@ -174,10 +301,12 @@ void GLWidget::keyPressEvent(QKeyEvent *event)
     {
         // stub for key based input
     }
-    if(event->key() == Qt::Key_S)
+    if(event->key() == Qt::Key_S && !sceneBusy) // not while a background stage owns the scene
     {
         getScene()->sphereScene();
     }
+    if(event->key() == Qt::Key_F)
+        setFrameStats(!renderer->isTiming());
 }
 
 void GLWidget::mousePressEvent(QMouseEvent *event)
@@ -188,8 +317,6 @@ void GLWidget::mousePressEvent(QMouseEvent *event)
     int x = event->x(); int y = event->y();
     float W = (float) width(); float H = (float) height();
 
-    update(); // ensure this viewport is current for unproject
-
     // control view orientation with right mouse button or ctrl/alt modifier key and left mouse
     if((event->modifiers() == Qt::MetaModifier || event->modifiers() == Qt::AltModifier || event->buttons() == Qt::RightButton))
     {
@@ -202,11 +329,38 @@ void GLWidget::mousePressEvent(QMouseEvent *event)
         getView()->startArcRotate(nx, ny);
         viewing = true;
     }
+    else if(event->modifiers() == Qt::NoModifier && event->buttons() == Qt::LeftButton)
+    {
+        // pick a visible control point first, and otherwise the surface behind the cursor
+        cgp::Vector dirn;
+        int i, j, k;
+
+        getView()->projectingRay(x, y, pnt, dirn);
+        if(latVisible && def.pickCP(pnt, dirn, i, j, k))
+        {
+            def.deactivateAllCP();
+            def.activateCP(i, j, k);
+            setLatticeUpdate();
+            emit signalPickedCP(i, j, k);
+        }
+        else if(meshVisible && !sceneBusy)
+        {
+            surfacePicked = getScene()->getMesh()->pickRay(pnt, dirn, surfacePick);
+            if(surfacePicked)
+                UTS_LOG(INFO, RENDER, "GLWidget::mousePressEvent: picked triangle ", surfacePick.tri, " at ", surfacePick.pnt.x, " ",
+                        surfacePick.pnt.y, " ", surfacePick.pnt.z);
+        }
+    }
     lastPos = event->pos();
 }
 
 void GLWidget::mouseReleaseEvent(QMouseEvent *event)
 {
+    if(viewing) // refine straight away rather than waiting for the view to be still
+    {
+        refineTimer.stop();
+        refineView();
+    }
     viewing = false;
 }
 
@@ -227,7 +381,7 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
         nx = (2.0f * (float) x - W) / W;
         ny = (H - 2.0f * (float) y) / H;
         getView()->arcRotate(nx, ny);
-        update();
+        viewMoved();
         lastPos = event->pos();
     }
 }
@@ -243,13 +397,13 @@ void GLWidget::wheelEvent(QWheelEvent * wheel)
     {
         del = (float) pix.y();
         getView()->incrZoom(del);
-        update();
+        viewMoved();
 
     }
     else if(!deg.isNull()) // mouse wheel instead
     {
         del = (float) deg.y();
         getView()->incrZoom(del);
-        update();
+        viewMoved();
     }
 }
@@ -23,6 +23,9 @@
 //! [0]
 using namespace std;
 
+const int refinedelay = 250;    ///< milliseconds the view must stay still before the full level of detail is drawn again
+const int statspolldelay = 20;  ///< milliseconds between reads of GPU frame times that were not ready
+
 class Window;
 
 class GLWidget : public QGLWidget
@@ -55,20 +58,66 @@ public:
     /// setter for geometry updating
     void setGeometryUpdate(bool update){ updateGeometry = update; }
 
+    /// mark the lattice control points or their highlighting as changed, which rebinds the lattice but not the scene
+    void setLatticeUpdate(){ updateLattice = true; }
+
+    /**
+     * Repaint if the camera, geometry, lattice or display options changed since the last frame, and otherwise
+     * leave the GPU idle
+     * @param immediate     paint before returning rather than at the next pass of the event loop
+     */
+    void requestRedraw(bool immediate = false);
+
     /// setter for drawing intersection mesh
     void setMeshVisible(bool vis){ meshVisible = vis; setGeometryUpdate(true); }
 
     /// setter for drawing intersection mesh
     void setLatVisible(bool vis){ latVisible = vis; setGeometryUpdate(true); }
 
+    /// setter for previewing the deformation on the GPU rather than drawing the committed mesh
+    void setDeformPreview(bool preview){ deformPreview = preview; setGeometryUpdate(true); }
+
+    /**
+     * Hand the scene to or back from a background stage. While it is busy, geometry updates leave the scene
+     * buffers bound from the last completed representation in place rather than reading the scene
+     * @param busy  true while a stage is running on the scene
+     */
+    void setSceneBusy(bool busy){ sceneBusy = busy; setGeometryUpdate(true); }
+
+    /**
+     * Show frame time, upload volume, triangles and draw calls over the canvas, timing each frame while shown.
+     * Toggled by the F key.
+     * @param show  true to show the overlay
+     */
+    void setFrameStats(bool show);
+
     /// respond to key press events
     void keyPressEvent(QKeyEvent *event);
 
+    /**
+     * Surface point under the last plain left click, for measurement and local edits
+     * @param[out] pick     triangle, barycentric weights, distance and position of the hit
+     * @retval true if the last click hit the scene surface,
+     * @retval false otherwise
+     */
+    bool getSurfacePick(MeshPick &pick){ pick = surfacePick; return surfacePicked; }
+
 signals:
 
     /// signal that the OpenGL canvas should be repainted
     void signalRepaintAllGL();
 
+    /// signal that a click picked lattice control point (@a i, @a j, @a k), which is now the only one highlighted
+    void signalPickedCP(int i, int j, int k);
+
+private slots:
+
+    /// Draw the full level of detail again once the view has stopped moving
+    void refineView();
+
+    /// Read back GPU frame times that have become available and refresh the overlay, without repainting
+    void pollFrameStats();
+
 protected:
     /// Setup OpenGL state
     void initializeGL();
@@ -99,8 +148,20 @@ private:
     View view;                          ///< current viewpoint
     vector<ShapeDrawData> drawParams;   ///< OpenGL drawing parameters
     bool updateGeometry;                ///< recreate render buffers on change
+    bool updateLattice;                 ///< rebind the lattice alone, as its control points or highlighting changed
+    bool updateView;                    ///< the camera or viewport changed since the last frame
     bool meshVisible;                   ///< render csg geometry
     bool latVisible;                    ///< render ffd control points
+    bool deformPreview;                 ///< render the undeformed mesh warped by the lattice in the vertex shader
+    bool sceneBusy;                     ///< is a background stage using the scene?
+    bool sceneBound;                    ///< does sceneParams hold the scene as last bound?
+    bool scenePreview;                  ///< was the scene last bound for deformation preview?
+    ShapeDrawData sceneParams;          ///< drawing parameters of the scene from the last bind
+    glm::mat4x4 sceneModel;             ///< model transformation of the last bind for deformation preview
+    bool interacting;                   ///< is the view moving, so that the scene is drawn at a reduced level of detail?
+    QTimer refineTimer;                 ///< fires once the view has been still for refinedelay
+    QTimer statsTimer;                  ///< fires to read GPU frame times that were still pending
+    QLabel * statsLabel;                ///< frame statistics overlay, hidden unless enabled
 
     // render variables
     Renderer * renderer;                ///< OpenGL renderer
@@ -108,8 +169,16 @@ private:
     // gui variables
     bool viewing;                       ///< is the user adjusting the viewing direction?
     bool glewSetupDone;                 ///< is OpenGL initialisation finished
+    bool surfacePicked;                 ///< did the last plain left click hit the scene surface?
+    MeshPick surfacePick;               ///< where the last plain left click hit the scene surface
 
     QPoint lastPos;                     ///< previous mouse position in 2D
+
+    /// Note a camera change, dropping to the interactive level of detail until the view is still again
+    void viewMoved();
+
+    /// Write the renderer's latest frame statistics into the overlay
+    void showFrameStats();
 };
 
 #endif
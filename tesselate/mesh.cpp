@@ -3,6 +3,7 @@
 //
 
 #include "mesh.h"
+#include "tokenizer.h"
 #define GLM_ENABLE_EXPERIMENTAL
 #include <stdio.h>
 #include <math.h>
@@ -12,12 +13,26 @@
 #include <math.h>
 #include <list>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/intersect.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <unordered_map>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "common/timer.h"
+#include "common/trace.h"
+#include "common/counters.h"
+#include "common/log.h"
+#include "common/parallel.h"
+#include "common/pages.h"
 
 using namespace std;
 using namespace cgp;
@@ -298,7 +313,23 @@ int triangleTable[256][16] =
 //==========END BLOYD
 
 GLfloat stdCol[] = {0.7f, 0.7f, 0.75f, 0.4f};
-const int raysamples = 1;
+const int mcslablayers = 16; ///< cell layers per marching cubes slab
+const int mcnoslot = INT_MIN; ///< marks a lattice edge without a vertex in the marching cubes edge tables
+const double dualqefpull = 0.05; ///< weight pulling a dual contouring vertex towards the mean of its crossings, relative to one tangent plane
+
+static stats::TimeInit readSTLTime("Mesh::readSTL");
+static stats::TimeInit mergeVertsTime("Mesh::mergeVerts");
+static stats::TimeInit mergeMeshesTime("Mesh::mergeMeshes");
+static stats::TimeInit booleanOfTime("Mesh::booleanOf");
+static stats::TimeInit marchingCubesTime("Mesh::marchingCubes");
+static stats::TimeInit smoothTime("Mesh::smooth");
+static stats::TimeInit applyFFDTime("Mesh::applyFFD");
+static stats::MemoryInit meshMemory("Mesh");
+const int stlchunksize = 4096; ///< triangles decoded per parallel chunk when reading binary STL
+const float filenormtol = 0.01f; ///< departure from unit length beyond which a face normal read from file is malformed
+const float filenormagree = 0.9f; ///< least cosine between a file face normal and its winding for the file to be trusted
+const int mergeparallel = 65536; ///< vertices or triangles of a part below which mergeMeshes copies it serially
+const float normupdatefrac = 0.25f; ///< fraction of moved vertices above which normals are rederived for the whole mesh
 
 void Sphere::genGeometry(ShapeGeometry * geom, View * view)
 {
@@ -311,10 +342,17 @@ void Sphere::genGeometry(ShapeGeometry * geom, View * view)
     geom->genSphere(r, 40, 40, tfm);
 }
 
+void BaseShape::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    for(size_t i = 0; i < n; i++)
+        out[i] = (uint8_t) pointContainment(pts[i]);
+}
+
 bool Sphere::pointContainment(cgp::Point pnt)
 {
     cgp::Vector delvec;
 
+    UTS_COUNT(SPHERE_CONTAINMENT, 1);
     delvec.diff(c, pnt);
     if(delvec.sqrdlength() < r*r)
         return true;
@@ -322,6 +360,38 @@ bool Sphere::pointContainment(cgp::Point pnt)
         return false;
 }
 
+void Sphere::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    Inside inside(*this);
+
+    UTS_COUNT(SPHERE_CONTAINMENT, n);
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+        out[i] = (uint8_t) inside(pts[i].x, pts[i].y, pts[i].z);
+}
+
+float Sphere::signedDistance(cgp::Point pnt, float band)
+{
+    cgp::Vector delvec;
+
+    delvec.diff(c, pnt);
+    return delvec.length() - r;
+}
+
+void Sphere::getBounds(cgp::BoundBox &bbox)
+{
+    bbox.reset();
+    bbox.includePnt(c);
+    bbox.expand(r);
+}
+
+void Sphere::hashContent(ContentHash &hash)
+{
+    hash.addString("sphere");
+    hash.addFloat(c.x); hash.addFloat(c.y); hash.addFloat(c.z);
+    hash.addFloat(r);
+}
+
 void Square::genGeometry(ShapeGeometry *geom, View *view)
 {
     // std::vector<cgp::Point> * points, std::vector<cgp::Vector> * norms, std::vector<int> * faces, glm::mat4x4 trm
@@ -397,6 +467,7 @@ bool Square::pointContainment(cgp::Point pnt)
 {
     cgp::Vector delvec;
 
+    UTS_COUNT(CUBE_CONTAINMENT, 1);
     delvec.diff(c, pnt);
     if(delvec.sqrdlength() < l*l*l)
         return true;
@@ -404,6 +475,39 @@ bool Square::pointContainment(cgp::Point pnt)
         return false;
 }
 
+void Square::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    Inside inside(*this);
+
+    UTS_COUNT(CUBE_CONTAINMENT, n);
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+        out[i] = (uint8_t) inside(pts[i].x, pts[i].y, pts[i].z);
+}
+
+float Square::signedDistance(cgp::Point pnt, float band)
+{
+    cgp::Vector delvec;
+
+    delvec.diff(c, pnt);
+    return delvec.length() - sqrtf(l*l*l);
+}
+
+void Square::getBounds(cgp::BoundBox &bbox)
+{
+    // containment accepts points within sqrt(l^3) of the center
+    bbox.reset();
+    bbox.includePnt(c);
+    bbox.expand(sqrtf(l*l*l));
+}
+
+void Square::hashContent(ContentHash &hash)
+{
+    hash.addString("square");
+    hash.addFloat(c.x); hash.addFloat(c.y); hash.addFloat(c.z);
+    hash.addFloat(l);
+}
+
 void Cylinder::genGeometry(ShapeGeometry * geom, View * view)
 {
     glm::mat4 tfm, idt;
@@ -454,6 +558,7 @@ bool Cylinder::pointContainment(cgp::Point pnt)
     cgp::Vector dirvec;
     float dist, tval;
 
+    UTS_COUNT(CYLINDER_CONTAINMENT, 1);
     // find distance and parameter value to closest point on the axis of the cylinder
     dirvec.diff(s, e);
     rayPointDist(s, dirvec, pnt, tval, dist);
@@ -463,6 +568,76 @@ bool Cylinder::pointContainment(cgp::Point pnt)
         return false;
 }
 
+void Cylinder::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    // same closest point construction as rayPointDist, hoisted out of the loop
+    Inside inside(*this);
+
+    UTS_COUNT(CYLINDER_CONTAINMENT, n);
+    if(inside.den == 0.0f) // degenerate spine
+    {
+        memset(out, 0, n);
+        return;
+    }
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+        out[i] = (uint8_t) inside(pts[i].x, pts[i].y, pts[i].z);
+}
+
+float Cylinder::signedDistance(cgp::Point pnt, float band)
+{
+    cgp::Vector dirvec;
+    float dist, tval, len, axial, radial;
+
+    dirvec.diff(s, e);
+    len = dirvec.length();
+    if(len == 0.0f) // degenerate spine, which contains nothing
+    {
+        dirvec.diff(s, pnt);
+        return dirvec.length();
+    }
+
+    // offsets outside the caps and outside the curved side combine as for a box in (axial, radial) coordinates
+    rayPointDist(s, dirvec, pnt, tval, dist);
+    axial = fabsf(tval * len - 0.5f * len) - 0.5f * len;
+    radial = dist - r;
+    return std::min(std::max(axial, radial), 0.0f) + sqrtf(std::max(axial, 0.0f) * std::max(axial, 0.0f) + std::max(radial, 0.0f) * std::max(radial, 0.0f));
+}
+
+void Cylinder::getBounds(cgp::BoundBox &bbox)
+{
+    cgp::Vector axis;
+    float ei, ej, ek;
+
+    bbox.reset();
+    bbox.includePnt(s);
+    bbox.includePnt(e);
+
+    // the end caps are discs, whose extent along each coordinate axis shrinks as the spine aligns with it
+    axis.diff(s, e);
+    if(axis.sqrdlength() > 0.0f)
+    {
+        axis.normalize();
+        ei = r * sqrtf(std::max(0.0f, 1.0f - axis.i * axis.i));
+        ej = r * sqrtf(std::max(0.0f, 1.0f - axis.j * axis.j));
+        ek = r * sqrtf(std::max(0.0f, 1.0f - axis.k * axis.k));
+    }
+    else
+        ei = ej = ek = r;
+    bbox.min.x -= ei; bbox.max.x += ei;
+    bbox.min.y -= ej; bbox.max.y += ej;
+    bbox.min.z -= ek; bbox.max.z += ek;
+}
+
+void Cylinder::hashContent(ContentHash &hash)
+{
+    hash.addString("cylinder");
+    hash.addFloat(s.x); hash.addFloat(s.y); hash.addFloat(s.z);
+    hash.addFloat(e.x); hash.addFloat(e.y); hash.addFloat(e.z);
+    hash.addFloat(r);
+}
+
 bool Mesh::findVert(cgp::Point pnt, int &idx)
 {
     bool found = false;
@@ -482,21 +657,6 @@ bool Mesh::findVert(cgp::Point pnt, int &idx)
     return found;
 }
 
-long Mesh::hashVert(cgp::Point pnt, cgp::BoundBox bbox)
-{
-    long x, y, z;
-    float range = 2500.0f;
-    long lrangesq, lrange = 2500;
-
-    lrangesq = lrange * lrange;
-
-    // discretise vertex within bounds of the enclosing bounding box
-    x = (long) (((pnt.x - bbox.min.x) * range) / bbox.diagLen()) * lrangesq;
-    y = (long) (((pnt.y - bbox.min.y) * range) / bbox.diagLen()) * lrange;
-    z = (long) (((pnt.z - bbox.min.z) * range) / bbox.diagLen());
-    return x+y+z;
-}
-
 long Mesh::hashEdge(int v0, int v1)
 {
     long key = ((long) (v0+v1) * (long) (v0+v1+1)) / 2;
@@ -510,107 +670,218 @@ long Mesh::hashEdge(int v0, int v1)
 
 void Mesh::mergeVerts()
 {
+    stats::Timer timer(mergeVertsTime);
+    UTS_TRACE_SCOPE("mergeVerts");
+    VertexWelder welder;
     vector<cgp::Point> cleanverts;
-    long key;
-    int i, p, hitcount = 0;
-    // use hashmap to quickly look up vertices with the same coordinates
-    std::unordered_map<long, int> idxlookup; // key is concatenation of vertex position, value is index into the cleanverts vector
+    vector<int> remap;
     cgp::BoundBox bbox;
+    int i, numclean;
 
-    // construct a bounding box enclosing all vertices
-    for(i = 0; i < (int) verts.size(); i++)
-        bbox.includePnt(verts[i]);
-
-    // remove duplicate vertices
-    for(i = 0; i < (int) verts.size(); i++)
-    {
-        key = hashVert(verts[i], bbox);
-        if(idxlookup.find(key) == idxlookup.end()) // key not in map
-        {
-            idxlookup[key] = (int) cleanverts.size(); // put index in map for quick lookup
-            cleanverts.push_back(verts[i]);
-        }
-        else
-        {
-            hitcount++;
-        }
-    }
-
-    /*
-    cerr << "clean verts:" << endl;
-    for(i = 0; i < (int) cleanverts.size(); i++)
-        cerr << cleanverts[i].x << " " << cleanverts[i].y << " " << cleanverts[i].z << endl;*/
-    cerr << "num duplicate vertices found = " << hitcount << " of " << (int) verts.size() << endl;
-    cerr << "clean verts = " << (int) cleanverts.size() << endl;
-    cerr << "bbox min = " << bbox.min.x << ", " << bbox.min.y << ", " << bbox.min.z << endl;
-    cerr << "bbox max = " << bbox.max.x << ", " << bbox.max.y << ", " << bbox.max.z << endl;
-    cerr << "bbox diag = " << bbox.diagLen() << endl;
+    // construct a bounding box enclosing all vertices, to scale the weld distance
+    vertexBounds(bbox);
 
+    // remove duplicate vertices, keeping the first of each group
+    numclean = welder.weld(verts, weldDistance(bbox), remap, cleanverts);
+    UTS_LOG(INFO, MESH, "num duplicate vertices found = ", (int) verts.size() - numclean, " of ", (int) verts.size());
 
     // re-index triangles
+    #pragma omp parallel for
     for(i = 0; i < (int) tris.size(); i++)
-        for(p = 0; p < 3; p++)
+        for(int p = 0; p < 3; p++)
         {
-            key = hashVert(verts[tris[i].v[p]], bbox);
-            if(idxlookup.find(key) != idxlookup.end())
-                tris[i].v[p] = idxlookup[key];
+            if(tris[i].v[p] >= 0 && tris[i].v[p] < (int) remap.size())
+                tris[i].v[p] = remap[tris[i].v[p]];
             else
-                cerr << "Error Mesh::mergeVerts: vertex not found in map" << endl;
-
+                tris[i].v[p] = -1; // out of bounds, which basicValidity reports
         }
 
-    verts.clear();
-    verts = cleanverts;
+    verts.swap(cleanverts);
+    invalidateTopology();
+    accountMemory();
+}
+
+void Mesh::vertexBounds(cgp::BoundBox &bbox)
+{
+    cgp::BoundBox empty;
+
+    bbox = parallel::reduce(0, (int) verts.size(), vertchunksize, empty, [this](int lo, int hi)
+    {
+        cgp::BoundBox local;
+        local.includePnts(&verts[lo], hi - lo);
+        return local;
+    },
+    [](cgp::BoundBox a, const cgp::BoundBox &b){ a.includeBox(b); return a; });
+}
+
+float Mesh::weldDistance(cgp::BoundBox &bbox)
+{
+    if(verts.empty() || bbox.min.x > bbox.max.x)
+        return 0.0f;
+    return weldreltol * bbox.diagLen();
+}
+
+void Mesh::deriveVertNorm(int v)
+{
+    float sx = 0.0f, sy = 0.0f, sz = 0.0f, s;
+
+    // unnormalised face cross products are weighted by twice the face area
+    for(const int * c = topo.cornerBegin(v); c != topo.cornerEnd(v); c++)
+    {
+        const int * f = tris[(* c) / 3].v;
+        const cgp::Point &p0 = verts[f[0]], &p1 = verts[f[1]], &p2 = verts[f[2]];
+        float e0x = p1.x - p0.x, e0y = p1.y - p0.y, e0z = p1.z - p0.z;
+        float e1x = p2.x - p0.x, e1y = p2.y - p0.y, e1z = p2.z - p0.z;
+
+        sx += e0y * e1z - e0z * e1y;
+        sy += e0z * e1x - e0x * e1z;
+        sz += e0x * e1y - e0y * e1x;
+    }
+    s = sqrtf(sx * sx + sy * sy + sz * sz);
+    if(s > 0.0f)
+        s = 1.0f / s;
+    norms[v] = cgp::Vector(sx * s, sy * s, sz * s);
 }
 
 void Mesh::deriveVertNorms()
 {
-    vector<int> vinc; // number of faces incident on vertex
-    int p, t;
-    cgp::Vector n;
+    buildTopology();
+    norms.resize(verts.size());
+
+    // each vertex gathers its incident faces, so vertices are independent and need no atomics
+    #pragma omp parallel for schedule(static, vertchunksize)
+    for(int v = 0; v < (int) verts.size(); v++)
+        deriveVertNorm(v);
+    worldstate.valid = false; // world-space normals are stale, but the hierarchy is not
+}
+
+void Mesh::deriveFaceNorm(int t)
+{
+    cgp::faceNormals(verts.data(), tris[t].v, 3, 1, &fnorms.x[t], &fnorms.y[t], &fnorms.z[t]);
+}
+
+void Mesh::deriveFaceNorms()
+{
+    int numtris = (int) tris.size();
 
-    // init structures
-    for(p = 0; p < (int) verts.size(); p++)
+    fnorms.resize(numtris);
+
+    // each chunk is a vectorised batch, with each component going to its own packed array
+    #pragma omp parallel for schedule(static)
+    for(int c = 0; c < numtris; c += vertchunksize)
     {
-        vinc.push_back(0);
-        norms.push_back(cgp::Vector(0.0f, 0.0f, 0.0f));
+        int n = std::min(vertchunksize, numtris - c);
+        cgp::faceNormals(verts.data(), tris[c].v, 3, n, &fnorms.x[c], &fnorms.y[c], &fnorms.z[c]);
     }
+}
 
-    // accumulate face normals into vertex normals
-    for(t = 0; t < (int) tris.size(); t++)
+void Mesh::deriveNorms()
+{
+    int numtris = (int) tris.size(), numverts = (int) verts.size();
+
+    buildTopology();
+    fnorms.resize(numtris);
+    norms.resize(numverts);
+
+    // vertex normals read positions rather than face normals, so neither loop waits for the other
+    #pragma omp parallel
     {
-        n = tris[t].n; n.normalize();
-        for(p = 0; p < 3; p++)
+        #pragma omp for schedule(static) nowait
+        for(int c = 0; c < numtris; c += vertchunksize)
         {
-            norms[tris[t].v[p]].add(n);
-            vinc[tris[t].v[p]]++;
+            int n = std::min(vertchunksize, numtris - c);
+            cgp::faceNormals(verts.data(), tris[c].v, 3, n, &fnorms.x[c], &fnorms.y[c], &fnorms.z[c]);
         }
+        #pragma omp for schedule(static, vertchunksize)
+        for(int v = 0; v < numverts; v++)
+            deriveVertNorm(v);
+    }
+    worldstate.valid = false;
+}
+
+int Mesh::validateFaceNorms()
+{
+    int numtris = (int) tris.size(), replaced = 0;
+
+    if(fnorms.size() != tris.size())
+    {
+        deriveFaceNorms();
+        return numtris;
     }
 
-    // complete average
-    for(p = 0; p < (int) verts.size(); p++)
+    #pragma omp parallel for schedule(static) reduction(+:replaced)
+    for(int c = 0; c < numtris; c += vertchunksize)
     {
-        norms[p].mult(1.0f/((float) vinc[p]));
-        norms[p].normalize();
+        int n = std::min(vertchunksize, numtris - c);
+        float dx[vertchunksize], dy[vertchunksize], dz[vertchunksize];
+
+        cgp::faceNormals(verts.data(), tris[c].v, 3, n, dx, dy, dz);
+        for(int k = 0; k < n; k++)
+        {
+            float fx = fnorms.x[c+k], fy = fnorms.y[c+k], fz = fnorms.z[c+k];
+            float len = sqrtf(fx * fx + fy * fy + fz * fz), dlen = dx[k] * dx[k] + dy[k] * dy[k] + dz[k] * dz[k];
+
+            // a degenerate triangle has no normal of its own, so a unit file normal is kept for it
+            if(len > 1.0f - filenormtol && len < 1.0f + filenormtol
+               && (dlen == 0.0f || (fx * dx[k] + fy * dy[k] + fz * dz[k]) > filenormagree * len))
+            {
+                fnorms.x[c+k] = fx / len; fnorms.y[c+k] = fy / len; fnorms.z[c+k] = fz / len;
+            }
+            else
+            {
+                fnorms.x[c+k] = dx[k]; fnorms.y[c+k] = dy[k]; fnorms.z[c+k] = dz[k];
+                replaced++;
+            }
+        }
     }
+    return replaced;
 }
 
-void Mesh::deriveFaceNorms()
+void Mesh::updateNorms(const std::vector<int> &moved)
 {
-    int t;
-    cgp::Vector evec[2];
+    vector<int> faces, fverts;
+    int i, p;
 
-    for(t = 0; t < (int) tris.size(); t++)
+    buildTopology();
+    if(norms.size() != verts.size() || fnorms.size() != tris.size() || (float) moved.size() > normupdatefrac * (float) verts.size())
     {
-        // right-hand rule for calculating normals, i.e. counter-clockwise winding from front on vertices
-        evec[0].diff(verts[tris[t].v[0]], verts[tris[t].v[1]]);
-        evec[1].diff(verts[tris[t].v[0]], verts[tris[t].v[2]]);
-        evec[0].normalize();
-        evec[1].normalize();
-        tris[t].n.cross(evec[0], evec[1]);
-        tris[t].n.normalize();
+        deriveNorms();
+        return;
     }
+    if(facemark.size() != tris.size())
+        facemark.assign(tris.size(), 0);
+    if(vertmark.size() != verts.size())
+        vertmark.assign(verts.size(), 0);
+
+    // faces incident on a moved vertex, then every vertex of those faces, since their averages include the changed faces
+    for(i = 0; i < (int) moved.size(); i++)
+        for(const int * c = topo.cornerBegin(moved[i]); c != topo.cornerEnd(moved[i]); c++)
+            if(!facemark[(* c) / 3])
+            {
+                facemark[(* c) / 3] = 1;
+                faces.push_back((* c) / 3);
+            }
+    for(i = 0; i < (int) faces.size(); i++)
+        for(p = 0; p < 3; p++)
+            if(!vertmark[tris[faces[i]].v[p]])
+            {
+                vertmark[tris[faces[i]].v[p]] = 1;
+                fverts.push_back(tris[faces[i]].v[p]);
+            }
 
+    #pragma omp parallel for schedule(static, vertchunksize)
+    for(i = 0; i < (int) faces.size(); i++)
+        deriveFaceNorm(faces[i]);
+    #pragma omp parallel for schedule(static, vertchunksize)
+    for(i = 0; i < (int) fverts.size(); i++)
+        deriveVertNorm(fverts[i]);
+
+    // leave the scratch flags clear for the next update, touching only what was set
+    for(i = 0; i < (int) faces.size(); i++)
+        facemark[faces[i]] = 0;
+    for(i = 0; i < (int) fverts.size(); i++)
+        vertmark[fverts[i]] = 0;
+    worldstate.valid = false;
 }
 
 void Mesh::buildTransform(glm::mat4x4 &tfm)
@@ -625,197 +896,212 @@ void Mesh::buildTransform(glm::mat4x4 &tfm)
     tfm = glm::scale(tfm, glm::vec3(scale));
 }
 
-void Mesh::buildSphereAccel(int maxspheres)
+void Mesh::buildWorld()
 {
-    vector<Sphere> packedspheres;
-    list<int> insphere;
-    int i, v, p, t, s, numsx, numsy, numsz, sx, sy, sz, x, y, z, sind = 0;
-    cgp::Point centroid, center;
-    cgp::Vector radvec, diag, edgevec;
-    float radius, dist, packrad, packspace, maxedge;
-    cgp::BoundBox bbox;
-    Sphere sph;
-    bool found;
+    if(worldstate.valid)
+        return;
 
-    if((int) tris.size() > 0) // must actually have a mesh to build the acceleration structure on top of
-    {
-        // calculate longest triangle edge
-        maxedge = 0.0f;
-        for(t = 0; t < (int) tris.size(); t++)
-        {
-            edgevec.diff(verts[tris[t].v[0]], verts[tris[t].v[1]]);
-            dist = edgevec.length();
+    std::lock_guard<std::mutex> lock(worldstate.build);
+    glm::mat4x4 tfm;
+    glm::mat3x3 nfm;
+    glm::vec4 vxfm;
+    glm::vec3 nxfm;
+    int v;
 
-            edgevec.diff(verts[tris[t].v[1]], verts[tris[t].v[2]]);
-            dist = min(dist, edgevec.length());
+    if(worldstate.valid) // another thread got here first
+        return;
 
-            edgevec.diff(verts[tris[t].v[2]], verts[tris[t].v[0]]);
-            dist = min(dist, edgevec.length());
-            if(dist > maxedge)
-                maxedge = dist;
+    // the normal matrix is inverted once for the whole mesh rather than per vertex
+    buildTransform(tfm);
+    nfm = glm::transpose(glm::inverse(glm::mat3(tfm)));
+    wverts.resize(verts.size());
+    wnorms.resize(verts.size());
+    for(v = 0; v < (int) verts.size(); v++)
+    {
+        vxfm = tfm * glm::vec4(verts[v].x, verts[v].y, verts[v].z, 1.0f);
+        wverts[v] = cgp::Point(vxfm.x, vxfm.y, vxfm.z);
+        if(v < (int) norms.size())
+        {
+            nxfm = glm::normalize(nfm * glm::normalize(glm::vec3(norms[v].i, norms[v].j, norms[v].k)));
+            wnorms[v] = cgp::Vector(nxfm.x, nxfm.y, nxfm.z);
         }
+        else
+            wnorms[v] = cgp::Vector(0.0f, 0.0f, 0.0f);
+    }
+    accountMemory();
+    worldstate.valid = true;
+}
 
-        // calculate mesh bounding box
-        for(v = 0; v < (int) verts.size(); v++)
-            bbox.includePnt(verts[v]);
+void Mesh::buildLOD()
+{
+    if(lodstate.valid)
+        return;
+
+    std::lock_guard<std::mutex> lock(lodstate.build);
+    MeshTopology leveltopo;
+    const MeshTopology * srctopo;
+    const std::vector<cgp::Point> * srcverts;
+    int target;
+
+    if(lodstate.valid) // another thread got here first
+        return;
+
+    // levels are decimated in world space, so they render without a transform, and each starts from the level above
+    buildWorld();
+    buildTopology();
+    srctopo = &topo;
+    srcverts = &wverts;
+    target = (int) tris.size();
+    for(int l = 0; l < meshlodlevels; l++)
+    {
+        target /= meshlodreduction;
+        decimator.decimate(* srctopo, * srcverts, target, lods[l].verts, lods[l].norms, lods[l].faces);
+        lods[l].bound = false;
+        leveltopo.build((int) lods[l].verts.size(), lods[l].faces);
+        srctopo = &leveltopo;
+        srcverts = &lods[l].verts;
+    }
+    lodstate.valid = true;
+}
 
-        diag = bbox.getDiag();
-        dist = std::max(diag.i, diag.j); dist = std::max(dist, diag.k);
-        packrad = dist / (float) maxspheres;
-        if(packrad < maxedge) // sphere radius must be larger than the longest shorest edge in any triangle
-        {
-            cerr << "Error Mesh::buildSphereAccel: bounding spheres too small relative to edge length. Inflating spheres accordingly." << endl;
-            packrad = maxedge;
-        }
-        packspace = 2.0f * packrad;
-
-        // number of spheres to pack in each dimension filling the bounding box
-        numsx = (int) ceil(diag.i / packspace) +1;
-        numsy = (int) ceil(diag.j / packrad) +1;
-        numsz = (int) ceil(diag.k / packrad) +1;
-
-        // pack spheres into volume so that there is no unsampled space
-        // alternating rows are offset by the sphere radius and x-adjacent spheres are spaced to just touch
-        // this provides a minimal overlap between spheres that nevertheless covers all available space
-        for(x = 0; x < numsx; x++)
-            for(y = 0; y < numsy; y++)
-                for(z = 0; z < numsz; z++)
-                {
-                    center = cgp::Point((float) x * packspace + bbox.min.x, (float) y * packrad + bbox.min.y, (float) z * packrad + bbox.min.z);
-                    if(z%2==1) // row shifting alternates in layers
-                    {
-                        if(y%2 == 1) // shift alternating rows by half spacing in x
-                            center.x += packrad;
-                    }
-                    else
-                    {
-                        if(y%2 == 0) // shift alternating rows by half spacing in x
-                            center.x += packrad;
-                    }
+/**
+ * Move each element of an array indexed by vertex to its new position
+ * @param[in,out] values    per vertex values, left alone unless there is one per entry of remap
+ * @param remap             new index of each vertex
+ */
+template<typename T> static void permuteVerts(std::vector<T> &values, const std::vector<int> &remap)
+{
+    std::vector<T> moved;
+
+    if(values.size() != remap.size())
+        return;
+    moved.resize(values.size());
+    #pragma omp parallel for schedule(static, 4096)
+    for(int v = 0; v < (int) values.size(); v++)
+        moved[remap[v]] = values[v];
+    values.swap(moved);
+}
 
-                    sph.c = center;
-                    sph.r = packrad;
-                    sph.ind.clear();
-                    packedspheres.push_back(sph);
-                }
+void Mesh::applyCacheOrder()
+{
+    vector<int> triorder, remap;
+    vector<Triangle> ordered;
+    int numverts = (int) verts.size();
+
+    if(!cacheorder || cacheordered || tris.empty())
+        return;
+
+    buildTopology();
+    cacheopt.optimise(topo, vcachesize, triorder, remap);
+    ordered.resize(tris.size());
+    #pragma omp parallel for schedule(static, 4096)
+    for(int t = 0; t < (int) tris.size(); t++)
+    {
+        ordered[t] = tris[triorder[t]];
+        for(int p = 0; p < 3; p++)
+            if(ordered[t].v[p] >= 0 && ordered[t].v[p] < numverts)
+                ordered[t].v[p] = remap[ordered[t].v[p]];
+    }
+    tris.swap(ordered);
+    if(fnorms.size() == tris.size())
+        fnorms.gather(triorder);
+
+    // scatter every array indexed by vertex into its new position
+    permuteVerts(verts, remap);
+    permuteVerts(norms, remap);
+    permuteVerts(base, remap);
+    permuteVerts(basenorms, remap);
+    embedding.clear();
+
+    invalidateTopology();
+    cacheordered = true;
+}
 
-        // assign triangles to spheres based on their vertices
-        for(t = 0; t < (int) tris.size(); t++)
-        {
+void Mesh::buildTopology()
+{
+    if(topostate.valid && topo.getNumVerts() == (int) verts.size() && topo.getNumTris() == (int) tris.size())
+        return;
 
-            // find the first sphere that contains any of the triangle vertices
-            found = false; s = 0;
-            while(!found && s < (int) packedspheres.size())
-            {
-                for(p = 0; p < 3; p++)
-                    if(packedspheres[s].pointContainment(verts[tris[t].v[p]]))
-                    {
-                        found = true;
-                        // add triangle to packedsphere
-                        packedspheres[s].ind.push_back(t);
-                        sind = s;
-                    }
-                s++;
-            }
+    std::lock_guard<std::mutex> lock(topostate.build);
+    vector<int> faces;
+    int t, p;
 
-            if(!found)
-            {
-                cerr << "Error Mesh::buildSphereAccel: packed spheres do not entirely fill the volume." << endl;
-            }
-            else
-            {
-                // once a sphere triangle intersection is found only a few adjacent spheres need be tested for intersection
-                // also test against +x, +y, +z spheres (and diagonal adjacents as well for possible intersection due to partial sphere overlaps
-
-                // neighbour search of packed spheres
-                // decompose into x, y, z sphere grid position
-
-                // unflatten index
-                sx = (int) ((float) sind / (float) (numsy*numsz));
-                sy = (int) ((float) sind / (float) numsz);
-                sz = sind - (sx * numsy * numsz + sy * numsz);
-                for(x = sx; x <= sx+1; x++)
-                    for(y = sy; y <= sy+1; y++)
-                        for(z = sz; z <= sz+1; z++)
-                        {
-                            if(x < numsx && y < numsy && z < numsz) // bounds check
-                                if(!(x == sx && y == sy && z == sz)) // ignore starter sphere
-                                {
-                                    s = x * numsy * numsz + y * numsz + z; // flatten 3d index
-                                    found = false;
-                                    for(p = 0; p < 3; p++)
-                                        if(packedspheres[s].pointContainment(verts[tris[t].v[p]]))
-                                            found = true;
-                                    if(found) // add triangle to packedsphere
-                                        packedspheres[s].ind.push_back(t);
-                                }
+    if(topostate.valid && topo.getNumVerts() == (int) verts.size() && topo.getNumTris() == (int) tris.size())
+        return; // another thread got here first
 
-                        }
+    faces.resize(3 * tris.size());
+    for(t = 0; t < (int) tris.size(); t++)
+        for(p = 0; p < 3; p++)
+            faces[3*t+p] = tris[t].v[p];
+    topo.build((int) verts.size(), faces);
+    topostate.valid = true;
+}
 
-            }
-        }
+void Mesh::buildAccel()
+{
+    std::lock_guard<std::mutex> lock(accelstate.build);
+    vector<int> faces;
+    int t, p;
 
-        // discard any spheres containing no triangles
-        for(i = 0; i < (int) packedspheres.size(); i++)
-        {
-            if(!packedspheres[i].ind.empty()) // bounding sphere has at least one triangle
-                boundspheres.push_back(packedspheres[i]);
-        }
-        packedspheres.clear();
+    if(accelstate.valid) // another thread got here first
+        return;
 
-        // recaculate spheres by using center of mass and furthest triangle vertex to get tighter bounding
-        for(i = 0; i < (int) boundspheres.size(); i++)
-        {
-            insphere.clear();
-            // gather included vertices
-            for(t = 0; t < (int) boundspheres[i].ind.size(); t++)
-                for(p = 0; p < 3; p++)
-                    insphere.push_back(tris[boundspheres[i].ind[t]].v[p]);
-
-            // remove duplicates because they will bias the center of mass
-            insphere.sort();
-            insphere.unique();
-
-            // calculate centroid as average of vertices
-            centroid = cgp::Point(0.0f, 0.0f, 0.0f);
-            for (list<int>::iterator it=insphere.begin(); it!=insphere.end(); ++it)
-            {
-                centroid.x += verts[(* it)].x; centroid.y += verts[(* it)].y; centroid.z += verts[(* it)].z;
+    // containment queries are made in world space, so the hierarchy is built over transformed vertices
+    buildWorld();
+    faces.resize(3 * tris.size());
+    for(t = 0; t < (int) tris.size(); t++)
+        for(p = 0; p < 3; p++)
+            faces[3*t+p] = tris[t].v[p];
 
-            }
-            centroid.x /= (float) insphere.size();  centroid.y /= (float) insphere.size();  centroid.z /= (float) insphere.size();
-            boundspheres[i].c = centroid;
+    accel.build(wverts, faces);
+    if(containmode == MeshContainment::WINDING)
+        winding.build(wverts, faces);
+    else
+        winding.clear();
+    accelstate.valid = true;
+}
 
-            // calculate new radius
-            radius = 0.0f;
-            for (list<int>::iterator it=insphere.begin(); it!=insphere.end(); ++it)
-            {
-                radvec.diff(boundspheres[i].c, verts[(* it)]);
-                dist = radvec.length();
-                if(dist > radius)
-                    radius = dist;
-            }
-            boundspheres[i].r = radius;
-
-            /*
-             // check current radius
-             for (list<int>::iterator it=insphere.begin(); it!=insphere.end(); ++it)
-             {
-             radvec.diff(boundspheres[i].c, verts[(* it)]);
-             dist = radvec.length();
-             if(dist > boundspheres[i].r)
-             cerr << "Error Mesh::buildSphereAccel:vertex " << (* it) << " outside containing sphere by " << (dist - packrad) << endl;
-             }*/
-        }
+void CoordArrays::gather(const std::vector<int> &order)
+{
+    std::vector<float> * comps[3] = {&x, &y, &z};
+    std::vector<float> dst(order.size());
+
+    for(std::vector<float> * src: comps)
+    {
+        for(int i = 0; i < (int) order.size(); i++)
+            dst[i] = (* src)[order[i]];
+        src->swap(dst);
+        dst.resize(order.size());
     }
 }
 
 Mesh::Mesh()
+    : BaseShape(ShapeKind::MESH), memtally(meshMemory)
 {
     col = stdCol;
     scale = 1.0f;
     xrot = yrot = zrot = 0.0f;
     trx = cgp::Vector(0.0f, 0.0f, 0.0f);
+    numraysamples = defaultraysamples;
+    containmode = MeshContainment::PARITY;
+    basebound = false;
+    geombound = false;
+    cacheorder = false;
+    cacheordered = false;
+
+    // isosurfaces are untextured, so their buffers use the compact vertex layout
+    geometry.setCompact(true);
+    basegeometry.setCompact(true);
+    for(int l = 0; l < meshlodlevels; l++)
+    {
+        lods[l].bound = false;
+        lods[l].geometry.setCompact(true);
+    }
+}
+
+void Mesh::setRaySamples(int samples)
+{
+    numraysamples = std::min(std::max(samples, 1), maxraysamples);
 }
 
 Mesh::~Mesh()
@@ -827,35 +1113,85 @@ void Mesh::clear()
 {
     verts.clear();
     tris.clear();
+    fnorms.clear();
+    mcslabs.clear();
+    accel.clear();
+    winding.clear();
+    wverts.clear();
+    wnorms.clear();
+    base.clear();
+    basenorms.clear();
+    embedding.clear();
+    topo.clear();
+    invalidateTopology();
     geometry.clear();
+    basegeometry.clear();
+    for(int l = 0; l < meshlodlevels; l++)
+    {
+        lods[l].verts.clear();
+        lods[l].norms.clear();
+        lods[l].faces.clear();
+        lods[l].geometry.clear();
+        lods[l].bound = false;
+    }
     col = stdCol;
     scale = 1.0f;
     xrot = yrot = zrot = 0.0f;
     trx = cgp::Vector(0.0f, 0.0f, 0.0f);
+    accountMemory();
 }
 
-void Mesh::genGeometry(ShapeGeometry * geom, View * view)
+void Mesh::accountMemory()
 {
-    vector<int> faces;
-    int t, p;
-    glm::mat4x4 tfm;
+    size_t points = verts.capacity() + base.capacity() + wverts.capacity();
+    size_t vectors = norms.capacity() + basenorms.capacity() + wnorms.capacity();
 
-    // transform mesh data structures into a form suitable for rendering
-    // by flattening the triangle list
-    for(t = 0; t < (int) tris.size(); t++)
-        for(p = 0; p < 3; p++)
-            faces.push_back(tris[t].v[p]);
+    memtally.set(points * sizeof(cgp::Point) + vectors * sizeof(cgp::Vector) + tris.capacity() * sizeof(Triangle)
+                 + fnorms.capacityBytes());
+}
 
-    // construct transformation matrix
-    buildTransform(tfm);
-    geom->genMesh(&verts, &norms, &faces, tfm);
+void Mesh::genGeometry(ShapeGeometry * geom, View * view)
+{
+    // vertices and normals are already in world space, so no further transformation is needed,
+    // and the triangle list is read in place as a packed index array
+    buildWorld();
+    geom->genMesh(wverts.data(), wnorms.data(), (int) wverts.size(), tris.empty() ? NULL : tris[0].v, (int) tris.size(),
+                  sizeof(Triangle), glm::mat4(1.0f));
 }
 
-bool Mesh::bindGeometry(View * view, ShapeDrawData &sdd)
+bool Mesh::bindGeometry(View * view, ShapeDrawData &sdd, int level)
 {
-    geometry.clear();
+    applyCacheOrder();
+    if(level > 0 && !tris.empty())
+    {
+        MeshLOD &lod = lods[std::min(level, meshlodlevels) - 1];
+
+        buildLOD();
+        lod.geometry.setColour(col);
+        if(!lod.bound)
+        {
+            lod.geometry.clear();
+            lod.geometry.genMesh(&lod.verts, &lod.norms, &lod.faces, glm::mat4(1.0f));
+            lod.bound = true;
+        }
+        if(lod.geometry.bindBuffers(view))
+        {
+            sdd = lod.geometry.getDrawParameters();
+            return true;
+        }
+        return false;
+    }
+
     geometry.setColour(col);
-    genGeometry(&geometry, view);
+
+    // with the triangles unchanged, a deformation or transformation only rewrites the vertices that moved
+    buildWorld();
+    if(!geombound || !geometry.updateMesh(&wverts, &wnorms, glm::mat4(1.0f)))
+    {
+        geometry.clear();
+        genGeometry(&geometry, view);
+        geombound = true;
+    }
 
     // bind geometry to buffers and return drawing parameters, if possible
     if(geometry.bindBuffers(view))
@@ -867,98 +1203,90 @@ bool Mesh::bindGeometry(View * view, ShapeDrawData &sdd)
        return false;
 }
 
-bool Mesh::pointContainment(cgp::Point pnt)
+int Mesh::getNumLODFaces(int level)
 {
-    int incount = 0, outcount = 0, hits, i, t, p, s;
-    glm::vec3 v[3], origin, ray;
-    glm::vec2 xsect;
-    float d;
-    glm::mat4x4 tfm, idt;
-    glm::vec4 vxfm, cxfm;
-    cgp::Point vert, sphc;
-    cgp::Vector dir;
-    float dist, tval;
-    list<int> inspheres;
-
-    srand(time(0));
+    if(level <= 0 || tris.empty())
+        return (int) tris.size();
+    buildLOD();
+    return (int) lods[std::min(level, meshlodlevels) - 1].faces.size() / 3;
+}
 
-    // sample over multiple rays to avoid numerical issues (e.g., ray hits a vertex or edge)
-    origin = glm::vec3(pnt.x, pnt.y, pnt.z);
+bool Mesh::bindBaseGeometry(View * view, ShapeDrawData &sdd, glm::mat4x4 &model)
+{
+    applyCacheOrder();
 
-    // construct transformation matrix
-    buildTransform(tfm);
+    if(base.size() != verts.size()) // no deformation has been set up since the vertices were last replaced
+        setBase();
+    if(basenorms.size() != base.size())
+        return false;
 
-    if(sphereaccel)
+    if(!basebound)
     {
-        if(boundspheres.empty()) // no acceleration structure so build
-            buildSphereAccel((int) sphperdim);
+        // the lattice is defined in mesh space, so the transformation is left to the shader, after deformation
+        basegeometry.clear();
+        basegeometry.genMesh(base.data(), basenorms.data(), (int) base.size(), tris.empty() ? NULL : tris[0].v,
+                             (int) tris.size(), sizeof(Triangle), glm::mat4(1.0f));
+        if(!basegeometry.bindBuffers(view))
+            return false;
+        basebound = true;
     }
+    buildTransform(model);
+    basegeometry.setColour(col);
+    sdd = basegeometry.getDrawParameters();
+    sdd.deformed = true;
+    return true;
+}
 
-    for(i = 0; i < raysamples; i++)
+cgp::Vector containmentDir(int i)
+{
+    static const std::vector<cgp::Vector> dirs = []()
     {
-        hits = 0;
-        inspheres.clear();
-
-        // sampling ray with random direction
-        // avoid axis aligned rays because more likely to lead to numerical issues with axis aligned structures
-        dir = cgp::Vector((float) (rand()%1000-500), (float) (rand()%1000-500), (float) (rand()%1000-500));
-        dir.normalize();
-        ray = glm::vec3(dir.i, dir.j, dir.k);
+        std::vector<cgp::Vector> table(maxraysamples);
+        const double a1 = 0.7548776662466927, a2 = 0.5698402909980532; // inverse powers of the plastic number
 
-        if(sphereaccel)
+        // the sequence starts at -x, so it is taken from its second sample on, keeping every ray off the axes
+        for(int s = 0; s < maxraysamples; s++)
         {
-            // gather potential triangle intersector indices and remove duplicates
-            for(s = 0; s < (int) boundspheres.size(); s++)
-            {
-                // sphere accel structure is in model space, so need to apply transform
-                cxfm = tfm * glm::vec4(boundspheres[s].c.x, boundspheres[s].c.y, boundspheres[s].c.z, 1.0f);
-                sphc = cgp::Point(cxfm.x, cxfm.y, cxfm.z);
-
-                rayPointDist(pnt, dir, sphc, tval, dist);
-                if(dist <= boundspheres[s].r) // if ray hits the bounding sphere
-                    for(t = 0; t < (int) boundspheres[s].ind.size(); t++) // include all triangles allocated to the bounding sphere
-                        inspheres.push_back(boundspheres[s].ind[t]);
-            }
+            double u = fmod(0.5 + a1 * (double) (s+1), 1.0), v = fmod(0.5 + a2 * (double) (s+1), 1.0);
+            double z = 2.0 * u - 1.0, r = sqrt(std::max(0.0, 1.0 - z * z)), phi = 2.0 * M_PI * v;
+            table[s] = cgp::Vector((float) (r * cos(phi)), (float) (r * sin(phi)), (float) z);
+        }
+        return table;
+    }();
+    return dirs[i];
+}
 
-            // remove duplicate triangle indices because a triangle may appear in multiple bounding spheres
-            inspheres.sort();
-            inspheres.unique();
+int rayCrossings(const BVH &accel, cgp::Point pnt, cgp::Vector dir, vector<BVHHit> &hits)
+{
+    int crossings = 0;
+
+    hits.clear();
+    accel.rayHits(pnt, dir, hits);
+    std::sort(hits.begin(), hits.end(), [](const BVHHit &h0, const BVHHit &h1){ return h0.t < h1.t; });
+    for(int h = 0; h < (int) hits.size(); h++)
+        if(h == 0 || hits[h].t - hits[h-1].t > scanmergetol || hits[h].front != hits[h-1].front)
+            crossings++;
+    return crossings;
+}
 
-            // test intersection against list of triangles
-            for (list<int>::iterator it=inspheres.begin(); it!=inspheres.end(); ++it)
-            {
-                for(p = 0; p < 3; p++)
-                {
-                    vert = verts[tris[(* it)].v[p]];
-                    // vxfm = tfm * glm::vec4(vert.x, vert.y, vert.z, 1.0f);
-                    vxfm = glm::vec4(vert.x, vert.y, vert.z, 1.0f);
-                    v[p] = glm::vec3(vxfm.x, vxfm.y, vxfm.z);
-                }
-                if(glm::intersectRayTriangle(origin, ray, v[0], v[1], v[2], xsect, d) || glm::intersectRayTriangle(origin, ray, v[0], v[2], v[1], xsect, d)) // test triangle in both windings because intersectLineTriangle is winding dependent
-                {
-                    hits++;
-                }
-            }
-        }
-        else // no acceleration structure so test against all triangles
-        {
-            for(t = 0; t < (int) tris.size(); t++)
-            {
-                for(p = 0; p < 3; p++)
-                {
-                    vert = verts[tris[t].v[p]];
-                    vxfm = tfm * glm::vec4(vert.x, vert.y, vert.z, 1.0f);
-                    v[p] = glm::vec3(vxfm.x, vxfm.y, vxfm.z);
-                }
-                ray[0] = 1.0f; ray[1] = 0.0f; ray[2] = 0.0f;
-                if(glm::intersectRayTriangle(origin, ray, v[0], v[1], v[2], xsect, d)) // || glm::intersectRayTriangle(origin, ray, v[0], v[2], v[1], xsect, d)) // test triangle in both windings because intersectLineTriangle is winding dependent
-                {
-                    if(d > 0.0f)
-                        hits++;
-                }
+bool Mesh::pointContainment(cgp::Point pnt)
+{
+    int incount = 0, outcount = 0, hits, i;
+    cgp::Vector dir;
+    vector<BVHHit> xsect;
 
-            }
-        }
+    if(!accelstate.valid) // geometry or transform has changed since the last query
+        buildAccel();
+    UTS_COUNT(MESH_CONTAINMENT, 1);
+
+    if(containmode == MeshContainment::WINDING)
+        return winding.windingNumber(pnt) > 0.5f;
+
+    // sample over multiple rays to avoid numerical issues (e.g., ray hits a vertex or edge)
+    for(i = 0; i < numraysamples; i++)
+    {
+        dir = containmentDir(i);
+        hits = rayCrossings(accel, pnt, dir, xsect);
 
         if(hits%2 == 0) // even number of intersection means point is outside
             outcount++;
@@ -970,20 +1298,318 @@ bool Mesh::pointContainment(cgp::Point pnt)
     return (incount > outcount);
 }
 
+float Mesh::signedDistance(cgp::Point pnt, float band)
+{
+    float dist;
+
+    if(!accelstate.valid)
+        buildAccel();
+    dist = surfaceDistance(pnt, band);
+    return pointContainment(pnt) ? -dist : dist;
+}
+
+bool Mesh::pickRay(cgp::Point start, cgp::Vector dirn, MeshPick &pick)
+{
+    BVHRayHit hit;
+
+    if(!accelstate.valid) // geometry or transform has changed since the last query
+        buildAccel();
+    if(dirn.sqrdlength() <= 0.0f)
+        return false;
+    dirn.normalize(); // so that the ray parameter is a distance
+    if(!accel.closestHit(start, dirn, hit))
+        return false;
+
+    pick.tri = hit.tri;
+    pick.bary[0] = 1.0f - hit.u - hit.v;
+    pick.bary[1] = hit.u;
+    pick.bary[2] = hit.v;
+    pick.dist = hit.t;
+    pick.pnt = cgp::Point(start.x + hit.t * dirn.i, start.y + hit.t * dirn.j, start.z + hit.t * dirn.k);
+    return true;
+}
+
+void Mesh::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    vector<BVHHit> xsect;
+
+    if(!accelstate.valid) // checked once for the whole batch
+        buildAccel();
+    UTS_COUNT(MESH_CONTAINMENT, n);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(containmode == MeshContainment::WINDING)
+        {
+            out[i] = (uint8_t) (winding.windingNumber(pts[i]) > 0.5f);
+        }
+        else
+        {
+            int incount = 0;
+            for(int k = 0; k < numraysamples; k++)
+                if(rayCrossings(accel, pts[i], containmentDir(k), xsect)%2 == 1)
+                    incount++;
+            out[i] = (uint8_t) (2 * incount > numraysamples); // consensus wins
+        }
+    }
+}
+
+void Mesh::getBounds(cgp::BoundBox &bbox)
+{
+    if(!accelstate.valid) // the hierarchy holds the world-space triangles
+        buildAccel();
+    accel.getBounds(bbox);
+}
+
+void Mesh::hashContent(ContentHash &hash)
+{
+    hash.addInt((int64_t) checksum());
+    hash.addFloat(scale);
+    hash.addFloat(trx.i); hash.addFloat(trx.j); hash.addFloat(trx.k);
+    hash.addFloat(xrot); hash.addFloat(yrot); hash.addFloat(zrot);
+    hash.addInt((int64_t) containmode);
+    hash.addInt(numraysamples);
+}
+
+uint64_t Mesh::checksum()
+{
+    ContentHash hash;
+    uint64_t vertsum, trisum;
+
+    vertsum = parallel::reduce(0, (int) verts.size(), vertchunksize, (uint64_t) 0, [this](int lo, int hi)
+    {
+        ContentHash chunk;
+        for(int v = lo; v < hi; v++)
+        {
+            chunk.addFloat(verts[v].x); chunk.addFloat(verts[v].y); chunk.addFloat(verts[v].z);
+        }
+        return chunk.value();
+    }, ContentHash::combine);
+    trisum = parallel::reduce(0, (int) tris.size(), vertchunksize, (uint64_t) 0, [this](int lo, int hi)
+    {
+        ContentHash chunk;
+        chunk.add(&tris[lo], (size_t) (hi - lo) * sizeof(Triangle));
+        return chunk.value();
+    }, ContentHash::combine);
+
+    hash.addString("mesh");
+    hash.addInt((int64_t) verts.size());
+    hash.addInt((int64_t) vertsum);
+    hash.addInt((int64_t) tris.size());
+    hash.addInt((int64_t) trisum);
+    return hash.value();
+}
+
+size_t Mesh::takeSnapshot(MeshSnapshot &snap, const MeshSnapshot * prev, const MeshSnapshot * alt)
+{
+    size_t bytes = 0;
+
+    // a base that has not moved away from the vertices shares their chunks, ahead of the alternative
+    bytes += snap.verts.capture(verts, prev ? &prev->verts : NULL, alt ? &alt->verts : NULL);
+    bytes += snap.norms.capture(norms, prev ? &prev->norms : NULL, alt ? &alt->norms : NULL);
+    bytes += snap.tris.capture(tris, prev ? &prev->tris : NULL, alt ? &alt->tris : NULL);
+    bytes += snap.base.capture(base, prev ? &prev->base : NULL, &snap.verts);
+    bytes += snap.basenorms.capture(basenorms, prev ? &prev->basenorms : NULL, &snap.norms);
+    return bytes;
+}
+
+void Mesh::restoreSnapshot(const MeshSnapshot &snap)
+{
+    snap.verts.restore(verts);
+    snap.norms.restore(norms);
+    snap.tris.restore(tris);
+    snap.base.restore(base);
+    snap.basenorms.restore(basenorms);
+    fnorms.clear(); // rederived when next needed
+    mcslabs.clear(); // the triangles no longer come from the last extraction
+    embedding.clear();
+    invalidateTopology();
+    accountMemory();
+}
+
+template<class Archive> void Mesh::save(Archive & ar, const unsigned int version) const
+{
+    int32_t mode = (int32_t) containmode;
+
+    uts::saveArray(ar, verts);
+    uts::saveArray(ar, norms);
+    uts::saveArray(ar, tris);
+    uts::saveArray(ar, base);
+    uts::saveArray(ar, basenorms);
+    ar << scale << trx << xrot << yrot << zrot;
+    ar << numraysamples << mode << cacheorder;
+}
+
+template<class Archive> void Mesh::load(Archive & ar, const unsigned int version)
+{
+    int32_t mode;
+
+    uts::loadArray(ar, verts);
+    uts::loadArray(ar, norms);
+    uts::loadArray(ar, tris);
+    uts::loadArray(ar, base);
+    uts::loadArray(ar, basenorms);
+    ar >> scale >> trx >> xrot >> yrot >> zrot;
+    ar >> numraysamples >> mode >> cacheorder;
+    containmode = (MeshContainment) mode;
+    fnorms.clear();
+    mcslabs.clear();
+    embedding.clear();
+    invalidateTopology();
+    accountMemory();
+}
+
+template void Mesh::save(boost::archive::binary_oarchive & ar, const unsigned int version) const;
+template void Mesh::load(boost::archive::binary_iarchive & ar, const unsigned int version);
+
+void Mesh::scanRow(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, std::vector<int> &spans)
+{
+    vector<BVHHit> hits;
+    cgp::Point o;
+    float xstart, xstep;
+    int dx, dy, dz;
+
+    spans.clear();
+    o = vox->getVoxelPos(0, y, z);
+    if(o.y < bbox.min.y || o.y > bbox.max.y || o.z < bbox.min.z || o.z > bbox.max.z)
+        return; // row misses the mesh entirely
+    vox->getDim(dx, dy, dz);
+    xstart = o.x;
+    xstep = (dx > 1) ? vox->getVoxelPos(1, y, z).x - xstart : 1.0f;
+
+    // start the ray just outside the mesh so that every crossing lies in front of it
+    o.x = bbox.min.x - 1.0f;
+    accel.rayHits(o, cgp::Vector(1.0f, 0.0f, 0.0f), hits);
+    crossingSpans(hits, o.x, xstart, xstep, spans);
+}
+
+void Mesh::scanRows(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, int n, std::vector<int> * spans)
+{
+    vector<BVHHit> hits[bvhpacket];
+    cgp::Point origins[bvhpacket], o;
+    int rows[bvhpacket], dx, dy, dz;
+    float xstart, xstep;
+
+    vox->getDim(dx, dy, dz);
+    o = vox->getVoxelPos(0, y, z);
+    xstart = o.x;
+    xstep = (dx > 1) ? vox->getVoxelPos(1, y, z).x - xstart : 1.0f;
+
+    for(int first = 0; first < n; first += bvhpacket)
+    {
+        int count = 0;
+
+        // rows that miss the mesh are left empty, the rest share one packet
+        for(int r = first; r < std::min(first + bvhpacket, n); r++)
+        {
+            spans[r].clear();
+            o = vox->getVoxelPos(0, y + r, z);
+            if(o.y < bbox.min.y || o.y > bbox.max.y || o.z < bbox.min.z || o.z > bbox.max.z)
+                continue;
+            o.x = bbox.min.x - 1.0f;
+            origins[count] = o;
+            rows[count] = r;
+            hits[count++].clear();
+        }
+        accel.packetHits(origins, count, cgp::Vector(1.0f, 0.0f, 0.0f), hits);
+        for(int p = 0; p < count; p++)
+            crossingSpans(hits[p], bbox.min.x - 1.0f, xstart, xstep, spans[rows[p]]);
+    }
+}
+
+void crossingSpans(std::vector<BVHHit> &hits, float ox, float xstart, float xstep, std::vector<int> &spans)
+{
+    vector<float> xsect;
+    int h;
+
+    std::sort(hits.begin(), hits.end(), [](const BVHHit &h0, const BVHHit &h1){ return h0.t < h1.t; });
+
+    // a ray through a shared edge or vertex hits every incident triangle, but these
+    // register as a single crossing if they all agree on whether the ray is entering or leaving
+    for(h = 0; h < (int) hits.size(); h++)
+        if(h == 0 || hits[h].t - hits[h-1].t > scanmergetol || hits[h].front != hits[h-1].front)
+            xsect.push_back(ox + hits[h].t);
+
+    // voxels strictly between alternate crossings are inside, an unmatched final crossing is ignored
+    spans.clear();
+    for(h = 0; h+1 < (int) xsect.size(); h += 2)
+    {
+        spans.push_back((int) floor((xsect[h] - xstart) / xstep) + 1);
+        spans.push_back((int) ceil((xsect[h+1] - xstart) / xstep));
+    }
+}
+
+void Mesh::getFaces(std::vector<int> &faces)
+{
+    faces.resize(3 * tris.size());
+    for(int t = 0; t < (int) tris.size(); t++)
+        for(int p = 0; p < 3; p++)
+            faces[3*t+p] = tris[t].v[p];
+}
+
+void Mesh::setIndexed(const std::vector<cgp::Point> &newverts, const std::vector<int> &faces)
+{
+    clear();
+    verts = newverts;
+    tris.resize(faces.size() / 3);
+    for(int t = 0; t < (int) tris.size(); t++)
+        for(int p = 0; p < 3; p++)
+            tris[t].v[p] = faces[3*t+p];
+    deriveNorms();
+    setBase();
+}
+
+void Mesh::packTriangles(std::vector<float> &coords)
+{
+    coords.resize(tris.size() * 9);
+
+    #pragma omp parallel for schedule(static, vertchunksize)
+    for(int t = 0; t < (int) tris.size(); t++)
+        for(int p = 0; p < 3; p++)
+        {
+            const cgp::Point &v = verts[tris[t].v[p]];
+            coords[9*t + 3*p] = v.x; coords[9*t + 3*p + 1] = v.y; coords[9*t + 3*p + 2] = v.z;
+        }
+}
+
+void Mesh::scanVoxelise(VoxelVolume * vox)
+{
+    int lo[3], hi[3];
+    cgp::BoundBox bbox;
+
+    getBounds(bbox);
+    vox->fill(false);
+    if(!vox->getVoxelRange(bbox, lo, hi)) // mesh lies outside the volume
+        return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = lo[2]; z <= hi[2]; z++)
+    {
+        vector<int> spans[bvhpacket];
+
+        for(int y = lo[1]; y <= hi[1]; y += bvhpacket)
+        {
+            int n = std::min(bvhpacket, hi[1] - y + 1);
+            scanRows(vox, bbox, y, z, n, spans);
+            for(int r = 0; r < n; r++)
+                for(int s = 0; s < (int) spans[r].size(); s += 2)
+                    vox->setSpan(spans[r][s], spans[r][s+1], y + r, z, true);
+        }
+    }
+}
+
 void Mesh::boxFit(float sidelen)
 {
-    cgp::Point pnt;
     cgp::Vector shift, diag, halfdiag;
     float scale;
-    int v;
+    int numverts = (int) verts.size();
     cgp::BoundBox bbox;
 
-    // calculate current bounding box
-    for(v = 0; v < (int) verts.size(); v++)
-        bbox.includePnt(verts[v]);
+    // calculate current bounding box, as a reduction over vectorised chunks
+    vertexBounds(bbox);
 
-    cerr << "numverts = " << (int) verts.size() << endl;
-    if((int) verts.size() > 0)
+    UTS_LOG(INFO, MESH, "numverts = ", numverts);
+    if(numverts > 0)
     {
         // calculate translation necessary to move center of bounding box to the origin
         diag = bbox.getDiag();
@@ -992,283 +1618,1296 @@ void Mesh::boxFit(float sidelen)
         shift.add(halfdiag);
         shift.mult(-1.0f);
 
-        cerr << "shift = " << shift.i << " " << shift.j << " " << shift.k << endl;
+        UTS_LOG(INFO, MESH, "shift = ", shift.i, " ", shift.j, " ", shift.k);
+
+        // scale so that largest side of bounding box fits sidelen
+        scale = max(diag.i, diag.j); scale = max(scale, diag.k);
+        UTS_LOG(INFO, MESH, " scale = ", scale);
+        if(scale > 0.0f)
+        {
+            float tfm[16] = {0.0f};
+
+            // shift center to origin and scale uniformly, as one affine transform applied in place
+            scale = sidelen / scale;
+            tfm[0] = tfm[5] = tfm[10] = scale; tfm[15] = 1.0f;
+            tfm[12] = shift.i * scale; tfm[13] = shift.j * scale; tfm[14] = shift.k * scale;
+            #pragma omp parallel for schedule(static)
+            for(int c = 0; c < numverts; c += vertchunksize)
+                cgp::transformPoints(tfm, &verts[c], std::min(vertchunksize, numverts - c), &verts[c].x, 3);
+
+            if(UTS_LOG_ENABLED(DEBUG, MESH))
+                for(int v = 0; v < numverts; v++)
+                    UTS_LOG(DEBUG, MESH, "pnt ", v, " = ", verts[v].x, " ", verts[v].y, " ", verts[v].z);
+            invalidateAccel();
+        }
+    }
+}
+
+/**
+ * Grow the buffer of a vector to at least @a n elements, marking a large new buffer for huge pages and interleaving
+ * before the stitching loops first write it
+ */
+template<typename T> static void reservePlaced(std::vector<T> &vec, size_t n)
+{
+    if(vec.capacity() >= n)
+        return;
+    vec.reserve(n);
+    parallel::advisePages(vec.data(), vec.capacity() * sizeof(T));
+}
+
+/// Cell edge to lattice edge mapping: offset of the lattice node at the start of the edge and the edge axis (0 = x, 1 = y, 2 = z)
+static const int mcEdgeLattice[12][4] =
+{
+    {0, 0, 0, 0}, {1, 0, 0, 1}, {0, 1, 0, 0}, {0, 0, 0, 1},
+    {0, 0, 1, 0}, {1, 0, 1, 1}, {0, 1, 1, 0}, {0, 0, 1, 1},
+    {0, 0, 0, 2}, {1, 0, 0, 2}, {1, 1, 0, 2}, {0, 1, 0, 2}
+};
+
+/**
+ * Marching cubes over a range of cell layers, sharing vertices between cells through lattice edge tables for the
+ * lower and upper node planes of each layer
+ * @param vox           volume supplying row codes and edge crossings
+ * @param zbase         layer of the whole volume held as layer 0 of @a vox, which may be a slab of it
+ * @param zstart, zend  range [zstart, zend) of cell layers to extract, in layers of the whole volume
+ * @param toplane       x and y edges on the top plane belong to the slab above and are left as foreign edges,
+ *                      otherwise every vertex is placed in this slab
+ * @param origin        first voxel centre of the whole volume
+ * @param voxedgelen    spacing between voxel centres
+ * @param xdim, ydim    number of voxels in x and y
+ * @param planes        two edge tables, working storage
+ * @param codes         row codes for xdim-1 cells, working storage
+ * @param[out] slab     vertices and triangles of the layers
+ */
+template <typename Volume> static void extractCellLayers(Volume * vox, int zbase, int zstart, int zend, bool toplane,
+                                                         const cgp::Point &origin, const cgp::Vector &voxedgelen, int xdim, int ydim,
+                                                         std::vector<int> * planes, std::vector<unsigned char> &codes, MCSlab &slab)
+{
+    int x, y, z, e, t, p, vcode, ecode, planelen = xdim * ydim;
+    int edgeidx[12];
+
+    slab.verts.clear();
+    slab.faces.clear();
+    slab.foreign.clear();
+    slab.bottom.clear();
+    planes[0].assign(3 * planelen, mcnoslot);
+    planes[1].assign(3 * planelen, mcnoslot);
+    for(z = zstart; z < zend; z++)
+    {
+        for(y = 0; y < ydim-1; y++)
+        {
+            if(!vox->getMCRowCodes(y, z - zbase, &codes[0])) // row is entirely inside or outside
+                continue;
+            for(x = 0; x < xdim-1; x++)
+            {
+                vcode = codes[x];
+                ecode = vox->getMCEdgeIdx(vcode);
+                if(ecode == 0) // no triangles if no edges are intersected
+                    continue;
+                UTS_COUNT(MC_ACTIVE_CELLS, 1);
+
+                // look up or create the vertex for each intersected edge
+                for(e = 0; e < 12; e++)
+                    if(ecode & (1 << e))
+                    {
+                        const int * le = mcEdgeLattice[e];
+                        int key = (y + le[1]) * xdim + (x + le[0]);
+                        int &slot = planes[le[2]][3 * key + le[3]];
+
+                        if(slot == mcnoslot)
+                        {
+                            if(le[2] == 1 && z == zend-1 && le[3] != 2 && toplane)
+                            {
+                                // shared with the slab above, resolved when stitching
+                                slab.foreign.push_back(2 * key + le[3]);
+                                slot = -(int) slab.foreign.size();
+                            }
+                            else
+                            {
+                                cgp::Point pnt = vox->getMCEdgeXsect(x, y, z - zbase, e);
+                                pnt.x = origin.x + ((float) x + pnt.x) * voxedgelen.i;
+                                pnt.y = origin.y + ((float) y + pnt.y) * voxedgelen.j;
+                                pnt.z = origin.z + ((float) z + pnt.z) * voxedgelen.k;
+                                slot = (int) slab.verts.size();
+                                slab.verts.push_back(pnt);
+                                if(le[2] == 0 && z == zstart && le[3] != 2)
+                                    slab.bottom.push_back(std::pair<int, int>(2 * key + le[3], slot));
+                            }
+                        }
+                        edgeidx[e] = slot;
+                    }
+
+                for(t = 0; t < 5; t++) // up to 5 triangles per cube
+                {
+                    if(triangleTable[vcode][3*t] < 0) // no more triangles
+                        break;
+                    for(p = 0; p < 3; p++)
+                        slab.faces.push_back(edgeidx[triangleTable[vcode][3*t+p]]);
+                }
+            }
+        }
+        // upper plane of this layer becomes the lower plane of the next
+        planes[0].swap(planes[1]);
+        std::fill(planes[1].begin(), planes[1].end(), mcnoslot);
+    }
+    std::sort(slab.bottom.begin(), slab.bottom.end());
+}
+
+template <typename Volume> void Mesh::extractIsosurface(Volume * vox, int zlo, int zhi)
+{
+    int xdim, ydim, zdim, numslabs, s;
+    cgp::Point origin;
+    cgp::Vector diag, voxedgelen;
+    std::vector<MCSlab> slabs;
+    std::vector<int> vertoff, faceoff;
+    bool stitched = true, reuse;
+
+    vox->getDim(xdim, ydim, zdim);
+    vox->getFrame(origin, diag);
+    slabs.swap(mcslabs); // before clear discards them
+    reuse = !slabs.empty() && mcdim[0] == xdim && mcdim[1] == ydim && mcdim[2] == zdim
+            && mcorigin.x == origin.x && mcorigin.y == origin.y && mcorigin.z == origin.z
+            && mcdiag.i == diag.i && mcdiag.j == diag.j && mcdiag.k == diag.k;
+    clear();
+    if(xdim < 2 || ydim < 2 || zdim < 2) // no cells
+        return;
+    voxedgelen = cgp::Vector(diag.i / (float) (xdim-1), diag.j / (float) (ydim-1), diag.k / (float) (zdim-1));
+
+    // fixed slab thickness, so the output ordering does not depend on the thread count
+    numslabs = (zdim - 1 + mcslablayers - 1) / mcslablayers;
+    if(!reuse)
+        slabs.clear();
+    slabs.resize(numslabs);
+
+    // the edge planes and row codes are allocated once per thread rather than once per slab
+    #pragma omp parallel
+    {
+        std::vector<int> planes[2]; // lattice edge to vertex index for the lower and upper node planes of a cell layer
+        std::vector<unsigned char> codes(xdim-1);
+
+        #pragma omp for schedule(dynamic)
+        for(s = 0; s < numslabs; s++)
+        {
+            UTS_TRACE_SCOPE("marchingCubes slab", "slab", s);
+            MCSlab &slab = slabs[s];
+            int zstart = s * mcslablayers, zend = std::min(zstart + mcslablayers, zdim - 1);
+            bool toplane = (s < numslabs - 1);
+
+            // cell layer z reads voxel layers z and z+1, and a slab whose top plane changes is redone along with the
+            // slab above, so the edges they share still match when stitching
+            if(reuse && (zend < zlo || zstart > zhi))
+                continue;
+            extractCellLayers(vox, 0, zstart, zend, toplane, origin, voxedgelen, xdim, ydim, planes, codes, slab);
+        }
+    }
+
+    // global vertex and face offsets for each slab
+    vertoff.resize(numslabs+1);
+    faceoff.resize(numslabs+1);
+    vertoff[0] = faceoff[0] = 0;
+    for(s = 0; s < numslabs; s++)
+    {
+        vertoff[s+1] = vertoff[s] + (int) slabs[s].verts.size();
+        faceoff[s+1] = faceoff[s] + (int) slabs[s].faces.size() / 3;
+    }
+    reservePlaced(verts, vertoff[numslabs]);
+    reservePlaced(tris, faceoff[numslabs]);
+    verts.resize(vertoff[numslabs]);
+    tris.resize(faceoff[numslabs]);
+
+    // concatenate slabs, stitching shared edges on slab boundaries to the vertices of the slab above
+    #pragma omp parallel for schedule(dynamic) reduction(&&:stitched)
+    for(s = 0; s < numslabs; s++)
+    {
+        UTS_TRACE_SCOPE("marchingCubes stitch", "slab", s);
+        MCSlab &slab = slabs[s];
+        std::vector<int> remote(slab.foreign.size());
+
+        for(int k = 0; k < (int) slab.foreign.size(); k++)
+        {
+            std::vector<std::pair<int, int>> &above = slabs[s+1].bottom;
+            std::vector<std::pair<int, int>>::iterator it = std::lower_bound(above.begin(), above.end(), std::pair<int, int>(slab.foreign[k], -1));
+            if(it != above.end() && it->first == slab.foreign[k])
+            {
+                remote[k] = vertoff[s+1] + it->second;
+            }
+            else
+            {
+                remote[k] = 0;
+                stitched = false;
+            }
+        }
+        for(int i = 0; i < (int) slab.verts.size(); i++)
+            verts[vertoff[s]+i] = slab.verts[i];
+        for(int f = 0; f < (int) slab.faces.size() / 3; f++)
+            for(int p = 0; p < 3; p++)
+            {
+                int idx = slab.faces[3*f+p];
+                tris[faceoff[s]+f].v[p] = (idx >= 0) ? vertoff[s] + idx : remote[-idx-1];
+            }
+    }
+
+    if(!stitched)
+        cerr << "Error Mesh::marchingCubes: slab boundary edge without a matching vertex" << endl;
+    if(!basicValidity())
+        cerr << "Error Mesh::marchingCubes: Not valid after stitching" << endl;
+
+    // laplacianSmooth(12, 0.3f);
+    deriveNorms();
+
+    // create base copy of mesh to support deformation
+    setBase();
+
+    mcslabs.swap(slabs);
+    mcdim[0] = xdim; mcdim[1] = ydim; mcdim[2] = zdim;
+    mcorigin = origin;
+    mcdiag = diag;
+}
+
+void Mesh::marchingCubes(VoxelVolume * vox)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractIsosurface(vox, 0, INT_MAX);
+}
+
+void Mesh::marchingCubes(DistanceField * field)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractIsosurface(field, 0, INT_MAX);
+}
+
+void Mesh::marchingCubes(DexelVolume * dexels)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractIsosurface(dexels, 0, INT_MAX);
+}
+
+void Mesh::marchingCubes(VoxelStreamReader * stream)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractIsosurface(stream, 0, INT_MAX);
+}
+
+void Mesh::marchingCubesSlab(VoxelVolume * slab, int zbase, int zdim, cgp::Point origin, cgp::Vector diag, int zlo, int zhi,
+                             std::vector<cgp::Point> &verts, std::vector<int> &faces)
+{
+    stats::Timer timer(marchingCubesTime);
+    int xdim, ydim, sdim, numparts;
+    cgp::Vector voxedgelen;
+    std::vector<MCSlab> parts;
+
+    verts.clear();
+    faces.clear();
+    slab->getDim(xdim, ydim, sdim);
+    zlo = std::max(zlo, zbase);
+    zhi = std::min(zhi, std::min(zbase + sdim - 1, zdim - 1));
+    if(xdim < 2 || ydim < 2 || zdim < 2 || zlo >= zhi)
+        return;
+    voxedgelen = cgp::Vector(diag.i / (float) (xdim-1), diag.j / (float) (ydim-1), diag.k / (float) (zdim-1));
+
+    // parts of the slab are extracted concurrently, each placing all of its own vertices so nothing needs stitching
+    numparts = (zhi - zlo + mcslablayers - 1) / mcslablayers;
+    parts.resize(numparts);
+    #pragma omp parallel
+    {
+        std::vector<int> planes[2];
+        std::vector<unsigned char> codes(xdim-1);
+
+        #pragma omp for schedule(dynamic)
+        for(int s = 0; s < numparts; s++)
+        {
+            int zstart = zlo + s * mcslablayers;
+            extractCellLayers(slab, zbase, zstart, std::min(zstart + mcslablayers, zhi), false, origin, voxedgelen, xdim, ydim, planes, codes, parts[s]);
+        }
+    }
+
+    for(int s = 0; s < numparts; s++)
+    {
+        int base = (int) verts.size();
+        verts.insert(verts.end(), parts[s].verts.begin(), parts[s].verts.end());
+        for(int idx : parts[s].faces)
+            faces.push_back(base + idx);
+    }
+}
+
+void Mesh::updateMarchingCubes(VoxelVolume * vox, int zlo, int zhi)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractIsosurface(vox, zlo, zhi);
+}
+
+/// Vertices and quads of the cell layers of one dual extraction slab
+struct DualSlab
+{
+    std::vector<cgp::Point> verts;              ///< vertices of the active cells of the slab
+    std::vector<int> faces;                     ///< triangle corners, slab-local vertex index or -(k+1) for cell k on the top layer of the slab below
+    std::vector<std::pair<int, int>> top;       ///< planar cell key and local vertex index of the active cells on the top layer, by key
+};
+
+/**
+ * Mean of the edge crossings of a cell, in cell coordinates
+ * @param vox       volume supplying edge crossings
+ * @param x, y, z   cell
+ * @param ecode     edge bit code of the cell
+ * @param[out] xsect crossing of each edge with its bit set in @a ecode
+ * @returns mean crossing
+ */
+template <typename Volume> static cgp::Point meanCrossing(Volume * vox, int x, int y, int z, int ecode, cgp::Point * xsect)
+{
+    cgp::Point mean(0.0f, 0.0f, 0.0f);
+    int count = 0;
+
+    for(int e = 0; e < 12; e++)
+        if(ecode & (1 << e))
+        {
+            xsect[e] = vox->getMCEdgeXsect(x, y, z, e);
+            mean.x += xsect[e].x; mean.y += xsect[e].y; mean.z += xsect[e].z;
+            count++;
+        }
+    mean.x /= (float) count; mean.y /= (float) count; mean.z /= (float) count;
+    return mean;
+}
+
+/**
+ * Place the vertex of a cell of a voxel volume at the mean of its edge crossings, as surface nets do
+ * @param vox       voxel volume
+ * @param x, y, z   cell
+ * @param ecode     edge bit code of the cell
+ * @returns vertex position in cell coordinates
+ */
+static cgp::Point dualVertex(VoxelVolume * vox, int x, int y, int z, int ecode)
+{
+    cgp::Point xsect[12];
+    return meanCrossing(vox, x, y, z, ecode, xsect);
+}
+
+/**
+ * Slope of a distance field at a voxel along one axis, as the smaller of the one-sided differences, or zero where
+ * they disagree in sign. Unlike a central difference this does not average across a crease of the field, such as
+ * the one inside a sharp edge, so the tangent planes of the faces meeting there are kept apart.
+ * @param field     distance field
+ * @param x, y, z   voxel
+ * @param axis      0, 1 or 2 for x, y or z
+ * @returns slope in voxel units
+ */
+static float fieldSlope(DistanceField * field, int x, int y, int z, int axis)
+{
+    float mid = field->get(x, y, z);
+    float fwd = field->get(x + (axis == 0), y + (axis == 1), z + (axis == 2)) - mid;
+    float bwd = mid - field->get(x - (axis == 0), y - (axis == 1), z - (axis == 2));
+
+    if(fwd * bwd <= 0.0f)
+        return 0.0f;
+    return (fabsf(fwd) < fabsf(bwd)) ? fwd : bwd;
+}
+
+/**
+ * Place the vertex of a cell of a distance field by dual contouring, minimising the squared distances to the
+ * tangent planes at the edge crossings, with a small pull towards their mean that settles directions the planes
+ * leave free, such as along a sharp edge. The result is clamped to the cell.
+ * @param field     distance field
+ * @param x, y, z   cell
+ * @param ecode     edge bit code of the cell
+ * @returns vertex position in cell coordinates
+ */
+static cgp::Point dualVertex(DistanceField * field, int x, int y, int z, int ecode)
+{
+    cgp::Point xsect[12], mean = meanCrossing(field, x, y, z, ecode, xsect), pnt;
+    double ata[3][3] = {{dualqefpull, 0.0, 0.0}, {0.0, dualqefpull, 0.0}, {0.0, 0.0, dualqefpull}}, atb[3], det, m[3];
+
+    // solved relative to the mean, which keeps the system well conditioned
+    m[0] = mean.x; m[1] = mean.y; m[2] = mean.z;
+    atb[0] = atb[1] = atb[2] = 0.0;
+    for(int e = 0; e < 12; e++)
+        if(ecode & (1 << e))
+        {
+            const int * le = mcEdgeLattice[e];
+            float t = (&xsect[e].x)[le[3]] - (float) le[le[3]], n[3], len, off;
+            int bx = x + le[0], by = y + le[1], bz = z + le[2];
+
+            // normal from the change along the edge, and the slopes across it at its ends interpolated to the crossing
+            for(int a = 0; a < 3; a++)
+                if(a == le[3])
+                    n[a] = field->get(bx + (a == 0), by + (a == 1), bz + (a == 2)) - field->get(bx, by, bz);
+                else
+                    n[a] = (1.0f - t) * fieldSlope(field, bx, by, bz, a)
+                         + t * fieldSlope(field, bx + (le[3] == 0), by + (le[3] == 1), bz + (le[3] == 2), a);
+            len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if(len <= 0.0f)
+                continue;
+            off = 0.0f;
+            for(int a = 0; a < 3; a++)
+            {
+                n[a] /= len;
+                off += n[a] * ((&xsect[e].x)[a] - (float) m[a]);
+            }
+            for(int a = 0; a < 3; a++)
+            {
+                for(int b = 0; b < 3; b++)
+                    ata[a][b] += (double) n[a] * (double) n[b];
+                atb[a] += (double) n[a] * (double) off;
+            }
+        }
+
+    det = ata[0][0] * (ata[1][1] * ata[2][2] - ata[1][2] * ata[2][1])
+        - ata[0][1] * (ata[1][0] * ata[2][2] - ata[1][2] * ata[2][0])
+        + ata[0][2] * (ata[1][0] * ata[2][1] - ata[1][1] * ata[2][0]);
+    if(fabs(det) < 1.0e-12)
+        return mean;
+    // Cramer's rule on the symmetric system
+    pnt.x = (float) (m[0] + (atb[0] * (ata[1][1] * ata[2][2] - ata[1][2] * ata[2][1])
+                           - ata[0][1] * (atb[1] * ata[2][2] - ata[1][2] * atb[2])
+                           + ata[0][2] * (atb[1] * ata[2][1] - ata[1][1] * atb[2])) / det);
+    pnt.y = (float) (m[1] + (ata[0][0] * (atb[1] * ata[2][2] - ata[1][2] * atb[2])
+                           - atb[0] * (ata[1][0] * ata[2][2] - ata[1][2] * ata[2][0])
+                           + ata[0][2] * (ata[1][0] * atb[2] - atb[1] * ata[2][0])) / det);
+    pnt.z = (float) (m[2] + (ata[0][0] * (ata[1][1] * atb[2] - atb[1] * ata[2][1])
+                           - ata[0][1] * (ata[1][0] * atb[2] - atb[1] * ata[2][0])
+                           + atb[0] * (ata[1][0] * ata[2][1] - ata[1][1] * ata[2][0])) / det);
+    pnt.x = std::min(std::max(pnt.x, 0.0f), 1.0f);
+    pnt.y = std::min(std::max(pnt.y, 0.0f), 1.0f);
+    pnt.z = std::min(std::max(pnt.z, 0.0f), 1.0f);
+    return pnt;
+}
+
+/**
+ * Dual extraction over a range of cell layers: a vertex for each cell with a mix of inside and outside corners, and
+ * a quad joining the four cells around each crossed lattice edge. Each cell emits the quads of the three edges
+ * leaving its lower corner, whose other cells come before it in scan order, so every vertex is in place when it is
+ * needed.
+ * @param vox           volume supplying row codes and edge crossings
+ * @param zstart, zend  range [zstart, zend) of cell layers to extract
+ * @param origin        first voxel centre of the volume
+ * @param voxedgelen    spacing between voxel centres
+ * @param xdim, ydim    number of voxels in x and y
+ * @param planes        cell to vertex tables of the previous and current cell layers, working storage
+ * @param codes         row codes for xdim-1 cells, working storage
+ * @param[out] slab     vertices and triangles of the layers
+ */
+template <typename Volume> static void extractDualLayers(Volume * vox, int zstart, int zend, const cgp::Point &origin, const cgp::Vector &voxedgelen,
+                                                         int xdim, int ydim, std::vector<int> * planes, std::vector<unsigned char> &codes, DualSlab &slab)
+{
+    const int lowcorner[3] = {1, 3, 4};                         // corner at the far end of the x, y and z edges from corner 0
+    const int ring[4][2] = {{-1, -1}, {0, -1}, {0, 0}, {-1, 0}}; // cells around an edge, anticlockwise about its axis
+    int celldim = xdim - 1, planelen = (xdim-1) * (ydim-1);
+
+    slab.verts.clear();
+    slab.faces.clear();
+    slab.top.clear();
+    planes[0].resize(planelen);
+    planes[1].resize(planelen);
+    for(int z = zstart; z < zend; z++)
+    {
+        for(int y = 0; y < ydim-1; y++)
+        {
+            if(!vox->getMCRowCodes(y, z, &codes[0])) // row is entirely inside or outside
+                continue;
+            for(int x = 0; x < xdim-1; x++)
+            {
+                int vcode = codes[x], key = y * celldim + x, cell[3] = {x, y, z};
+                cgp::Point pnt;
+
+                if(vcode == 0 || vcode == 255)
+                    continue;
+                pnt = dualVertex(vox, x, y, z, vox->getMCEdgeIdx(vcode));
+                pnt.x = origin.x + ((float) x + pnt.x) * voxedgelen.i;
+                pnt.y = origin.y + ((float) y + pnt.y) * voxedgelen.j;
+                pnt.z = origin.z + ((float) z + pnt.z) * voxedgelen.k;
+                planes[1][key] = (int) slab.verts.size();
+                if(z == zend-1)
+                    slab.top.push_back(std::pair<int, int>(key, (int) slab.verts.size()));
+                slab.verts.push_back(pnt);
+
+                for(int a = 0; a < 3; a++)
+                {
+                    int b = (a+1) % 3, c = (a+2) % 3, quad[4];
+                    bool inlow = !(vcode & 1), inhigh = !((vcode >> lowcorner[a]) & 1);
+
+                    if(inlow == inhigh || cell[b] == 0 || cell[c] == 0) // edge not crossed, or on the volume boundary
+                        continue;
+                    for(int k = 0; k < 4; k++)
+                    {
+                        int other[3] = {x, y, z}, okey;
+
+                        other[b] += ring[k][0];
+                        other[c] += ring[k][1];
+                        okey = other[1] * celldim + other[0];
+                        if(other[2] == z)
+                            quad[k] = planes[1][okey];
+                        else if(z > zstart)
+                            quad[k] = planes[0][okey];
+                        else // on the top layer of the slab below, resolved when stitching
+                            quad[k] = -(okey + 1);
+                    }
+                    // the surface faces away from the inside end of the edge
+                    if(!inlow)
+                        std::swap(quad[1], quad[3]);
+                    slab.faces.insert(slab.faces.end(), {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]});
+                }
+            }
+        }
+        planes[0].swap(planes[1]);
+    }
+}
+
+template <typename Volume> void Mesh::extractDual(Volume * vox)
+{
+    int xdim, ydim, zdim, numslabs, s;
+    cgp::Point origin;
+    cgp::Vector diag, voxedgelen;
+    std::vector<DualSlab> slabs;
+    std::vector<int> vertoff, faceoff;
+    bool stitched = true;
+
+    vox->getDim(xdim, ydim, zdim);
+    vox->getFrame(origin, diag);
+    clear();
+    if(xdim < 2 || ydim < 2 || zdim < 2) // no cells
+        return;
+    voxedgelen = cgp::Vector(diag.i / (float) (xdim-1), diag.j / (float) (ydim-1), diag.k / (float) (zdim-1));
+
+    // the same fixed slabs as marching cubes, so the output ordering does not depend on the thread count
+    numslabs = (zdim - 1 + mcslablayers - 1) / mcslablayers;
+    slabs.resize(numslabs);
+    #pragma omp parallel
+    {
+        std::vector<int> planes[2];
+        std::vector<unsigned char> codes(xdim-1);
+
+        #pragma omp for schedule(dynamic)
+        for(s = 0; s < numslabs; s++)
+        {
+            UTS_TRACE_SCOPE("surfaceNets slab", "slab", s);
+            int zstart = s * mcslablayers;
+            extractDualLayers(vox, zstart, std::min(zstart + mcslablayers, zdim - 1), origin, voxedgelen, xdim, ydim, planes, codes, slabs[s]);
+        }
+    }
+
+    vertoff.resize(numslabs+1);
+    faceoff.resize(numslabs+1);
+    vertoff[0] = faceoff[0] = 0;
+    for(s = 0; s < numslabs; s++)
+    {
+        vertoff[s+1] = vertoff[s] + (int) slabs[s].verts.size();
+        faceoff[s+1] = faceoff[s] + (int) slabs[s].faces.size() / 3;
+    }
+    reservePlaced(verts, vertoff[numslabs]);
+    reservePlaced(tris, faceoff[numslabs]);
+    verts.resize(vertoff[numslabs]);
+    tris.resize(faceoff[numslabs]);
+
+    // concatenate slabs, resolving quads on slab boundaries to the vertices of the top layer of the slab below
+    #pragma omp parallel for schedule(dynamic) reduction(&&:stitched)
+    for(s = 0; s < numslabs; s++)
+    {
+        DualSlab &slab = slabs[s];
+
+        for(int i = 0; i < (int) slab.verts.size(); i++)
+            verts[vertoff[s]+i] = slab.verts[i];
+        for(int f = 0; f < (int) slab.faces.size() / 3; f++)
+            for(int p = 0; p < 3; p++)
+            {
+                int idx = slab.faces[3*f+p];
+
+                if(idx < 0) // only the first layer of a slab above the bottom one looks below
+                {
+                    std::vector<std::pair<int, int>> &below = slabs[s-1].top;
+                    std::vector<std::pair<int, int>>::iterator it = std::lower_bound(below.begin(), below.end(), std::pair<int, int>(-idx-1, -1));
+                    if(it != below.end() && it->first == -idx-1)
+                        idx = vertoff[s-1] + it->second;
+                    else
+                    {
+                        idx = 0;
+                        stitched = false;
+                    }
+                }
+                else
+                    idx += vertoff[s];
+                tris[faceoff[s]+f].v[p] = idx;
+            }
+    }
+
+    if(!stitched)
+        cerr << "Error Mesh::surfaceNets: slab boundary cell without a vertex" << endl;
+    deriveNorms();
+    setBase();
+}
+
+void Mesh::surfaceNets(VoxelVolume * vox)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractDual(vox);
+}
+
+void Mesh::dualContouring(DistanceField * field)
+{
+    stats::Timer timer(marchingCubesTime);
+    extractDual(field);
+}
+
+void Mesh::voxelSurface(VoxelVolume * vox, bool greedy)
+{
+    VoxelMesher mesher;
+    vector<int> faces;
+    Triangle tri;
+    int t, p;
+
+    clear();
+    mesher.setGreedy(greedy);
+    mesher.extract(vox, verts, faces);
+    tris.reserve(faces.size() / 3);
+    for(t = 0; t < (int) faces.size() / 3; t++)
+    {
+        for(p = 0; p < 3; p++)
+            tri.v[p] = faces[3*t+p];
+        tris.push_back(tri);
+    }
+
+    deriveNorms();
+
+    // create base copy of mesh to support deformation
+    setBase();
+}
+
+void Mesh::applySmoothing(SmoothMode mode, int iter, float rate, float passband)
+{
+    stats::Timer timer(smoothTime);
+    UTS_TRACE_SCOPE("smooth");
+
+    // the one-ring of each vertex comes from the shared topology, which smoothing does not change
+    buildTopology();
+    smoother.smooth(topo, verts, mode, iter, rate, passband);
+    deriveNorms();
+    invalidateAccel();
+
+    // create base copy of mesh to support deformation
+    setBase();
+}
+
+void Mesh::laplacianSmooth(int iter, float rate)
+{
+    applySmoothing(SmoothMode::LAPLACIAN, iter, rate, taubinpassband);
+}
+
+void Mesh::taubinSmooth(int iter, float lambda, float passband)
+{
+    applySmoothing(SmoothMode::TAUBIN, iter, lambda, passband);
+}
+
+void Mesh::applyFFD(ffd * lat)
+{
+    stats::Timer timer(applyFFDTime);
+    UTS_TRACE_SCOPE("applyFFD");
+    vector<int> moved;
+
+    if(base.size() != verts.size()) // no deformation has been set up since the vertices were last replaced
+        setBase();
+
+    // the base vertices only need embedding again if the lattice frame or dimensions changed, and a vertex only
+    // needs new normals if its result differs from last time
+    if(!embedding.matches(* lat, base.size()))
+        embedding.bind(* lat, base.data(), base.size());
+    embedding.deform(* lat, base.data(), verts.data(), moved);
+
+    if(!moved.empty())
+    {
+        updateNorms(moved);
+        invalidateAccel();
+    }
+}
+
+/**
+ * Map a whole file read-only into memory
+ * @param filename  name of file to map
+ * @param caller    method name for error messages
+ * @param[out] size number of bytes mapped
+ * @returns start of the mapping, to be released with munmap, or NULL on failure
+ */
+static const char * mapFile(const string &filename, const char * caller, size_t &size)
+{
+    struct stat results;
+    void * mapping;
+    int fd;
+
+    fd = open((char *) filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        cerr << "Error Mesh::" << caller << ": unable to open " << filename << endl;
+        return NULL;
+    }
+    if(fstat(fd, &results) != 0 || results.st_size <= 0)
+    {
+        cerr << "Error Mesh::" << caller << ": unable to get size of " << filename << " or file is empty" << endl;
+        close(fd);
+        return NULL;
+    }
+    size = (size_t) results.st_size;
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping holds its own reference to the file
+    if(mapping == MAP_FAILED)
+    {
+        cerr << "Error Mesh::" << caller << ": unable to map " << filename << endl;
+        return NULL;
+    }
+    return (const char *) mapping;
+}
+
+bool Mesh::readSTL(string filename)
+{
+    stats::Timer timer(readSTLTime);
+    const char * inbuffer;
+    size_t insize;
+    uint32_t numt;
+    int badnorms;
+
+    // mapped rather than copied so that large files are paged in on demand
+    inbuffer = mapFile(filename, "readSTL", insize);
+    if(inbuffer == NULL)
+        return false;
+
+    // 80 character header, then a 4-byte triangle count, then 50 bytes per triangle. ASCII files start with
+    // "solid", but so do some binary headers, so only the size of a binary file is trusted to tell them apart.
+    numt = 0;
+    if(insize >= 84)
+        memcpy(&numt, &inbuffer[80], 4);
+    if(insize >= 5 && strncmp(inbuffer, "solid", 5) == 0 && (uint64_t) numt * stlrecordsize + 84 != (uint64_t) insize)
+    {
+        bool ok = parseAsciiSTL(inbuffer, insize);
+        munmap((void *) inbuffer, insize);
+        if(!ok)
+        {
+            clear();
+            return false;
+        }
+    }
+    else
+    {
+        if(insize <= 84)
+        {
+            cerr << "Error Mesh::readSTL: invalid STL binary file, too small" << endl;
+            munmap((void *) inbuffer, insize);
+            return false;
+        }
+        if((uint64_t) numt * stlrecordsize + 84 > (uint64_t) insize || (uint64_t) numt * 3 > (uint64_t) INT_MAX)
+        {
+            cerr << "Error Mesh::readSTL: malformed stl file, " << numt << " triangles do not fit in " << insize << " bytes" << endl;
+            munmap((void *) inbuffer, insize);
+            return false;
+        }
+
+        clear();
+        verts.resize(3 * (size_t) numt);
+        tris.resize(numt);
+        fnorms.resize(numt);
+
+        // triangle vertices have consistent outward facing clockwise winding (right hand rule)
+        // records are independent so they decode in parallel straight into place
+        #pragma omp parallel for schedule(static, stlchunksize)
+        for(int t = 0; t < (int) numt; t++)
+        {
+            float rec[12];
+
+            // IEEE floating point 4-byte binary numerical representation, IEEE754, little endian
+            // normal, then 3 vertices, then an attribute byte count that can simply be discarded
+            memcpy(rec, &inbuffer[84 + (size_t) t * stlrecordsize], sizeof(rec));
+            fnorms.x[t] = rec[0]; fnorms.y[t] = rec[1]; fnorms.z[t] = rec[2];
+            for(int i = 0; i < 3; i++)
+            {
+                verts[3*t+i] = cgp::Point(rec[3+3*i], rec[4+3*i], rec[5+3*i]);
+                tris[t].v[i] = 3*t+i;
+            }
+        }
+        munmap((void *) inbuffer, insize);
+    }
+
+    UTS_LOG(INFO, MESH, "num vertices = ", (int) verts.size());
+    UTS_LOG(INFO, MESH, "num triangles = ", (int) tris.size());
+
+    // STL provides a triangle soup so merge vertices that are coincident
+    mergeVerts();
+    // file normals are kept where they agree with the winding, and normal vectors at vertices are needed for
+    // rendering so derive from incident faces
+    badnorms = validateFaceNorms();
+    if(badnorms > 0)
+        UTS_LOG(INFO, MESH, "face normals derived for ", badnorms, " triangles without a usable normal in the file");
+    deriveVertNorms();
+    if(basicValidity())
+        UTS_LOG(INFO, MESH, "loaded file has basic validity");
+    else
+        UTS_LOG(WARNING, MESH, "loaded file does not pass basic validity");
+    return true;
+}
+
+bool Mesh::parseAsciiSTL(const char * buffer, size_t size)
+{
+    TextTokenizer tok(buffer, size);
+    Triangle tri;
+    float val[3];
+    int i;
+
+    clear();
+    tok.nextLine(); // "solid" and an optional name
+
+    // facet normal nx ny nz / outer loop / vertex x y z (x3) / endloop / endfacet, repeated
+    while(tok.matchWord("facet"))
+    {
+        if(!tok.matchWord("normal") || !tok.readFloat(val[0]) || !tok.readFloat(val[1]) || !tok.readFloat(val[2]))
+        {
+            cerr << "Error Mesh::readSTL: malformed facet normal on line " << tok.getLine() << endl;
+            return false;
+        }
+        fnorms.push_back(cgp::Vector(val[0], val[1], val[2]));
+        if(!tok.matchWord("outer") || !tok.matchWord("loop"))
+        {
+            cerr << "Error Mesh::readSTL: expected outer loop on line " << tok.getLine() << endl;
+            return false;
+        }
+        for(i = 0; i < 3; i++)
+        {
+            if(!tok.matchWord("vertex") || !tok.readFloat(val[0]) || !tok.readFloat(val[1]) || !tok.readFloat(val[2]))
+            {
+                cerr << "Error Mesh::readSTL: malformed vertex on line " << tok.getLine() << ", facets must be triangles" << endl;
+                return false;
+            }
+            tri.v[i] = (int) verts.size();
+            verts.push_back(cgp::Point(val[0], val[1], val[2]));
+        }
+        if(!tok.matchWord("endloop") || !tok.matchWord("endfacet"))
+        {
+            cerr << "Error Mesh::readSTL: expected endloop and endfacet on line " << tok.getLine() << endl;
+            return false;
+        }
+        tris.push_back(tri);
+    }
+    if(!tok.matchWord("endsolid"))
+    {
+        cerr << "Error Mesh::readSTL: expected facet or endsolid on line " << tok.getLine() << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Mesh::readOBJ(string filename)
+{
+    const char * inbuffer, * word;
+    size_t insize;
+    vector<int> poly;
+    Triangle tri;
+    float val[3];
+    long idx;
+    int len, i;
+    bool ok = true;
+
+    inbuffer = mapFile(filename, "readOBJ", insize);
+    if(inbuffer == NULL)
+        return false;
+
+    clear();
+    TextTokenizer tok(inbuffer, insize);
+
+    // only vertex positions and faces contribute to the mesh, other statements are skipped
+    for(; ok && !tok.atEnd(); tok.nextLine())
+    {
+        if(!tok.readWord(word, len))
+            continue;
+        if(len == 1 && word[0] == 'v')
+        {
+            if(!tok.readFloat(val[0]) || !tok.readFloat(val[1]) || !tok.readFloat(val[2]))
+            {
+                cerr << "Error Mesh::readOBJ: malformed vertex on line " << tok.getLine() << endl;
+                ok = false;
+            }
+            else
+                verts.push_back(cgp::Point(val[0], val[1], val[2])); // any w component is ignored
+        }
+        else if(len == 1 && word[0] == 'f')
+        {
+            // corners are v, v/vt, v//vn or v/vt/vn, with negative indices counting back from the latest vertex
+            poly.clear();
+            while(ok && !tok.endOfLine())
+            {
+                if(!tok.readInt(idx) || idx == 0)
+                {
+                    cerr << "Error Mesh::readOBJ: malformed face on line " << tok.getLine() << endl;
+                    ok = false;
+                }
+                else
+                {
+                    poly.push_back((idx > 0) ? (int) (idx - 1) : (int) verts.size() + (int) idx);
+                    tok.skipWord();
+                }
+            }
+            if(ok && (int) poly.size() < 3)
+            {
+                cerr << "Error Mesh::readOBJ: face with fewer than 3 corners on line " << tok.getLine() << endl;
+                ok = false;
+            }
+
+            // polygons are split into a fan of triangles about their first corner
+            for(i = 1; ok && i < (int) poly.size() - 1; i++)
+            {
+                tri.v[0] = poly[0]; tri.v[1] = poly[i]; tri.v[2] = poly[i+1];
+                tris.push_back(tri);
+            }
+        }
+    }
+    munmap((void *) inbuffer, insize);
+    for(i = 0; ok && i < (int) tris.size(); i++)
+        for(int p = 0; p < 3; p++)
+            if(tris[i].v[p] < 0 || tris[i].v[p] >= (int) verts.size())
+            {
+                cerr << "Error Mesh::readOBJ: face refers to missing vertex " << tris[i].v[p] + 1 << endl;
+                ok = false;
+                break;
+            }
+    if(!ok)
+    {
+        clear();
+        return false;
+    }
+
+    UTS_LOG(INFO, MESH, "num vertices = ", (int) verts.size());
+    UTS_LOG(INFO, MESH, "num triangles = ", (int) tris.size());
+
+    // OBJ is already indexed, but coincident vertices can still separate triangles that should be connected
+    mergeVerts();
+    deriveNorms();
+    if(basicValidity())
+        UTS_LOG(INFO, MESH, "loaded file has basic validity");
+    else
+        UTS_LOG(WARNING, MESH, "loaded file does not pass basic validity");
+    return true;
+}
+
+bool Mesh::isMeshFile(string filename)
+{
+    FILE * fp;
+    char magic[4];
+    bool found = false;
+
+    fp = fopen(filename.c_str(), "rb");
+    if(fp != NULL)
+    {
+        found = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, meshfilemagic, 4) == 0);
+        fclose(fp);
+    }
+    return found;
+}
+
+bool Mesh::readMeshFile(string filename)
+{
+    MeshFileHeader hdr;
+    const char * inbuffer, * vbuf, * nbuf, * tbuf, * fbuf;
+    size_t insize;
+    uint64_t need;
+
+    inbuffer = mapFile(filename, "readMeshFile", insize);
+    if(inbuffer == NULL)
+        return false;
+
+    if(insize < sizeof(MeshFileHeader) || memcmp(inbuffer, meshfilemagic, 4) != 0)
+    {
+        cerr << "Error Mesh::readMeshFile: " << filename << " is not a mesh file" << endl;
+        munmap((void *) inbuffer, insize);
+        return false;
+    }
+    memcpy(&hdr, inbuffer, sizeof(MeshFileHeader));
+    if(hdr.version != meshfileversion || hdr.numverts < 0 || hdr.numtris < 0)
+    {
+        cerr << "Error Mesh::readMeshFile: unsupported version or layout in " << filename << endl;
+        munmap((void *) inbuffer, insize);
+        return false;
+    }
+    need = sizeof(MeshFileHeader) + (uint64_t) hdr.numverts * 12 * (hdr.hasnorms ? 2 : 1) + (uint64_t) hdr.numtris * 24;
+    if((uint64_t) insize < need)
+    {
+        cerr << "Error Mesh::readMeshFile: " << filename << " is truncated" << endl;
+        munmap((void *) inbuffer, insize);
+        return false;
+    }
 
-        // scale so that largest side of bounding box fits sidelen
-        scale = max(diag.i, diag.j); scale = max(scale, diag.k);
-        cerr << " scale = " << scale << endl;
-        if(scale > 0.0f)
+    clear();
+    verts.resize(hdr.numverts);
+    norms.resize(hdr.hasnorms ? hdr.numverts : 0);
+    tris.resize(hdr.numtris);
+    fnorms.resize(hdr.numtris);
+    vbuf = inbuffer + sizeof(MeshFileHeader);
+    nbuf = vbuf + (size_t) hdr.numverts * 12;
+    tbuf = nbuf + (hdr.hasnorms ? (size_t) hdr.numverts * 12 : 0);
+    fbuf = tbuf + (size_t) hdr.numtris * 12;
+
+    #pragma omp parallel for schedule(static, stlchunksize)
+    for(int v = 0; v < hdr.numverts; v++)
+    {
+        float rec[3];
+        memcpy(rec, vbuf + (size_t) v * 12, 12);
+        verts[v] = cgp::Point(rec[0], rec[1], rec[2]);
+        if(hdr.hasnorms)
         {
-            scale = sidelen / scale;
-
-            // shift center to origin and scale uniformly
-            for(v = 0; v < (int) verts.size(); v++)
-            {
-                pnt = verts[v];
-                shift.pntplusvec(pnt, &pnt);
-                pnt.x *= scale; pnt.y *= scale; pnt.z *= scale;
-                verts[v] = pnt;
-                cerr << "pnt " << v << " = " << pnt.x << " " << pnt.y << " " << pnt.z << endl;
-            }
+            memcpy(rec, nbuf + (size_t) v * 12, 12);
+            norms[v] = cgp::Vector(rec[0], rec[1], rec[2]);
         }
-        // buildSphereAccel((int) sphperdim);
     }
-}
-
-void Mesh::marchingCubes(VoxelVolume * vox)
-{
-    int e, t, p, x, y, z, xdim, ydim, zdim, vcode, ecode, ex;
-    cgp::Point origin, edgeXsect[12]; // position of edge intersections
-    Triangle tri;
-    cgp::Vector diag, celloff, voxedgelen, voxoffset, voxdiag;
 
-    vox->getDim(xdim, ydim, zdim);
-    vox->getFrame(origin, diag);
-    voxoffset = cgp::Vector(origin.x, origin.y, origin.z);
-    clear();
-    voxedgelen = cgp::Vector(diag.i / (float) (xdim-1), diag.j / (float) (ydim-1), diag.k / (float) (zdim-1));
-    for(x = 0; x < xdim-1; x++)
+    bool inbounds = true;
+    #pragma omp parallel for schedule(static, stlchunksize) reduction(&&:inbounds)
+    for(int t = 0; t < hdr.numtris; t++)
     {
-        for(y = 0; y < ydim-1; y++)
-            for(z = 0; z < zdim-1; z++)
-            {
-                vcode = vox->getMCVertIdx(x, y, z);
-                ecode = vox->getMCEdgeIdx(vcode);
-
-                if(ecode != 0) // no triangles if no edges are intersected
-                {
-                    for(e = 0; e < 12; e++) // transform edge intersection to correct position and scale
-                        if(ecode & (1 << e))
-                        {
-                            edgeXsect[e] = vox->getMCEdgeXsect(e);
-                            // transform by scaling and translation to world coordinates
-                            edgeXsect[e].x *= voxedgelen.i; edgeXsect[e].y *= voxedgelen.j; edgeXsect[e].z *= voxedgelen.k;
-                            voxoffset.pntplusvec(edgeXsect[e], &edgeXsect[e]); // volume origin offset
-                            celloff = cgp::Vector((float) x * voxedgelen.i, (float) y * voxedgelen.j, (float) z * voxedgelen.k);
-                            celloff.pntplusvec(edgeXsect[e], &edgeXsect[e]); // local cell offset
-                        }
-                    for(t = 0; t < 5; t++) // up to 5 triangles per cube
-                    {
-                        if(triangleTable[vcode][3*t] < 0) // no more triangles
-                            break;
-                        for(p = 0; p < 3; p++)
-                        {
-                            ex = triangleTable[vcode][3*t+p];
-                            verts.push_back(edgeXsect[ex]); // vertex position
-                            tri.v[p] = (int) verts.size()-1; // vertex index
-                        }
-                        tris.push_back(tri);
-                    }
-
-                }
-            }
+        float rec[3];
+        int32_t idx[3];
+        memcpy(idx, tbuf + (size_t) t * 12, 12);
+        for(int p = 0; p < 3; p++)
+        {
+            tris[t].v[p] = idx[p];
+            inbounds = inbounds && idx[p] >= 0 && idx[p] < hdr.numverts;
+        }
+        memcpy(rec, fbuf + (size_t) t * 12, 12);
+        fnorms.x[t] = rec[0]; fnorms.y[t] = rec[1]; fnorms.z[t] = rec[2];
     }
-    // creates a triangle soup, with lots of duplicate vertices
-    mergeVerts(); // remove duplicate vertices
-    if(!basicValidity())
-        cerr << "Error Mesh::marchingCubes: Not valid after merging" << endl;
+    munmap((void *) inbuffer, insize);
 
-    // laplacianSmooth(12, 0.3f);
-    deriveFaceNorms();
-    deriveVertNorms();
+    if(!inbounds)
+    {
+        cerr << "Error Mesh::readMeshFile: triangle refers to missing vertex in " << filename << endl;
+        clear();
+        return false;
+    }
+    if(!hdr.hasnorms)
+        deriveVertNorms();
+    invalidateAccel();
 
     // create base copy of mesh to support deformation
-    base.resize((int) verts.size());
-    for(int v = 0; v < (int) verts.size(); v++)
-        base[v] = verts[v];
+    setBase();
+    return true;
 }
 
-void Mesh::laplacianSmooth(int iter, float rate)
+size_t Mesh::getMeshFileBytes()
 {
-    vector<vector<int>> adj;
-    vector<int> emptyadj;
-    vector<Vector> del;
-    float norm;
-    cgp::Vector delvec, adjvec;
-    int i, v, t, a, p;
+    bool hasnorms = (norms.size() == verts.size());
 
-    // build an adjacency list for vertices
-    // assumes a two-manifold without boundary because it uses triangle winding to ensure that duplicate entries are not added
-    for(v = 0; v < (int) verts.size(); v++)
-        adj.push_back(emptyadj);
-    for(t = 0; t < (int) tris.size(); t++)
-        for(p = 0; p < 3; p++)
-            adj[tris[t].v[p]].push_back(tris[t].v[(p+1)%3]); // forward edge adjacency
+    return sizeof(MeshFileHeader) + verts.size() * 12 * (hasnorms ? 2 : 1) + tris.size() * 24;
+}
 
-    for(i = 0; i < iter; i++)
+void Mesh::encodeMeshFile(char * buf)
+{
+    MeshFileHeader hdr;
+    char * vbuf, * nbuf, * tbuf, * fbuf;
+
+    applyCacheOrder();
+    ensureFaceNorms();
+    memset(&hdr, 0, sizeof(MeshFileHeader));
+    memcpy(hdr.magic, meshfilemagic, 4);
+    hdr.version = meshfileversion;
+    hdr.numverts = (int32_t) verts.size();
+    hdr.numtris = (int32_t) tris.size();
+    hdr.hasnorms = (norms.size() == verts.size()) ? 1 : 0; // normals are re-derived on load otherwise
+
+    // encode every array in parallel
+    memcpy(buf, &hdr, sizeof(MeshFileHeader));
+    vbuf = buf + sizeof(MeshFileHeader);
+    nbuf = vbuf + (size_t) hdr.numverts * 12;
+    tbuf = nbuf + (hdr.hasnorms ? (size_t) hdr.numverts * 12 : 0);
+    fbuf = tbuf + (size_t) hdr.numtris * 12;
+
+    #pragma omp parallel for schedule(static, stlchunksize)
+    for(int v = 0; v < hdr.numverts; v++)
     {
-        del.clear();
-        for(v = 0; v < (int) verts.size(); v++)
+        float rec[3] = {verts[v].x, verts[v].y, verts[v].z};
+        memcpy(vbuf + (size_t) v * 12, rec, 12);
+        if(hdr.hasnorms)
         {
-            delvec = Vector(0.0f, 0.0f, 0.0f);
-            // delvec = sum_j (x_j - x_i) / numadj
-            // new position relies on weighted sum of one ring neighbours of vertex
-            for(a = 0; a < (int) adj[v].size(); a++)
-            {
-                adjvec.diff(verts[v], verts[(adj[v])[a]]);
-                delvec.add(adjvec);
-            }
-            norm =  rate / (float) adj[v].size();
-            delvec.mult(norm);
-            del.push_back(delvec);
+            float nrec[3] = {norms[v].i, norms[v].j, norms[v].k};
+            memcpy(nbuf + (size_t) v * 12, nrec, 12);
         }
-
-        // apply Laplacian
-        for(v = 0; v < (int) verts.size(); v++)
-            del[v].pntplusvec(verts[v], &verts[v]);
     }
-    deriveFaceNorms();
-    deriveVertNorms();
-
-    // create base copy of mesh to support deformation
-    base.resize((int) verts.size());
-    for(v = 0; v < (int) verts.size(); v++)
-        base[v] = verts[v];
+    #pragma omp parallel for schedule(static, stlchunksize)
+    for(int t = 0; t < hdr.numtris; t++)
+    {
+        int32_t idx[3] = {tris[t].v[0], tris[t].v[1], tris[t].v[2]};
+        float rec[3] = {fnorms.x[t], fnorms.y[t], fnorms.z[t]};
+        memcpy(tbuf + (size_t) t * 12, idx, 12);
+        memcpy(fbuf + (size_t) t * 12, rec, 12);
+    }
 }
 
-void Mesh::applyFFD(ffd * lat)
+bool Mesh::writeMeshFile(string filename)
 {
-    for(int v = 0; v < (int) verts.size(); v++)
+    vector<char> outbuffer;
+    FILE * fp;
+    bool ok;
+
+    // encode into one buffer, then write it in a single call
+    outbuffer.resize(getMeshFileBytes());
+    encodeMeshFile(&outbuffer[0]);
+
+    fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL)
     {
-        verts[v] = base[v];
-        lat->deform(verts[v]);
+        cerr << "Error Mesh::writeMeshFile: unable to open " << filename << endl;
+        return false;
     }
-    deriveFaceNorms();
-    deriveVertNorms();
+    ok = (fwrite(&outbuffer[0], 1, outbuffer.size(), fp) == outbuffer.size());
+    if(fclose(fp) != 0)
+        ok = false;
+    if(!ok)
+        cerr << "Error Mesh::writeMeshFile: failed writing " << filename << endl;
+    return ok;
 }
 
-bool Mesh::readSTL(string filename)
+bool Mesh::isCompressedFile(string filename)
 {
-    ifstream infile;
-	char * inbuffer;
-    struct stat results;
-    int insize, inpos, numt, t, i;
-    cgp::Point vpos;
-    Triangle tri;
-
-    // assumes binary format STL file
-    infile.open((char *) filename.c_str(), ios_base::in | ios_base::binary);
-	if(infile.is_open())
-	{
-        clear();
+    FILE * fp;
+    char magic[4];
+    bool found = false;
 
-		// get the size of the file
-		stat((char *) filename.c_str(), &results);
-		insize = results.st_size;
+    fp = fopen(filename.c_str(), "rb");
+    if(fp != NULL)
+    {
+        found = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, meshcodecmagic, 4) == 0);
+        fclose(fp);
+    }
+    return found;
+}
 
-		// put file contents in buffer
-		inbuffer = new char[insize];
-		infile.read(inbuffer, insize);
-		if(!infile) // failed to read from the file for some reason
-		{
-            cerr << "Error Mesh::readSTL: unable to populate read buffer" << endl;
-			return false;
-		}
+void Mesh::encodeCompressed(std::vector<uint8_t> &out, int posbits, int normbits)
+{
+    applyCacheOrder(); // the connectivity coding relies on neighbouring triangles being close in the list
+    codec.encode(verts.data(), (norms.size() == verts.size()) ? norms.data() : NULL, (int) verts.size(),
+                 tris.empty() ? NULL : &tris[0].v[0], (int) tris.size(), posbits, normbits, out);
+}
 
-		// interpret buffer as STL file
-        if(insize <= 84)
-        {
-            cerr << "Error Mesh::readSTL: invalid STL binary file, too small" << endl;
-            return false;
-        }
+bool Mesh::decodeCompressed(const uint8_t * data, size_t len)
+{
+    MeshCodecHeader hdr;
+    bool ok;
 
-        inpos = 80; // skip 80 character header
-        if(inpos+4 >= insize){ cerr << "Error Mesh::readSTL: malformed header on stl file" << endl; return false; }
-        numt = (int) (* ((long *) &inbuffer[inpos]));
-        inpos += 4;
+    clear();
+    if(!MeshCodec::readHeader(data, len, hdr))
+    {
+        cerr << "Error Mesh::decodeCompressed: not a compressed mesh or unsupported version" << endl;
+        return false;
+    }
+    verts.resize(hdr.numverts);
+    norms.resize(hdr.normbits > 0 ? hdr.numverts : 0);
+    tris.resize(hdr.numtris);
+    ok = MeshCodec::decode(data, len, verts.data(), norms.empty() ? NULL : norms.data(), tris.empty() ? NULL : &tris[0].v[0]);
+    if(!ok)
+    {
+        cerr << "Error Mesh::decodeCompressed: compressed mesh is damaged" << endl;
+        clear();
+        return false;
+    }
+    UTS_LOG(INFO, MESH, "num vertices = ", (int) verts.size());
+    UTS_LOG(INFO, MESH, "num triangles = ", (int) tris.size());
 
-        t = 0;
+    if(hdr.normbits == 0)
+        deriveVertNorms();
+    deriveFaceNorms();
+    invalidateAccel();
 
-        // triangle vertices have consistent outward facing clockwise winding (right hand rule)
-        while(t < numt) // read in triangle data
-        {
-            // normal
-            if(inpos+12 >= insize){ cerr << "Error Mesh::readSTL: malformed stl file" << endl; return false; }
-            // IEEE floating point 4-byte binary numerical representation, IEEE754, little endian
-            tri.n = cgp::Vector((* ((float *) &inbuffer[inpos])), (* ((float *) &inbuffer[inpos+4])), (* ((float *) &inbuffer[inpos+8])));
-            inpos += 12;
+    // create base copy of mesh to support deformation
+    setBase();
+    return true;
+}
 
-            // vertices
-            for(i = 0; i < 3; i++)
-            {
-                if(inpos+12 >= insize){ cerr << "Error Mesh::readSTL: malformed stl file" << endl; return false; }
-                vpos = cgp::Point((* ((float *) &inbuffer[inpos])), (* ((float *) &inbuffer[inpos+4])), (* ((float *) &inbuffer[inpos+8])));
-                tri.v[i] = (int) verts.size();
-                verts.push_back(vpos);
-                inpos += 12;
-            }
-            tris.push_back(tri);
-            t++;
-            inpos += 2; // handle attribute byte count - which can simply be discarded
-        }
+bool Mesh::readCompressed(string filename)
+{
+    const char * inbuffer;
+    size_t insize;
+    bool ok;
 
-        // tidy up
-		delete inbuffer;
-		infile.close();
+    inbuffer = mapFile(filename, "readCompressed", insize);
+    if(inbuffer == NULL)
+        return false;
+    ok = decodeCompressed((const uint8_t *) inbuffer, insize);
+    munmap((void *) inbuffer, insize);
+    if(!ok)
+        cerr << "Error Mesh::readCompressed: unable to decode " << filename << endl;
+    return ok;
+}
 
-        cerr << "num vertices = " << (int) verts.size() << endl;
-        cerr << "num triangles = " << (int) tris.size() << endl;
+bool Mesh::writeCompressed(string filename, int posbits, int normbits)
+{
+    vector<uint8_t> outbuffer;
+    FILE * fp;
+    bool ok;
 
-        // STL provides a triangle soup so merge vertices that are coincident
-        mergeVerts();
-        // normal vectors at vertices are needed for rendering so derive from incident faces
-        deriveVertNorms();
-        if(basicValidity())
-            cerr << "loaded file has basic validity" << endl;
-        else
-            cerr << "loaded file does not pass basic validity" << endl;
-    }
-    else
+    encodeCompressed(outbuffer, posbits, normbits);
+    fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL)
     {
-        cerr << "Error Mesh::readSTL: unable to open " << filename << endl;
+        cerr << "Error Mesh::writeCompressed: unable to open " << filename << endl;
         return false;
     }
-    return true;
+    ok = (fwrite(outbuffer.data(), 1, outbuffer.size(), fp) == outbuffer.size());
+    if(fclose(fp) != 0)
+        ok = false;
+    if(!ok)
+        cerr << "Error Mesh::writeCompressed: failed writing " << filename << endl;
+    return ok;
+}
 
+bool Mesh::readMesh(string filename)
+{
+    string ext = (filename.size() >= 4) ? filename.substr(filename.size() - 4) : "";
+
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if(isMeshFile(filename))
+        return readMeshFile(filename);
+    else if(isCompressedFile(filename))
+        return readCompressed(filename);
+    else if(ext == ".obj")
+        return readOBJ(filename);
+    else
+        return readSTL(filename);
 }
 
 bool Mesh::writeSTL(string filename)
 {
-    ofstream outfile;
-    int t, p, numt;
-    unsigned short val;
-
-    outfile.open((char *) filename.c_str(), ios_base::out | ios_base::binary);
-	if(outfile.is_open())
-	{
-        outfile.write("File Generated by Tesselator. Binary STL", 80); // skippable header
-        numt = (int) tris.size();
-        outfile.write((char *) &numt, 4); // number of triangles
+    vector<char> outbuffer;
+    const char header[80] = "File Generated by Tesselator. Binary STL"; // skippable header, zero padded
+    uint32_t numt;
+    FILE * fp;
+    bool ok;
+
+    applyCacheOrder();
+    ensureFaceNorms();
+
+    // encode the whole file into one buffer, with records filled in parallel, then write it in a single call
+    numt = (uint32_t) tris.size();
+    outbuffer.resize(84 + (size_t) numt * stlrecordsize);
+    memcpy(&outbuffer[0], header, 80);
+    memcpy(&outbuffer[80], &numt, 4); // number of triangles
+
+    #pragma omp parallel for schedule(static, stlchunksize)
+    for(int t = 0; t < (int) numt; t++)
+    {
+        float rec[12];
+        char * dst = &outbuffer[84 + (size_t) t * stlrecordsize];
 
-        for(t = 0; t < numt; t++)
+        // normal, then triangle vertices
+        rec[0] = fnorms.x[t]; rec[1] = fnorms.y[t]; rec[2] = fnorms.z[t];
+        for(int p = 0; p < 3; p++)
         {
-            // normal
-            outfile.write((char *) &tris[t].n.i, 4);
-            outfile.write((char *) &tris[t].n.j, 4);
-            outfile.write((char *) &tris[t].n.k, 4);
-
-            // triangle vertices
-            for(p = 0; p < 3; p++)
-            {
-                outfile.write((char *) &verts[tris[t].v[p]].x, 4);
-                outfile.write((char *) &verts[tris[t].v[p]].y, 4);
-                outfile.write((char *) &verts[tris[t].v[p]].z, 4);
-            }
-
-            // attribute byte count - null
-            val = 0;
-            outfile.write((char *) &val, 2);
+            rec[3+3*p] = verts[tris[t].v[p]].x;
+            rec[4+3*p] = verts[tris[t].v[p]].y;
+            rec[5+3*p] = verts[tris[t].v[p]].z;
         }
-
-        // tidy up
-		outfile.close();
+        memcpy(dst, rec, sizeof(rec));
+        dst[48] = dst[49] = 0; // attribute byte count - null
     }
-    else
+
+    fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL)
     {
         cerr << "Error Mesh::writeSTL: unable to open " << filename << endl;
         return false;
     }
-    return true;
+    ok = (fwrite(&outbuffer[0], 1, outbuffer.size(), fp) == outbuffer.size());
+    if(fclose(fp) != 0)
+        ok = false;
+    if(!ok)
+        cerr << "Error Mesh::writeSTL: failed writing " << filename << endl;
+    return ok;
 }
 
 void Mesh::readGrid(vector<vector<vector<int>>> &voxelgrid, string filename, int len)
@@ -1323,31 +2962,199 @@ bool Mesh::writeGrid(vector<vector<vector<int>>> &voxelgrid, string outfilename,
     return true;
 }
 
-void Mesh::mergeMesh(Mesh *m2, bool lastCall)
+void Mesh::mergeMeshes(const std::vector<Mesh *> &parts, bool weldseams)
 {
-    // copy new verts and tris from m2 to this
-    verts.insert(verts.end(), m2->verts.begin(), m2->verts.end());
-    tris.insert(tris.end(), m2->tris.begin(), m2->tris.end());
+    stats::Timer timer(mergeMeshesTime);
+    vector<cgp::BoundBox> boxes;
+    vector<int> start;
+    size_t numverts = verts.size(), numtris = tris.size();
+
+    for(Mesh * part : parts)
+    {
+        numverts += part->verts.size();
+        numtris += part->tris.size();
+    }
+    if(numverts > (size_t) INT_MAX)
+    {
+        cerr << "Error Mesh::mergeMeshes: " << numverts << " vertices are too many to index" << endl;
+        return;
+    }
+
+    // this mesh as it was is the first part of the seam
+    if(weldseams && !verts.empty())
+    {
+        boxes.push_back(cgp::BoundBox());
+        boxes.back().includePnts(verts.data(), verts.size());
+        start.push_back(0);
+    }
+    verts.reserve(numverts);
+    tris.reserve(numtris);
+    for(Mesh * part : parts)
+    {
+        int vbase = (int) verts.size(), tbase = (int) tris.size();
+        int nv = (int) part->verts.size(), nt = (int) part->tris.size();
+
+        if(part == this || nv == 0)
+            continue;
+        if(weldseams)
+        {
+            boxes.push_back(cgp::BoundBox());
+            boxes.back().includePnts(part->verts.data(), nv);
+            start.push_back(vbase);
+        }
+        verts.resize(vbase + nv);
+        tris.resize(tbase + nt);
+        #pragma omp parallel for if(nv >= mergeparallel)
+        for(int v = 0; v < nv; v++)
+            verts[vbase + v] = part->verts[v];
+        #pragma omp parallel for if(nt >= mergeparallel)
+        for(int t = 0; t < nt; t++)
+            for(int p = 0; p < 3; p++)
+                tris[tbase + t].v[p] = part->tris[t].v[p] + vbase;
+    }
+    fnorms.clear(); // rederived when next needed
+    mcslabs.clear(); // the triangles no longer come from a single extraction
+    invalidateTopology();
 
-    if (lastCall)
+    if(boxes.size() > 1)
     {
-        mergeVerts();
+        start.push_back((int) verts.size());
+        weldSeams(boxes, start);
+    }
+    accountMemory();
+}
 
-        for (vector<Triangle>::iterator iter = tris.begin(); iter != tris.end(); iter++) {
-            (*iter).printVec();
+void Mesh::weldSeams(std::vector<cgp::BoundBox> &boxes, const std::vector<int> &start)
+{
+    VertexWelder welder;
+    vector<cgp::Point> seamverts, welded;
+    vector<int> seam, remap, first, newidx;
+    vector<vector<int>> overlaps(boxes.size());
+    cgp::BoundBox all;
+    float eps;
+    int numparts = (int) boxes.size(), kept = 0;
+
+    for(int i = 0; i < numparts; i++)
+    {
+        all.includePnt(boxes[i].min);
+        all.includePnt(boxes[i].max);
+    }
+    eps = weldDistance(all);
+
+    // boxes, widened by the weld distance, that each part meets
+    for(int i = 0; i < numparts; i++)
+        for(int j = 0; j < numparts; j++)
+            if(i != j && boxes[i].min.x <= boxes[j].max.x + eps && boxes[j].min.x <= boxes[i].max.x + eps
+                      && boxes[i].min.y <= boxes[j].max.y + eps && boxes[j].min.y <= boxes[i].max.y + eps
+                      && boxes[i].min.z <= boxes[j].max.z + eps && boxes[j].min.z <= boxes[i].max.z + eps)
+                overlaps[i].push_back(j);
+
+    // only vertices inside another part's box can meet that part
+    for(int i = 0; i < numparts; i++)
+        for(int v = start[i]; v < start[i+1] && !overlaps[i].empty(); v++)
+            for(int j : overlaps[i])
+            {
+                const cgp::BoundBox &box = boxes[j];
+                if(verts[v].x >= box.min.x - eps && verts[v].x <= box.max.x + eps && verts[v].y >= box.min.y - eps
+                   && verts[v].y <= box.max.y + eps && verts[v].z >= box.min.z - eps && verts[v].z <= box.max.z + eps)
+                {
+                    seam.push_back(v);
+                    seamverts.push_back(verts[v]);
+                    break;
+                }
+            }
+    if(seam.empty())
+        return;
+
+    // each seam vertex joins the first in its group, and the vertices left are renumbered in order
+    welder.weld(seamverts, eps, remap, welded);
+    first.assign(welded.size(), -1);
+    newidx.assign(verts.size(), 0);
+    for(int k = 0; k < (int) seam.size(); k++)
+        if(first[remap[k]] < 0)
+            first[remap[k]] = seam[k];
+        else
+            newidx[seam[k]] = -1 - first[remap[k]];
+    for(int v = 0; v < (int) verts.size(); v++)
+        if(newidx[v] == 0)
+        {
+            verts[kept] = verts[v];
+            newidx[v] = kept++;
         }
+    for(int v = 0; v < (int) newidx.size(); v++)
+        if(newidx[v] < 0)
+            newidx[v] = newidx[-1 - newidx[v]];
+    UTS_LOG(INFO, MESH, "seam vertices welded = ", (int) verts.size() - kept, " of ", (int) seam.size());
+    verts.resize(kept);
+
+    #pragma omp parallel for if(tris.size() >= (size_t) mergeparallel)
+    for(int t = 0; t < (int) tris.size(); t++)
+        for(int p = 0; p < 3; p++)
+            if(tris[t].v[p] >= 0 && tris[t].v[p] < (int) newidx.size())
+                tris[t].v[p] = newidx[tris[t].v[p]];
+}
+
+void Mesh::mergeMesh(Mesh * m2, bool weldseam)
+{
+    mergeMeshes(vector<Mesh *>(1, m2), weldseam);
+}
+
+void Mesh::mergeMesh(Mesh && m2, bool weldseam)
+{
+    if(verts.empty() && tris.empty())
+    {
+        verts.swap(m2.verts);
+        tris.swap(m2.tris);
+        fnorms.clear();
+        mcslabs.clear();
+        invalidateTopology();
+        accountMemory();
+    }
+    else
+        mergeMeshes(vector<Mesh *>(1, &m2), weldseam);
+    m2.clear();
+}
+
+bool Mesh::booleanOf(Mesh * a, Mesh * b, int op)
+{
+    stats::Timer timer(booleanOfTime);
+    UTS_TRACE_SCOPE("booleanOf");
+    MeshBoolean engine;
+    vector<cgp::Point> outverts;
+    vector<int> faces[2], outfaces;
+    Mesh * operand[2] = {a, b};
+    int i, t;
+
+    for(i = 0; i < 2; i++)
+    {
+        operand[i]->buildWorld();
+        faces[i].resize(3 * operand[i]->tris.size());
+        for(t = 0; t < (int) operand[i]->tris.size(); t++)
+            for(int p = 0; p < 3; p++)
+                faces[i][3*t+p] = operand[i]->tris[t].v[p];
     }
+    if(!engine.apply(a->wverts, faces[0], b->wverts, faces[1], op, outverts, outfaces))
+        return false;
+
+    clear();
+    verts.swap(outverts);
+    tris.resize(outfaces.size() / 3);
+    for(t = 0; t < (int) tris.size(); t++)
+        for(int p = 0; p < 3; p++)
+            tris[t].v[p] = outfaces[3*t+p];
+    deriveNorms();
+    setBase();
+    UTS_LOG(INFO, MESH, "boolean result has ", (int) verts.size(), " vertices and ", (int) tris.size(), " triangles");
+    return true;
 }
 
 bool Mesh::basicValidity()
 {
-    int i, p, t, v;
-    vector<bool> dangle;
-    long key;
-    // use hashmap to quickly look up vertices with the same coordinates
-    std::unordered_map<long, int> idxlookup; // key is concatenation of vertex position, value is index into the cleanverts vector
+    VertexWelder welder;
+    vector<int> remap;
     cgp::BoundBox bbox;
     vector<cgp::Point> cleanverts;
+    int numverts = (int) verts.size(), outside, dangling;
 
     // search vertex list for duplicates
     // duplicate vertices will not occur if MergeVerts has taken place
@@ -1378,250 +3185,144 @@ bool Mesh::basicValidity()
     */
 
     // construct a bounding box enclosing all vertices
-    bbox.reset();
-    for(i = 0; i < (int) verts.size(); i++)
-        bbox.includePnt(verts[i]);
+    vertexBounds(bbox);
 
-    cleanverts.clear();
-
-    // search vertex list for duplicates using hash table
-    for(i = 0; i < (int) verts.size(); i++)
+    // search vertex list for duplicates, using the same tolerance as mergeVerts
+    if(welder.weld(verts, weldDistance(bbox), remap, cleanverts) < (int) verts.size())
     {
-        key = hashVert(verts[i], bbox);
-        if(idxlookup.find(key) == idxlookup.end()) // key not in map
-        {
-            idxlookup[key] = (int) cleanverts.size(); // put index in map for quick lookup
-            cleanverts.push_back(verts[i]);
-        }
-        else
-        {
-            cerr << "Error Mesh::basicValidity(): duplicate vertex found" << endl;
-            return false; // early out - exits on first duplicate encountered
-        }
+        cerr << "Error Mesh::basicValidity(): duplicate vertex found" << endl;
+        return false;
     }
 
 
-    // test for dangling vertices that do not belong to any triangles
-    // build flag list corresponding to vertex list. Entry true if a vertex is dangling.
-    for(v = 0; v < (int) verts.size(); v++)
-        dangle.push_back(true);
-
-    // switch flags for vertices incident on an edge
-    for(t = 0; t < (int) tris.size(); t++)
-        for(p = 0; p < 3; p++)
-        {
-            if(tris[t].v[p] >= 0 && tris[t].v[p] < (int) verts.size()) // check for in range at the same time
-            {
-                dangle[tris[t].v[p]] = false;
-            }
-            else // vertex index out of bounds
-            {
-                cerr << "Error Mesh::basicValidity(): vertex index out of bounds" << endl;
-                return false; // early out
-            }
-        }
+    // test for vertex indices out of bounds
+    outside = parallel::reduce(0, (int) tris.size(), vertchunksize, 0, [this, numverts](int lo, int hi)
+    {
+        int count = 0;
+        for(int t = lo; t < hi; t++)
+            for(int p = 0; p < 3; p++)
+                count += (int) (tris[t].v[p] < 0 || tris[t].v[p] >= numverts);
+        return count;
+    }, std::plus<int>());
+    if(outside > 0)
+    {
+        cerr << "Error Mesh::basicValidity(): vertex index out of bounds" << endl;
+        return false; // early out
+    }
 
-    // check if any vertices are still flagged as dangling
-    for(v = 0; v < (int) verts.size(); v++)
-        if(dangle[v])
-        {
-            cerr << "Error Mesh::basicValidity(): dangling vertex found" << endl;
-            return false; // early out
-        }
+    // test for dangling vertices that do not belong to any triangles
+    buildTopology();
+    dangling = parallel::reduce(0, numverts, vertchunksize, 0, [this](int lo, int hi)
+    {
+        int count = 0;
+        for(int v = lo; v < hi; v++)
+            count += (int) (topo.degree(v) == 0);
+        return count;
+    }, std::plus<int>());
+    if(dangling > 0)
+    {
+        cerr << "Error Mesh::basicValidity(): " << dangling << " dangling vertices found" << endl;
+        return false; // early out
+    }
 
     return true;
 }
 
 bool Mesh::sameTriangle(Triangle t1, Triangle t2)
 {
-    std::vector<int> ind1, ind2;
-
     // a duplicate has the same set of vertices but they may be ordered differently
     // so sort vertex indices of both triangles and then compare index by index
-    for(int i = 0; i < 3; i++)
-    {
-        ind1.push_back(t1.v[i]);
-        ind2.push_back(t2.v[i]);
-    }
-    std::sort(ind1.begin(), ind1.end());
-    std::sort(ind2.begin(), ind2.end());
-    return (ind1 == ind2);
+    std::sort(t1.v, t1.v + 3);
+    std::sort(t2.v, t2.v + 3);
+    return t1.v[0] == t2.v[0] && t1.v[1] == t2.v[1] && t1.v[2] == t2.v[2];
 }
 
-bool Mesh::sameEdge(Edge e1, Edge e2, bool & opposite)
+bool Mesh::manifoldValidity()
 {
-    if(e1.v[0] == e2.v[0] && e1.v[1] == e2.v[1])
-    {
-        opposite = false;
-        return true;
-    }
-    if(e1.v[0] == e2.v[1] && e1.v[1] == e2.v[0])
-    {
-        opposite = true;
-        return true;
-    }
-    return false;
+    ManifoldReport report;
+
+    return manifoldValidity(report);
 }
 
-bool Mesh::manifoldValidity()
+bool Mesh::manifoldValidity(ManifoldReport &report)
 {
-    std::unordered_multimap<long, int> trilookup; // key is sum of vertex indices, needs a multimap because this is not unique
-    long key;
-    int i, j, k, t, v, e, erest, mcount, ocount;
-    std::vector<std::vector<int>> incident;
-    std::vector<int> incempty;
-    std::vector<Edge> edges;
-    std::vector<bool> visited;
-    bool opposite, fin, found;
-    Edge edge1, edge2;
+    vector<uint8_t> dupflag, pinchflag;
+    int numtris = (int) tris.size(), numverts = (int) verts.size();
 
-    /*
-     // inefficient search of triangle list for duplicates - O(n^2)
-     int t = 0, trest = 0;
-     bool found = false;
-     while(!found && t < (int) tris.size()-1)
-     {
-     // search remainder of list
-     trest = t+1;
-     while(!found && trest < (int) tris.size())
-     {
-     if(sameTriangle(tris[t], tris[trest]))
-     {
-     found = true;
-     }
-     trest++;
-     }
-     t++;
-     }
-     if(found)
-     {
-     cerr << "Error Mesh::manifoldValidity(): duplicate triangle found" << endl;
-     return false;
-     }
-     */
-
-    // search triangle list for duplicates
-    // usual trick for more efficient version using hash table but this time keys map to multiple values
-    for(i = 0; i < (int) tris.size(); i++)
+    report = ManifoldReport();
+    buildTopology();
+    dupflag.assign(numtris, 0);
+    pinchflag.assign(numverts, 0);
+
+    // a duplicate shares its lowest vertex with the triangle it repeats, so only that vertex's corners are searched
+    #pragma omp parallel for schedule(static, vertchunksize)
+    for(int t = 0; t < numtris; t++)
     {
-        key = (long) tris[i].v[0] + (long) tris[i].v[1] + (long) tris[i].v[2]; // use sum of vertex indices as the key, not unique but a good start
-        if(!(trilookup.find(key) == trilookup.end())) // key in map
-        {
-            // cerr << "possible dup" << endl;
-            // iterate over triangles with the same key to see if any are duplicates
-            auto range = trilookup.equal_range(key);
-            for(auto it = range.first; it != range.second; it++) // now check if each truly is a duplicate, by looking at all values with the same key
-            {
-                // cerr << tris[i].v[0] << " " << tris[i].v[1] << " " << tris[i].v[2] << " ?= " << tris[it->second].v[0] << " " << tris[it->second].v[1] << " " << tris[it->second].v[2] << endl;
-                if(sameTriangle(tris[i], tris[it->second]))
-                {
-                    cerr << "Error Mesh::manifoldValidity(): duplicate triangle found" << endl;
-                    return false; // early out - exits on first duplicate encountered
-                }
-            }
-        }
-        trilookup.emplace(key, i); // add triangle index to multimap
-    }
+        int lo = std::min(tris[t].v[0], std::min(tris[t].v[1], tris[t].v[2]));
 
-    // make sure every edge appears exactly twice in triangle list, with edges traversed in different directions
-    // build list of triangles incident on each vertex - single pass over tris list
-    for(v = 0; v < (int) verts.size(); v++)
-        incident.push_back(incempty);
-    for(t = 0; t < (int) tris.size(); t++)
-        for(i = 0; i < 3; i++)
-            incident[tris[t].v[i]].push_back(t);
+        if(lo < 0 || lo >= numverts)
+            continue; // reported as non-manifold through its twins
+        for(const int * c = topo.cornerBegin(lo); !dupflag[t] && c != topo.cornerEnd(lo); c++)
+            if((* c) / 3 < t && sameTriangle(tris[(* c) / 3], tris[t]))
+                dupflag[t] = 1;
+    }
 
-    // make sure edges match up around each vertex. Each edge is shared by two triangles with opposite directions - single pass over incident list
-    for(i = 0; i < (int) incident.size(); i++)
+    // every edge must already have exactly one oppositely wound partner, and stepping from partner to partner around
+    // each vertex must then visit all its corners in a single cycle, which also picks up surfaces touching at a vertex
+    #pragma omp parallel for schedule(static, vertchunksize)
+    for(int v = 0; v < numverts; v++)
     {
+        int start, c, steps = 0;
 
-        // note: this edge counting approach does not pick up cases where two surfaces touch at a single vertex
-        edges.clear();
-        // gather incident edges
-        for(j = 0; j < (int) incident[i].size(); j++)
+        if(topo.degree(v) == 0)
+            continue; // dangling vertices are reported by basicValidity
+        start = c = * topo.cornerBegin(v);
+        do
         {
-            t = (incident[i])[j]; // index of incident triangle
-            for(k = 0; k < 3; k++) // gather edges incident on vertex
-            {
-                if(tris[t].v[k] == i) // vertex for incidence, gather edge before and after
-                {
-                    edge1.v[0] = i; edge1.v[1] = tris[t].v[(k+1)%3]; // outgoing edge
-                    edges.push_back(edge1);
-
-                    // incoming edge
-                    edge2.v[0] = tris[t].v[(k+2)%3]; edge2.v[1] = i; // incoming edge
-                    edges.push_back(edge2);
-                }
-            }
+            c = topo.twin(topo.prev(c)); // the half-edge into v, reversed, leaves v in the next triangle of the fan
+            steps++;
         }
+        while(c >= 0 && c != start && steps <= topo.degree(v));
+        if(c != start || steps != topo.degree(v))
+            pinchflag[v] = 1;
+    }
 
-        // compare edges - O(n^2) but small n
-        for(e = 0; e < (int) edges.size(); e++)
-        {
-            mcount = 0; ocount = 0;
-            for(erest = 0; erest < (int) edges.size(); erest++)
-            {
-                if(e != erest)
-                    if(sameEdge(edges[e], edges[erest], opposite))
-                    {
-                        if(opposite)
-                            ocount++;
-                        else
-                            mcount++;
-                    }
-            }
-            if(ocount != 1 || mcount != 0) // only one matching edge wound oppositely
-            {
-                cerr << "Error Mesh::manifoldValidity(): edges do not have exactly two incident triangles correctly wound" << endl;
-                return false;
-            }
-        }
+    // gather failing triangles in order
+    for(int t = 0; t < numtris; t++)
+    {
+        bool bound = false, nonman = false, pinch = false;
 
-        // check for reachability - there should only be a single cycle around a vertex
-        // more efficient if this was combined with the previous loop but less readable
-        visited.clear(); visited.resize((int) incident[i].size(), false);
-        e = 0; visited[0] = true; fin = false;
-        while(!fin)
+        for(int p = 0; p < 3; p++)
         {
-            // find adjacent triangle to outgoing edge using incident edge table
-            found = false; erest = 0;
-            while(!found && erest < (int) edges.size())
-            {
-                if(e != erest)
-                    if(sameEdge(edges[e], edges[erest], opposite))
-                    {
-                        found = true;
-                        e = erest;
-
-                        // check if triangle is already visited
-                        if(visited[e/2])
-                            fin = true;
-                        else
-                            visited[e/2] = true;
-
-                        if(e % 2 == 0) // find outgoing edge, come in pairs
-                            e++;
-                        else
-                            e--;
-                    }
-                erest++;
-            }
-        }
+            int tw = topo.twin(3*t+p), v = tris[t].v[p];
 
-        for(j = 0; j < (int) incident[i].size(); j++)
-        {
-            if(!visited[j])
-            {
-                cerr << "Error Mesh::manifoldValidity(): vertices do note have a single cycle of incident triangles" << endl;
-                return false;
-            }
+            bound = bound || tw == topoboundary;
+            nonman = nonman || tw == topononmanifold;
+            pinch = pinch || (v >= 0 && v < numverts && pinchflag[v]);
         }
+        if(dupflag[t])
+            report.duplicate.push_back(t);
+        if(bound)
+            report.boundary.push_back(t);
+        if(nonman)
+            report.nonmanifold.push_back(t);
+        if(pinch)
+            report.openfan.push_back(t);
     }
 
+    if(!report.duplicate.empty())
+        cerr << "Error Mesh::manifoldValidity(): " << (int) report.duplicate.size() << " duplicate triangles found" << endl;
+    if(!report.boundary.empty())
+        cerr << "Error Mesh::manifoldValidity(): " << (int) report.boundary.size() << " triangles on a boundary edge" << endl;
+    if(!report.nonmanifold.empty())
+        cerr << "Error Mesh::manifoldValidity(): " << (int) report.nonmanifold.size() << " triangles on an edge without exactly two incident triangles correctly wound" << endl;
+    if(!report.openfan.empty())
+        cerr << "Error Mesh::manifoldValidity(): " << (int) report.openfan.size() << " triangles at vertices without a single cycle of incident triangles" << endl;
+
     // For true 2-manifold validity it would also be necessary to see if the object is self-intersecting by testing triangles against
     // each other for intersection. This would require a spatial data structure such as a bounding sphere hierarchy to accelerate properly
     // which is beyond the scope of this assignment
-    return true;
+    return report.valid();
 }
 
 void Mesh::validTetTest()
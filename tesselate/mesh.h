@@ -9,25 +9,44 @@
 
 #include <vector>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
 #include <iostream>
-#include "renderer.h"
+#include "shape.h"
 #include "ffd.h"
 #include "voxels.h"
+#include "voxstream.h"
+#include "distfield.h"
+#include "dexels.h"
+#include "bvh.h"
+#include "winding.h"
+#include "weld.h"
+#include "normalpalette.h"
+#include "meshbool.h"
+#include "topology.h"
+#include "smooth.h"
+#include "decimate.h"
+#include "vcache.h"
+#include "contenthash.h"
+#include "voxmesher.h"
+#include "snapshot.h"
+#include "meshcodec.h"
+#include "slicer.h"
+#include "common/serialize.h"
 #include <unordered_set>
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 
-const int sphperdim = 5;
-const bool sphereaccel = false; // controls whether or not the bounding sphere acceleration structure is used.
-                                // better set as <false> for any mesh with fewer than a hundred triangles.
-
 /**
- * A triangle in 3D space, with 3 indices into a vertex list and an outward facing normal. Triangle winding is counterclockwise.
+ * A triangle in 3D space, with 3 indices into a vertex list. Triangle winding is counterclockwise. The outward facing
+ * normal is held apart by the mesh, so that a list of triangles is a packed index array.
  */
 struct Triangle
 {
     int v[3];   ///< index into the vertex list for triangle vertices
-    cgp::Vector n;   ///< outward facing unit normal to the triangle
 
     bool vertexFound(int vertex)
     {
@@ -36,48 +55,75 @@ struct Triangle
         return false;
     }
 
-    void deriveNormal(vector<cgp::Vector> & normals, vector<cgp::Point> & vts)
+    /**
+     * Add the unit normal of the triangle to a set of distinct normals
+     * @param normals   normals found so far, to which this one is added unless an equal one is held
+     * @param vts       vertex positions
+     * @returns index of the normal in @a normals
+     */
+    int deriveNormal(NormalPalette & normals, vector<cgp::Point> & vts)
     {
-        ///< points (coordinates) at each triangle vertex
-        cgp::Point p1 = vts[v[0]];
-        cgp::Point p2 = vts[v[1]];
-        cgp::Point p3 = vts[v[2]];
-
-        ///< derive vectors
-        cgp::Vector a, b;
-        a.diff(p3, p2);
-        b.diff(p1, p2);
+        cgp::Vector a, b, normal;
 
-        ///< cross vectors -> derive normal
-        cgp::Vector normal;
-        normal.cross(a, b);
-
-        ///< invert normal
-        normal.mult(-1);
-
-        ///< normalize before comparing
+        a.diff(vts[v[2]], vts[v[1]]);
+        b.diff(vts[v[0]], vts[v[1]]);
+        normal.cross(b, a);
         normal.normalize();
-
-        ///< add to normals, if not in already
-        bool found = false;
-        for (int i = 0; i < normals.size(); ++i) {
-            if (normals[i] == normal)
-            {
-                found = true;
-                break;
-            }
-        }
-
-        if (!found)
-        {
-            normals.push_back(normal);
-         }
+        return normals.insert(normal);
     }
 
     void printVec()
     {
         cerr << "(" << v[0] << "," << v[1] << "," << v[2] << ")" << endl;
     }
+
+    /// Boost serialization
+    template<class Archive> void serialize(Archive & ar, const unsigned int version)
+    {
+        ar & boost::serialization::make_array(v, 3);
+    }
+};
+
+static_assert(sizeof(Triangle) == 3 * sizeof(int), "triangle lists are read as packed index arrays");
+
+BOOST_IS_BITWISE_SERIALIZABLE(Triangle)
+BOOST_CLASS_IMPLEMENTATION(Triangle, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(Triangle, boost::serialization::track_never)
+
+/**
+ * Per element vectors held as separate x, y and z float arrays, so that loops over many elements read only packed
+ * components and can be vectorised. Individual elements are still available as cgp::Vector values.
+ */
+struct CoordArrays
+{
+    std::vector<float> x, y, z;     ///< components of each element
+
+    /// Number of elements
+    size_t size() const { return x.size(); }
+
+    /// Change the number of elements, keeping the leading ones
+    void resize(size_t n){ x.resize(n); y.resize(n); z.resize(n); }
+
+    /// Remove all elements
+    void clear(){ x.clear(); y.clear(); z.clear(); }
+
+    /// Bytes reserved by the arrays
+    size_t capacityBytes() const { return (x.capacity() + y.capacity() + z.capacity()) * sizeof(float); }
+
+    /// Element i as a vector
+    cgp::Vector get(int i) const { return cgp::Vector(x[i], y[i], z[i]); }
+
+    /// Replace element i
+    void set(int i, const cgp::Vector &v){ x[i] = v.i; y[i] = v.j; z[i] = v.k; }
+
+    /// Add an element at the end
+    void push_back(const cgp::Vector &v){ x.push_back(v.i); y.push_back(v.j); z.push_back(v.k); }
+
+    /**
+     * Reorder the elements
+     * @param order     old index of the element placed at each new index
+     */
+    void gather(const std::vector<int> &order);
 };
 
 /**
@@ -88,16 +134,107 @@ struct Edge
     int v[2];   ///< indices into the vertex list for edge endpoints
 };
 
+/**
+ * Triangles that fail the two-manifold tests, by cause. A triangle can appear under more than one cause,
+ * and each list is in increasing triangle order.
+ */
+struct ManifoldReport
+{
+    std::vector<int> duplicate;     ///< triangles with the same vertices as an earlier triangle
+    std::vector<int> boundary;      ///< triangles with an edge that no other triangle shares
+    std::vector<int> nonmanifold;   ///< triangles with an edge shared by more than two triangles or by two wound the same way
+    std::vector<int> openfan;       ///< triangles at a vertex whose incident triangles do not form a single closed cycle
+
+    /// Did every triangle pass?
+    bool valid() const { return duplicate.empty() && boundary.empty() && nonmanifold.empty() && openfan.empty(); }
+};
+
+const int meshlodlevels = 3;        ///< reduced display levels of detail kept below the full resolution mesh
+const int meshlodreduction = 4;     ///< ratio of triangle counts between successive levels of detail
+const float scanmergetol = 1.0e-5f; ///< crossings of a scan ray closer than this are treated as a single crossing of a shared edge or vertex
+const int defaultraysamples = 1;    ///< rays cast per containment query unless set otherwise
+const int maxraysamples = 64;       ///< size of the fixed table of containment ray directions
+const int vertchunksize = 4096;     ///< vertices per parallel chunk when smoothing, deriving normals and transforming
+
+/**
+ * Reduced resolution copy of a mesh, used in place of the full mesh for display when it covers few pixels
+ */
+struct MeshLOD
+{
+    std::vector<cgp::Point> verts;  ///< world-space vertex positions
+    std::vector<cgp::Vector> norms; ///< world-space vertex normals
+    std::vector<int> faces;         ///< vertex indices, 3 per triangle
+    ShapeGeometry geometry;         ///< renderable version of this level
+    bool bound;                     ///< geometry holds the current vertices and faces
+};
+
+const char meshfilemagic[4] = {'T', 'M', 'S', 'H'}; ///< identifies a binary indexed mesh file
+const int meshfileversion = 1;                      ///< current binary indexed mesh file layout
+
+/**
+ * Fixed size header at the start of a binary indexed mesh file. It is followed by the vertex positions
+ * (3 floats each), the vertex normals if present (3 floats each), the triangle vertex indices (3 int32 each)
+ * and the triangle normals (3 floats each). Padded to 64 bytes so that the mapped arrays are well aligned.
+ */
+struct MeshFileHeader
+{
+    char magic[4];          ///< always meshfilemagic
+    int32_t version;        ///< layout version, currently meshfileversion
+    int32_t numverts;       ///< number of vertices
+    int32_t numtris;        ///< number of triangles
+    int32_t hasnorms;       ///< 1 if per vertex normals follow the positions, 0 otherwise
+    int32_t pad[11];        ///< reserved, zero
+};
+
+/**
+ * Validity flag and lock for a lazily built acceleration structure. Copies start out invalid so that
+ * each copy of a shape rebuilds its own structure, which keeps shapes copyable despite the lock.
+ */
+struct AccelState
+{
+    std::atomic<bool> valid;    ///< is the structure consistent with the shape it accelerates?
+    std::mutex build;           ///< serialises construction by concurrent queries
+
+    AccelState() : valid(false) {}
+    AccelState(const AccelState &) : valid(false) {}
+    AccelState & operator=(const AccelState &){ valid = false; return *this; }
+};
+
+/**
+ * Concrete type of a BaseShape
+ */
+enum class ShapeKind
+{
+    SPHERE,     ///< Sphere
+    CYLINDER,   ///< Cylinder
+    SQUARE,     ///< Square
+    MESH,       ///< Mesh
+    INSTANCE,   ///< MeshInstance
+    SUBTREE,    ///< SubtreeInstance
+};
+
 /**
  * Abstract base class for shapes
  */
 class BaseShape
 {
+protected:
+    ShapeKind kind;     ///< concrete type of the shape
+
 public:
 
+    /**
+     * Constructor
+     * @param type  concrete type of the inheriting class
+     */
+    BaseShape(ShapeKind type){ kind = type; }
+
     /// virtual destructor
     virtual ~BaseShape(){}
 
+    /// Concrete type of the shape, so that evaluators can specialise on it without dynamic_cast
+    ShapeKind getKind() const { return kind; }
+
     /**
      * Generate geometry for OpenGL rendering
      * @param[out] geom triangle-mesh geometry packed for OpenGL
@@ -112,20 +249,88 @@ public:
      * @retval false otherwise
      */
     virtual bool pointContainment(cgp::Point pnt)=0;
+
+    /**
+     * Test a batch of points for containment, amortising dispatch and per-query setup over the batch.
+     * The default applies pointContainment to each point in turn.
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the shape, 0 otherwise
+     */
+    virtual void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /**
+     * Signed distance from a point to the surface of the shape, negative inside, for building distance fields.
+     * Must agree in sign with pointContainment.
+     * @param pnt   point to measure
+     * @param band  distance from the surface beyond which only the sign matters, so searches can stop early
+     * @returns signed distance, exact within band of the surface and at least band in magnitude elsewhere
+     */
+    virtual float signedDistance(cgp::Point pnt, float band)=0;
+
+    /**
+     * Unsigned distance from a point to the surface of the shape, for callers that find the sign another way,
+     * such as scanRow. The default takes the magnitude of signedDistance.
+     * @param pnt   point to measure
+     * @param band  distance from the surface beyond which the search may stop
+     * @returns distance, exact within band of the surface and at least band elsewhere
+     */
+    virtual float surfaceDistance(cgp::Point pnt, float band){ return fabsf(signedDistance(pnt, band)); }
+
+    /// Can scanRow find the inside of a whole voxel row at once? False unless overridden.
+    virtual bool scansRows(){ return false; }
+
+    /**
+     * Find the occupied spans of a single voxel row at once, for shapes where scansRows holds. The bounds must
+     * already have been found with getBounds, after which rows can be scanned concurrently.
+     * @param vox       voxel volume supplying the row positions
+     * @param bbox      bounds of the shape
+     * @param y, z      row to scan
+     * @param[out] spans pairs of first and one past last occupied voxel, unclamped and in increasing order
+     */
+    virtual void scanRow(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, std::vector<int> &spans){ spans.clear(); }
+
+    /**
+     * Find the occupied spans of consecutive voxel rows of one layer, as for scanRow, which shapes that can cast
+     * the rays together override. The default scans the rows one at a time.
+     * @param vox       voxel volume supplying the row positions
+     * @param bbox      bounds of the shape
+     * @param y         first row to scan
+     * @param z         layer of the rows
+     * @param n         number of rows
+     * @param[out] spans n lists of spans, one for each row from y on, as for scanRow
+     */
+    virtual void scanRows(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, int n, std::vector<int> * spans)
+    {
+        for(int r = 0; r < n; r++)
+            scanRow(vox, bbox, y + r, z, spans[r]);
+    }
+
+    /**
+     * Find a world-space axis-aligned box enclosing every point for which pointContainment succeeds
+     * @param[out] bbox  enclosing box, reset to empty if the shape has no interior
+     */
+    virtual void getBounds(cgp::BoundBox &bbox)=0;
+
+    /**
+     * Add everything that affects containment (shape type, parameters and transform) to a hash, for keying cached results
+     * @param hash  hash being accumulated
+     */
+    virtual void hashContent(ContentHash &hash)=0;
 };
 
 /**
- * A sphere in 3D space, consisting of a center and radius. Used for bounding sphere hierarchy acceleration.
+ * A sphere in 3D space, consisting of a center and radius.
  */
 class Sphere: public BaseShape
 {
 public:
     cgp::Point c;  ///< sphere center
     float r;       ///< sphere radius
-    std::vector<int> ind; ///< triangle vertex indices included in the bounding sphere. Used for acceleration struct, otherwise ignored
 
     /// Default Constructor
     Sphere()
+        : BaseShape(ShapeKind::SPHERE)
     {
         c = cgp::Point(0.0f, 0.0f, 0.0f);
         r = 0.0f;
@@ -137,11 +342,19 @@ public:
      * @param radius    sphere radius
      */
     Sphere(cgp::Point center, float radius)
+        : BaseShape(ShapeKind::SPHERE)
     {
         c = center;
         r = radius;
     }
 
+    /// Boost serialization
+    template<class Archive> void serialize(Archive & ar, const unsigned int version)
+    {
+        ar & c;
+        ar & r;
+    }
+
    /**
      * Generate sphere geometry for OpenGL rendering
      * @param[out] geom triangle-mesh geometry packed for OpenGL
@@ -157,6 +370,65 @@ public:
      */
     bool pointContainment(cgp::Point pnt);
 
+    /**
+     * Test a batch of points for containment in a single branch-free loop
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the sphere, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /// Containment test with its setup hoisted, for inlining into evaluators that specialise on the shape type
+    struct Inside
+    {
+        float cx, cy, cz, rsq;  ///< center and squared radius
+
+        /// Set up the test for a sphere
+        Inside(const Sphere &sphere)
+            : cx(sphere.c.x), cy(sphere.c.y), cz(sphere.c.z), rsq(sphere.r * sphere.r) {}
+
+        /// Test whether the point (x, y, z) is inside, as for containment
+        bool operator()(float x, float y, float z) const
+        {
+            float dx = x - cx, dy = y - cy, dz = z - cz;
+            return dx*dx + dy*dy + dz*dz < rsq;
+        }
+
+        /**
+         * Bound the points of a row along x that can be inside, widened to allow for rounding in the test
+         * @param y, z          row to bound
+         * @param[out] xmin, xmax   world x range outside of which no point of the row is inside
+         * @retval true if the row may pass through the sphere,
+         * @retval false if it misses
+         */
+        bool rowSpan(float y, float z, float &xmin, float &xmax) const
+        {
+            double dy = y - cy, dz = z - cz, tol = 1.0e-5 * rsq, q = (double) rsq - dy*dy - dz*dz;
+
+            if(q < -tol)
+                return false;
+            q = sqrt(std::max(q, 0.0) + tol);
+            xmin = (float) (cx - q); xmax = (float) (cx + q);
+            return true;
+        }
+    };
+
+    /**
+     * Exact signed distance to the sphere
+     * @param pnt   point to measure
+     * @param band  unused, since the distance is analytic
+     * @returns signed distance, negative inside
+     */
+    float signedDistance(cgp::Point pnt, float band);
+
+    /**
+     * Find the world-space bounds of the sphere
+     * @param[out] bbox  enclosing box
+     */
+    void getBounds(cgp::BoundBox &bbox);
+
+    /// Add the center and radius to a hash
+    void hashContent(ContentHash &hash);
 };
 
 /**
@@ -170,6 +442,7 @@ public:
 
     /// Default Constructor
     Cylinder()
+        : BaseShape(ShapeKind::CYLINDER)
     {
         s = cgp::Point(0.0f, 0.0f, 0.0f);
         e = s;
@@ -183,12 +456,21 @@ public:
      * @param radius    cylinder radius
      */
     Cylinder(cgp::Point start, cgp::Point end, float radius)
+        : BaseShape(ShapeKind::CYLINDER)
     {
         s = start;
         e = end;
         r = radius;
     }
 
+    /// Boost serialization
+    template<class Archive> void serialize(Archive & ar, const unsigned int version)
+    {
+        ar & s;
+        ar & e;
+        ar & r;
+    }
+
    /**
      * Generate cylinder geometry for OpenGL rendering
      * @param[out] geom triangle-mesh geometry packed for OpenGL
@@ -203,6 +485,104 @@ public:
      * @retval false otherwise
      */
     bool pointContainment(cgp::Point pnt);
+
+    /**
+     * Test a batch of points for containment in a single branch-free loop, with the spine set up once
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the cylinder, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /// Containment test with the spine set up once, for inlining into evaluators that specialise on the shape type
+    struct Inside
+    {
+        float sx, sy, sz;       ///< start of the spine
+        float di, dj, dk;       ///< spine from start to end
+        float den;              ///< squared spine length, zero for a degenerate spine which contains nothing
+        float r;                ///< radius
+
+        /// Set up the test for a cylinder
+        Inside(const Cylinder &cyl)
+        {
+            cgp::Vector dirvec;
+
+            dirvec.diff(cyl.s, cyl.e);
+            sx = cyl.s.x; sy = cyl.s.y; sz = cyl.s.z;
+            di = dirvec.i; dj = dirvec.j; dk = dirvec.k;
+            den = dirvec.sqrdlength();
+            r = cyl.r;
+        }
+
+        /// Test whether the point (x, y, z) is inside, as for containment
+        bool operator()(float x, float y, float z) const
+        {
+            float tval = (di * (x - sx) + dj * (y - sy) + dk * (z - sz)) / den;
+            float dx = x - (sx + di * tval), dy = y - (sy + dj * tval), dz = z - (sz + dk * tval);
+            return den != 0.0f && tval >= 0.0f && tval <= 1.0f && sqrtf(dx*dx + dy*dy + dz*dz) <= r;
+        }
+
+        /**
+         * Bound the points of a row along x that can be inside, from where the row lies between the caps and within
+         * the radius of the spine, widened to allow for rounding in the test
+         * @param y, z          row to bound
+         * @param[out] xmin, xmax   world x range outside of which no point of the row is inside
+         * @retval true if the row may pass through the cylinder,
+         * @retval false if it misses
+         */
+        bool rowSpan(float y, float z, float &xmin, float &xmax) const
+        {
+            // with u = x - sx the spine parameter is (di u + e) / den and the squared distance from the spine is
+            // a u^2 + b u + c, so both conditions bound u to an interval
+            double ey = y - sy, ez = z - sz, e = dj * ey + dk * ez, dd = den, len = sqrt(dd);
+            double tol = 1.0e-5 * (len + r + fabs(sx) + fabs(sy) + fabs(sz) + fabs(y) + fabs(z));
+            double lo = -1.0e30, hi = 1.0e30, a, b, c, disc, root;
+
+            if(den == 0.0f)
+                return false;
+            if(fabs(di) > 1.0e-6 * len) // caps, with the spine parameter allowed tol / len either side
+            {
+                lo = (-e - tol * len) / di; hi = (dd + tol * len - e) / di;
+                if(lo > hi)
+                    std::swap(lo, hi);
+            }
+            else if(e < -tol * len || e > dd + tol * len)
+                return false;
+            a = 1.0 - di * (double) di / dd;
+            if(a > 1.0e-6) // radius, unless the spine runs nearly along x, where the caps bound the row instead
+            {
+                b = -2.0 * di * e / dd;
+                c = ey * ey + ez * ez - e * e / dd - ((double) r + tol) * ((double) r + tol);
+                disc = b * b - 4.0 * a * c;
+                if(disc < 0.0)
+                    return false;
+                root = sqrt(std::max(disc, 0.0));
+                lo = std::max(lo, (-b - root) / (2.0 * a));
+                hi = std::min(hi, (-b + root) / (2.0 * a));
+            }
+            if(lo > hi)
+                return false;
+            xmin = (float) (sx + lo - tol); xmax = (float) (sx + hi + tol);
+            return true;
+        }
+    };
+
+    /**
+     * Exact signed distance to the capped cylinder
+     * @param pnt   point to measure
+     * @param band  unused, since the distance is analytic
+     * @returns signed distance, negative inside
+     */
+    float signedDistance(cgp::Point pnt, float band);
+
+    /**
+     * Find the world-space bounds of the cylinder, which are tight for any orientation of its spine
+     * @param[out] bbox  enclosing box
+     */
+    void getBounds(cgp::BoundBox &bbox);
+
+    /// Add the spine and radius to a hash
+    void hashContent(ContentHash &hash);
 };
 
 /**
@@ -216,6 +596,7 @@ public:
 
     /// Default Constructor
     Square()
+        : BaseShape(ShapeKind::SQUARE)
     {
         c = cgp::Point(0.0f, 0.0f, 0.0f);
         l = 1.0f;
@@ -227,11 +608,19 @@ public:
      * @param radius    square length
      */
     Square(cgp::Point start, float length)
+        : BaseShape(ShapeKind::SQUARE)
     {
         c = start;
         l = length;
     }
 
+    /// Boost serialization
+    template<class Archive> void serialize(Archive & ar, const unsigned int version)
+    {
+        ar & c;
+        ar & l;
+    }
+
    /**
      * Generate square geometry for OpenGL rendering
      * @param[out] geom triangle-mesh geometry packed for OpenGL
@@ -246,6 +635,136 @@ public:
      * @retval false otherwise
      */
     bool pointContainment(cgp::Point pnt);
+
+    /**
+     * Test a batch of points for containment in a single branch-free loop
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the square, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /// Containment test with its setup hoisted, for inlining into evaluators that specialise on the shape type
+    struct Inside
+    {
+        float cx, cy, cz, lcube;    ///< center and cubed length, the squared radius of the accepted ball
+
+        /// Set up the test for a square
+        Inside(const Square &square)
+            : cx(square.c.x), cy(square.c.y), cz(square.c.z), lcube(square.l * square.l * square.l) {}
+
+        /// Test whether the point (x, y, z) is inside, as for containment
+        bool operator()(float x, float y, float z) const
+        {
+            float dx = x - cx, dy = y - cy, dz = z - cz;
+            return dx*dx + dy*dy + dz*dz < lcube;
+        }
+
+        /// Bound the points of a row along x that can be inside, as for Sphere::Inside::rowSpan
+        bool rowSpan(float y, float z, float &xmin, float &xmax) const
+        {
+            double dy = y - cy, dz = z - cz, tol = 1.0e-5 * lcube, q = (double) lcube - dy*dy - dz*dz;
+
+            if(q < -tol)
+                return false;
+            q = sqrt(std::max(q, 0.0) + tol);
+            xmin = (float) (cx - q); xmax = (float) (cx + q);
+            return true;
+        }
+    };
+
+    /**
+     * Exact signed distance to the region accepted by pointContainment, which is a ball of radius sqrt(l^3)
+     * @param pnt   point to measure
+     * @param band  unused, since the distance is analytic
+     * @returns signed distance, negative inside
+     */
+    float signedDistance(cgp::Point pnt, float band);
+
+    /**
+     * Find the world-space bounds of the region accepted by pointContainment
+     * @param[out] bbox  enclosing box
+     */
+    void getBounds(cgp::BoundBox &bbox);
+
+    /// Add the center and length to a hash
+    void hashContent(ContentHash &hash);
+};
+
+/**
+ * Query used to decide whether a point lies inside a mesh
+ */
+enum class MeshContainment
+{
+    PARITY,     ///< count ray crossings, exact for closed manifold meshes
+    WINDING,    ///< threshold the generalized winding number, robust to holes and triangle soups
+};
+
+/**
+ * Direction of the i-th containment ray. Rays follow a fixed low-discrepancy (R2) sequence over the sphere, none of
+ * them along an axis, where rays through axis-aligned meshes graze their edges and vertices. Any prefix of the table
+ * is well spread and every query with the same sample count uses the same rays, independent of thread or call order.
+ * @param i     sample index, less than maxraysamples
+ * @returns unit ray direction
+ */
+cgp::Vector containmentDir(int i);
+
+/**
+ * Count the surface crossings of a containment ray. A ray through a shared edge or vertex hits every incident
+ * triangle, so hits at the same distance that agree on entering or leaving count once, as in scanRow.
+ * @param accel     hierarchy over the triangles, in the space of the ray
+ * @param pnt       ray origin
+ * @param dir       ray direction
+ * @param hits      scratch buffer for the raw hits
+ * @returns number of distinct crossings in front of the origin
+ */
+int rayCrossings(const BVH &accel, cgp::Point pnt, cgp::Vector dir, std::vector<BVHHit> &hits);
+
+/**
+ * Convert the crossings of a ray along a voxel row into occupied spans, as for Mesh::scanRow
+ * @param hits      crossings of the ray, sorted in place by parameter
+ * @param ox        x at which the ray starts
+ * @param xstart    x of the centre of the first voxel of the row
+ * @param xstep     distance between voxel centres along x
+ * @param[out] spans pairs of first and one past last occupied voxel, in increasing order
+ */
+void crossingSpans(std::vector<BVHHit> &hits, float ox, float xstart, float xstep, std::vector<int> &spans);
+
+/**
+ * Partial marching cubes result for a slab of cell layers. Each slab owns the vertices on lattice edges
+ * that start in its node planes, except for the top plane, whose x and y edges belong to the slab above.
+ */
+struct MCSlab
+{
+    std::vector<cgp::Point> verts;                  ///< vertices owned by the slab
+    std::vector<int> faces;                         ///< triangle corners, slab-local vertex index or -(k+1) for foreign edge k
+    std::vector<int> foreign;                       ///< planar edge keys on the top plane, owned by the slab above
+    std::vector<std::pair<int, int>> bottom;        ///< planar edge key and local vertex index for edges on the bottom plane
+};
+
+/**
+ * Where a ray first meets the surface of a mesh, as found by Mesh::pickRay
+ */
+struct MeshPick
+{
+    int tri;            ///< index of the triangle hit
+    float bary[3];      ///< barycentric weights of the three triangle vertices at the hit
+    float dist;         ///< distance along the ray from its start to the hit
+    cgp::Point pnt;     ///< world-space position of the hit
+};
+
+/**
+ * Immutable copy of the vertices, normals and triangles of a mesh, along with its undistorted base, taken by
+ * Mesh::takeSnapshot. A snapshot after smoothing or deformation shares the unchanged triangles with its predecessor,
+ * and a base equal to the vertices is held once.
+ */
+struct MeshSnapshot
+{
+    SnapshotArray<cgp::Point> verts;        ///< vertices
+    SnapshotArray<cgp::Vector> norms;       ///< per vertex normals
+    SnapshotArray<Triangle> tris;           ///< triangles
+    SnapshotArray<cgp::Point> base;         ///< undistorted vertices prior to deformation
+    SnapshotArray<cgp::Vector> basenorms;   ///< per vertex normals of the undistorted vertices
 };
 
 /**
@@ -256,13 +775,43 @@ class Mesh: public BaseShape
 private:
     std::vector<cgp::Point> verts; ///< vertices of the tesselation structure
     std::vector<cgp::Point> base; ///< undistorted vertices prior to deformation
+    std::vector<cgp::Vector> basenorms; ///< per vertex normals of the undistorted vertices
     std::vector<cgp::Vector> norms;  ///< per vertex normals
     std::vector<Triangle> tris; ///< triangles that join to make up the mesh
+    CoordArrays fnorms;         ///< outward facing unit normal of each triangle, when derived or read alongside the triangles
     GLfloat * col;              ///< (r,g,b,a) colour
     float scale;                ///< scaling factor
     cgp::Vector trx;                 ///< translation
     float xrot, yrot, zrot;     ///< rotation angles about x, y, and z axes
-    std::vector<Sphere> boundspheres; ///< bounding sphere accel structure
+    BVH accel;                  ///< world-space bounding volume hierarchy over triangles, built lazily for containment queries
+    AccelState accelstate;      ///< tracks whether accel matches the current vertices, triangles and transform
+    std::vector<cgp::Point> wverts;  ///< world-space vertex positions, shared by rendering and hierarchy construction
+    std::vector<cgp::Vector> wnorms; ///< world-space vertex normals, matching wverts
+    AccelState worldstate;      ///< tracks whether wverts and wnorms match the current vertices, normals and transform
+    int numraysamples;          ///< rays cast per containment query, with the majority deciding
+    MeshContainment containmode;    ///< query used by pointContainment
+    WindingTree winding;        ///< world-space winding number hierarchy, built with accel in WINDING mode
+    MeshTopology topo;          ///< vertex adjacency and half-edge twins, built lazily from the triangles
+    AccelState topostate;       ///< tracks whether topo matches the current triangles and vertex count
+    MeshSmoother smoother;      ///< smoothing engine, keeping its working buffers between calls
+    std::vector<uint8_t> facemark;  ///< scratch flags for triangles touched by a local normal update, all zero between updates
+    std::vector<uint8_t> vertmark;  ///< scratch flags for vertices touched by a local normal update, all zero between updates
+    ffdEmbedding embedding;     ///< lattice weights of the base vertices, for repeated deformation by the same lattice
+    ShapeGeometry basegeometry; ///< renderable version of the undistorted base, warped by the lattice in the vertex shader
+    bool basebound;             ///< basegeometry buffers hold the current base and triangles
+    bool geombound;             ///< geometry holds the current triangles, so only vertex data needs refreshing
+    MeshDecimator decimator;    ///< simplification engine, keeping its working buffers between calls
+    MeshLOD lods[meshlodlevels];    ///< successively coarser display levels, built lazily from the world-space mesh
+    AccelState lodstate;        ///< tracks whether lods match the current world-space vertices and triangles
+    VertexCacheOptimiser cacheopt;  ///< triangle and vertex reordering engine, keeping its working buffers between calls
+    bool cacheorder;            ///< reorder triangles and vertices for the vertex cache before rendering or export
+    bool cacheordered;          ///< the current triangles and vertices are already in cache order
+    MeshCodec codec;            ///< compressed format engine, keeping its working buffers between calls
+    std::vector<MCSlab> mcslabs;    ///< slabs from the last marching cubes extraction, so that an update can redo only some of them
+    int mcdim[3];               ///< dimensions of the volume mcslabs were extracted from
+    cgp::Point mcorigin;        ///< first voxel centre of the volume mcslabs were extracted from
+    cgp::Vector mcdiag;         ///< diagonal of the volume mcslabs were extracted from
+    stats::MemoryTally memtally;    ///< bytes of the vertex, normal and triangle arrays and their world and base copies
 
     /**
      * Search list of vertices to find matching point
@@ -273,14 +822,6 @@ private:
      */
     bool findVert(cgp::Point pnt, int &idx);
 
-    /**
-     * Construct a hash key based on a 3D point
-     * @param pnt   point to convert to key
-     * @param bbox  bounding box enclosing all mesh vertices
-     * @retval hash key
-     */
-    long hashVert(cgp::Point pnt, cgp::BoundBox bbox);
-
     /**
      * Construct a hash key based on the indices of an edge
      * @param v0    first endpoint index
@@ -289,15 +830,72 @@ private:
      */
     long hashEdge(int v0, int v1);
 
-    /// Connect triangles together by merging duplicate vertices
+    /**
+     * Parse an ASCII STL file held in memory into a triangle soup
+     * @param buffer    file contents, starting with "solid"
+     * @param size      number of characters in the buffer
+     * @retval true  if the contents are well formed,
+     * @retval false otherwise.
+     */
+    bool parseAsciiSTL(const char * buffer, size_t size);
+
+    /// Connect triangles together by merging vertices that lie within the weld distance of each other
     void mergeVerts();
 
-    /// Generate vertex normals by averaging normals of the surrounding faces
+    /**
+     * Weld the vertices of merged parts that lie inside the bounding box of another part, leaving the rest alone
+     * @param boxes     bounding box of each part
+     * @param start     first vertex of each part, followed by the number of vertices
+     */
+    void weldSeams(std::vector<cgp::BoundBox> &boxes, const std::vector<int> &start);
+
+    /**
+     * Distance within which vertices are treated as duplicates
+     * @param bbox  bounding box enclosing all mesh vertices
+     * @returns weld distance, a fixed fraction of the bounding box diagonal
+     */
+    float weldDistance(cgp::BoundBox &bbox);
+
+    /**
+     * Bounding box of the model-space vertices, reduced over parallel chunks
+     * @param[out] bbox  enclosing box, empty if there are no vertices
+     */
+    void vertexBounds(cgp::BoundBox &bbox);
+
+    /// Generate vertex normals by area weighted averaging of the normals of the surrounding faces
     void deriveVertNorms();
 
     /// Generate face normals from triangle vertex positions
     void deriveFaceNorms();
 
+    /// Generate face and vertex normals together, in a single parallel region
+    void deriveNorms();
+
+    /**
+     * Check face normals read from a file against the winding of their triangles, keeping those that agree and
+     * replacing missing, malformed or contradicting ones with normals derived from the vertex positions
+     * @returns number of normals replaced
+     */
+    int validateFaceNorms();
+
+    /// Generate face normals if there is not one for every triangle, as after the triangles are replaced
+    void ensureFaceNorms(){ if(fnorms.size() != tris.size()) deriveFaceNorms(); }
+
+    /// Generate the normal of triangle t from its vertex positions
+    void deriveFaceNorm(int t);
+
+    /// Generate the normal of vertex v from the area weighted normals of its incident faces, which requires an up
+    /// to date topology but not the face normals
+    void deriveVertNorm(int v);
+
+    /**
+     * Refresh normals after some vertices have moved. Only the faces incident on a moved vertex and the vertices of
+     * those faces are recomputed, so the cost follows the size of the edited region, unless most of the mesh moved
+     * or the normals are missing, in which case everything is rederived.
+     * @param moved     indices of the vertices whose positions changed
+     */
+    void updateNorms(const std::vector<int> &moved);
+
     /**
      * Composite rotations, translation and scaling into a single transformation matrix
      * @param tfm   composited transformation matrix
@@ -314,20 +912,58 @@ private:
     bool sameTriangle(Triangle t1, Triangle t2);
 
     /**
-     * Compare two Edges to see if they index the same vertices
-     * @param e1    first edge
-     * @param e2    second edge
-     * @param[out] opposite true if the edges traverse in opposite directions
-     * @return true if the edges index the same vertices
-     * @return false otherwise
+     * Smooth the vertices over the shared topology, then refresh normals and the undeformed base copy
+     * @param mode      smoothing filter
+     * @param iter      number of iterations
+     * @param rate      proportion of the full step, or the shrinking factor for Taubin smoothing
+     * @param passband  Taubin pass-band frequency
      */
-    bool sameEdge(Edge e1, Edge e2, bool & opposite);
+    void applySmoothing(SmoothMode mode, int iter, float rate, float passband);
+
+    /// Make the current vertices and normals the undistorted base copy for deformation, discarding any cached lattice weights and base buffers
+    void setBase(){ base = verts; basenorms = norms; embedding.clear(); basebound = false; accountMemory(); }
+
+    /// Count the capacity of the per-vertex and per-triangle arrays towards the Mesh memory total
+    void accountMemory();
+
+    /// Build the bounding volume hierarchy over the transformed triangles, if it is out of date. Thread-safe.
+    void buildAccel();
 
     /**
-     * Create bounding sphere acceleration structure for mesh
-     * @param maxspheres    the number of spheres placed along the longest side of the bounding volume
+     * Marching cubes over any volume that supplies row codes and edge crossings in the manner of VoxelVolume
+     * @param vol       voxel volume or distance field
+     * @param zlo, zhi  inclusive range of voxel layers that have changed since the last extraction, outside of
+     *                  which the slabs kept from it are reused if the volume dimensions and frame still match
      */
-    void buildSphereAccel(int maxspheres);
+    template <typename Volume> void extractIsosurface(Volume * vol, int zlo, int zhi);
+
+    /**
+     * Dual extraction over a voxel volume or distance field, with vertices placed by the dualVertex overload for
+     * the volume type
+     * @param vol       voxel volume or distance field
+     */
+    template <typename Volume> void extractDual(Volume * vol);
+
+    /// Transform vertices and normals into world space, if they are out of date. Thread-safe.
+    void buildWorld();
+
+    /// Build the display levels of detail by decimating each level from the one above, if they are out of date. Thread-safe.
+    void buildLOD();
+
+    /// Mark the world-space vertices, levels of detail and the bounding volume hierarchy as out of date, so that they are rebuilt on the next query
+    void invalidateAccel(){ worldstate.valid = false; accelstate.valid = false; lodstate.valid = false; }
+
+    /// Derive connectivity from the triangles, if it is out of date. Thread-safe.
+    void buildTopology();
+
+    /// Mark the connectivity as out of date as well as the world-space structures and render buffers, after a change to the triangles or vertex count
+    void invalidateTopology(){ topostate.valid = false; basebound = false; geombound = false; cacheordered = false; invalidateAccel(); }
+
+    /**
+     * Put the triangles and vertices into cache order, if enabled and not already done. Every per vertex array,
+     * including the undistorted base, is permuted alike, so the mesh and any deformation of it are unchanged.
+     */
+    void applyCacheOrder();
 
 public:
 
@@ -346,19 +982,19 @@ public:
     bool empty(){ return verts.empty(); }
 
     /// Setter for scale
-    void setScale(float scf){ scale = scf; }
+    void setScale(float scf){ scale = scf; invalidateAccel(); }
 
     /// Getter for scale
     float getScale(){ return scale; }
 
     /// Setter for translation
-    void setTranslation(cgp::Vector tvec){ trx = tvec; }
+    void setTranslation(cgp::Vector tvec){ trx = tvec; invalidateAccel(); }
 
     /// Getter for translation
     cgp::Vector getTranslation(){ return trx; }
 
     /// Setter for rotation angles
-    void setRotations(float ax, float ay, float az){ xrot = ax; yrot = ay; zrot = az; }
+    void setRotations(float ax, float ay, float az){ xrot = ax; yrot = ay; zrot = az; invalidateAccel(); }
 
     /// Getter for rotation angles
     void getRotations(float &ax, float &ay, float &az){ ax = xrot; ay = yrot; az = zrot; }
@@ -371,18 +1007,76 @@ public:
 
     void mergeAllVerts() { mergeVerts(); }
 
-    /// Getter for vertices
-    vector<cgp::Point>* getVerts() { return &verts; }
+    /// Getter for vertices. Callers may edit or resize them, so the acceleration structure and connectivity are invalidated.
+    vector<cgp::Point>* getVerts() { invalidateTopology(); return &verts; }
 
     /// Getter for number of faces
     int getNumFaces(){ return (int) tris.size(); }
 
-    /// Merge meshses
-    void mergeMesh(Mesh * m2, bool lastCall=false);
+    /// Bytes held by the vertex, normal and triangle arrays and their world and base copies
+    size_t getMemoryBytes(){ return memtally.get(); }
+
+    /**
+     * Copy out the vertex indices of every triangle
+     * @param[out] faces    three vertex indices per triangle
+     */
+    void getFaces(std::vector<int> &faces);
+
+    /**
+     * Replace the geometry with an indexed triangle list, deriving the normals and resetting the transform
+     * @param newverts  vertices
+     * @param faces     three indices into @a newverts per triangle, counterclockwise seen from outside
+     */
+    void setIndexed(const std::vector<cgp::Point> &newverts, const std::vector<int> &faces);
+
+    /**
+     * Copy out the corner positions of every triangle, leaving the acceleration structure and connectivity valid
+     * @param[out] coords   x, y and z of each of the three corners of each triangle in turn, 9 floats per triangle
+     */
+    void packTriangles(std::vector<float> &coords);
+
+    /// Outward facing unit normal of triangle t, derived first if the triangles have changed since
+    cgp::Vector getFaceNorm(int t){ ensureFaceNorms(); return fnorms.get(t); }
+
+    /**
+     * Append other meshes, rebasing their triangle indices past the vertices already held. Storage is reserved once
+     * and large parts are copied in parallel, so assembling many parts takes time linear in their total size.
+     * @param parts     meshes to append, left unchanged
+     * @param weldseams if true weld vertices lying where the bounding boxes of the parts, and of this mesh as it was,
+     *                  overlap, so parts that share a boundary are joined without welding their interiors
+     */
+    void mergeMeshes(const std::vector<Mesh *> &parts, bool weldseams = false);
+
+    /**
+     * Append another mesh, as for mergeMeshes
+     * @param m2        mesh to append, left unchanged
+     * @param weldseam  if true weld the vertices where the two meshes overlap
+     */
+    void mergeMesh(Mesh * m2, bool weldseam = false);
+
+    /**
+     * Append a mesh that is no longer needed, taking over its storage when this mesh is empty
+     * @param m2        mesh to append, left empty
+     * @param weldseam  if true weld the vertices where the two meshes overlap
+     */
+    void mergeMesh(Mesh && m2, bool weldseam = false);
+
+    /**
+     * Replace this mesh with a set operation on the surfaces of two closed meshes, as placed in the world, using
+     * MeshBoolean rather than voxelising them. The result is welded by the engine, has derived normals and an identity transform.
+     * @param a, b  operands, either of which may be this mesh
+     * @param op    0 for union, 1 for intersection and 2 for difference, as for VoxelVolume::unionWith,
+     *              intersectWith and subtract
+     * @retval true if the operation was applied,
+     * @retval false if an operand is empty or the operation is unknown, leaving this mesh unchanged
+     */
+    bool booleanOf(Mesh * a, Mesh * b, int op);
 
     /// Setter for cube triangles
     void setCubeTriangles() {
         tris.clear();
+        fnorms.clear();
+        invalidateTopology();
         Triangle t;
         t.v[0] = 1; t.v[1] = 2; t.v[2] = 3; // front
         tris.push_back(t);
@@ -417,6 +1111,7 @@ public:
 
     // Getter for cube triangles
     vector<Triangle>* getCubeTriangles() {
+        invalidateTopology();
         return &tris;
     }
 
@@ -424,10 +1119,30 @@ public:
      * Generate and bind triangle mesh geometry for OpenGL rendering
      * @param view      current view parameters
      * @param[out] sdd  openGL parameters required to draw this geometry
+     * @param level     level of detail, 0 for the full mesh, up to meshlodlevels for successively coarser
+     *                  versions with meshlodreduction times fewer triangles each, which are decimated on first use
+     * @retval @c true  if buffers are bound successfully, in which case sdd is valid
+     * @retval @c false otherwise
+     */
+    bool bindGeometry(View * view, ShapeDrawData &sdd, int level = 0);
+
+    /**
+     * Number of triangles at a level of detail, building the levels if they are out of date
+     * @param level     level of detail, as for bindGeometry
+     * @returns triangle count, which can exceed the target where further collapses would break the surface
+     */
+    int getNumLODFaces(int level);
+
+    /**
+     * Bind the undistorted base for OpenGL rendering with the deformation applied in the vertex shader. The buffers
+     * are only rebuilt when the base changes, so that moving control points costs no upload.
+     * @param view      current view parameters
+     * @param[out] sdd  openGL parameters required to draw this geometry, marked as deformed
+     * @param[out] model    transformation to apply after deformation
      * @retval @c true  if buffers are bound successfully, in which case sdd is valid
      * @retval @c false otherwise
      */
-    bool bindGeometry(View * view, ShapeDrawData &sdd);
+    bool bindBaseGeometry(View * view, ShapeDrawData &sdd, glm::mat4x4 &model);
 
     /**
      * Generate triangle mesh geometry for OpenGL rendering
@@ -437,13 +1152,176 @@ public:
     void genGeometry(ShapeGeometry * geom, View * view);
 
     /**
-     * Test whether a point falls inside the mesh using ray-mesh intersection tests
+     * Test whether a point falls inside the mesh using ray-mesh intersection tests. A bounding volume hierarchy
+     * is built on the first call after any change to the geometry or transform, making each query O(log n).
      * @param pnt   point to test for containment
      * @retval true if the point falls within the mesh, 
      * @retval false otherwise
      */
     bool pointContainment(cgp::Point pnt);
 
+    /**
+     * Test a batch of points for containment with the world-space hierarchy checked once for the whole batch
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the mesh, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /**
+     * Signed distance to the mesh, with the magnitude found by a closest triangle search of the hierarchy and the
+     * sign by pointContainment, so it follows the current containment mode
+     * @param pnt   point to measure
+     * @param band  distance beyond which the closest triangle search gives up
+     * @returns signed distance, negative inside, clamped to band in magnitude
+     */
+    float signedDistance(cgp::Point pnt, float band);
+
+    /**
+     * Unsigned distance to the nearest triangle, for callers that find the sign another way, such as scanRow.
+     * The hierarchy must already be built (e.g., by getBounds), after which queries can run concurrently.
+     * @param pnt   point to measure
+     * @param band  distance beyond which the search gives up
+     * @returns distance to the nearest triangle, or band if none is closer
+     */
+    float surfaceDistance(cgp::Point pnt, float band){ return accel.closestDistance(pnt, band); }
+
+    /**
+     * Find the first point at which a ray meets the surface, for picking, by a nearest-first descent of the
+     * world-space hierarchy, which is built on the first call after any change as for pointContainment
+     * @param start     start of the ray, such as the centre of projection from View::projectingRay
+     * @param dirn      direction of the ray, normalised here
+     * @param[out] pick triangle, barycentric weights, distance and position of the hit
+     * @retval true if the ray meets the surface in front of @a start,
+     * @retval false otherwise
+     */
+    bool pickRay(cgp::Point start, cgp::Vector dirn, MeshPick &pick);
+
+    /**
+     * Set the number of rays cast by each containment query. Rays follow a fixed table of directions, so results
+     * are reproducible and queries need no shared random state when run concurrently.
+     * @param samples   number of rays, clamped to [1, 64], odd values avoid tied votes
+     */
+    void setRaySamples(int samples);
+
+    /**
+     * Choose the containment query. Winding numbers tolerate meshes that fail the validity tests, at a higher
+     * cost per query, and voxelisation then tests voxels individually rather than scanning rows by parity.
+     * @param mode  containment query used by pointContainment
+     */
+    void setContainment(MeshContainment mode){ containmode = mode; invalidateAccel(); }
+
+    /// Current containment query
+    MeshContainment getContainment(){ return containmode; }
+
+    /**
+     * Choose whether triangles and vertices are reordered for the GPU post-transform cache and sequential vertex
+     * fetch. The reordering runs once after each change to the triangles, before buffers are built or files written,
+     * so rendered and exported meshes share the same order.
+     * @param enable    reorder if true, otherwise keep triangles and vertices in the order they were created
+     */
+    void setCacheOrder(bool enable){ cacheorder = enable; }
+
+    /// Are triangles and vertices reordered for the vertex cache?
+    bool getCacheOrder(){ return cacheorder; }
+
+    /**
+     * Vertex positions after scaling, rotation and translation, recomputed only after the mesh or its transform changes
+     * @return world-space vertices, in the same order as the model-space vertices
+     */
+    const std::vector<cgp::Point> & getWorldVerts(){ buildWorld(); return wverts; }
+
+    /**
+     * Connectivity of the mesh, recomputed only after the triangles change, for algorithms that walk one-rings or edges
+     * @return topology over the current triangles
+     */
+    const MeshTopology & getTopology(){ buildTopology(); return topo; }
+
+    /// Getter for per vertex normals, in model space
+    const std::vector<cgp::Vector> & getNorms(){ return norms; }
+
+    /**
+     * Find the world-space bounds of the mesh, after scaling, rotation and translation
+     * @param[out] bbox  enclosing box, reset to empty if the mesh has no triangles
+     */
+    void getBounds(cgp::BoundBox &bbox);
+
+    /// Add the vertices, triangles, transform and containment settings to a hash
+    void hashContent(ContentHash &hash);
+
+    /**
+     * Hash of the model-space vertices and triangles, computed in parallel chunks joined in a fixed order, so that
+     * it is the same for any number of threads and can be compared between runs to detect changed results
+     * @returns 64-bit content hash
+     */
+    uint64_t checksum();
+
+    /**
+     * Copy the vertices, normals, triangles and undistorted base into an immutable snapshot, sharing the unchanged
+     * chunks of an earlier one
+     * @param[out] snap     snapshot receiving the arrays
+     * @param prev          snapshot the mesh was most likely derived from, or NULL
+     * @param alt           another snapshot to share chunks with where @a prev has changed, or NULL
+     * @returns bytes of storage allocated for the snapshot rather than shared
+     */
+    size_t takeSnapshot(MeshSnapshot &snap, const MeshSnapshot * prev = NULL, const MeshSnapshot * alt = NULL);
+
+    /**
+     * Replace the vertices, normals, triangles and undistorted base with those of a snapshot. Everything derived from
+     * them, such as the topology, hierarchies, lattice weights and render buffers, is rebuilt when next needed.
+     * @param snap  snapshot from takeSnapshot
+     */
+    void restoreSnapshot(const MeshSnapshot &snap);
+
+    /**
+     * Write the vertices, normals, triangles, undistorted base, transform and containment settings to a Boost
+     * archive, each array as one block. Instantiated for the binary archives.
+     * @param ar    output archive
+     */
+    template<class Archive> void save(Archive & ar, const unsigned int version) const;
+
+    /**
+     * Replace the mesh with one written by save. Everything derived from the arrays is rebuilt when next needed, as
+     * for restoreSnapshot.
+     * @param ar    input archive
+     */
+    template<class Archive> void load(Archive & ar, const unsigned int version);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    /**
+     * Voxelise the mesh by row parity. A single ray is cast along each x-row of the volume, its crossings are sorted
+     * and the spans between alternate crossings are filled directly into the bit-packed voxel words. Equivalent to
+     * calling pointContainment for every voxel, but with one ray per row rather than per voxel.
+     * @param[out] vox  voxel volume, every voxel of which is overwritten
+     */
+    void scanVoxelise(VoxelVolume * vox);
+
+    /**
+     * Find the occupied spans of a single voxel row by casting one ray along x. The acceleration structure must
+     * already be built (e.g., by getBounds), after which rows can be scanned concurrently.
+     * @param vox       voxel volume supplying the row positions
+     * @param bbox      bounds of the mesh
+     * @param y, z      row to scan
+     * @param[out] spans pairs of first and one past last occupied voxel, unclamped and in increasing order
+     */
+    void scanRow(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, std::vector<int> &spans);
+
+    /**
+     * Find the occupied spans of consecutive voxel rows of one layer, casting the rays along x in packets of up
+     * to bvhpacket through the wide hierarchy, with the same results as scanRow on each row
+     * @param vox       voxel volume supplying the row positions
+     * @param bbox      bounds of the mesh
+     * @param y         first row to scan
+     * @param z         layer of the rows
+     * @param n         number of rows
+     * @param[out] spans n lists of spans, one for each row from y on, as for scanRow
+     */
+    void scanRows(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, int n, std::vector<int> * spans);
+
+    /// Rows can be scanned by a single ray under parity containment
+    bool scansRows(){ return containmode == MeshContainment::PARITY; }
+
     /**
      * Scale geometry to fit bounding cube centered at origin
      * @param sidelen   length of one side of the bounding cube
@@ -451,11 +1329,85 @@ public:
     void boxFit(float sidelen);
 
     /**
-     * Apply marching cubes to a voxel volume to generate a mesh
+     * Apply marching cubes to a voxel volume to generate a mesh. Slabs of cell layers are processed in parallel,
+     * each sharing edge vertices through per-plane edge tables, and stitched along slab boundaries, so the mesh is
+     * indexed directly without a vertex merging pass.
      * @param vox           voxel volume
      */
     void marchingCubes(VoxelVolume * vox);
 
+    /**
+     * Apply marching cubes to a signed distance field, as for a voxel volume but with vertices placed where the
+     * interpolated distance crosses zero along each edge rather than at edge midpoints
+     * @param field         distance field
+     */
+    void marchingCubes(DistanceField * field);
+
+    /**
+     * Apply marching cubes to the span lists of a dexel volume, as for a voxel volume but unpacking only the rows
+     * that bound cells crossing the surface, so the volume is never held as packed words
+     * @param dexels        dexel volume
+     */
+    void marchingCubes(DexelVolume * dexels);
+
+    /**
+     * Extract the surface of a voxel volume by surface nets, the dual of marching cubes: one vertex for each cell
+     * with a mix of inside and outside corners, at the mean of its edge crossings, and a quad joining the four cells
+     * around each crossed lattice edge. Gives about half the triangles of marchingCubes without its terracing, and
+     * is indexed directly as it is extracted.
+     * @param vox           voxel volume
+     */
+    void surfaceNets(VoxelVolume * vox);
+
+    /**
+     * Extract the surface of a signed distance field by dual contouring: as surfaceNets, but with the vertex of each
+     * cell placed to best fit the tangent planes at its edge crossings, from the gradient of the field, so that
+     * sharp edges and corners are kept rather than rounded off
+     * @param field         distance field
+     */
+    void dualContouring(DistanceField * field);
+
+    /**
+     * Apply marching cubes to a compressed voxel file, as for a voxel volume but decompressing only the rows each
+     * slab of cells needs, so the volume is never held in full
+     * @param stream        open compressed voxel file
+     */
+    void marchingCubes(VoxelStreamReader * stream);
+
+    /**
+     * Apply marching cubes to the cells of one slab of a volume too large to hold whole, as delivered by an out of
+     * core pipeline. Vertices are placed in the frame of the whole volume, so a vertex on a plane shared by two
+     * slabs is repeated in each at exactly the same position, and the slabs together form the same surface as
+     * marchingCubes on the whole volume.
+     * @param slab          volume holding voxel layers zbase onwards of the whole volume, with matching x and y dimensions
+     * @param zbase         layer of the whole volume held as layer 0 of @a slab
+     * @param zdim          number of voxel layers in the whole volume
+     * @param origin, diag  frame of the whole volume, as for VoxelVolume::getFrame
+     * @param zlo, zhi      range [zlo, zhi) of cell layers to extract, clipped to those @a slab holds both voxel layers of
+     * @param[out] verts    vertex positions in world space
+     * @param[out] faces    flattened triangle vertex indices into @a verts
+     */
+    static void marchingCubesSlab(VoxelVolume * slab, int zbase, int zdim, cgp::Point origin, cgp::Vector diag, int zlo, int zhi,
+                                  std::vector<cgp::Point> &verts, std::vector<int> &faces);
+
+    /**
+     * Redo marching cubes after a change to some voxel layers of the volume given to the last marchingCubes call.
+     * Only the slabs with cells touching those layers are extracted again and the rest are reused, so the cost
+     * of extraction follows the size of the change, and the mesh matches a full extraction of the volume. Falls
+     * back to a full extraction if the volume dimensions or frame have changed in between.
+     * @param vox       voxel volume
+     * @param zlo, zhi  inclusive range of changed voxel layers
+     */
+    void updateMarchingCubes(VoxelVolume * vox, int zlo, int zhi);
+
+    /**
+     * Generate a mesh of the exposed faces of a voxel volume, treating each occupied voxel as a solid cube.
+     * Runs in a single linear pass and produces an indexed mesh with shared vertices.
+     * @param vox           voxel volume
+     * @param greedy        merge coplanar faces into maximal rectangles, which leaves T-junctions between rectangles
+     */
+    void voxelSurface(VoxelVolume * vox, bool greedy = false);
+
     /**
      * Apply in-place simple Laplacian smoothing to the mesh
      * @param iter  number of smoothing iterations
@@ -464,19 +1416,130 @@ public:
     void laplacianSmooth(int iter, float rate);
 
     /**
-     * Apply a free-form deformation to the mesh
+     * Apply in-place Taubin smoothing, alternating a shrinking Laplacian step with an inflating one, so that
+     * noise is removed without the volume loss of plain Laplacian smoothing
+     * @param iter      number of shrink and inflate pairs
+     * @param lambda    shrinking factor, with 0 < lambda <= 1
+     * @param passband  pass-band frequency, from which the inflating factor is derived
+     */
+    void taubinSmooth(int iter, float lambda, float passband = taubinpassband);
+
+    /**
+     * Apply a free-form deformation to the undistorted base copy of the mesh. The base vertices are embedded in the
+     * lattice once per lattice frame, so later calls after control point moves only reweight the control points.
+     * Normals are refreshed only around vertices whose deformed position changed since the previous deformation.
      * @param lat   ffd lattice being applied
      */
     void applyFFD(ffd * lat);
 
     /**
-     * Read in triangle mesh from STL format binary file
+     * Read in triangle mesh from STL format file, either binary or ASCII
      * @param filename  name of file to load (STL format)
      * @retval true  if load succeeds,
      * @retval false otherwise.
      */
     bool readSTL(string filename);
 
+    /**
+     * Read in triangle mesh from Wavefront OBJ format file. Polygons are triangulated as fans, and texture
+     * coordinates, normals, groups and materials are ignored.
+     * @param filename  name of file to load (OBJ format)
+     * @retval true  if load succeeds,
+     * @retval false otherwise.
+     */
+    bool readOBJ(string filename);
+
+    /**
+     * Test whether a file starts with the binary indexed mesh file signature
+     * @param filename  name of file to test
+     * @retval true if the file exists and is an indexed mesh file,
+     * @retval false otherwise
+     */
+    static bool isMeshFile(string filename);
+
+    /**
+     * Read in a mesh written by writeMeshFile. The file is memory mapped and its arrays copied out in parallel,
+     * without the welding and normal derivation needed for STL.
+     * @param filename  name of file to load
+     * @retval true  if load succeeds,
+     * @retval false otherwise.
+     */
+    bool readMeshFile(string filename);
+
+    /**
+     * Write vertices, vertex normals and triangles to a binary indexed mesh file, suitable for caching
+     * intermediate results between runs. The model-space geometry is written, not the transform.
+     * @param filename  name of file to save
+     * @retval true  if save succeeds,
+     * @retval false otherwise.
+     */
+    bool writeMeshFile(string filename);
+
+    /**
+     * Number of bytes encodeMeshFile writes, which is the size of the file writeMeshFile produces
+     */
+    size_t getMeshFileBytes();
+
+    /**
+     * Encode the mesh in binary indexed mesh file layout, as writeMeshFile does, into memory such as a shared
+     * segment, so that a reader can use the arrays in place. Applies any pending cache order first.
+     * @param buf   destination of getMeshFileBytes bytes
+     */
+    void encodeMeshFile(char * buf);
+
+    /**
+     * Test whether a file starts with the compressed mesh signature
+     * @param filename  name of file to test
+     * @retval true if the file exists and is a compressed mesh,
+     * @retval false otherwise
+     */
+    static bool isCompressedFile(string filename);
+
+    /**
+     * Encode the mesh in the compressed format of MeshCodec, in vertex cache order. Positions and normals are
+     * quantised, so they come back only approximately, and triangles may start from another corner.
+     * @param[out] out  encoded mesh, replacing its contents
+     * @param posbits   bits per position component, from 1 to 24
+     * @param normbits  bits per normal component, from 2 to 16
+     */
+    void encodeCompressed(std::vector<uint8_t> &out, int posbits = meshcodecposbits, int normbits = meshcodecnormbits);
+
+    /**
+     * Replace the mesh with one encoded by encodeCompressed, as received from another process
+     * @param data  encoded mesh
+     * @param len   bytes available
+     * @retval true  if decoding succeeds,
+     * @retval false if the data is not a compressed mesh or is damaged, leaving the mesh empty
+     */
+    bool decodeCompressed(const uint8_t * data, size_t len);
+
+    /**
+     * Read in a mesh written by writeCompressed. The file is memory mapped and decoded in parallel.
+     * @param filename  name of file to load
+     * @retval true  if load succeeds,
+     * @retval false otherwise.
+     */
+    bool readCompressed(string filename);
+
+    /**
+     * Write the mesh compressed, typically a few bytes per vertex and one and a bit per triangle, for caching
+     * large intermediate results where the quantisation error is acceptable. The model-space geometry is written.
+     * @param filename  name of file to save
+     * @param posbits   bits per position component, from 1 to 24
+     * @param normbits  bits per normal component, from 2 to 16
+     * @retval true  if save succeeds,
+     * @retval false otherwise.
+     */
+    bool writeCompressed(string filename, int posbits = meshcodecposbits, int normbits = meshcodecnormbits);
+
+    /**
+     * Read in triangle mesh, choosing the format from the file signature (indexed or compressed mesh file) or extension (.obj for OBJ, otherwise STL)
+     * @param filename  name of file to load
+     * @retval true  if load succeeds,
+     * @retval false otherwise.
+     */
+    bool readMesh(string filename);
+
     /**
      * Write triangle mesh to STL format binary file
      * @param filename  name of file to save (STL format)
@@ -485,6 +1548,15 @@ public:
      */
     bool writeSTL(string filename);
 
+    /**
+     * Cut the mesh into closed contours per layer for printing, as for Slicer::slice, with vertices as written by writeSTL
+     * @param slicer    layer thickness and base
+     * @param out       receives each layer in turn
+     * @retval true if every layer was accepted by @a out,
+     * @retval false otherwise
+     */
+    bool slice(Slicer &slicer, SliceWriter &out){ return slicer.slice(verts.data(), tris.empty() ? NULL : tris[0].v, (int) tris.size(), sizeof(Triangle), out); }
+
     /**
      * Read in 3D vector data from file
      * @param filename  name of file to read
@@ -513,6 +1585,16 @@ public:
      */
     bool manifoldValidity();
 
+    /**
+     * Check that the mesh is a closed two-manifold and find every triangle that breaks it. Edges are paired through
+     * the half-edge twins of the shared topology and each vertex fan is walked once, all in parallel, so the cost is
+     * linear in the number of triangles. Out of bounds vertex indices are reported as non-manifold.
+     * @param[out] report   failing triangles by cause
+     * @retval true if the mesh is two-manifold,
+     * @retval false otherwise
+     */
+    bool manifoldValidity(ManifoldReport &report);
+
     /**
      * Test that the mesh forms a single connected structure
      * @retval true if any vertex can be reached by edge traversal from any other
@@ -547,4 +1629,10 @@ public:
     void overlapTetTest();
 };
 
+/// A shape as a mesh, or NULL if it is another shape or NULL
+inline Mesh * meshShape(BaseShape * shape)
+{
+    return (shape != NULL && shape->getKind() == ShapeKind::MESH) ? static_cast<Mesh *>(shape) : NULL;
+}
+
 #endif
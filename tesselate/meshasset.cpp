@@ -0,0 +1,384 @@
+//
+// MeshAsset, MeshAssetCache and MeshInstance
+//
+
+#include "meshasset.h"
+#include <math.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "common/counters.h"
+
+using namespace std;
+
+static stats::MemoryInit assetMemory("MeshAsset");
+
+MeshAsset::MeshAsset(Mesh &mesh)
+    : memtally(assetMemory)
+{
+    verts = * mesh.getVerts();
+    norms = mesh.getNorms();
+    mesh.getFaces(faces);
+    build();
+}
+
+MeshAsset::MeshAsset(std::vector<cgp::Point> &&vertices, std::vector<cgp::Vector> &&normals, std::vector<int> &&triangles)
+    : verts(std::move(vertices)), norms(std::move(normals)), faces(std::move(triangles)), memtally(assetMemory)
+{
+    build();
+}
+
+void MeshAsset::build()
+{
+    ContentHash hash;
+    int numverts;
+
+    if(norms.size() != verts.size())
+        norms.assign(verts.size(), cgp::Vector(0.0f, 0.0f, 0.0f));
+    accel.build(verts, faces);
+
+    numverts = (int) verts.size();
+    for(int c = 0; c < numverts; c += vertchunksize)
+        bounds.includePnts(&verts[c], std::min(vertchunksize, numverts - c));
+
+    hash.addInt((int64_t) verts.size());
+    hash.add(verts.data(), verts.size() * sizeof(cgp::Point));
+    hash.addInt((int64_t) faces.size());
+    hash.add(faces.data(), faces.size() * sizeof(int));
+    digest = hash.value();
+
+    memtally.set(verts.capacity() * sizeof(cgp::Point) + norms.capacity() * sizeof(cgp::Vector) + faces.capacity() * sizeof(int)
+                 + (size_t) accel.getNumTris() * (9 * sizeof(float) + sizeof(int)));
+}
+
+const WindingTree & MeshAsset::getWinding() const
+{
+    if(!windingstate.valid)
+    {
+        std::lock_guard<std::mutex> guard(windingstate.build);
+        if(!windingstate.valid) // another instance may have got here first
+        {
+            winding.build(verts, faces);
+            windingstate.valid = true;
+        }
+    }
+    return winding;
+}
+
+bool MeshAssetCache::fileState(const std::string &filename, int64_t &mtime, int64_t &size)
+{
+    struct stat st;
+
+    if(stat(filename.c_str(), &st) != 0)
+        return false;
+    mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + (int64_t) st.st_mtim.tv_nsec;
+    size = (int64_t) st.st_size;
+    return true;
+}
+
+std::shared_ptr<const MeshAsset> MeshAssetCache::find(const std::string &filename)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    int64_t mtime, size;
+    auto entry = entries.find(filename);
+
+    if(entry == entries.end())
+        return std::shared_ptr<const MeshAsset>();
+    if(!fileState(filename, mtime, size) || mtime != entry->second.mtime || size != entry->second.size)
+    {
+        entries.erase(entry); // the file has changed or gone, so it is read again
+        return std::shared_ptr<const MeshAsset>();
+    }
+    return entry->second.asset;
+}
+
+void MeshAssetCache::insert(const std::string &filename, std::shared_ptr<const MeshAsset> asset)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    Entry entry;
+
+    if(!fileState(filename, entry.mtime, entry.size))
+        return;
+    entry.asset = asset;
+    entries[filename] = entry;
+}
+
+int MeshAssetCache::size()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return (int) entries.size();
+}
+
+void MeshAssetCache::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+}
+
+MeshInstance::MeshInstance(std::shared_ptr<const MeshAsset> shared)
+    : BaseShape(ShapeKind::INSTANCE), asset(shared)
+{
+    fit = glm::mat4(1.0f);
+    scale = 1.0f;
+    trx = cgp::Vector(0.0f, 0.0f, 0.0f);
+    xrot = yrot = zrot = 0.0f;
+    numraysamples = defaultraysamples;
+    containmode = MeshContainment::PARITY;
+    updateTransform();
+}
+
+void MeshInstance::updateTransform()
+{
+    glm::mat4x4 idt = glm::mat4(1.0f);
+
+    // the same order as Mesh::buildTransform, after the fit
+    tfm = glm::translate(idt, glm::vec3(trx.i, trx.j, trx.k));
+    tfm = glm::rotate(tfm, zrot, glm::vec3(0.0f, 0.0f, 1.0f));
+    tfm = glm::rotate(tfm, yrot, glm::vec3(0.0f, 1.0f, 0.0f));
+    tfm = glm::rotate(tfm, xrot, glm::vec3(1.0f, 0.0f, 0.0f));
+    tfm = glm::scale(tfm, glm::vec3(scale));
+    tfm = tfm * fit;
+    inv = glm::inverse(tfm);
+    worldscale = fabsf(scale * fit[0][0]);
+    boundstate.valid = false;
+}
+
+cgp::Point MeshInstance::toModel(cgp::Point pnt) const
+{
+    glm::vec4 p = inv * glm::vec4(pnt.x, pnt.y, pnt.z, 1.0f);
+    return cgp::Point(p.x, p.y, p.z);
+}
+
+cgp::Vector MeshInstance::toModel(cgp::Vector dir) const
+{
+    glm::vec4 d = inv * glm::vec4(dir.i, dir.j, dir.k, 0.0f);
+    return cgp::Vector(d.x, d.y, d.z);
+}
+
+void MeshInstance::boxFit(float sidelen)
+{
+    cgp::BoundBox bbox = asset->getBounds();
+    cgp::Vector diag;
+    float side;
+
+    if(asset->getVerts().empty())
+        return;
+    diag = bbox.getDiag();
+    side = std::max(std::max(diag.i, diag.j), diag.k);
+    if(side <= 0.0f)
+        return;
+
+    // shift the centre of the bounds to the origin and scale uniformly, as Mesh::boxFit does to the vertices
+    side = sidelen / side;
+    fit = glm::mat4(1.0f);
+    fit[0][0] = fit[1][1] = fit[2][2] = side;
+    fit[3][0] = -(bbox.min.x + 0.5f * diag.i) * side;
+    fit[3][1] = -(bbox.min.y + 0.5f * diag.j) * side;
+    fit[3][2] = -(bbox.min.z + 0.5f * diag.k) * side;
+    updateTransform();
+}
+
+void MeshInstance::toMesh(Mesh * mesh)
+{
+    const std::vector<cgp::Point> &verts = asset->getVerts();
+    std::vector<cgp::Point> world(verts.size());
+    int numverts = (int) verts.size();
+
+    #pragma omp parallel for schedule(static)
+    for(int c = 0; c < numverts; c += vertchunksize)
+        cgp::transformPoints(&tfm[0][0], &verts[c], std::min(vertchunksize, numverts - c), &world[c].x, 3);
+    mesh->setIndexed(world, asset->getFaces());
+    mesh->setContainment(containmode);
+}
+
+void MeshInstance::genGeometry(ShapeGeometry * geom, View * view)
+{
+    const std::vector<cgp::Point> &verts = asset->getVerts();
+    const std::vector<int> &faces = asset->getFaces();
+
+    // the shared arrays are transformed as they are packed, so no world-space copy is kept
+    geom->genMesh(verts.data(), asset->getNorms().data(), (int) verts.size(), faces.empty() ? NULL : faces.data(),
+                  asset->getNumFaces(), 3 * sizeof(int), tfm);
+}
+
+bool MeshInstance::pointContainment(cgp::Point pnt)
+{
+    uint8_t inside;
+
+    containment(&pnt, 1, &inside);
+    return inside != 0;
+}
+
+void MeshInstance::containment(const cgp::Point * pts, size_t n, uint8_t * out)
+{
+    const BVH &accel = asset->getAccel();
+    const WindingTree * winding = (containmode == MeshContainment::WINDING) ? &asset->getWinding() : NULL;
+    cgp::Vector dirs[maxraysamples];
+    vector<BVHHit> xsect;
+
+    UTS_COUNT(INSTANCE_CONTAINMENT, n);
+    // world-space rays mapped into model space, so rays match those of a transformed Mesh
+    for(int k = 0; k < numraysamples; k++)
+        dirs[k] = toModel(containmentDir(k));
+
+    for(size_t i = 0; i < n; i++)
+    {
+        cgp::Point p = toModel(pts[i]);
+
+        if(winding != NULL)
+        {
+            out[i] = (uint8_t) (winding->windingNumber(p) > 0.5f);
+        }
+        else
+        {
+            int incount = 0;
+            for(int k = 0; k < numraysamples; k++)
+                if(rayCrossings(accel, p, dirs[k], xsect)%2 == 1)
+                    incount++;
+            out[i] = (uint8_t) (2 * incount > numraysamples); // consensus wins
+        }
+    }
+}
+
+float MeshInstance::signedDistance(cgp::Point pnt, float band)
+{
+    float dist = surfaceDistance(pnt, band);
+
+    return pointContainment(pnt) ? -dist : dist;
+}
+
+float MeshInstance::surfaceDistance(cgp::Point pnt, float band)
+{
+    if(worldscale <= 0.0f)
+        return band;
+    return asset->getAccel().closestDistance(toModel(pnt), band / worldscale) * worldscale;
+}
+
+void MeshInstance::scanRow(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, std::vector<int> &spans)
+{
+    vector<BVHHit> hits;
+    cgp::Point o;
+    float xstart, xstep;
+    int dx, dy, dz;
+
+    spans.clear();
+    o = vox->getVoxelPos(0, y, z);
+    if(o.y < bbox.min.y || o.y > bbox.max.y || o.z < bbox.min.z || o.z > bbox.max.z)
+        return; // row misses the mesh entirely
+    vox->getDim(dx, dy, dz);
+    xstart = o.x;
+    xstep = (dx > 1) ? vox->getVoxelPos(1, y, z).x - xstart : 1.0f;
+
+    // the ray starts just outside the mesh, and its model-space image keeps the same parameter values
+    o.x = bbox.min.x - 1.0f;
+    asset->getAccel().rayHits(toModel(o), toModel(cgp::Vector(1.0f, 0.0f, 0.0f)), hits);
+    crossingSpans(hits, o.x, xstart, xstep, spans);
+}
+
+void MeshInstance::scanRows(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, int n, std::vector<int> * spans)
+{
+    vector<BVHHit> hits[bvhpacket];
+    cgp::Point origins[bvhpacket], o;
+    cgp::Vector dir = toModel(cgp::Vector(1.0f, 0.0f, 0.0f));
+    int rows[bvhpacket], dx, dy, dz;
+    float xstart, xstep;
+
+    vox->getDim(dx, dy, dz);
+    o = vox->getVoxelPos(0, y, z);
+    xstart = o.x;
+    xstep = (dx > 1) ? vox->getVoxelPos(1, y, z).x - xstart : 1.0f;
+
+    // the rows share one model-space direction, so they still travel together through the shared hierarchy
+    for(int first = 0; first < n; first += bvhpacket)
+    {
+        int count = 0;
+
+        for(int r = first; r < std::min(first + bvhpacket, n); r++)
+        {
+            spans[r].clear();
+            o = vox->getVoxelPos(0, y + r, z);
+            if(o.y < bbox.min.y || o.y > bbox.max.y || o.z < bbox.min.z || o.z > bbox.max.z)
+                continue;
+            o.x = bbox.min.x - 1.0f;
+            origins[count] = toModel(o);
+            rows[count] = r;
+            hits[count++].clear();
+        }
+        asset->getAccel().packetHits(origins, count, dir, hits);
+        for(int p = 0; p < count; p++)
+            crossingSpans(hits[p], bbox.min.x - 1.0f, xstart, xstep, spans[rows[p]]);
+    }
+}
+
+void MeshInstance::getBounds(cgp::BoundBox &bbox)
+{
+    if(!boundstate.valid)
+    {
+        std::lock_guard<std::mutex> guard(boundstate.build);
+        if(!boundstate.valid) // another thread got here first
+        {
+            const std::vector<cgp::Point> &verts = asset->getVerts();
+            int numverts = (int) verts.size();
+            cgp::BoundBox box;
+
+            // the transformed vertices are reduced a chunk at a time, so they are never all held
+            #pragma omp parallel
+            {
+                cgp::BoundBox local;
+                std::vector<cgp::Point> chunk(vertchunksize);
+
+                #pragma omp for schedule(static) nowait
+                for(int c = 0; c < numverts; c += vertchunksize)
+                {
+                    int len = std::min(vertchunksize, numverts - c);
+                    cgp::transformPoints(&tfm[0][0], &verts[c], len, &chunk[0].x, 3);
+                    local.includePnts(chunk.data(), len);
+                }
+                #pragma omp critical
+                if(local.min.x <= local.max.x) // threads without a chunk leave theirs empty
+                {
+                    box.includePnt(local.min);
+                    box.includePnt(local.max);
+                }
+            }
+            wbounds = box;
+            boundstate.valid = true;
+        }
+    }
+    bbox = wbounds;
+}
+
+void MeshInstance::hashContent(ContentHash &hash)
+{
+    hash.addString("instance");
+    hash.addInt((int64_t) asset->getDigest());
+    for(int c = 0; c < 4; c++)
+        for(int r = 0; r < 4; r++)
+            hash.addFloat(tfm[c][r]);
+    hash.addInt((int64_t) containmode);
+    hash.addInt(numraysamples);
+}
+
+template<class Archive> void MeshInstance::save(Archive & ar, const unsigned int version) const
+{
+    int32_t mode = (int32_t) containmode;
+
+    ar << boost::serialization::make_array(&fit[0][0], 16);
+    ar << scale << trx << xrot << yrot << zrot;
+    ar << numraysamples << mode;
+}
+
+template<class Archive> void MeshInstance::load(Archive & ar, const unsigned int version)
+{
+    int32_t mode;
+
+    ar >> boost::serialization::make_array(&fit[0][0], 16);
+    ar >> scale >> trx >> xrot >> yrot >> zrot;
+    ar >> numraysamples >> mode;
+    containmode = (MeshContainment) mode;
+    updateTransform();
+}
+
+template void MeshInstance::save(boost::archive::binary_oarchive & ar, const unsigned int version) const;
+template void MeshInstance::load(boost::archive::binary_iarchive & ar, const unsigned int version);
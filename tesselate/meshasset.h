@@ -0,0 +1,288 @@
+/**
+ * @file
+ *
+ * Loaded meshes shared between the csg leaves that place them, with each leaf holding only its own transform
+ */
+
+#ifndef _MESHASSET
+#define _MESHASSET
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "mesh.h"
+
+/**
+ * Immutable geometry of a loaded mesh in its own model space, with a hierarchy over its triangles. Every
+ * MeshInstance of the asset queries the same hierarchy, mapping its queries into model space, so a part placed
+ * many times, such as a fastener or a lattice cell, holds one copy of its triangles and acceleration structures.
+ */
+class MeshAsset
+{
+private:
+    std::vector<cgp::Point> verts;      ///< model-space vertices
+    std::vector<cgp::Vector> norms;     ///< model-space vertex normals
+    std::vector<int> faces;             ///< three vertex indices per triangle
+    BVH accel;                          ///< model-space hierarchy over the triangles
+    mutable WindingTree winding;        ///< model-space winding number hierarchy, built by the first instance that needs it
+    mutable AccelState windingstate;    ///< tracks whether winding has been built
+    cgp::BoundBox bounds;               ///< model-space bounds of the vertices
+    uint64_t digest;                    ///< hash of the vertices and triangles, so that instances hash in constant time
+    stats::MemoryTally memtally;        ///< bytes of the geometry and hierarchies
+
+    /// Build the hierarchy, bounds and digest of the geometry once it is in place
+    void build();
+
+public:
+
+    /**
+     * Take the geometry of a loaded mesh, ignoring its transform, and build the hierarchy over it
+     * @param mesh  source mesh, left unchanged
+     */
+    MeshAsset(Mesh &mesh);
+
+    /**
+     * Take model-space geometry directly, such as that read back from a session, and build the hierarchy over it
+     * @param vertices      model-space vertices, moved into the asset
+     * @param normals       vertex normals, moved into the asset
+     * @param triangles     three vertex indices per triangle, moved into the asset
+     */
+    MeshAsset(std::vector<cgp::Point> &&vertices, std::vector<cgp::Vector> &&normals, std::vector<int> &&triangles);
+
+    /// Model-space vertices
+    const std::vector<cgp::Point> & getVerts() const { return verts; }
+
+    /// Model-space vertex normals, one per vertex
+    const std::vector<cgp::Vector> & getNorms() const { return norms; }
+
+    /// Three vertex indices per triangle
+    const std::vector<int> & getFaces() const { return faces; }
+
+    /// Number of triangles
+    int getNumFaces() const { return (int) faces.size() / 3; }
+
+    /// Model-space hierarchy over the triangles
+    const BVH & getAccel() const { return accel; }
+
+    /// Model-space winding number hierarchy, built on the first call, after which queries can run concurrently
+    const WindingTree & getWinding() const;
+
+    /// Model-space bounds of the vertices
+    const cgp::BoundBox & getBounds() const { return bounds; }
+
+    /// Hash of the vertices and triangles
+    uint64_t getDigest() const { return digest; }
+};
+
+/**
+ * Loaded assets keyed by file path, each reused for as long as the file keeps the modification time and size it
+ * had when it was read, so scenes that name a file many times parse and weld it once
+ */
+class MeshAssetCache
+{
+private:
+    /// A loaded asset with the state of the file it came from
+    struct Entry
+    {
+        std::shared_ptr<const MeshAsset> asset;     ///< shared geometry
+        int64_t mtime;                              ///< modification time of the file in nanoseconds
+        int64_t size;                               ///< size of the file in bytes
+    };
+
+    std::unordered_map<std::string, Entry> entries; ///< asset of each path
+    std::mutex lock;                                ///< serialises lookups and insertions
+
+    /**
+     * Read the modification time and size of a file
+     * @param filename      file to examine
+     * @param[out] mtime    modification time in nanoseconds
+     * @param[out] size     size in bytes
+     * @retval true if the file exists,
+     * @retval false otherwise
+     */
+    static bool fileState(const std::string &filename, int64_t &mtime, int64_t &size);
+
+public:
+
+    /**
+     * Find the asset loaded from a file, unless the file has changed since
+     * @param filename  path as given to insert
+     * @returns shared asset, or an empty pointer if there is none or it is stale
+     */
+    std::shared_ptr<const MeshAsset> find(const std::string &filename);
+
+    /**
+     * Record the asset loaded from a file, keyed by the current state of the file
+     * @param filename  path the asset was loaded from
+     * @param asset     shared asset
+     */
+    void insert(const std::string &filename, std::shared_ptr<const MeshAsset> asset);
+
+    /// Number of assets held
+    int size();
+
+    /// Release every asset, leaving existing instances with their own references
+    void clear();
+};
+
+/**
+ * A placement of a shared MeshAsset, holding only its transform. Fitting, scaling, rotation and translation compose
+ * into one similarity transform, and queries are mapped into the model space of the asset, where the shared
+ * hierarchy answers them. Ray parameters, crossing orientation and winding numbers are unchanged by the mapping,
+ * and distances scale by the uniform scale factor, so results match a Mesh holding the transformed vertices.
+ */
+class MeshInstance: public BaseShape
+{
+private:
+    std::shared_ptr<const MeshAsset> asset; ///< shared geometry
+    glm::mat4x4 fit;            ///< model-space fitting applied before the transform, identity unless boxFit is used
+    float scale;                ///< scaling factor
+    cgp::Vector trx;            ///< translation
+    float xrot, yrot, zrot;     ///< rotation angles about x, y, and z axes
+    glm::mat4x4 tfm;            ///< model to world transform, including the fit
+    glm::mat4x4 inv;            ///< world to model transform
+    float worldscale;           ///< uniform scale of tfm, by which model-space distances grow
+    int numraysamples;          ///< rays cast per parity containment query, with the majority deciding
+    MeshContainment containmode;    ///< query used by pointContainment
+    cgp::BoundBox wbounds;      ///< world-space bounds of the transformed vertices
+    AccelState boundstate;      ///< tracks whether wbounds matches the current transform
+
+    /// Compose the transform and its inverse, and mark the bounds stale
+    void updateTransform();
+
+    /// Map a world-space point into model space
+    cgp::Point toModel(cgp::Point pnt) const;
+
+    /// Map a world-space direction into model space, keeping ray parameters unchanged
+    cgp::Vector toModel(cgp::Vector dir) const;
+
+public:
+
+    /**
+     * Constructor
+     * @param shared    geometry to place, with an identity transform
+     */
+    MeshInstance(std::shared_ptr<const MeshAsset> shared);
+
+    /// Shared geometry
+    const std::shared_ptr<const MeshAsset> & getAsset() const { return asset; }
+
+    /**
+     * Centre the asset on the origin and scale it so that the longest side of its bounds is @a sidelen, as
+     * Mesh::boxFit does to the vertices, but as part of the transform of this instance
+     * @param sidelen   side length of the bounding cube
+     */
+    void boxFit(float sidelen);
+
+    /// Setter for scale
+    void setScale(float scf){ scale = scf; updateTransform(); }
+
+    /// Setter for translation
+    void setTranslation(cgp::Vector tvec){ trx = tvec; updateTransform(); }
+
+    /// Setter for rotation angles
+    void setRotations(float ax, float ay, float az){ xrot = ax; yrot = ay; zrot = az; updateTransform(); }
+
+    /// Choose the query used by pointContainment, as for Mesh::setContainment
+    void setContainment(MeshContainment mode){ containmode = mode; }
+
+    /// Current containment query
+    MeshContainment getContainment(){ return containmode; }
+
+    /**
+     * Copy the placed geometry into a mesh of its own, in world space, for operations that need a mutable mesh
+     * such as Mesh::booleanOf
+     * @param[out] mesh     replaced by the transformed vertices and the triangles of the asset
+     */
+    void toMesh(Mesh * mesh);
+
+    /**
+     * Generate geometry for OpenGL rendering, transforming the shared arrays as they are packed
+     * @param[out] geom triangle-mesh geometry packed for OpenGL
+     * @param view      current view parameters
+     */
+    void genGeometry(ShapeGeometry * geom, View * view);
+
+    /**
+     * Test whether a point falls inside the placed mesh, as for Mesh::pointContainment
+     * @param pnt   point to test for containment
+     * @retval true if the point falls within the mesh,
+     * @retval false otherwise
+     */
+    bool pointContainment(cgp::Point pnt);
+
+    /**
+     * Test a batch of points for containment
+     * @param pts       points to test
+     * @param n         number of points
+     * @param[out] out  1 for each point inside the mesh, 0 otherwise
+     */
+    void containment(const cgp::Point * pts, size_t n, uint8_t * out);
+
+    /**
+     * Signed distance to the placed mesh, with the sign from pointContainment
+     * @param pnt   point to measure
+     * @param band  distance beyond which the closest triangle search gives up
+     * @returns signed distance, negative inside, clamped to band in magnitude
+     */
+    float signedDistance(cgp::Point pnt, float band);
+
+    /**
+     * Unsigned distance to the nearest triangle, from the shared hierarchy
+     * @param pnt   point to measure
+     * @param band  distance beyond which the search gives up
+     * @returns distance to the nearest triangle, or band if none is closer
+     */
+    float surfaceDistance(cgp::Point pnt, float band);
+
+    /// Rows can be scanned by a single ray under parity containment
+    bool scansRows(){ return containmode == MeshContainment::PARITY; }
+
+    /**
+     * Find the occupied spans of a single voxel row with one ray through the shared hierarchy, as for Mesh::scanRow
+     * @param vox       voxel volume supplying the row positions
+     * @param bbox      bounds of the placed mesh
+     * @param y, z      row to scan
+     * @param[out] spans pairs of first and one past last occupied voxel, unclamped and in increasing order
+     */
+    void scanRow(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, std::vector<int> &spans);
+
+    /**
+     * Find the occupied spans of consecutive voxel rows of one layer, casting packets of rays through the shared
+     * hierarchy, as for Mesh::scanRows
+     * @param vox       voxel volume supplying the row positions
+     * @param bbox      bounds of the placed mesh
+     * @param y         first row to scan
+     * @param z         layer of the rows
+     * @param n         number of rows
+     * @param[out] spans n lists of spans, one for each row from y on, as for scanRow
+     */
+    void scanRows(VoxelVolume * vox, const cgp::BoundBox &bbox, int y, int z, int n, std::vector<int> * spans);
+
+    /**
+     * Find the world-space bounds of the transformed vertices, computed once per transform
+     * @param[out] bbox  enclosing box, reset to empty if the asset has no vertices
+     */
+    void getBounds(cgp::BoundBox &bbox);
+
+    /// Add the asset digest, transform and containment settings to a hash
+    void hashContent(ContentHash &hash);
+
+    /**
+     * Write the fit, transform and containment settings to a Boost archive, leaving the shared asset to the caller.
+     * Instantiated for the binary archives.
+     * @param ar    output archive
+     */
+    template<class Archive> void save(Archive & ar, const unsigned int version) const;
+
+    /**
+     * Replace the fit, transform and containment settings with those written by save
+     * @param ar    input archive
+     */
+    template<class Archive> void load(Archive & ar, const unsigned int version);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+#endif
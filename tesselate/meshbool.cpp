@@ -0,0 +1,753 @@
+//
+// MeshBoolean
+//
+
+#include "meshbool.h"
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <climits>
+
+using namespace std;
+
+/// Key of the edge between two vertices, independent of their order
+static inline uint64_t edgeKey(int a, int b)
+{
+    return ((uint64_t) (uint32_t) std::min(a, b) << 32) | (uint64_t) (uint32_t) std::max(a, b);
+}
+
+static inline double dot3(const double * a, const double * b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline void cross3(const double * a, const double * b, double * c)
+{
+    c[0] = a[1] * b[2] - a[2] * b[1];
+    c[1] = a[2] * b[0] - a[0] * b[2];
+    c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline void toDouble(const cgp::Point &p, double * d)
+{
+    d[0] = p.x; d[1] = p.y; d[2] = p.z;
+}
+
+/**
+ * Unit normal and offset of the plane of a triangle
+ * @retval true if the triangle has an area above @a minarea2 / 2,
+ * @retval false otherwise, leaving the plane undefined
+ */
+static bool trianglePlane(const double (*c)[3], double minarea2, double * n, double &off)
+{
+    double e1[3], e2[3], len;
+
+    for(int a = 0; a < 3; a++)
+    {
+        e1[a] = c[1][a] - c[0][a];
+        e2[a] = c[2][a] - c[0][a];
+    }
+    cross3(e1, e2, n);
+    len = sqrt(dot3(n, n));
+    if(len <= minarea2)
+        return false;
+    for(int a = 0; a < 3; a++)
+        n[a] /= len;
+    off = dot3(n, c[0]);
+    return true;
+}
+
+/// Test whether a piece of the first operand, or of the second, belongs in the result of an operation
+static bool keepPiece(int side, int op, PieceSide ps)
+{
+    if(side == 0)
+    {
+        switch(op)
+        {
+            case 0: return ps == PieceSide::OUTSIDE || ps == PieceSide::SAME;
+            case 1: return ps == PieceSide::INSIDE || ps == PieceSide::SAME;
+            default: return ps == PieceSide::OUTSIDE || ps == PieceSide::OPPOSITE;
+        }
+    }
+    // faces shared with the first operand are kept from there
+    return (op == 0) ? ps == PieceSide::OUTSIDE : ps == PieceSide::INSIDE;
+}
+
+static int findRoot(vector<int> &parent, int i)
+{
+    while(parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void MeshBoolean::findCuts()
+{
+    vector<pair<int, int>> pairs;
+    vector<char> crossing;
+    int p, side;
+
+    ops[0].bvh.overlapPairs(ops[1].bvh, (float) tol, pairs);
+    crossing.resize(pairs.size());
+
+    // discard pairs in which either triangle lies clear of the plane of the other
+    #pragma omp parallel for schedule(static)
+    for(p = 0; p < (int) pairs.size(); p++)
+    {
+        int tri[2] = {pairs[p].first, pairs[p].second};
+        bool cross = true;
+
+        for(int s = 0; s < 2 && cross; s++)
+        {
+            double c[3][3], d[3][3], n[3], off, dist;
+            int above = 0, below = 0;
+
+            for(int k = 0; k < 3; k++)
+            {
+                toDouble((* ops[s].verts)[(* ops[s].faces)[3*tri[s]+k]], c[k]);
+                toDouble((* ops[1-s].verts)[(* ops[1-s].faces)[3*tri[1-s]+k]], d[k]);
+            }
+            if(!trianglePlane(d, tol * tol, n, off))
+                continue;
+            for(int k = 0; k < 3; k++)
+            {
+                dist = dot3(n, c[k]) - off;
+                above += (dist > tol);
+                below += (dist < -tol);
+            }
+            cross = (above < 3 && below < 3);
+        }
+        crossing[p] = cross;
+    }
+
+    // gather the pairs by triangle on each side, in pair order
+    for(side = 0; side < 2; side++)
+    {
+        BoolOperand &o = ops[side];
+        int ntris = (int) o.faces->size() / 3;
+        vector<int> fill;
+
+        o.cutstart.assign(ntris + 1, 0);
+        for(p = 0; p < (int) pairs.size(); p++)
+            if(crossing[p])
+                o.cutstart[(side == 0 ? pairs[p].first : pairs[p].second) + 1]++;
+        for(int t = 0; t < ntris; t++)
+            o.cutstart[t+1] += o.cutstart[t];
+        o.cuts.resize(o.cutstart[ntris]);
+        fill.assign(o.cutstart.begin(), o.cutstart.end() - 1);
+        for(p = 0; p < (int) pairs.size(); p++)
+            if(crossing[p])
+            {
+                if(side == 0)
+                    o.cuts[fill[pairs[p].first]++] = pairs[p].second;
+                else
+                    o.cuts[fill[pairs[p].second]++] = pairs[p].first;
+            }
+    }
+}
+
+void MeshBoolean::splitTriangle(int side, int t, vector<BoolPiece> &polys, vector<BoolEdgePoint> &edgepts) const
+{
+    const BoolOperand &o = ops[side], &other = ops[1-side];
+    double c[3][3], n[3], off;
+    vector<BoolPiece> next;
+    BoolPiece first;
+
+    for(int k = 0; k < 3; k++)
+        toDouble((* o.verts)[(* o.faces)[3*t+k]], c[k]);
+    polys.clear();
+    if(!trianglePlane(c, tol * tol, n, off)) // degenerate triangles cover no area
+        return;
+
+    for(int k = 0; k < 3; k++)
+    {
+        BoolVert v;
+        for(int a = 0; a < 3; a++)
+            v.p[a] = c[k][a];
+        v.onedge = (1 << k) | (1 << ((k + 2) % 3));
+        first.verts.push_back(v);
+    }
+    first.side = PieceSide::OUTSIDE;
+    polys.push_back(first);
+
+    // split every piece by a plane, keeping the halves with their piece's side
+    auto splitBy = [&](const double * pn, double poff)
+    {
+        next.clear();
+        for(BoolPiece &piece: polys)
+        {
+            int nv = (int) piece.verts.size();
+            vector<double> s(nv);
+            bool pos = false, neg = false;
+
+            for(int i = 0; i < nv; i++)
+            {
+                s[i] = dot3(pn, piece.verts[i].p) - poff;
+                if(fabs(s[i]) <= tol)
+                    s[i] = 0.0;
+                pos = pos || s[i] > 0.0;
+                neg = neg || s[i] < 0.0;
+            }
+            if(!pos || !neg)
+            {
+                next.push_back(std::move(piece));
+                continue;
+            }
+
+            BoolPiece halves[2];
+            for(int h = 0; h < 2; h++)
+                halves[h].side = piece.side;
+            for(int i = 0; i < nv; i++)
+            {
+                const BoolVert &v = piece.verts[i], &w = piece.verts[(i+1)%nv];
+                double sv = s[i], sw = s[(i+1)%nv];
+
+                if(sv >= 0.0)
+                    halves[0].verts.push_back(v);
+                if(sv <= 0.0)
+                    halves[1].verts.push_back(v);
+                if((sv > 0.0 && sw < 0.0) || (sv < 0.0 && sw > 0.0))
+                {
+                    BoolVert x;
+                    x.onedge = v.onedge & w.onedge;
+                    if(x.onedge != 0)
+                    {
+                        // crossings of an original edge are found from its end points in a fixed order, so every
+                        // triangle sharing the edge and cut by the same plane places the crossing identically
+                        int k = (x.onedge & 1) ? 0 : ((x.onedge & 2) ? 1 : 2);
+                        int a = (* o.faces)[3*t+k], b = (* o.faces)[3*t+(k+1)%3];
+                        double plo[3], phi[3], slo, shi, et;
+                        BoolEdgePoint ep;
+
+                        toDouble((* o.verts)[std::min(a, b)], plo);
+                        toDouble((* o.verts)[std::max(a, b)], phi);
+                        slo = dot3(pn, plo) - poff;
+                        shi = dot3(pn, phi) - poff;
+                        et = std::min(1.0, std::max(0.0, slo / (slo - shi)));
+                        for(int d = 0; d < 3; d++)
+                            x.p[d] = plo[d] + et * (phi[d] - plo[d]);
+                        ep.key = edgeKey(a, b);
+                        ep.t = et;
+                        for(int d = 0; d < 3; d++)
+                            ep.p[d] = x.p[d];
+                        edgepts.push_back(ep);
+                    }
+                    else
+                    {
+                        double f = sv / (sv - sw);
+                        for(int d = 0; d < 3; d++)
+                            x.p[d] = v.p[d] + f * (w.p[d] - v.p[d]);
+                    }
+                    halves[0].verts.push_back(x);
+                    halves[1].verts.push_back(x);
+                }
+            }
+            for(int h = 0; h < 2; h++)
+                if((int) halves[h].verts.size() >= 3)
+                    next.push_back(std::move(halves[h]));
+        }
+        polys.swap(next);
+    };
+
+    for(int u = o.cutstart[t]; u < o.cutstart[t+1]; u++)
+    {
+        double d[3][3], m[3], moff, dist;
+        bool coplanar = true;
+
+        for(int k = 0; k < 3; k++)
+            toDouble((* other.verts)[(* other.faces)[3*o.cuts[u]+k]], d[k]);
+        if(!trianglePlane(d, tol * tol, m, moff))
+            continue;
+        for(int k = 0; k < 3; k++)
+        {
+            dist = dot3(m, c[k]) - moff;
+            coplanar = coplanar && fabs(dist) <= tol;
+        }
+
+        if(!coplanar)
+        {
+            splitBy(m, moff);
+            continue;
+        }
+
+        // a coplanar triangle splits by its edges, and the pieces within it lie on the other surface
+        double en[3][3], eoff[3];
+        for(int k = 0; k < 3; k++)
+        {
+            double e[3], len;
+            for(int a = 0; a < 3; a++)
+                e[a] = d[(k+1)%3][a] - d[k][a];
+            cross3(m, e, en[k]);
+            len = sqrt(dot3(en[k], en[k]));
+            for(int a = 0; a < 3; a++)
+                en[k][a] /= len;
+            eoff[k] = dot3(en[k], d[k]);
+            splitBy(en[k], eoff[k]);
+        }
+        for(BoolPiece &piece: polys)
+        {
+            double cent[3] = {0.0, 0.0, 0.0};
+            bool within = true;
+
+            if(piece.side != PieceSide::OUTSIDE)
+                continue;
+            for(const BoolVert &v: piece.verts)
+                for(int a = 0; a < 3; a++)
+                    cent[a] += v.p[a] / (double) piece.verts.size();
+            for(int k = 0; k < 3; k++)
+                within = within && dot3(en[k], cent) - eoff[k] > 0.0;
+            if(within)
+                piece.side = (dot3(n, m) > 0.0) ? PieceSide::SAME : PieceSide::OPPOSITE;
+        }
+    }
+}
+
+PieceSide MeshBoolean::classify(int side, const double * c) const
+{
+    cgp::Point pnt((float) c[0], (float) c[1], (float) c[2]);
+
+    return (ops[1-side].winding.windingNumber(pnt) > 0.5f) ? PieceSide::INSIDE : PieceSide::OUTSIDE;
+}
+
+void MeshBoolean::classifyUncut(int side)
+{
+    BoolOperand &o = ops[side];
+    int ntris = (int) o.faces->size() / 3, t, k, r;
+    vector<pair<uint64_t, int>> edges;
+    vector<int> parent(ntris), roots;
+    vector<PieceSide> rootside(ntris, PieceSide::OUTSIDE);
+
+    // join triangles without cuts that share an edge, since no region of them crosses the other surface
+    for(t = 0; t < ntris; t++)
+    {
+        parent[t] = t;
+        if(o.cutstart[t] == o.cutstart[t+1])
+            for(k = 0; k < 3; k++)
+                edges.push_back(std::make_pair(edgeKey((* o.faces)[3*t+k], (* o.faces)[3*t+(k+1)%3]), t));
+    }
+    std::sort(edges.begin(), edges.end());
+    for(int e = 1; e < (int) edges.size(); e++)
+        if(edges[e].first == edges[e-1].first)
+        {
+            int ra = findRoot(parent, edges[e-1].second), rb = findRoot(parent, edges[e].second);
+            if(ra != rb)
+                parent[std::max(ra, rb)] = std::min(ra, rb);
+        }
+    for(t = 0; t < ntris; t++)
+        if(o.cutstart[t] == o.cutstart[t+1] && findRoot(parent, t) == t)
+            roots.push_back(t);
+
+    // one winding query per region, at the centroid of its first triangle
+    #pragma omp parallel for schedule(dynamic)
+    for(r = 0; r < (int) roots.size(); r++)
+    {
+        double cent[3] = {0.0, 0.0, 0.0}, p[3];
+
+        for(int j = 0; j < 3; j++)
+        {
+            toDouble((* o.verts)[(* o.faces)[3*roots[r]+j]], p);
+            for(int a = 0; a < 3; a++)
+                cent[a] += p[a] / 3.0;
+        }
+        rootside[roots[r]] = classify(side, cent);
+    }
+
+    o.uncut.assign(ntris, PieceSide::OUTSIDE);
+    for(t = 0; t < ntris; t++)
+        if(o.cutstart[t] == o.cutstart[t+1])
+            o.uncut[t] = rootside[findRoot(parent, t)];
+}
+
+double MeshBoolean::edgeParam(int side, uint64_t key, const double * p) const
+{
+    double plo[3], phi[3], e[3], q[3];
+
+    toDouble((* ops[side].verts)[(int) (key >> 32)], plo);
+    toDouble((* ops[side].verts)[(int) (key & 0xffffffffu)], phi);
+    for(int a = 0; a < 3; a++)
+    {
+        e[a] = phi[a] - plo[a];
+        q[a] = p[a] - plo[a];
+    }
+    return dot3(q, e) / std::max(dot3(e, e), 1.0e-300);
+}
+
+void MeshBoolean::emitPiece(int side, int t, const vector<BoolVert> * poly, bool flip, vector<cgp::Point> &out) const
+{
+    const BoolOperand &o = ops[side];
+    vector<BoolVert> tri;
+    vector<cgp::Point> bound;
+    bool inserted = false;
+
+    auto keyRange = [&](uint64_t key)
+    {
+        BoolEdgePoint probe;
+        probe.key = key;
+        return std::equal_range(o.edgepts.begin(), o.edgepts.end(), probe,
+                                [](const BoolEdgePoint &a, const BoolEdgePoint &b){ return a.key < b.key; });
+    };
+
+    if(poly == NULL)
+    {
+        for(int k = 0; k < 3; k++)
+        {
+            BoolVert v;
+            toDouble((* o.verts)[(* o.faces)[3*t+k]], v.p);
+            v.onedge = (1 << k) | (1 << ((k + 2) % 3));
+            tri.push_back(v);
+        }
+        poly = &tri;
+    }
+
+    int nv = (int) poly->size();
+    for(int i = 0; i < nv; i++)
+    {
+        const BoolVert &v = (* poly)[i], &w = (* poly)[(i+1)%nv];
+        int common = v.onedge & w.onedge;
+        double vp[3] = {v.p[0], v.p[1], v.p[2]};
+
+        // a cut point on a single edge takes the position registered for it, which every triangle on the edge shares
+        if(v.onedge == 1 || v.onedge == 2 || v.onedge == 4)
+        {
+            int k = v.onedge >> 1;
+            uint64_t key = edgeKey((* o.faces)[3*t+k], (* o.faces)[3*t+(k+1)%3]);
+            auto range = keyRange(key);
+            double vt = edgeParam(side, key, v.p), best = HUGE_VAL;
+
+            for(auto e = range.first; e != range.second; e++)
+            {
+                double dist = sqrt(pow(e->p[0] - v.p[0], 2) + pow(e->p[1] - v.p[1], 2) + pow(e->p[2] - v.p[2], 2));
+                if(dist <= tol && fabs(e->t - vt) < best)
+                {
+                    best = fabs(e->t - vt);
+                    for(int a = 0; a < 3; a++)
+                        vp[a] = e->p[a];
+                }
+            }
+        }
+        bound.push_back(cgp::Point((float) vp[0], (float) vp[1], (float) vp[2]));
+
+        // cut points that other triangles placed along this stretch of edge
+        if(common != 0)
+        {
+            int k = (common & 1) ? 0 : ((common & 2) ? 1 : 2);
+            uint64_t key = edgeKey((* o.faces)[3*t+k], (* o.faces)[3*t+(k+1)%3]);
+            auto range = keyRange(key);
+            double ta = edgeParam(side, key, v.p), tb = edgeParam(side, key, w.p), ex[3];
+            double lo = std::min(ta, tb), hi = std::max(ta, tb);
+            vector<cgp::Point> between;
+
+            for(int a = 0; a < 3; a++)
+                ex[a] = w.p[a] - v.p[a];
+            double eps = (hi > lo) ? tol / sqrt(dot3(ex, ex)) * (hi - lo) : 0.0;
+
+            for(auto e = range.first; e != range.second; e++)
+                if(e->t > lo + eps && e->t < hi - eps)
+                    between.push_back(cgp::Point((float) e->p[0], (float) e->p[1], (float) e->p[2]));
+            if(ta > tb)
+                std::reverse(between.begin(), between.end());
+            inserted = inserted || !between.empty();
+            bound.insert(bound.end(), between.begin(), between.end());
+        }
+    }
+
+    // pieces are convex, so a fan covers them, from the centroid if inserted points line their edges
+    int nb = (int) bound.size();
+    cgp::Point cent(0.0f, 0.0f, 0.0f);
+    if(inserted)
+    {
+        double sum[3] = {0.0, 0.0, 0.0};
+        for(const cgp::Point &p: bound)
+        {
+            sum[0] += p.x; sum[1] += p.y; sum[2] += p.z;
+        }
+        cent = cgp::Point((float) (sum[0] / nb), (float) (sum[1] / nb), (float) (sum[2] / nb));
+    }
+    for(int i = inserted ? 0 : 1; i < (inserted ? nb : nb - 1); i++)
+    {
+        cgp::Point c[3] = {inserted ? cent : bound[0], bound[i], bound[(i+1)%nb]};
+        double d[3][3], n[3], off;
+
+        for(int k = 0; k < 3; k++)
+            toDouble(c[k], d[k]);
+        if(!trianglePlane(d, tol * tol, n, off))
+            continue;
+        out.push_back(c[0]);
+        out.push_back(flip ? c[2] : c[1]);
+        out.push_back(flip ? c[1] : c[2]);
+    }
+}
+
+int MeshBoolean::repairJunctions(vector<cgp::Point> &verts, vector<int> &faces) const
+{
+    int ntris = (int) faces.size() / 3, split = 0;
+    vector<uint64_t> directed(faces.size());
+    vector<pair<int, int>> open;        // triangle and corner starting each unmatched edge
+    vector<pair<float, int>> ends;      // x coordinate and index of each vertex on an unmatched edge
+    vector<vector<pair<double, int>>> inserts(3);
+    vector<int> added;
+
+    for(int t = 0; t < ntris; t++)
+        for(int k = 0; k < 3; k++)
+            directed[3*t+k] = ((uint64_t) (uint32_t) faces[3*t+k] << 32) | (uint32_t) faces[3*t+(k+1)%3];
+    std::sort(directed.begin(), directed.end());
+
+    // an edge is matched when some triangle runs along it the other way
+    for(int t = 0; t < ntris; t++)
+        for(int k = 0; k < 3; k++)
+        {
+            uint64_t rev = ((uint64_t) (uint32_t) faces[3*t+(k+1)%3] << 32) | (uint32_t) faces[3*t+k];
+            if(!std::binary_search(directed.begin(), directed.end(), rev))
+            {
+                open.push_back(std::make_pair(t, k));
+                ends.push_back(std::make_pair(verts[faces[3*t+k]].x, faces[3*t+k]));
+                ends.push_back(std::make_pair(verts[faces[3*t+(k+1)%3]].x, faces[3*t+(k+1)%3]));
+            }
+        }
+    std::sort(ends.begin(), ends.end());
+    ends.erase(std::unique(ends.begin(), ends.end()), ends.end());
+
+    for(int e = 0; e < (int) open.size(); )
+    {
+        int t = open[e].first, c[3];
+        bool any = false;
+
+        for(int k = 0; k < 3; k++)
+        {
+            c[k] = faces[3*t+k];
+            inserts[k].clear();
+        }
+
+        // vertices of other unmatched edges that lie along the unmatched edges of this triangle
+        for(; e < (int) open.size() && open[e].first == t; e++)
+        {
+            int k = open[e].second;
+            double a[3], b[3], ab[3], len2;
+
+            toDouble(verts[c[k]], a);
+            toDouble(verts[c[(k+1)%3]], b);
+            for(int d = 0; d < 3; d++)
+                ab[d] = b[d] - a[d];
+            len2 = dot3(ab, ab);
+            if(len2 <= tol * tol)
+                continue;
+            auto first = std::lower_bound(ends.begin(), ends.end(), std::make_pair((float) (std::min(a[0], b[0]) - tol), INT_MIN));
+            for(auto v = first; v != ends.end() && v->first <= std::max(a[0], b[0]) + tol; v++)
+            {
+                double p[3], ap[3], s, dist2 = 0.0;
+
+                if(v->second == c[k] || v->second == c[(k+1)%3])
+                    continue;
+                toDouble(verts[v->second], p);
+                for(int d = 0; d < 3; d++)
+                    ap[d] = p[d] - a[d];
+                s = dot3(ap, ab) / len2;
+                if(s * s * len2 <= tol * tol || (1.0 - s) * (1.0 - s) * len2 <= tol * tol || s < 0.0 || s > 1.0)
+                    continue;
+                for(int d = 0; d < 3; d++)
+                    dist2 += (ap[d] - s * ab[d]) * (ap[d] - s * ab[d]);
+                if(dist2 <= tol * tol)
+                    inserts[k].push_back(std::make_pair(s, v->second));
+            }
+            std::sort(inserts[k].begin(), inserts[k].end());
+            any = any || !inserts[k].empty();
+        }
+        if(!any)
+            continue;
+
+        // replace the triangle by a fan over its boundary, from the corner opposite a single split edge and from a
+        // new centroid otherwise
+        vector<int> bound;
+        int single = -1, numsplit = 0;
+        for(int k = 0; k < 3; k++)
+        {
+            bound.push_back(c[k]);
+            for(auto &ins: inserts[k])
+                bound.push_back(ins.second);
+            if(!inserts[k].empty())
+            {
+                single = k;
+                numsplit++;
+            }
+        }
+        int nb = (int) bound.size(), apex, start;
+        if(numsplit == 1)
+        {
+            apex = c[(single+2)%3];
+            start = (int) (std::find(bound.begin(), bound.end(), c[single]) - bound.begin());
+            for(int i = 0; i < (int) inserts[single].size() + 1; i++)
+            {
+                int tri[3] = {apex, bound[(start+i)%nb], bound[(start+i+1)%nb]};
+                for(int k = 0; k < 3; k++)
+                    added.push_back(tri[k]);
+            }
+        }
+        else
+        {
+            double sum[3] = {0.0, 0.0, 0.0};
+            for(int v: bound)
+            {
+                sum[0] += verts[v].x; sum[1] += verts[v].y; sum[2] += verts[v].z;
+            }
+            apex = (int) verts.size();
+            verts.push_back(cgp::Point((float) (sum[0] / nb), (float) (sum[1] / nb), (float) (sum[2] / nb)));
+            for(int i = 0; i < nb; i++)
+            {
+                int tri[3] = {apex, bound[i], bound[(i+1)%nb]};
+                for(int k = 0; k < 3; k++)
+                    added.push_back(tri[k]);
+            }
+        }
+        faces[3*t] = -1; // removed below
+        split++;
+    }
+
+    if(split > 0)
+    {
+        int kept = 0;
+        for(int t = 0; t < ntris; t++)
+            if(faces[3*t] >= 0)
+            {
+                for(int k = 0; k < 3; k++)
+                    faces[3*kept+k] = faces[3*t+k];
+                kept++;
+            }
+        faces.resize(3 * kept);
+        faces.insert(faces.end(), added.begin(), added.end());
+    }
+    return split;
+}
+
+bool MeshBoolean::apply(const vector<cgp::Point> &averts, const vector<int> &afaces, const vector<cgp::Point> &bverts,
+                        const vector<int> &bfaces, int op, vector<cgp::Point> &outverts, vector<int> &outfaces)
+{
+    cgp::BoundBox bbox;
+    VertexWelder welder;
+    vector<cgp::Point> soup;
+    vector<int> remap;
+    int side, t;
+
+    outverts.clear();
+    outfaces.clear();
+    if(op < 0 || op > 2)
+    {
+        cerr << "Error MeshBoolean::apply: unknown set operation " << op << endl;
+        return false;
+    }
+    if(afaces.empty() || bfaces.empty())
+    {
+        cerr << "Error MeshBoolean::apply: operand has no triangles" << endl;
+        return false;
+    }
+
+    ops[0].verts = &averts; ops[0].faces = &afaces;
+    ops[1].verts = &bverts; ops[1].faces = &bfaces;
+    bbox.reset();
+    bbox.includePnts(averts.data(), averts.size());
+    bbox.includePnts(bverts.data(), bverts.size());
+    tol = boolreltol * std::max((double) bbox.diagLen(), 1.0e-30);
+
+    for(side = 0; side < 2; side++)
+    {
+        ops[side].bvh.build(* ops[side].verts, * ops[side].faces);
+        ops[side].winding.build(* ops[side].verts, * ops[side].faces);
+    }
+    findCuts();
+
+    for(side = 0; side < 2; side++)
+    {
+        BoolOperand &o = ops[side];
+        int ntris = (int) o.faces->size() / 3;
+        vector<vector<BoolEdgePoint>> tripts(ntris);
+
+        // split and classify the triangles with cuts
+        o.pieces.assign(ntris, vector<BoolPiece>());
+        #pragma omp parallel for schedule(dynamic, 16)
+        for(t = 0; t < ntris; t++)
+            if(o.cutstart[t] < o.cutstart[t+1])
+            {
+                splitTriangle(side, t, o.pieces[t], tripts[t]);
+                for(BoolPiece &piece: o.pieces[t])
+                    if(piece.side == PieceSide::OUTSIDE)
+                    {
+                        double cent[3] = {0.0, 0.0, 0.0};
+                        for(const BoolVert &v: piece.verts)
+                            for(int a = 0; a < 3; a++)
+                                cent[a] += v.p[a] / (double) piece.verts.size();
+                        piece.side = classify(side, cent);
+                    }
+            }
+
+        // register the edge cuts, merging those closer than the tolerance
+        o.edgepts.clear();
+        for(t = 0; t < ntris; t++)
+            o.edgepts.insert(o.edgepts.end(), tripts[t].begin(), tripts[t].end());
+        std::sort(o.edgepts.begin(), o.edgepts.end());
+        int kept = 0;
+        for(int e = 0; e < (int) o.edgepts.size(); e++)
+        {
+            const BoolEdgePoint &ep = o.edgepts[e];
+            if(kept > 0 && o.edgepts[kept-1].key == ep.key)
+            {
+                const BoolEdgePoint &last = o.edgepts[kept-1];
+                double dist = sqrt(pow(ep.p[0] - last.p[0], 2) + pow(ep.p[1] - last.p[1], 2) + pow(ep.p[2] - last.p[2], 2));
+                if(dist <= tol)
+                    continue;
+            }
+            o.edgepts[kept++] = ep;
+        }
+        o.edgepts.resize(kept);
+
+        classifyUncut(side);
+    }
+
+    // write out the kept pieces in parallel chunks, joined in triangle order
+    for(side = 0; side < 2; side++)
+    {
+        const BoolOperand &o = ops[side];
+        int ntris = (int) o.faces->size() / 3, numchunks = (ntris + boolchunk - 1) / boolchunk;
+        bool flip = (side == 1 && op == 2);
+        vector<vector<cgp::Point>> chunks(numchunks);
+
+        #pragma omp parallel for schedule(dynamic)
+        for(int c = 0; c < numchunks; c++)
+            for(int tc = c * boolchunk; tc < std::min(ntris, (c + 1) * boolchunk); tc++)
+            {
+                if(o.cutstart[tc] == o.cutstart[tc+1])
+                {
+                    if(keepPiece(side, op, o.uncut[tc]))
+                        emitPiece(side, tc, NULL, flip, chunks[c]);
+                }
+                else
+                {
+                    for(const BoolPiece &piece: o.pieces[tc])
+                        if(keepPiece(side, op, piece.side))
+                            emitPiece(side, tc, &piece.verts, flip, chunks[c]);
+                }
+            }
+        for(int c = 0; c < numchunks; c++)
+            soup.insert(soup.end(), chunks[c].begin(), chunks[c].end());
+    }
+
+    // join the pieces, dropping triangles that collapse, then close any remaining junctions
+    welder.weld(soup, (float) tol, remap, outverts);
+    for(t = 0; t < (int) soup.size(); t += 3)
+        if(remap[t] != remap[t+1] && remap[t+1] != remap[t+2] && remap[t+2] != remap[t])
+            for(int k = 0; k < 3; k++)
+                outfaces.push_back(remap[t+k]);
+    repairJunctions(outverts, outfaces);
+
+    // the operands belong to the caller
+    for(side = 0; side < 2; side++)
+    {
+        ops[side].bvh.clear();
+        ops[side].winding.clear();
+        ops[side].pieces.clear();
+        ops[side].edgepts.clear();
+        ops[side].verts = NULL;
+        ops[side].faces = NULL;
+    }
+    return true;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file
+ *
+ * Set operations computed directly on the surfaces of closed triangle meshes, without passing through a voxel volume
+ */
+
+#ifndef _MESHBOOL
+#define _MESHBOOL
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "vecpnt.h"
+#include "bvh.h"
+#include "winding.h"
+#include "weld.h"
+
+const double boolreltol = 1.0e-5;   ///< distance from a plane, as a fraction of the diagonal of both operands, within which a point lies on it
+const int boolchunk = 4096;         ///< triangles per parallel chunk when writing out the result
+
+/// Where a piece of one operand lies relative to the other operand
+enum class PieceSide
+{
+    INSIDE,     ///< strictly inside the other operand
+    OUTSIDE,    ///< strictly outside the other operand
+    SAME,       ///< on the surface of the other operand, facing the same way
+    OPPOSITE    ///< on the surface of the other operand, facing the other way
+};
+
+/**
+ * A vertex of a piece of a triangle being split, with the edges of the original triangle it lies on
+ */
+struct BoolVert
+{
+    double p[3];    ///< position
+    int onedge;     ///< bit k set if the vertex lies on edge k of the triangle, which runs from corner k to corner k+1
+};
+
+/**
+ * A convex piece of a triangle being split
+ */
+struct BoolPiece
+{
+    std::vector<BoolVert> verts;    ///< boundary, counterclockwise as for the triangle
+    PieceSide side;                 ///< SAME or OPPOSITE if the piece lies on a coplanar triangle of the other operand, else OUTSIDE until classified
+};
+
+/**
+ * A point at which a cut crosses an edge of an operand, which every triangle sharing the edge must include
+ */
+struct BoolEdgePoint
+{
+    uint64_t key;   ///< vertex indices of the edge, lower index in the upper 32 bits
+    double t;       ///< position along the edge from the lower to the higher indexed vertex, between 0 and 1
+    double p[3];    ///< position
+
+    bool operator<(const BoolEdgePoint &other) const { return key < other.key || (key == other.key && t < other.t); }
+};
+
+/**
+ * One side of a set operation, with its acceleration structures and the triangles of the other side crossing it
+ */
+struct BoolOperand
+{
+    const std::vector<cgp::Point> * verts;      ///< world space vertices
+    const std::vector<int> * faces;             ///< three vertex indices per triangle
+    BVH bvh;                                    ///< hierarchy over the triangles, for pairing and distance queries
+    WindingTree winding;                        ///< winding number hierarchy, for inside tests
+    std::vector<int> cutstart;                  ///< first entry in cuts for each triangle, with the total at the end
+    std::vector<int> cuts;                      ///< triangles of the other operand that may cross each triangle
+    std::vector<std::vector<BoolPiece>> pieces; ///< convex pieces of each triangle with cuts
+    std::vector<PieceSide> uncut;               ///< classification of each triangle without cuts
+    std::vector<BoolEdgePoint> edgepts;         ///< points where cuts cross edges, sorted by edge and position
+};
+
+/**
+ * Union, intersection and difference of closed, consistently wound triangle meshes. Triangles of each operand that
+ * may cross the other are found by descending both bounding volume hierarchies together. Each such triangle is
+ * split into convex pieces by the planes of the triangles crossing it, and by the edge planes of coplanar ones,
+ * so no piece crosses the other surface. Pieces lying on a coplanar triangle take its orientation, so that shared
+ * faces are kept once; other pieces, and connected regions of triangles without cuts, are classified by the winding
+ * number of the other operand. Cut points on shared edges are inserted into every triangle using the edge, and the
+ * welded result is split wherever the two operands placed different vertices along an intersection curve, so that
+ * the pieces join without T-junctions.
+ *
+ * Positions are split in double precision with a tolerance relative to the size of the operands, so the result is
+ * robust for the near-coincident input typical of csg scenes but not exact. The cost grows with the number of
+ * crossing triangles, plus a winding query per unsplit region, rather than with any voxel count.
+ */
+class MeshBoolean
+{
+private:
+    BoolOperand ops[2];     ///< first and second operand
+    double tol;             ///< distance within which points lie on a plane
+
+    /// Pair the triangles of the two operands that may cross, and record the pairs with each triangle
+    void findCuts();
+
+    /**
+     * Split a triangle into convex pieces by the planes of the triangles crossing it
+     * @param side          operand holding the triangle
+     * @param t             triangle index
+     * @param[out] polys    convex pieces
+     * @param[out] edgepts  points where the pieces meet the edges of the triangle
+     */
+    void splitTriangle(int side, int t, std::vector<BoolPiece> &polys, std::vector<BoolEdgePoint> &edgepts) const;
+
+    /**
+     * Classify a point of one operand that is clear of the other operand's surface
+     * @param side  operand holding the point
+     * @param c     point
+     * @returns INSIDE or OUTSIDE the other operand
+     */
+    PieceSide classify(int side, const double * c) const;
+
+    /// Classify the triangles of an operand without cuts, a connected region at a time
+    void classifyUncut(int side);
+
+    /**
+     * Position of a point along an edge of an operand
+     * @param side  operand
+     * @param key   edge, as for BoolEdgePoint
+     * @param p     point on the edge
+     * @returns parameter from the lower to the higher indexed vertex
+     */
+    double edgeParam(int side, uint64_t key, const double * p) const;
+
+    /**
+     * Triangulate a convex piece, with the cut points on the edges of its triangle inserted
+     * @param side      operand holding the piece
+     * @param t         triangle the piece came from
+     * @param poly      piece boundary, or NULL for the whole triangle
+     * @param flip      reverse the winding of the output
+     * @param[out] out  three corners per output triangle, appended
+     */
+    void emitPiece(int side, int t, const std::vector<BoolVert> * poly, bool flip, std::vector<cgp::Point> &out) const;
+
+    /**
+     * Split triangles at vertices lying on their unmatched edges, where the cuts of the two operands placed different
+     * vertices along a shared intersection curve
+     * @param verts         welded vertices
+     * @param[in,out] faces three vertex indices per triangle
+     * @returns number of triangles split
+     */
+    int repairJunctions(std::vector<cgp::Point> &verts, std::vector<int> &faces) const;
+
+public:
+
+    /// Default constructor
+    MeshBoolean(){ tol = 0.0; }
+
+    /**
+     * Apply a set operation
+     * @param averts, afaces    first operand, in world space with three vertex indices per triangle
+     * @param bverts, bfaces    second operand
+     * @param op                0 for union, 1 for intersection and 2 for difference, as for VoxelVolume::unionWith,
+     *                          intersectWith and subtract
+     * @param[out] outverts     vertices of the result, welded to within the tolerance
+     * @param[out] outfaces     three indices into @a outverts per result triangle, counterclockwise seen from outside
+     * @retval true if the operation was applied,
+     * @retval false if an operand is empty or the operation is unknown
+     */
+    bool apply(const std::vector<cgp::Point> &averts, const std::vector<int> &afaces, const std::vector<cgp::Point> &bverts,
+               const std::vector<int> &bfaces, int op, std::vector<cgp::Point> &outverts, std::vector<int> &outfaces);
+};
+
+#endif
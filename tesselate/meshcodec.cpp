@@ -0,0 +1,501 @@
+//
+// MeshCodec
+//
+
+#include "meshcodec.h"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+/// Map a signed value to an unsigned one, interleaving positive and negative so that small magnitudes stay small
+static inline uint32_t zigzag(int32_t val)
+{
+    return ((uint32_t) val << 1) ^ (uint32_t) (val >> 31);
+}
+
+/// Inverse of zigzag
+static inline int32_t unzigzag(uint32_t val)
+{
+    return (int32_t) (val >> 1) ^ -(int32_t) (val & 1);
+}
+
+/// Append a value seven bits at a time, least significant first, with the top bit of each byte marking continuation
+static inline void putVarint(std::vector<uint8_t> &out, uint32_t val)
+{
+    while(val >= 0x80)
+    {
+        out.push_back((uint8_t) (val | 0x80));
+        val >>= 7;
+    }
+    out.push_back((uint8_t) val);
+}
+
+/**
+ * Read a value written by putVarint
+ * @param[in,out] p     read position, advanced past the value
+ * @param end           end of the readable bytes
+ * @param[out] val      value read
+ * @retval true  if a whole value was read,
+ * @retval false if it runs past @a end or is too long
+ */
+static inline bool getVarint(const uint8_t * &p, const uint8_t * end, uint32_t &val)
+{
+    uint32_t result = 0;
+
+    for(int shift = 0; shift < 35 && p < end; shift += 7)
+    {
+        uint8_t byte = * p++;
+        result |= (uint32_t) (byte & 0x7f) << shift;
+        if(byte < 0x80)
+        {
+            val = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Number of blocks of @a blocklen items needed for @a n items, without overflow for any header values
+static inline int blockCount(int n, int blocklen)
+{
+    return (int) (((int64_t) n + blocklen - 1) / blocklen);
+}
+
+/**
+ * Project a normal onto the octahedron and unfold the lower half over the upper, giving two coordinates in [-1,1]
+ * @param n         normal, which need not be of unit length
+ * @param maxq      quantised value of coordinate 1
+ * @param[out] qu, qv   quantised coordinates
+ */
+static inline void octEncode(const cgp::Vector &n, int maxq, int32_t &qu, int32_t &qv)
+{
+    float len = fabsf(n.i) + fabsf(n.j) + fabsf(n.k), u = 0.0f, v = 0.0f, fold;
+
+    if(len > 0.0f)
+    {
+        u = n.i / len;
+        v = n.j / len;
+        if(n.k < 0.0f)
+        {
+            fold = (1.0f - fabsf(v)) * sign(u);
+            v = (1.0f - fabsf(u)) * sign(v);
+            u = fold;
+        }
+    }
+    qu = (int32_t) lroundf(u * (float) maxq);
+    qv = (int32_t) lroundf(v * (float) maxq);
+}
+
+/// Inverse of octEncode, with @a scale the reciprocal of its @a maxq, giving a unit normal
+static inline cgp::Vector octDecode(int32_t qu, int32_t qv, float scale)
+{
+    float u = (float) qu * scale, v = (float) qv * scale, w = 1.0f - fabsf(u) - fabsf(v), fold;
+    cgp::Vector n;
+
+    if(w < 0.0f)
+    {
+        fold = (1.0f - fabsf(v)) * sign(u);
+        v = (1.0f - fabsf(u)) * sign(v);
+        u = fold;
+    }
+    n = cgp::Vector(u, v, w);
+    n.normalize();
+    return n;
+}
+
+/// Recently used edges and vertices, which the encoder and decoder keep identically
+struct CodecHistory
+{
+    int ea[meshcodecfifo], eb[meshcodecfifo];  ///< directed edges, in a ring
+    int vf[meshcodecfifo];                      ///< vertices, in a ring
+    int ehead, vhead;                           ///< next slot of each ring
+
+    CodecHistory() : ehead(0), vhead(0)
+    {
+        std::fill(ea, ea + meshcodecfifo, -1);
+        std::fill(eb, eb + meshcodecfifo, -1);
+        std::fill(vf, vf + meshcodecfifo, -1);
+    }
+
+    /// Edge @a i back from the newest
+    int edgeSlot(int i) const { return (ehead - 1 - i) & (meshcodecfifo - 1); }
+
+    /// Vertex @a i back from the newest
+    int vertex(int i) const { return vf[(vhead - 1 - i) & (meshcodecfifo - 1)]; }
+
+    void pushVertex(int v){ vf[vhead] = v; vhead = (vhead + 1) & (meshcodecfifo - 1); }
+
+    /// Record a triangle, whose neighbours run its edges the other way
+    void pushTriangle(int x, int y, int z)
+    {
+        const int tri[3] = {x, y, z};
+
+        for(int e = 0; e < 3; e++)
+        {
+            ea[ehead] = tri[(e + 1) % 3];
+            eb[ehead] = tri[e];
+            ehead = (ehead + 1) & (meshcodecfifo - 1);
+        }
+    }
+};
+
+static_assert((meshcodecfifo & (meshcodecfifo - 1)) == 0 && meshcodecfifo <= 16, "the rings are indexed by masking and named by nibbles");
+
+void MeshCodec::orderVertices(const int * faces, int numverts, int numtris, int blocklen)
+{
+    int next = 0;
+
+    remap.assign(numverts, -1);
+    order.resize(numverts);
+    blocknext.clear();
+    for(int t = 0; t < numtris; t++)
+    {
+        if(t % blocklen == 0)
+            blocknext.push_back(next);
+        for(int c = 0; c < 3; c++)
+        {
+            int v = faces[3 * t + c];
+            if(remap[v] < 0)
+            {
+                remap[v] = next;
+                order[next++] = v;
+            }
+        }
+    }
+    for(int v = 0; v < numverts; v++)
+        if(remap[v] < 0)
+        {
+            remap[v] = next;
+            order[next++] = v;
+        }
+}
+
+void MeshCodec::encode(const cgp::Point * verts, const cgp::Vector * norms, int numverts, const int * faces, int numtris,
+                       int posbits, int normbits, std::vector<uint8_t> &out)
+{
+    MeshCodecHeader hdr;
+    cgp::BoundBox bbox;
+    int numvblocks, numtblocks, maxpos, maxnorm;
+    float inv[3];
+    size_t tables, pos;
+    uint64_t end = 0;
+
+    posbits = std::min(std::max(posbits, 1), 24);
+    normbits = (norms != NULL) ? std::min(std::max(normbits, 2), 16) : 0;
+    maxpos = (1 << posbits) - 1;
+    maxnorm = (normbits > 0) ? (1 << (normbits - 1)) - 1 : 0;
+    numvblocks = (numverts + meshcodecblock - 1) / meshcodecblock;
+    numtblocks = (numtris + meshcodecblock - 1) / meshcodecblock;
+    orderVertices(faces, numverts, numtris, meshcodecblock);
+
+    memset(&hdr, 0, sizeof(MeshCodecHeader));
+    memcpy(hdr.magic, meshcodecmagic, 4);
+    hdr.version = meshcodecversion;
+    hdr.numverts = numverts;
+    hdr.numtris = numtris;
+    hdr.posbits = posbits;
+    hdr.normbits = normbits;
+    hdr.blocklen = meshcodecblock;
+    for(int v = 0; v < numverts; v++)
+        bbox.includePnt(verts[v]);
+    for(int c = 0; c < 3; c++)
+    {
+        float lo = (numverts > 0) ? (&bbox.min.x)[c] : 0.0f, hi = (numverts > 0) ? (&bbox.max.x)[c] : 0.0f;
+        hdr.origin[c] = lo;
+        hdr.step[c] = (hi > lo) ? (hi - lo) / (float) maxpos : 0.0f;
+        inv[c] = (hdr.step[c] > 0.0f) ? 1.0f / hdr.step[c] : 0.0f;
+    }
+
+    vertblocks.resize(numvblocks);
+    triblocks.resize(numtblocks);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int b = 0; b < numvblocks + numtblocks; b++)
+    {
+        if(b < numvblocks) // positions then normals, each as differences from the vertex before
+        {
+            std::vector<uint8_t> &blk = vertblocks[b];
+            int lo = b * meshcodecblock, hi = std::min(lo + meshcodecblock, numverts);
+            int32_t prev[3] = {0, 0, 0}, prevn[2] = {0, 0}, q[3];
+
+            blk.clear();
+            for(int v = lo; v < hi; v++)
+            {
+                const cgp::Point &p = verts[order[v]];
+                const float coord[3] = {p.x, p.y, p.z};
+                for(int c = 0; c < 3; c++)
+                {
+                    q[c] = std::min(std::max((int32_t) lroundf((coord[c] - hdr.origin[c]) * inv[c]), 0), maxpos);
+                    putVarint(blk, zigzag(q[c] - prev[c]));
+                    prev[c] = q[c];
+                }
+            }
+            for(int v = lo; v < hi && normbits > 0; v++)
+            {
+                octEncode(norms[order[v]], maxnorm, q[0], q[1]);
+                for(int c = 0; c < 2; c++)
+                {
+                    putVarint(blk, zigzag(q[c] - prevn[c]));
+                    prevn[c] = q[c];
+                }
+            }
+        }
+        else // one code byte per triangle, naming a recent edge and how its third vertex is found
+        {
+            int tb = b - numvblocks, lo = tb * meshcodecblock, hi = std::min(lo + meshcodecblock, numtris);
+            std::vector<uint8_t> &blk = triblocks[tb];
+            int next = blocknext[tb], last = next;
+            CodecHistory recent;
+
+            blk.clear();
+            for(int t = lo; t < hi; t++)
+            {
+                int tri[3] = {remap[faces[3 * t]], remap[faces[3 * t + 1]], remap[faces[3 * t + 2]]};
+                int fe = -1, rot = 0, fv = -1;
+
+                for(int r = 0; r < 3 && fe < 0; r++)
+                    for(int i = 0; i < meshcodecfifo - 1; i++)
+                    {
+                        int s = recent.edgeSlot(i);
+                        if(recent.ea[s] == tri[r] && recent.eb[s] == tri[(r + 1) % 3])
+                        {
+                            fe = i;
+                            rot = r;
+                            break;
+                        }
+                    }
+
+                if(fe >= 0)
+                {
+                    int x = tri[rot], y = tri[(rot + 1) % 3], z = tri[(rot + 2) % 3];
+                    tri[0] = x; tri[1] = y; tri[2] = z;
+                    if(z == next)
+                    {
+                        blk.push_back((uint8_t) (fe << 4));
+                        next++;
+                    }
+                    else
+                    {
+                        for(int i = 0; i < meshcodecfifo - 2 && fv < 0; i++)
+                            if(recent.vertex(i) == z)
+                                fv = i;
+                        if(fv >= 0)
+                            blk.push_back((uint8_t) ((fe << 4) | (fv + 1)));
+                        else
+                        {
+                            blk.push_back((uint8_t) ((fe << 4) | 15));
+                            putVarint(blk, zigzag(z - last));
+                            next = std::max(next, z + 1);
+                        }
+                    }
+                }
+                else // no shared edge, as at the start of a block, so every vertex is given
+                {
+                    blk.push_back(0xf0);
+                    for(int c = 0; c < 3; c++)
+                    {
+                        putVarint(blk, zigzag(tri[c] - last));
+                        last = tri[c];
+                        next = std::max(next, tri[c] + 1);
+                    }
+                    recent.pushVertex(tri[0]);
+                    recent.pushVertex(tri[1]);
+                }
+                recent.pushVertex(tri[2]);
+                recent.pushTriangle(tri[0], tri[1], tri[2]);
+                last = tri[2];
+            }
+        }
+    }
+
+    // header, block tables, then the blocks in order
+    tables = sizeof(MeshCodecHeader) + (size_t) (numvblocks + numtblocks) * sizeof(uint64_t) + (size_t) numtblocks * sizeof(int32_t);
+    for(const std::vector<uint8_t> &blk : vertblocks)
+        end += blk.size();
+    for(const std::vector<uint8_t> &blk : triblocks)
+        end += blk.size();
+    out.resize(tables + end);
+    memcpy(&out[0], &hdr, sizeof(MeshCodecHeader));
+    pos = sizeof(MeshCodecHeader);
+    end = 0;
+    for(const std::vector<uint8_t> &blk : vertblocks)
+    {
+        end += blk.size();
+        memcpy(&out[pos], &end, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+    }
+    for(const std::vector<uint8_t> &blk : triblocks)
+    {
+        end += blk.size();
+        memcpy(&out[pos], &end, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+    }
+    for(int tb = 0; tb < numtblocks; tb++)
+    {
+        int32_t start = blocknext[tb];
+        memcpy(&out[pos], &start, sizeof(int32_t));
+        pos += sizeof(int32_t);
+    }
+    for(const std::vector<uint8_t> &blk : vertblocks)
+    {
+        if(!blk.empty())
+            memcpy(&out[pos], blk.data(), blk.size());
+        pos += blk.size();
+    }
+    for(const std::vector<uint8_t> &blk : triblocks)
+    {
+        if(!blk.empty())
+            memcpy(&out[pos], blk.data(), blk.size());
+        pos += blk.size();
+    }
+}
+
+bool MeshCodec::readHeader(const uint8_t * data, size_t len, MeshCodecHeader &hdr)
+{
+    uint64_t numvblocks, numtblocks, tables, least;
+
+    if(len < sizeof(MeshCodecHeader) || memcmp(data, meshcodecmagic, 4) != 0)
+        return false;
+    memcpy(&hdr, data, sizeof(MeshCodecHeader));
+    if(hdr.version != meshcodecversion || hdr.numverts < 0 || hdr.numtris < 0 || hdr.posbits < 1 || hdr.posbits > 24
+       || (hdr.normbits != 0 && (hdr.normbits < 2 || hdr.normbits > 16)) || hdr.blocklen <= 0)
+        return false;
+    numvblocks = (uint64_t) blockCount(hdr.numverts, hdr.blocklen);
+    numtblocks = (uint64_t) blockCount(hdr.numtris, hdr.blocklen);
+    tables = sizeof(MeshCodecHeader) + (numvblocks + numtblocks) * sizeof(uint64_t) + numtblocks * sizeof(int32_t);
+
+    // every vertex takes at least a byte per component and every triangle at least a byte, so counts the blocks
+    // could not hold are refused before anything is sized by them
+    least = (uint64_t) hdr.numverts * (hdr.normbits > 0 ? 5 : 3) + (uint64_t) hdr.numtris;
+    return tables <= (uint64_t) len && least <= (uint64_t) len - tables;
+}
+
+bool MeshCodec::decode(const uint8_t * data, size_t len, cgp::Point * verts, cgp::Vector * norms, int * faces)
+{
+    MeshCodecHeader hdr;
+    int numvblocks, numtblocks;
+    const uint8_t * base;
+    size_t avail;
+    bool ok = true;
+
+    if(!readHeader(data, len, hdr))
+        return false;
+    numvblocks = blockCount(hdr.numverts, hdr.blocklen);
+    numtblocks = blockCount(hdr.numtris, hdr.blocklen);
+    base = data + sizeof(MeshCodecHeader) + (size_t) (numvblocks + numtblocks) * sizeof(uint64_t) + (size_t) numtblocks * sizeof(int32_t);
+    avail = len - (size_t) (base - data);
+
+    #pragma omp parallel for schedule(dynamic, 1) reduction(&&:ok)
+    for(int b = 0; b < numvblocks + numtblocks; b++)
+    {
+        uint64_t start = 0, finish;
+        const uint8_t * p, * end;
+        uint32_t code = 0;
+
+        if(b > 0)
+            memcpy(&start, data + sizeof(MeshCodecHeader) + (size_t) (b - 1) * sizeof(uint64_t), sizeof(uint64_t));
+        memcpy(&finish, data + sizeof(MeshCodecHeader) + (size_t) b * sizeof(uint64_t), sizeof(uint64_t));
+        if(start > finish || finish > avail)
+        {
+            ok = false;
+            continue;
+        }
+        p = base + start;
+        end = base + finish;
+
+        if(b < numvblocks)
+        {
+            int lo = b * hdr.blocklen, hi = lo + std::min(hdr.blocklen, hdr.numverts - lo);
+            int32_t q[3] = {0, 0, 0};
+            bool good = true;
+
+            for(int v = lo; v < hi && good; v++)
+            {
+                for(int c = 0; c < 3 && good; c++)
+                    if((good = getVarint(p, end, code)))
+                        q[c] += unzigzag(code);
+                if(!good) // truncated block, leaving the vertex unwritten
+                    break;
+                verts[v] = cgp::Point(hdr.origin[0] + (float) q[0] * hdr.step[0], hdr.origin[1] + (float) q[1] * hdr.step[1],
+                                      hdr.origin[2] + (float) q[2] * hdr.step[2]);
+            }
+            if(norms != NULL && hdr.normbits > 0)
+            {
+                float scale = 1.0f / (float) ((1 << (hdr.normbits - 1)) - 1);
+                q[0] = q[1] = 0;
+                for(int v = lo; v < hi && good; v++)
+                {
+                    for(int c = 0; c < 2 && good; c++)
+                        if((good = getVarint(p, end, code)))
+                            q[c] += unzigzag(code);
+                    if(!good)
+                        break;
+                    norms[v] = octDecode(q[0], q[1], scale);
+                }
+            }
+            ok = ok && good;
+        }
+        else
+        {
+            int tb = b - numvblocks, lo = tb * hdr.blocklen, hi = lo + std::min(hdr.blocklen, hdr.numtris - lo);
+            int32_t next;
+            int last, tri[3];
+            CodecHistory recent;
+            bool good = true;
+
+            memcpy(&next, data + sizeof(MeshCodecHeader) + (size_t) (numvblocks + numtblocks) * sizeof(uint64_t) + (size_t) tb * sizeof(int32_t), sizeof(int32_t));
+            last = next;
+            for(int t = lo; t < hi && good; t++)
+            {
+                if(p >= end)
+                {
+                    good = false;
+                    break;
+                }
+                uint8_t op = * p++;
+                if((op >> 4) < 15)
+                {
+                    int s = recent.edgeSlot(op >> 4), lower = op & 15;
+                    tri[0] = recent.ea[s];
+                    tri[1] = recent.eb[s];
+                    if(lower == 0)
+                        tri[2] = next++;
+                    else if(lower < 15)
+                        tri[2] = recent.vertex(lower - 1);
+                    else if((good = getVarint(p, end, code)))
+                    {
+                        tri[2] = last + unzigzag(code);
+                        next = std::max(next, tri[2] + 1);
+                    }
+                }
+                else
+                {
+                    for(int c = 0; c < 3 && good; c++)
+                        if((good = getVarint(p, end, code)))
+                        {
+                            tri[c] = last = last + unzigzag(code);
+                            next = std::max(next, tri[c] + 1);
+                        }
+                    if(!good)
+                        break;
+                    recent.pushVertex(tri[0]);
+                    recent.pushVertex(tri[1]);
+                }
+                if(!good) // truncated block, leaving the triangle unwritten
+                    break;
+                for(int c = 0; c < 3; c++)
+                {
+                    good = good && tri[c] >= 0 && tri[c] < hdr.numverts;
+                    faces[3 * t + c] = tri[c];
+                }
+                recent.pushVertex(tri[2]);
+                recent.pushTriangle(tri[0], tri[1], tri[2]);
+                last = tri[2];
+            }
+            ok = ok && good;
+        }
+    }
+    return ok;
+}
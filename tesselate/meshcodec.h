@@ -0,0 +1,113 @@
+/**
+ * @file
+ *
+ * Compressed encoding of indexed triangle meshes, with quantised positions, octahedral normals and connectivity coded
+ * against recently used edges, for caching large isosurfaces and sending them between processes.
+ */
+
+#ifndef _MESHCODEC
+#define _MESHCODEC
+
+#include <vector>
+#include <stdint.h>
+#include "vecpnt.h"
+
+const char meshcodecmagic[4] = {'T', 'M', 'S', 'Z'};  ///< identifies a compressed mesh
+const int meshcodecversion = 1;                         ///< current compressed mesh layout
+const int meshcodecposbits = 16;        ///< default bits per quantised position component
+const int meshcodecnormbits = 12;       ///< default bits per octahedral normal component
+const int meshcodecblock = 1 << 16;     ///< vertices or triangles per block, each of which is decoded independently
+const int meshcodecfifo = 16;           ///< entries of the recent edge and vertex lists that triangles are coded against
+
+/**
+ * Fixed size header at the start of a compressed mesh. It is followed by the byte offset of the end of each vertex
+ * block (uint64 each), the byte offset of the end of each triangle block (uint64 each) and the first unused vertex
+ * index at the start of each triangle block (int32 each), then by the blocks themselves, with offsets counted from
+ * the end of these tables.
+ */
+struct MeshCodecHeader
+{
+    char magic[4];          ///< always meshcodecmagic
+    int32_t version;        ///< layout version, currently meshcodecversion
+    int32_t numverts;       ///< number of vertices
+    int32_t numtris;        ///< number of triangles
+    int32_t posbits;        ///< bits per quantised position component
+    int32_t normbits;       ///< bits per octahedral normal component, 0 if the mesh has no normals
+    float origin[3];        ///< position of quantised coordinate 0
+    float step[3];          ///< spacing of quantised coordinates along each axis
+    int32_t blocklen;       ///< vertices or triangles per block
+    int32_t pad[3];         ///< reserved, zero
+};
+
+static_assert(sizeof(MeshCodecHeader) == 64, "the compressed mesh header is read and written as raw bytes");
+
+/**
+ * Encodes and decodes compressed meshes. Positions are quantised to a grid over the bounding box and normals to
+ * octahedral coordinates, and each is written as the difference from the previous vertex in zigzag variable length
+ * bytes. Vertices are renumbered in the order the triangles first use them. Each triangle that shares an edge with
+ * one of the last few triangles is written as one byte, naming the edge and whether the remaining vertex is the next
+ * unused one, a recently used one or, rarely, given explicitly, so meshes in vertex cache order, as Mesh writes them,
+ * take little over a byte per triangle. Triangles come back in order, with the same winding, although each may start
+ * from another corner. Blocks of vertices and triangles are coded independently and in parallel, and decoding needs
+ * only byte reads and table lookups. Working storage is kept between calls.
+ */
+class MeshCodec
+{
+private:
+    std::vector<int> remap;                         ///< new index of each original vertex
+    std::vector<int> order;                         ///< original index of each new vertex
+    std::vector<int> blocknext;                     ///< first unused new vertex index at the start of each triangle block
+    std::vector<std::vector<uint8_t>> vertblocks;   ///< encoded vertex blocks
+    std::vector<std::vector<uint8_t>> triblocks;    ///< encoded triangle blocks
+
+    /**
+     * Number vertices in the order the triangles first use them, followed by any that no triangle uses
+     * @param faces     vertex indices, 3 per triangle
+     * @param numverts  number of vertices
+     * @param numtris   number of triangles
+     * @param blocklen  triangles per block
+     */
+    void orderVertices(const int * faces, int numverts, int numtris, int blocklen);
+
+public:
+
+    /**
+     * Encode a mesh
+     * @param verts         vertex positions
+     * @param norms         vertex normals, or NULL to leave them out
+     * @param numverts      number of vertices
+     * @param faces         vertex indices, 3 per triangle
+     * @param numtris       number of triangles
+     * @param posbits       bits per position component, from 1 to 24, bounding the error by half a step of the
+     *                      bounding box extent divided into 2^posbits - 1 steps
+     * @param normbits      bits per octahedral normal component, from 2 to 16
+     * @param[out] out      encoded mesh, replacing its contents
+     */
+    void encode(const cgp::Point * verts, const cgp::Vector * norms, int numverts, const int * faces, int numtris,
+                int posbits, int normbits, std::vector<uint8_t> &out);
+
+    /**
+     * Check and read the header of an encoded mesh
+     * @param data      encoded mesh
+     * @param len       bytes available
+     * @param[out] hdr  header
+     * @retval true  if the data starts with a supported header and holds its block tables and at least the fewest
+     *               bytes its vertex and triangle counts could be encoded in,
+     * @retval false otherwise
+     */
+    static bool readHeader(const uint8_t * data, size_t len, MeshCodecHeader &hdr);
+
+    /**
+     * Decode a mesh, block by block in parallel
+     * @param data          encoded mesh
+     * @param len           bytes available
+     * @param[out] verts    room for numverts positions
+     * @param[out] norms    room for numverts normals, or NULL if they are not wanted or were left out
+     * @param[out] faces    room for 3 * numtris vertex indices
+     * @retval true  if the whole mesh was decoded,
+     * @retval false if the data is damaged, in which case the outputs are partly written
+     */
+    static bool decode(const uint8_t * data, size_t len, cgp::Point * verts, cgp::Vector * norms, int * faces);
+};
+
+#endif
@@ -0,0 +1,276 @@
+/**
+ * @file
+ *
+ * Binary voxel volume in 64-bit Morton ordered bricks
+ */
+
+#include "mortonvol.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+static stats::MemoryInit mortonMemory("MortonVolume");
+
+/// Corners of a marching cubes cell relative to its bottom, front, left corner, in the order used by VoxelVolume
+static const int mortonCubePos[8][3] =
+{
+    {0, 0, 0},{1, 0, 0},{1, 1, 0},{0, 1, 0},{0, 0, 1},{1, 0, 1},{1, 1, 1},{0, 1, 1}
+};
+
+MortonVolume::MortonVolume()
+    : memtally(mortonMemory)
+{
+    setDim(0, 0, 0);
+}
+
+MortonVolume::MortonVolume(int dimx, int dimy, int dimz)
+    : memtally(mortonMemory)
+{
+    setDim(dimx, dimy, dimz);
+}
+
+void MortonVolume::setDim(int dimx, int dimy, int dimz)
+{
+    dim[0] = max(dimx, 0); dim[1] = max(dimy, 0); dim[2] = max(dimz, 0);
+    for(int a = 0; a < 3; a++)
+        sdim[a] = (dim[a] + mortonsuperside - 1) / mortonsuperside;
+    words.assign((size_t) sdim[0] * sdim[1] * sdim[2] * mortonsuperwords, 0);
+    words.shrink_to_fit();
+    memtally.set(getStorageBytes());
+}
+
+void MortonVolume::fill(bool setval)
+{
+    std::fill(words.begin(), words.end(), setval ? ~(uint64_t) 0 : 0);
+}
+
+bool MortonVolume::get(int x, int y, int z) const
+{
+    if(!inside(x, y, z))
+    {
+        cerr << "Error MortonVolume::get: voxel request (" << x << ", " << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    return getUnchecked(x, y, z);
+}
+
+bool MortonVolume::set(int x, int y, int z, bool setval)
+{
+    if(!inside(x, y, z))
+    {
+        cerr << "Error MortonVolume::set: voxel request (" << x << ", " << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    uint64_t &word = words[brickWord(x / mortonbrick, y / mortonbrick, z / mortonbrick)];
+    if(setval)
+        word |= voxelBit(x, y, z);
+    else
+        word &= ~voxelBit(x, y, z);
+    return true;
+}
+
+void MortonVolume::fromVolume(VoxelVolume * vox)
+{
+    int dx, dy, dz;
+
+    vox->getDim(dx, dy, dz);
+    setDim(dx, dy, dz);
+
+    // a layer of bricks is gathered from its rows by one thread, so no two threads write the same word
+    #pragma omp parallel
+    {
+        vector<unsigned int> row(vox->getXSpan());
+
+        #pragma omp for schedule(dynamic)
+        for(int bz = 0; bz < (dz + mortonbrick - 1) / mortonbrick; bz++)
+            for(int z = bz * mortonbrick; z < min(dz, (bz+1) * mortonbrick); z++)
+                for(int y = 0; y < dy; y++)
+                {
+                    vox->getRow(y, z, row.data());
+                    for(int x = 0; x < dx; x++)
+                        if((row[x / voxwordbits] >> (voxwordbits - 1 - x % voxwordbits)) & 0x1u)
+                            words[brickWord(x / mortonbrick, y / mortonbrick, bz)] |= voxelBit(x, y, z);
+                }
+    }
+}
+
+bool MortonVolume::toVolume(VoxelVolume * vox) const
+{
+    int dx, dy, dz;
+
+    vox->getDim(dx, dy, dz);
+    if(dx != dim[0] || dy != dim[1] || dz != dim[2])
+    {
+        cerr << "Error MortonVolume::toVolume: volume dimensions (" << dim[0] << ", " << dim[1] << ", " << dim[2] << ") and (";
+        cerr << dx << ", " << dy << ", " << dz << ") do not match" << endl;
+        return false;
+    }
+
+    #pragma omp parallel
+    {
+        vector<unsigned int> row(vox->getXSpan());
+
+        #pragma omp for schedule(dynamic)
+        for(int z = 0; z < dz; z++)
+            for(int y = 0; y < dy; y++)
+            {
+                std::fill(row.begin(), row.end(), 0u);
+                for(int x = 0; x < dx; x++)
+                    if(getUnchecked(x, y, z))
+                        row[x / voxwordbits] |= 0x80000000u >> (x % voxwordbits);
+                vox->setRow(y, z, row.data());
+            }
+    }
+    return true;
+}
+
+int MortonVolume::getMCVertIdx(int x, int y, int z) const
+{
+    int idx = 0;
+
+    // 1 for outside, 0 for inside, as for VoxelVolume::getMCVertIdx
+    if(x % mortonbrick < mortonbrick-1 && y % mortonbrick < mortonbrick-1 && z % mortonbrick < mortonbrick-1
+       && x >= 0 && y >= 0 && z >= 0 && x+1 < dim[0] && y+1 < dim[1] && z+1 < dim[2])
+    {
+        // every corner is in the same brick, so one word is read
+        uint64_t word = words[brickWord(x / mortonbrick, y / mortonbrick, z / mortonbrick)];
+        for(int i = 0; i < 8; i++)
+            if(!(word & voxelBit(x + mortonCubePos[i][0], y + mortonCubePos[i][1], z + mortonCubePos[i][2])))
+                idx |= 1 << i;
+        return idx;
+    }
+    for(int i = 0; i < 8; i++)
+        if(!getOrEmpty(x + mortonCubePos[i][0], y + mortonCubePos[i][1], z + mortonCubePos[i][2]))
+            idx |= 1 << i;
+    return idx;
+}
+
+/// Masks over the bits of a brick word, selecting voxels by their coordinate within the brick along each axis
+struct MortonMasks
+{
+    uint64_t at[3][mortonbrick];            ///< voxels whose coordinate along the axis equals the index
+    uint64_t below[3][mortonbrick+1];       ///< voxels whose coordinate along the axis is less than the index
+
+    MortonMasks()
+    {
+        for(int a = 0; a < 3; a++)
+        {
+            for(int l = 0; l < mortonbrick; l++)
+                at[a][l] = 0;
+            for(int k = 0; k <= mortonbrick; k++)
+                below[a][k] = 0;
+        }
+        for(int p = 0; p < 64; p++)
+            for(int a = 0; a < 3; a++)
+            {
+                int l = ((p >> a) & 1) | (((p >> (a+3)) & 1) << 1);
+                at[a][l] |= (uint64_t) 1 << p;
+                for(int k = l+1; k <= mortonbrick; k++)
+                    below[a][k] |= (uint64_t) 1 << p;
+            }
+    }
+};
+
+static const MortonMasks mortonMasks;
+
+/**
+ * Occupancy of the next voxel along an axis, for every voxel of a brick. Within a brick, a coordinate l along the axis
+ * contributes bit l&1 at weight u and bit l>>1 at weight 8u, so stepping from l to l+1 moves u, 7u, u or, into the
+ * next brick, back 9u bit positions.
+ * @param w     brick word
+ * @param next  word of the next brick along the axis, 0 if outside the volume
+ * @param a     axis, 0 for x, 1 for y, 2 for z
+ */
+static inline uint64_t stepUp(uint64_t w, uint64_t next, int a)
+{
+    int u = 1 << a;
+    const uint64_t * at = mortonMasks.at[a];
+    return ((w >> u) & (at[0] | at[2])) | ((w >> (7*u)) & at[1]) | ((next << (9*u)) & at[3]);
+}
+
+/**
+ * Occupancy of the previous voxel along an axis, for every voxel of a brick, as for stepUp
+ * @param w     brick word
+ * @param prev  word of the previous brick along the axis, 0 if outside the volume
+ * @param a     axis, 0 for x, 1 for y, 2 for z
+ */
+static inline uint64_t stepDown(uint64_t w, uint64_t prev, int a)
+{
+    int u = 1 << a;
+    const uint64_t * at = mortonMasks.at[a];
+    return ((w << u) & (at[1] | at[3])) | ((w << (7*u)) & at[2]) | ((prev >> (9*u)) & at[0]);
+}
+
+uint64_t MortonVolume::brickBits(int bx, int by, int bz) const
+{
+    int b[3] = {bx, by, bz};
+    uint64_t valid = ~(uint64_t) 0;
+
+    for(int a = 0; a < 3; a++)
+    {
+        int left = dim[a] - b[a] * mortonbrick;
+        if(b[a] < 0 || left <= 0)
+            return 0;
+        if(left < mortonbrick) // padding voxels past the end of the volume are never occupied
+            valid &= mortonMasks.below[a][left];
+    }
+    return words[brickWord(bx, by, bz)] & valid;
+}
+
+void MortonVolume::brickShell(int bx, int by, int bz, vector<int> &cells) const
+{
+    uint64_t word = brickBits(bx, by, bz), inner;
+
+    if(word == 0)
+        return;
+
+    // occupied voxels whose six face neighbours are all occupied
+    inner = word;
+    inner &= stepDown(word, brickBits(bx-1, by, bz), 0) & stepUp(word, brickBits(bx+1, by, bz), 0);
+    inner &= stepDown(word, brickBits(bx, by-1, bz), 1) & stepUp(word, brickBits(bx, by+1, bz), 1);
+    inner &= stepDown(word, brickBits(bx, by, bz-1), 2) & stepUp(word, brickBits(bx, by, bz+1), 2);
+
+    for(uint64_t shell = word & ~inner; shell != 0; shell &= shell - 1)
+    {
+        int p = __builtin_ctzll(shell);
+        cells.push_back(bx * mortonbrick + ((p & 1) | ((p >> 2) & 2)));
+        cells.push_back(by * mortonbrick + (((p >> 1) & 1) | ((p >> 3) & 2)));
+        cells.push_back(bz * mortonbrick + (((p >> 2) & 1) | ((p >> 4) & 2)));
+    }
+}
+
+void MortonVolume::getShellVoxels(vector<int> &cells) const
+{
+    int numsuper = sdim[0] * sdim[1] * sdim[2];
+    vector<vector<int>> blocks(numsuper);
+    size_t total = 0;
+
+    cells.clear();
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int s = 0; s < numsuper; s++)
+    {
+        int sx = s % sdim[0], sy = (s / sdim[0]) % sdim[1], sz = s / (sdim[0] * sdim[1]);
+
+        // bricks in the order they are stored, skipping those wholly outside the volume
+        for(int m = 0; m < mortonsuperwords; m++)
+        {
+            int bx = sx * mortonsuper, by = sy * mortonsuper, bz = sz * mortonsuper;
+            for(int b = 0; b < 3; b++)
+            {
+                bx += ((m >> (3*b)) & 1) << b;
+                by += ((m >> (3*b + 1)) & 1) << b;
+                bz += ((m >> (3*b + 2)) & 1) << b;
+            }
+            if(bx * mortonbrick < dim[0] && by * mortonbrick < dim[1] && bz * mortonbrick < dim[2])
+                brickShell(bx, by, bz, blocks[s]);
+        }
+    }
+
+    for(int s = 0; s < numsuper; s++)
+        total += blocks[s].size();
+    cells.reserve(total);
+    for(int s = 0; s < numsuper; s++)
+        cells.insert(cells.end(), blocks[s].begin(), blocks[s].end());
+}
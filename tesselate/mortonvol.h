@@ -0,0 +1,176 @@
+#ifndef _MORTONVOLUME
+#define _MORTONVOLUME
+/**
+ * @file
+ *
+ * MortonVolume class for storing a 3d cuboid of binary voxel data with 3D locality
+ */
+
+#include <vector>
+#include <cassert>
+#include <stdint.h>
+#include "voxels.h"
+#include "common/memory.h"
+
+const int mortonbrick = 4;          ///< voxels along each side of the brick held by one 64-bit word
+const int mortonsuper = 8;          ///< bricks along each side of a superblock, within which bricks are in Morton order
+const int mortonsuperside = mortonbrick * mortonsuper;                      ///< voxels along each side of a superblock
+const int mortonsuperwords = mortonsuper * mortonsuper * mortonsuper;       ///< words per superblock
+
+/**
+ * Binary voxel volume in which each 64-bit word holds a 4 x 4 x 4 brick of voxels, with bits and bricks both laid out
+ * in Morton order. Bricks are grouped into 32 x 32 x 32 voxel superblocks of 4KB, so that the 26 neighbours of almost
+ * every voxel lie in the same or an adjacent word and cell and neighbourhood tests stay within a few cache lines,
+ * unlike the x rows of a VoxelVolume, where z neighbours are a whole slice apart.
+ *
+ * Dimensions are kept exactly as given. Bits of superblocks beyond the volume are padding, which is never read.
+ * The flat row layout of VoxelVolume remains the format for files and for the rest of the pipeline, and volumes are
+ * converted with fromVolume and toVolume.
+ */
+class MortonVolume
+{
+private:
+    std::vector<uint64_t> words;    ///< bricks of voxels, a superblock at a time
+    int dim[3];                     ///< voxels along x, y and z
+    int sdim[3];                    ///< superblocks along x, y and z
+    stats::MemoryTally memtally;    ///< bytes of words
+
+    /// Spread the low three bits of v to every third bit, for interleaving into a Morton code
+    static unsigned int spread(unsigned int v)
+    {
+        static const unsigned int table[8] = {0u, 1u, 8u, 9u, 64u, 65u, 72u, 73u};
+        return table[v];
+    }
+
+    /// Morton code of a position within a brick or a superblock, each coordinate less than 8
+    static unsigned int morton(unsigned int x, unsigned int y, unsigned int z)
+    {
+        return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+    }
+
+    /// Index of the word holding the brick at brick coordinates (bx, by, bz), which must lie in a superblock
+    size_t brickWord(int bx, int by, int bz) const
+    {
+        size_t s = ((size_t) (bz / mortonsuper) * sdim[1] + by / mortonsuper) * sdim[0] + bx / mortonsuper;
+        return s * mortonsuperwords + morton(bx % mortonsuper, by % mortonsuper, bz % mortonsuper);
+    }
+
+    /// Bit of voxel (x, y, z) within the word of its brick
+    static uint64_t voxelBit(int x, int y, int z)
+    {
+        return (uint64_t) 1 << morton(x % mortonbrick, y % mortonbrick, z % mortonbrick);
+    }
+
+    /// Test whether a voxel lies within the volume
+    bool inside(int x, int y, int z) const
+    {
+        return x >= 0 && x < dim[0] && y >= 0 && y < dim[1] && z >= 0 && z < dim[2];
+    }
+
+    /// Occupancy of a voxel, or false outside the volume
+    bool getOrEmpty(int x, int y, int z) const { return inside(x, y, z) && getUnchecked(x, y, z); }
+
+    /**
+     * Voxels of a brick that lie within the volume
+     * @param bx, by, bz    brick coordinates
+     * @returns brick word with bits outside the volume cleared, or 0 for a brick outside the volume
+     */
+    uint64_t brickBits(int bx, int by, int bz) const;
+
+    /**
+     * Shell voxels of one brick, as for getShellVoxels, found with shifts and masks on whole brick words
+     * @param bx, by, bz    brick coordinates, within the volume
+     * @param[out] cells    x, y, z index triples appended for each shell voxel
+     */
+    void brickShell(int bx, int by, int bz, std::vector<int> &cells) const;
+
+public:
+
+    /// Default constructor, an empty volume
+    MortonVolume();
+
+    /**
+     * Create a volume of the given dimensions, with every voxel empty
+     * @param dimx, dimy, dimz     number of voxels in x, y, z dimensions, kept exactly
+     */
+    MortonVolume(int dimx, int dimy, int dimz);
+
+    /**
+     * Set the dimensions, with every voxel empty
+     * @param dimx, dimy, dimz     number of voxels in x, y, z dimensions, kept exactly
+     */
+    void setDim(int dimx, int dimy, int dimz);
+
+    /**
+     * Obtain the dimensions of the voxel volume
+     * @param dimx, dimy, dimz     number of voxels in x, y, z dimensions
+     */
+    void getDim(int &dimx, int &dimy, int &dimz) const { dimx = dim[0]; dimy = dim[1]; dimz = dim[2]; }
+
+    /// Memory used to hold the voxels, in bytes
+    size_t getStorageBytes() const { return words.capacity() * sizeof(uint64_t); }
+
+    /**
+     * Set all voxels to empty or occupied
+     * @param setval    new value for all voxels
+     */
+    void fill(bool setval);
+
+    /**
+     * Get the status of a single voxel
+     * @param x, y, z   3D location, zero indexed
+     * @retval true if the voxel is occupied,
+     * @retval false if the voxel is empty or out of bounds, which is reported.
+     */
+    bool get(int x, int y, int z) const;
+
+    /**
+     * Set a single voxel to either empty or occupied
+     * @param x, y, z   3D location, zero indexed
+     * @param setval    new voxel value
+     * @retval true if the voxel is within volume bounds,
+     * @retval false otherwise.
+     */
+    bool set(int x, int y, int z, bool setval);
+
+    /**
+     * Unchecked version of get for loops that already stay within the volume. Bounds are asserted in debug builds only.
+     * @param x, y, z   3D location, zero indexed and within the volume
+     */
+    bool getUnchecked(int x, int y, int z) const
+    {
+        assert(inside(x, y, z));
+        return (words[brickWord(x / mortonbrick, y / mortonbrick, z / mortonbrick)] & voxelBit(x, y, z)) != 0;
+    }
+
+    /**
+     * Copy the voxels of a flat row volume, taking its (x padded) dimensions
+     * @param vox   volume to copy, in either dense or sparse storage
+     */
+    void fromVolume(VoxelVolume * vox);
+
+    /**
+     * Copy the voxels into a flat row volume of the same dimensions, for files and the rest of the pipeline
+     * @param[out] vox  volume to overwrite, which must have matching dimensions
+     * @retval true if the dimensions match,
+     * @retval false otherwise.
+     */
+    bool toVolume(VoxelVolume * vox) const;
+
+    /**
+     * Marching cubes corner code of a cell, as for VoxelVolume::getMCVertIdx, with corners outside the volume empty
+     * @param x, y, z   bottom, front, left corner of the cell
+     * @returns bit i set if corner i of the cell is empty
+     */
+    int getMCVertIdx(int x, int y, int z) const;
+
+    /**
+     * Find the boundary shell, the occupied voxels with at least one empty or out of volume face neighbour. Each
+     * brick is tested a whole word at a time against the words of its six neighbouring bricks, empty bricks are
+     * skipped, and superblocks are processed in parallel.
+     * @param[out] cells    x, y, z index triples of the shell voxels, ordered by superblock and then by brick
+     */
+    void getShellVoxels(std::vector<int> &cells) const;
+};
+
+#endif
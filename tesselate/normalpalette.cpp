@@ -0,0 +1,67 @@
+//
+// NormalPalette
+//
+
+#include "normalpalette.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+int NormalPalette::insert(const cgp::Vector &n)
+{
+    uint32_t key = packNormal(n.i, n.j, n.k);
+    auto slot = lookup.insert(std::make_pair(key, (int) normals.size()));
+
+    if(slot.second)
+    {
+        normals.push_back(n);
+        keys.push_back(key);
+    }
+    return slot.first->second;
+}
+
+void NormalPalette::insert(const cgp::Vector * n, int count, int * ids)
+{
+    int numchunks = (count + palettechunk - 1) / palettechunk;
+    vector<uint32_t> batchkeys(count);
+    vector<vector<int>> firsts(numchunks);
+
+    // key each chunk and note the first occurrence of each key within it
+    #pragma omp parallel for schedule(dynamic)
+    for(int c = 0; c < numchunks; c++)
+    {
+        unordered_map<uint32_t, int> seen;
+        int lo = c * palettechunk, hi = std::min(count, lo + palettechunk);
+
+        for(int p = lo; p < hi; p++)
+        {
+            batchkeys[p] = packNormal(n[p].i, n[p].j, n[p].k);
+            if(lookup.find(batchkeys[p]) == lookup.end() && seen.insert(std::make_pair(batchkeys[p], p)).second)
+                firsts[c].push_back(p);
+        }
+    }
+
+    // new keys join the palette in chunk order, which is the order of the batch
+    for(int c = 0; c < numchunks; c++)
+        for(int p : firsts[c])
+            if(lookup.insert(std::make_pair(batchkeys[p], (int) normals.size())).second)
+            {
+                normals.push_back(n[p]);
+                keys.push_back(batchkeys[p]);
+            }
+
+    if(ids != NULL)
+    {
+        #pragma omp parallel for schedule(static, palettechunk)
+        for(int p = 0; p < count; p++)
+            ids[p] = lookup.find(batchkeys[p])->second;
+    }
+}
+
+int NormalPalette::find(const cgp::Vector &n) const
+{
+    auto slot = lookup.find(packNormal(n.i, n.j, n.k));
+
+    return (slot == lookup.end()) ? -1 : slot->second;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file
+ *
+ * Sets of distinct unit normals, keyed by their packed signed normalised 10:10:10 encoding
+ */
+
+#ifndef _NORMALPALETTE
+#define _NORMALPALETTE
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <math.h>
+#include "vecpnt.h"
+
+const int palettechunk = 16384;     ///< normals keyed per parallel chunk when inserting a batch
+
+/**
+ * Pack a unit normal as three signed normalised 10-bit fields with x in the lowest bits, the layout of the
+ * CompactVertex normal, so that normals equal at that precision share a key
+ * @param i, j, k   components, each clamped to [-1,1]
+ * @returns packed normal, with the top two bits clear
+ */
+inline uint32_t packNormal(float i, float j, float k)
+{
+    float c[3] = {i, j, k};
+    uint32_t key = 0u;
+
+    for(int a = 0; a < 3; a++)
+    {
+        float v = c[a] < -1.0f ? -1.0f : (c[a] > 1.0f ? 1.0f : c[a]);
+        int q = (int) floorf(v * 511.0f + 0.5f);
+        key |= ((uint32_t) q & 0x3ffu) << (10 * a);
+    }
+    return key;
+}
+
+/**
+ * Inverse of packNormal, to the precision of the packing
+ * @param key   packed normal
+ * @returns normal with each component a multiple of 1/511
+ */
+inline cgp::Vector unpackNormal(uint32_t key)
+{
+    float c[3];
+
+    for(int a = 0; a < 3; a++)
+    {
+        int q = (int) ((key >> (10 * a)) & 0x3ffu);
+        c[a] = (float) (q >= 512 ? q - 1024 : q) / 511.0f;
+    }
+    return cgp::Vector(c[0], c[1], c[2]);
+}
+
+/**
+ * The distinct normals of a mesh, each stored once in order of first insertion. Lookup is a hash on the packed
+ * key, so building the palette of n normals takes expected O(n) time rather than a scan of the palette per
+ * normal. Batches are keyed in parallel chunks whose first occurrences are then merged in chunk order, so palette
+ * order does not depend on the thread count.
+ */
+class NormalPalette
+{
+private:
+    std::vector<cgp::Vector> normals;           ///< first inserted normal of each entry
+    std::vector<uint32_t> keys;                 ///< packed key of each entry
+    std::unordered_map<uint32_t, int> lookup;   ///< entry for each packed key
+
+public:
+
+    /// Remove every entry
+    void clear(){ normals.clear(); keys.clear(); lookup.clear(); }
+
+    /// Number of distinct normals
+    int size() const { return (int) normals.size(); }
+
+    /**
+     * Add a normal unless an equal one is already held
+     * @param n     unit normal
+     * @returns index of the entry holding the normal
+     */
+    int insert(const cgp::Vector &n);
+
+    /**
+     * Add a batch of normals, keying them in parallel
+     * @param n         unit normals
+     * @param count     number of normals
+     * @param[out] ids  entry index for each normal, or NULL if not wanted
+     */
+    void insert(const cgp::Vector * n, int count, int * ids);
+
+    /**
+     * Find the entry holding a normal
+     * @param n     unit normal
+     * @returns index of the entry, or -1 if there is none
+     */
+    int find(const cgp::Vector &n) const;
+
+    /// Distinct normals in order of first insertion
+    const std::vector<cgp::Vector> & getNormals() const { return normals; }
+
+    /// Packed CompactVertex normal of each entry
+    const std::vector<uint32_t> & getKeys() const { return keys; }
+};
+
+#endif
@@ -0,0 +1,144 @@
+//
+// PartBatch
+//
+
+#include "partbatch.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "common/parallel.h"
+
+using namespace std;
+
+PartBatch::PartBatch()
+{
+    voxlen = 0.1f;
+    distfield = false;
+    keeplargest = false;
+    fillvoids = false;
+    dualsurface = false;
+    smoothpairs = 0;
+    smoothshrink = smoothrate;
+    smoothband = taubinpassband;
+    cachedir = "";
+    cachecompress = false;
+}
+
+bool PartBatch::readJobs(const std::string &filename, std::vector<PartJob> &jobs)
+{
+    ifstream infile(filename);
+    string line, extra;
+    int lineno = 0;
+
+    jobs.clear();
+    if(!infile)
+    {
+        cerr << "Error PartBatch::readJobs: unable to open " << filename << endl;
+        return false;
+    }
+    while(getline(infile, line))
+    {
+        PartJob job;
+
+        lineno++;
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        if(!(fields >> job.input)) // blank or comment
+            continue;
+        if(!(fields >> job.output) || (fields >> extra))
+        {
+            cerr << "Error PartBatch::readJobs: expected an input and an output path on line " << lineno << " of " << filename << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+void PartBatch::runPart(const PartJob &job, PartResult &result)
+{
+    auto start = chrono::steady_clock::now();
+    bool fit, loaded;
+    Scene * scene = scenes.take([](Scene *){ return true; }, fit);
+
+    if(scene == NULL)
+    {
+        scene = new Scene();
+        scene->setStreamCSG(true); // only the final volume is needed, as for tessbatch
+    }
+    scene->setCacheDirectory(cachedir);
+    scene->setCacheCompression(cachecompress);
+    scene->setDistanceField(distfield);
+    scene->setKeepLargest(keeplargest);
+    scene->setFillVoids(fillvoids);
+    scene->setDualSurface(dualsurface);
+    scene->setSmoothing(smoothpairs, smoothshrink, smoothband);
+
+    result.ok = false;
+    result.triangles = 0;
+    if(job.input.size() > 4 && job.input.compare(job.input.size() - 4, 4, ".csg") == 0)
+        loaded = scene->readSceneFile(job.input);
+    else
+        loaded = scene->loadSTLScene(job.input);
+    if(!loaded)
+        cerr << "Error PartBatch::run: unable to read " << job.input << endl;
+    else if(scene->voxelise(voxlen) && scene->isoextract() && (smoothpairs <= 0 || scene->smooth()))
+    {
+        if(scene->getMesh()->getNumFaces() == 0)
+            cerr << "Error PartBatch::run: the isosurface of " << job.input << " is empty" << endl;
+        else if(!scene->getMesh()->writeSTL(job.output))
+            cerr << "Error PartBatch::run: unable to write " << job.output << endl;
+        else
+        {
+            result.ok = true;
+            result.triangles = scene->getMesh()->getNumFaces();
+        }
+    }
+    scenes.give(scene); // the next part replaces the tree, and takes over the volume and mesh storage
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int PartBatch::run(const std::vector<PartJob> &jobs, std::vector<PartResult> &results)
+{
+    int numjobs = (int) jobs.size(), written = 0;
+    std::vector<int> order(numjobs);
+    std::vector<int64_t> sizes(numjobs, 0);
+
+    results.assign(numjobs, PartResult());
+    for(int j = 0; j < numjobs; j++)
+    {
+        struct stat st;
+        if(stat(jobs[j].input.c_str(), &st) == 0)
+            sizes[j] = (int64_t) st.st_size;
+        order[j] = j;
+    }
+    // longest first, taking the file size as the measure of work
+    std::stable_sort(order.begin(), order.end(), [&sizes](int a, int b){ return sizes[a] > sizes[b]; });
+
+    if(numjobs < parallel::getThreads()) // too few to keep the team busy, so each part has the whole team
+    {
+        for(int j : order)
+            runPart(jobs[j], results[j]);
+    }
+    else
+    {
+        // the parallel regions within each part are nested and so run on its own thread
+        #pragma omp parallel
+        {
+            #pragma omp single
+            {
+                parallel::TaskGroup group;
+                for(int j : order)
+                    group.run([this, &jobs, &results, j](){ runPart(jobs[j], results[j]); });
+                group.wait();
+            }
+        }
+    }
+
+    for(const PartResult &result : results)
+        written += (int) result.ok;
+    return written;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file
+ *
+ * Voxelisation and surface extraction of many independent parts, such as the contents of a build plate, packed onto
+ * one thread team.
+ */
+
+#ifndef _PARTBATCH
+#define _PARTBATCH
+
+#include <string>
+#include <vector>
+#include "csg.h"
+#include "scratch.h"
+
+/// One part of a batch
+struct PartJob
+{
+    std::string input;      ///< scene file if it ends in .csg, otherwise a mesh file loaded as by Scene::loadSTLScene
+    std::string output;     ///< STL file receiving the extracted surface
+};
+
+/// Outcome of one part of a batch
+struct PartResult
+{
+    bool ok;                ///< the surface was written
+    int triangles;          ///< triangles written
+    double seconds;         ///< time from loading to the end of the export
+};
+
+/**
+ * Runs the load, voxelise, isoextract, smooth and export stages of many parts. When there are at least as many parts
+ * as threads, each part runs through all of its stages on one thread of the team and the threads take the next
+ * part as they finish, so loading and writing one part overlaps the computation of the others and no thread waits
+ * on the start and end of the parallel regions within a small part. Parts are started largest file first, so the
+ * longest ones do not trail at the end. With fewer parts than threads, the parts run in turn on the whole team.
+ * Finished scenes are kept in a pool and taken over by later parts, whose voxel volumes and meshes reuse their
+ * storage rather than going back to the allocator.
+ */
+class PartBatch
+{
+private:
+    float voxlen;           ///< voxel side length of every part
+    bool distfield;         ///< voxelise to signed distances
+    bool keeplargest;       ///< keep only the largest component of each part
+    bool fillvoids;         ///< fill voids enclosed by each part
+    bool dualsurface;       ///< extract the dual surface rather than marching cubes
+    int smoothpairs;        ///< Taubin shrink and inflate pairs, 0 to skip smoothing
+    float smoothshrink;     ///< Taubin shrinking factor
+    float smoothband;       ///< Taubin pass-band frequency
+    std::string cachedir;   ///< directory of cached stage results, empty if caching is disabled
+    bool cachecompress;     ///< cache meshes in the compressed format
+    ScratchPool<Scene> scenes;  ///< scenes of finished parts, taken over by the parts that follow
+
+    /**
+     * Run every stage of one part on a scene from the pool
+     * @param job           part to process
+     * @param[out] result   outcome of the part
+     */
+    void runPart(const PartJob &job, PartResult &result);
+
+public:
+
+    PartBatch();
+
+    /// Setter for the voxel side length of every part
+    void setVoxelLength(float len){ voxlen = len; }
+
+    /// Voxelise to signed distances, as for Scene::setDistanceField
+    void setDistanceField(bool distances){ distfield = distances; }
+
+    /// Keep only the largest component of each part, as for Scene::setKeepLargest
+    void setKeepLargest(bool largest){ keeplargest = largest; }
+
+    /// Fill the voids enclosed by each part, as for Scene::setFillVoids
+    void setFillVoids(bool voids){ fillvoids = voids; }
+
+    /// Extract the dual surface of each part, as for Scene::setDualSurface
+    void setDualSurface(bool dual){ dualsurface = dual; }
+
+    /// Set the Taubin smoothing of each part, as for Scene::setSmoothing, with 0 pairs to skip it
+    void setSmoothing(int iter, float rate, float passband = taubinpassband){ smoothpairs = iter; smoothshrink = rate; smoothband = passband; }
+
+    /// Enable the on-disk cache of stage results, as for Scene::setCacheDirectory
+    void setCacheDirectory(const std::string &dir){ cachedir = dir; }
+
+    /// Toggle caching meshes compressed, as for Scene::setCacheCompression
+    void setCacheCompression(bool on){ cachecompress = on; }
+
+    /**
+     * Read a list of parts, one "input output" pair of paths per line, skipping blank lines and '#' comments
+     * @param filename      name of job file
+     * @param[out] jobs     parts in file order
+     * @retval true  if the file was read,
+     * @retval false otherwise
+     */
+    static bool readJobs(const std::string &filename, std::vector<PartJob> &jobs);
+
+    /**
+     * Process every part, writing the surface of each to its output
+     * @param jobs          parts to process
+     * @param[out] results  outcome of each part, in the order of jobs
+     * @returns number of parts written
+     */
+    int run(const std::vector<PartJob> &jobs, std::vector<PartResult> &results);
+
+    /// Release the pooled scenes
+    void releasePool(){ scenes.reset(); }
+};
+
+#endif
@@ -0,0 +1,113 @@
+//
+// Pipeline
+//
+
+#include "pipeline.h"
+#include <iostream>
+#include "common/memory.h"
+#include "common/timer.h"
+#include "common/parallel.h"
+
+using namespace std;
+
+Pipeline::Pipeline(Scene * target, QObject * parent)
+    : QObject(parent)
+{
+    scene = target;
+    done = false;
+    completed = false;
+    stage = PipelineStage::VOXELISE;
+    voxlen = 0.0f;
+    lastpercent = 0;
+    poll = new QTimer(this);
+    poll->setInterval(pipelinepollms);
+    connect(poll, SIGNAL(timeout()), this, SLOT(check()));
+}
+
+Pipeline::~Pipeline()
+{
+    if(busy())
+    {
+        cancel();
+        worker.join();
+    }
+    scene->setProgress(NULL);
+}
+
+void Pipeline::run()
+{
+    static const char * stagenames[] = {"voxelise", "isoextract", "smooth", "deform", "preview"};
+
+    parallel::adoptThreads(); // OpenMP keeps the thread count per thread, and this one did not set it
+    stats::resetMemoryPeaks();
+    // the interface asks for the stage it wants to show, and only the stages that are out of date are run
+    if(voxlen > 0.0f && stage != PipelineStage::PREVIEW)
+        scene->setVoxelSize(voxlen);
+    switch(stage)
+    {
+        case PipelineStage::VOXELISE:
+            completed = scene->require(SceneStage::VOXELS);
+            break;
+        case PipelineStage::ISOEXTRACT:
+            completed = scene->require(SceneStage::ISOSURFACE);
+            break;
+        case PipelineStage::SMOOTH:
+            completed = scene->require(SceneStage::SMOOTHED);
+            break;
+        case PipelineStage::DEFORM:
+            scene->setLattice(&lattice);
+            completed = scene->require(SceneStage::DEFORMED);
+            break;
+        case PipelineStage::PREVIEW:
+            completed = scene->voxelise(voxlen) && scene->isoextract();
+            break;
+    }
+    if(completed && stage != PipelineStage::PREVIEW) // previews are recorded by the caller once full resolution is reached
+        scene->recordStage(stagenames[(int) stage]);
+    if(stats::isTimingEnabled()) // peaks reported alongside the stage timers
+        stats::reportMemory(stagenames[(int) stage]);
+    done = true; // publishes completed to the polling thread
+}
+
+bool Pipeline::start(PipelineStage run, float len, ffd * def)
+{
+    if(busy())
+    {
+        cerr << "Error Pipeline::start: a stage is already running" << endl;
+        return false;
+    }
+
+    stage = run;
+    voxlen = len;
+    if(run == PipelineStage::DEFORM && def != NULL)
+        lattice = (* def);
+    tracker.reset();
+    scene->setProgress(&tracker);
+    done = false;
+    completed = false;
+    lastpercent = 0;
+    emit progress(0);
+
+    worker = std::thread(&Pipeline::run, this);
+    poll->start();
+    return true;
+}
+
+void Pipeline::check()
+{
+    int percent = tracker.percent;
+
+    if(percent != lastpercent)
+    {
+        lastpercent = percent;
+        emit progress(percent);
+    }
+
+    if(done)
+    {
+        poll->stop();
+        worker.join();
+        scene->setProgress(NULL);
+        emit finished(stage, completed);
+    }
+}
@@ -0,0 +1,107 @@
+/**
+ * @file
+ *
+ * Runs the expensive Scene stages on a background thread, so that the interface keeps responding while they compute.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QObject>
+#include <QTimer>
+#include <thread>
+#include <atomic>
+
+#include "csg.h"
+#include "ffd.h"
+
+const int pipelinepollms = 50;  ///< interval in milliseconds between checks on a running stage
+
+/**
+ * Scene stages that can be run in the background
+ */
+enum class PipelineStage
+{
+    VOXELISE,   ///< Scene::require up to the voxels
+    ISOEXTRACT, ///< Scene::require up to the isosurface
+    SMOOTH,     ///< Scene::require up to the smoothed isosurface
+    DEFORM,     ///< Scene::require up to the deformed isosurface
+    PREVIEW,    ///< Scene::voxelise followed by Scene::isoextract, for one level of progressive voxelisation
+};
+
+/**
+ * Runs one Scene stage at a time on a worker thread. The scene belongs to the worker until the stage finishes, so
+ * the GUI thread must not touch it in between, and should keep drawing the buffers bound from the last completed
+ * stage instead. Only Scene::getPublished may be called meanwhile, from any thread. Progress and completion are polled on the GUI thread and delivered as signals, so slots connected
+ * to them run on the GUI thread as usual.
+ */
+class Pipeline : public QObject
+{
+    Q_OBJECT
+
+private:
+    Scene * scene;              ///< scene the stages are applied to
+    std::thread worker;         ///< thread running the current stage
+    StageProgress tracker;      ///< progress and cancellation shared with the scene
+    std::atomic<bool> done;     ///< has the worker finished its stage?
+    bool completed;             ///< did the finished stage run to completion rather than being cancelled?
+    PipelineStage stage;        ///< stage being run
+    ffd lattice;                ///< copy of the deformation lattice, which the interface may edit while deforming
+    float voxlen;               ///< voxel side length for the voxels, or 0 to keep the scene's
+    int lastpercent;            ///< progress most recently signalled
+    QTimer * poll;              ///< GUI thread timer that checks on the worker
+
+    /// Body of the worker thread
+    void run();
+
+private slots:
+
+    /// Signal any new progress and, once the worker is done, join it and signal completion
+    void check();
+
+public:
+
+    /**
+     * Constructor
+     * @param target    scene the stages are applied to
+     * @param parent    owning Qt object
+     */
+    Pipeline(Scene * target, QObject * parent = 0);
+
+    /// Destructor, which cancels and waits for any running stage
+    ~Pipeline();
+
+    /**
+     * Start a stage in the background
+     * @param run       which stage to run
+     * @param len       voxel side length, or 0 to keep the one last given, which the stages before the one run are
+     *                  brought up to date with
+     * @param def       deformation lattice, copied for deform and otherwise ignored
+     * @retval true  if the stage was started,
+     * @retval false if another stage is still running
+     */
+    bool start(PipelineStage run, float len = 0.0f, ffd * def = NULL);
+
+    /// Is a stage running, in which case the scene must be left alone?
+    bool busy(){ return worker.joinable(); }
+
+    /// Ask the running stage to stop early, which is signalled through finished as usual
+    void cancel(){ tracker.cancel = true; }
+
+signals:
+
+    /**
+     * Progress of the running stage
+     * @param percent   completion from 0 to 100
+     */
+    void progress(int percent);
+
+    /**
+     * The stage has finished and the scene may be used again
+     * @param run       which stage finished
+     * @param complete  true if it ran to completion, false if it was cancelled
+     */
+    void finished(PipelineStage run, bool complete);
+};
+
+#endif
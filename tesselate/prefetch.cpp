@@ -0,0 +1,144 @@
+//
+// Prefetcher
+//
+
+#include "prefetch.h"
+#include "common/log.h"
+#include "common/parallel.h"
+
+using namespace std;
+
+Prefetcher::Prefetcher()
+{
+    stopping = false;
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    if(worker.joinable())
+        worker.join();
+}
+
+deque<shared_ptr<Prefetcher::Item>>::iterator Prefetcher::find(const string &filename)
+{
+    for(auto it = items.begin(); it != items.end(); it++)
+        if((* it)->filename == filename)
+            return it;
+    return items.end();
+}
+
+void Prefetcher::run()
+{
+    parallel::adoptThreads(); // OpenMP keeps the thread count per thread, and this one did not set it
+    for(;;)
+    {
+        shared_ptr<Item> item;
+
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [this, &item]()
+            {
+                for(auto &queued : items)
+                    if(!queued->started)
+                    {
+                        item = queued;
+                        return true;
+                    }
+                return stopping;
+            });
+            if(stopping)
+                return;
+            item->started = true;
+        }
+
+        // the item is only touched by this thread until done is set
+        unique_ptr<Mesh> mesh(new Mesh());
+        bool loaded = scratch.prepareSTL(mesh.get(), item->filename);
+        if(loaded && item->voxlen > 0.0f && !scratch.getCacheDirectory().empty())
+        {
+            // a second load is read back from the cache, and the stages leave their results beside it
+            if(!scratch.loadSTLScene(item->filename) || !scratch.voxelise(item->voxlen) || !scratch.isoextract())
+                UTS_LOG(WARNING, CSG, "Prefetcher::run: stages of ", item->filename, " were not cached");
+            scratch.clear();
+        }
+        UTS_LOG(DEBUG, CSG, "Prefetcher::run: ", item->filename, loaded ? " loaded" : " failed to load");
+
+        {
+            lock_guard<mutex> guard(lock);
+            item->mesh = move(mesh);
+            item->loaded = loaded;
+            item->done = true;
+        }
+        changed.notify_all();
+    }
+}
+
+void Prefetcher::queue(const string &filename, float voxlen)
+{
+    shared_ptr<Item> item = make_shared<Item>();
+
+    item->filename = filename;
+    item->voxlen = voxlen;
+    item->started = false;
+    item->done = false;
+    item->loaded = false;
+    {
+        lock_guard<mutex> guard(lock);
+        items.push_back(item);
+        if(!worker.joinable())
+            worker = thread(&Prefetcher::run, this);
+    }
+    changed.notify_all();
+}
+
+bool Prefetcher::ready(const string &filename)
+{
+    lock_guard<mutex> guard(lock);
+    auto it = find(filename);
+
+    return it != items.end() && (* it)->done;
+}
+
+Mesh * Prefetcher::take(const string &filename, bool &loaded)
+{
+    unique_lock<mutex> guard(lock);
+    auto it = find(filename);
+    shared_ptr<Item> item;
+
+    loaded = false;
+    if(it == items.end())
+        return NULL;
+    item = * it;
+    changed.wait(guard, [&item](){ return item->done; });
+    items.erase(find(filename));
+    loaded = item->loaded;
+    return item->mesh.release();
+}
+
+int Prefetcher::pending()
+{
+    lock_guard<mutex> guard(lock);
+    return (int) items.size();
+}
+
+void Prefetcher::clear()
+{
+    unique_lock<mutex> guard(lock);
+
+    for(auto it = items.begin(); it != items.end(); )
+        if((* it)->started && !(* it)->done)
+            it++;
+        else
+            it = items.erase(it);
+    if(!items.empty()) // the running item, which the worker still writes to
+    {
+        shared_ptr<Item> running = items.front();
+        changed.wait(guard, [&running](){ return running->done; });
+        items.clear();
+    }
+}
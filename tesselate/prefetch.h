@@ -0,0 +1,102 @@
+/**
+ * @file
+ *
+ * Loading of the meshes a scene will show next on a background thread, while the current one is on display.
+ */
+
+#ifndef _PREFETCH
+#define _PREFETCH
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "csg.h"
+
+/**
+ * Loads a queue of mesh files ahead of time, such as the steps of a demo or the next parts of an operator's job list,
+ * so that switching to each is immediate. Files are loaded and welded in the order queued, one at a time, on a worker
+ * thread with its own scene, and each loaded mesh is held until taken and handed to Scene::setMeshScene.
+ *
+ * A file queued with a voxel size is also voxelised and its isosurface extracted by the worker scene, which leaves
+ * the results in the on-disk stage cache. This only pays off when the scene later shown shares a cache directory
+ * with the worker scene and the same voxelisation settings, and the worker skips it when there is no cache.
+ */
+class Prefetcher
+{
+private:
+
+    /// A queued file and, once loaded, its mesh
+    struct Item
+    {
+        std::string filename;           ///< mesh file
+        float voxlen;                   ///< voxel side length to voxelise and extract at, 0 to only load
+        bool started;                   ///< the worker has taken the item
+        bool done;                      ///< the worker has finished with the item
+        bool loaded;                    ///< the file was read
+        std::unique_ptr<Mesh> mesh;     ///< loaded and fitted mesh, as Scene::prepareSTL leaves it
+    };
+
+    Scene scratch;                      ///< scene the worker loads and voxelises in
+    std::deque<std::shared_ptr<Item>> items;    ///< queued, running and loaded items, in the order queued
+    std::mutex lock;                    ///< serialises access to items and stopping
+    std::condition_variable changed;    ///< signalled when an item is queued or finished, or the worker is to stop
+    std::thread worker;                 ///< thread loading the items, started by the first queue
+    bool stopping;                      ///< the worker is to exit once its current item is done
+
+    /// Body of the worker thread
+    void run();
+
+    /// Find the first item for a file, or items.end() if there is none, with lock held
+    std::deque<std::shared_ptr<Item>>::iterator find(const std::string &filename);
+
+public:
+
+    Prefetcher();
+
+    /// Destructor, which drops the items not yet started and waits for the running one
+    ~Prefetcher();
+
+    Prefetcher(const Prefetcher &) = delete;
+    Prefetcher & operator=(const Prefetcher &) = delete;
+
+    /**
+     * Scene the worker loads and voxelises in, so that its cache directory and voxelisation settings can be matched
+     * to the scene being served
+     * @pre No items are queued or running, as after clear or before the first queue
+     */
+    Scene * getScene(){ return &scratch; }
+
+    /**
+     * Add a file to the end of the queue
+     * @param filename  STL, OBJ or indexed mesh file, as for Scene::loadSTLScene
+     * @param voxlen    voxel side length to also voxelise and extract at, or 0 to only load
+     */
+    void queue(const std::string &filename, float voxlen = 0.0f);
+
+    /**
+     * Has the first queued item for a file finished loading, so that take will not wait?
+     * @param filename  file as given to queue
+     */
+    bool ready(const std::string &filename);
+
+    /**
+     * Take the mesh loaded for the first queued item of a file, waiting for the worker to reach and finish it if
+     * necessary. Items queued ahead of it are loaded first and remain held.
+     * @param filename      file as given to queue
+     * @param[out] loaded   whether the file was read, as loadSTLScene reports it
+     * @returns the loaded mesh, owned by the caller and empty if the file could not be read, or NULL if the file was
+     *          not queued, in which case the caller should load it itself
+     */
+    Mesh * take(const std::string &filename, bool &loaded);
+
+    /// Number of items queued, running or loaded and not yet taken
+    int pending();
+
+    /// Drop every item not yet started and every loaded mesh not yet taken, and wait for the running item
+    void clear();
+};
+
+#endif
@@ -1,13 +1,26 @@
+#include <GL/glew.h>
 #include "renderer.h"
+#include "ffd.h"
 #include <cassert>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
+#include "common/timer.h"
+#include "common/trace.h"
+#include "common/log.h"
+
+// the uniform block structs are copied byte for byte, so they must match the std140 sizes of the shader blocks
+static_assert(sizeof(FrameUniforms) == 256, "FrameUniforms does not match the std140 layout of FrameBlock");
+static_assert(sizeof(MaterialUniforms) == 64, "MaterialUniforms does not match the std140 layout of MaterialBlock");
+
+static stats::TimeInit drawTime("Renderer::draw");
 
 Renderer::Renderer(QGLWidget *drawTo, const std::string& dir)
 {
     canvas = drawTo;
     shaderDir = dir;
+    shaderCache = "";
     shadersReady = false;
 
     // lights
@@ -15,9 +28,9 @@ Renderer::Renderer(QGLWidget *drawTo, const std::string& dir)
     directionalLight[0] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
     directionalLight[1] = glm::vec4(0.5f, 0.5f, 0.0f, 0.0f);
 
-    lightDiffuseColour = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f); // colour of light
+    lightDiffuseColour = glm::vec4(0.2f, 0.2f, 0.2f, 1.0f); // colour of light
     lightSpecColour = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-    lightAmbientColour = glm::vec4(0.4f, 0.4f, 0.4f, 1.0f);
+    lightAmbientColour = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
     shinySpec = 5.0f; // specular power
 
     // default camera
@@ -26,6 +39,51 @@ Renderer::Renderer(QGLWidget *drawTo, const std::string& dir)
     normalMatrix = glm::transpose(glm::inverse(glm::mat3(MVmx)));
     projMx = glm::frustum(-8.0f, 8.0f, -8.0f, 8.0f, 50.0f, 100000.0f);
     MVP = projMx  * MVmx;
+
+    // shaders and uniform buffers are set up once a context exists
+    phongProg = ffdProg = instProg = marchProg = NULL;
+    rsDepthProg = rsMeshProg = rsScreenProg = NULL;
+    frameUBO = materialUBO = 0;
+    materialStride = 0;
+    materialsDirty = true;
+
+    // no deformation until a lattice is supplied
+    latticeDim[0] = latticeDim[1] = latticeDim[2] = 0;
+    modelMx = glm::mat4(1.0f);
+    modelNormMx = glm::mat3(1.0f);
+
+    // radiance scaling is opt in, and its targets are created on the first frame that uses them
+    radiance = false;
+    radianceHalf = true;
+    depthPrepass = true;
+    interactive = false;
+    rsEnhance = rsenhancement;
+    for(int t = 0; t < 2; t++)
+    {
+        rsTargets[t].fbo = rsTargets[t].depth = 0;
+        for(int c = 0; c < rstargets; c++)
+            rsTargets[t].colour[c] = 0;
+        rsTargets[t].width = rsTargets[t].height = 0;
+    }
+    quadVAO = quadVBO = blankTex = 0;
+
+    // frames are not timed unless asked, and query support is only known once a context exists
+    timing = false;
+    timerQueries = false;
+    for(int f = 0; f < gputimerframes; f++)
+    {
+        timerFrames[f].used = 0;
+        timerFrames[f].pending = false;
+    }
+    timerFrame = 0;
+    timerOpen = false;
+    bindMs = 0.0;
+    frameBytes = 0;
+    frameStats.cpuBindMs = frameStats.cpuDrawMs = 0.0;
+    frameStats.gpuUploadMs = frameStats.gpuDrawMs = -1.0;
+    frameStats.uploadMB = 0.0;
+    frameStats.triangles = 0;
+    frameStats.drawCalls = 0;
 }
 
 Renderer::~Renderer()
@@ -38,11 +96,222 @@ Renderer::~Renderer()
     }
 }
 
+void Renderer::setLattice(ffd * lat, const glm::mat4x4 &model)
+{
+    cgp::Point corner;
+    cgp::Vector diag;
+    int dx, dy, dz, i, j, k;
+
+    lat->getDim(dx, dy, dz);
+    lat->getFrame(corner, diag);
+    latticeOrigin = glm::vec3(corner.x, corner.y, corner.z);
+    latticeDiag = glm::vec3(diag.i, diag.j, diag.k);
+    modelMx = model;
+    modelNormMx = glm::transpose(glm::inverse(glm::mat3(model)));
+
+    // the shader evaluates Bezier lattices only, and reserves room for ffdmaxorder control points along each axis
+    latticeCP.clear();
+    if(lat->isBSpline() || dx < 2 || dy < 2 || dz < 2 || dx > ffdmaxorder || dy > ffdmaxorder || dz > ffdmaxorder)
+    {
+        latticeDim[0] = latticeDim[1] = latticeDim[2] = 0;
+        return;
+    }
+    latticeDim[0] = dx; latticeDim[1] = dy; latticeDim[2] = dz;
+    for(i = 0; i < dx; i++)
+        for(j = 0; j < dy; j++)
+            for(k = 0; k < dz; k++)
+            {
+                cgp::Point p = lat->getCP(i, j, k);
+                latticeCP.push_back(p.x); latticeCP.push_back(p.y); latticeCP.push_back(p.z);
+            }
+}
+
+bool Renderer::inFrustum(const glm::vec4 * planes, const GLfloat * lo, const GLfloat * hi)
+{
+    for(int p = 0; p < 6; p++)
+    {
+        // the box corner furthest along the plane normal is the last to leave the inside
+        GLfloat x = (planes[p].x >= 0.0f) ? hi[0] : lo[0], y = (planes[p].y >= 0.0f) ? hi[1] : lo[1];
+        GLfloat z = (planes[p].z >= 0.0f) ? hi[2] : lo[2];
+        if(planes[p].x * x + planes[p].y * y + planes[p].z * z + planes[p].w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void Renderer::uploadFrame()
+{
+    FrameUniforms frame;
+    const GLfloat * nmx = glm::value_ptr(normalMatrix);
+    int c, r;
+
+    frame.MV = MVmx;
+    frame.MVproj = MVP;
+    for(c = 0; c < 3; c++)
+    {
+        for(r = 0; r < 3; r++)
+            frame.normMx[c*4+r] = nmx[c*3+r];
+        frame.normMx[c*4+3] = 0.0f;
+    }
+    // the shaders light from the eye, which is what they received before the light was held in a uniform block
+    frame.lightpos = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    frame.diffuseCol = lightDiffuseColour;
+    frame.ambientCol = lightAmbientColour;
+    frame.specularCol = lightSpecColour;
+    frame.shiny = shinySpec;
+    frame.pad[0] = frame.pad[1] = frame.pad[2] = 0.0f;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO); CE();
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &frame, GL_STREAM_DRAW); CE();
+    frameBytes += sizeof(FrameUniforms);
+    glBindBufferBase(GL_UNIFORM_BUFFER, frameblockbinding, frameUBO); CE();
+}
+
+void Renderer::uploadMaterials()
+{
+    std::vector<unsigned char> data(materialStride * drawCallData.size());
+    MaterialUniforms mat;
+
+    for (int i = 0; i < (int)drawCallData.size(); i++)
+    {
+        mat.matDiffuse = glm::vec4(drawCallData[i].diffuse[0], drawCallData[i].diffuse[1],
+                                   drawCallData[i].diffuse[2], drawCallData[i].diffuse[3]);
+        mat.matAmbient = glm::vec4(drawCallData[i].ambient[0], drawCallData[i].ambient[1],
+                                   drawCallData[i].ambient[2], drawCallData[i].ambient[3]);
+        mat.matSpec = glm::vec4(drawCallData[i].specular[0], drawCallData[i].specular[1],
+                                drawCallData[i].specular[2], drawCallData[i].specular[3]);
+        mat.matHighlight = glm::vec4(drawCallData[i].highlight[0], drawCallData[i].highlight[1],
+                                     drawCallData[i].highlight[2], drawCallData[i].highlight[3]);
+        memcpy(&data[i * materialStride], &mat, sizeof(MaterialUniforms));
+    }
+    if(!data.empty())
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, materialUBO); CE();
+        glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr) data.size(), &data[0], GL_DYNAMIC_DRAW); CE();
+        frameBytes += data.size();
+    }
+    materialsDirty = false;
+}
+
+void Renderer::setTiming(bool on)
+{
+    timing = on;
+    frameStats.gpuUploadMs = frameStats.gpuDrawMs = -1.0;
+}
+
+void Renderer::beginGPUTimer(const char * name)
+{
+    if(!timing || !timerQueries)
+        return;
+    endGPUTimer(); // GL_TIME_ELAPSED queries cannot overlap
+
+    TimerFrame &frame = timerFrames[timerFrame];
+    if(frame.used == (int) frame.queries.size())
+    {
+        GLuint query;
+        glGenQueries(1, &query); CE();
+        frame.queries.push_back(query);
+        frame.names.push_back(name);
+        frame.starts.push_back(0);
+    }
+    frame.names[frame.used] = name;
+    frame.starts[frame.used] = stats::traceClock();
+    glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.used]); CE();
+    frame.used++;
+    frame.pending = true;
+    timerOpen = true;
+}
+
+void Renderer::endGPUTimer()
+{
+    if(timerOpen)
+    {
+        glEndQuery(GL_TIME_ELAPSED); CE();
+        timerOpen = false;
+    }
+}
+
+void Renderer::beginFrame()
+{
+    if(!timing)
+        return;
+
+    // the oldest frame of the ring is reused, dropping its results if the GPU has still not finished it
+    collectGPUTimes();
+    timerFrame = (timerFrame + 1) % gputimerframes;
+    timerFrames[timerFrame].used = 0;
+    timerFrames[timerFrame].pending = false;
+
+    ShapeGeometry::takeUploadedBytes(); // uploads between timed frames are not charged to this one
+    frameBytes = 0;
+    frameStart = stats::clock_type::now();
+    beginGPUTimer("upload");
+}
+
+void Renderer::endBind()
+{
+    if(!timing)
+        return;
+    endGPUTimer();
+    bindMs = std::chrono::duration<double, std::milli>(stats::clock_type::now() - frameStart).count();
+    frameBytes += ShapeGeometry::takeUploadedBytes();
+}
+
+bool Renderer::collectGPUTimes()
+{
+    bool waiting = false;
+
+    if(!timerQueries)
+        return false;
+
+    // oldest first, so that the stats are left holding the most recent finished frame
+    for(int n = 1; n <= gputimerframes; n++)
+    {
+        TimerFrame &frame = timerFrames[(timerFrame + n) % gputimerframes];
+        GLint available = 0;
+        double upload = 0.0, draw = 0.0;
+
+        if(!frame.pending || frame.used == 0 || (n == gputimerframes && timerOpen))
+            continue;
+
+        // queries complete in order, so the last being available means the whole frame is
+        glGetQueryObjectiv(frame.queries[frame.used-1], GL_QUERY_RESULT_AVAILABLE, &available); CE();
+        if(!available)
+        {
+            waiting = true;
+            continue;
+        }
+        for(int q = 0; q < frame.used; q++)
+        {
+            GLuint64 elapsed = 0;
+            stats::TraceEvent event;
+
+            glGetQueryObjectui64v(frame.queries[q], GL_QUERY_RESULT, &elapsed); CE();
+            if(strcmp(frame.names[q], "upload") == 0)
+                upload += (double) elapsed * 1.0e-6;
+            else
+                draw += (double) elapsed * 1.0e-6;
+
+            // GPU spans are placed at their submission, which they cannot precede
+            event.name = frame.names[q];
+            event.argname = nullptr;
+            event.arg = 0;
+            event.begin = frame.starts[q];
+            event.end = frame.starts[q] + (std::int64_t) elapsed;
+            stats::recordTraceEvent("GPU", event);
+        }
+        frameStats.gpuUploadMs = upload;
+        frameStats.gpuDrawMs = draw;
+        frame.pending = false;
+    }
+    return waiting;
+}
+
 void Renderer::initShaders(void)
 {
     // set up shaders for loading and compilation
 
-    if (shadersReady) return; // already compiled
+    if (shadersReady) return; // already set up
 
     shaderProgram *s;
 
@@ -58,6 +327,18 @@ void Renderer::initShaders(void)
     s->setShaderSources(std::string("phong.frag"), std::string("phong.vert"));
     shaders["phong"] = s;
 
+    s = new shaderProgram();
+    s->setShaderSources(std::string("phong.frag"), std::string("ffdPhong.vert"));
+    shaders["ffdPhong"] = s;
+
+    s = new shaderProgram();
+    s->setShaderSources(std::string("phong.frag"), std::string("phongInst.vert"));
+    shaders["phongInst"] = s;
+
+    s = new shaderProgram();
+    s->setShaderSources(std::string("voxmarch.frag"), std::string("voxmarch.vert"));
+    shaders["voxmarch"] = s;
+
     s = new shaderProgram();
     s->setShaderSources(std::string("rad_scaling_pass1.frag"), std::string("rad_scaling_pass1.vert"));
     shaders["rscale1"] = s;
@@ -66,6 +347,14 @@ void Renderer::initShaders(void)
     s->setShaderSources(std::string("rad_scaling_pass2.frag"), std::string("rad_scaling_pass2.vert"));
     shaders["rscale2"] = s;
 
+    s = new shaderProgram();
+    s->setShaderSources(std::string("rad_scaling_pass1.frag"), std::string("rad_scaling_mesh.vert"));
+    shaders["rscaleMesh"] = s;
+
+    s = new shaderProgram();
+    s->setShaderSources(std::string("rad_scaling_depth.frag"), std::string("rad_scaling_mesh.vert"));
+    shaders["rscaleDepth"] = s;
+
     s = new shaderProgram();
     s->setShaderSources(std::string("phongRS.frag"), std::string("phongRS.vert"));
     shaders["phongRS"] = s;
@@ -74,24 +363,47 @@ void Renderer::initShaders(void)
     s->setShaderSources(std::string("phongRSmanip.frag"), std::string("phongRSmanip.vert"));
     shaders["phongRSmanip"] = s;
 
-    std::cout << "Compiling shaders...\n";
+    // compiling every program upfront slows startup, so each is compiled the first time it is drawn with
     std::map<std::string, shaderProgram*>::iterator it = shaders.begin();
     while (it != shaders.end())
     {
-        std::cout << " -- shader: " << (*it).first << " -- ";
-        (void)((*it).second)->compileAndLink();
-        std::cout << "ID = " << ((*it).second)->getProgramID() << std::endl;
+        ((*it).second)->setBinaryCache(shaderCache);
         it++;
     }
     shadersReady = true;
-    std::cout << "done!\n";
+}
+
+shaderProgram * Renderer::program(const std::string& name)
+{
+    std::map<std::string, shaderProgram*>::iterator it = shaders.find(name);
+
+    if (it == shaders.end())
+        return NULL;
+
+    shaderProgram * s = (*it).second;
+    if (!s->initialised())
+    {
+        // a failure is reported by the first attempt and not retried
+        if (!s->compileAndLink())
+            return NULL;
+        UTS_LOG(INFO, RENDER, " -- shader: ", name, (s->cached() ? " loaded" : " compiled"), " -- ID = ", s->getProgramID());
+        s->bindUniformBlock("FrameBlock", frameblockbinding);
+        s->bindUniformBlock("MaterialBlock", materialblockbinding);
+    }
+    return s;
 }
 
 void Renderer::draw(View * view)
 {
+    stats::Timer timer(drawTime);
+    UTS_TRACE_SCOPE("Renderer::draw");
+    stats::clock_type::time_point drawStart = stats::clock_type::now();
+    std::int64_t triangles = 0;
+    int drawCalls = 0;
+
     if (!shadersReady) // not compiled!
     {
-        std::cerr << "Shaders not built before draw() call - compiling...\n";
+        UTS_LOG(WARNING, RENDER, "Shaders not built before draw() call - compiling...");
         initShaders();
     }
 
@@ -113,42 +425,366 @@ void Renderer::draw(View * view)
     MVmx = view->getViewMtx();
     projMx = view->getProjMtx();
 
-    GLuint programID = (*shaders["phong"]).getProgramID();
+    // uniform buffers are created on the first frame, once extension entry points are available
+    if(frameUBO == 0)
+    {
+        GLint align;
 
-    glUseProgram(programID); CE();
+        glGenBuffers(1, &frameUBO); CE();
+        glGenBuffers(1, &materialUBO); CE();
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align); CE();
+        align = std::max(align, 1);
+        materialStride = (((GLsizeiptr) sizeof(MaterialUniforms) + align - 1) / align) * align;
+        materialsDirty = true;
+        timerQueries = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    }
 
-    for (int i = 0; i < (int)drawCallData.size(); i++)
-    {
-        glUniformMatrix4fv(glGetUniformLocation(programID, "MV"), 1, GL_FALSE, glm::value_ptr(MVmx) ); CE();
-        glUniformMatrix4fv(glGetUniformLocation(programID, "MVproj"), 1, GL_FALSE, glm::value_ptr(MVP) ); CE();
-        glUniformMatrix3fv(glGetUniformLocation(programID, "normMx"), 1, GL_FALSE, glm::value_ptr(normalMatrix)); CE();
-
-        glm::vec4 MatDiffuse = glm::vec4(drawCallData[i].diffuse[0], drawCallData[i].diffuse[1],
-                                         drawCallData[i].diffuse[2], drawCallData[i].diffuse[3]); // diffuse colour
-        glm::vec4 MatAmbient = glm::vec4(drawCallData[i].ambient[0], drawCallData[i].ambient[1],
-                                         drawCallData[i].ambient[2], drawCallData[i].ambient[3]); // ambient colour
-        glm::vec4 MatSpecular = glm::vec4(drawCallData[i].specular[0], drawCallData[i].specular[1],
-                                          drawCallData[i].specular[2], drawCallData[i].specular[3]); // specular colour
-        glm::vec4 lightDiffuseColour = glm::vec4(0.2f, 0.2f, 0.2f, 1.0f); // colour of light
-        glm::vec4 lightAmbientColour = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
-
-        // set colours and light
-        glUniform4fv(glGetUniformLocation(programID, "matDiffuse"), 1, glm::value_ptr(MatDiffuse) ); CE();
-        glUniform4fv(glGetUniformLocation(programID, "matAmbient"), 1, glm::value_ptr(MatAmbient) ); CE();
-        glUniform4fv(glGetUniformLocation(programID, "matSpec"), 1, glm::value_ptr(MatSpecular) ); CE();
-        glUniform4fv(glGetUniformLocation(programID, "lightPos"), 1, glm::value_ptr(pointLight)); CE();
-        glUniform4fv(glGetUniformLocation(programID, "diffuseCol"), 1, glm::value_ptr(lightDiffuseColour) ); CE();
-        glUniform4fv(glGetUniformLocation(programID, "ambientCol"), 1, glm::value_ptr(lightAmbientColour) ); CE();
-        glUniform4fv(glGetUniformLocation(programID, "specularCol"), 1, glm::value_ptr(lightSpecColour) ); CE();
-        glUniform1f(glGetUniformLocation(programID, "shiny"), shinySpec); CE();
+    // camera and lights are written once per frame, materials only when the draw parameters change
+    uploadFrame();
+    if(materialsDirty)
+        uploadMaterials();
 
-        glBindVertexArray(drawCallData[i].VAO); CE();
-        glDrawElements(GL_TRIANGLES, drawCallData[i].indexBufSize, GL_UNSIGNED_INT, (void*)(0)); CE();
-        glBindVertexArray(0); CE();
+    glm::vec4 planes[6];
+
+    // frustum planes in world space are the sums and differences of the last row of MVP with the others
+    glm::mat4x4 tMVP = glm::transpose(MVP);
+    for(int r = 0; r < 3; r++)
+    {
+        planes[2*r] = tMVP[3] + tMVP[r];
+        planes[2*r+1] = tMVP[3] - tMVP[r];
     }
+
+    // the meshes left out of radiance scaling are drawn over it, depth tested against what it restored
+    if(radiance && drawRadianceScaled(viewport, planes, triangles, drawCalls))
+        drawPass(DrawPass::OVERLAY, planes, triangles, drawCalls);
+    else
+        drawPass(DrawPass::FORWARD, planes, triangles, drawCalls);
     
     // unbind vao
     glBindVertexArray(0); CE();
 
     glUseProgram(0);  CE();
-}
\ No newline at end of file
+
+    if(timing)
+    {
+        frameStats.cpuBindMs = bindMs;
+        frameStats.cpuDrawMs = std::chrono::duration<double, std::milli>(stats::clock_type::now() - drawStart).count();
+        frameStats.uploadMB = (double) (frameBytes + ShapeGeometry::takeUploadedBytes()) / (1024.0 * 1024.0);
+        frameStats.triangles = triangles;
+        frameStats.drawCalls = drawCalls;
+        bindMs = 0.0;
+        frameBytes = 0;
+    }
+}
+
+void Renderer::drawPass(DrawPass pass, const glm::vec4 * planes, std::int64_t &triangles, int &drawCalls)
+{
+    shaderProgram * current = NULL;
+    bool latticeSent = false;
+    std::vector<GLsizei> runCounts;
+    std::vector<const GLvoid *> runOffsets;
+
+    for (int i = 0; i < (int)drawCallData.size(); i++)
+    {
+        // radiance scaling takes the plain meshes, and leaves the rest to the overlay
+        const VolumeDrawData &vol = drawCallData[i].volume;
+        bool plain = vol.voxelTex == 0 && !drawCallData[i].deformed && drawCallData[i].instances == 0;
+        bool scaled = (pass == DrawPass::DEPTH || pass == DrawPass::GBUFFER);
+        if((scaled && !plain) || (pass == DrawPass::OVERLAY && plain))
+            continue;
+
+        // chunks in view, with runs of consecutive chunks merged, so that only what is on screen is drawn
+        bool culled = !drawCallData[i].chunks.empty() && !drawCallData[i].deformed && drawCallData[i].instances == 0;
+        if(culled)
+        {
+            const std::vector<DrawChunk> &chunks = drawCallData[i].chunks;
+            size_t isize = (drawCallData[i].indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+            GLuint runEnd = 0;
+
+            runCounts.clear();
+            runOffsets.clear();
+            for(int c = 0; c < (int) chunks.size(); c++)
+            {
+                if(!inFrustum(planes, chunks[c].lo, chunks[c].hi))
+                    continue;
+                if(!runCounts.empty() && chunks[c].first == runEnd)
+                    runCounts.back() += (GLsizei) chunks[c].count;
+                else
+                {
+                    runCounts.push_back((GLsizei) chunks[c].count);
+                    runOffsets.push_back((const GLvoid *) (chunks[c].first * isize));
+                }
+                runEnd = chunks[c].first + chunks[c].count;
+            }
+            if(runCounts.empty()) // entirely out of view
+                continue;
+        }
+
+        // undeformed geometry is warped by the lattice on the GPU, instances are offset, everything else is drawn as is
+        shaderProgram * prog;
+        const char * span;
+        if(pass == DrawPass::DEPTH)
+        {
+            if(rsDepthProg == NULL)
+                rsDepthProg = program("rscaleDepth");
+            prog = rsDepthProg;
+            span = "draw depth pre-pass";
+        }
+        else if(pass == DrawPass::GBUFFER)
+        {
+            if(rsMeshProg == NULL)
+                rsMeshProg = program("rscaleMesh");
+            prog = rsMeshProg;
+            span = "draw rscaleMesh";
+        }
+        else if(vol.voxelTex != 0)
+        {
+            if(marchProg == NULL)
+                marchProg = program("voxmarch");
+            prog = marchProg;
+            span = "draw voxmarch";
+        }
+        else if(drawCallData[i].deformed)
+        {
+            if(ffdProg == NULL)
+                ffdProg = program("ffdPhong");
+            prog = ffdProg;
+            span = "draw ffdPhong";
+        }
+        else if(drawCallData[i].instances > 0)
+        {
+            if(instProg == NULL)
+                instProg = program("phongInst");
+            prog = instProg;
+            span = "draw phongInst";
+        }
+        else
+        {
+            if(phongProg == NULL)
+                phongProg = program("phong");
+            prog = phongProg;
+            span = "draw phong";
+        }
+        if(prog == NULL) // failed to compile
+            continue;
+
+        if(prog != current)
+        {
+            glUseProgram(prog->getProgramID()); CE();
+            current = prog;
+        }
+        if(drawCallData[i].deformed && !latticeSent)
+        {
+            glUniformMatrix4fv(prog->getUniformLocation("modelMx"), 1, GL_FALSE, glm::value_ptr(modelMx)); CE();
+            glUniformMatrix3fv(prog->getUniformLocation("modelNormMx"), 1, GL_FALSE, glm::value_ptr(modelNormMx)); CE();
+            glUniform3iv(prog->getUniformLocation("latticeDim"), 1, latticeDim); CE();
+            glUniform3fv(prog->getUniformLocation("latticeOrigin"), 1, glm::value_ptr(latticeOrigin)); CE();
+            glUniform3fv(prog->getUniformLocation("latticeDiag"), 1, glm::value_ptr(latticeDiag)); CE();
+            if(!latticeCP.empty())
+            {
+                glUniform3fv(prog->getUniformLocation("latticeCP"), (GLsizei) latticeCP.size() / 3, &latticeCP[0]); CE();
+            }
+            latticeSent = true;
+        }
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, materialblockbinding, materialUBO, i * materialStride,
+                          sizeof(MaterialUniforms)); CE();
+        glBindVertexArray(drawCallData[i].VAO); CE();
+        if(vol.voxelTex != 0)
+        {
+            glm::vec4 eye = glm::inverse(MVmx)[3];
+
+            glActiveTexture(GL_TEXTURE1); CE();
+            glBindTexture(GL_TEXTURE_3D, vol.occupancyTex); CE();
+            glActiveTexture(GL_TEXTURE0); CE();
+            glBindTexture(GL_TEXTURE_3D, vol.voxelTex); CE();
+            glUniform1i(prog->getUniformLocation("voxels"), 0); CE();
+            glUniform1i(prog->getUniformLocation("occupancy"), 1); CE();
+            glUniform3iv(prog->getUniformLocation("dim"), 1, vol.dim); CE();
+            glUniform1i(prog->getUniformLocation("block"), vol.block); CE();
+            glUniform3fv(prog->getUniformLocation("origin"), 1, vol.origin); CE();
+            glUniform3fv(prog->getUniformLocation("cell"), 1, vol.cell); CE();
+            glUniform3f(prog->getUniformLocation("eye"), eye.x, eye.y, eye.z); CE();
+            glCullFace(GL_FRONT); CE(); // rays start from the far side of the box, so the camera may be inside it
+        }
+        beginGPUTimer(span);
+        if(culled)
+        {
+            glMultiDrawElements(GL_TRIANGLES, &runCounts[0], drawCallData[i].indexType,
+                                const_cast<const GLvoid **>(&runOffsets[0]), (GLsizei) runCounts.size()); CE();
+            for(GLsizei count : runCounts)
+                triangles += count / 3;
+        }
+        else if(drawCallData[i].instances > 0)
+        {
+            glDrawElementsInstanced(GL_TRIANGLES, drawCallData[i].indexBufSize, drawCallData[i].indexType, (void*)(0),
+                                    drawCallData[i].instances); CE();
+            triangles += (std::int64_t) (drawCallData[i].indexBufSize / 3) * drawCallData[i].instances;
+        }
+        else
+        {
+            glDrawElements(GL_TRIANGLES, drawCallData[i].indexBufSize, drawCallData[i].indexType, (void*)(0)); CE();
+            triangles += drawCallData[i].indexBufSize / 3;
+        }
+        endGPUTimer();
+        if(vol.voxelTex != 0)
+        {
+            glCullFace(GL_BACK); CE();
+            glActiveTexture(GL_TEXTURE1); CE();
+            glBindTexture(GL_TEXTURE_3D, 0); CE();
+            glActiveTexture(GL_TEXTURE0); CE();
+            glBindTexture(GL_TEXTURE_3D, 0); CE();
+        }
+        drawCalls++;
+        glBindVertexArray(0); CE();
+    }
+}
+
+bool Renderer::bindRadianceTargets(RadianceTargets &targets, int w, int h)
+{
+    static const GLenum formats[rstargets] = {GL_RGBA16F, GL_RGBA32F, GL_RGBA8}; // window depth needs full precision
+    static const GLenum buffers[rstargets] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+    GLenum status;
+
+    if(targets.fbo == 0)
+    {
+        glGenFramebuffers(1, &targets.fbo); CE();
+        glGenTextures(rstargets, targets.colour); CE();
+        glGenTextures(1, &targets.depth); CE();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, targets.fbo); CE();
+
+    // storage follows the viewport, but the framebuffer and its attachments are kept
+    if(targets.width != w || targets.height != h)
+    {
+        for(int c = 0; c < rstargets; c++)
+        {
+            glBindTexture(GL_TEXTURE_2D, targets.colour[c]); CE();
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[c], w, h, 0, GL_RGBA, GL_FLOAT, NULL); CE();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); CE();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); CE();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); CE();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); CE();
+            glFramebufferTexture2D(GL_FRAMEBUFFER, buffers[c], GL_TEXTURE_2D, targets.colour[c], 0); CE();
+        }
+        glBindTexture(GL_TEXTURE_2D, targets.depth); CE();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL); CE();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); CE();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); CE();
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, targets.depth, 0); CE();
+        glBindTexture(GL_TEXTURE_2D, 0); CE();
+        glDrawBuffers(rstargets, buffers); CE();
+        targets.width = w;
+        targets.height = h;
+    }
+
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Error Renderer::bindRadianceTargets: framebuffer incomplete, status " << status << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0); CE();
+        return false;
+    }
+    return true;
+}
+
+bool Renderer::drawRadianceScaled(const GLint * viewport, const glm::vec4 * planes, std::int64_t &triangles, int &drawCalls)
+{
+    bool half = radianceHalf && interactive;
+    RadianceTargets &targets = rsTargets[half ? 1 : 0];
+    int w = half ? std::max(viewport[2] / 2, 1) : viewport[2], h = half ? std::max(viewport[3] / 2, 1) : viewport[3];
+    const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f}, background[4] = {1.0f, 1.0f, 1.0f, 1.0f}, farDepth = 1.0f;
+    glm::vec4 light0 = MVmx * directionalLight[0], light1 = MVmx * directionalLight[1];
+
+    if(rsScreenProg == NULL)
+        rsScreenProg = program("rscale2");
+    if(rsScreenProg == NULL || !bindRadianceTargets(targets, w, h))
+    {
+        radiance = false; // reported once, and Phong from here on
+        return false;
+    }
+
+    // screen-aligned quad as clip space position and texture coordinates, and a transparent manipulator overlay
+    if(quadVAO == 0)
+    {
+        const GLfloat quad[16] = {-1.0f, -1.0f, 0.0f, 0.0f,  1.0f, -1.0f, 1.0f, 0.0f,
+                                  -1.0f, 1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f, 1.0f};
+        const GLubyte clear[4] = {0, 0, 0, 0};
+
+        glGenVertexArrays(1, &quadVAO); CE();
+        glGenBuffers(1, &quadVBO); CE();
+        glBindVertexArray(quadVAO); CE();
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO); CE();
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW); CE();
+        glEnableVertexAttribArray(0); CE();
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void *) 0); CE();
+        glEnableVertexAttribArray(1); CE();
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void *) (2 * sizeof(GLfloat))); CE();
+        glBindVertexArray(0); CE();
+        glBindBuffer(GL_ARRAY_BUFFER, 0); CE();
+
+        glGenTextures(1, &blankTex); CE();
+        glBindTexture(GL_TEXTURE_2D, blankTex); CE();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, clear); CE();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); CE();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); CE();
+        glBindTexture(GL_TEXTURE_2D, 0); CE();
+    }
+
+    // G-buffer, with normals cleared to zero to mark the background, which keeps the window colour
+    glViewport(0, 0, w, h); CE();
+    glClearBufferfv(GL_COLOR, 0, zero); CE();
+    glClearBufferfv(GL_COLOR, 1, zero); CE();
+    glClearBufferfv(GL_COLOR, 2, background); CE();
+    glClearBufferfv(GL_DEPTH, 0, &farDepth); CE();
+    if(depthPrepass)
+    {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE); CE();
+        drawPass(DrawPass::DEPTH, planes, triangles, drawCalls);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); CE();
+        glDepthMask(GL_FALSE); CE(); // already laid down, so only the nearest fragment of each pixel passes
+    }
+    drawPass(DrawPass::GBUFFER, planes, triangles, drawCalls);
+    glDepthMask(GL_TRUE); CE();
+
+    // screen pass into the window, which writes the depth saved in the G-buffer so the overlay is hidden correctly
+    glBindFramebuffer(GL_FRAMEBUFFER, 0); CE();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]); CE();
+    glDepthFunc(GL_ALWAYS); CE();
+    glDisable(GL_CULL_FACE); CE();
+    glUseProgram(rsScreenProg->getProgramID()); CE();
+    for(int c = 0; c < rstargets; c++)
+    {
+        glActiveTexture(GL_TEXTURE0 + c); CE();
+        glBindTexture(GL_TEXTURE_2D, targets.colour[c]); CE();
+    }
+    glActiveTexture(GL_TEXTURE0 + rstargets); CE();
+    glBindTexture(GL_TEXTURE_2D, blankTex); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("grad"), 0); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("norm"), 1); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("colormap"), 2); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("manipTTexture"), rstargets); CE();
+    glUniform1f(rsScreenProg->getUniformLocation("sw"), 1.0f / (float) w); CE();
+    glUniform1f(rsScreenProg->getUniformLocation("sh"), 1.0f / (float) h); CE();
+    glUniform4fv(rsScreenProg->getUniformLocation("lightPos0"), 1, glm::value_ptr(light0)); CE();
+    glUniform4fv(rsScreenProg->getUniformLocation("lightPos1"), 1, glm::value_ptr(light1)); CE();
+    glUniform1f(rsScreenProg->getUniformLocation("enhancement"), rsEnhance); CE();
+    glUniform1f(rsScreenProg->getUniformLocation("transition"), 1.0f); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("enabled"), 1); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("invert"), 0); CE();
+    glUniform1i(rsScreenProg->getUniformLocation("display"), 0); CE(); // lambertian, lit by the directional lights
+    glUniform1i(rsScreenProg->getUniformLocation("twoLS"), 0); CE();
+    beginGPUTimer("draw rscale2");
+    glBindVertexArray(quadVAO); CE();
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); CE();
+    endGPUTimer();
+    glBindVertexArray(0); CE();
+    for(int c = rstargets; c >= 0; c--)
+    {
+        glActiveTexture(GL_TEXTURE0 + c); CE();
+        glBindTexture(GL_TEXTURE_2D, 0); CE();
+    }
+    glEnable(GL_CULL_FACE); CE();
+    glDepthFunc(GL_LEQUAL); CE();
+    return true;
+}
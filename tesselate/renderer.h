@@ -7,16 +7,90 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <cstdint>
 #include "glheaders.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 //#include <common/map.h>
 #include <common/debug_string.h>
+#include <common/timer.h>
 #include "shaderProgram.h"
 #include <QGLWidget>
 #include "shape.h"
 
+class ffd;
+
+const GLuint frameblockbinding = 0;     ///< uniform buffer binding point for per-frame camera and light state
+const GLuint materialblockbinding = 1;  ///< uniform buffer binding point for per-draw material ranges
+const int gputimerframes = 4;           ///< frames of GPU timer queries in flight before the oldest is read back
+const int rstargets = 3;                ///< colour targets of the radiance scaling G-buffer
+const float rsenhancement = 0.5f;       ///< default curvature enhancement of radiance scaling
+
+/**
+ * Cost of the last frame drawn with timing enabled. GPU times trail the CPU figures by the frames in flight.
+ */
+struct FrameStats
+{
+    double cpuBindMs;       ///< CPU time spent binding geometry before the draw
+    double cpuDrawMs;       ///< CPU time spent issuing the draw calls
+    double gpuUploadMs;     ///< GPU time of the geometry uploads, or negative if not yet known
+    double gpuDrawMs;       ///< GPU time of the draw calls, or negative if not yet known
+    double uploadMB;        ///< megabytes written to vertex, index, instance and uniform buffers
+    std::int64_t triangles; ///< triangles submitted, after frustum culling and counting every instance
+    int drawCalls;          ///< draw calls issued
+};
+
+/**
+ * Render targets of the first radiance scaling pass, kept from frame to frame so that the framebuffer is created
+ * once and its textures are only reallocated when the size they are drawn at changes
+ */
+struct RadianceTargets
+{
+    GLuint fbo;                 ///< framebuffer, 0 until first used
+    GLuint colour[rstargets];   ///< screen-space gradient and log depth, normal and window depth, and surface colour
+    GLuint depth;               ///< depth attachment, laid down by the depth pre-pass
+    int width, height;          ///< size of the textures in pixels, 0 before they are allocated
+};
+
+/**
+ * Which draw calls a pass of Renderer::draw issues, and with which programs
+ */
+enum class DrawPass
+{
+    FORWARD,    ///< every draw call, shaded into the window
+    DEPTH,      ///< plain meshes, depth only, into the radiance scaling targets
+    GBUFFER,    ///< plain meshes, into the radiance scaling targets
+    OVERLAY     ///< the draw calls radiance scaling leaves out, shaded into the window over its result
+};
+
+/**
+ * Camera and light state in std140 layout, matching FrameBlock in the Phong shaders
+ */
+struct FrameUniforms
+{
+    glm::mat4x4 MV;             ///< model-view matrix
+    glm::mat4x4 MVproj;         ///< model-view-projection matrix
+    GLfloat normMx[12];         ///< normal matrix, one padded column of 4 floats per matrix column
+    glm::vec4 lightpos;         ///< light position in camera space
+    glm::vec4 diffuseCol;       ///< diffuse colour of light source
+    glm::vec4 ambientCol;       ///< ambient colour of light source
+    glm::vec4 specularCol;      ///< specular colour of light source
+    GLfloat shiny;              ///< specular coefficient
+    GLfloat pad[3];             ///< padding to the std140 block size
+};
+
+/**
+ * Material of one draw call in std140 layout, matching MaterialBlock in the Phong shaders
+ */
+struct MaterialUniforms
+{
+    glm::vec4 matDiffuse;       ///< diffuse colour
+    glm::vec4 matAmbient;       ///< ambient colour
+    glm::vec4 matSpec;          ///< specular colour
+    glm::vec4 matHighlight;     ///< diffuse colour of highlighted instances
+};
+
 /**
  * Class for managing OpenGL 3.2 rendering
  */
@@ -27,6 +101,7 @@ private:
     QGLWidget *canvas;              ///< Qt drawing surface
 
     std::string shaderDir;          ///< location of all shaders
+    std::string shaderCache;        ///< directory of linked program binaries, empty if they are not cached
 
     glm::vec4 pointLight;           ///< position of light source in world space
     glm::vec4 directionalLight[2];  ///< directional lights (vector) for radiance scaling
@@ -41,8 +116,121 @@ private:
     glm::mat3x3 normalMatrix;       ///< normal transformation matrix
 
     std::map<std::string, shaderProgram*> shaders;  ///< available shaders
+    shaderProgram * phongProg;                      ///< Phong shader, looked up on first use
+    shaderProgram * ffdProg;                        ///< Phong shader with lattice deformation, looked up on first use
+    shaderProgram * instProg;                       ///< Phong shader for instanced draws, looked up on first use
+    shaderProgram * marchProg;                      ///< ray marcher for voxel volumes, looked up on first use
+    shaderProgram * rsDepthProg;                    ///< radiance scaling depth pre-pass, looked up on first use
+    shaderProgram * rsMeshProg;                     ///< radiance scaling G-buffer pass for meshes, looked up on first use
+    shaderProgram * rsScreenProg;                   ///< radiance scaling screen pass, looked up on first use
     std::vector<ShapeDrawData> drawCallData;        ///< drawing state for scene shapes
 
+    GLuint frameUBO;                ///< uniform buffer holding FrameUniforms, rewritten once per frame
+    GLuint materialUBO;             ///< uniform buffer holding one MaterialUniforms range per draw call
+    GLsizeiptr materialStride;      ///< spacing of material ranges, rounded up to the driver's offset alignment
+    bool materialsDirty;            ///< draw parameters changed since the material buffer was last written
+
+    // lattice applied in the vertex shader to draw calls marked as deformed
+    GLint latticeDim[3];                ///< control points along each axis, zero if the lattice is unsupported
+    glm::vec3 latticeOrigin;            ///< bottom left front corner of the undeformed lattice
+    glm::vec3 latticeDiag;              ///< diagonal extent of the undeformed lattice
+    std::vector<GLfloat> latticeCP;     ///< control point coordinates, 3 per point, indexed as in the lattice
+    glm::mat4x4 modelMx;                ///< transformation from deformed mesh space to world space
+    glm::mat3x3 modelNormMx;            ///< normal transformation matrix for modelMx
+
+    // radiance scaling of plain meshes, with deformed, instanced and voxel draw calls shaded as usual over the top
+    bool radiance;                      ///< shade meshes by radiance scaling rather than Phong
+    bool radianceHalf;                  ///< render the G-buffer at half resolution while the view moves
+    bool depthPrepass;                  ///< lay down depth before the G-buffer pass, so that it shades each pixel once
+    bool interactive;                   ///< the view is moving
+    float rsEnhance;                    ///< curvature enhancement of radiance scaling
+    RadianceTargets rsTargets[2];       ///< full and half resolution targets, both kept so that switching reallocates nothing
+    GLuint quadVAO, quadVBO;            ///< screen-aligned quad drawn by the screen pass
+    GLuint blankTex;                    ///< transparent texel standing in for the manipulator overlay of the screen pass
+
+    /// GPU timer queries issued during one frame, read back once the GPU has finished it
+    struct TimerFrame
+    {
+        std::vector<GLuint> queries;        ///< query objects, created as a frame first needs them
+        std::vector<const char *> names;    ///< span measured by each query in use
+        std::vector<std::int64_t> starts;   ///< trace clock at which each span was submitted
+        int used;                           ///< queries in use this frame
+        bool pending;                       ///< results are still to be read
+    };
+
+    // frame timing
+    bool timing;                        ///< measure the cost of each frame
+    bool timerQueries;                  ///< the context supports GL_TIME_ELAPSED queries
+    TimerFrame timerFrames[gputimerframes]; ///< ring of frames of queries
+    int timerFrame;                     ///< frame of the ring receiving the current queries
+    bool timerOpen;                     ///< a query of the current frame has begun but not ended
+    stats::clock_type::time_point frameStart;  ///< when the current frame began binding
+    double bindMs;                      ///< CPU time of the binding in the current frame, in milliseconds
+    size_t frameBytes;                  ///< bytes uploaded so far in the current frame
+    FrameStats frameStats;              ///< cost of the last complete frame
+
+    /**
+     * Start a GPU timer query covering the GL commands that follow, if timing is enabled and supported
+     * @param name  span name, a string literal, reported in the trace
+     */
+    void beginGPUTimer(const char * name);
+
+    /// End the open GPU timer query, if any
+    void endGPUTimer();
+
+    /**
+     * Look up a shader program, compiling it or loading it from the binary cache the first time it is needed, and
+     * attaching its uniform blocks to the shared binding points
+     * @param name  name under which initShaders registered the program
+     * @returns the linked program, or NULL if there is no such program or it failed to compile
+     */
+    shaderProgram * program(const std::string& name);
+
+    /**
+     * Test whether an axis-aligned box is at least partly inside the view frustum. Boxes near a frustum corner may
+     * pass without being visible, but no visible box fails.
+     * @param planes    six frustum planes in world space as (normal, offset), positive inside
+     * @param lo, hi    opposite corners of the box
+     */
+    static bool inFrustum(const glm::vec4 * planes, const GLfloat * lo, const GLfloat * hi);
+
+    /// Write the per-frame uniform buffer from the current view and lights
+    void uploadFrame();
+
+    /**
+     * Issue the draw calls of one pass
+     * @param pass              which draw calls to issue and with which programs
+     * @param planes            view frustum planes for culling
+     * @param[out] triangles    incremented by the triangles submitted
+     * @param[out] drawCalls    incremented by the draw calls issued
+     */
+    void drawPass(DrawPass pass, const glm::vec4 * planes, std::int64_t &triangles, int &drawCalls);
+
+    /**
+     * Bind the framebuffer of a set of radiance scaling targets, creating it on first use and reallocating its
+     * textures if their size differs
+     * @param targets   set to bind
+     * @param w, h      size in pixels
+     * @retval true  if the framebuffer is bound and complete,
+     * @retval false otherwise, leaving the window framebuffer bound
+     */
+    bool bindRadianceTargets(RadianceTargets &targets, int w, int h);
+
+    /**
+     * Draw the plain meshes by radiance scaling: an optional depth pre-pass and a G-buffer pass into the persistent
+     * targets, then a screen pass that shades the window and restores its depth for the draw calls that follow
+     * @param viewport          window viewport as (x, y, width, height)
+     * @param planes            view frustum planes for culling
+     * @param[out] triangles    incremented by the triangles submitted
+     * @param[out] drawCalls    incremented by the draw calls issued
+     * @retval true  if the meshes were drawn,
+     * @retval false if radiance scaling is unavailable, in which case it is switched off and nothing is drawn
+     */
+    bool drawRadianceScaled(const GLint * viewport, const glm::vec4 * planes, std::int64_t &triangles, int &drawCalls);
+
+    /// Write one material range per draw call into the material uniform buffer
+    void uploadMaterials();
+
 public:
 
     /// constructor
@@ -124,16 +312,19 @@ public:
         // std::cout << "Directional light " << n << " = (" << x << "," << y << ","<< z << ")\n";
     }
 
-    /// get a pointer to a compiled shader program object; this can be queried for program ID.
-    shaderProgram* getShaderProgramObject(const std::string& name) const
+    /// get a pointer to a compiled shader program object, compiling it if need be; this can be queried for program ID.
+    shaderProgram* getShaderProgramObject(const std::string& name)
     {
-        std::map<std::string, shaderProgram*>::const_iterator it;
-        if ((it = shaders.find(name)) == shaders.end())
-            return NULL;
-        else
-            return it->second;
+        return program(name);
     }
 
+    /**
+     * Keep linked shader programs in a directory, keyed by the driver and shader sources, so that later starts on
+     * the same driver skip compilation. Must be set before initShaders.
+     * @param dir   existing directory, or empty to compile every start
+     */
+    void setShaderCache(const std::string& dir){ shaderCache = dir; }
+
     // copy across manipulator/constraint draw data
     /**
      * Copy in drawing state data for each shape
@@ -142,9 +333,49 @@ public:
     void setDrawParams(const std::vector<ShapeDrawData>& indata)
     {
         drawCallData = indata;
+        materialsDirty = true;
     }
 
-    /// Initialise render object. Must be called before any other operations to set up and compile shaders
+    /**
+     * Copy in the lattice used to warp deformed draw calls in the vertex shader, so that their undeformed buffers
+     * need not be rebuilt as control points move. Must be reissued whenever the lattice changes.
+     * @param lat   free-form deformation lattice
+     * @param model transformation applied to vertices after deformation
+     */
+    void setLattice(ffd * lat, const glm::mat4x4 &model);
+
+    /**
+     * Shade meshes by radiance scaling, which brings out surface detail through curvature, rather than by Phong.
+     * Deformed and instanced meshes and voxel volumes are still drawn with their usual shaders. Switched off again if
+     * the context cannot render to the targets.
+     * @param on    true to use radiance scaling
+     */
+    void setRadianceScaling(bool on){ radiance = on; }
+
+    /// Returns true if meshes are shaded by radiance scaling
+    bool isRadianceScaling() const { return radiance; }
+
+    /**
+     * Render the radiance scaling G-buffer at half resolution while the view moves, which quarters the cost of the
+     * first pass on large meshes. On by default.
+     * @param on    true to halve the resolution while interacting
+     */
+    void setRadianceHalfRes(bool on){ radianceHalf = on; }
+
+    /**
+     * Lay down depth in a cheap pass before the G-buffer pass, so that hidden fragments of dense meshes are not
+     * shaded. On by default.
+     * @param on    true to draw the depth pre-pass
+     */
+    void setDepthPrepass(bool on){ depthPrepass = on; }
+
+    /// Set the curvature enhancement of radiance scaling, from 0 for none to 1
+    void setRadianceEnhancement(float enhance){ rsEnhance = enhance; }
+
+    /// Note whether the view is moving, which selects the half resolution targets if enabled
+    void setInteractive(bool moving){ interactive = moving; }
+
+    /// Initialise render object. Must be called before any other operations to set up shaders, which are compiled on first use
     void initShaders(void);
 
     /**
@@ -152,6 +383,32 @@ public:
      * @param view  current view state
      */
     void draw(View * view);
+
+    /**
+     * Measure the CPU and GPU cost of each frame, and trace the GPU spans as their own lane. GPU times are measured
+     * only where the context supports timer queries.
+     * @param on    true to time frames
+     */
+    void setTiming(bool on);
+
+    /// Returns true if frames are being timed
+    bool isTiming() const { return timing; }
+
+    /// Mark the start of a frame, before any geometry is bound, so that its uploads are counted and timed
+    void beginFrame();
+
+    /// Mark the end of the geometry binding in the frame, before the draw
+    void endBind();
+
+    /**
+     * Read back the GPU timer queries of finished frames without waiting on the GPU
+     * @retval true  if some frames are still waiting on the GPU, so this should be called again later,
+     * @retval false otherwise
+     */
+    bool collectGPUTimes();
+
+    /// Cost of the last frame drawn with timing enabled
+    const FrameStats &getFrameStats() const { return frameStats; }
 };
 
 #endif // RENDERER_H
@@ -0,0 +1,88 @@
+/**
+ * @file
+ *
+ * Reuse of large transient objects within a pipeline stage.
+ */
+
+#ifndef _SCRATCH
+#define _SCRATCH
+
+#include <vector>
+#include <mutex>
+
+/**
+ * Free list of scratch objects, such as the intermediate volumes of a csg walk. Objects are handed back rather than
+ * deleted once used, so that later requests in the same stage take over their storage instead of going back to the
+ * allocator, and whatever is left is freed in bulk by reset at the end of the stage. Safe to use from concurrent tasks.
+ */
+template <typename T> class ScratchPool
+{
+private:
+    std::vector<T *> spare;     ///< objects handed back and not yet taken again
+    std::mutex lock;            ///< serialises access to spare
+
+public:
+
+    ScratchPool(){}
+    ScratchPool(const ScratchPool &) = delete;
+    ScratchPool & operator=(const ScratchPool &) = delete;
+
+    /// Frees any objects still held
+    ~ScratchPool(){ reset(); }
+
+    /**
+     * Take a spare object, preferring one for which @a fits is true
+     * @param fits      predicate on a spare object, true if it can be used without resizing
+     * @param[out] fit  whether the object returned satisfies @a fits
+     * @returns a spare object, which the caller must prepare, or NULL if there are none
+     */
+    template <typename Fits> T * take(Fits fits, bool &fit)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        T * obj;
+
+        fit = false;
+        if(spare.empty())
+            return NULL;
+        for(int i = (int) spare.size() - 1; i >= 0; i--) // most recently handed back first, since it is likely still cached
+            if(fits(spare[i]))
+            {
+                obj = spare[i];
+                spare.erase(spare.begin() + i);
+                fit = true;
+                return obj;
+            }
+        obj = spare.back();
+        spare.pop_back();
+        return obj;
+    }
+
+    /**
+     * Hand back an object for reuse, rather than deleting it
+     * @param obj   object previously allocated with new or returned by take
+     */
+    void give(T * obj)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(obj != NULL)
+            spare.push_back(obj);
+    }
+
+    /// Free every spare object, typically at the end of a stage
+    void reset()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for(T * obj : spare)
+            delete obj;
+        spare.clear();
+    }
+
+    /// Number of spare objects held
+    int size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return (int) spare.size();
+    }
+};
+
+#endif
@@ -6,8 +6,11 @@
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <cstdio>
 
 #include "shaderProgram.h"
+#include "contenthash.h"
 
 #define FailGLError(X) {int err = (int)glGetError(); \
         if (err != GL_NO_ERROR) \
@@ -82,6 +85,8 @@ shaderProgram::shaderProgram(const std::string& fragSource, const std::string& v
 
     fileInput = false;
     shaderReady = false;
+    shaderFailed = false;
+    fromCache = false;
 }
 
 shaderProgram::shaderProgram(const char * fragSourceFile, const char * vertSourceFile)
@@ -92,6 +97,8 @@ shaderProgram::shaderProgram(const char * fragSourceFile, const char * vertSourc
 
     frag_ID = vert_ID = program_ID = 0;
     shaderReady = false;
+    shaderFailed = false;
+    fromCache = false;
 }
 
 void shaderProgram::setShaderSources(const std::string& fragSource, const std::string& vertSource)
@@ -108,6 +115,7 @@ void shaderProgram::setShaderSources(const std::string& fragSource, const std::s
 
     fileInput = false;
     shaderReady = false;
+    shaderFailed = false;
 }
 
 
@@ -126,12 +134,16 @@ void shaderProgram::setShaderSources(const char * fragSourceFile, const char * v
     frag_ID = vert_ID = program_ID = 0;
 
     shaderReady = false;
+    shaderFailed = false;
 }
 
 bool shaderProgram::compileAndLink(void)
 {
     if (shaderReady)
         return true;
+    if (shaderFailed)
+        return false;
+    shaderFailed = true; // until the program links
 
     if (fileInput)
     {
@@ -167,6 +179,17 @@ bool shaderProgram::compileAndLink(void)
         // std::cout << "fragSrc=\n" << fragSrc << std::endl;
         vshader.close();
         fshader.close();
+        fileInput = false; // sources are now held as strings
+    }
+
+    std::string binfile = binaryPath();
+    if (!binfile.empty() && loadBinary(binfile))
+    {
+        uniformLocs.clear();
+        fromCache = true;
+        shaderFailed = false;
+        shaderReady = true;
+        return true;
     }
 
     GLuint err = compileProgram(GL_VERTEX_SHADER, const_cast<GLchar*>(vertSrc.c_str()), vert_ID);
@@ -186,6 +209,8 @@ bool shaderProgram::compileAndLink(void)
     //std::cout << "Shader ID = " << program_ID << std::endl;
     glAttachShader(program_ID, vert_ID);
     glAttachShader(program_ID, frag_ID);
+    if (!binfile.empty())
+        glProgramParameteri(program_ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     err = linkProgram(program_ID);
     if (GL_NO_ERROR != err)
@@ -207,6 +232,110 @@ bool shaderProgram::compileAndLink(void)
         glDeleteShader(vert_ID);
         vert_ID = 0;
     }
+    if (!binfile.empty())
+        saveBinary(binfile);
+    uniformLocs.clear();
+    fromCache = false;
+    shaderFailed = false;
     shaderReady = true;
     return true;
-}
\ No newline at end of file
+}
+
+std::string shaderProgram::binaryPath(void)
+{
+    const GLenum ids[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    GLint formats = 0;
+    ContentHash key;
+
+    if (cacheDir.empty())
+        return "";
+
+    // contexts without program binaries (before OpenGL 4.1 or ARB_get_program_binary) reject the query
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    (void) glGetError();
+    if (formats <= 0)
+        return "";
+
+    // a binary is only valid for the driver that produced it, so an updated driver gets new cache files
+    for (int i = 0; i < 3; i++)
+    {
+        const GLubyte * str = glGetString(ids[i]);
+        key.addString(str != NULL ? reinterpret_cast<const char *>(str) : "");
+    }
+    key.addString(vertSrc);
+    key.addString(fragSrc);
+    return cacheDir + "/" + key.hex() + ".glprog";
+}
+
+bool shaderProgram::loadBinary(const std::string& path)
+{
+    std::ifstream binfile(path.c_str(), std::ios::binary);
+    GLenum format = 0;
+    GLint linked = 0;
+
+    if (!binfile || !binfile.read(reinterpret_cast<char *>(&format), sizeof(format)))
+        return false;
+    std::vector<char> blob((std::istreambuf_iterator<char>(binfile)), std::istreambuf_iterator<char>());
+    if (blob.empty())
+        return false;
+
+    program_ID = glCreateProgram();
+    glProgramBinary(program_ID, format, &blob[0], (GLsizei) blob.size());
+    (void) glGetError(); // a format the driver no longer accepts is an error as well as a failed link
+    glGetProgramiv(program_ID, GL_LINK_STATUS, &linked);
+    if (linked == 0)
+    {
+        // compiled from source instead, and the cache file replaced
+        glDeleteProgram(program_ID);
+        program_ID = 0;
+        return false;
+    }
+    return true;
+}
+
+void shaderProgram::saveBinary(const std::string& path)
+{
+    GLint length = 0;
+    GLsizei written = 0;
+    GLenum format = 0;
+    std::string tmpfile = path + ".tmp";
+
+    glGetProgramiv(program_ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> blob(length);
+    glGetProgramBinary(program_ID, length, &written, &format, &blob[0]);
+    if (glGetError() != GL_NO_ERROR || written <= 0)
+        return;
+
+    // renamed into place once complete, so that no other run loads a partial binary
+    std::ofstream binfile(tmpfile.c_str(), std::ios::binary);
+    binfile.write(reinterpret_cast<const char *>(&format), sizeof(format));
+    binfile.write(&blob[0], written);
+    binfile.close();
+    if (!binfile || rename(tmpfile.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "Error shaderProgram::saveBinary: unable to store " << path << std::endl;
+        remove(tmpfile.c_str());
+    }
+}
+
+GLint shaderProgram::getUniformLocation(const std::string& name)
+{
+    std::map<std::string, GLint>::iterator it = uniformLocs.find(name);
+
+    if (it != uniformLocs.end())
+        return it->second;
+
+    GLint loc = glGetUniformLocation(program_ID, name.c_str());
+    uniformLocs[name] = loc;
+    return loc;
+}
+
+void shaderProgram::bindUniformBlock(const std::string& name, GLuint binding)
+{
+    GLuint idx = glGetUniformBlockIndex(program_ID, name.c_str());
+
+    if (idx != GL_INVALID_INDEX)
+        glUniformBlockBinding(program_ID, idx, binding);
+}
@@ -6,6 +6,7 @@
 //#include <GL/glu.h>
 
 #include <string>
+#include <map>
 #include <common/source2cpp.h>
 
 class shaderProgram
@@ -16,13 +17,26 @@ private:
     GLuint frag_ID;
     GLuint vert_ID;
     bool shaderReady;
+    bool shaderFailed; // compilation or linking failed, so it is not tried again
+    bool fromCache; // linked program was loaded from the binary cache
     bool fileInput; // input comes from file rather than strings
     std::string fragSrc, vertSrc;
+    std::string cacheDir; // directory of linked program binaries, empty if they are not cached
+    std::map<std::string, GLint> uniformLocs; // uniform locations already queried from the linked program
 
     // private mehods
     GLenum compileProgram(GLenum target, GLchar* sourcecode, GLuint & shader);
     GLenum linkProgram(GLuint program);
 
+    /// cache file of the linked program, keyed by the driver and both sources, empty if binaries cannot be cached
+    std::string binaryPath(void);
+
+    /// replace the program with a cached binary, returning false if there is none or the driver refuses it
+    bool loadBinary(const std::string& path);
+
+    /// store the linked program in the binary cache
+    void saveBinary(const std::string& path);
+
 public:
 
     /// construct from string source
@@ -35,6 +49,8 @@ public:
     {
         program_ID = frag_ID = vert_ID = 0;
         shaderReady = false;
+        shaderFailed = false;
+        fromCache = false;
         fileInput = false;
         fragSrc ="";
         vertSrc = "";
@@ -45,9 +61,26 @@ public:
     void setShaderSources(const std::string& frageSource, const std::string& vertSource);
     void setShaderSources(const char * fragSourceFile, const char * vertSourceFile);
 
+    /**
+     * Keep linked program binaries in a directory, so that later runs on the same driver load them rather than
+     * compiling the sources again. Drivers without program binaries always compile.
+     * @param dir   existing directory, or empty to disable the cache
+     */
+    void setBinaryCache(const std::string& dir){ cacheDir = dir; }
+
+    /// compile and link, or load from the binary cache, returning false if this fails, which is not retried
     bool  compileAndLink(void);
 
+    /// was the linked program loaded from the binary cache?
+    bool cached(void) const { return fromCache; }
+
     GLuint getProgramID(void) const { return program_ID; }
+
+    /// location of a named uniform, queried from the driver only on first use after linking
+    GLint getUniformLocation(const std::string& name);
+
+    /// attach a named uniform block to a buffer binding point, if the program uses the block
+    void bindUniformBlock(const std::string& name, GLuint binding);
     bool initialised(void) const {return shaderReady; }
 };
 
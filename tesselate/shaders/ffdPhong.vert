@@ -0,0 +1,131 @@
+#version 150
+#extension GL_ARB_explicit_attrib_location: enable
+
+// vertex shader: ffdPhong; Phong Model lighting of undeformed geometry warped by a Bezier lattice
+
+layout (location=0) in vec3 vertex;
+layout (location=1) in vec2 UV;
+layout (location=2) in vec3 vertexNormal;
+
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+// material of the current draw call
+layout (std140) uniform MaterialBlock
+{
+    vec4 matDiffuse;
+    vec4 matAmbient;
+    vec4 matSpec;
+    vec4 matHighlight; // diffuse colour of highlighted instances
+};
+
+// transformations
+uniform mat4 modelMx; // mesh to world mx, applied after deformation
+uniform mat3 modelNormMx; // normal matrix for modelMx
+
+// lattice, with control points indexed by (i * dimy + j) * dimz + k
+uniform ivec3 latticeDim; // control points along each axis, zero to disable deformation
+uniform vec3 latticeOrigin; // bottom left front corner of undeformed lattice
+uniform vec3 latticeDiag; // diagonal extent of undeformed lattice
+uniform vec3 latticeCP[64];
+
+// per pixel values to be computed in fragment shader
+out vec3 normal; // vertex normal
+out vec3 lightDir; // toLight
+out vec3 halfVector;
+out vec4 diffuse;
+out vec4 ambient;
+
+out vec2 texCoord;
+
+// Bernstein polynomials of degree n (1-3) and their derivatives at t
+void bernstein(float t, int n, out float b[4], out float d[4])
+{
+    float s = 1.0 - t;
+
+    for(int i = 0; i < 4; i++)
+    {
+        b[i] = 0.0; d[i] = 0.0;
+    }
+    if(n == 1)
+    {
+        b[0] = s; b[1] = t;
+        d[0] = -1.0; d[1] = 1.0;
+    }
+    else if(n == 2)
+    {
+        b[0] = s*s; b[1] = 2.0*s*t; b[2] = t*t;
+        d[0] = -2.0*s; d[1] = 2.0*(s-t); d[2] = 2.0*t;
+    }
+    else if(n == 3)
+    {
+        b[0] = s*s*s; b[1] = 3.0*s*s*t; b[2] = 3.0*s*t*t; b[3] = t*t*t;
+        d[0] = -3.0*s*s; d[1] = 3.0*s*(s-2.0*t); d[2] = 3.0*t*(2.0*s-t); d[3] = 3.0*t*t;
+    }
+}
+
+void main(void)
+{
+    vec3 inNormal, v, uvw;
+    float bu[4], bv[4], bw[4], du[4], dv[4], dw[4];
+
+    texCoord = UV;
+    v = vertex;
+    inNormal = vertexNormal;
+
+    // local lattice coordinates, leaving points outside the lattice unchanged as on the CPU
+    uvw = (vertex - latticeOrigin) / latticeDiag;
+    if(latticeDim.x > 0 && all(greaterThanEqual(uvw, vec3(0.0))) && all(lessThanEqual(uvw, vec3(1.0))))
+    {
+        vec3 fu = vec3(0.0), fv = vec3(0.0), fw = vec3(0.0);
+
+        bernstein(uvw.x, latticeDim.x-1, bu, du);
+        bernstein(uvw.y, latticeDim.y-1, bv, dv);
+        bernstein(uvw.z, latticeDim.z-1, bw, dw);
+
+        // position and its partial derivatives, which form the columns of the Jacobian
+        v = vec3(0.0);
+        for(int i = 0; i < latticeDim.x; i++)
+            for(int j = 0; j < latticeDim.y; j++)
+                for(int k = 0; k < latticeDim.z; k++)
+                {
+                    vec3 c = latticeCP[(i * latticeDim.y + j) * latticeDim.z + k];
+                    v += bu[i] * bv[j] * bw[k] * c;
+                    fu += du[i] * bv[j] * bw[k] * c;
+                    fv += bu[i] * dv[j] * bw[k] * c;
+                    fw += bu[i] * bv[j] * dw[k] * c;
+                }
+        fu /= latticeDiag.x; fv /= latticeDiag.y; fw /= latticeDiag.z;
+
+        // normals transform by the inverse transpose of the Jacobian, which is its cofactor matrix up to scale
+        inNormal = mat3(cross(fv, fw), cross(fw, fu), cross(fu, fv)) * vertexNormal;
+        if(dot(fu, cross(fv, fw)) < 0.0) // the lattice is folded over here
+            inNormal = -inNormal;
+    }
+    v = (modelMx * vec4(v, 1.0)).xyz;
+    inNormal = modelNormMx * inNormal;
+
+    // map to camera space for lighting etc
+    normal = normalize(normMx * inNormal);
+
+    // vertex in camera coords
+    vec4 ecPos = MV * vec4(v, 1.0);
+
+    lightDir  = normalize(lightpos.xyz - ecPos.xyz);
+    halfVector = normalize(normalize(-ecPos.xyz) + lightDir);
+
+    diffuse = matDiffuse * diffuseCol;
+    ambient = matAmbient * ambientCol;
+
+    gl_Position = MVproj * vec4(v, 1.0); // clip space position
+}
@@ -1,8 +1,26 @@
 #version 150
 
-uniform vec4 specularCol;
-uniform float shiny;
-uniform vec4 matSpec;
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+// material of the current draw call
+layout (std140) uniform MaterialBlock
+{
+    vec4 matDiffuse;
+    vec4 matAmbient;
+    vec4 matSpec;
+    vec4 matHighlight; // diffuse colour of highlighted instances
+};
 
 in vec2 texCoord;
 
@@ -7,17 +7,27 @@ layout (location=0) in vec3 vertex;
 layout (location=1) in vec2 UV;
 layout (location=2) in vec3 vertexNormal;
 
-// transformations
-uniform mat4 MV; // model-view mx
-uniform mat4 MVproj; //model-view-projection mx
-uniform mat3 normMx; // normal matrix
-
-//colours and material
-uniform vec4 matDiffuse;
-uniform vec4 matAmbient;
-uniform vec4 lightpos; // in camera space
-uniform vec4 diffuseCol;
-uniform vec4 ambientCol;
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+// material of the current draw call
+layout (std140) uniform MaterialBlock
+{
+    vec4 matDiffuse;
+    vec4 matAmbient;
+    vec4 matSpec;
+    vec4 matHighlight; // diffuse colour of highlighted instances
+};
 
 // per pixel values to be computed in fragment shader
 out vec3 normal; // vertex normal
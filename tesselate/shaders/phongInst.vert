@@ -0,0 +1,64 @@
+#version 150
+#extension GL_ARB_explicit_attrib_location: enable
+
+// vertex shader: phongInst; simple Phong Model lighting of instanced geometry, such as voxel previews and lattice control points
+
+layout (location=0) in vec3 vertex;
+layout (location=1) in vec2 UV;
+layout (location=2) in vec3 vertexNormal;
+layout (location=3) in vec4 instanceData; // translation of this instance and its highlight flag, advanced once per instance
+
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+// material of the current draw call
+layout (std140) uniform MaterialBlock
+{
+    vec4 matDiffuse;
+    vec4 matAmbient;
+    vec4 matSpec;
+    vec4 matHighlight; // diffuse colour of highlighted instances
+};
+
+// per pixel values to be computed in fragment shader
+out vec3 normal; // vertex normal
+out vec3 lightDir; // toLight
+out vec3 halfVector;
+out vec4 diffuse;
+out vec4 ambient;
+
+out vec2 texCoord;
+
+void main(void)
+{
+    vec3 inNormal, v;
+
+    texCoord = UV;
+    v = vertex + instanceData.xyz;
+    inNormal = vertexNormal;
+
+    // map to camera space for lighting etc
+    normal = normalize(normMx * inNormal);
+
+    // vertex in camera coords
+    vec4 ecPos = MV * vec4(v, 1.0);
+
+    lightDir  = normalize(lightpos.xyz - ecPos.xyz);
+    halfVector = normalize(normalize(-ecPos.xyz) + lightDir);
+
+    // highlighted instances take the highlight colour, with ambient scaled as ShapeGeometry::setColour does
+    diffuse = mix(matDiffuse, matHighlight, instanceData.w) * diffuseCol;
+    ambient = mix(matAmbient, vec4(0.75 * matHighlight.rgb, matAmbient.a), instanceData.w) * ambientCol;
+
+    gl_Position = MVproj * vec4(v, 1.0); // clip space position
+}
@@ -0,0 +1,8 @@
+#version 150
+
+// fragment shader: depth pre-pass of radiance scaling, which writes no colour so that the G-buffer pass that follows
+// shades each pixel once
+
+void main(void)
+{
+}
@@ -0,0 +1,67 @@
+#version 150
+#extension GL_ARB_explicit_attrib_location: enable
+
+// vertex shader: first radiance scaling pass for meshes, with the attributes and uniform blocks of the Phong shaders
+
+layout (location=0) in vec3 vertex;
+layout (location=1) in vec2 UV;
+layout (location=2) in vec3 vertexNormal;
+
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+// material of the current draw call
+layout (std140) uniform MaterialBlock
+{
+    vec4 matDiffuse;
+    vec4 matAmbient;
+    vec4 matSpec;
+    vec4 matHighlight; // diffuse colour of highlighted instances
+};
+
+// the depth pre-pass and the G-buffer pass share this shader, and must place every fragment at the same depth
+invariant gl_Position;
+
+// inputs of rad_scaling_pass1.frag
+out vec3 normal;
+out float depth;
+out vec3 view;
+out vec4 colour;
+out vec3 lightDir1;
+out vec3 lightDir2;
+out vec3 halfVector1;
+out vec3 halfVector2;
+out vec3 pos;
+out vec2 texCoord;
+
+void main(void)
+{
+    // vertex in camera coords
+    vec4 ecPos = MV * vec4(vertex, 1.0);
+
+    texCoord = UV;
+    pos = vertex;
+    view = -ecPos.xyz;
+    normal = normalize(normMx * vertexNormal);
+    depth = log(-ecPos.z);
+
+    // only lit in the first pass for terrain walls, which meshes never are
+    lightDir1 = normalize(lightpos.xyz - ecPos.xyz);
+    lightDir2 = lightDir1;
+    halfVector1 = normalize(normalize(-ecPos.xyz) + lightDir1);
+    halfVector2 = halfVector1;
+
+    colour = matDiffuse; // lit in the second pass
+
+    gl_Position = MVproj * vec4(vertex, 1.0); // clip space position
+}
@@ -101,7 +101,7 @@ vec3 hsvToRgb(in float h,in float s,in float v) {
   return color;
 }
 
-float tanh(in float c, in float en) {
+float tanhClamped(in float c, in float en) {
   float cmax = en*15.0;
   const float tanhmax = 3.11622;
 
@@ -150,7 +150,7 @@ vec3 hessian() {
 }
 
 float curvature(in float w, in vec3 h, in float e) {
-  float c = tanh(-(h.x+h.y)/2.0,e);
+  float c = tanhClamped(-(h.x+h.y)/2.0,e);
   return invert ? -c*max(w-0.5,0.0) : c*max(w-0.5,0.0);
 }
 
@@ -216,6 +216,7 @@ void main(void) {
 
   if(n==vec3(0.0)) { // fragments outside mesh or that we do not want affected by RS
     fcolour = vec4(texture(colormap, texCoord.st).xyz,1.0);
+    gl_FragDepth = 1.0; // far plane, so that later draws are not hidden by the background
 
     return;
   }
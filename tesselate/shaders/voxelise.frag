@@ -0,0 +1,28 @@
+#version 150
+
+// Each surface crossing flips every voxel of the row beyond it, so the XOR of all crossings leaves the voxels inside
+// set. The four channels hold four consecutive packed words of the row, voxel x in bit 31-(x%32) of its word.
+
+in float voxx;
+
+uniform int firstword;  // word of the row held by the red channel
+
+out uvec4 parity;
+
+uint beyond(int w, int k)
+{
+    int first = 32 * (firstword + w);
+
+    if (k <= first)
+        return 0xFFFFFFFFu;
+    if (k >= first + 32)
+        return 0u;
+    return 0xFFFFFFFFu >> uint(k - first);
+}
+
+void main( void )
+{
+    int k = int(clamp(ceil(voxx), -1.0, 1.0e8)); // first voxel centre at or beyond the crossing
+
+    parity = uvec4(beyond(0, k), beyond(1, k), beyond(2, k), beyond(3, k));
+}
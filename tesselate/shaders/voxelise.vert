@@ -0,0 +1,17 @@
+#version 150
+#extension GL_ARB_explicit_attrib_location: enable
+
+// Solid voxelisation by parity: triangles are seen along the x axis, one pixel per voxel row in y and z
+
+layout (location=0) in vec3 vertex;
+
+uniform vec4 tile;      // world y and z of the lower edges of the tile, then 2 over its extent in y and z
+uniform vec2 xrow;      // world x of the first voxel of a row and the spacing of voxels along it
+
+out float voxx;         // position along the row, in voxels
+
+void main( void )
+{
+    voxx = (vertex.x - xrow.x) / xrow.y;
+    gl_Position = vec4((vertex.y - tile.x) * tile.z - 1.0, (vertex.z - tile.y) * tile.w - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,145 @@
+#version 150
+
+// fragment shader: ray march a bit-packed voxel volume, stepping over empty occupancy blocks whole and shading the
+// face of the first occupied voxel hit with the Phong model of phong.frag
+
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+// material of the current draw call
+layout (std140) uniform MaterialBlock
+{
+    vec4 matDiffuse;
+    vec4 matAmbient;
+    vec4 matSpec;
+    vec4 matHighlight; // diffuse colour of highlighted instances
+};
+
+uniform usampler3D voxels;      // packed words, the voxel at x in bit 31-(x%32) of word x/32
+uniform usampler3D occupancy;   // nonzero for blocks holding any occupied voxel
+uniform ivec3 dim;              // voxels along each axis
+uniform int block;              // edge of an occupancy block in voxels
+uniform vec3 origin;            // centre of the voxel at (0, 0, 0)
+uniform vec3 cell;              // spacing of voxel centres
+uniform vec3 eye;               // camera position in world space
+
+in vec3 worldPos;
+
+out vec4 color;
+
+bool occupied(ivec3 v)
+{
+    uint word = texelFetch(voxels, ivec3(v.x >> 5, v.y, v.z), 0).r;
+    return ((word >> uint(31 - (v.x & 31))) & 1u) != 0u;
+}
+
+void main(void)
+{
+    // in voxel space the voxel at i covers [i, i+1) along each axis
+    vec3 o = (eye - origin) / cell + 0.5;
+    vec3 d = (worldPos - eye) / cell;
+    d = mix(d, vec3(1.0e-7), equal(d, vec3(0.0))); // no axis-aligned ray divides by zero
+    vec3 inv = 1.0 / d;
+    ivec3 stepv = ivec3(sign(d));
+    ivec3 bdim = (dim + block - 1) / block;
+
+    // clip the ray to the volume, starting at the camera when it is inside
+    vec3 ta = -o * inv, tb = (vec3(dim) - o) * inv;
+    vec3 tmin = min(ta, tb), tmax = max(ta, tb);
+    float t = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tfar = min(min(tmax.x, tmax.y), tmax.z);
+    if(t >= tfar)
+        discard;
+    int axis = (tmin.x >= tmin.y && tmin.x >= tmin.z) ? 0 : ((tmin.y >= tmin.z) ? 1 : 2);
+
+    // coarse march over blocks, from the block holding the entry point
+    float fb = float(block);
+    ivec3 b = clamp(ivec3(floor((o + d * t) / fb)), ivec3(0), bdim - 1);
+    vec3 bnext = ((vec3(b + max(stepv, 0)) * fb) - o) * inv;
+    vec3 bdelta = abs(inv) * fb;
+    bool hit = false;
+
+    for(int n = 0; n < bdim.x + bdim.y + bdim.z && !hit; n++)
+    {
+        float texit = min(min(bnext.x, bnext.y), min(bnext.z, tfar));
+
+        if(texelFetch(occupancy, b, 0).r != 0u)
+        {
+            // fine march over the voxels of an occupied block
+            ivec3 lo = b * block, hi = min(lo + block, dim) - 1;
+            ivec3 v = clamp(ivec3(floor(o + d * t)), lo, hi);
+            vec3 vnext = (vec3(v + max(stepv, 0)) - o) * inv;
+            float tv = t;
+
+            while(tv < texit && all(greaterThanEqual(v, lo)) && all(lessThanEqual(v, hi)))
+            {
+                if(occupied(v))
+                {
+                    t = tv;
+                    hit = true;
+                    break;
+                }
+                if(vnext.x < vnext.y && vnext.x < vnext.z)
+                {
+                    tv = vnext.x; vnext.x += abs(inv.x); v.x += stepv.x; axis = 0;
+                }
+                else if(vnext.y < vnext.z)
+                {
+                    tv = vnext.y; vnext.y += abs(inv.y); v.y += stepv.y; axis = 1;
+                }
+                else
+                {
+                    tv = vnext.z; vnext.z += abs(inv.z); v.z += stepv.z; axis = 2;
+                }
+            }
+        }
+        if(hit || texit >= tfar)
+            break;
+
+        // on to the next block along the ray
+        t = texit;
+        if(bnext.x < bnext.y && bnext.x < bnext.z)
+        {
+            bnext.x += bdelta.x; b.x += stepv.x; axis = 0;
+        }
+        else if(bnext.y < bnext.z)
+        {
+            bnext.y += bdelta.y; b.y += stepv.y; axis = 1;
+        }
+        else
+        {
+            bnext.z += bdelta.z; b.z += stepv.z; axis = 2;
+        }
+        if(any(lessThan(b, ivec3(0))) || any(greaterThanEqual(b, bdim)))
+            break;
+    }
+    if(!hit)
+        discard;
+
+    // the face crossed to enter the voxel faces back along the ray
+    vec3 n = vec3(0.0);
+    n[axis] = -float(stepv[axis]);
+    vec3 p = origin + (o + d * t - 0.5) * cell;
+    vec4 ecPos = MV * vec4(p, 1.0);
+    vec4 clip = MVproj * vec4(p, 1.0);
+    gl_FragDepth = 0.5 * (clip.z / clip.w) + 0.5;
+
+    vec3 normal = normalize(normMx * n);
+    vec3 lightDir = normalize(lightpos.xyz - ecPos.xyz);
+    vec3 halfV = normalize(normalize(-ecPos.xyz) + lightDir);
+    float NdotL = max(dot(normal, lightDir), 0.0);
+    float NdotHV = max(dot(normal, halfV), 0.0);
+
+    color = matAmbient * ambientCol + matDiffuse * diffuseCol * NdotL;
+    color += matSpec * specularCol * pow(NdotHV, shiny);
+}
@@ -0,0 +1,27 @@
+#version 150
+#extension GL_ARB_explicit_attrib_location: enable
+
+// vertex shader: box around a voxel volume, whose back faces start the rays marched by voxmarch.frag
+
+layout (location=0) in vec3 vertex;
+
+// camera and light state, shared by every draw call in a frame
+layout (std140) uniform FrameBlock
+{
+    mat4 MV; // model-view mx
+    mat4 MVproj; //model-view-projection mx
+    mat3 normMx; // normal matrix
+    vec4 lightpos; // in camera space
+    vec4 diffuseCol;
+    vec4 ambientCol;
+    vec4 specularCol;
+    float shiny;
+};
+
+out vec3 worldPos; // point on the box in world space
+
+void main(void)
+{
+    worldPos = vertex;
+    gl_Position = MVproj * vec4(vertex, 1.0); // clip space position
+}
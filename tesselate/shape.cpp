@@ -1,10 +1,30 @@
+#ifndef TESS_HEADLESS
 #include <GL/glew.h>
+#endif
 #include "shape.h"
+#include "normalpalette.h"
+#include "voxels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "common/timer.h"
 
 using namespace cgp;
 
+static stats::TimeInit genMeshTime("ShapeGeometry::genMesh");
+static stats::TimeInit bindBuffersTime("ShapeGeometry::bindBuffers");
+
+stats::MemoryInit geometryMemory("ShapeGeometry");
+
+static std::atomic<size_t> uploadedBytes(0);   ///< bytes written to buffers since the last takeUploadedBytes
+
+size_t ShapeGeometry::takeUploadedBytes()
+{
+    return uploadedBytes.exchange(0);
+}
+
 void ShapeGeometry::setColour(GLfloat * col)
 {
     int i;
@@ -124,31 +144,212 @@ void ShapeGeometry::genSphere(float radius, int slices, int stacks, glm::mat4x4
     }
 }
 
+/**
+ * Pack a transformed vertex into the interleaved layout of the vertex buffer
+ * @param pnt       vertex position
+ * @param norm      vertex normal
+ * @param trm       model transformation matrix
+ * @param nrm       normal matrix of trm
+ * @param[out] dst  8 floats: position, texture coordinates and unit normal
+ */
+static void packVertex(const cgp::Point &pnt, const cgp::Vector &norm, const glm::mat4x4 &trm, const glm::mat3x3 &nrm, float * dst)
+{
+    // the same batched transforms as genMesh, so that a repacked vertex compares equal
+    cgp::transformPoints(glm::value_ptr(trm), &pnt, 1, dst, 8); // position
+    dst[3] = 0.0f; dst[4] = 0.0f; // texture coordinates
+    cgp::transformNormals(glm::value_ptr(nrm), &norm, 1, dst + 5, 8); // normal
+}
+
+void ShapeGeometry::genBox(cgp::Vector halfext, glm::mat4x4 trm)
+{
+    // outward normal of each face and two tangents whose cross product is that normal, for anticlockwise winding
+    static const float faces[6][3][3] = {
+        {{ 1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+        {{-1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f}},
+        {{ 0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}},
+        {{ 0.0f,-1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+        {{ 0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+        {{ 0.0f, 0.0f,-1.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}}};
+    static const float corners[4][2] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+    float ext[3] = {halfext.i, halfext.j, halfext.k};
+    glm::mat3x3 nrm;
+    int f, c, a, base;
+
+    nrm = glm::transpose(glm::inverse(glm::mat3(trm)));
+    for(f = 0; f < 6; f++)
+    {
+        base = int(verts.size()) / 8;
+        for(c = 0; c < 4; c++)
+        {
+            float p[3], vert[8];
+
+            for(a = 0; a < 3; a++)
+                p[a] = (faces[f][0][a] + corners[c][0] * faces[f][1][a] + corners[c][1] * faces[f][2][a]) * ext[a];
+            packVertex(cgp::Point(p[0], p[1], p[2]), cgp::Vector(faces[f][0][0], faces[f][0][1], faces[f][0][2]), trm, nrm, vert);
+            verts.insert(verts.end(), vert, vert + 8);
+        }
+        indices.push_back(base); indices.push_back(base+1); indices.push_back(base+2);
+        indices.push_back(base); indices.push_back(base+2); indices.push_back(base+3);
+    }
+}
+
+void ShapeGeometry::setInstances(const std::vector<cgp::Point> &offsets, const std::vector<bool> &flags)
+{
+    // the same number of instances fits the existing buffer, so the geometry itself need not be uploaded again
+    if(instanceData.size() == 4 * offsets.size() && vboInst != 0 && indicesBound)
+        instancesDirty = true;
+    else
+        indicesBound = false;
+    instanceData.resize(4 * offsets.size());
+    for(int i = 0; i < (int) offsets.size(); i++)
+    {
+        instanceData[4*i] = offsets[i].x;
+        instanceData[4*i+1] = offsets[i].y;
+        instanceData[4*i+2] = offsets[i].z;
+        instanceData[4*i+3] = (i < (int) flags.size() && flags[i]) ? 1.0f : 0.0f;
+    }
+}
+
 void ShapeGeometry::genMesh(std::vector<cgp::Point> * points, std::vector<cgp::Vector> * norms, std::vector<int> * faces, glm::mat4x4 trm)
 {
-    int i, base;
-    glm::vec4 p;
-    glm::vec3 v;
+    genMesh(points->data(), norms->data(), (int) points->size(), faces->data(), (int) faces->size() / 3, 3 * sizeof(int), trm);
+}
 
-    base = int(verts.size()) / 8;
-    for(i = 0; i < (int) points->size(); i++)
+void ShapeGeometry::genMesh(const cgp::Point * points, const cgp::Vector * norms, int numpoints, const int * faces, int numtris,
+                            size_t stride, glm::mat4x4 trm)
+{
+    stats::Timer timer(genMeshTime);
+    size_t voff = verts.size(), ioff = indices.size();
+    int base = int(voff) / 8;
+    glm::mat3x3 nrm;
+
+    nrm = glm::transpose(glm::inverse(glm::mat3(trm))); // normal matrix is the same for every vertex
+    verts.resize(voff + 8 * (size_t) numpoints);
+    indices.resize(ioff + 3 * (size_t) numtris);
+
+    // each chunk transforms its positions and then its normals as vectorised batches, straight into the interleaved records
+    #pragma omp parallel for schedule(static)
+    for(int c = 0; c < numpoints; c += geomchunksize)
     {
-        // apply transformation
-        p = trm * glm::vec4((* points)[i].x, (* points)[i].y, (* points)[i].z, 1.0f);
-        // v = glm::mat3(trm) * glm::normalize(glm::vec3(x, y, z));
-        v = glm::transpose(glm::inverse(glm::mat3(trm))) * glm::normalize(glm::vec3((* norms)[i].i, (* norms)[i].j, (* norms)[i].k));
-        v = glm::normalize(v);
+        int n = std::min(geomchunksize, numpoints - c);
+        float * dst = &verts[voff + 8 * (size_t) c];
+
+        cgp::transformPoints(glm::value_ptr(trm), points + c, n, dst, 8);
+        cgp::transformNormals(glm::value_ptr(nrm), norms + c, n, dst + 5, 8);
+        for(int i = 0; i < n; i++)
+        {
+            dst[8*i+3] = 0.0f; dst[8*i+4] = 0.0f; // texture coordinates
+        }
+    }
 
+    #pragma omp parallel for schedule(static, geomchunksize)
+    for(int t = 0; t < numtris; t++)
+    {
+        const int * f = (const int *) ((const char *) faces + t * stride);
+        unsigned int * dst = &indices[ioff + 3 * (size_t) t];
 
-        verts.push_back(p.x); verts.push_back(p.y); verts.push_back(p.z); // position
-        verts.push_back(0.0f); verts.push_back(0.0f); // texture coordinates
-        verts.push_back(v.x); verts.push_back(v.y); verts.push_back(v.z); // normal
+        dst[0] = f[0] + base; dst[1] = f[1] + base; dst[2] = f[2] + base;
     }
+    accountMemory();
+}
+
+void ShapeGeometry::append(const ShapeGeometry &piece)
+{
+    size_t ioff = indices.size();
+    unsigned int base = (unsigned int) (verts.size() / 8);
+    int numidx = (int) piece.indices.size();
 
-    for(i = 0; i < (int) faces->size(); i++)
+    verts.insert(verts.end(), piece.verts.begin(), piece.verts.end());
+    indices.resize(ioff + piece.indices.size());
+
+    #pragma omp parallel for schedule(static, geomchunksize)
+    for(int i = 0; i < numidx; i++)
+        indices[ioff + i] = piece.indices[i] + base;
+    accountMemory();
+}
+
+void ShapeGeometry::append(const ShapeGeometry &piece, const glm::mat4x4 &trm)
+{
+    size_t voff = verts.size(), ioff = indices.size();
+    glm::mat3x3 nrm = glm::transpose(glm::inverse(glm::mat3(trm)));
+    bool mirror = glm::determinant(glm::mat3(trm)) < 0.0f;
+    int numverts = (int) (piece.verts.size() / 8), numtris = (int) (piece.indices.size() / 3);
+
+    append(piece);
+    #pragma omp parallel for schedule(static, geomchunksize)
+    for(int v = 0; v < numverts; v++)
     {
-        indices.push_back((* faces)[i]+base);
+        float * dst = &verts[voff + 8 * (size_t) v];
+        glm::vec4 p = trm * glm::vec4(dst[0], dst[1], dst[2], 1.0f);
+        glm::vec3 n = nrm * glm::vec3(dst[5], dst[6], dst[7]);
+        float len = glm::length(n);
+
+        if(len > 0.0f) // scaling changes the length of the normals
+            n /= len;
+
+        dst[0] = p.x; dst[1] = p.y; dst[2] = p.z;
+        dst[5] = n.x; dst[6] = n.y; dst[7] = n.z;
+    }
+    if(mirror)
+        for(int t = 0; t < numtris; t++)
+            std::swap(indices[ioff + 3 * (size_t) t + 1], indices[ioff + 3 * (size_t) t + 2]);
+}
+
+void ShapeGeometry::packTriangles(std::vector<float> &coords) const
+{
+    int numtris = (int) indices.size() / 3;
+
+    coords.resize(9 * (size_t) numtris);
+    #pragma omp parallel for schedule(static, geomchunksize)
+    for(int t = 0; t < numtris; t++)
+        for(int c = 0; c < 3; c++)
+        {
+            const float * src = &verts[8 * (size_t) indices[3 * (size_t) t + c]];
+
+            for(int k = 0; k < 3; k++)
+                coords[9 * (size_t) t + 3 * c + k] = src[k];
+        }
+}
+
+bool ShapeGeometry::updateMesh(std::vector<cgp::Point> * points, std::vector<cgp::Vector> * norms, glm::mat4x4 trm)
+{
+    glm::mat3x3 nrm;
+    int numpoints = (int) points->size(), lo = numpoints, hi = 0;
+
+    if(points->size() * 8 != verts.size() || norms->size() < points->size())
+        return false;
+
+    nrm = glm::transpose(glm::inverse(glm::mat3(trm)));
+    #pragma omp parallel for schedule(static, geomchunksize) reduction(min:lo) reduction(max:hi)
+    for(int i = 0; i < numpoints; i++)
+    {
+        float vert[8];
+        int c;
+
+        // same packing as genMesh, so unchanged vertices compare equal
+        packVertex((* points)[i], (* norms)[i], trm, nrm, vert);
+        for(c = 0; c < 8; c++)
+            if(verts[i*8+c] != vert[c])
+                break;
+        if(c < 8)
+        {
+            std::copy(vert, vert + 8, verts.begin() + i*8);
+            lo = std::min(lo, i);
+            hi = std::max(hi, i+1);
+        }
+    }
+
+    // merge with any range still waiting for upload
+    if(lo < hi)
+    {
+        if(dirtyLo < dirtyHi)
+        {
+            lo = std::min(lo, dirtyLo);
+            hi = std::max(hi, dirtyHi);
+        }
+        dirtyLo = lo; dirtyHi = hi;
     }
+    return true;
 }
 
 ShapeDrawData ShapeGeometry::getDrawParameters()
@@ -162,27 +363,87 @@ ShapeDrawData ShapeGeometry::getDrawParameters()
         sdd.specular[i] = specular[i];
     for(int i = 0; i < 4; i++)
         sdd.ambient[i] = ambient[i];
-    sdd.indexBufSize = (int) indices.size();
+    for(int i = 0; i < 4; i++)
+        sdd.highlight[i] = highlight[i];
+    sdd.indexBufSize = (deviceIndices > 0) ? (GLuint) deviceIndices : (GLuint) indices.size();
+    sdd.indexType = indexType;
+    sdd.instances = (GLuint) (instanceData.size() / 4);
     sdd.texID = 0;
+    sdd.volume = volume;
     sdd.current = false; // default setting
+    sdd.deformed = false;
+    sdd.chunks = chunks;
 
     return sdd;
 }
 
+void ShapeGeometry::packCompact(int lo, int hi, std::vector<CompactVertex> &out)
+{
+    out.resize(hi - lo);
+
+    #pragma omp parallel for schedule(static, geomchunksize)
+    for(int i = lo; i < hi; i++)
+    {
+        const float * src = &verts[8 * (size_t) i];
+        CompactVertex &dst = out[i - lo];
+
+        dst.pos[0] = src[0]; dst.pos[1] = src[1]; dst.pos[2] = src[2];
+        dst.normal = packNormal(src[5], src[6], src[7]);
+    }
+}
+
 bool ShapeGeometry::bindBuffers(View * view)
 {
+    accountMemory(); // the other generators have finished filling the arrays by now
+#ifdef TESS_HEADLESS
+    std::cerr << "Error ShapeGeometry::bindBuffers: built without OpenGL" << std::endl;
+    return false;
+#else
+    stats::Timer timer(bindBuffersTime);
+
     if((int) indices.size() > 0)
     {
-        if (vboGeom != 0)
+        if (vboGeom != 0 && indicesBound && boundFloats == verts.size())
         {
-            glDeleteVertexArrays(1, &vaoGeom);
-            glDeleteBuffers(1, &vboGeom);
-            glDeleteBuffers(1, &iboGeom);
-            vaoGeom = 0;
-            vboGeom = 0;
-            iboGeom = 0;
+            // topology is unchanged, so rewrite only the vertices that moved in the existing buffer
+            if (dirtyLo < dirtyHi)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, vboGeom);
+                if (compact)
+                {
+                    std::vector<CompactVertex> packed;
+
+                    packCompact(dirtyLo, dirtyHi, packed);
+                    glBufferSubData(GL_ARRAY_BUFFER, sizeof(CompactVertex) * dirtyLo, sizeof(CompactVertex) * packed.size(),
+                                    &packed[0]);
+                    uploadedBytes += sizeof(CompactVertex) * packed.size();
+                }
+                else
+                {
+                    glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 8 * dirtyLo, sizeof(GLfloat) * 8 * (dirtyHi - dirtyLo),
+                                    (GLfloat *) &verts[8 * dirtyLo]);
+                    uploadedBytes += sizeof(GLfloat) * 8 * (dirtyHi - dirtyLo);
+                }
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                chunkBounds(); // moved vertices may leave their chunk bounds
+            }
+            dirtyLo = dirtyHi = 0;
+
+            // moved or highlighted instances need only the instance buffer
+            if (instancesDirty)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, vboInst);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * instanceData.size(), &instanceData[0]);
+                uploadedBytes += sizeof(GLfloat) * instanceData.size();
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                instancesDirty = false;
+            }
+            return true;
         }
 
+        deleteBuffers();
+        buildChunks();
+
         // vao
         glGenVertexArrays(1, &vaoGeom);
         glBindVertexArray(vaoGeom);
@@ -191,26 +452,81 @@ bool ShapeGeometry::bindBuffers(View * view)
         // set up vertex buffer and copy in data
         glGenBuffers(1, &vboGeom);
         glBindBuffer(GL_ARRAY_BUFFER, vboGeom);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*(int) verts.size(), (GLfloat *) &verts[0], GL_STATIC_DRAW);
+        if (compact)
+        {
+            std::vector<CompactVertex> packed;
+
+            packCompact(0, (int) verts.size() / 8, packed);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(CompactVertex) * packed.size(), &packed[0], GL_STATIC_DRAW);
+            uploadedBytes += sizeof(CompactVertex) * packed.size();
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*(int) verts.size(), (GLfloat *) &verts[0], GL_STATIC_DRAW);
+            uploadedBytes += sizeof(GLfloat) * verts.size();
+        }
 
         // ibo
+        // indices are halved in size whenever every vertex can be addressed in 16 bits
         glGenBuffers(1, &iboGeom);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboGeom);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*(int) indices.size(), (GLuint *) &indices[0], GL_STATIC_DRAW);
+        if (verts.size() / 8 <= 65536)
+        {
+            std::vector<GLushort> shortindices(indices.begin(), indices.end());
+
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * shortindices.size(), &shortindices[0], GL_STATIC_DRAW);
+            uploadedBytes += sizeof(GLushort) * shortindices.size();
+            indexType = GL_UNSIGNED_SHORT;
+        }
+        else
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*(int) indices.size(), (GLuint *) &indices[0], GL_STATIC_DRAW);
+            uploadedBytes += sizeof(GLuint) * indices.size();
+            indexType = GL_UNSIGNED_INT;
+        }
 
-        // enable position attribute
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(0));
+        if (compact)
+        {
+            // position and packed normal, leaving texture coordinates at their default
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)(0));
+            glDisableVertexAttribArray(1);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (void*)(3*sizeof(GLfloat)));
+        }
+        else
+        {
+            // enable position attribute
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(0));
+
+            // enable texture coord attribute
+            const int sz = 3*sizeof(GLfloat);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(sz) );
+
+            // enable normals
+            const int nz = 5*sizeof(GLfloat);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(nz) );
+        }
 
-        // enable texture coord attribute
-        const int sz = 3*sizeof(GLfloat);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(sz) );
+        // instance offsets and highlight flags, advancing once per instance rather than per vertex
+        if (!instanceData.empty())
+        {
+            glGenBuffers(1, &vboInst);
+            glBindBuffer(GL_ARRAY_BUFFER, vboInst);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * instanceData.size(), &instanceData[0], GL_DYNAMIC_DRAW);
+            uploadedBytes += sizeof(GLfloat) * instanceData.size();
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (void*)(0));
+            glVertexAttribDivisor(3, 1);
+        }
+        instancesDirty = false;
 
-        // enable normals
-        const int nz = 5*sizeof(GLfloat);
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(nz) );
+        boundFloats = verts.size();
+        indicesBound = true;
+        dirtyLo = dirtyHi = 0;
 
         //glBindVertexArray(vaoConstraint);
         //glDrawElements(GL_TRIANGLES, (int) indices.size(), GL_UNSIGNED_INT, (void*)(0));
@@ -220,6 +536,240 @@ bool ShapeGeometry::bindBuffers(View * view)
     }
     else
     {
+        return deviceIndices > 0; // written by a device, so the buffers are already current
+    }
+#endif
+}
+
+void ShapeGeometry::buildChunks()
+{
+    int numtris = (int) indices.size() / 3, numverts = (int) verts.size() / 8, cells, g, c, t;
+    float lo[3], hi[3], scale[3];
+
+    chunks.clear();
+    if(numtris < 2 * drawchunktris || !instanceData.empty())
+        return;
+
+    for(c = 0; c < 3; c++)
+    {
+        lo[c] = verts[c];
+        hi[c] = verts[c];
+    }
+    for(int v = 1; v < numverts; v++)
+        for(c = 0; c < 3; c++)
+        {
+            lo[c] = std::min(lo[c], verts[8 * (size_t) v + c]);
+            hi[c] = std::max(hi[c], verts[8 * (size_t) v + c]);
+        }
+
+    // a surface occupies roughly g*g of the g^3 cells, which sets the grid size for chunks of about drawchunktris
+    g = std::min(drawchunkgrid, std::max(1, (int) std::ceil(std::sqrt((float) numtris / (float) drawchunktris))));
+    cells = g * g * g;
+    for(c = 0; c < 3; c++)
+        scale[c] = (hi[c] > lo[c]) ? (float) g / (hi[c] - lo[c]) : 0.0f;
+
+    std::vector<int> cell(numtris), start(cells + 1, 0);
+    #pragma omp parallel for schedule(static, geomchunksize)
+    for(int i = 0; i < numtris; i++)
+    {
+        int k[3];
+
+        for(int a = 0; a < 3; a++)
+        {
+            float centroid = (verts[8 * (size_t) indices[3*i] + a] + verts[8 * (size_t) indices[3*i+1] + a]
+                    + verts[8 * (size_t) indices[3*i+2] + a]) / 3.0f;
+            k[a] = std::min(g - 1, std::max(0, (int) ((centroid - lo[a]) * scale[a])));
+        }
+        cell[i] = (k[2] * g + k[1]) * g + k[0];
+    }
+
+    // counting sort, which is stable and so keeps any vertex cache ordering within a cell
+    for(t = 0; t < numtris; t++)
+        start[cell[t] + 1]++;
+    for(c = 0; c < cells; c++)
+        start[c + 1] += start[c];
+    std::vector<unsigned int> sorted(indices.size());
+    std::vector<int> pos(start.begin(), start.end() - 1);
+    for(t = 0; t < numtris; t++)
+    {
+        int dst = pos[cell[t]]++;
+
+        sorted[3*dst] = indices[3*t]; sorted[3*dst+1] = indices[3*t+1]; sorted[3*dst+2] = indices[3*t+2];
+    }
+    indices.swap(sorted);
+
+    for(c = 0; c < cells; c++)
+        if(start[c + 1] > start[c])
+        {
+            DrawChunk chunk;
+
+            chunk.first = (GLuint) (3 * start[c]);
+            chunk.count = (GLuint) (3 * (start[c + 1] - start[c]));
+            chunks.push_back(chunk);
+        }
+    chunkBounds();
+}
+
+void ShapeGeometry::chunkBounds()
+{
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < (int) chunks.size(); i++)
+    {
+        DrawChunk &chunk = chunks[i];
+
+        for(int a = 0; a < 3; a++)
+        {
+            chunk.lo[a] = verts[8 * (size_t) indices[chunk.first] + a];
+            chunk.hi[a] = chunk.lo[a];
+        }
+        for(GLuint j = chunk.first + 1; j < chunk.first + chunk.count; j++)
+            for(int a = 0; a < 3; a++)
+            {
+                chunk.lo[a] = std::min(chunk.lo[a], verts[8 * (size_t) indices[j] + a]);
+                chunk.hi[a] = std::max(chunk.hi[a], verts[8 * (size_t) indices[j] + a]);
+            }
+    }
+}
+
+void ShapeGeometry::deleteBuffers()
+{
+#ifndef TESS_HEADLESS
+    if (vboGeom != 0)
+    {
+        glDeleteVertexArrays(1, &vaoGeom);
+        glDeleteBuffers(1, &vboGeom);
+        glDeleteBuffers(1, &iboGeom);
+        vaoGeom = 0;
+        vboGeom = 0;
+        iboGeom = 0;
+    }
+    if (vboInst != 0)
+    {
+        glDeleteBuffers(1, &vboInst);
+        vboInst = 0;
+    }
+    if (volume.voxelTex != 0)
+    {
+        glDeleteTextures(1, &volume.voxelTex);
+        glDeleteTextures(1, &volume.occupancyTex);
+        volume.voxelTex = 0;
+        volume.occupancyTex = 0;
+    }
+#endif
+}
+
+bool ShapeGeometry::bindDeviceBuffers(int numverts, int numindices, const void * vertdata, const void * indexdata, GLuint &vbo, GLuint &ibo)
+{
+    clear();
+#ifdef TESS_HEADLESS
+    std::cerr << "Error ShapeGeometry::bindDeviceBuffers: built without OpenGL" << std::endl;
+    return false;
+#else
+    if (numverts <= 0 || numindices <= 0)
+        return false;
+    deleteBuffers();
+
+    glGenVertexArrays(1, &vaoGeom);
+    glBindVertexArray(vaoGeom);
+    glGenBuffers(1, &vboGeom);
+    glBindBuffer(GL_ARRAY_BUFFER, vboGeom);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CompactVertex) * (size_t) numverts, vertdata, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &iboGeom);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboGeom);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * (size_t) numindices, indexdata, GL_DYNAMIC_DRAW);
+    indexType = GL_UNSIGNED_INT;
+
+    // as the compact layout of bindBuffers
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)(0));
+    glDisableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (void*)(3*sizeof(GLfloat)));
+    glBindVertexArray(0);
+    glFinish(); // the device may only take the buffers once OpenGL is done with them
+
+    deviceIndices = numindices;
+    vbo = vboGeom;
+    ibo = iboGeom;
+    return true;
+#endif
+}
+
+bool ShapeGeometry::bindVolume(VoxelVolume * vox, View * view)
+{
+    int dim[3];
+    cgp::Point corner;
+    cgp::Vector diag;
+
+    clear();
+    vox->getDim(dim[0], dim[1], dim[2]);
+    vox->getFrame(corner, diag);
+    if(dim[0] <= 0 || dim[1] <= 0 || dim[2] <= 0)
         return false;
+#ifdef TESS_HEADLESS
+    std::cerr << "Error ShapeGeometry::bindVolume: built without OpenGL" << std::endl;
+    return false;
+#else
+    std::vector<GLuint> slab;
+    std::vector<unsigned char> occ;
+    float cell[3];
+    int odim[3];
+    GLint maxsize;
+    int xspan = vox->getXSpan();
+
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxsize);
+    if(xspan > maxsize || dim[1] > maxsize || dim[2] > maxsize)
+    {
+        std::cerr << "Error ShapeGeometry::bindVolume: volume of " << xspan << " x " << dim[1] << " x " << dim[2]
+                  << " words exceeds the 3D texture limit of " << maxsize << std::endl;
+        return false;
+    }
+
+    // the box reaches half a voxel beyond the outer centres, so that the faces of the outermost voxels are drawn
+    cell[0] = (dim[0] > 1) ? diag.i / (float) (dim[0]-1) : 0.0f;
+    cell[1] = (dim[1] > 1) ? diag.j / (float) (dim[1]-1) : 0.0f;
+    cell[2] = (dim[2] > 1) ? diag.k / (float) (dim[2]-1) : 0.0f;
+    genBox(cgp::Vector(0.5f * (diag.i + cell[0]), 0.5f * (diag.j + cell[1]), 0.5f * (diag.k + cell[2])),
+           glm::translate(glm::mat4(1.0f), glm::vec3(corner.x + 0.5f * diag.i, corner.y + 0.5f * diag.j, corner.z + 0.5f * diag.k)));
+    if(!bindBuffers(view))
+        return false;
+
+    glGenTextures(1, &volume.voxelTex);
+    glBindTexture(GL_TEXTURE_3D, volume.voxelTex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32UI, xspan, dim[1], dim[2], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    for(int z0 = 0; z0 < dim[2]; z0 += volslab)
+    {
+        int nz = std::min(volslab, dim[2] - z0);
+
+        slab.resize((size_t) xspan * dim[1] * nz);
+        #pragma omp parallel for
+        for(int z = 0; z < nz; z++)
+            for(int y = 0; y < dim[1]; y++)
+                vox->getRow(y, z0 + z, &slab[((size_t) z * dim[1] + y) * xspan]);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z0, xspan, dim[1], nz, GL_RED_INTEGER, GL_UNSIGNED_INT, slab.data());
+        uploadedBytes += sizeof(GLuint) * slab.size();
+    }
+
+    vox->getOccupancy(volblock, occ, odim);
+    glGenTextures(1, &volume.occupancyTex);
+    glBindTexture(GL_TEXTURE_3D, volume.occupancyTex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, odim[0], odim[1], odim[2], 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, occ.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    uploadedBytes += occ.size();
+
+    for(int a = 0; a < 3; a++)
+    {
+        volume.dim[a] = dim[a];
+        volume.cell[a] = (cell[a] > 0.0f) ? cell[a] : 1.0f;
     }
+    volume.block = volblock;
+    volume.origin[0] = corner.x; volume.origin[1] = corner.y; volume.origin[2] = corner.z;
+    return true;
+#endif
 }
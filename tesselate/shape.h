@@ -6,7 +6,47 @@
  * ShapeGeometry class for rendering shapes in triangle mesh format
  */
 
+#ifdef TESS_HEADLESS
+#include <GL/gl.h>  // types only, since nothing is drawn without a context
+#else
+#include "glheaders.h"
+#endif
 #include "view.h"
+#include "common/memory.h"
+
+const int geomchunksize = 4096;     ///< vertices or triangles per parallel chunk when packing geometry
+const int drawchunktris = 16384;    ///< triangles aimed for per culling chunk, below twice which geometry is drawn whole
+const int drawchunkgrid = 16;       ///< most cells along each axis of the grid that splits geometry into culling chunks
+const int volblock = 32;            ///< edge in voxels of the occupancy blocks that ray marching steps over when empty
+const int volslab = 16;             ///< slices of a voxel volume packed and uploaded at a time
+
+extern stats::MemoryInit geometryMemory;    ///< CPU copies of geometry held for upload, counted as "ShapeGeometry"
+
+/**
+ * Contiguous range of an index buffer whose triangles lie in one cell of space, so that it can be skipped when
+ * its bounds are out of view
+ */
+struct DrawChunk
+{
+    GLuint first;           ///< first index of the range
+    GLuint count;           ///< number of indices in the range
+    GLfloat lo[3], hi[3];   ///< bounding box of the triangles, in the space of the vertices
+};
+
+class VoxelVolume;
+
+/**
+ * Voxel volume drawn by ray marching its packed words instead of by triangles
+ */
+struct VolumeDrawData
+{
+    GLuint voxelTex;        ///< R32UI 3D texture of packed words, one texel per word, or 0 if the draw is not a volume
+    GLuint occupancyTex;    ///< R8UI 3D texture of block occupancy, as found by VoxelVolume::getOccupancy
+    GLint dim[3];           ///< voxels along each axis
+    GLint block;            ///< edge of an occupancy block in voxels
+    GLfloat origin[3];      ///< centre of the voxel at (0, 0, 0)
+    GLfloat cell[3];        ///< spacing of voxel centres along each axis
+};
 
 /**
  * Container for rendering properties, primarily colour
@@ -17,9 +57,25 @@ struct ShapeDrawData
     GLfloat diffuse[4];     ///< diffuse colour
     GLfloat specular[4];    ///< specular colour
     GLfloat ambient[4];     ///< ambient colour
+    GLfloat highlight[4];   ///< diffuse colour of highlighted instances
     GLuint indexBufSize;    ///< index buffer size - as required by DrawElements
+    GLenum indexType;       ///< index type - as required by DrawElements
+    GLuint instances;       ///< number of instances, each offset by its own position, or 0 for a single draw
     bool   current;         ///< set to true is this is part of current manipulator
+    bool   deformed;        ///< set to true if vertices are undeformed and should be warped by the renderer's lattice
     GLuint texID;           ///< texture ID
+    VolumeDrawData volume;  ///< volume marched inside the bounding box held by the buffers, if volume.voxelTex is not 0
+    std::vector<DrawChunk> chunks; ///< spatial ranges of the index buffer in order, or empty to draw it whole
+};
+
+/**
+ * Vertex layout for untextured geometry: a float position and a normal packed as signed normalised 10:10:10:2 by packNormal,
+ * half the size of the full layout
+ */
+struct CompactVertex
+{
+    GLfloat pos[3];         ///< position
+    GLuint normal;          ///< unit normal, 10 bits per component with x in the lowest bits
 };
 
 /**
@@ -30,8 +86,21 @@ class ShapeGeometry
 private:
     std::vector<float> verts;               ///< vertex, texture and normal data
     std::vector<unsigned int> indices;      ///< vertex indices for triangles
+    std::vector<DrawChunk> chunks;          ///< spatial ranges of the bound indices, empty if they are drawn whole
     GLuint vaoGeom, vboGeom, iboGeom;       ///< openGL handle for various buffers
+    size_t boundFloats;                     ///< size of the bound vertex buffer, in floats
+    bool indicesBound;                      ///< bound buffers match the current indices, so only vertex data can be stale
+    int dirtyLo, dirtyHi;                   ///< range of vertices changed since the last upload, empty if dirtyLo >= dirtyHi
+    bool compact;                           ///< upload vertices as CompactVertex, without texture coordinates
+    GLenum indexType;                       ///< type of the bound index buffer, 16-bit when every index fits
+    int deviceIndices;                      ///< indices in buffers filled through bindDeviceBuffers, 0 if they come from indices
+    std::vector<float> instanceData;        ///< per-instance translation and highlight flag, 4 floats each, empty for a single draw
+    GLuint vboInst;                         ///< openGL handle for the instance buffer
+    bool instancesDirty;                    ///< instance data changed since the last upload, with the same number of instances
     GLfloat diffuse[4], ambient[4], specular[4]; ///< material properties
+    GLfloat highlight[4];                   ///< diffuse colour of highlighted instances
+    VolumeDrawData volume;                  ///< textures and frame of a volume bound by bindVolume
+    stats::MemoryTally memtally;            ///< bytes of the vertex, index and instance arrays
 
     /**
      * Create a sphere vertex at specified integer latitude and longitude with a transformation matrix applied and append to existing geometry
@@ -42,17 +111,54 @@ private:
      */
     void genSphereVert(float radius, float lat, float lon, glm::mat4x4 trm);
 
+    /**
+     * Pack a range of vertices into the compact layout
+     * @param lo, hi    range of vertices, hi exclusive
+     * @param[out] out  packed vertices
+     */
+    void packCompact(int lo, int hi, std::vector<CompactVertex> &out);
+
+    /**
+     * Reorder the triangles of large geometry by the cell of a coarse grid holding their centroid, keeping their
+     * order within a cell, and make a chunk of each occupied cell. Instanced geometry is not split.
+     */
+    void buildChunks();
+
+    /// Recompute the bounding box of every chunk from the current vertices
+    void chunkBounds();
+
+    /// Delete the vertex array and any vertex, index and instance buffers
+    void deleteBuffers();
+
+    /// Count the capacity of the CPU-side arrays towards the ShapeGeometry memory total
+    void accountMemory()
+    {
+        memtally.set((verts.capacity() + instanceData.capacity()) * sizeof(float) + indices.capacity() * sizeof(unsigned int));
+    }
+
 public:
 
     /// default constructor
     ShapeGeometry()
+        : memtally(geometryMemory)
     {
         vaoGeom = 0;
         vboGeom = 0;
         iboGeom = 0;
+        vboInst = 0;
+        instancesDirty = false;
+        boundFloats = 0;
+        indicesBound = false;
+        dirtyLo = dirtyHi = 0;
+        compact = false;
+        indexType = GL_UNSIGNED_INT;
+        deviceIndices = 0;
+        volume.voxelTex = volume.occupancyTex = 0;
 
         // default colour
         diffuse[0] = 0.325f; diffuse[1] = 0.235f; diffuse[3] = diffuse[2] = 1.0f;
+        for(int i = 0; i < 4; i++)
+            highlight[i] = diffuse[i];
     }
 
     /// destructor
@@ -66,14 +172,30 @@ public:
     {
         verts.clear();
         indices.clear();
+        instanceData.clear();
+        instancesDirty = false;
+        chunks.clear();
+        indicesBound = false;
+        deviceIndices = 0;
+        accountMemory();
     }
 
+    /**
+     * Select the vertex layout used on upload. The compact layout drops texture coordinates and packs normals,
+     * so it suits untextured geometry. Takes effect at the next bindBuffers.
+     * @param on    if true then use CompactVertex, otherwise 8 floats per vertex
+     */
+    void setCompact(bool on){ compact = on; indicesBound = false; }
+
     /// Getter for shape colour
     GLfloat * getColour(){ return diffuse; }
 
     /// Setter for shape colour
     void setColour(GLfloat * col);
 
+    /// Setter for the colour of instances flagged as highlighted by setInstances
+    void setHighlightColour(GLfloat * col){ for(int i = 0; i < 4; i++) highlight[i] = col[i]; }
+
     /**
      * Create an uncapped cylinder originally lying along the positive z-axis and append to existing geometry
      * @param radius      radius of cylinder
@@ -93,6 +215,23 @@ public:
      */
     void genSphere(float radius, int slices, int stacks, glm::mat4x4 trm);
 
+    /**
+     * Create an axis-aligned box with flat shaded faces, centred on the origin, with a transformation matrix applied
+     * and append to existing geometry
+     * @param halfext   half the extent of the box along each axis
+     * @param trm       model transformation matrix
+     */
+    void genBox(cgp::Vector halfext, glm::mat4x4 trm);
+
+    /**
+     * Draw the geometry once per offset, translated by that offset, in a single instanced draw call.
+     * Takes effect at the next bindBuffers, which only rewrites the instance buffer if the number of instances
+     * is unchanged.
+     * @param offsets   translation of each instance
+     * @param flags     highlighting of each instance, drawn in the highlight colour, or empty for none
+     */
+    void setInstances(const std::vector<cgp::Point> &offsets, const std::vector<bool> &flags = std::vector<bool>());
+
     /**
      * Convert a mesh structure to openGL geometry
      * @param points    list of vertices
@@ -102,6 +241,58 @@ public:
      */
     void genMesh(std::vector<cgp::Point> * points, std::vector<cgp::Vector> * norms, std::vector<int> * faces, glm::mat4x4 trm);
 
+    /**
+     * Convert mesh arrays to openGL geometry in bulk, without intermediate copies. The output is sized once and
+     * packed in parallel.
+     * @param points    vertices
+     * @param norms     vertex normals, one per vertex
+     * @param numpoints number of vertices
+     * @param faces     first vertex index of the first triangle, with the three indices of a triangle contiguous
+     * @param numtris   number of triangles
+     * @param stride    distance in bytes between the first indices of consecutive triangles
+     * @param trm       model transformation matrix
+     */
+    void genMesh(const cgp::Point * points, const cgp::Vector * norms, int numpoints, const int * faces, int numtris,
+                 size_t stride, glm::mat4x4 trm);
+
+    /**
+     * Append the vertices and triangles of other geometry, such as a cached tessellation, whose indices are rebased
+     * after the existing vertices. Instance offsets and materials of @a piece are ignored.
+     * @param piece     geometry to copy
+     */
+    void append(const ShapeGeometry &piece);
+
+    /**
+     * Append other geometry as for append, with its positions and normals mapped by an affine transform. Triangles
+     * are rewound if the transform mirrors, so that they still face outwards.
+     * @param piece     geometry to copy
+     * @param trm       transform applied to the copy
+     */
+    void append(const ShapeGeometry &piece, const glm::mat4x4 &trm);
+
+    /**
+     * Copy out the corner positions of every triangle, as Mesh::packTriangles does for a mesh
+     * @param[out] coords   x, y and z of each of the three corners of each triangle in turn, 9 floats per triangle
+     */
+    void packTriangles(std::vector<float> &coords) const;
+
+    /**
+     * Overwrite the positions and normals of geometry created by a single genMesh call, keeping its triangles.
+     * Only vertices whose data actually changes are marked for upload by the next bindBuffers.
+     * @param points    list of vertices, as many as the geometry holds
+     * @param norms     list of vertex normals
+     * @param trm       model transformation matrix
+     * @retval true if the geometry was updated in place,
+     * @retval false if the vertex count differs, in which case the geometry must be regenerated
+     */
+    bool updateMesh(std::vector<cgp::Point> * points, std::vector<cgp::Vector> * norms, glm::mat4x4 trm);
+
+    /**
+     * Returns the bytes written to vertex, index and instance buffers by bindBuffers across all geometry since the
+     * last call, and starts counting again from zero
+     */
+    static size_t takeUploadedBytes();
+
     /**
      * Return data required for a draw call, such as the VAO, colour, etc.
      */
@@ -109,10 +300,39 @@ public:
 
     /**
      * Bind the appropriate OpenGL buffers for rendering the constraint shape. Only needs to be done if
-     * the shape changes.
+     * the shape changes. If only vertex data changed since the last call, through updateMesh, then just the
+     * changed range of the existing vertex buffer is rewritten and the index buffer is kept. Large geometry has its
+     * triangles reordered into spatial chunks, which the renderer culls against the view.
      * @param view      current viewpoint
      * @retval true if buffers successfully bound
      */
     bool bindBuffers(View * view);
+
+    /**
+     * Create vertex and index buffers for geometry that is written by a device, such as a surface extracted by
+     * CLVoxeliser, rather than packed from the CPU-side arrays, which are cleared. Vertices take the CompactVertex
+     * layout and indices are 32-bit. OpenGL has finished with the buffers on return, so the device may write them,
+     * and later bindBuffers calls keep them until other geometry is generated.
+     * @param numverts      number of vertices
+     * @param numindices    number of indices, 3 per triangle
+     * @param vertdata      initial vertices, or NULL to leave them for the device to write
+     * @param indexdata     initial indices, or NULL to leave them for the device to write
+     * @param[out] vbo, ibo handles of the vertex and index buffers
+     * @retval true if the buffers were created,
+     * @retval false if there is no geometry or no OpenGL
+     */
+    bool bindDeviceBuffers(int numverts, int numindices, const void * vertdata, const void * indexdata, GLuint &vbo, GLuint &ibo);
+
+    /**
+     * Upload a voxel volume for the renderer to ray march, replacing any geometry with the box around its voxels. The
+     * packed words go to an integer 3D texture, a slab of slices at a time so that a sparse volume is never expanded
+     * whole in memory, alongside a texture of block occupancy that lets empty space be skipped. Later bindBuffers
+     * calls keep the textures until other geometry is generated.
+     * @param vox       volume to draw, left unchanged
+     * @param view      current viewpoint
+     * @retval true if the textures were created,
+     * @retval false if the volume is empty, larger than the driver's 3D textures or there is no OpenGL
+     */
+    bool bindVolume(VoxelVolume * vox, View * view);
 };
 #endif
@@ -0,0 +1,219 @@
+//
+// SharedSegment, SharedGeometryWriter, SharedGeometryReader
+//
+
+#include "sharedgeom.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static_assert(sizeof(SharedGeometryHeader) == 64, "shared geometry header must stay 64 bytes");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the segment state must be lock free to be shared between processes");
+
+SharedSegment::SharedSegment()
+{
+    fd = -1;
+    base = NULL;
+    mapped = 0;
+}
+
+SharedSegment::~SharedSegment()
+{
+    close();
+}
+
+string SharedSegment::segmentName(const string &segname)
+{
+    return (!segname.empty() && segname[0] == '/') ? segname : "/" + segname;
+}
+
+bool SharedSegment::remap()
+{
+    struct stat st;
+    void * ptr;
+
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SharedGeometryHeader))
+        return false;
+    if(base != NULL && (size_t) st.st_size == mapped)
+        return true;
+    ptr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED)
+        return false;
+    if(base != NULL)
+        munmap(base, mapped);
+    base = (char *) ptr;
+    mapped = (size_t) st.st_size;
+    return true;
+}
+
+template<typename Test> bool SharedSegment::waitFor(Test test, double timeout)
+{
+    auto start = chrono::steady_clock::now();
+
+    for(;;)
+    {
+        if(test((SharedState) header()->state.load(memory_order_acquire)))
+            return true;
+        if(timeout >= 0.0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() >= timeout)
+            return false;
+        this_thread::sleep_for(chrono::microseconds(sharedpollmicros));
+    }
+}
+
+void SharedSegment::close()
+{
+    if(base != NULL)
+        munmap(base, mapped);
+    if(fd >= 0)
+        ::close(fd);
+    base = NULL;
+    mapped = 0;
+    fd = -1;
+}
+
+bool SharedSegment::unlink(const string &segname)
+{
+    return shm_unlink(segmentName(segname).c_str()) == 0;
+}
+
+bool SharedGeometryWriter::open(const string &segname)
+{
+    struct stat st;
+
+    close();
+    name = segmentName(segname);
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if(fd < 0)
+    {
+        cerr << "Error SharedGeometryWriter::open: unable to create " << name << endl;
+        return false;
+    }
+    // a new segment is empty, and growing it zeroes the header, which leaves the state EMPTY
+    if(fstat(fd, &st) != 0 || ((size_t) st.st_size < sizeof(SharedGeometryHeader) && ftruncate(fd, sizeof(SharedGeometryHeader)) != 0) || !remap())
+    {
+        cerr << "Error SharedGeometryWriter::open: unable to map " << name << endl;
+        close();
+        return false;
+    }
+    if(header()->sequence == 0 && memcmp(header()->magic, sharedmagic, 4) != 0)
+    {
+        memcpy(header()->magic, sharedmagic, 4);
+        header()->version = sharedversion;
+    }
+    else if(memcmp(header()->magic, sharedmagic, 4) != 0 || header()->version != sharedversion)
+    {
+        cerr << "Error SharedGeometryWriter::open: " << name << " is not a shared geometry segment of version " << sharedversion << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+char * SharedGeometryWriter::beginPayload(size_t bytes, double timeout)
+{
+    size_t needed = sizeof(SharedGeometryHeader) + bytes;
+    uint32_t previous;
+
+    if(!waitFor([](SharedState state){ return state != SharedState::READY; }, timeout))
+    {
+        cerr << "Error SharedGeometryWriter::publish: the previous payload in " << name << " was not consumed in time" << endl;
+        return NULL;
+    }
+    previous = header()->state.exchange((uint32_t) SharedState::WRITING, memory_order_acq_rel);
+
+    // a segment only grows, so that a consumer still mapping the old length never loses pages under it
+    if(needed > mapped && (ftruncate(fd, (off_t) needed) != 0 || !remap() || needed > mapped))
+    {
+        cerr << "Error SharedGeometryWriter::publish: unable to grow " << name << " to " << needed << " bytes" << endl;
+        header()->state.store(previous, memory_order_release);
+        return NULL;
+    }
+    return base + sizeof(SharedGeometryHeader);
+}
+
+void SharedGeometryWriter::endPayload(SharedKind kind, size_t bytes)
+{
+    header()->kind = (int32_t) kind;
+    header()->payloadbytes = (uint64_t) bytes;
+    header()->sequence++;
+    header()->state.store((uint32_t) SharedState::READY, memory_order_release);
+}
+
+bool SharedGeometryWriter::publish(Mesh * mesh, double timeout)
+{
+    size_t bytes = mesh->getMeshFileBytes();
+    char * payload;
+
+    if(!isOpen())
+        return false;
+    payload = beginPayload(bytes, timeout);
+    if(payload == NULL)
+        return false;
+    mesh->encodeMeshFile(payload);
+    endPayload(SharedKind::MESH, bytes);
+    return true;
+}
+
+bool SharedGeometryWriter::publish(VoxelVolume * vox, double timeout)
+{
+    size_t bytes = vox->getVoxelFileBytes();
+    char * payload;
+
+    if(!isOpen())
+        return false;
+    payload = beginPayload(bytes, timeout);
+    if(payload == NULL)
+        return false;
+    vox->encodeVoxels(payload);
+    endPayload(SharedKind::VOXELS, bytes);
+    return true;
+}
+
+bool SharedGeometryReader::open(const string &segname)
+{
+    close();
+    name = segmentName(segname);
+    seen = 0;
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if(fd < 0)
+    {
+        cerr << "Error SharedGeometryReader::open: unable to open " << name << endl;
+        return false;
+    }
+    if(!remap() || memcmp(header()->magic, sharedmagic, 4) != 0 || header()->version != sharedversion)
+    {
+        cerr << "Error SharedGeometryReader::open: " << name << " is not a shared geometry segment of version " << sharedversion << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool SharedGeometryReader::wait(double timeout)
+{
+    if(!isOpen())
+        return false;
+    if(!waitFor([this](SharedState state){ return state == SharedState::READY && header()->sequence > seen; }, timeout))
+        return false;
+    // the producer grows the segment before marking the payload ready
+    if(!remap())
+    {
+        cerr << "Error SharedGeometryReader::wait: unable to map " << name << endl;
+        return false;
+    }
+    seen = header()->sequence;
+    return true;
+}
+
+void SharedGeometryReader::release()
+{
+    if(isOpen())
+        header()->state.store((uint32_t) SharedState::CONSUMED, memory_order_release);
+}
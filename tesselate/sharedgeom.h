@@ -0,0 +1,221 @@
+/**
+ * @file
+ *
+ * Handoff of meshes and voxel volumes to other processes on the same machine through named shared memory.
+ */
+
+#ifndef _SHAREDGEOM
+#define _SHAREDGEOM
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "mesh.h"
+#include "voxels.h"
+
+const char sharedmagic[4] = {'T', 'S', 'H', 'G'};   ///< identifies a shared geometry segment
+const int sharedversion = 1;                        ///< current shared geometry segment layout
+const int sharedpollmicros = 200;                   ///< interval between checks of the segment state while waiting
+
+/// Stage of the handshake between the producer and consumer of a segment
+enum class SharedState : uint32_t
+{
+    EMPTY,      ///< created, nothing published yet
+    WRITING,    ///< the producer is filling in the payload
+    READY,      ///< a payload is complete and has not yet been consumed
+    CONSUMED    ///< the consumer is done with the payload, which may be overwritten
+};
+
+/// Geometry held in a segment
+enum class SharedKind : int32_t
+{
+    NONE,       ///< nothing published yet
+    MESH,       ///< a binary indexed mesh file, starting with MeshFileHeader
+    VOXELS      ///< a binary voxel file, starting with VoxelFileHeader
+};
+
+/**
+ * Fixed size header at the start of a shared geometry segment. It is followed by the payload, laid out exactly as the
+ * file the geometry would be written to, so that a consumer uses the arrays in place without parsing or copying.
+ * Padded to 64 bytes so that the payload arrays are well aligned.
+ */
+struct SharedGeometryHeader
+{
+    char magic[4];                  ///< always sharedmagic
+    int32_t version;                ///< layout version, currently sharedversion
+    std::atomic<uint32_t> state;    ///< a SharedState, written with release and read with acquire ordering
+    int32_t kind;                   ///< a SharedKind, valid while state is READY
+    uint64_t sequence;              ///< number of payloads published, counting the current one
+    uint64_t payloadbytes;          ///< size of the current payload
+    int32_t pad[8];                 ///< reserved, zero
+};
+
+/**
+ * Mapping of a named POSIX shared memory segment, common to the producer and consumer ends
+ */
+class SharedSegment
+{
+protected:
+    std::string name;               ///< segment name, with the leading slash shm_open requires
+    int fd;                         ///< descriptor of the open segment, or -1
+    char * base;                    ///< start of the mapping, or NULL
+    size_t mapped;                  ///< length of the mapping
+
+    SharedSegment();
+    ~SharedSegment();
+
+    /// Header at the start of the mapping
+    SharedGeometryHeader * header(){ return (SharedGeometryHeader *) base; }
+
+    /**
+     * Map the segment as it now stands, replacing any earlier mapping if the segment has grown
+     * @retval true if at least a header is mapped,
+     * @retval false otherwise
+     */
+    bool remap();
+
+    /**
+     * Poll the state until it satisfies a test or the timeout expires
+     * @param timeout   seconds to wait, or negative to wait indefinitely
+     */
+    template<typename Test> bool waitFor(Test test, double timeout);
+
+    /// Name as shm_open expects it
+    static std::string segmentName(const std::string &segname);
+
+public:
+
+    SharedSegment(const SharedSegment &) = delete;
+    SharedSegment & operator=(const SharedSegment &) = delete;
+
+    /// Unmap and close the segment, which remains in the system until unlinked
+    void close();
+
+    /// Is a segment open?
+    bool isOpen(){ return base != NULL; }
+
+    /**
+     * Remove a segment from the system. Processes with it mapped keep their mappings.
+     * @param segname   name of the segment, with or without the leading slash
+     * @retval true if the segment existed and was removed,
+     * @retval false otherwise
+     */
+    static bool unlink(const std::string &segname);
+};
+
+/**
+ * Producer end of a segment, which publishes one geometry at a time. Each publish waits for the consumer to be done
+ * with the previous payload, then encodes the new one straight into the mapping, growing the segment if needed, so
+ * that the geometry is copied once from the in-memory representation and never written to disk.
+ */
+class SharedGeometryWriter : public SharedSegment
+{
+private:
+
+    /**
+     * Take the segment for writing a payload, once the previous one has been consumed
+     * @returns start of the payload area, or NULL if the wait timed out or the segment could not be grown
+     */
+    char * beginPayload(size_t bytes, double timeout);
+
+    /// Mark the payload complete
+    void endPayload(SharedKind kind, size_t bytes);
+
+public:
+
+    SharedGeometryWriter(){}
+
+    /**
+     * Create the named segment, or open it if it already exists, such as when a consumer is waiting on it
+     * @param segname   name of the segment, with or without the leading slash
+     * @retval true if the segment is open,
+     * @retval false otherwise
+     */
+    bool open(const std::string &segname);
+
+    /**
+     * Publish a mesh in binary indexed mesh file layout
+     * @param mesh      mesh to publish, whose cache order is applied
+     * @param timeout   seconds to wait for the previous payload to be consumed, or negative to wait indefinitely
+     * @retval true if the mesh was published,
+     * @retval false if the wait timed out or the segment could not be grown
+     */
+    bool publish(Mesh * mesh, double timeout);
+
+    /**
+     * Publish a voxel volume in binary voxel format, sparse volumes being written out dense
+     * @param vox       volume to publish
+     * @param timeout   seconds to wait for the previous payload to be consumed, or negative to wait indefinitely
+     * @retval true if the volume was published,
+     * @retval false if the wait timed out or the segment could not be grown
+     */
+    bool publish(VoxelVolume * vox, double timeout);
+};
+
+/**
+ * Consumer end of a segment. Wait for a payload, read it in place through the accessors, then release it so that the
+ * producer may publish the next. The accessors are valid from a successful wait until release or close.
+ */
+class SharedGeometryReader : public SharedSegment
+{
+private:
+    uint64_t seen;                  ///< sequence number of the last payload returned by wait
+
+public:
+
+    SharedGeometryReader(){ seen = 0; }
+
+    /**
+     * Open an existing segment
+     * @param segname   name of the segment, with or without the leading slash
+     * @retval true if the segment exists and holds a header of the current version,
+     * @retval false otherwise
+     */
+    bool open(const std::string &segname);
+
+    /**
+     * Wait for a payload not yet returned by an earlier wait
+     * @param timeout   seconds to wait, or negative to wait indefinitely
+     * @retval true if a payload is ready,
+     * @retval false if the wait timed out
+     */
+    bool wait(double timeout);
+
+    /// Let the producer overwrite the payload returned by the last wait
+    void release();
+
+    /// Geometry held by the payload
+    SharedKind getKind(){ return (SharedKind) header()->kind; }
+
+    /// Sequence number of the payload, 1 for the first one published into the segment
+    uint64_t getSequence(){ return header()->sequence; }
+
+    /// Payload, laid out as the file of its kind
+    const char * getPayload(){ return base + sizeof(SharedGeometryHeader); }
+
+    /// Size of the payload
+    size_t getPayloadBytes(){ return (size_t) header()->payloadbytes; }
+
+    /// Header of a mesh payload
+    const MeshFileHeader * getMeshHeader(){ return (const MeshFileHeader *) getPayload(); }
+
+    /// Vertex positions of a mesh payload, 3 floats each
+    const float * getVerts(){ return (const float *) (getPayload() + sizeof(MeshFileHeader)); }
+
+    /// Vertex normals of a mesh payload, 3 floats each, or NULL if the mesh has none
+    const float * getNorms(){ return getMeshHeader()->hasnorms ? getVerts() + 3 * (size_t) getMeshHeader()->numverts : NULL; }
+
+    /// Vertex indices of a mesh payload, 3 per triangle
+    const int32_t * getTris(){ return (const int32_t *) (getVerts() + 3 * (size_t) getMeshHeader()->numverts * (getMeshHeader()->hasnorms ? 2 : 1)); }
+
+    /// Triangle normals of a mesh payload, 3 floats each
+    const float * getFaceNorms(){ return (const float *) (getTris() + 3 * (size_t) getMeshHeader()->numtris); }
+
+    /// Header of a voxel payload
+    const VoxelFileHeader * getVoxelHeader(){ return (const VoxelFileHeader *) getPayload(); }
+
+    /// Packed words of a voxel payload, row by row as in VoxelVolume
+    const unsigned int * getWords(){ return (const unsigned int *) (getPayload() + sizeof(VoxelFileHeader)); }
+};
+
+#endif
@@ -0,0 +1,406 @@
+/**
+ * @file
+ *
+ * Planar slicing of meshes and voxel volumes into closed contours per layer, for print preparation
+ */
+
+#include "slicer.h"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <math.h>
+#include "common/log.h"
+#include "common/timer.h"
+
+using namespace std;
+
+static stats::TimeInit sliceMeshTime("Slicer::slice mesh");
+static stats::TimeInit sliceVoxelTime("Slicer::slice voxels");
+
+bool CLISliceWriter::open(const std::string &filename)
+{
+    close();
+    fp = fopen(filename.c_str(), "w");
+    if(fp == NULL)
+    {
+        cerr << "Error CLISliceWriter::open: unable to open " << filename << endl;
+        return false;
+    }
+    name = filename;
+    numlayers = numcontours = 0;
+
+    // no layer count, which is optional, as the layers are not known until they are written
+    ok = fprintf(fp, "$$HEADERSTART\n$$ASCII\n$$UNITS/00000001.000000\n$$VERSION/200\n$$HEADEREND\n$$GEOMETRYSTART\n") > 0;
+    return ok;
+}
+
+bool CLISliceWriter::write(const SliceLayer &layer)
+{
+    if(fp == NULL || !ok)
+        return false;
+    ok = fprintf(fp, "$$LAYER/%.6f\n", layer.z) > 0;
+    for(const SliceContour &c : layer.contours)
+    {
+        int n = (int) c.xy.size() / 2;
+
+        if(n < 3 || !ok)
+            continue;
+
+        // direction 1 is counterclockwise, an outer boundary, and 0 clockwise, a hole; closed polylines repeat the first point
+        numcontours++;
+        ok = fprintf(fp, "$$POLYLINE/%d,%d,%d", numcontours, c.outer ? 1 : 0, n + 1) > 0;
+        for(int i = 0; i <= n && ok; i++)
+            ok = fprintf(fp, ",%.6f,%.6f", c.xy[2 * (i % n)], c.xy[2 * (i % n) + 1]) > 0;
+        ok = ok && fprintf(fp, "\n") > 0;
+    }
+    if(!ok)
+        cerr << "Error CLISliceWriter::write: unable to write to " << name << endl;
+    else
+        numlayers++;
+    return ok;
+}
+
+bool CLISliceWriter::close()
+{
+    bool done;
+
+    if(fp == NULL)
+        return false;
+    done = ok && fprintf(fp, "$$GEOMETRYEND\n") > 0;
+    done = (fclose(fp) == 0) && done;
+    fp = NULL;
+    if(!done)
+        cerr << "Error CLISliceWriter::close: unable to complete " << name << endl;
+    return done;
+}
+
+void Slicer::layerRange(float zmin, float zmax, int &first, int &last)
+{
+    // a plane cuts heights in (zmin, zmax], so the range is widened by a layer and trimmed exactly
+    first = (int) floorf((zmin - base) / thickness - 0.5f);
+    last = (int) ceilf((zmax - base) / thickness - 0.5f);
+    while(first <= last && height(first) <= zmin)
+        first++;
+    while(last >= first && height(last) > zmax)
+        last--;
+}
+
+int Slicer::chainSegments(const std::vector<int64_t> &from, const std::vector<int64_t> &to, const std::vector<float> &pts,
+                          SliceLayer &layer)
+{
+    vector<int> order(from.size());
+    vector<char> used(from.size(), 0);
+    int open = 0;
+
+    // segments sorted by their start, so that the segments leaving a point are found by binary search
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&from](int a, int b){ return from[a] < from[b]; });
+
+    for(int s0 : order)
+    {
+        SliceContour contour;
+        int s = s0;
+        bool closed = false;
+
+        if(used[s0])
+            continue;
+        while(true)
+        {
+            float dx = pts[4*s+2] - pts[4*s], dy = pts[4*s+3] - pts[4*s+1], best = 0.0f;
+            int next = -1;
+
+            used[s] = 1;
+            contour.xy.push_back(pts[4*s]);
+            contour.xy.push_back(pts[4*s+1]);
+            if(to[s] == from[s0])
+            {
+                closed = true;
+                break;
+            }
+
+            // where two segments leave a point, the sharpest turn to the left keeps each contour to its own side
+            for(auto it = std::lower_bound(order.begin(), order.end(), to[s], [&from](int a, int64_t key){ return from[a] < key; });
+                it != order.end() && from[* it] == to[s]; it++)
+            {
+                float turn = dx * (pts[4 * * it + 3] - pts[4 * * it + 1]) - dy * (pts[4 * * it + 2] - pts[4 * * it]);
+
+                if(used[* it] && * it != s0)
+                    continue;
+                if(next < 0 || turn > best)
+                {
+                    next = * it;
+                    best = turn;
+                }
+            }
+            if(next < 0 || next == s0)
+            {
+                closed = (next == s0);
+                break;
+            }
+            s = next;
+        }
+        if(!closed)
+        {
+            open++;
+            continue;
+        }
+
+        // drop repeated and collinear corners, which voxel faces and cuts through vertices leave
+        vector<float> &xy = contour.xy;
+        bool changed = true;
+        while(changed && xy.size() >= 6)
+        {
+            vector<float> kept;
+            int n = (int) xy.size() / 2;
+
+            changed = false;
+            for(int i = 0; i < n; i++)
+            {
+                int p = (i + n - 1) % n, q = (i + 1) % n;
+                float ax = xy[2*i] - xy[2*p], ay = xy[2*i+1] - xy[2*p+1], bx = xy[2*q] - xy[2*i], by = xy[2*q+1] - xy[2*i+1];
+
+                if((ax == 0.0f && ay == 0.0f) || (ax * by - ay * bx == 0.0f && ax * bx + ay * by >= 0.0f))
+                {
+                    changed = true;
+                    continue;
+                }
+                kept.push_back(xy[2*i]);
+                kept.push_back(xy[2*i+1]);
+            }
+            xy.swap(kept);
+        }
+        if(xy.size() < 6)
+            continue;
+
+        // shoelace area, positive for counterclockwise
+        double area = 0.0;
+        int n = (int) xy.size() / 2;
+        for(int i = 0; i < n; i++)
+        {
+            int q = (i + 1) % n;
+            area += (double) xy[2*i] * xy[2*q+1] - (double) xy[2*q] * xy[2*i+1];
+        }
+        contour.outer = area > 0.0;
+        layer.contours.push_back(std::move(contour));
+    }
+    return open;
+}
+
+bool Slicer::slice(const cgp::Point * points, const int * faces, int numtris, size_t stride, SliceWriter &out)
+{
+    stats::Timer timer(sliceMeshTime);
+    vector<float> zlo(numtris), zhi(numtris);
+    vector<int> order(numtris), active;
+    float zmin = 0.0f, zmax = 0.0f;
+    int first, last, chains = 0;
+    size_t next = 0;
+
+    openchains = 0;
+    if(thickness <= 0.0f)
+    {
+        cerr << "Error Slicer::slice: layer thickness " << thickness << " is not positive" << endl;
+        return false;
+    }
+    if(numtris == 0)
+        return true;
+    auto corner = [&](int t, int c) -> const cgp::Point & { return points[((const int *) ((const char *) faces + (size_t) t * stride))[c]]; };
+
+    // height range of each triangle, swept upwards from the lowest
+    #pragma omp parallel for schedule(static)
+    for(int t = 0; t < numtris; t++)
+    {
+        zlo[t] = std::min(corner(t, 0).z, std::min(corner(t, 1).z, corner(t, 2).z));
+        zhi[t] = std::max(corner(t, 0).z, std::max(corner(t, 1).z, corner(t, 2).z));
+    }
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&zlo](int a, int b){ return zlo[a] < zlo[b]; });
+    zmin = zlo[order[0]];
+    zmax = * std::max_element(zhi.begin(), zhi.end());
+    if(!fixedbase)
+        base = zmin;
+    layerRange(zmin, zmax, first, last);
+
+    for(int b = first; b <= last; b += slicebatch)
+    {
+        int e = std::min(b + slicebatch - 1, last), lo, hi;
+        vector<SliceLayer> layers(e - b + 1);
+        vector<vector<int>> crossing(e - b + 1);
+
+        // triangles below the batch leave the sweep, and those starting within it join
+        active.erase(std::remove_if(active.begin(), active.end(), [&](int t){ return zhi[t] < height(b); }), active.end());
+        while(next < order.size() && zlo[order[next]] < height(e))
+            active.push_back(order[next++]);
+        for(int t : active)
+        {
+            layerRange(zlo[t], zhi[t], lo, hi);
+            for(int l = std::max(lo, b); l <= std::min(hi, e); l++)
+                crossing[l - b].push_back(t);
+        }
+
+        #pragma omp parallel for schedule(dynamic) reduction(+:chains)
+        for(int l = 0; l <= e - b; l++)
+        {
+            float h = height(b + l);
+            vector<int64_t> from, to;
+            vector<float> pts;
+
+            layers[l].z = h;
+            for(int t : crossing[l])
+            {
+                const int * tri = (const int *) ((const char *) faces + (size_t) t * stride);
+                cgp::Point v[3] = {corner(t, 0), corner(t, 1), corner(t, 2)};
+                int64_t key[2];
+                float px[2], py[2];
+                int n = 0;
+
+                // corners at the plane count as above it, so each edge is cut at most once and shared edges agree
+                for(int c = 0; c < 3; c++)
+                {
+                    int d = (c + 1) % 3;
+                    bool ca = v[c].z >= h, da = v[d].z >= h;
+
+                    if(ca == da || n == 2)
+                        continue;
+                    float s = (h - v[c].z) / (v[d].z - v[c].z);
+                    px[n] = v[c].x + s * (v[d].x - v[c].x);
+                    py[n] = v[c].y + s * (v[d].y - v[c].y);
+                    key[n] = ((int64_t) std::min(tri[c], tri[d]) << 32) | (int64_t) (uint32_t) std::max(tri[c], tri[d]);
+                    n++;
+                }
+                if(n != 2)
+                    continue;
+
+                // directed so that the outside, where the normal points, lies to the right
+                cgp::Vector e1, e2, nrm;
+                e1.diff(v[0], v[1]);
+                e2.diff(v[0], v[2]);
+                nrm.cross(e1, e2);
+                int i0 = (-nrm.j * (px[1] - px[0]) + nrm.i * (py[1] - py[0]) >= 0.0f) ? 0 : 1;
+                from.push_back(key[i0]);
+                to.push_back(key[1 - i0]);
+                pts.push_back(px[i0]); pts.push_back(py[i0]);
+                pts.push_back(px[1 - i0]); pts.push_back(py[1 - i0]);
+            }
+            chains += chainSegments(from, to, pts, layers[l]);
+        }
+
+        for(const SliceLayer &layer : layers)
+            if(!out.write(layer))
+                return false;
+    }
+    openchains = chains;
+    if(chains > 0)
+        UTS_LOG(WARNING, MESH, "Slicer::slice: ", chains, " contours did not close, as the mesh has holes or non-manifold edges");
+    return true;
+}
+
+void Slicer::sliceVoxelLayer(VoxelVolume * vox, int k, SliceLayer &layer)
+{
+    int dx, dy, dz, xspan = vox->getXSpan();
+    unsigned int pad;
+    cgp::Point origin;
+    cgp::Vector diag;
+    float cx, cy;
+    vector<int64_t> from, to;
+    vector<float> pts;
+
+    vox->getDim(dx, dy, dz);
+    vox->getFrame(origin, diag);
+    cx = (dx > 1) ? diag.i / (float) (dx-1) : 1.0f;
+    cy = (dy > 1) ? diag.j / (float) (dy-1) : 1.0f;
+    pad = (dx % voxwordbits == 0) ? 0xFFFFFFFFu : ~(0xFFFFFFFFu >> (dx % voxwordbits));
+
+    // words outside the slice are empty, and the padding past the end of a row is cleared
+    auto word = [&](int w, int y) -> unsigned int
+    {
+        if(w < 0 || w >= xspan || y < 0 || y >= dy)
+            return 0u;
+        return vox->getWordUnchecked(w, y, k) & ((w == xspan-1) ? pad : 0xFFFFFFFFu);
+    };
+
+    // each exposed side of an occupied voxel is an edge between cell corners, running counterclockwise around it
+    auto edge = [&](int x0, int y0, int x1, int y1)
+    {
+        from.push_back((int64_t) y0 * (dx + 1) + x0);
+        to.push_back((int64_t) y1 * (dx + 1) + x1);
+        pts.push_back(origin.x + ((float) x0 - 0.5f) * cx); pts.push_back(origin.y + ((float) y0 - 0.5f) * cy);
+        pts.push_back(origin.x + ((float) x1 - 0.5f) * cx); pts.push_back(origin.y + ((float) y1 - 0.5f) * cy);
+    };
+
+    for(int y = 0; y < dy; y++)
+        for(int w = 0; w < xspan; w++)
+        {
+            unsigned int cur = word(w, y), side[4];
+
+            if(cur == 0u)
+                continue;
+
+            // the voxel at x is held in bit 31-(x%32), so its neighbour at x-1 is the next bit up
+            side[0] = cur & ~word(w, y-1);
+            side[1] = cur & ~((cur << 1) | (word(w+1, y) >> (voxwordbits-1)));
+            side[2] = cur & ~word(w, y+1);
+            side[3] = cur & ~((cur >> 1) | (word(w-1, y) << (voxwordbits-1)));
+            for(int f = 0; f < 4; f++)
+                for(unsigned int bits = side[f]; bits != 0u; )
+                {
+                    int b = __builtin_clz(bits), x = w * voxwordbits + b;
+
+                    bits &= ~(0x80000000u >> b);
+                    if(f == 0)
+                        edge(x, y, x+1, y);
+                    else if(f == 1)
+                        edge(x+1, y, x+1, y+1);
+                    else if(f == 2)
+                        edge(x+1, y+1, x, y+1);
+                    else
+                        edge(x, y+1, x, y);
+                }
+        }
+    chainSegments(from, to, pts, layer);
+}
+
+bool Slicer::slice(VoxelVolume * vox, SliceWriter &out)
+{
+    stats::Timer timer(sliceVoxelTime);
+    int dx, dy, dz, first, last;
+    cgp::Point origin;
+    cgp::Vector diag;
+    float cz, bottom;
+
+    openchains = 0;
+    if(thickness <= 0.0f)
+    {
+        cerr << "Error Slicer::slice: layer thickness " << thickness << " is not positive" << endl;
+        return false;
+    }
+    vox->getDim(dx, dy, dz);
+    vox->getFrame(origin, diag);
+    if(dx <= 0 || dy <= 0 || dz <= 0)
+        return true;
+    cz = (dz > 1) ? diag.k / (float) (dz-1) : thickness;
+    bottom = origin.z - 0.5f * cz;
+    if(!fixedbase)
+        base = bottom;
+    layerRange(bottom, bottom + (float) dz * cz, first, last);
+
+    for(int b = first; b <= last; b += slicebatch)
+    {
+        int e = std::min(b + slicebatch - 1, last);
+        vector<SliceLayer> layers(e - b + 1);
+
+        #pragma omp parallel for schedule(dynamic)
+        for(int l = 0; l <= e - b; l++)
+        {
+            float h = height(b + l);
+            int k = (int) floorf((h - bottom) / cz); // slice whose voxels span the plane
+
+            layers[l].z = h;
+            if(k >= 0 && k < dz)
+                sliceVoxelLayer(vox, k, layers[l]);
+        }
+        for(const SliceLayer &layer : layers)
+            if(!out.write(layer))
+                return false;
+    }
+    return true;
+}
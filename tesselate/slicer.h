@@ -0,0 +1,200 @@
+#ifndef _SLICER
+#define _SLICER
+/**
+ * @file
+ *
+ * Planar slicing of meshes and voxel volumes into closed contours per layer, for print preparation
+ */
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include "vecpnt.h"
+#include "voxels.h"
+
+const int slicebatch = 64;      ///< layers sliced in parallel before they are handed to the writer in order
+
+/**
+ * Closed outline on a slicing plane
+ */
+struct SliceContour
+{
+    std::vector<float> xy;      ///< x and y of each corner in turn, with the last joined back to the first
+    bool outer;                 ///< true for a boundary of material, wound counterclockwise seen from above,
+                                ///< false for a hole, wound clockwise
+};
+
+/**
+ * Contours of one layer
+ */
+struct SliceLayer
+{
+    float z;                                ///< height of the slicing plane
+    std::vector<SliceContour> contours;     ///< closed outlines cut by the plane, in no particular order
+};
+
+/**
+ * Receives the layers of a slice as they are produced, so that a whole build never needs every contour in memory
+ */
+class SliceWriter
+{
+public:
+    virtual ~SliceWriter(){}
+
+    /**
+     * Accept the next layer, which comes in order of increasing height
+     * @param layer     contours of the layer
+     * @retval true if the layer was accepted,
+     * @retval false to stop slicing
+     */
+    virtual bool write(const SliceLayer &layer) = 0;
+};
+
+/**
+ * Writes layers as an ASCII Common Layer Interface (CLI) file, the layer format read by most powder bed and
+ * stereolithography printers, with one closed polyline per contour and coordinates in the units of the input.
+ */
+class CLISliceWriter : public SliceWriter
+{
+private:
+    FILE * fp;                  ///< file being written, or NULL when closed
+    std::string name;           ///< name of the file, for messages
+    int numlayers;              ///< layers written so far
+    int numcontours;            ///< contours written so far, which also numbers each polyline
+    bool ok;                    ///< no write has failed since open
+
+public:
+
+    /// Default constructor, with no file open
+    CLISliceWriter(){ fp = NULL; numlayers = numcontours = 0; ok = false; }
+
+    /// Destructor, which completes any file still open
+    ~CLISliceWriter(){ close(); }
+
+    CLISliceWriter(const CLISliceWriter &) = delete;
+    CLISliceWriter & operator=(const CLISliceWriter &) = delete;
+
+    /**
+     * Start a CLI file with its header, closing any file already open
+     * @param filename  name of the file
+     * @retval true if the file was opened,
+     * @retval false otherwise
+     */
+    bool open(const std::string &filename);
+
+    /// Test whether a file is open
+    bool isOpen(){ return fp != NULL; }
+
+    /**
+     * Append a layer, as for SliceWriter::write
+     * @retval true if the layer was written,
+     * @retval false if no file is open or a write failed
+     */
+    bool write(const SliceLayer &layer) override;
+
+    /// Number of layers written since open
+    int getNumLayers(){ return numlayers; }
+
+    /// Number of contours written since open
+    int getNumContours(){ return numcontours; }
+
+    /**
+     * End the geometry section and close the file
+     * @retval true if the whole file was written,
+     * @retval false if a write failed or no file was open
+     */
+    bool close();
+};
+
+/**
+ * Cuts meshes or voxel volumes into layers of constant thickness, each sliced at its mid-height into closed
+ * contours. Layers are sliced slicebatch at a time in parallel and then handed to a SliceWriter in order.
+ *
+ * Meshes are swept upwards through their triangles, sorted by lowest height, so that each batch only considers
+ * the triangles spanning it. Each triangle crossing a plane gives a segment between the two crossing edges, which
+ * are hashed by their vertex indices, so segments join exactly without any tolerance and contours close wherever
+ * the mesh is closed. Segments are directed by the triangle normal, so that outer boundaries run counterclockwise.
+ *
+ * Voxel volumes are sliced through the voxels whose centres lie nearest each plane, taking the outline of the
+ * occupied voxels along their cell faces, which is found with word operations on the packed rows. Diagonally
+ * touching voxels are treated as separate, so contours never cross.
+ */
+class Slicer
+{
+private:
+    float thickness;            ///< distance between layers
+    float base;                 ///< height of the bottom of layer 0
+    bool fixedbase;             ///< base was set, rather than taken from the bottom of each input
+    int openchains;             ///< chains of mesh segments that failed to close in the last slice
+
+    /// Height of the slicing plane of a layer, at its middle
+    float height(int layer){ return base + ((float) layer + 0.5f) * thickness; }
+
+    /**
+     * Find the layers whose planes pass within a range of heights
+     * @param zmin, zmax    range of heights
+     * @param[out] first, last  inclusive range of layers, empty if first > last
+     */
+    void layerRange(float zmin, float zmax, int &first, int &last);
+
+    /**
+     * Join directed segments, end to start, into closed contours
+     * @param from, to      keys identifying the start and end of each segment
+     * @param pts           x and y of the start and end of each segment, 4 floats per segment
+     * @param[out] layer    receives the closed contours
+     * @returns number of chains that did not close
+     */
+    static int chainSegments(const std::vector<int64_t> &from, const std::vector<int64_t> &to, const std::vector<float> &pts,
+                             SliceLayer &layer);
+
+    /**
+     * Cut the outline of occupied voxels in one z slice of a volume
+     * @param vox       voxel volume
+     * @param k         slice along z, within the volume
+     * @param[out] layer receives the closed contours
+     */
+    static void sliceVoxelLayer(VoxelVolume * vox, int k, SliceLayer &layer);
+
+public:
+
+    /// Default constructor, with layers one unit thick starting at the bottom of each input
+    Slicer(){ thickness = 1.0f; base = 0.0f; fixedbase = false; openchains = 0; }
+
+    /**
+     * Set the thickness of each layer
+     * @param layer     distance between slicing planes, which must be positive
+     */
+    void setThickness(float layer){ thickness = layer; }
+
+    /**
+     * Set the height of the bottom of layer 0, so that the layers of separate parts line up
+     * @param z     height of the bottom of the first layer
+     */
+    void setBase(float z){ base = z; fixedbase = true; }
+
+    /**
+     * Slice a triangle mesh, which should be closed for every contour to close
+     * @param points    vertices
+     * @param faces     first vertex index of the first triangle, with the three indices of a triangle contiguous
+     * @param numtris   number of triangles
+     * @param stride    distance in bytes between the first indices of consecutive triangles
+     * @param out       receives each layer from the lowest cut to the highest
+     * @retval true if every layer was accepted by @a out,
+     * @retval false if the thickness is not positive or @a out refused a layer
+     */
+    bool slice(const cgp::Point * points, const int * faces, int numtris, size_t stride, SliceWriter &out);
+
+    /**
+     * Slice a voxel volume, as the outline of its occupied voxels. Planes outside the volume give empty layers.
+     * @param vox       voxel volume, left unchanged
+     * @param out       receives each layer from the bottom of the volume to the top
+     * @retval true if every layer was accepted by @a out,
+     * @retval false if the thickness is not positive or @a out refused a layer
+     */
+    bool slice(VoxelVolume * vox, SliceWriter &out);
+
+    /// Number of chains of segments that did not close in the last mesh slice, from holes or non-manifold edges
+    int getOpenChains(){ return openchains; }
+};
+
+#endif
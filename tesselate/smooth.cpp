@@ -0,0 +1,74 @@
+//
+// MeshSmoother
+//
+
+#include "smooth.h"
+
+void MeshSmoother::step(const MeshTopology &topo, float rate)
+{
+    const float * sx = src[0].data(), * sy = src[1].data(), * sz = src[2].data();
+    float * dx = dst[0].data(), * dy = dst[1].data(), * dz = dst[2].data();
+    int numverts = topo.getNumVerts();
+
+    #pragma omp parallel for schedule(static, smoothchunksize)
+    for(int v = 0; v < numverts; v++)
+    {
+        float ax = 0.0f, ay = 0.0f, az = 0.0f, w;
+        int n = topo.numNeighbours(v);
+        const int * nbr = topo.nbrBegin(v);
+
+        if(n == 0)
+        {
+            dx[v] = sx[v]; dy[v] = sy[v]; dz[v] = sz[v];
+            continue;
+        }
+        for(int a = 0; a < n; a++)
+        {
+            ax += sx[nbr[a]];
+            ay += sy[nbr[a]];
+            az += sz[nbr[a]];
+        }
+
+        // x + rate * (average - x)
+        w = 1.0f / (float) n;
+        dx[v] = sx[v] + rate * (ax * w - sx[v]);
+        dy[v] = sy[v] + rate * (ay * w - sy[v]);
+        dz[v] = sz[v] + rate * (az * w - sz[v]);
+    }
+    for(int d = 0; d < 3; d++)
+        src[d].swap(dst[d]);
+}
+
+void MeshSmoother::smooth(const MeshTopology &topo, std::vector<cgp::Point> &verts, SmoothMode mode, int iter, float rate,
+                          float passband)
+{
+    int numverts = (int) verts.size(), i;
+    float mu = 0.0f;
+
+    if(numverts != topo.getNumVerts() || iter <= 0)
+        return;
+    if(mode == SmoothMode::TAUBIN)
+        mu = 1.0f / (passband - 1.0f / rate); // negative, and slightly larger in magnitude than lambda
+
+    for(int d = 0; d < 3; d++)
+    {
+        src[d].resize(numverts);
+        dst[d].resize(numverts);
+    }
+    #pragma omp parallel for schedule(static, smoothchunksize)
+    for(int v = 0; v < numverts; v++)
+    {
+        src[0][v] = verts[v].x; src[1][v] = verts[v].y; src[2][v] = verts[v].z;
+    }
+
+    for(i = 0; i < iter; i++)
+    {
+        step(topo, rate);
+        if(mode == SmoothMode::TAUBIN)
+            step(topo, mu);
+    }
+
+    #pragma omp parallel for schedule(static, smoothchunksize)
+    for(int v = 0; v < numverts; v++)
+        verts[v] = cgp::Point(src[0][v], src[1][v], src[2][v]);
+}
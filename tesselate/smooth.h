@@ -0,0 +1,57 @@
+/**
+ * @file
+ *
+ * Umbrella operator smoothing of mesh vertices over a shared topology, with Laplacian and Taubin variants.
+ */
+
+#ifndef _SMOOTH
+#define _SMOOTH
+
+#include <vector>
+#include "vecpnt.h"
+#include "topology.h"
+
+const int smoothchunksize = 4096;       ///< vertices per parallel chunk in a smoothing step
+const float taubinpassband = 0.1f;      ///< default Taubin pass-band frequency, which sets the inflating factor from the shrinking one
+
+/// Smoothing filter
+enum class SmoothMode
+{
+    LAPLACIAN,  ///< repeated umbrella steps, which shrink the mesh as they smooth it
+    TAUBIN      ///< alternating shrinking and inflating steps, which smooth without significant loss of volume
+};
+
+/**
+ * Moves each vertex towards the average of its one-ring neighbours. Positions are held as separate x, y and z float
+ * arrays in two buffers, so every step reads one buffer and writes the other, vertices update independently in
+ * parallel, and neighbour gathers touch only the packed coordinates. Working storage is kept between calls.
+ */
+class MeshSmoother
+{
+private:
+    std::vector<float> src[3];  ///< coordinates read by the current step
+    std::vector<float> dst[3];  ///< coordinates written by the current step
+
+    /**
+     * Apply one umbrella step from src to dst and swap the buffers
+     * @param topo  connectivity supplying the neighbours of each vertex
+     * @param rate  proportion of the full step applied, negative to inflate
+     */
+    void step(const MeshTopology &topo, float rate);
+
+public:
+
+    /**
+     * Smooth vertex positions in place
+     * @param topo      connectivity over the vertices
+     * @param verts     vertex positions, one per topology vertex
+     * @param mode      smoothing filter
+     * @param iter      number of iterations, each a single step for LAPLACIAN and a shrink then inflate pair for TAUBIN
+     * @param rate      proportion of the full step, the shrinking factor lambda for TAUBIN, with 0 < rate <= 1
+     * @param passband  Taubin pass-band frequency kpb, with the inflating factor mu satisfying 1/lambda + 1/mu = kpb
+     */
+    void smooth(const MeshTopology &topo, std::vector<cgp::Point> &verts, SmoothMode mode, int iter, float rate,
+                float passband = taubinpassband);
+};
+
+#endif
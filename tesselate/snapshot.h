@@ -0,0 +1,140 @@
+/**
+ * @file
+ *
+ * Immutable copies of large arrays, such as voxel bricks and mesh vertices, kept for undoing pipeline stages.
+ */
+
+#ifndef _SNAPSHOT
+#define _SNAPSHOT
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+const size_t snapshotchunkbytes = 1 << 16;  ///< size of the chunks that snapshot arrays are shared in
+
+/**
+ * Read-only copy of an array, held in reference-counted chunks. A new snapshot taken with an earlier one as its
+ * predecessor shares every chunk whose contents are unchanged rather than copying it, so a history of stages that
+ * each alter part of the data, or only some of the arrays, holds the unaltered parts once. Chunks are compared and
+ * copied bytewise, so T must be plain data without padding.
+ */
+template <typename T> class SnapshotArray
+{
+private:
+    typedef std::shared_ptr<const std::vector<T>> Chunk;
+
+    std::vector<Chunk> chunks;  ///< contents in order, NULL for a chunk that was not captured
+    size_t count;               ///< number of elements
+    size_t chunklen;            ///< elements per chunk, with the last chunk possibly shorter
+
+    /// Test whether chunk @a c of another snapshot holds exactly @a len elements equal to @a data
+    static bool matches(const SnapshotArray * other, size_t c, const T * data, size_t len)
+    {
+        return other != NULL && c < other->chunks.size() && other->chunks[c] && other->chunks[c]->size() == len
+               && memcmp(other->chunks[c]->data(), data, len * sizeof(T)) == 0;
+    }
+
+public:
+
+    SnapshotArray() : count(0), chunklen(std::max(snapshotchunkbytes / sizeof(T), (size_t) 1)) {}
+
+    /**
+     * Start a snapshot of @a n elements with no chunks captured
+     * @param n     number of elements
+     * @param len   elements per chunk, at least 1
+     */
+    void reset(size_t n, size_t len)
+    {
+        count = n;
+        chunklen = std::max(len, (size_t) 1);
+        chunks.assign((count + chunklen - 1) / chunklen, Chunk());
+    }
+
+    /**
+     * Capture one chunk, sharing the same chunk of a candidate snapshot if its contents are identical
+     * @param c             chunk index
+     * @param data          elements of the chunk, as many as the chunk holds
+     * @param prev, alt     snapshots to share with, in order of preference, or NULL
+     * @returns bytes newly allocated for the chunk, 0 if it was shared
+     */
+    size_t setChunk(size_t c, const T * data, const SnapshotArray * prev, const SnapshotArray * alt = NULL)
+    {
+        size_t len = chunkSize(c);
+
+        if(matches(prev, c, data, len))
+            chunks[c] = prev->chunks[c];
+        else if(matches(alt, c, data, len))
+            chunks[c] = alt->chunks[c];
+        else
+        {
+            chunks[c] = std::make_shared<const std::vector<T>>(data, data + len);
+            return len * sizeof(T);
+        }
+        return 0;
+    }
+
+    /**
+     * Capture a whole array in chunks of snapshotchunkbytes
+     * @param data          elements to copy
+     * @param n             number of elements
+     * @param prev, alt     snapshots to share chunks with, in order of preference, or NULL
+     * @returns bytes newly allocated, as opposed to shared with @a prev or @a alt
+     */
+    size_t capture(const T * data, size_t n, const SnapshotArray * prev, const SnapshotArray * alt = NULL)
+    {
+        size_t bytes = 0;
+
+        reset(n, std::max(snapshotchunkbytes / sizeof(T), (size_t) 1));
+        for(size_t c = 0; c < chunks.size(); c++)
+            bytes += setChunk(c, data + c * chunklen, prev, alt);
+        return bytes;
+    }
+
+    /// Capture the contents of a vector, as for capture
+    size_t capture(const std::vector<T> &data, const SnapshotArray * prev, const SnapshotArray * alt = NULL)
+    {
+        return capture(data.data(), data.size(), prev, alt);
+    }
+
+    /**
+     * Elements of one chunk
+     * @param c     chunk index
+     * @returns the chunk, or NULL if it was not captured
+     */
+    const T * getChunk(size_t c) const { return chunks[c] ? chunks[c]->data() : NULL; }
+
+    /// Number of elements in chunk @a c
+    size_t chunkSize(size_t c) const { return std::min(chunklen, count - c * chunklen); }
+
+    /**
+     * Copy the whole array back
+     * @param[out] out  room for size() elements, with those of chunks not captured left as they are
+     */
+    void restore(T * out) const
+    {
+        for(size_t c = 0; c < chunks.size(); c++)
+            if(chunks[c])
+                memcpy((void *) (out + c * chunklen), chunks[c]->data(), chunkSize(c) * sizeof(T));
+    }
+
+    /// Copy the whole array back into a vector, which is resized to match
+    void restore(std::vector<T> &out) const
+    {
+        out.resize(count);
+        if(count > 0)
+            restore(&out[0]);
+    }
+
+    /// Number of elements
+    size_t size() const { return count; }
+
+    /// Number of chunks
+    size_t numChunks() const { return chunks.size(); }
+
+    /// Release this snapshot's references, freeing chunks no other snapshot shares
+    void clear(){ chunks.clear(); count = 0; }
+};
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * @file
+ *
+ * Binary STL files written a batch of triangles at a time
+ */
+
+#include "stlstream.h"
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+static stats::MemoryInit stlStreamMemory("STLStream");
+
+const int stlstreamchunk = 4096; ///< triangles encoded per parallel chunk
+
+STLStreamWriter::STLStreamWriter()
+    : memtally(stlStreamMemory)
+{
+    fp = NULL;
+    numt = 0;
+    ok = false;
+}
+
+bool STLStreamWriter::open(const std::string &filename)
+{
+    char header[stlheadersize + 4] = "File Generated by Tesselator. Binary STL"; // zero padded, with a zero count
+
+    close();
+    name = filename;
+    numt = 0;
+    fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL)
+    {
+        cerr << "Error STLStreamWriter::open: unable to open " << filename << endl;
+        return false;
+    }
+    ok = (fwrite(header, 1, sizeof(header), fp) == sizeof(header));
+    if(!ok)
+        cerr << "Error STLStreamWriter::open: failed writing " << filename << endl;
+
+    // whole records only, so that every buffer handed on ends on a triangle
+    gather.reserve(stlstreambytes / stlrecordsize * stlrecordsize);
+    flight.reserve(stlstreambytes / stlrecordsize * stlrecordsize);
+    memtally.set(gather.capacity() + flight.capacity());
+    return ok;
+}
+
+bool STLStreamWriter::drain()
+{
+    if(pending.valid() && !pending.get())
+    {
+        cerr << "Error STLStreamWriter::flush: failed writing " << name << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+bool STLStreamWriter::flush()
+{
+    if(gather.empty())
+        return ok;
+    if(!drain())
+        return false;
+    gather.swap(flight);
+    gather.clear();
+    pending = std::async(std::launch::async, [this](){ return fwrite(flight.data(), 1, flight.size(), fp) == flight.size(); });
+    return true;
+}
+
+bool STLStreamWriter::append(const std::vector<cgp::Point> &verts, const std::vector<int> &faces)
+{
+    size_t n = faces.size() / 3, done = 0, room, count, start;
+    vector<float> nx, ny, nz;
+
+    if(fp == NULL || !ok)
+        return false;
+
+    while(done < n)
+    {
+        room = (gather.capacity() - gather.size()) / stlrecordsize;
+        if(room == 0)
+        {
+            if(!flush())
+                return false;
+            continue;
+        }
+
+        // normals for as many triangles as fit, then records filled in parallel
+        count = min(room, n - done);
+        start = gather.size();
+        nx.resize(count); ny.resize(count); nz.resize(count);
+        cgp::faceNormals(verts.data(), faces.data() + 3 * done, 3, count, nx.data(), ny.data(), nz.data());
+        gather.resize(start + count * stlrecordsize);
+
+        #pragma omp parallel for schedule(static, stlstreamchunk)
+        for(int t = 0; t < (int) count; t++)
+        {
+            float rec[12];
+            const int * tri = &faces[3 * (done + t)];
+            char * dst = &gather[start + (size_t) t * stlrecordsize];
+
+            // normal, then triangle vertices
+            rec[0] = nx[t]; rec[1] = ny[t]; rec[2] = nz[t];
+            for(int p = 0; p < 3; p++)
+            {
+                rec[3+3*p] = verts[tri[p]].x;
+                rec[4+3*p] = verts[tri[p]].y;
+                rec[5+3*p] = verts[tri[p]].z;
+            }
+            memcpy(dst, rec, sizeof(rec));
+            dst[48] = dst[49] = 0; // attribute byte count - null
+        }
+        done += count;
+        numt += count;
+    }
+    return true;
+}
+
+bool STLStreamWriter::close()
+{
+    uint32_t count;
+
+    if(fp == NULL)
+        return false;
+    flush();
+    drain();
+    if(numt > UINT32_MAX)
+    {
+        cerr << "Error STLStreamWriter::close: " << numt << " triangles are too many for binary STL in " << name << endl;
+        ok = false;
+    }
+    count = (uint32_t) numt;
+    if(ok)
+        ok = (fseek(fp, stlheadersize, SEEK_SET) == 0 && fwrite(&count, sizeof(uint32_t), 1, fp) == 1);
+    if(fclose(fp) != 0)
+        ok = false;
+    fp = NULL;
+    if(!ok)
+        cerr << "Error STLStreamWriter::close: failed writing " << name << endl;
+
+    // the buffers are only needed while a file is open
+    vector<char>().swap(gather);
+    vector<char>().swap(flight);
+    memtally.set(0);
+    return ok;
+}
@@ -0,0 +1,96 @@
+#ifndef _STLSTREAM
+#define _STLSTREAM
+/**
+ * @file
+ *
+ * Binary STL files written a batch of triangles at a time
+ */
+
+#include <vector>
+#include <string>
+#include <future>
+#include <stdio.h>
+#include <stdint.h>
+#include "vecpnt.h"
+#include "common/memory.h"
+
+const int stlheadersize = 80;       ///< bytes of skippable header at the start of a binary STL file, before the triangle count
+const int stlrecordsize = 50;       ///< bytes per triangle in a binary STL file: normal, 3 vertices and an attribute count
+const size_t stlstreambytes = 8 << 20; ///< bytes of records gathered before they are handed to the writer thread
+
+/**
+ * Writes a binary STL file from batches of triangles as they are produced, for meshes that are never held whole,
+ * such as the slabs of Scene::extractSlabs or the layers of VoxelMesher. Records are encoded in parallel into a large
+ * buffer, and each full buffer is written by a background thread while the next is filled, so producers rarely wait
+ * on the disk. The triangle count is left as zero in the header until close, which fills it in.
+ */
+class STLStreamWriter
+{
+private:
+    FILE * fp;                      ///< file being written, or NULL when closed
+    std::string name;               ///< name of the file, for messages
+    uint64_t numt;                  ///< triangles appended so far
+    std::vector<char> gather;       ///< records being encoded
+    std::vector<char> flight;       ///< records being written by the writer thread
+    std::future<bool> pending;      ///< outcome of the write in flight, if any
+    bool ok;                        ///< no write has failed since open
+    stats::MemoryTally memtally;    ///< bytes of the two buffers
+
+    /**
+     * Wait for the write in flight, if any, to finish
+     * @retval true if no write has failed,
+     * @retval false otherwise
+     */
+    bool drain();
+
+    /**
+     * Hand the gathered records to the writer thread, once the previous write has finished
+     * @retval true if no write has failed,
+     * @retval false otherwise
+     */
+    bool flush();
+
+public:
+
+    /// Default constructor, with no file open
+    STLStreamWriter();
+
+    /// Destructor, which completes any file still open
+    ~STLStreamWriter(){ close(); }
+
+    STLStreamWriter(const STLStreamWriter &) = delete;
+    STLStreamWriter & operator=(const STLStreamWriter &) = delete;
+
+    /**
+     * Start a binary STL file with its header and a placeholder triangle count, closing any file already open
+     * @param filename  name of the file
+     * @retval true if the file was opened,
+     * @retval false otherwise
+     */
+    bool open(const std::string &filename);
+
+    /// Test whether a file is open
+    bool isOpen(){ return fp != NULL; }
+
+    /**
+     * Append a batch of triangles, with unit normals computed as for Mesh::writeSTL. Batches are independent, so
+     * their vertex indices need not continue from earlier batches.
+     * @param verts     vertex positions
+     * @param faces     flattened list of vertex indices, with each group of 3 indices representing a triangle
+     * @retval true if the triangles were accepted,
+     * @retval false if no file is open or an earlier write failed
+     */
+    bool append(const std::vector<cgp::Point> &verts, const std::vector<int> &faces);
+
+    /// Number of triangles appended since open
+    uint64_t getNumTriangles(){ return numt; }
+
+    /**
+     * Write out any remaining triangles, fill in the triangle count and close the file
+     * @retval true if the whole file was written,
+     * @retval false if a write failed, there are too many triangles for the count, or no file was open
+     */
+    bool close();
+};
+
+#endif
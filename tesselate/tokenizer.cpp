@@ -0,0 +1,171 @@
+//
+// TextTokenizer
+//
+
+#include "tokenizer.h"
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+const int tokmaxmantissa = 19;      ///< significant digits accumulated exactly, later digits only shift the exponent
+const int tokmaxexponent = 400;     ///< magnitude at which exponents are clamped, well beyond the float range
+
+/// Exactly representable powers of ten
+static const double tokpow10[] = {1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9, 1.0e10,
+                                  1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19, 1.0e20,
+                                  1.0e21, 1.0e22};
+
+void TextTokenizer::skipBlanks()
+{
+    while(pos < end && (* pos == ' ' || * pos == '\t' || * pos == '\r' || * pos == '\v' || * pos == '\f'))
+        pos++;
+}
+
+bool TextTokenizer::endOfLine()
+{
+    skipBlanks();
+    return pos >= end || * pos == '\n';
+}
+
+void TextTokenizer::nextLine()
+{
+    const char * nl = (const char *) memchr(pos, '\n', (size_t) (end - pos));
+
+    if(nl == NULL)
+        pos = end;
+    else
+    {
+        pos = nl + 1;
+        line++;
+    }
+}
+
+void TextTokenizer::skipSpace()
+{
+    while(pos < end && isSpace(* pos))
+    {
+        if(* pos == '\n')
+            line++;
+        pos++;
+    }
+}
+
+bool TextTokenizer::readWord(const char * &start, int &len)
+{
+    if(endOfLine())
+        return false;
+    start = pos;
+    skipWord();
+    len = (int) (pos - start);
+    return true;
+}
+
+bool TextTokenizer::matchWord(const char * keyword)
+{
+    size_t len = strlen(keyword);
+
+    skipSpace();
+    if((size_t) (end - pos) < len || strncmp(pos, keyword, len) != 0)
+        return false;
+    if(pos + len < end && !isSpace(pos[len])) // keyword is only a prefix of the word
+        return false;
+    pos += len;
+    return true;
+}
+
+bool TextTokenizer::readFloat(float &val)
+{
+    const char * p;
+    uint64_t mantissa = 0;
+    int exp10 = 0, sigdigits = 0, digits = 0;
+    bool neg = false;
+    double d;
+
+    skipBlanks();
+    p = pos;
+    if(p < end && (* p == '-' || * p == '+'))
+        neg = (* p++ == '-');
+
+    // integer and fractional digits, with leading zeros not counted as significant
+    for(; p < end && isDigit(* p); p++, digits++)
+    {
+        if(sigdigits < tokmaxmantissa)
+        {
+            mantissa = mantissa * 10 + (uint64_t) (* p - '0');
+            if(mantissa > 0)
+                sigdigits++;
+        }
+        else
+            exp10++;
+    }
+    if(p < end && * p == '.')
+    {
+        for(p++; p < end && isDigit(* p); p++, digits++)
+            if(sigdigits < tokmaxmantissa)
+            {
+                mantissa = mantissa * 10 + (uint64_t) (* p - '0');
+                if(mantissa > 0)
+                    sigdigits++;
+                exp10--;
+            }
+    }
+    if(digits == 0)
+        return false;
+
+    if(p < end && (* p == 'e' || * p == 'E'))
+    {
+        int e = 0, edigits = 0;
+        bool eneg = false;
+
+        p++;
+        if(p < end && (* p == '-' || * p == '+'))
+            eneg = (* p++ == '-');
+        for(; p < end && isDigit(* p); p++, edigits++)
+            if(e < tokmaxexponent)
+                e = e * 10 + (* p - '0');
+        if(edigits == 0)
+            return false;
+        exp10 += eneg ? -e : e;
+    }
+    if(p < end && !isSpace(* p))
+        return false;
+
+    // a single scaling by an exact power of ten covers nearly all mesh data
+    d = (double) mantissa;
+    if(exp10 >= 0 && exp10 <= 22)
+        d *= tokpow10[exp10];
+    else if(exp10 < 0 && exp10 >= -22)
+        d /= tokpow10[-exp10];
+    else if(mantissa != 0)
+        d *= pow(10.0, (double) exp10);
+    val = (float) (neg ? -d : d);
+    pos = p;
+    return true;
+}
+
+bool TextTokenizer::readInt(long &val)
+{
+    const char * p;
+    long v = 0;
+    bool neg = false;
+
+    skipBlanks();
+    p = pos;
+    if(p < end && (* p == '-' || * p == '+'))
+        neg = (* p++ == '-');
+    if(p >= end || !isDigit(* p))
+        return false;
+    for(; p < end && isDigit(* p); p++)
+        v = v * 10 + (long) (* p - '0');
+    if(p < end && !isSpace(* p) && * p != '/')
+        return false;
+    val = neg ? -v : v;
+    pos = p;
+    return true;
+}
+
+void TextTokenizer::skipWord()
+{
+    while(pos < end && !isSpace(* pos))
+        pos++;
+}
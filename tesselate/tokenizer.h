@@ -0,0 +1,99 @@
+/**
+ * @file
+ *
+ * Allocation-free tokenizer over an in-memory (typically memory mapped) text buffer, for parsing ASCII mesh formats.
+ */
+
+#ifndef _TOKENIZER
+#define _TOKENIZER
+
+#include <stddef.h>
+
+/**
+ * Reads whitespace separated words and numbers from a text buffer without copying it. Numbers are parsed
+ * directly from the buffer, independent of the locale, and a token is valid only if it ends at whitespace
+ * or the end of the buffer. Newlines are not skipped implicitly, so line based formats control their own layout.
+ */
+class TextTokenizer
+{
+private:
+    const char * pos;   ///< next unread character
+    const char * end;   ///< one past the last character of the buffer
+    int line;           ///< line number of pos, starting at 1
+
+    /// Advance past spaces, tabs and carriage returns, stopping at a newline
+    void skipBlanks();
+
+    /// Is c a whitespace character, including newlines?
+    static bool isSpace(char c){ return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f'; }
+
+    /// Is c a decimal digit?
+    static bool isDigit(char c){ return c >= '0' && c <= '9'; }
+
+public:
+
+    /**
+     * Constructor
+     * @param buffer    start of the text, which must outlive the tokenizer
+     * @param size      number of characters in the text
+     */
+    TextTokenizer(const char * buffer, size_t size){ pos = buffer; end = buffer + size; line = 1; }
+
+    /// Has every character been consumed?
+    bool atEnd() const { return pos >= end; }
+
+    /// Current line number, for error reporting
+    int getLine() const { return line; }
+
+    /**
+     * Test for the end of the current line
+     * @retval true if only blanks remain before the next newline or the end of the buffer,
+     * @retval false otherwise
+     */
+    bool endOfLine();
+
+    /// Skip the remainder of the current line, including its newline
+    void nextLine();
+
+    /// Skip any blank lines and leading whitespace, stopping at the first character of a token or at the end of the buffer
+    void skipSpace();
+
+    /**
+     * Read the next word on the current line
+     * @param[out] start    first character of the word
+     * @param[out] len      number of characters in the word
+     * @retval true if a word was found before the end of the line,
+     * @retval false otherwise
+     */
+    bool readWord(const char * &start, int &len);
+
+    /**
+     * Read the next word, which may be on a later line, and compare it against a keyword
+     * @param keyword   null terminated word to match
+     * @retval true if the next word matches, in which case it is consumed,
+     * @retval false otherwise, in which case nothing is consumed
+     */
+    bool matchWord(const char * keyword);
+
+    /**
+     * Read a floating point number in decimal or scientific notation from the current line
+     * @param[out] val  parsed value
+     * @retval true if a well formed number was read,
+     * @retval false otherwise, in which case nothing is consumed
+     */
+    bool readFloat(float &val);
+
+    /**
+     * Read a signed decimal integer from the current line. The integer may be followed by a '/', as in OBJ
+     * face corners, which is left unread.
+     * @param[out] val  parsed value
+     * @retval true if a well formed integer was read,
+     * @retval false otherwise, in which case nothing is consumed
+     */
+    bool readInt(long &val);
+
+    /// Skip the remaining characters of the current word
+    void skipWord();
+};
+
+#endif
@@ -0,0 +1,96 @@
+//
+// MeshTopology
+//
+
+#include "topology.h"
+#include <algorithm>
+
+void MeshTopology::clear()
+{
+    numverts = 0;
+    faces.clear();
+    cornerstart.clear();
+    corners.clear();
+    nbrstart.clear();
+    nbrs.clear();
+    twins.clear();
+}
+
+void MeshTopology::build(int nverts, const std::vector<int> &tfaces)
+{
+    std::vector<int> fill, gather, count;
+    int numcorners = (int) tfaces.size() - (int) tfaces.size() % 3;
+    int c, v;
+
+    numverts = nverts;
+    faces.assign(tfaces.begin(), tfaces.begin() + numcorners);
+
+    // counting sort of corners by vertex, which keeps each run in increasing corner order
+    cornerstart.assign(numverts+1, 0);
+    for(c = 0; c < numcorners; c++)
+        if(inRange(faces[c]))
+            cornerstart[faces[c]+1]++;
+    for(v = 0; v < numverts; v++)
+        cornerstart[v+1] += cornerstart[v];
+    corners.resize(cornerstart[numverts]);
+    fill.assign(cornerstart.begin(), cornerstart.end() - 1);
+    for(c = 0; c < numcorners; c++)
+        if(inRange(faces[c]))
+            corners[fill[faces[c]]++] = c;
+
+    // each corner contributes the vertices after and before it in its triangle, which are then deduplicated
+    // the outgoing edges alone would be enough on a closed manifold, but boundary fans need both
+    gather.resize(2 * corners.size());
+    count.assign(numverts+1, 0);
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for(v = 0; v < numverts; v++)
+    {
+        int * dst = gather.data() + 2 * cornerstart[v], n = 0;
+
+        for(int i = cornerstart[v]; i < cornerstart[v+1]; i++)
+        {
+            int a = dest(corners[i]), b = origin(prev(corners[i]));
+            if(inRange(a) && a != v) // degenerate triangles would otherwise make a vertex its own neighbour
+                dst[n++] = a;
+            if(inRange(b) && b != v)
+                dst[n++] = b;
+        }
+        std::sort(dst, dst + n);
+        count[v+1] = (int) (std::unique(dst, dst + n) - dst);
+    }
+    nbrstart.resize(numverts+1);
+    nbrstart[0] = 0;
+    for(v = 0; v < numverts; v++)
+        nbrstart[v+1] = nbrstart[v] + count[v+1];
+    nbrs.resize(nbrstart[numverts]);
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for(v = 0; v < numverts; v++)
+        std::copy(gather.begin() + 2 * cornerstart[v], gather.begin() + 2 * cornerstart[v] + count[v+1], nbrs.begin() + nbrstart[v]);
+
+    // the twin of a->b is the only half-edge b->a among the corners of b, provided a->b is itself unique
+    twins.resize(numcorners);
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for(c = 0; c < numcorners; c++)
+    {
+        int a = origin(c), b = dest(c), partner = topoboundary, matches = 0;
+        bool dup = false;
+
+        if(!inRange(a) || !inRange(b) || a == b)
+        {
+            twins[c] = topononmanifold;
+            continue;
+        }
+        for(const int * it = cornerBegin(b); it != cornerEnd(b); it++)
+            if(dest(* it) == a)
+            {
+                partner = * it;
+                matches++;
+            }
+        for(const int * it = cornerBegin(a); !dup && it != cornerEnd(a); it++)
+            dup = (* it != c && dest(* it) == b);
+        if(dup || matches > 1)
+            twins[c] = topononmanifold;
+        else
+            twins[c] = partner;
+    }
+}
@@ -0,0 +1,89 @@
+/**
+ * @file
+ *
+ * Compact mesh connectivity in compressed sparse row form, with a half-edge twin table, shared by smoothing,
+ * normal derivation and validity checks.
+ */
+
+#ifndef _TOPOLOGY
+#define _TOPOLOGY
+
+#include <vector>
+
+const int topoboundary = -1;        ///< twin of a half-edge with no oppositely directed partner
+const int topononmanifold = -2;     ///< twin of a half-edge that is duplicated, shared by more than two triangles or out of range
+
+/**
+ * Connectivity of an indexed triangle mesh, built once per change to the triangles and then queried without
+ * allocation. Corner c = 3t+p is the p-th vertex of triangle t, and also names the half-edge running from that
+ * vertex to the next corner of the triangle. Per vertex lists of incident corners and of unique neighbouring
+ * vertices are stored contiguously, so that one-ring traversals read memory sequentially. Corners that index
+ * vertices out of range are left out of the vertex lists and their half-edges have no twin.
+ */
+class MeshTopology
+{
+private:
+    int numverts;                   ///< number of vertices the topology was built for
+    std::vector<int> faces;         ///< vertex index of each corner, 3 per triangle
+    std::vector<int> cornerstart;   ///< start of each vertex's run in corners, followed by the total
+    std::vector<int> corners;       ///< incident corners grouped by vertex, in increasing corner order
+    std::vector<int> nbrstart;      ///< start of each vertex's run in nbrs, followed by the total
+    std::vector<int> nbrs;          ///< unique neighbouring vertices grouped by vertex, in increasing order
+    std::vector<int> twins;         ///< oppositely directed half-edge for each corner, topoboundary or topononmanifold
+
+    /// Is v a vertex index within range?
+    bool inRange(int v) const { return v >= 0 && v < numverts; }
+
+public:
+
+    /// Default constructor
+    MeshTopology(){ numverts = 0; }
+
+    /// Release all connectivity
+    void clear();
+
+    /**
+     * Derive connectivity from a triangle list
+     * @param nverts    number of vertices in the mesh
+     * @param tfaces    vertex indices, 3 per triangle, with consistent winding
+     */
+    void build(int nverts, const std::vector<int> &tfaces);
+
+    /// Number of vertices
+    int getNumVerts() const { return numverts; }
+
+    /// Number of triangles
+    int getNumTris() const { return (int) faces.size() / 3; }
+
+    /// Vertex at the start of the half-edge of corner c
+    int origin(int c) const { return faces[c]; }
+
+    /// Vertex at the end of the half-edge of corner c
+    int dest(int c) const { return faces[c - c % 3 + (c % 3 + 1) % 3]; }
+
+    /// Corner preceding c around its triangle, whose half-edge ends at origin(c)
+    int prev(int c) const { return c - c % 3 + (c % 3 + 2) % 3; }
+
+    /// Oppositely directed half-edge of corner c, or topoboundary or topononmanifold
+    int twin(int c) const { return twins[c]; }
+
+    /// Number of triangle corners incident on vertex v
+    int degree(int v) const { return cornerstart[v+1] - cornerstart[v]; }
+
+    /// First incident corner of vertex v
+    const int * cornerBegin(int v) const { return corners.data() + cornerstart[v]; }
+
+    /// One past the last incident corner of vertex v
+    const int * cornerEnd(int v) const { return corners.data() + cornerstart[v+1]; }
+
+    /// Number of unique vertices sharing an edge with vertex v
+    int numNeighbours(int v) const { return nbrstart[v+1] - nbrstart[v]; }
+
+    /// First neighbour of vertex v
+    const int * nbrBegin(int v) const { return nbrs.data() + nbrstart[v]; }
+
+    /// One past the last neighbour of vertex v
+    const int * nbrEnd(int v) const { return nbrs.data() + nbrstart[v+1]; }
+};
+
+#endif
@@ -0,0 +1,128 @@
+//
+// VertexCacheOptimiser
+//
+
+#include "vcache.h"
+#include <algorithm>
+
+int VertexCacheOptimiser::nextCandidate(int stamp, int cachesize)
+{
+    int best = -1, bestpriority = -1, priority;
+
+    for(int v : candidates)
+        if(live[v] > 0)
+        {
+            // a vertex that would drop out of the cache before its remaining triangles are done is no better than a fresh one
+            priority = 0;
+            if(stamp - cachetime[v] + 2 * live[v] <= cachesize)
+                priority = stamp - cachetime[v];
+            if(priority > bestpriority)
+            {
+                bestpriority = priority;
+                best = v;
+            }
+        }
+    return best;
+}
+
+int VertexCacheOptimiser::skipDeadEnd(int &cursor)
+{
+    while(!deadend.empty())
+    {
+        int d = deadend.back();
+
+        deadend.pop_back();
+        if(live[d] > 0)
+            return d;
+    }
+    for(; cursor < (int) live.size(); cursor++)
+        if(live[cursor] > 0)
+            return cursor;
+    return -1;
+}
+
+void VertexCacheOptimiser::optimise(const MeshTopology &topo, int cachesize, std::vector<int> &triorder, std::vector<int> &remap)
+{
+    int numverts = topo.getNumVerts(), numtris = topo.getNumTris(), fan = 0, stamp = cachesize + 1, cursor = 0, next;
+
+    triorder.clear();
+    triorder.reserve(numtris);
+    live.resize(numverts);
+    for(int v = 0; v < numverts; v++)
+        live[v] = topo.degree(v);
+    cachetime.assign(numverts, 0);
+    emitted.assign(numtris, 0);
+    deadend.clear();
+
+    while(numverts > 0 && fan >= 0)
+    {
+        candidates.clear();
+        for(const int * it = topo.cornerBegin(fan); it != topo.cornerEnd(fan); it++)
+        {
+            int t = (* it) / 3;
+
+            if(emitted[t])
+                continue;
+            for(int p = 0; p < 3; p++)
+            {
+                int v = topo.origin(3*t+p);
+
+                if(v < 0 || v >= numverts) // left out of the topology's vertex lists
+                    continue;
+                deadend.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if(stamp - cachetime[v] > cachesize) // a miss, which brings the vertex into the cache
+                    cachetime[v] = stamp++;
+            }
+            emitted[t] = 1;
+            triorder.push_back(t);
+        }
+        next = nextCandidate(stamp, cachesize);
+        fan = (next >= 0) ? next : skipDeadEnd(cursor);
+    }
+
+    // triangles with no vertex in range are never reached by fanning, so keep them at the end
+    for(int t = 0; t < numtris; t++)
+        if(!emitted[t])
+            triorder.push_back(t);
+
+    // number vertices by first use in the new order, then any unused ones in their original order
+    remap.assign(numverts, -1);
+    next = 0;
+    for(int t : triorder)
+        for(int p = 0; p < 3; p++)
+        {
+            int v = topo.origin(3*t+p);
+
+            if(v >= 0 && v < numverts && remap[v] < 0)
+                remap[v] = next++;
+        }
+    for(int v = 0; v < numverts; v++)
+        if(remap[v] < 0)
+            remap[v] = next++;
+}
+
+float VertexCacheOptimiser::missRatio(const std::vector<int> &faces, int numverts, int cachesize)
+{
+    std::vector<int> entered(std::max(numverts, 0), -1);
+    int numtris = (int) faces.size() / 3, misses = 0;
+
+    if(numtris == 0)
+        return 0.0f;
+
+    // a vertex is still cached if fewer than cachesize misses have happened since it last entered
+    for(int c = 0; c < 3 * numtris; c++)
+    {
+        int v = faces[c];
+
+        if(v < 0 || v >= numverts)
+            continue;
+        if(entered[v] < 0 || misses - entered[v] >= cachesize)
+        {
+            entered[v] = misses;
+            misses++;
+        }
+    }
+    return (float) misses / (float) numtris;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file
+ *
+ * Reordering of indexed triangle meshes for the GPU post-transform vertex cache and for sequential vertex fetch.
+ */
+
+#ifndef _VCACHE
+#define _VCACHE
+
+#include <vector>
+#include "topology.h"
+
+const int vcachesize = 16;  ///< post-transform cache entries assumed when ordering triangles
+
+/**
+ * Orders triangles with the Tipsify algorithm (Sander, Nehab and Barczak), which fans around one vertex at a time,
+ * moving next to the most recently used vertex whose remaining triangles are likely to still find it in the cache,
+ * and backtracking through recently touched vertices at dead ends. Vertices are then renumbered in the order the
+ * reordered triangles first use them, so that vertex fetches walk memory forwards. Runs in linear time on the
+ * shared topology. Working storage is kept between calls.
+ */
+class VertexCacheOptimiser
+{
+private:
+    std::vector<int> live;          ///< triangles not yet emitted around each vertex
+    std::vector<int> cachetime;     ///< timestamp at which each vertex last entered the simulated cache
+    std::vector<char> emitted;      ///< has each triangle been placed in the output order?
+    std::vector<int> deadend;       ///< stack of recently used vertices, for restarting after a dead end
+    std::vector<int> candidates;    ///< vertices of the triangles emitted around the current fanning vertex
+
+    /**
+     * Pick the next fanning vertex among the candidates, preferring the one that has been in the cache longest
+     * while still being expected to be there once its remaining triangles are emitted
+     * @param stamp     current cache timestamp
+     * @param cachesize cache entries assumed
+     * @returns candidate vertex, or -1 if none has triangles left
+     */
+    int nextCandidate(int stamp, int cachesize);
+
+    /**
+     * Find a vertex with triangles left after a dead end, trying the dead-end stack before scanning forwards
+     * @param[in,out] cursor    position of the forward scan over the vertices
+     * @returns vertex, or -1 once every triangle has been emitted
+     */
+    int skipDeadEnd(int &cursor);
+
+public:
+
+    /**
+     * Derive cache friendly triangle and vertex orders
+     * @param topo          connectivity of the mesh, which also supplies its triangles
+     * @param cachesize     cache entries assumed
+     * @param[out] triorder original index of the triangle at each position of the new order
+     * @param[out] remap    new index of each original vertex, with vertices that no triangle uses placed last
+     */
+    void optimise(const MeshTopology &topo, int cachesize, std::vector<int> &triorder, std::vector<int> &remap);
+
+    /**
+     * Average number of vertices transformed per triangle with a first in first out cache of the given size,
+     * which is 3 with no reuse and approaches 0.5 for large regular meshes
+     * @param faces     vertex indices, 3 per triangle
+     * @param numverts  number of vertices indexed
+     * @param cachesize cache entries
+     * @returns average cache miss ratio
+     */
+    static float missRatio(const std::vector<int> &faces, int numverts, int cachesize);
+};
+
+#endif
@@ -0,0 +1,353 @@
+//
+// OpenVDB interchange for VoxelVolume and DistanceField
+//
+
+#include "voxels.h"
+#include "distfield.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+#include "common/log.h"
+
+#ifdef TESS_OPENVDB
+#include <openvdb/openvdb.h>
+#include <openvdb/io/File.h>
+#include <openvdb/tools/Prune.h>
+#include <openvdb/tools/SignedFloodFill.h>
+#endif
+
+using namespace std;
+
+const unsigned char vdbmagic[4] = {0x20, 0x42, 0x44, 0x56};   ///< first bytes of an OpenVDB file, its 64-bit magic number in little-endian order
+const char vdbvoxelgrid[] = "occupancy";    ///< name given to written occupancy grids
+const char vdbdistancegrid[] = "surface";   ///< name given to written level set grids
+const int vdbleafdim = 8;                   ///< voxels along each side of an OpenVDB leaf node
+
+static_assert(voxbrickrows == vdbleafdim && voxwordbits % vdbleafdim == 0, "each sparse brick must cover whole leaf nodes");
+
+bool VoxelVolume::isVDBFile(std::string filename)
+{
+    FILE * fp;
+    unsigned char magic[4];
+    bool found = false;
+
+    fp = fopen(filename.c_str(), "rb");
+    if(fp != NULL)
+    {
+        found = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, vdbmagic, 4) == 0);
+        fclose(fp);
+    }
+    return found;
+}
+
+#ifdef TESS_OPENVDB
+
+/// Round down to a multiple of @a align, towards negative infinity
+static int alignDown(int val, int align)
+{
+    return (val >= 0) ? val / align * align : -((-val + align - 1) / align) * align;
+}
+
+/**
+ * Transform taking grid index (x, y, z) to the centre of voxel (x, y, z) of a volume
+ * @param origin    centre of voxel (0, 0, 0)
+ * @param diagonal  offset from the first to the last voxel centre
+ * @param dim       number of voxels along each axis
+ */
+static openvdb::math::Transform::Ptr vdbTransform(cgp::Point origin, cgp::Vector diagonal, const int * dim)
+{
+    const float extent[3] = {diagonal.i, diagonal.j, diagonal.k};
+    openvdb::Vec3d step;
+    openvdb::math::Transform::Ptr xform = openvdb::math::Transform::createLinearTransform(1.0);
+
+    for(int a = 0; a < 3; a++) // a single layer has no spacing, so it is given unit spacing rather than a singular map
+        step[a] = (dim[a] > 1 && extent[a] > 0.0f) ? (double) extent[a] / (double) (dim[a] - 1) : 1.0;
+    xform->preScale(step);
+    xform->postTranslate(openvdb::Vec3d(origin.x, origin.y, origin.z));
+    return xform;
+}
+
+/**
+ * Place the active voxels of a grid in a volume frame, with an empty margin of at least one voxel on every side
+ * @param grid          grid being read
+ * @param align         alignment of the first voxel of the frame along each axis, in grid indices
+ * @param caller        method name for error messages
+ * @param[out] off      grid index of voxel (0, 0, 0)
+ * @param[out] dim      number of voxels along each axis
+ * @param[out] origin   centre of voxel (0, 0, 0)
+ * @param[out] diagonal offset from the first to the last voxel centre
+ * @retval true  if the grid is axis aligned and has active voxels,
+ * @retval false otherwise, with an error message
+ */
+static bool vdbFrame(const openvdb::GridBase &grid, const int * align, const char * caller, int * off, int * dim,
+                     cgp::Point &origin, cgp::Vector &diagonal)
+{
+    openvdb::CoordBBox box = grid.evalActiveVoxelBoundingBox();
+    const openvdb::math::Transform &xform = grid.transform();
+    openvdb::Vec3d corner, axis[3];
+    double step[3];
+
+    if(box.empty())
+    {
+        cerr << "Error " << caller << ": grid " << grid.getName() << " has no active voxels" << endl;
+        return false;
+    }
+    for(int a = 0; a < 3; a++)
+    {
+        off[a] = alignDown(box.min()[a] - 1, align[a]);
+        dim[a] = (box.max()[a] - off[a] + 2 + align[a] - 1) / align[a] * align[a];
+    }
+    corner = xform.indexToWorld(openvdb::Vec3d(off[0], off[1], off[2]));
+    for(int a = 0; a < 3; a++)
+    {
+        openvdb::Vec3d next(off[0], off[1], off[2]);
+        next[a] += 1.0;
+        axis[a] = xform.indexToWorld(next) - corner;
+        step[a] = axis[a][a];
+    }
+    for(int a = 0; a < 3; a++)
+        for(int b = 0; b < 3; b++)
+            if(!xform.isLinear() || step[a] <= 0.0 || (a != b && fabs(axis[a][b]) > 1.0e-6 * step[a]))
+            {
+                cerr << "Error " << caller << ": grid " << grid.getName() << " is not aligned with the axes" << endl;
+                return false;
+            }
+    origin = cgp::Point((float) corner[0], (float) corner[1], (float) corner[2]);
+    diagonal = cgp::Vector((float) (step[0] * (dim[0] - 1)), (float) (step[1] * (dim[1] - 1)), (float) (step[2] * (dim[2] - 1)));
+    return true;
+}
+
+/**
+ * Read every grid from an OpenVDB file and pick the first of a given type
+ * @param filename  name of file to read
+ * @param caller    method name for error messages
+ * @returns the grid, or NULL with an error message if the file cannot be read or has no grid of that type
+ */
+template<typename GridType> static typename GridType::Ptr readVDBGrid(const std::string &filename, const char * caller)
+{
+    typename GridType::Ptr grid;
+
+    try
+    {
+        openvdb::initialize();
+        openvdb::io::File file(filename);
+        file.open();
+        openvdb::GridPtrVecPtr grids = file.getGrids();
+        file.close();
+        for(openvdb::GridBase::Ptr &candidate : * grids)
+            if((grid = openvdb::gridPtrCast<GridType>(candidate)))
+                break;
+    }
+    catch(const openvdb::Exception &e)
+    {
+        cerr << "Error " << caller << ": unable to read " << filename << ": " << e.what() << endl;
+        return typename GridType::Ptr();
+    }
+    if(!grid)
+        cerr << "Error " << caller << ": no " << GridType::gridType() << " grid in " << filename << endl;
+    return grid;
+}
+
+/**
+ * Write a single grid to an OpenVDB file
+ * @param grid      grid to write
+ * @param filename  name of file to write
+ * @param caller    method name for error messages
+ * @retval true  if writing succeeds,
+ * @retval false otherwise, with an error message
+ */
+static bool writeVDBGrid(openvdb::GridBase::Ptr grid, const std::string &filename, const char * caller)
+{
+    try
+    {
+        openvdb::GridPtrVec grids;
+        openvdb::io::File file(filename);
+
+        grids.push_back(grid);
+        file.write(grids);
+        file.close();
+    }
+    catch(const openvdb::Exception &e)
+    {
+        cerr << "Error " << caller << ": unable to write " << filename << ": " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+#endif
+
+bool VoxelVolume::readVDB(std::string filename)
+{
+#ifdef TESS_OPENVDB
+    openvdb::BoolGrid::Ptr grid = readVDBGrid<openvdb::BoolGrid>(filename, "VoxelVolume::readVDB");
+    const int align[3] = {voxwordbits, voxbrickrows, voxbrickrows};
+    int off[3], dim[3];
+    cgp::Point corner;
+    cgp::Vector diag;
+
+    if(!grid || !vdbFrame(* grid, align, "VoxelVolume::readVDB", off, dim, corner, diag))
+        return false;
+
+    // bricks line up with leaf nodes, so only those holding active voxels are allocated
+    clear();
+    setSparse(true);
+    setDim(dim[0], dim[1], dim[2]);
+    setFrame(corner, diag);
+    for(openvdb::BoolGrid::ValueOnCIter it = grid->cbeginValueOn(); it; ++it)
+    {
+        if(!it.getValue()) // active but false is empty
+            continue;
+        if(it.isVoxelValue())
+        {
+            openvdb::Coord c = it.getCoord();
+            setUnchecked(c.x() - off[0], c.y() - off[1], c.z() - off[2], true);
+        }
+        else // a tile of a leaf node or larger
+        {
+            openvdb::CoordBBox tile = it.getBoundingBox();
+            for(int z = tile.min().z(); z <= tile.max().z(); z++)
+                for(int y = tile.min().y(); y <= tile.max().y(); y++)
+                    setSpan(tile.min().x() - off[0], tile.max().x() - off[0] + 1, y - off[1], z - off[2], true);
+        }
+    }
+    memtally.set(getStorageBytes());
+    UTS_LOG(INFO, VOXELS, "VoxelVolume::readVDB: ", xdim, " x ", ydim, " x ", zdim, " voxels from ", filename);
+    return true;
+#else
+    cerr << "Error VoxelVolume::readVDB: built without OpenVDB, unable to read " << filename << endl;
+    return false;
+#endif
+}
+
+bool VoxelVolume::writeVDB(std::string filename)
+{
+#ifdef TESS_OPENVDB
+    typedef openvdb::BoolTree::LeafNodeType Leaf;
+    const int dim[3] = {xdim, ydim, zdim}, leaves = voxwordbits / vdbleafdim;
+    int brows = (ydim + voxbrickrows - 1) / voxbrickrows, bslabs = (zdim + voxbrickrows - 1) / voxbrickrows;
+
+    openvdb::initialize();
+    openvdb::BoolGrid::Ptr grid = openvdb::BoolGrid::create(false);
+    openvdb::BoolTree &tree = grid->tree();
+    grid->setName(vdbvoxelgrid);
+    grid->setTransform(vdbTransform(origin, diagonal, dim));
+
+    // each word-wide brick of 8 x 8 rows covers a run of leaf nodes along x, and empty bricks are skipped whole
+    for(int bz = 0; bz < bslabs; bz++)
+        for(int by = 0; by < brows; by++)
+            for(int w = 0; w < xspan; w++)
+            {
+                int y0 = by * voxbrickrows, z0 = bz * voxbrickrows;
+                bool whole = (y0 + voxbrickrows <= ydim && z0 + voxbrickrows <= zdim); // not clipped by the volume
+
+                if(sparse)
+                {
+                    const unsigned int * brick = bricks[brickIndex(w, y0, z0)];
+                    if(brick == uniformBrick(false))
+                        continue;
+                    if(brick == uniformBrick(true) && whole)
+                    {
+                        for(int k = 0; k < leaves; k++)
+                            tree.addTile(1, openvdb::Coord(w * voxwordbits + k * vdbleafdim, y0, z0), true, true);
+                        continue;
+                    }
+                }
+                for(int k = 0; k < leaves; k++)
+                {
+                    Leaf * leaf = NULL;
+                    int x0 = w * voxwordbits + k * vdbleafdim;
+
+                    for(int z = z0; z < std::min(z0 + voxbrickrows, zdim); z++)
+                        for(int y = y0; y < std::min(y0 + voxbrickrows, ydim); y++)
+                        {
+                            // voxels are packed from the most significant bit, so leaf k takes byte k from the top
+                            unsigned int bits = (getWord(w, y, z) >> (voxwordbits - (k + 1) * vdbleafdim)) & 0xffu;
+                            if(bits == 0u)
+                                continue;
+                            if(leaf == NULL)
+                                leaf = tree.touchLeaf(openvdb::Coord(x0, y0, z0));
+                            for(int b = 0; b < vdbleafdim; b++)
+                                if(bits & (0x80u >> b))
+                                    leaf->setValueOn(Leaf::coordToOffset(openvdb::Coord(x0 + b, y, z)), true);
+                        }
+                }
+            }
+    openvdb::tools::prune(tree); // full leaves and runs of them become tiles
+    return writeVDBGrid(grid, filename, "VoxelVolume::writeVDB");
+#else
+    cerr << "Error VoxelVolume::writeVDB: built without OpenVDB, unable to write " << filename << endl;
+    return false;
+#endif
+}
+
+bool DistanceField::readVDB(std::string filename)
+{
+#ifdef TESS_OPENVDB
+    openvdb::FloatGrid::Ptr grid = readVDBGrid<openvdb::FloatGrid>(filename, "DistanceField::readVDB");
+    const int align[3] = {1, 1, 1};
+    int off[3], dim[3];
+    cgp::Point corner;
+    cgp::Vector diag;
+
+    if(!grid || !vdbFrame(* grid, align, "DistanceField::readVDB", off, dim, corner, diag))
+        return false;
+    if(grid->getGridClass() != openvdb::GRID_LEVEL_SET || !(grid->background() > 0.0f))
+    {
+        cerr << "Error DistanceField::readVDB: grid " << grid->getName() << " in " << filename << " is not a level set" << endl;
+        return false;
+    }
+
+    // the narrow band is read voxel by voxel, and inactive values give the band with the sign of their side
+    band = grid->background();
+    setDim(dim[0], dim[1], dim[2]);
+    setFrame(corner, diag);
+    #pragma omp parallel
+    {
+        openvdb::FloatGrid::ConstAccessor acc = grid->getConstAccessor();
+
+        #pragma omp for schedule(static)
+        for(int z = 0; z < zdim; z++)
+            for(int y = 0; y < ydim; y++)
+                for(int x = 0; x < xdim; x++)
+                    dist[flatten(x, y, z)] = std::min(std::max(acc.getValue(openvdb::Coord(x + off[0], y + off[1], z + off[2])), -band), band);
+    }
+    UTS_LOG(INFO, VOXELS, "DistanceField::readVDB: ", xdim, " x ", ydim, " x ", zdim, " voxels from ", filename);
+    return true;
+#else
+    cerr << "Error DistanceField::readVDB: built without OpenVDB, unable to read " << filename << endl;
+    return false;
+#endif
+}
+
+bool DistanceField::writeVDB(std::string filename)
+{
+#ifdef TESS_OPENVDB
+    const int dim[3] = {xdim, ydim, zdim};
+
+    openvdb::initialize();
+    openvdb::FloatGrid::Ptr grid = openvdb::FloatGrid::create(band);
+    openvdb::FloatGrid::Accessor acc = grid->getAccessor();
+    grid->setName(vdbdistancegrid);
+    grid->setGridClass(openvdb::GRID_LEVEL_SET);
+    grid->setTransform(vdbTransform(origin, diagonal, dim));
+
+    // only the narrow band is stored, and the flood fill marks the inside so the grid is a proper level set
+    for(int z = 0; z < zdim; z++)
+        for(int y = 0; y < ydim; y++)
+            for(int x = 0; x < xdim; x++)
+            {
+                float d = dist[flatten(x, y, z)];
+                if(fabsf(d) < band)
+                    acc.setValue(openvdb::Coord(x, y, z), d);
+            }
+    openvdb::tools::signedFloodFill(grid->tree());
+    openvdb::tools::pruneLevelSet(grid->tree());
+    return writeVDBGrid(grid, filename, "DistanceField::writeVDB");
+#else
+    cerr << "Error DistanceField::writeVDB: built without OpenVDB, unable to write " << filename << endl;
+    return false;
+#endif
+}
@@ -1,5 +1,6 @@
 #include "vecpnt.h"
 #include <stdio.h>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -36,3 +37,93 @@ void clamp(float & t)
     if(t < 0.0f)
         t = 0.0f;
 }
+
+void cgp::BoundBox::includePnts(const Point * pnts, size_t n)
+{
+    const float * p = &pnts[0].x;
+    float lx = min.x, ly = min.y, lz = min.z, hx = max.x, hy = max.y, hz = max.z;
+
+    #pragma omp simd reduction(min:lx,ly,lz) reduction(max:hx,hy,hz)
+    for(size_t i = 0; i < n; i++)
+    {
+        lx = std::min(lx, p[3*i]); ly = std::min(ly, p[3*i+1]); lz = std::min(lz, p[3*i+2]);
+        hx = std::max(hx, p[3*i]); hy = std::max(hy, p[3*i+1]); hz = std::max(hz, p[3*i+2]);
+    }
+    min = Point(lx, ly, lz);
+    max = Point(hx, hy, hz);
+}
+
+void cgp::transformPoints(const float * mat, const Point * src, size_t n, float * dst, size_t stride)
+{
+    const float * p = &src[0].x;
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+    {
+        float x = p[3*i], y = p[3*i+1], z = p[3*i+2];
+
+        dst[stride*i] = mat[0] * x + mat[4] * y + mat[8] * z + mat[12];
+        dst[stride*i+1] = mat[1] * x + mat[5] * y + mat[9] * z + mat[13];
+        dst[stride*i+2] = mat[2] * x + mat[6] * y + mat[10] * z + mat[14];
+    }
+}
+
+/// Reciprocal length for normalisation, or 0 for a zero length vector so that it stays zero
+static inline float invLength(float x, float y, float z)
+{
+    float len = sqrtf(x*x + y*y + z*z);
+    return (len > 0.0f) ? 1.0f / len : 0.0f;
+}
+
+void cgp::transformNormals(const float * mat, const Vector * src, size_t n, float * dst, size_t stride)
+{
+    const float * v = &src[0].i;
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+    {
+        float x = v[3*i], y = v[3*i+1], z = v[3*i+2], s, tx, ty, tz;
+
+        s = invLength(x, y, z);
+        x *= s; y *= s; z *= s;
+        tx = mat[0] * x + mat[3] * y + mat[6] * z;
+        ty = mat[1] * x + mat[4] * y + mat[7] * z;
+        tz = mat[2] * x + mat[5] * y + mat[8] * z;
+        s = invLength(tx, ty, tz);
+        dst[stride*i] = tx * s; dst[stride*i+1] = ty * s; dst[stride*i+2] = tz * s;
+    }
+}
+
+void cgp::normalizeVectors(Vector * v, size_t n)
+{
+    float * f = &v[0].i;
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+    {
+        float s = invLength(f[3*i], f[3*i+1], f[3*i+2]);
+        f[3*i] *= s; f[3*i+1] *= s; f[3*i+2] *= s;
+    }
+}
+
+void cgp::faceNormals(const Point * verts, const int * faces, size_t stride, size_t numtris, float * nx, float * ny, float * nz)
+{
+    const float * p = &verts[0].x;
+
+    #pragma omp simd
+    for(size_t t = 0; t < numtris; t++)
+    {
+        const float * a = p + 3 * (size_t) faces[stride*t], * b = p + 3 * (size_t) faces[stride*t+1], * c = p + 3 * (size_t) faces[stride*t+2];
+        float e0x = b[0] - a[0], e0y = b[1] - a[1], e0z = b[2] - a[2];
+        float e1x = c[0] - a[0], e1y = c[1] - a[1], e1z = c[2] - a[2];
+        float s0 = invLength(e0x, e0y, e0z), s1 = invLength(e1x, e1y, e1z), cx, cy, cz, s;
+
+        e0x *= s0; e0y *= s0; e0z *= s0;
+        e1x *= s1; e1y *= s1; e1z *= s1;
+        cx = e0y * e1z - e0z * e1y;
+        cy = e0z * e1x - e0x * e1z;
+        cz = e0x * e1y - e0y * e1x;
+        s = invLength(cx, cy, cz);
+        nx[t] = cx * s; ny[t] = cy * s; nz[t] = cz * s;
+    }
+}
@@ -8,6 +8,7 @@
 #define _INC_VECPNT
 
 #include <math.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <boost/archive/text_oarchive.hpp>
@@ -17,6 +18,9 @@
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/array.hpp>
 #include <boost/serialization/split_member.hpp>
+#include <boost/serialization/is_bitwise_serializable.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
 
 #define pluszero 0.000001f
 #define minuszero -0.000001f
@@ -409,6 +413,20 @@ public:
             max.z = pnt.z;
     }
 
+    /**
+     * Expand to enclose an array of points, as repeated includePnt but as a vectorised min/max reduction
+     * @param pnts  points to enclose
+     * @param n     number of points
+     */
+    void includePnts(const Point * pnts, size_t n);
+
+    /// Expand to enclose another bounding box, which may be empty
+    inline void includeBox(const BoundBox &box)
+    {
+        min = Point(std::min(min.x, box.min.x), std::min(min.y, box.min.y), std::min(min.z, box.min.z));
+        max = Point(std::max(max.x, box.max.x), std::max(max.y, box.max.y), std::max(max.z, box.max.z));
+    }
+
     /// Return the length of the diagonal of the bounding box
     inline float diagLen()
     {
@@ -447,8 +465,63 @@ public:
     }
 };
 
+////
+//// BATCHED OPERATIONS
+////
+//// Points and vectors are three packed floats, so arrays of them can be read as float arrays with a stride of 3.
+//// These loops are written over plain floats so that the compiler vectorises across elements, and are serial so
+//// that callers split large arrays into chunks across threads.
+
+static_assert(sizeof(Point) == 3 * sizeof(float) && sizeof(Vector) == 3 * sizeof(float), "points and vectors are read as packed floats");
+
+/**
+ * Transform points by an affine matrix
+ * @param mat       4x4 matrix in column-major order, as laid out by glm
+ * @param src       points to transform
+ * @param n         number of points
+ * @param[out] dst  transformed x, y, z written to the first three floats of each destination record
+ * @param stride    floats between successive destination records
+ */
+void transformPoints(const float * mat, const Point * src, size_t n, float * dst, size_t stride);
+
+/**
+ * Transform directions by a normal matrix, normalising them before and after
+ * @param mat       3x3 matrix in column-major order, as laid out by glm
+ * @param src       directions to transform
+ * @param n         number of directions
+ * @param[out] dst  unit transformed i, j, k written to the first three floats of each destination record
+ * @param stride    floats between successive destination records
+ */
+void transformNormals(const float * mat, const Vector * src, size_t n, float * dst, size_t stride);
+
+/**
+ * Scale vectors to unit length, leaving zero length vectors unchanged, as Vector::normalize
+ * @param v     vectors to normalise in place
+ * @param n     number of vectors
+ */
+void normalizeVectors(Vector * v, size_t n);
+
+/**
+ * Unit normals of triangles by the right-hand rule, i.e. counter-clockwise winding from front, computed as the
+ * normalised cross product of the normalised edges from the first vertex
+ * @param verts     vertex positions
+ * @param faces     three vertex indices per triangle
+ * @param stride    ints between successive triangles in @a faces
+ * @param numtris   number of triangles
+ * @param[out] nx, ny, nz   normal components of each triangle, in separate arrays
+ */
+void faceNormals(const Point * verts, const int * faces, size_t stride, size_t numtris, float * nx, float * ny, float * nz);
+
 }
 
+// points and vectors are written without class information or tracking, and arrays of them as single blocks
+BOOST_IS_BITWISE_SERIALIZABLE(cgp::Point)
+BOOST_CLASS_IMPLEMENTATION(cgp::Point, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(cgp::Point, boost::serialization::track_never)
+BOOST_IS_BITWISE_SERIALIZABLE(cgp::Vector)
+BOOST_CLASS_IMPLEMENTATION(cgp::Vector, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(cgp::Vector, boost::serialization::track_never)
+
 ////
 //// USEFUL GEOMETRY ROUTINES
 ////
@@ -298,11 +298,17 @@ glm::mat4x4 View::getProjMtx()
     glm::mat4x4 projMx;
 
     // frustum
-    projMx = glm::frustum(-0.08, 0.08, -0.08, 0.08, 0.5, 250.0);
+    projMx = glm::frustum(-FRUSTUM_HALF, FRUSTUM_HALF, -FRUSTUM_HALF, FRUSTUM_HALF, FRUSTUM_NEAR, FRUSTUM_FAR);
 
     return projMx;
 }
 
+float View::getProjectedSize(float extent)
+{
+    // the focal point is zoomdist in front of the eye, where the frustum is zoomdist / near times wider than at the near plane
+    return extent * FRUSTUM_NEAR * height / (2.0f * FRUSTUM_HALF * zoomdist);
+}
+
 glm::mat4x4 View::getViewMtx()
 {
     glm::mat4x4 viewMx, quatMx;
@@ -32,6 +32,9 @@ enum viewType {perspective, frontOrtho, upOrtho, leftOrtho};
 #define DEG2RAD 0.0174532925f
 #define ACTUAL_ASPECT 1.4
 #define spinsteps 481.0f
+#define FRUSTUM_HALF 0.08f  // half width of the frustum at the near plane
+#define FRUSTUM_NEAR 0.5f
+#define FRUSTUM_FAR 250.0f
 
 void trackball(float q[4], float p1x, float p1y, float p2x, float p2y);
 void axis_to_quat(float a[3], float phi, float q[4]);
@@ -193,6 +196,9 @@ public:
     /// Retrieve inverse transpose of the view transform
     glm::mat3x3 getNormalMtx();
 
+    /// Find the approximate height in pixels covered by an object of size @a extent at the focal point
+    float getProjectedSize(float extent);
+
     /// Provide a scaling factor for manipulators, which depends on zoom
     float getScaleFactor();
 
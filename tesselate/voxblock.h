@@ -0,0 +1,531 @@
+#ifndef _VOXELBLOCK
+#define _VOXELBLOCK
+/**
+ * @file
+ *
+ * VoxelBlock class for small cubes of binary voxel data whose size is fixed at compile time
+ */
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include "voxels.h"
+
+extern int triangleTable[256][16]; // marching cubes tables shared with Mesh and VoxelVolume
+
+/// Cube corners of each face, counterclockwise from outside, as VoxelMesher emits them
+const int voxblockfacecorner[6][4][3] =
+{
+    {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}}, // -x
+    {{1, 0, 0}, {1, 1, 0}, {1, 1, 1}, {1, 0, 1}}, // +x
+    {{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}}, // -y
+    {{0, 1, 0}, {0, 1, 1}, {1, 1, 1}, {1, 1, 0}}, // +y
+    {{0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}}, // -z
+    {{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}}  // +z
+};
+
+/// Marching cubes cell edge to lattice edge: offset of the node at the start of the edge and the edge axis (0 = x, 1 = y, 2 = z)
+const int voxblockmcedge[12][4] =
+{
+    {0, 0, 0, 0}, {1, 0, 0, 1}, {0, 1, 0, 0}, {0, 0, 0, 1},
+    {0, 0, 1, 0}, {1, 0, 1, 1}, {0, 1, 1, 0}, {0, 0, 1, 1},
+    {0, 0, 0, 2}, {1, 0, 0, 2}, {1, 1, 0, 2}, {0, 1, 0, 2}
+};
+
+/**
+ * Binary voxel cube of N voxels a side, held inline as N^3 bits with no heap storage, for processing many small cells
+ * such as lattice unit cells. The voxel at (x, y, z) is bit i % 64 of word i / 64, where i = (z * N + y) * N + x, so
+ * a row of x never straddles a word and the strides along each axis are compile-time constants. With no bounds to
+ * check and loops of fixed trip count, neighbour shifts, boolean operations and the face culling and marching cubes
+ * kernels reduce to straight-line word operations the compiler unrolls and vectorises.
+ *
+ * Voxels outside the block count as empty, so a block on its own behaves as a VoxelVolume of the same size. Blocks are
+ * copied in and out of a VoxelVolume a row at a time through its word access, so a block can serve as a working brick
+ * of a larger dense or sparse volume, and writing back a block that is unchanged leaves shared sparse bricks shared.
+ */
+template<int N> class VoxelBlock
+{
+    static_assert(N >= 8 && N <= 64 && (N & (N - 1)) == 0, "VoxelBlock side must be a power of two from 8 to 64");
+
+public:
+    static constexpr int dim = N;                                   ///< voxels along each side
+    static constexpr int size = N * N * N;                          ///< voxels in the block
+    static constexpr int numwords = size / 64;                      ///< 64-bit words of voxels
+    static constexpr int xstride = 1;                               ///< bit offset between neighbours in x
+    static constexpr int ystride = N;                               ///< bit offset between neighbours in y
+    static constexpr int zstride = N * N;                           ///< bit offset between neighbours in z
+    static constexpr int planewords = (N * N) / 64;                 ///< words per z plane
+
+private:
+    alignas(64) uint64_t words[numwords];   ///< packed voxels, least significant bit first
+
+    /// Bits of a word holding voxels with x == 0, the same for every word since rows are aligned to words
+    static constexpr uint64_t lowColumn(int rows = 64 / N)
+    {
+        return rows <= 1 ? 1ull : (lowColumn(rows - 1) << (N % 64)) | 1ull;
+    }
+
+    /// Bits of one row within a word
+    static constexpr uint64_t rowMask(){ return N == 64 ? ~0ull : (1ull << N) - 1ull; }
+
+    /// Reverse the bits of a word, between the volume layout with x in bit 31-(x%32) and the block layout
+    static uint32_t reverse32(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+        v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    /// Bit index of the start of row (y, z)
+    static int rowBit(int y, int z){ return (z * N + y) * N; }
+
+public:
+
+    /// Constructor, leaving the block empty
+    VoxelBlock(){ clear(); }
+
+    /// Set every voxel to empty
+    void clear(){ memset(words, 0, sizeof(words)); }
+
+    /// Set every voxel to occupied
+    void fill(){ memset(words, 0xff, sizeof(words)); }
+
+    /// Occupancy of voxel (x, y, z), each coordinate in [0, N), bounds asserted in debug builds only
+    bool get(int x, int y, int z) const
+    {
+        int i = rowBit(y, z) + x;
+
+        assert(x >= 0 && x < N && y >= 0 && y < N && z >= 0 && z < N);
+        return (words[i >> 6] >> (i & 63)) & 1ull;
+    }
+
+    /// Set the occupancy of voxel (x, y, z), each coordinate in [0, N), bounds asserted in debug builds only
+    void set(int x, int y, int z, bool setval)
+    {
+        int i = rowBit(y, z) + x;
+
+        assert(x >= 0 && x < N && y >= 0 && y < N && z >= 0 && z < N);
+        if(setval)
+            words[i >> 6] |= 1ull << (i & 63);
+        else
+            words[i >> 6] &= ~(1ull << (i & 63));
+    }
+
+    /// Row of voxels at (y, z), with voxel x in bit x
+    uint64_t getRow(int y, int z) const
+    {
+        int i = rowBit(y, z);
+        return (words[i >> 6] >> (i & 63)) & rowMask();
+    }
+
+    /// Replace the row of voxels at (y, z) with the low N bits of @a bits, voxel x in bit x
+    void setRow(int y, int z, uint64_t bits)
+    {
+        int i = rowBit(y, z);
+        words[i >> 6] = (words[i >> 6] & ~(rowMask() << (i & 63))) | ((bits & rowMask()) << (i & 63));
+    }
+
+    /// Packed words, for kernels of their own
+    const uint64_t * getWords() const { return words; }
+
+    /// Number of occupied voxels
+    int count() const
+    {
+        int n = 0;
+        for(int w = 0; w < numwords; w++)
+            n += __builtin_popcountll(words[w]);
+        return n;
+    }
+
+    /// Is every voxel empty?
+    bool empty() const
+    {
+        uint64_t any = 0;
+        for(int w = 0; w < numwords; w++)
+            any |= words[w];
+        return any == 0;
+    }
+
+    /// Is every voxel occupied?
+    bool full() const
+    {
+        uint64_t all = ~0ull;
+        for(int w = 0; w < numwords; w++)
+            all &= words[w];
+        return all == ~0ull;
+    }
+
+    bool operator==(const VoxelBlock &other) const { return memcmp(words, other.words, sizeof(words)) == 0; }
+    bool operator!=(const VoxelBlock &other) const { return !(* this == other); }
+
+    /// Set union
+    VoxelBlock & operator|=(const VoxelBlock &other)
+    {
+        for(int w = 0; w < numwords; w++)
+            words[w] |= other.words[w];
+        return * this;
+    }
+
+    /// Set intersection
+    VoxelBlock & operator&=(const VoxelBlock &other)
+    {
+        for(int w = 0; w < numwords; w++)
+            words[w] &= other.words[w];
+        return * this;
+    }
+
+    /// Symmetric difference
+    VoxelBlock & operator^=(const VoxelBlock &other)
+    {
+        for(int w = 0; w < numwords; w++)
+            words[w] ^= other.words[w];
+        return * this;
+    }
+
+    /// Set difference, removing the voxels of @a other
+    VoxelBlock & subtract(const VoxelBlock &other)
+    {
+        for(int w = 0; w < numwords; w++)
+            words[w] &= ~other.words[w];
+        return * this;
+    }
+
+    /// Complement, within the block
+    void invert()
+    {
+        for(int w = 0; w < numwords; w++)
+            words[w] = ~words[w];
+    }
+
+    /**
+     * Neighbours of every voxel at a fixed offset, as a single multiword shift followed by masking of the voxels whose
+     * neighbour wraps into the next row or plane
+     * @tparam DX, DY, DZ   offset of the neighbour, each -1, 0 or 1
+     * @param[out] out      voxel (x, y, z) set to voxel (x+DX, y+DY, z+DZ) of this block, or empty if that lies outside
+     */
+    template<int DX, int DY, int DZ> void neighbour(VoxelBlock &out) const
+    {
+        static_assert(DX >= -1 && DX <= 1 && DY >= -1 && DY <= 1 && DZ >= -1 && DZ <= 1, "neighbour offsets are -1, 0 or 1");
+        constexpr int d = DX * xstride + DY * ystride + DZ * zstride;
+        constexpr int ad = d < 0 ? -d : d;
+        constexpr int q = ad / 64, b = ad % 64;
+        constexpr uint64_t xmask = DX == 1 ? ~(lowColumn() << (N - 1)) : (DX == -1 ? ~lowColumn() : ~0ull);
+        constexpr uint64_t ylo = rowMask(), yhi = rowMask() << (64 - N);
+        int w;
+
+        for(w = 0; w < numwords; w++)
+        {
+            uint64_t v = 0;
+            if(d > 0) // out[i] = in[i+d]
+            {
+                if(w + q < numwords)
+                    v = words[w + q] >> b;
+                if(b != 0 && w + q + 1 < numwords)
+                    v |= words[w + q + 1] << ((64 - b) & 63);
+            }
+            else if(d < 0) // out[i] = in[i-|d|]
+            {
+                if(w - q >= 0)
+                    v = words[w - q] << b;
+                if(b != 0 && w - q - 1 >= 0)
+                    v |= words[w - q - 1] >> ((64 - b) & 63);
+            }
+            else
+                v = words[w];
+            v &= xmask;
+            if(DY == 1 && (w % planewords) == planewords - 1) // row y = N-1 ends each plane
+                v &= ~yhi;
+            if(DY == -1 && (w % planewords) == 0) // row y = 0 starts each plane
+                v &= ~ylo;
+            out.words[w] = v;
+        }
+    }
+
+    /**
+     * Voxels exposing a face, that is occupied voxels whose neighbour across the face is empty or outside the block
+     * @param face      face index, in the order -x, +x, -y, +y, -z, +z
+     * @param[out] out  voxels exposing that face
+     */
+    void exposed(int face, VoxelBlock &out) const
+    {
+        switch(face)
+        {
+            case 0: neighbour<-1, 0, 0>(out); break;
+            case 1: neighbour<1, 0, 0>(out); break;
+            case 2: neighbour<0, -1, 0>(out); break;
+            case 3: neighbour<0, 1, 0>(out); break;
+            case 4: neighbour<0, 0, -1>(out); break;
+            default: neighbour<0, 0, 1>(out); break;
+        }
+        for(int w = 0; w < numwords; w++)
+            out.words[w] = words[w] & ~out.words[w];
+    }
+
+    /// Number of exposed voxel faces, each culled face between two occupied voxels excluded
+    int countFaces() const
+    {
+        VoxelBlock cull;
+        int n = 0;
+
+        for(int f = 0; f < 6; f++)
+        {
+            exposed(f, cull);
+            n += cull.count();
+        }
+        return n;
+    }
+
+    /**
+     * Visit every exposed voxel face, one face direction at a time and within each in voxel order
+     * @param visit called as visit(x, y, z, face) with face indexed as for exposed
+     */
+    template<typename Visit> void forEachFace(Visit visit) const
+    {
+        VoxelBlock cull;
+
+        for(int f = 0; f < 6; f++)
+        {
+            exposed(f, cull);
+            for(int w = 0; w < numwords; w++)
+                for(uint64_t bits = cull.words[w]; bits != 0; bits &= bits - 1)
+                {
+                    int i = w * 64 + __builtin_ctzll(bits);
+                    visit(i % N, (i / N) % N, i / (N * N), f);
+                }
+        }
+    }
+
+    /**
+     * Closed mesh of the exposed voxel faces, two triangles per face with cube corners shared between faces, as
+     * VoxelMesher produces for a volume of the same voxels. Faces are found a row at a time, layer by layer, so that
+     * corners are shared through two planes of slots rolled up the block, held inline rather than on the heap.
+     * @param base          position of the lower corner of voxel (0, 0, 0)
+     * @param step          voxel side lengths
+     * @param[out] verts    cube corners, appended to
+     * @param[out] faces    triangle vertex indices, three per triangle, appended to
+     */
+    void extractFaces(const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts, std::vector<int> &faces) const
+    {
+        std::array<int, (N+1) * (N+1)> plane[2];   // vertex index of each cube corner on the even and odd corner planes
+        uint64_t exposure[6];
+
+        plane[0].fill(-1);
+        for(int z = 0; z < N; z++)
+        {
+            plane[(z+1) & 1].fill(-1); // corners above this layer are new, those below are shared with the last one
+            for(int y = 0; y < N; y++)
+            {
+                uint64_t row = getRow(y, z);
+
+                if(row == 0)
+                    continue;
+                // an occupied voxel exposes a face where its neighbour is empty or outside the block
+                exposure[0] = row & ~(row << 1);
+                exposure[1] = row & ~(row >> 1);
+                exposure[2] = row & ~(y > 0 ? getRow(y-1, z) : 0ull);
+                exposure[3] = row & ~(y < N-1 ? getRow(y+1, z) : 0ull);
+                exposure[4] = row & ~(z > 0 ? getRow(y, z-1) : 0ull);
+                exposure[5] = row & ~(z < N-1 ? getRow(y, z+1) : 0ull);
+                for(int f = 0; f < 6; f++)
+                    for(uint64_t bits = exposure[f]; bits != 0; bits &= bits - 1)
+                    {
+                        int x = __builtin_ctzll(bits), quad[4];
+
+                        for(int c = 0; c < 4; c++)
+                        {
+                            const int * fc = voxblockfacecorner[f][c];
+                            int cx = x + fc[0], cy = y + fc[1], cz = z + fc[2];
+                            int &slot = plane[cz & 1][cy * (N+1) + cx];
+
+                            if(slot < 0)
+                            {
+                                slot = (int) verts.size();
+                                verts.push_back(cgp::Point(base.x + (float) cx * step.i, base.y + (float) cy * step.j, base.z + (float) cz * step.k));
+                            }
+                            quad[c] = slot;
+                        }
+                        faces.push_back(quad[0]); faces.push_back(quad[1]); faces.push_back(quad[2]);
+                        faces.push_back(quad[0]); faces.push_back(quad[2]); faces.push_back(quad[3]);
+                    }
+            }
+        }
+    }
+
+    /**
+     * Visit every marching cubes cell with corners both inside and outside. The corner sets are neighbour shifts of
+     * the block, so uniform regions are skipped a word at a time.
+     * @param visit called as visit(x, y, z, vcode) for cell (x, y, z), x, y and z in [0, N-1), with vcode built as
+     *              VoxelVolume::getMCVertIdx builds it, bit i set if corner i is outside
+     */
+    template<typename Visit> void forActiveCells(Visit visit) const
+    {
+        VoxelBlock corner[8];
+        constexpr uint64_t xhi = lowColumn() << (N - 1), yhi = rowMask() << (64 - N);
+        int w, c;
+
+        // corners ordered as cubePos in voxels.cpp
+        corner[0] = * this;
+        neighbour<1, 0, 0>(corner[1]);
+        neighbour<1, 1, 0>(corner[2]);
+        neighbour<0, 1, 0>(corner[3]);
+        neighbour<0, 0, 1>(corner[4]);
+        neighbour<1, 0, 1>(corner[5]);
+        neighbour<1, 1, 1>(corner[6]);
+        neighbour<0, 1, 1>(corner[7]);
+
+        for(w = 0; w < numwords - planewords; w++) // cells of the last plane would reach outside the block
+        {
+            uint64_t any = 0, all = ~0ull, active;
+            for(c = 0; c < 8; c++)
+            {
+                any |= corner[c].words[w];
+                all &= corner[c].words[w];
+            }
+            active = any & ~all & ~xhi;
+            if((w % planewords) == planewords - 1)
+                active &= ~yhi;
+            for(; active != 0; active &= active - 1)
+            {
+                int b = __builtin_ctzll(active), i = w * 64 + b, vcode = 0;
+                for(c = 0; c < 8; c++)
+                    vcode |= (int) ((~corner[c].words[w] >> b) & 1ull) << c;
+                visit(i % N, (i / N) % N, i / (N * N), vcode);
+            }
+        }
+    }
+
+    /**
+     * Marching cubes surface through the voxel centres, matching Mesh::marchingCubes on a volume of the same voxels,
+     * with vertices shared between cells. Active cells arrive layer by layer, so the lattice edges are looked up
+     * through two planes of slots rolled up the block, held inline rather than on the heap.
+     * @param origin        position of the centre of voxel (0, 0, 0)
+     * @param step          spacing between voxel centres
+     * @param[out] verts    surface vertices, appended to
+     * @param[out] faces    triangle vertex indices, three per triangle, appended to
+     */
+    void marchingCubes(const cgp::Point &origin, const cgp::Vector &step, std::vector<cgp::Point> &verts, std::vector<int> &faces) const
+    {
+        std::array<int, 3 * N * N> plane[2];   // vertex index of the x, y and z lattice edges from each node of the even and odd node planes
+        int layer = -2;
+
+        forActiveCells([&](int x, int y, int z, int vcode)
+        {
+            int edgeidx[12], ecode = VoxelVolume::getMCEdgeIdx(vcode);
+
+            if(z != layer) // edges of the plane below are shared with the last layer only if it was next to this one
+            {
+                if(z != layer + 1)
+                    plane[z & 1].fill(-1);
+                plane[(z+1) & 1].fill(-1);
+                layer = z;
+            }
+            for(int e = 0; e < 12; e++)
+                if(ecode & (1 << e))
+                {
+                    const int * le = voxblockmcedge[e];
+                    int &slot = plane[(z + le[2]) & 1][3 * ((y + le[1]) * N + x + le[0]) + le[3]];
+
+                    if(slot < 0)
+                    {
+                        cgp::Point pnt = VoxelVolume::getMCEdgeXsect(e);
+                        slot = (int) verts.size();
+                        verts.push_back(cgp::Point(origin.x + ((float) x + pnt.x) * step.i, origin.y + ((float) y + pnt.y) * step.j,
+                                                   origin.z + ((float) z + pnt.z) * step.k));
+                    }
+                    edgeidx[e] = slot;
+                }
+            for(int t = 0; t < 5 && triangleTable[vcode][3*t] >= 0; t++) // up to 5 triangles per cube
+                for(int p = 0; p < 3; p++)
+                    faces.push_back(edgeidx[triangleTable[vcode][3*t+p]]);
+        });
+    }
+
+    /**
+     * Copy in the voxels of a volume, those outside the volume being left empty
+     * @param vox           dense or sparse volume
+     * @param x0, y0, z0    voxel of the volume at block voxel (0, 0, 0), with x0 a non-negative multiple of 32 or, for
+     *                      blocks narrower than a word, of N
+     * @retval true if the block was read,
+     * @retval false if x0 is misaligned
+     */
+    bool readVolume(VoxelVolume * vox, int x0, int y0, int z0)
+    {
+        int dx, dy, dz, y, z, k;
+
+        if(x0 < 0 || x0 % (N < 32 ? N : 32) != 0)
+        {
+            std::cerr << "Error VoxelBlock::readVolume: x origin " << x0 << " is not aligned to " << (N < 32 ? N : 32) << std::endl;
+            return false;
+        }
+        vox->getDim(dx, dy, dz);
+        clear();
+        for(z = 0; z < N; z++)
+            for(y = 0; y < N; y++)
+            {
+                uint64_t row = 0;
+
+                if(y0 + y < 0 || y0 + y >= dy || z0 + z < 0 || z0 + z >= dz)
+                    continue;
+                for(k = 0; k < (N + 31) / 32; k++)
+                {
+                    int w = x0 / 32 + k;
+                    if(w >= vox->getXSpan())
+                        continue;
+                    row |= (uint64_t) reverse32(vox->getWordUnchecked(w, y0 + y, z0 + z)) << (32 * k);
+                }
+                if(N < 32)
+                    row >>= x0 % 32;
+                setRow(y, z, row);
+            }
+        return true;
+    }
+
+    /**
+     * Copy the voxels of the block into a volume, clipped to the volume. Words the block leaves unchanged are not
+     * written, so shared uniform bricks of a sparse volume stay shared.
+     * @param vox           dense or sparse volume
+     * @param x0, y0, z0    voxel of the volume at block voxel (0, 0, 0), aligned as for readVolume
+     * @retval true if the block was written,
+     * @retval false if x0 is misaligned
+     */
+    bool writeVolume(VoxelVolume * vox, int x0, int y0, int z0) const
+    {
+        int dx, dy, dz, y, z, k;
+
+        if(x0 < 0 || x0 % (N < 32 ? N : 32) != 0)
+        {
+            std::cerr << "Error VoxelBlock::writeVolume: x origin " << x0 << " is not aligned to " << (N < 32 ? N : 32) << std::endl;
+            return false;
+        }
+        vox->getDim(dx, dy, dz);
+        for(z = 0; z < N; z++)
+            for(y = 0; y < N; y++)
+            {
+                uint64_t row = getRow(y, z), rmask = rowMask();
+
+                if(y0 + y < 0 || y0 + y >= dy || z0 + z < 0 || z0 + z >= dz)
+                    continue;
+                if(N < 32)
+                {
+                    row <<= x0 % 32;
+                    rmask <<= x0 % 32;
+                }
+                for(k = 0; k < (N + 31) / 32; k++)
+                {
+                    int w = x0 / 32 + k;
+
+                    if(w < vox->getXSpan())
+                        vox->setWordUnchecked(w, y0 + y, z0 + z, reverse32((uint32_t) (rmask >> (32 * k))), reverse32((uint32_t) (row >> (32 * k))));
+                }
+            }
+        return true;
+    }
+};
+
+#endif
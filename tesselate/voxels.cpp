@@ -8,9 +8,24 @@
 #include <string.h>
 #include <iostream>
 #include <limits>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "common/serialize.h"
+#include "common/log.h"
+#include "common/parallel.h"
+#include "common/pages.h"
 
 using namespace std;
 
+static stats::MemoryInit voxelMemory("VoxelVolume");
+
+const int voxmorphwindow = 8;   ///< largest ball offset whose distance transform takes the minimum over nearby rows rather than an envelope
+
 //==========START BLOYD
 
 // source for tables Marching Cubes Example Program by Cory Bloyd (corysama@yahoo.com)
@@ -74,7 +89,7 @@ bool VoxelVolume::flatten(int x, int y, int z, int &intidx, int &bitidx)
     }
     else // in bounds
     {
-        intidx = z * (xspan * ydim) + y * (xspan) + (int) ((float) x / (float) intsize);
+        intidx = z * (xspan * ydim) + y * (xspan) + x / intsize;
         bitidx = 31 - (x % intsize); // shifting from/to least significant bit required to select addressed bit
         return true;
     }
@@ -82,16 +97,28 @@ bool VoxelVolume::flatten(int x, int y, int z, int &intidx, int &bitidx)
 
 
 VoxelVolume::VoxelVolume()
+    : memtally(voxelMemory)
 {
     xdim = ydim = zdim = 0;
     xspan = 0;
+    intsize = (sizeof(int) * 8);
     voxgrid = NULL;
+    gridbytes = 0;
+    mapping = NULL;
+    maplen = 0;
+    sparse = false;
+    bdim[0] = bdim[1] = bdim[2] = 0;
     setFrame(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(0.0f, 0.0f, 0.0f));
 }
 
 VoxelVolume::VoxelVolume(int xsize, int ysize, int zsize, cgp::Point corner, cgp::Vector diag)
+    : memtally(voxelMemory)
 {
     voxgrid = NULL;
+    gridbytes = 0;
+    mapping = NULL;
+    maplen = 0;
+    sparse = false;
     setDim(xsize, ysize, zsize);
     setFrame(corner, diag);
 }
@@ -103,22 +130,487 @@ VoxelVolume::~VoxelVolume()
 
 void VoxelVolume::clear()
 {
-    if(voxgrid != NULL)
+    if(mapping != NULL) // voxgrid points into a file mapping
+    {
+        munmap(mapping, maplen);
+        mapping = NULL;
+        maplen = 0;
+        voxgrid = NULL;
+    }
+    else if(voxgrid != NULL)
     {
-        delete [] voxgrid;
+        parallel::freePages(voxgrid, gridbytes);
         voxgrid = NULL;
+        gridbytes = 0;
+    }
+    for(int b = 0; b < (int) bricks.size(); b++)
+        if(!isUniform(bricks[b]))
+            delete [] bricks[b];
+    bricks.clear();
+    memtally.set(0);
+}
+
+unsigned int * VoxelVolume::uniformBrick(bool full)
+{
+    static std::vector<unsigned int> empty(voxbrickwords, 0u), solid(voxbrickwords, ~0u);
+    return full ? &solid[0] : &empty[0];
+}
+
+unsigned int * VoxelVolume::editWord(int w, int y, int z)
+{
+    unsigned int * brick;
+    int b;
+
+    if(!sparse)
+        return (unsigned int *) &voxgrid[z * (xspan * ydim) + y * xspan + w];
+
+    b = brickIndex(w, y, z);
+    brick = bricks[b];
+    if(isUniform(brick)) // copy on write, checking again in case another thread got there first
+    {
+        #pragma omp critical(voxbrick)
+        {
+            if(isUniform(bricks[b]))
+            {
+                unsigned int * owned = new unsigned int[voxbrickwords];
+                memcpy(owned, bricks[b], voxbrickwords * sizeof(unsigned int));
+                bricks[b] = owned;
+                memtally.add(voxbrickwords * sizeof(unsigned int));
+            }
+            brick = bricks[b];
+        }
     }
+    return &brick[brickOffset(y, z)];
 }
 
+void VoxelVolume::collapseBrick(int b)
+{
+    unsigned int * brick = bricks[b], first;
+    int by, bz, y, z;
+    bool uniform = true;
+
+    if(isUniform(brick))
+        return;
+
+    // only rows inside the volume count, edge bricks may overhang in y and z
+    by = (b / bdim[0]) % bdim[1];
+    bz = b / (bdim[0] * bdim[1]);
+    first = brick[0];
+    if(first != 0u && first != ~0u)
+        return;
+    for(z = bz * voxbrickrows; z < std::min(zdim, (bz+1) * voxbrickrows) && uniform; z++)
+        for(y = by * voxbrickrows; y < std::min(ydim, (by+1) * voxbrickrows); y++)
+            if(brick[brickOffset(y, z)] != first)
+            {
+                uniform = false;
+                break;
+            }
+    if(uniform)
+    {
+        delete [] brick;
+        bricks[b] = uniformBrick(first != 0u);
+        memtally.add(-(std::int64_t) (voxbrickwords * sizeof(unsigned int)));
+    }
+}
+
+void VoxelVolume::setSparse(bool on)
+{
+    int w, y, z, b, numbricks;
+
+    if(on == sparse)
+        return;
+
+    if(on)
+    {
+        std::vector<unsigned int *> table;
+        int tdim[3] = {xspan, (ydim + voxbrickrows - 1) / voxbrickrows, (zdim + voxbrickrows - 1) / voxbrickrows};
+
+        // gather words into bricks, then let uniform bricks fall back to shared storage
+        numbricks = tdim[0] * tdim[1] * tdim[2];
+        table.resize(numbricks);
+        for(b = 0; b < numbricks; b++)
+        {
+            table[b] = new unsigned int[voxbrickwords];
+            memset(table[b], 0, voxbrickwords * sizeof(unsigned int));
+        }
+        for(z = 0; z < zdim; z++)
+            for(y = 0; y < ydim; y++)
+                for(w = 0; w < xspan; w++)
+                    table[((z / voxbrickrows) * tdim[1] + y / voxbrickrows) * tdim[0] + w][brickOffset(y, z)] = getWord(w, y, z);
+
+        clear();
+        sparse = true;
+        bdim[0] = tdim[0]; bdim[1] = tdim[1]; bdim[2] = tdim[2];
+        bricks.swap(table);
+        for(b = 0; b < numbricks; b++)
+            collapseBrick(b);
+    }
+    else
+    {
+        size_t densebytes = (size_t) xspan * ydim * zdim * sizeof(int);
+        int * dense = (int *) parallel::allocPages(densebytes, (size_t) xspan * ydim * sizeof(int));
+
+        for(z = 0; z < zdim; z++)
+            for(y = 0; y < ydim; y++)
+                for(w = 0; w < xspan; w++)
+                    dense[((size_t) z * ydim + y) * xspan + w] = (int) getWord(w, y, z);
+        clear();
+        sparse = false;
+        voxgrid = dense;
+        gridbytes = densebytes;
+    }
+    memtally.set(getStorageBytes());
+}
+
+size_t VoxelVolume::getStorageBytes()
+{
+    size_t bytes;
+
+    if(!sparse)
+        return (size_t) xspan * (size_t) ydim * (size_t) zdim * sizeof(int);
+    bytes = bricks.size() * sizeof(unsigned int *);
+    for(int b = 0; b < (int) bricks.size(); b++)
+        if(!isUniform(bricks[b]))
+            bytes += voxbrickwords * sizeof(unsigned int);
+    return bytes;
+}
+
+bool VoxelVolume::isVoxelFile(std::string filename)
+{
+    FILE * fp;
+    char magic[4];
+    bool found = false;
+
+    fp = fopen(filename.c_str(), "rb");
+    if(fp != NULL)
+    {
+        found = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, voxfilemagic, 4) == 0);
+        fclose(fp);
+    }
+    return found;
+}
+
+bool VoxelVolume::readVoxels(std::string filename)
+{
+    VoxelFileHeader hdr;
+    struct stat st;
+    size_t numwords;
+    void * map;
+    int fd;
+    bool wassparse;
+
+    fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        cerr << "Error VoxelVolume::readVoxels: unable to open " << filename << endl;
+        return false;
+    }
+    if(fstat(fd, &st) != 0 || read(fd, &hdr, sizeof(VoxelFileHeader)) != (ssize_t) sizeof(VoxelFileHeader)
+       || memcmp(hdr.magic, voxfilemagic, 4) != 0)
+    {
+        cerr << "Error VoxelVolume::readVoxels: " << filename << " is not a binary voxel file" << endl;
+        close(fd);
+        return false;
+    }
+    if(hdr.version != voxfileversion || hdr.intsize != (int32_t) (sizeof(int) * 8) || hdr.xspan * hdr.intsize != hdr.dim[0]
+       || hdr.dim[0] < 0 || hdr.dim[1] < 0 || hdr.dim[2] < 0)
+    {
+        cerr << "Error VoxelVolume::readVoxels: unsupported version or layout in " << filename << endl;
+        close(fd);
+        return false;
+    }
+    numwords = (size_t) hdr.xspan * (size_t) hdr.dim[1] * (size_t) hdr.dim[2];
+    if((size_t) st.st_size < sizeof(VoxelFileHeader) + numwords * sizeof(int))
+    {
+        cerr << "Error VoxelVolume::readVoxels: " << filename << " is truncated" << endl;
+        close(fd);
+        return false;
+    }
+
+    wassparse = sparse;
+    clear();
+    sparse = false;
+    xdim = hdr.dim[0]; ydim = hdr.dim[1]; zdim = hdr.dim[2];
+    xspan = hdr.xspan;
+    intsize = hdr.intsize;
+
+    // private mapping, so that later edits to the volume never reach the file
+    map = (numwords > 0) ? mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if(map != MAP_FAILED)
+    {
+        mapping = map;
+        maplen = (size_t) st.st_size;
+        voxgrid = (int *) ((char *) map + sizeof(VoxelFileHeader));
+    }
+    else // fall back to reading into heap memory
+    {
+        gridbytes = numwords * sizeof(int);
+        voxgrid = (int *) parallel::allocPages(gridbytes, (size_t) xspan * ydim * sizeof(int));
+        if(voxgrid == NULL || pread(fd, voxgrid, numwords * sizeof(int), sizeof(VoxelFileHeader)) != (ssize_t) (numwords * sizeof(int)))
+        {
+            cerr << "Error VoxelVolume::readVoxels: failed to read voxels from " << filename << endl;
+            close(fd);
+            setDim(0, 0, 0);
+            return false;
+        }
+    }
+    close(fd);
+
+    setFrame(cgp::Point(hdr.origin[0], hdr.origin[1], hdr.origin[2]), cgp::Vector(hdr.diagonal[0], hdr.diagonal[1], hdr.diagonal[2]));
+    memtally.set(getStorageBytes()); // a mapping counts in full, since edits may touch every page
+    if(wassparse) // keep the storage scheme requested by the caller
+        setSparse(true);
+    return true;
+}
+
+void VoxelVolume::fillFileHeader(VoxelFileHeader &hdr)
+{
+    memset(&hdr, 0, sizeof(VoxelFileHeader));
+    memcpy(hdr.magic, voxfilemagic, 4);
+    hdr.version = voxfileversion;
+    hdr.dim[0] = xdim; hdr.dim[1] = ydim; hdr.dim[2] = zdim;
+    hdr.xspan = xspan;
+    hdr.intsize = intsize;
+    hdr.origin[0] = origin.x; hdr.origin[1] = origin.y; hdr.origin[2] = origin.z;
+    hdr.diagonal[0] = diagonal.i; hdr.diagonal[1] = diagonal.j; hdr.diagonal[2] = diagonal.k;
+}
+
+size_t VoxelVolume::getVoxelFileBytes()
+{
+    return sizeof(VoxelFileHeader) + (size_t) xspan * (size_t) ydim * (size_t) zdim * sizeof(unsigned int);
+}
+
+void VoxelVolume::encodeVoxels(char * buf)
+{
+    VoxelFileHeader hdr;
+    unsigned int * words = (unsigned int *) (buf + sizeof(VoxelFileHeader));
+    size_t numwords = (size_t) xspan * (size_t) ydim * (size_t) zdim;
+
+    fillFileHeader(hdr);
+    memcpy(buf, &hdr, sizeof(VoxelFileHeader));
+    if(numwords == 0)
+        return;
+    if(!sparse)
+    {
+        memcpy(words, voxgrid, numwords * sizeof(unsigned int));
+        return;
+    }
+    // densify a slice per iteration, since bricks are only read
+    #pragma omp parallel for schedule(static)
+    for(int z = 0; z < zdim; z++)
+        for(int y = 0; y < ydim; y++)
+            for(int w = 0; w < xspan; w++)
+                words[((size_t) z * ydim + y) * xspan + w] = getWord(w, y, z);
+}
+
+bool VoxelVolume::writeVoxels(std::string filename)
+{
+    VoxelFileHeader hdr;
+    FILE * fp;
+    size_t numwords = (size_t) xspan * (size_t) ydim * (size_t) zdim;
+    bool ok;
+
+    fillFileHeader(hdr);
+
+    fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL)
+    {
+        cerr << "Error VoxelVolume::writeVoxels: unable to open " << filename << endl;
+        return false;
+    }
+    ok = (fwrite(&hdr, sizeof(VoxelFileHeader), 1, fp) == 1);
+    if(ok && numwords > 0 && !sparse)
+    {
+        ok = (fwrite(voxgrid, sizeof(int), numwords, fp) == numwords);
+    }
+    else if(ok && numwords > 0) // densify a row at a time
+    {
+        std::vector<unsigned int> row(xspan);
+        for(int z = 0; z < zdim && ok; z++)
+            for(int y = 0; y < ydim && ok; y++)
+            {
+                for(int w = 0; w < xspan; w++)
+                    row[w] = getWord(w, y, z);
+                ok = (fwrite(&row[0], sizeof(unsigned int), xspan, fp) == (size_t) xspan);
+            }
+    }
+    if(fclose(fp) != 0)
+        ok = false;
+    if(!ok)
+        cerr << "Error VoxelVolume::writeVoxels: failed writing " << filename << endl;
+    return ok;
+}
+
+void VoxelVolume::hashContent(ContentHash &hash)
+{
+    hash.addString("voxels");
+    hash.addInt((int64_t) checksum());
+}
+
+uint64_t VoxelVolume::checksum()
+{
+    ContentHash hash;
+    uint64_t layersum;
+
+    // a layer per chunk, read word by word so that dense and sparse storage hash alike
+    layersum = parallel::reduce(0, zdim, 1, (uint64_t) 0, [this](int z, int)
+    {
+        std::vector<unsigned int> row(xspan);
+        ContentHash layer;
+        for(int y = 0; y < ydim; y++)
+        {
+            for(int w = 0; w < xspan; w++)
+                row[w] = getWord(w, y, z);
+            if(xspan > 0)
+                layer.add(&row[0], xspan * sizeof(unsigned int));
+        }
+        return layer.value();
+    }, ContentHash::combine);
+
+    hash.addInt(xdim); hash.addInt(ydim); hash.addInt(zdim);
+    hash.addFloat(origin.x); hash.addFloat(origin.y); hash.addFloat(origin.z);
+    hash.addFloat(diagonal.i); hash.addFloat(diagonal.j); hash.addFloat(diagonal.k);
+    hash.addInt((int64_t) layersum);
+    return hash.value();
+}
+
+size_t VoxelVolume::takeSnapshot(VoxelSnapshot &snap, const VoxelSnapshot * prev, const VoxelSnapshot * alt)
+{
+    const SnapshotArray<unsigned int> * prevwords = (prev != NULL) ? &prev->words : NULL;
+    const SnapshotArray<unsigned int> * altwords = (alt != NULL) ? &alt->words : NULL;
+    size_t bytes;
+
+    snap.dim[0] = xdim; snap.dim[1] = ydim; snap.dim[2] = zdim;
+    snap.origin = origin;
+    snap.diagonal = diagonal;
+    snap.sparse = sparse;
+    snap.uniform.clear();
+    if(!sparse)
+        return snap.words.capture((const unsigned int *) voxgrid, (size_t) xspan * ydim * zdim, prevwords, altwords);
+
+    // uniform bricks are noted rather than copied, and each held brick is compared with the same brick before
+    bytes = 0;
+    snap.uniform.resize(bricks.size());
+    snap.words.reset(bricks.size() * voxbrickwords, voxbrickwords);
+    for(int b = 0; b < (int) bricks.size(); b++)
+    {
+        if(isUniform(bricks[b]))
+            snap.uniform[b] = (bricks[b] == uniformBrick(true)) ? 1 : 0;
+        else
+        {
+            snap.uniform[b] = -1;
+            bytes += snap.words.setChunk(b, bricks[b], prevwords, altwords);
+        }
+    }
+    return bytes + snap.uniform.size();
+}
+
+void VoxelVolume::restoreSnapshot(const VoxelSnapshot &snap)
+{
+    clear();
+    sparse = snap.sparse;
+    setDim(snap.dim[0], snap.dim[1], snap.dim[2]);
+    setFrame(snap.origin, snap.diagonal);
+    if(!sparse)
+    {
+        snap.words.restore((unsigned int *) voxgrid);
+        return;
+    }
+    for(int b = 0; b < (int) bricks.size(); b++)
+    {
+        if(snap.uniform[b] >= 0)
+            bricks[b] = uniformBrick(snap.uniform[b] == 1);
+        else
+        {
+            bricks[b] = new unsigned int[voxbrickwords];
+            memcpy(bricks[b], snap.words.getChunk(b), voxbrickwords * sizeof(unsigned int));
+        }
+    }
+    memtally.set(getStorageBytes());
+}
+
+template<class Archive> void VoxelVolume::save(Archive & ar, const unsigned int version) const
+{
+    std::vector<signed char> kinds;
+
+    ar << xdim << ydim << zdim << origin << diagonal << sparse;
+    if(!sparse)
+    {
+        if(xspan > 0 && ydim > 0 && zdim > 0)
+            ar << boost::serialization::make_array((const unsigned int *) voxgrid, (size_t) xspan * ydim * zdim);
+        return;
+    }
+
+    // as for takeSnapshot, uniform bricks are noted rather than written
+    kinds.resize(bricks.size());
+    for(int b = 0; b < (int) bricks.size(); b++)
+        kinds[b] = isUniform(bricks[b]) ? ((bricks[b] == uniformBrick(true)) ? 1 : 0) : -1;
+    uts::saveArray(ar, kinds);
+    for(int b = 0; b < (int) bricks.size(); b++)
+        if(kinds[b] < 0)
+            ar << boost::serialization::make_array((const unsigned int *) bricks[b], (size_t) voxbrickwords);
+}
+
+template<class Archive> void VoxelVolume::load(Archive & ar, const unsigned int version)
+{
+    std::vector<signed char> kinds;
+    int dimx, dimy, dimz;
+    cgp::Point corner;
+    cgp::Vector diag;
+    bool bricked;
+
+    ar >> dimx >> dimy >> dimz >> corner >> diag >> bricked;
+    clear();
+    sparse = bricked;
+    setDim(dimx, dimy, dimz);
+    setFrame(corner, diag);
+    if(!sparse)
+    {
+        if(xspan > 0 && ydim > 0 && zdim > 0)
+            ar >> boost::serialization::make_array((unsigned int *) voxgrid, (size_t) xspan * ydim * zdim);
+        return;
+    }
+
+    uts::loadArray(ar, kinds);
+    if(kinds.size() != bricks.size())
+        throw boost::archive::archive_exception(boost::archive::archive_exception::array_size_too_short);
+    for(int b = 0; b < (int) bricks.size(); b++)
+    {
+        if(kinds[b] >= 0)
+            bricks[b] = uniformBrick(kinds[b] == 1);
+        else
+        {
+            bricks[b] = new unsigned int[voxbrickwords];
+            ar >> boost::serialization::make_array(bricks[b], (size_t) voxbrickwords);
+        }
+    }
+    memtally.set(getStorageBytes());
+}
+
+template void VoxelVolume::save(boost::archive::binary_oarchive & ar, const unsigned int version) const;
+template void VoxelVolume::load(boost::archive::binary_iarchive & ar, const unsigned int version);
+
 void VoxelVolume::fill(bool setval)
 {
-    int memsize = xspan * ydim * zdim * sizeof(int);
+    size_t memsize = (size_t) xspan * ydim * zdim * sizeof(int);
     unsigned char fillval;
+
+    if(sparse) // every brick becomes uniform
+    {
+        for(int b = 0; b < (int) bricks.size(); b++)
+        {
+            if(!isUniform(bricks[b]))
+                delete [] bricks[b];
+            bricks[b] = uniformBrick(setval);
+        }
+        memtally.set(getStorageBytes());
+        return;
+    }
     if(setval) // all bits set
         fillval = (unsigned char) 0xff;
     else // no bits set
         fillval = (unsigned char) 0;
-    memset(voxgrid, fillval, memsize);
+    parallel::fillPages(voxgrid, fillval, memsize, (size_t) xspan * ydim * sizeof(int));
 }
 
 void VoxelVolume::calcCellDiag()
@@ -141,8 +633,14 @@ int VoxelVolume::getXSpan()
 
 void VoxelVolume::setDim(int dimx, int dimy, int dimz)
 {
-    int memsize;
 
+    // a dense volume keeps its storage when the shape is unchanged, as when a scene voxelises part after part
+    if(!sparse && mapping == NULL && voxgrid != NULL && dimx > 0 && (dimx + intsize - 1) / intsize == xspan && dimy == ydim && dimz == zdim)
+    {
+        xdim = xspan * intsize;
+        fill(false);
+        return;
+    }
     clear();
     xdim = dimx;
     ydim = dimy;
@@ -150,12 +648,25 @@ void VoxelVolume::setDim(int dimx, int dimy, int dimz)
     intsize = (sizeof(int) * 8); // because size of an integer is supposedly platform dependent, although typically 32 bits
     // will address individual bits in x dimension, so must be divisible by integer size
     xspan = (int) ceil((float) xdim / (float) intsize);
-    cout << "xspan = " << xspan << endl;
+    UTS_LOG(DEBUG, VOXELS, "xspan = ", xspan);
     xdim = xspan * intsize;
 
-    memsize = xspan * ydim * zdim;
-    voxgrid = new int[memsize];
-    fill(false);
+    if(sparse)
+    {
+        bdim[0] = xspan;
+        bdim[1] = (ydim + voxbrickrows - 1) / voxbrickrows;
+        bdim[2] = (zdim + voxbrickrows - 1) / voxbrickrows;
+        bricks.assign(bdim[0] * bdim[1] * bdim[2], uniformBrick(false));
+    }
+    else
+    {
+        // already zeroed, by the team when first touch places the pages
+        gridbytes = (size_t) xspan * ydim * zdim * sizeof(int);
+        voxgrid = (int *) parallel::allocPages(gridbytes, (size_t) xspan * ydim * sizeof(int));
+    }
+    if(sparse)
+        fill(false);
+    memtally.set(getStorageBytes());
 
     calcCellDiag();
 }
@@ -178,7 +689,19 @@ bool VoxelVolume::set(int x, int y, int z, bool setval)
     int intidx, bitidx;
     if(flatten(x, y, z, intidx, bitidx))
     {
-        if(setval) // set the bit
+        if(sparse)
+        {
+            unsigned int bit = 0x1u << bitidx;
+            if(((getWord(x / intsize, y, z) & bit) != 0u) != setval) // leave uniform bricks alone unless the voxel changes
+            {
+                unsigned int * word = editWord(x / intsize, y, z);
+                if(setval)
+                    *word |= bit;
+                else
+                    *word &= ~bit;
+            }
+        }
+        else if(setval) // set the bit
             voxgrid[intidx] |= (0x1 << bitidx); // "or" left shifted mask with particular bit set
         else // clear the bit
             voxgrid[intidx] &= ~(0x1 << bitidx); // "and" left shifted mask with particular bit unset
@@ -191,11 +714,82 @@ bool VoxelVolume::set(int x, int y, int z, bool setval)
     }
 }
 
+bool VoxelVolume::setSpan(int xstart, int xend, int y, int z, bool setval)
+{
+    int rowidx, w, wstart, wend, lo, hi;
+    unsigned int mask;
+
+    if(y < 0 || y >= ydim || z < 0 || z >= zdim)
+    {
+        cerr << "Error VoxelVolume::setSpan: row request (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    if(xstart < 0)
+        xstart = 0;
+    if(xend > xdim)
+        xend = xdim;
+    if(xstart >= xend) // empty run
+        return true;
+
+    rowidx = z * (xspan * ydim) + y * xspan;
+    wstart = xstart / intsize;
+    wend = (xend-1) / intsize;
+    for(w = wstart; w <= wend; w++)
+    {
+        // bit positions within the word are counted from the most significant bit, matching flatten
+        lo = (w == wstart) ? xstart - w * intsize : 0;
+        hi = (w == wend) ? xend - 1 - w * intsize : intsize - 1;
+        mask = (~0u >> lo) & (~0u << (intsize - 1 - hi));
+        if(sparse)
+        {
+            unsigned int cur = getWord(w, y, z), next = setval ? (cur | mask) : (cur & ~mask);
+            if(next != cur)
+                *editWord(w, y, z) = next;
+        }
+        else if(setval)
+            voxgrid[rowidx+w] |= (int) mask;
+        else
+            voxgrid[rowidx+w] &= ~((int) mask);
+    }
+    return true;
+}
+
+bool VoxelVolume::setRow(int y, int z, const unsigned int * words)
+{
+    if(y < 0 || y >= ydim || z < 0 || z >= zdim)
+    {
+        cerr << "Error VoxelVolume::setRow: row request (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    for(int w = 0; w < xspan; w++)
+        if(!sparse || getWord(w, y, z) != words[w]) // avoid giving uniform bricks storage unnecessarily
+            *editWord(w, y, z) = words[w];
+    return true;
+}
+
+bool VoxelVolume::getRow(int y, int z, unsigned int * words)
+{
+    if(y < 0 || y >= ydim || z < 0 || z >= zdim)
+    {
+        cerr << "Error VoxelVolume::getRow: row request (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    const unsigned int * row = rowWords(y, z);
+    if(row != NULL) // dense rows are contiguous
+        memcpy(words, row, xspan * sizeof(unsigned int));
+    else
+        for(int w = 0; w < xspan; w++)
+            words[w] = getWord(w, y, z);
+    return true;
+}
+
 bool VoxelVolume::get(int x, int y, int z)
 {
     int intidx, bitidx;
     if(flatten(x, y, z, intidx, bitidx))
     {
+        if(sparse)
+            return (bool) ((getWord(x / intsize, y, z) >> bitidx) & 0x1u);
         return (bool) ((voxgrid[intidx] >> bitidx) & 0x1); // right shift voxgrid element to select individual bit
     }
     else // if out of bounds provde warning and return empty
@@ -205,6 +799,1041 @@ bool VoxelVolume::get(int x, int y, int z)
     }
 }
 
+bool VoxelVolume::matchDim(VoxelVolume * other, const char * caller)
+{
+    if(other->xdim != xdim || other->ydim != ydim || other->zdim != zdim)
+    {
+        cerr << "Error VoxelVolume::" << caller << ": volume dimensions (" << xdim << ", " << ydim << ", " << zdim << ") and (";
+        cerr << other->xdim << ", " << other->ydim << ", " << other->zdim << ") do not match" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool VoxelVolume::unionWith(VoxelVolume * other, const int * lo, const int * hi)
+{
+    int i, memsize = xspan * ydim * zdim;
+    const int * src = other->voxgrid;
+
+    if(!matchDim(other, "unionWith"))
+        return false;
+    if(sparse || other->sparse || lo != NULL)
+    {
+        combineRegion(other, 0, lo, hi);
+        return true;
+    }
+    #pragma omp parallel for simd
+    for(i = 0; i < memsize; i++)
+        voxgrid[i] |= src[i];
+    return true;
+}
+
+bool VoxelVolume::intersectWith(VoxelVolume * other, const int * lo, const int * hi)
+{
+    int i, memsize = xspan * ydim * zdim;
+    const int * src = other->voxgrid;
+
+    if(!matchDim(other, "intersectWith"))
+        return false;
+    if(sparse || other->sparse || lo != NULL)
+    {
+        combineRegion(other, 1, lo, hi);
+        return true;
+    }
+    #pragma omp parallel for simd
+    for(i = 0; i < memsize; i++)
+        voxgrid[i] &= src[i];
+    return true;
+}
+
+bool VoxelVolume::subtract(VoxelVolume * other, const int * lo, const int * hi)
+{
+    int i, memsize = xspan * ydim * zdim;
+    const int * src = other->voxgrid;
+
+    if(!matchDim(other, "subtract"))
+        return false;
+    if(sparse || other->sparse || lo != NULL)
+    {
+        combineRegion(other, 2, lo, hi);
+        return true;
+    }
+    #pragma omp parallel for simd
+    for(i = 0; i < memsize; i++)
+        voxgrid[i] &= ~src[i];
+    return true;
+}
+
+void VoxelVolume::combineRegion(VoxelVolume * other, int op, const int * lo, const int * hi)
+{
+    int b, numbricks, wlo = 0, whi = xspan-1, ylo = 0, yhi = ydim-1, zlo = 0, zhi = zdim-1;
+
+    if(lo != NULL) // whole words in x
+    {
+        wlo = std::max(0, lo[0] / intsize); whi = std::min(xspan-1, hi[0] / intsize);
+        ylo = std::max(0, lo[1]); yhi = std::min(ydim-1, hi[1]);
+        zlo = std::max(0, lo[2]); zhi = std::min(zdim-1, hi[2]);
+    }
+
+    if(!sparse) // dense result
+    {
+        #pragma omp parallel for
+        for(int z = zlo; z <= zhi; z++)
+            for(int y = ylo; y <= yhi; y++)
+                for(int w = wlo; w <= whi; w++)
+                {
+                    unsigned int src = other->getWord(w, y, z), * dst = editWord(w, y, z);
+                    *dst = (op == 0) ? (*dst | src) : ((op == 1) ? (*dst & src) : (*dst & ~src));
+                }
+        return;
+    }
+
+    // bricks are disjoint, so each can be combined independently
+    numbricks = (int) bricks.size();
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(b = 0; b < numbricks; b++)
+    {
+        unsigned int * src = other->sparse ? other->bricks[b] : NULL;
+        int w = b % bdim[0], by = (b / bdim[0]) % bdim[1], bz = b / (bdim[0] * bdim[1]);
+
+        if(w < wlo || w > whi || (by+1) * voxbrickrows <= ylo || by * voxbrickrows > yhi ||
+           (bz+1) * voxbrickrows <= zlo || bz * voxbrickrows > zhi) // outside the region
+            continue;
+
+        // whole brick shortcuts when the other brick is uniform
+        if(src == uniformBrick(false) && op != 1) // union or difference with nothing
+            continue;
+        if(src == uniformBrick(true) && op == 1) // intersection with everything
+            continue;
+        if(src != NULL && isUniform(src)) // union with everything, intersection with or difference from nothing
+        {
+            if(!isUniform(bricks[b]))
+                delete [] bricks[b];
+            bricks[b] = uniformBrick(op == 0);
+            continue;
+        }
+        if(bricks[b] == uniformBrick(true) && op == 0) // already full
+            continue;
+        if(bricks[b] == uniformBrick(false) && op != 0) // nothing to intersect or subtract from
+            continue;
+
+        for(int z = bz * voxbrickrows; z < std::min(zdim, (bz+1) * voxbrickrows); z++)
+            for(int y = by * voxbrickrows; y < std::min(ydim, (by+1) * voxbrickrows); y++)
+            {
+                unsigned int cur = getWord(w, y, z), arg = other->getWord(w, y, z), next;
+                next = (op == 0) ? (cur | arg) : ((op == 1) ? (cur & arg) : (cur & ~arg));
+                if(next != cur)
+                    *editWord(w, y, z) = next;
+            }
+        collapseBrick(b);
+    }
+    memtally.set(getStorageBytes()); // bricks replaced by shared uniform ones above were freed without counting
+}
+
+/**
+ * Combine one element of a line of packed words with another, for morphological offsets
+ * @param dst   words to update
+ * @param src   words to combine in, or NULL for empty voxels beyond the volume
+ * @param span  number of words in each element
+ * @param grow  true to OR, false to AND
+ */
+static void combineWords(unsigned int * dst, const unsigned int * src, int span, bool grow)
+{
+    if(src == NULL)
+    {
+        if(!grow)
+            memset(dst, 0, span * sizeof(unsigned int));
+        return;
+    }
+    for(int w = 0; w < span; w++)
+        dst[w] = grow ? (dst[w] | src[w]) : (dst[w] & src[w]);
+}
+
+/**
+ * Combine each element of a line with the elements up to a window length beyond it in one direction, in place. The
+ * window grows by doubling, so a length of L takes about log2(L) passes, and empty voxels are shifted in past the end.
+ * @param line  n elements of span words each
+ * @param n     number of elements
+ * @param span  words per element
+ * @param len   window length, counting the element itself
+ * @param dir   1 to look towards higher indices, -1 towards lower ones
+ * @param grow  true to OR, false to AND
+ */
+static void windowLine(unsigned int * line, int n, int span, int len, int dir, bool grow)
+{
+    int m;
+
+    // each pass reads elements ahead of the sweep, which still hold the previous window
+    auto pass = [&](int step)
+    {
+        if(dir > 0)
+            for(int i = 0; i < n; i++)
+                combineWords(line + (size_t) i * span, (i + step < n) ? line + (size_t) (i + step) * span : NULL, span, grow);
+        else
+            for(int i = n - 1; i >= 0; i--)
+                combineWords(line + (size_t) i * span, (i - step >= 0) ? line + (size_t) (i - step) * span : NULL, span, grow);
+    };
+
+    for(m = 1; 2 * m <= len; m *= 2)
+        pass(m);
+    if(len > m) // overlapping windows, since OR and AND are idempotent
+        pass(len - m);
+}
+
+/**
+ * Shift a row of packed voxels along x
+ * @param src   row words
+ * @param dst   shifted row, voxel x taking the value of voxel x + s of @a src, or empty past either end
+ * @param span  words per row
+ * @param s     shift in voxels
+ */
+static void shiftRow(const unsigned int * src, unsigned int * dst, int span, int s)
+{
+    int t = std::abs(s), ws = t / voxwordbits, bs = t % voxwordbits;
+
+    // voxel x sits at bit 31-(x%32), so higher voxels lie in lower bits and later words
+    for(int w = 0; w < span; w++)
+    {
+        unsigned int near, far;
+        if(s >= 0)
+        {
+            near = (w + ws < span) ? src[w + ws] : 0u;
+            far = (w + ws + 1 < span) ? src[w + ws + 1] : 0u;
+            dst[w] = (near << bs) | (bs > 0 ? far >> (voxwordbits - bs) : 0u);
+        }
+        else
+        {
+            near = (w - ws >= 0) ? src[w - ws] : 0u;
+            far = (w - ws - 1 >= 0) ? src[w - ws - 1] : 0u;
+            dst[w] = (near >> bs) | (bs > 0 ? far << (voxwordbits - bs) : 0u);
+        }
+    }
+}
+
+/// As windowLine, for the voxels along a single row of packed words
+static void windowRow(unsigned int * row, int span, int len, int dir, bool grow, unsigned int * tmp)
+{
+    int m;
+
+    auto pass = [&](int step)
+    {
+        shiftRow(row, tmp, span, dir * step);
+        combineWords(row, tmp, span, grow);
+    };
+
+    for(m = 1; 2 * m <= len; m *= 2)
+        pass(m);
+    if(len > m)
+        pass(len - m);
+}
+
+/**
+ * Exact squared distance along a line to the nearest of a set of samples, by the lower envelope of the parabolas
+ * rooted at each sample
+ * @param f         squared distance at each of n positions, where values of @a cap or more are not samples
+ * @param n         number of positions
+ * @param edges     if true positions -1 and n are samples at distance 0
+ * @param cap       bound above which distances are not needed
+ * @param[out] d    min(cap, f[i] + (q-i)^2) over samples i, for each position q
+ * @param pv, hv, zz    scratch of at least n+2 entries each
+ */
+static void envelopeLine(const int * f, int n, bool edges, int cap, int * d, int * pv, int * hv, double * zz)
+{
+    int m = 0, j = 0;
+
+    auto add = [&](int p, int h)
+    {
+        double s = 0.0;
+        while(m > 0)
+        {
+            s = ((double) h + (double) p * p - (double) hv[m-1] - (double) pv[m-1] * pv[m-1]) / (2.0 * (p - pv[m-1]));
+            if(s <= zz[m-1])
+                m--;
+            else
+                break;
+        }
+        pv[m] = p; hv[m] = h;
+        zz[m] = (m == 0) ? -HUGE_VAL : s;
+        m++;
+    };
+
+    // lines wholly of samples, or without any, are common and need no envelope
+    int zeros = 0, samples = 0;
+    for(int i = 0; i < n; i++)
+    {
+        zeros += (f[i] == 0);
+        samples += (f[i] < cap);
+    }
+    if(zeros == n || (samples == 0 && !edges))
+    {
+        std::fill(d, d + n, zeros == n ? 0 : cap);
+        return;
+    }
+
+    if(edges)
+        add(-1, 0);
+    for(int i = 0; i < n; i++)
+        if(f[i] < cap)
+            add(i, f[i]);
+    if(edges)
+        add(n, 0);
+
+    for(int q = 0; q < n; q++)
+    {
+        if(m == 0)
+        {
+            d[q] = cap;
+            continue;
+        }
+        while(j + 1 < m && zz[j+1] < q)
+            j++;
+        d[q] = (int) std::min((long long) cap, (long long) (q - pv[j]) * (q - pv[j]) + hv[j]);
+    }
+}
+
+/**
+ * Carry squared distances across the rows of a tile, so that each becomes the distance to the nearest sample in the
+ * plane of the tile rather than along its own row. Small offsets take the minimum over the rows within k, a whole row
+ * at a time, and larger ones the lower envelope of each column.
+ * @param tile      n rows of rowlen squared distances, capped at @a cap, updated in place
+ * @param n         number of rows
+ * @param rowlen    distances per row
+ * @param edges     if true rows -1 and n hold samples at distance 0
+ * @param cap       bound above which distances are not needed
+ * @param k         offset in voxels, with cap = (k+1)^2
+ * @param scratch   working storage
+ */
+static void distanceTile(int * tile, int n, int rowlen, bool edges, int cap, int k, vector<int> &scratch)
+{
+    if(k <= voxmorphwindow)
+    {
+        // rows further than k away add at least cap, so only the window matters
+        scratch.resize((size_t) n * rowlen);
+        for(int i = 0; i < n; i++)
+        {
+            int * out = &scratch[(size_t) i * rowlen], base = cap;
+
+            if(edges)
+                base = std::min(base, std::min((i + 1) * (i + 1), (n - i) * (n - i)));
+            std::fill(out, out + rowlen, base);
+            for(int d = std::max(-k, -i); d <= std::min(k, n - 1 - i); d++)
+            {
+                const int * in = &tile[(size_t) (i + d) * rowlen];
+                int add = d * d;
+                for(int x = 0; x < rowlen; x++)
+                    out[x] = std::min(out[x], in[x] + add);
+            }
+        }
+        std::copy(scratch.begin(), scratch.end(), tile);
+        return;
+    }
+
+    vector<int> f(n), out(n), pv(n + 2), hv(n + 2);
+    vector<double> zz(n + 2);
+    for(int x = 0; x < rowlen; x++)
+    {
+        for(int i = 0; i < n; i++)
+            f[i] = tile[(size_t) i * rowlen + x];
+        envelopeLine(f.data(), n, edges, cap, out.data(), pv.data(), hv.data(), zz.data());
+        for(int i = 0; i < n; i++)
+            tile[(size_t) i * rowlen + x] = out[i];
+    }
+}
+
+bool VoxelVolume::dilate(int k, VoxelMorph elem)
+{
+    if(k < 0)
+    {
+        cerr << "Error VoxelVolume::dilate: negative offset " << k << endl;
+        return false;
+    }
+    if(k > 0 && xspan > 0)
+        offset(k, elem, true);
+    return true;
+}
+
+bool VoxelVolume::erode(int k, VoxelMorph elem)
+{
+    if(k < 0)
+    {
+        cerr << "Error VoxelVolume::erode: negative offset " << k << endl;
+        return false;
+    }
+    if(k > 0 && xspan > 0)
+        offset(k, elem, false);
+    return true;
+}
+
+void VoxelVolume::offset(int k, VoxelMorph elem, bool grow)
+{
+    size_t slab = (size_t) ydim * xspan;
+    vector<unsigned int> words(zdim * slab);
+
+    // dense working copy, whichever way the volume is stored
+    #pragma omp parallel for schedule(static)
+    for(int z = 0; z < zdim; z++)
+        for(int y = 0; y < ydim; y++)
+            getRow(y, z, &words[z * slab + (size_t) y * xspan]);
+
+    if(elem == VoxelMorph::BOX)
+    {
+        // the window [i-k, i+k] along each axis joins a window of k+1 looking forward with one looking back
+        #pragma omp parallel for schedule(static)
+        for(int z = 0; z < zdim; z++)
+        {
+            vector<unsigned int> back(xspan), tmp(xspan), backslab(slab);
+
+            for(int y = 0; y < ydim; y++)
+            {
+                unsigned int * row = &words[z * slab + (size_t) y * xspan];
+                std::copy(row, row + xspan, back.begin());
+                windowRow(row, xspan, k + 1, 1, grow, tmp.data());
+                windowRow(back.data(), xspan, k + 1, -1, grow, tmp.data());
+                combineWords(row, back.data(), xspan, grow);
+            }
+            std::copy(words.begin() + z * slab, words.begin() + (z + 1) * slab, backslab.begin());
+            windowLine(&words[z * slab], ydim, xspan, k + 1, 1, grow);
+            windowLine(backslab.data(), ydim, xspan, k + 1, -1, grow);
+            combineWords(&words[z * slab], backslab.data(), (int) slab, grow);
+        }
+
+        // along z the words of each y are gathered into a line of their own
+        #pragma omp parallel for schedule(static)
+        for(int y = 0; y < ydim; y++)
+        {
+            vector<unsigned int> line((size_t) zdim * xspan), back;
+
+            for(int z = 0; z < zdim; z++)
+                std::copy(words.begin() + z * slab + (size_t) y * xspan, words.begin() + z * slab + (size_t) (y + 1) * xspan,
+                          line.begin() + (size_t) z * xspan);
+            back = line;
+            windowLine(line.data(), zdim, xspan, k + 1, 1, grow);
+            windowLine(back.data(), zdim, xspan, k + 1, -1, grow);
+            combineWords(line.data(), back.data(), (int) line.size(), grow);
+            for(int z = 0; z < zdim; z++)
+                std::copy(line.begin() + (size_t) z * xspan, line.begin() + (size_t) (z + 1) * xspan,
+                          words.begin() + z * slab + (size_t) y * xspan);
+        }
+    }
+    else if(elem == VoxelMorph::CROSS)
+    {
+        vector<unsigned int> next(words.size());
+
+        for(int step = 0; step < k; step++)
+        {
+            #pragma omp parallel for schedule(static)
+            for(int z = 0; z < zdim; z++)
+                for(int y = 0; y < ydim; y++)
+                {
+                    const unsigned int * row = &words[z * slab + (size_t) y * xspan];
+                    const unsigned int * nbr[4] = {y > 0 ? row - xspan : NULL, y + 1 < ydim ? row + xspan : NULL,
+                                                   z > 0 ? row - slab : NULL, z + 1 < zdim ? row + slab : NULL};
+                    unsigned int * out = &next[z * slab + (size_t) y * xspan];
+
+                    for(int w = 0; w < xspan; w++)
+                    {
+                        unsigned int cur = row[w], lower, higher;
+
+                        // voxel x takes x-1 from one bit higher and x+1 from one bit lower
+                        lower = (cur >> 1) | (w > 0 ? row[w-1] << (voxwordbits - 1) : 0u);
+                        higher = (cur << 1) | (w + 1 < xspan ? row[w+1] >> (voxwordbits - 1) : 0u);
+                        cur = grow ? (cur | lower | higher) : (cur & lower & higher);
+                        for(const unsigned int * n : nbr)
+                            cur = grow ? (cur | (n != NULL ? n[w] : 0u)) : (cur & (n != NULL ? n[w] : 0u));
+                        out[w] = cur;
+                    }
+                }
+            words.swap(next);
+        }
+    }
+    else
+    {
+        // squared distance to the nearest occupied voxel when growing, or to the nearest empty one, including the
+        // outside of the volume, when shrinking. Distances beyond k are capped, since only the threshold matters.
+        const int cap = (k + 1) * (k + 1), far = k + 1;
+        size_t xslab = (size_t) ydim * xdim;
+        vector<int> dist(zdim * xslab);
+
+        #pragma omp parallel for schedule(static)
+        for(int z = 0; z < zdim; z++)
+            for(int y = 0; y < ydim; y++)
+            {
+                const unsigned int * row = &words[z * slab + (size_t) y * xspan];
+                int * d = &dist[z * xslab + (size_t) y * xdim];
+                int last = grow ? -far - 1 : -1, next;
+
+                for(int x = 0; x < xdim; x++)
+                {
+                    bool occ = (row[x / voxwordbits] >> (voxwordbits - 1 - x % voxwordbits)) & 0x1u;
+                    if(occ == grow)
+                        last = x;
+                    d[x] = std::min(far, x - last);
+                }
+                next = grow ? xdim + far : xdim;
+                for(int x = xdim - 1; x >= 0; x--)
+                {
+                    if(d[x] == 0)
+                        next = x;
+                    d[x] = std::min(d[x], next - x);
+                    d[x] = std::min(cap, d[x] * d[x]);
+                }
+            }
+
+        #pragma omp parallel for schedule(static)
+        for(int z = 0; z < zdim; z++)
+        {
+            vector<int> scratch;
+            distanceTile(&dist[z * xslab], ydim, xdim, !grow, cap, k, scratch);
+        }
+
+        // along z each y is first gathered into a tile of whole rows, rather than striding across slabs per voxel
+        #pragma omp parallel for schedule(static)
+        for(int y = 0; y < ydim; y++)
+        {
+            vector<int> tile((size_t) zdim * xdim), scratch;
+
+            for(int z = 0; z < zdim; z++)
+                std::copy(dist.begin() + z * xslab + (size_t) y * xdim, dist.begin() + z * xslab + (size_t) (y + 1) * xdim,
+                          tile.begin() + (size_t) z * xdim);
+            distanceTile(tile.data(), zdim, xdim, !grow, cap, k, scratch);
+            for(int z = 0; z < zdim; z++)
+                std::copy(tile.begin() + (size_t) z * xdim, tile.begin() + (size_t) (z + 1) * xdim,
+                          dist.begin() + z * xslab + (size_t) y * xdim);
+        }
+
+        #pragma omp parallel for schedule(static)
+        for(int z = 0; z < zdim; z++)
+            for(int y = 0; y < ydim; y++)
+            {
+                unsigned int * row = &words[z * slab + (size_t) y * xspan];
+                const int * d = &dist[z * xslab + (size_t) y * xdim];
+
+                for(int w = 0; w < xspan; w++)
+                {
+                    unsigned int bits = 0u;
+                    for(int b = 0; b < voxwordbits; b++)
+                        if((d[w * voxwordbits + b] <= k * k) == grow)
+                            bits |= 0x1u << (voxwordbits - 1 - b);
+                    row[w] = bits;
+                }
+            }
+    }
+
+    // write back, a brick at a time when sparse so that uniform bricks can be shared again
+    if(!sparse)
+    {
+        memcpy(voxgrid, words.data(), words.size() * sizeof(unsigned int));
+        return;
+    }
+    int numbricks = (int) bricks.size();
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int b = 0; b < numbricks; b++)
+    {
+        int w = b % bdim[0], by = (b / bdim[0]) % bdim[1], bz = b / (bdim[0] * bdim[1]);
+
+        for(int z = bz * voxbrickrows; z < std::min(zdim, (bz+1) * voxbrickrows); z++)
+            for(int y = by * voxbrickrows; y < std::min(ydim, (by+1) * voxbrickrows); y++)
+            {
+                unsigned int next = words[z * slab + (size_t) y * xspan + w];
+                if(next != getWord(w, y, z))
+                    *editWord(w, y, z) = next;
+            }
+        collapseBrick(b);
+    }
+    memtally.set(getStorageBytes());
+}
+
+unsigned int VoxelVolume::maskedWord(int w, int y, int z)
+{
+    int valid;
+
+    if(w < 0 || w >= xspan || y < 0 || y >= ydim || z < 0 || z >= zdim)
+        return 0u;
+    valid = xdim - w * intsize;
+    if(valid >= intsize)
+        return getWord(w, y, z);
+    return getWord(w, y, z) & ~(~0u >> valid);
+}
+
+unsigned int VoxelVolume::shellWord(int w, int y, int z)
+{
+    unsigned int cur = maskedWord(w, y, z), inner;
+
+    if(cur == 0u)
+        return 0u;
+
+    // voxel x sits at bit 31-(x%32), so its x-1 neighbour is one bit higher and x+1 one bit lower
+    inner = cur & ((cur >> 1) | (maskedWord(w-1, y, z) << 31)) & ((cur << 1) | (maskedWord(w+1, y, z) >> 31));
+    inner &= maskedWord(w, y-1, z) & maskedWord(w, y+1, z) & maskedWord(w, y, z-1) & maskedWord(w, y, z+1);
+    return cur & ~inner;
+}
+
+size_t VoxelVolume::getShell(VoxelVolume * shell)
+{
+    size_t count = 0;
+
+    if(shell == this)
+    {
+        cerr << "Error VoxelVolume::getShell: shell must be a separate volume" << endl;
+        return 0;
+    }
+    if(shell != NULL)
+    {
+        shell->setDim(xdim, ydim, zdim);
+        shell->setFrame(origin, diagonal);
+    }
+    if(xspan <= 0)
+        return 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:count)
+    for(int z = 0; z < zdim; z++)
+    {
+        std::vector<unsigned int> row(xspan);
+
+        for(int y = 0; y < ydim; y++)
+        {
+            bool any = false;
+
+            for(int w = 0; w < xspan; w++)
+            {
+                row[w] = shellWord(w, y, z);
+                if(row[w] != 0u)
+                {
+                    count += (size_t) __builtin_popcount(row[w]);
+                    any = true;
+                }
+            }
+            if(shell != NULL && any) // rows are distinct words, so slabs can be written concurrently
+                shell->setRow(y, z, row.data());
+        }
+    }
+    return count;
+}
+
+void VoxelVolume::getStats(VoxelStats &stats)
+{
+    int slab = std::max(zdim, 0);
+    std::vector<size_t> slabfaces(3 * slab, 0);
+    std::vector<int> slablo(3 * slab, -1), slabhi(3 * slab, -1);
+    double step[3];
+    int dim[3] = {xdim, ydim, zdim};
+
+    stats.slices.assign(slab, 0);
+    stats.occupied = 0;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = 0; z < slab; z++)
+    {
+        size_t * faces = &slabfaces[3 * z];
+        int * lo = &slablo[3 * z], * hi = &slabhi[3 * z];
+
+        for(int y = 0; y < ydim; y++)
+        {
+            unsigned int prev = 0u, cur = maskedWord(0, y, z), next;
+
+            for(int w = 0; w < xspan; w++, prev = cur, cur = next)
+            {
+                int first, last;
+
+                next = maskedWord(w+1, y, z);
+                if(cur == 0u)
+                    continue;
+
+                stats.slices[z] += (size_t) __builtin_popcount(cur);
+                // voxel x sits at bit 31-(x%32), so its x-1 neighbour is one bit higher and x+1 one bit lower
+                faces[0] += (size_t) __builtin_popcount(cur & ~((cur >> 1) | (prev << 31)));
+                faces[0] += (size_t) __builtin_popcount(cur & ~((cur << 1) | (next >> 31)));
+                faces[1] += (size_t) __builtin_popcount(cur & ~maskedWord(w, y-1, z));
+                faces[1] += (size_t) __builtin_popcount(cur & ~maskedWord(w, y+1, z));
+                faces[2] += (size_t) __builtin_popcount(cur & ~maskedWord(w, y, z-1));
+                faces[2] += (size_t) __builtin_popcount(cur & ~maskedWord(w, y, z+1));
+
+                first = w * intsize + __builtin_clz(cur);
+                last = w * intsize + intsize - 1 - __builtin_ctz(cur);
+                if(lo[0] < 0 || first < lo[0])
+                    lo[0] = first;
+                hi[0] = std::max(hi[0], last);
+                if(lo[1] < 0)
+                    lo[1] = y;
+                hi[1] = y;
+                lo[2] = hi[2] = z;
+            }
+        }
+    }
+
+    // combine slabs in z order so the result does not depend on the thread count
+    for(int a = 0; a < 3; a++)
+    {
+        stats.faces[a] = 0;
+        stats.lo[a] = stats.hi[a] = -1;
+    }
+    for(int z = 0; z < slab; z++)
+    {
+        stats.occupied += stats.slices[z];
+        for(int a = 0; a < 3; a++)
+        {
+            stats.faces[a] += slabfaces[3 * z + a];
+            if(slablo[3 * z + a] >= 0 && (stats.lo[a] < 0 || slablo[3 * z + a] < stats.lo[a]))
+                stats.lo[a] = slablo[3 * z + a];
+            stats.hi[a] = std::max(stats.hi[a], slabhi[3 * z + a]);
+        }
+    }
+
+    // a voxel cell spans the spacing between centres, as placed by getVoxelPos
+    step[0] = (double) diagonal.i / (double) std::max(dim[0] - 1, 1);
+    step[1] = (double) diagonal.j / (double) std::max(dim[1] - 1, 1);
+    step[2] = (double) diagonal.k / (double) std::max(dim[2] - 1, 1);
+    stats.volume = (double) stats.occupied * step[0] * step[1] * step[2];
+    stats.area = (double) stats.faces[0] * step[1] * step[2] + (double) stats.faces[1] * step[0] * step[2]
+               + (double) stats.faces[2] * step[0] * step[1];
+
+    stats.bounds.reset();
+    if(stats.occupied > 0)
+    {
+        cgp::Point lopos = getVoxelPos(stats.lo[0], stats.lo[1], stats.lo[2]);
+        cgp::Point hipos = getVoxelPos(stats.hi[0], stats.hi[1], stats.hi[2]);
+
+        stats.bounds.includePnt(cgp::Point(lopos.x - 0.5f * step[0], lopos.y - 0.5f * step[1], lopos.z - 0.5f * step[2]));
+        stats.bounds.includePnt(cgp::Point(hipos.x + 0.5f * step[0], hipos.y + 0.5f * step[1], hipos.z + 0.5f * step[2]));
+    }
+}
+
+/**
+ * Root of a run in a union-find forest where every run's parent is at or before it
+ * @param parent    parent of each run, halved along the path
+ * @param r         run index
+ * @returns root run
+ */
+static int findRun(vector<int> &parent, int r)
+{
+    while(parent[r] != r)
+    {
+        parent[r] = parent[parent[r]];
+        r = parent[r];
+    }
+    return r;
+}
+
+/**
+ * Join the components of the overlapping runs of two adjacent rows, linking the later root to the earlier so that
+ * parents never follow their runs
+ * @param runs      run bounds
+ * @param parent    union-find forest over the runs
+ * @param a0, a1    first run and one past the last run of one row
+ * @param b0, b1    first run and one past the last run of the other row
+ */
+static void joinRows(const VoxelRuns &runs, vector<int> &parent, size_t a0, size_t a1, size_t b0, size_t b1)
+{
+    while(a0 < a1 && b0 < b1)
+    {
+        if(runs.start[a0] < runs.end[b0] && runs.start[b0] < runs.end[a0])
+        {
+            int ra = findRun(parent, (int) a0), rb = findRun(parent, (int) b0);
+            if(ra < rb)
+                parent[rb] = ra;
+            else if(rb < ra)
+                parent[ra] = rb;
+        }
+        if(runs.end[a0] < runs.end[b0])
+            a0++;
+        else
+            b0++;
+    }
+}
+
+void VoxelVolume::labelRuns(bool value, VoxelRuns &runs, std::vector<VoxelComponent> &comps)
+{
+    int layers = std::max(zdim, 0), rows = std::max(ydim, 0) * layers, numslabs = (layers + voxlabelslab - 1) / voxlabelslab;
+    vector<vector<int>> layerruns(layers);
+    vector<int> &parent = runs.label;
+
+    runs.rowstart.assign(rows + 1, 0);
+    comps.clear();
+
+    // runs of each row from whole words, with uniform words extending or ending a run without a bit search
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = 0; z < layers; z++)
+        for(int y = 0; y < ydim; y++)
+        {
+            vector<int> &out = layerruns[z];
+            size_t before = out.size();
+            int open = -1;
+
+            for(int w = 0; w < xspan; w++)
+            {
+                unsigned int bits = value ? getWord(w, y, z) : ~getWord(w, y, z), rest = bits;
+                int p, q;
+
+                if(bits == ~0u)
+                {
+                    if(open < 0)
+                        open = w * intsize;
+                    continue;
+                }
+                if(open >= 0) // bit x sits at 31-(x%32), so the first clear bit ends the open run
+                {
+                    q = __builtin_clz(~bits);
+                    out.push_back(open);
+                    out.push_back(w * intsize + q);
+                    open = -1;
+                    rest = (q > 0) ? bits & (~0u >> q) : bits;
+                }
+                while(rest != 0u)
+                {
+                    unsigned int gaps;
+
+                    p = __builtin_clz(rest);
+                    gaps = ~bits & (~0u >> p);
+                    if(gaps == 0u) // reaches the end of the word
+                    {
+                        open = w * intsize + p;
+                        break;
+                    }
+                    q = __builtin_clz(gaps);
+                    out.push_back(w * intsize + p);
+                    out.push_back(w * intsize + q);
+                    rest = bits & (~0u >> q);
+                }
+            }
+            if(open >= 0)
+            {
+                out.push_back(open);
+                out.push_back(xdim);
+            }
+            runs.rowstart[(size_t) z * ydim + y + 1] = (out.size() - before) / 2;
+        }
+
+    for(int r = 0; r < rows; r++)
+        runs.rowstart[r + 1] += runs.rowstart[r];
+    size_t total = runs.rowstart[rows];
+    runs.start.resize(total);
+    runs.end.resize(total);
+    parent.resize(total);
+
+    #pragma omp parallel for schedule(static)
+    for(int z = 0; z < layers; z++)
+    {
+        size_t first = runs.rowstart[(size_t) z * ydim];
+        for(size_t r = 0; r < layerruns[z].size() / 2; r++)
+        {
+            runs.start[first + r] = layerruns[z][2 * r];
+            runs.end[first + r] = layerruns[z][2 * r + 1];
+            parent[first + r] = (int) (first + r);
+        }
+        vector<int>().swap(layerruns[z]);
+    }
+
+    // join rows within each slab, whose runs no other slab touches, then join the slabs in order
+    auto rowRange = [&](int y, int z, size_t &r0, size_t &r1){ r0 = runs.rowstart[(size_t) z * ydim + y]; r1 = runs.rowstart[(size_t) z * ydim + y + 1]; };
+    #pragma omp parallel for schedule(dynamic)
+    for(int s = 0; s < numslabs; s++)
+        for(int z = s * voxlabelslab; z < std::min(layers, (s+1) * voxlabelslab); z++)
+            for(int y = 0; y < ydim; y++)
+            {
+                size_t a0, a1, b0, b1;
+
+                rowRange(y, z, a0, a1);
+                if(y > 0)
+                {
+                    rowRange(y-1, z, b0, b1);
+                    joinRows(runs, parent, b0, b1, a0, a1);
+                }
+                if(z > s * voxlabelslab)
+                {
+                    rowRange(y, z-1, b0, b1);
+                    joinRows(runs, parent, b0, b1, a0, a1);
+                }
+            }
+    for(int s = 1; s < numslabs; s++)
+        for(int y = 0; y < ydim; y++)
+        {
+            size_t a0, a1, b0, b1;
+
+            rowRange(y, s * voxlabelslab, a0, a1);
+            rowRange(y, s * voxlabelslab - 1, b0, b1);
+            joinRows(runs, parent, b0, b1, a0, a1);
+        }
+
+    // parents precede their runs, so in one pass in order each parent already holds its component number
+    for(size_t r = 0; r < total; r++)
+    {
+        if(parent[r] == (int) r)
+        {
+            VoxelComponent comp;
+            comp.size = 0;
+            for(int a = 0; a < 3; a++)
+            {
+                comp.lo[a] = std::numeric_limits<int>::max();
+                comp.hi[a] = -1;
+            }
+            comp.border = false;
+            parent[r] = (int) comps.size();
+            comps.push_back(comp);
+        }
+        else
+            parent[r] = parent[parent[r]];
+    }
+
+    for(int z = 0; z < layers; z++)
+        for(int y = 0; y < ydim; y++)
+            for(size_t r = runs.rowstart[(size_t) z * ydim + y]; r < runs.rowstart[(size_t) z * ydim + y + 1]; r++)
+            {
+                VoxelComponent &comp = comps[runs.label[r]];
+
+                comp.size += (size_t) (runs.end[r] - runs.start[r]);
+                comp.lo[0] = std::min(comp.lo[0], runs.start[r]);
+                comp.hi[0] = std::max(comp.hi[0], runs.end[r] - 1);
+                comp.lo[1] = std::min(comp.lo[1], y);
+                comp.hi[1] = std::max(comp.hi[1], y);
+                comp.lo[2] = std::min(comp.lo[2], z);
+                comp.hi[2] = z;
+                if(runs.start[r] == 0 || runs.end[r] == xdim || y == 0 || y == ydim-1 || z == 0 || z == zdim-1)
+                    comp.border = true;
+            }
+}
+
+void VoxelVolume::setRuns(const VoxelRuns &runs, const std::vector<char> &chosen, bool setval)
+{
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = 0; z < zdim; z++) // rows are distinct words, so layers can be written concurrently
+        for(int y = 0; y < ydim; y++)
+            for(size_t r = runs.rowstart[(size_t) z * ydim + y]; r < runs.rowstart[(size_t) z * ydim + y + 1]; r++)
+                if(chosen[runs.label[r]])
+                    setSpan(runs.start[r], runs.end[r], y, z, setval);
+
+    if(sparse)
+    {
+        int numbricks = (int) bricks.size();
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(int b = 0; b < numbricks; b++)
+            collapseBrick(b);
+        memtally.set(getStorageBytes());
+    }
+}
+
+int VoxelVolume::getComponents(std::vector<VoxelComponent> &comps)
+{
+    VoxelRuns runs;
+
+    labelRuns(true, runs, comps);
+    return (int) comps.size();
+}
+
+int VoxelVolume::keepLargest()
+{
+    VoxelRuns runs;
+    std::vector<VoxelComponent> comps;
+    int largest = 0;
+
+    labelRuns(true, runs, comps);
+    if(comps.size() <= 1)
+        return 0;
+    for(int c = 1; c < (int) comps.size(); c++)
+        if(comps[c].size > comps[largest].size)
+            largest = c;
+
+    std::vector<char> chosen(comps.size(), 1);
+    chosen[largest] = 0;
+    setRuns(runs, chosen, false);
+    return (int) comps.size() - 1;
+}
+
+int VoxelVolume::fillVoids()
+{
+    VoxelRuns runs;
+    std::vector<VoxelComponent> comps;
+    int voids = 0;
+
+    labelRuns(false, runs, comps);
+    std::vector<char> chosen(comps.size(), 0);
+    for(int c = 0; c < (int) comps.size(); c++)
+        if(!comps[c].border)
+        {
+            chosen[c] = 1;
+            voids++;
+        }
+    if(voids > 0)
+        setRuns(runs, chosen, true);
+    return voids;
+}
+
+void VoxelVolume::getShellVoxels(std::vector<int> &cells)
+{
+    std::vector<std::vector<int>> slabs(std::max(zdim, 0));
+    size_t total = 0;
+
+    cells.clear();
+    if(xspan <= 0)
+        return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = 0; z < zdim; z++)
+        for(int y = 0; y < ydim; y++)
+            for(int w = 0; w < xspan; w++)
+            {
+                unsigned int surf = shellWord(w, y, z);
+
+                for(int b = 0; surf != 0u && b < intsize; b++)
+                    if(surf & (0x80000000u >> b))
+                    {
+                        slabs[z].push_back(w * intsize + b);
+                        slabs[z].push_back(y);
+                        slabs[z].push_back(z);
+                        surf &= ~(0x80000000u >> b);
+                    }
+            }
+
+    for(int z = 0; z < zdim; z++)
+        total += slabs[z].size();
+    cells.reserve(total);
+    for(int z = 0; z < zdim; z++)
+        cells.insert(cells.end(), slabs[z].begin(), slabs[z].end());
+}
+
+void VoxelVolume::getSurfaceVoxels(std::vector<cgp::Point> &centres)
+{
+    std::vector<int> cells;
+
+    getShellVoxels(cells);
+    centres.resize(cells.size() / 3);
+
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < (int) centres.size(); i++)
+        centres[i] = getVoxelPos(cells[3*i], cells[3*i+1], cells[3*i+2]);
+}
+
+bool VoxelVolume::getOccupancy(int block, std::vector<unsigned char> &occ, int * odim)
+{
+    int bwords;
+
+    if(block <= 0 || block % voxwordbits != 0)
+    {
+        cerr << "Error VoxelVolume::getOccupancy: block size " << block << " is not a multiple of " << voxwordbits << endl;
+        return false;
+    }
+    bwords = block / voxwordbits;
+    odim[0] = (xspan + bwords - 1) / bwords;
+    odim[1] = (ydim + block - 1) / block;
+    odim[2] = (zdim + block - 1) / block;
+    occ.assign((size_t) odim[0] * odim[1] * odim[2], 0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int bz = 0; bz < odim[2]; bz++)
+        for(int by = 0; by < odim[1]; by++)
+            for(int bx = 0; bx < odim[0]; bx++)
+            {
+                bool any = false;
+
+                // a block is settled by its first occupied word
+                for(int z = bz * block; z < std::min((bz+1) * block, zdim) && !any; z++)
+                    for(int y = by * block; y < std::min((by+1) * block, ydim) && !any; y++)
+                        for(int w = bx * bwords; w < std::min((bx+1) * bwords, xspan) && !any; w++)
+                            any = maskedWord(w, y, z) != 0u;
+                occ[((size_t) bz * odim[1] + by) * odim[0] + bx] = any ? 1 : 0;
+            }
+    return true;
+}
+
 cgp::Point VoxelVolume::getVoxelPos(int x, int y, int z)
 {
     cgp::Point pnt;
@@ -219,14 +1848,49 @@ cgp::Point VoxelVolume::getVoxelPos(int x, int y, int z)
     return pnt;
 }
 
+bool VoxelVolume::getVoxelRange(cgp::BoundBox bbox, int * lo, int * hi)
+{
+    float start[3] = {origin.x, origin.y, origin.z};
+    float extent[3] = {diagonal.i, diagonal.j, diagonal.k};
+    float bmin[3] = {bbox.min.x, bbox.min.y, bbox.min.z};
+    float bmax[3] = {bbox.max.x, bbox.max.y, bbox.max.z};
+    int dim[3] = {xdim, ydim, zdim};
+    float step, flo, fhi;
+
+    for(int a = 0; a < 3; a++)
+    {
+        if(dim[a] <= 0 || bmin[a] > bmax[a]) // empty volume or empty box
+            return false;
+        step = (dim[a] > 1) ? extent[a] / (float) (dim[a]-1) : 0.0f;
+        if(step <= 0.0f) // degenerate frame, so no culling along this axis
+        {
+            lo[a] = 0; hi[a] = dim[a]-1;
+            continue;
+        }
+
+        // voxel centres are spaced evenly from the origin, widen by one voxel to be conservative
+        flo = floorf((bmin[a] - start[a]) / step);
+        fhi = ceilf((bmax[a] - start[a]) / step);
+        if(fhi < 0.0f || flo > (float) (dim[a]-1))
+            return false;
+        lo[a] = (flo < 0.0f) ? 0 : (int) flo;
+        hi[a] = (fhi > (float) (dim[a]-1)) ? dim[a]-1 : (int) fhi;
+    }
+    return true;
+}
+
 int VoxelVolume::getMCVertIdx(int x, int y, int z)
 {
     bool cube[8];
     int i, idx = 0;
 
-    // flatten 8 voxel vertex values into an array
-    for(i = 0; i < 8; i++)
-        cube[i] = get(x+cubePos[i][0], y+cubePos[i][1], z+cubePos[i][2]);
+    // flatten 8 voxel vertex values into an array, skipping the bounds checks for cells wholly inside the volume
+    if(x >= 0 && x < xdim-1 && y >= 0 && y < ydim-1 && z >= 0 && z < zdim-1)
+        for(i = 0; i < 8; i++)
+            cube[i] = getUnchecked(x+cubePos[i][0], y+cubePos[i][1], z+cubePos[i][2]);
+    else
+        for(i = 0; i < 8; i++)
+            cube[i] = get(x+cubePos[i][0], y+cubePos[i][1], z+cubePos[i][2]);
 
     // construct bit index code, 1 for outside, 0 for inside
     for(i = 0; i < 8; i++)
@@ -235,6 +1899,100 @@ int VoxelVolume::getMCVertIdx(int x, int y, int z)
     return idx;
 }
 
+bool VoxelVolume::getMCRowCodes(int y, int z, unsigned char * codes)
+{
+    const unsigned int * rows[4];
+    int w, r;
+    std::vector<unsigned int> rowbuf;
+
+    if(y < 0 || y >= ydim-1 || z < 0 || z >= zdim-1)
+    {
+        cerr << "Error VoxelVolume::getMCRowCodes: row (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+
+    // rows at (y, z), (y+1, z), (y, z+1), (y+1, z+1)
+    if(sparse) // gather rows from their bricks
+    {
+        rowbuf.resize(4 * xspan);
+        for(r = 0; r < 4; r++)
+        {
+            for(w = 0; w < xspan; w++)
+                rowbuf[r * xspan + w] = getWord(w, y + (r & 1), z + (r >> 1));
+            rows[r] = &rowbuf[r * xspan];
+        }
+    }
+    else
+    {
+        rows[0] = (const unsigned int *) &voxgrid[z * (xspan * ydim) + y * xspan];
+        rows[1] = rows[0] + xspan;
+        rows[2] = rows[0] + xspan * ydim;
+        rows[3] = rows[2] + xspan;
+    }
+
+    return rowCodes(rows, xdim, codes);
+}
+
+bool VoxelVolume::rowCodes(const unsigned int * const * rows, int dimx, unsigned char * codes)
+{
+    unsigned int corner[8], cur, shifted, all, any, mask;
+    int w, r, i, j, ncells, xspan = dimx / voxwordbits;
+    bool active = false;
+
+    for(w = 0; w < xspan; w++)
+    {
+        ncells = std::min(voxwordbits, dimx - 1 - w * voxwordbits);
+        if(ncells <= 0)
+            break;
+
+        // bit 31-j of each corner word holds that corner of cell w*voxwordbits+j, with the x+1 corners
+        // obtained by shifting in the first bit of the following word
+        for(r = 0; r < 4; r++)
+        {
+            cur = rows[r][w];
+            shifted = (cur << 1) | ((w+1 < xspan) ? (rows[r][w+1] >> 31) : 0u);
+            if(r == 0 || r == 2) // corners 0, 1 and 4, 5
+            {
+                corner[2*r] = cur;
+                corner[2*r+1] = shifted;
+            }
+            else // corners 3, 2 and 7, 6
+            {
+                corner[2*r+1] = cur;
+                corner[2*r] = shifted;
+            }
+        }
+
+        all = ~0u; any = 0u;
+        for(i = 0; i < 8; i++)
+        {
+            all &= corner[i];
+            any |= corner[i];
+        }
+        mask = ~0u << (voxwordbits - ncells);
+        if((any & mask) == 0u) // all corners outside
+        {
+            memset(&codes[w * voxwordbits], 255, ncells);
+        }
+        else if((all & mask) == mask) // all corners inside
+        {
+            memset(&codes[w * voxwordbits], 0, ncells);
+        }
+        else
+        {
+            active = true;
+            for(j = 0; j < ncells; j++) // 1 for outside, 0 for inside, as for getMCVertIdx
+            {
+                unsigned int code = 0;
+                for(i = 0; i < 8; i++)
+                    code |= ((~corner[i] >> (31 - j)) & 1u) << i;
+                codes[w * voxwordbits + j] = (unsigned char) code;
+            }
+        }
+    }
+    return active;
+}
+
 int VoxelVolume::getMCEdgeIdx(int vcode)
 {
     return cubeEdgeFlags[vcode];
@@ -8,26 +8,133 @@
 
 
 #include <vector>
+#include <string>
+#include <cassert>
 #include <stdio.h>
+#include <stdint.h>
 #include <iostream>
 #include "vecpnt.h"
+#include "contenthash.h"
+#include "snapshot.h"
+#include "common/memory.h"
+
+const char voxfilemagic[4] = {'T', 'V', 'O', 'X'}; ///< identifies a binary voxel file
+const int voxfileversion = 1;                     ///< current binary voxel file layout
+const int voxbrickrows = 8;                       ///< rows along y and z covered by a sparse brick, which is one word wide in x
+const int voxbrickwords = voxbrickrows * voxbrickrows; ///< packed words per sparse brick
+const int voxwordbits = 32;                       ///< voxels packed into each word of a row
+const int voxlabelslab = 16;                      ///< z layers whose runs one thread joins before the slabs are joined
+
+/// Structuring element of the morphological offsets VoxelVolume::dilate and VoxelVolume::erode
+enum class VoxelMorph
+{
+    BOX,    ///< cube of side 2k+1, so offsets keep flat faces and sharp corners
+    CROSS,  ///< voxels within k face steps, the six-neighbour cross applied k times
+    BALL    ///< voxels whose centres lie within Euclidean distance k, so offsets are uniform in every direction
+};
+
+/**
+ * Occupancy and extent of the voxels of a VoxelVolume, in voxel counts and in world units. A voxel is taken to be a
+ * cell of the spacing between voxel centres, as placed by VoxelVolume::getVoxelPos, centred on its voxel.
+ */
+struct VoxelStats
+{
+    size_t occupied;            ///< number of occupied voxels
+    size_t faces[3];            ///< occupied voxel faces with an empty neighbour, or the outside of the volume, across x, y and z
+    int lo[3];                  ///< lowest occupied voxel index in x, y and z, or -1 if no voxel is occupied
+    int hi[3];                  ///< highest occupied voxel index in x, y and z, or -1 if no voxel is occupied
+    std::vector<size_t> slices; ///< occupied voxels in each z layer
+    double volume;              ///< occupied volume in world units
+    double area;                ///< area of the exposed faces in world units
+    cgp::BoundBox bounds;       ///< world-space box enclosing the cells of the occupied voxels, reset if there are none
+
+    /// Total exposed faces across all three axes
+    size_t exposed() const { return faces[0] + faces[1] + faces[2]; }
+};
+
+/**
+ * A face-connected region of equal voxels in a VoxelVolume
+ */
+struct VoxelComponent
+{
+    size_t size;    ///< number of voxels
+    int lo[3];      ///< lowest voxel index in x, y and z
+    int hi[3];      ///< highest voxel index in x, y and z
+    bool border;    ///< some voxel lies on a face of the volume, so an empty region is open to the outside
+};
+
+/**
+ * Maximal runs of equal voxels along the rows of a VoxelVolume, with the connected component of each
+ */
+struct VoxelRuns
+{
+    std::vector<size_t> rowstart;   ///< first run of row (y, z) at index z * ydim + y, with the total at the end
+    std::vector<int> start;         ///< first voxel of each run along x
+    std::vector<int> end;           ///< one past the last voxel of each run along x
+    std::vector<int> label;         ///< component of each run
+};
+
+/**
+ * Fixed size header at the start of a binary voxel file, followed immediately by the raw voxgrid words.
+ * Padded to 64 bytes so that the mapped words are well aligned.
+ */
+struct VoxelFileHeader
+{
+    char magic[4];          ///< always voxfilemagic
+    int32_t version;        ///< layout version, currently voxfileversion
+    int32_t dim[3];         ///< number of voxels in x (padded), y and z dimensions
+    int32_t xspan;          ///< number of words per x row
+    int32_t intsize;        ///< number of bits per word
+    float origin[3];        ///< corner point of the volume in world space
+    float diagonal[3];      ///< diagonal extent of the volume in world space
+    int32_t pad[3];         ///< reserved, zero
+};
+
+/**
+ * Immutable copy of a volume, taken by VoxelVolume::takeSnapshot. Dense words are held in chunks and allocated
+ * bricks one to a chunk, so a snapshot taken after a local edit shares all but the changed chunks with its
+ * predecessor.
+ */
+struct VoxelSnapshot
+{
+    int dim[3];                             ///< number of voxels in x (padded), y and z dimensions
+    cgp::Point origin;                      ///< corner point in world space
+    cgp::Vector diagonal;                   ///< diagonal extent in world space
+    bool sparse;                            ///< words are held by brick rather than densely
+    std::vector<signed char> uniform;       ///< for each brick of a sparse volume, 0 if empty, 1 if full, -1 if held in words
+    SnapshotArray<unsigned int> words;      ///< dense words, or one chunk per held brick
+
+    VoxelSnapshot() : sparse(false) { dim[0] = dim[1] = dim[2] = 0; }
+};
 
 /**
  * A cuboid volume regularly subdivided into uniformly sized cubes (voxels). Bit packing is used to compress storage.
+ * Voxels are either held in a single dense array or, for large mostly uniform volumes, in sparse bricks of
+ * 32 x voxbrickrows x voxbrickrows voxels, where uniformly empty or full bricks share read-only storage and
+ * only bricks crossed by a surface are allocated.
  */
 class VoxelVolume
 {
 private:
     int * voxgrid;  ///< flattened voxel volume, bit packed to save memory
+    size_t gridbytes;   ///< size voxgrid was allocated with, unless it points into a mapping
     int xdim;       ///< number of voxels in x dimension
     int ydim;       ///< number of voxels in y dimension
     int zdim;       ///< number of voxels in z dimension
     int xspan;      ///< number of integers used to represent xdim
     int intsize;    ///< size of an integer in bits
 
+    void * mapping;     ///< memory mapped file backing voxgrid, or NULL if voxgrid is heap allocated
+    size_t maplen;      ///< length of the memory mapping in bytes
+
+    bool sparse;                            ///< voxels are stored in bricks rather than voxgrid
+    int bdim[3];                            ///< number of bricks along x (one per word), y and z
+    std::vector<unsigned int *> bricks;     ///< brick table, with uniform bricks pointing at shared storage
+
     cgp::Point origin;     ///< corner point in world space
     cgp::Vector diagonal;  ///< diagonal extent of the volume in world space
     cgp::Vector cell;      ///< diagonal extent of a single voxel cell
+    stats::MemoryTally memtally;    ///< bytes of voxgrid or of the owned bricks and brick table
 
     /**
      * Convert from 3D position to voxgrid index, including the bit position
@@ -42,6 +149,113 @@ private:
     /// Calculate the diagonal extent of a single cell and store internally
     void calcCellDiag();
 
+    /**
+     * Check that another volume has the same dimensions, so that the two can be combined word by word
+     * @param other     volume being compared
+     * @param caller    name of the calling method, for error reporting
+     * @retval true if the dimensions match,
+     * @retval false otherwise, with an error message.
+     */
+    bool matchDim(VoxelVolume * other, const char * caller);
+
+    /**
+     * Shared, read-only storage for uniform bricks
+     * @param full  true for a brick with all voxels occupied, false for an empty brick
+     * @returns words of the uniform brick
+     */
+    static unsigned int * uniformBrick(bool full);
+
+    /// Test whether a brick uses shared uniform storage
+    static bool isUniform(const unsigned int * brick){ return brick == uniformBrick(false) || brick == uniformBrick(true); }
+
+    /// Index into the brick table of the brick containing word w of row (y, z)
+    int brickIndex(int w, int y, int z){ return ((z / voxbrickrows) * bdim[1] + y / voxbrickrows) * bdim[0] + w; }
+
+    /// Position of row (y, z) within its brick
+    int brickOffset(int y, int z){ return (z % voxbrickrows) * voxbrickrows + y % voxbrickrows; }
+
+    /**
+     * Read access to a packed word, for either storage scheme
+     * @param w     word index along the row
+     * @param y, z  row containing the word, not bounds checked
+     * @returns word holding voxels w*intsize to (w+1)*intsize-1 of the row
+     */
+    unsigned int getWord(int w, int y, int z)
+    {
+        if(sparse)
+            return bricks[brickIndex(w, y, z)][brickOffset(y, z)];
+        return (unsigned int) voxgrid[((size_t) z * ydim + y) * xspan + w];
+    }
+
+    /// Header of the binary voxel format describing this volume
+    void fillFileHeader(VoxelFileHeader &hdr);
+
+    /**
+     * Read access to a packed word with padding bits past the end of the row cleared
+     * @param w     word index along the row
+     * @param y, z  row containing the word
+     * @returns word holding voxels w*intsize to (w+1)*intsize-1 of the row, or 0 if outside the volume
+     */
+    unsigned int maskedWord(int w, int y, int z);
+
+    /**
+     * Occupied voxels of a word that have at least one empty face neighbour, found by shifting and ANDing the word
+     * against its neighbours along the row and the four adjacent rows
+     * @param w     word index along the row
+     * @param y, z  row containing the word
+     * @returns boundary shell bits of the word
+     */
+    unsigned int shellWord(int w, int y, int z);
+
+    /**
+     * Write access to a packed word, for either storage scheme. A uniform brick is given its own storage first,
+     * so only call this when the word is about to change. Safe for concurrent writes to different rows.
+     * @param w     word index along the row
+     * @param y, z  row containing the word, not bounds checked
+     * @returns pointer to the word
+     */
+    unsigned int * editWord(int w, int y, int z);
+
+    /**
+     * Return an allocated brick to shared storage if all of its voxels within the volume have the same value
+     * @param b     index into the brick table
+     */
+    void collapseBrick(int b);
+
+    /**
+     * Combine with another volume when either one is sparse or only part of the volume is combined
+     * @param other     second argument, must have matching dimensions
+     * @param op        0 for union, 1 for intersection, 2 for difference
+     * @param lo, hi    inclusive voxel range to combine, or NULL for the whole volume
+     */
+    void combineRegion(VoxelVolume * other, int op, const int * lo, const int * hi);
+
+    /**
+     * Apply dilate or erode
+     * @param k     offset in voxels, at least 1
+     * @param elem  structuring element
+     * @param grow  true to dilate, false to erode
+     */
+    void offset(int k, VoxelMorph elem, bool grow);
+
+    /**
+     * Label the face-connected components of occupied or empty voxels. Runs are read from whole words, joined to
+     * overlapping runs in the rows below and behind by union-find, slabs of voxlabelslab layers in parallel and then
+     * across slabs, and numbered in order of their first voxel by z, then y, then x.
+     * @param value         true to label occupied voxels, false to label empty ones
+     * @param[out] runs     runs of @a value with their components
+     * @param[out] comps    size and bounds of each component
+     */
+    void labelRuns(bool value, VoxelRuns &runs, std::vector<VoxelComponent> &comps);
+
+    /**
+     * Set every voxel of chosen components
+     * @param runs      runs labelled by labelRuns
+     * @param chosen    non-zero for each component to set
+     * @param setval    new value of the voxels
+     */
+    void setRuns(const VoxelRuns &runs, const std::vector<char> &chosen, bool setval);
+
 public:
 
     /// Default constructor
@@ -63,12 +277,137 @@ public:
      */
     void clear();
 
+    /**
+     * Test whether a file starts with a binary voxel header
+     * @param filename  name of file to check
+     * @retval true if the file is in binary voxel format,
+     * @retval false otherwise (e.g., text grid or missing).
+     */
+    static bool isVoxelFile(std::string filename);
+
+    /**
+     * Read a volume from binary voxel format, replacing the current dimensions, frame and contents.
+     * The file is memory mapped copy-on-write where possible, so loading does not copy the voxel words.
+     * @param filename  name of file to load
+     * @retval true  if load succeeds,
+     * @retval false otherwise.
+     */
+    bool readVoxels(std::string filename);
+
+    /**
+     * Write the volume in binary voxel format: a header with dimensions and frame, followed by the raw bit-packed words
+     * @param filename  name of file to save
+     * @retval true  if save succeeds,
+     * @retval false otherwise.
+     */
+    bool writeVoxels(std::string filename);
+
+    /**
+     * Number of bytes encodeVoxels writes, which is the size of the file writeVoxels produces
+     */
+    size_t getVoxelFileBytes();
+
+    /**
+     * Encode the volume in binary voxel format, as writeVoxels does, into memory such as a shared segment, so that a
+     * reader can use the words in place. Sparse volumes are written out dense.
+     * @param buf   destination of getVoxelFileBytes bytes, aligned for unsigned int
+     */
+    void encodeVoxels(char * buf);
+
+    /**
+     * Test whether a file starts with the OpenVDB signature
+     * @param filename  name of file to check
+     * @retval true if the file is an OpenVDB file,
+     * @retval false otherwise
+     */
+    static bool isVDBFile(std::string filename);
+
+    /**
+     * Read the first bool grid of an OpenVDB file, with active true voxels occupied, replacing the dimensions, frame
+     * and contents. The volume switches to sparse storage and receives one brick per run of leaf nodes holding active
+     * voxels, so memory follows the active region rather than its bounding box. The frame encloses the active voxels
+     * with an empty margin, aligned to whole bricks in grid index space. Needs a build with OPENVDB.
+     * @param filename  name of file to load
+     * @retval true  if load succeeds,
+     * @retval false if the file is unreadable, has no bool grid, its transform is not axis aligned, or OpenVDB is missing
+     */
+    bool readVDB(std::string filename);
+
+    /**
+     * Write the volume as a bool grid named "occupancy", with voxel (x, y, z) at grid index (x, y, z) and the
+     * transform placing it at getVoxelPos. Each brick maps onto leaf nodes, empty bricks are skipped and full ones
+     * become tiles, so a sparse volume is never densified. Needs a build with OPENVDB.
+     * @param filename  name of file to save
+     * @retval true  if save succeeds,
+     * @retval false otherwise.
+     */
+    bool writeVDB(std::string filename);
+
+    /**
+     * Add the dimensions, frame and voxel contents to a hash, so that equal volumes hash equally whether dense or sparse
+     * @param hash  hash being accumulated
+     */
+    void hashContent(ContentHash &hash);
+
+    /**
+     * Hash of the dimensions, frame and voxel contents, computed a layer at a time in parallel and joined in a fixed
+     * order, so that it is the same for any number of threads and for dense and sparse storage
+     * @returns 64-bit content hash
+     */
+    uint64_t checksum();
+
+    /**
+     * Copy the volume into an immutable snapshot, sharing the unchanged chunks of an earlier one
+     * @param[out] snap     snapshot receiving the dimensions, frame and voxels
+     * @param prev          snapshot the volume was most likely derived from, or NULL
+     * @param alt           another snapshot to share chunks with where @a prev has changed, or NULL
+     * @returns bytes of storage allocated for the snapshot rather than shared with @a prev or @a alt
+     */
+    size_t takeSnapshot(VoxelSnapshot &snap, const VoxelSnapshot * prev = NULL, const VoxelSnapshot * alt = NULL);
+
+    /**
+     * Replace the volume with the contents of a snapshot, with the storage scheme it was taken with
+     * @param snap  snapshot from takeSnapshot
+     */
+    void restoreSnapshot(const VoxelSnapshot &snap);
+
+    /**
+     * Write the dimensions, frame and voxels to a Boost archive. A dense volume is written as one block of words,
+     * and a sparse one as the kind of each brick followed by the words of each allocated brick, so uniform bricks
+     * take a byte apiece. Instantiated for the binary archives.
+     * @param ar    output archive
+     */
+    template<class Archive> void save(Archive & ar, const unsigned int version) const;
+
+    /**
+     * Replace the volume with one written by save, with the storage scheme it was written with
+     * @param ar    input archive
+     */
+    template<class Archive> void load(Archive & ar, const unsigned int version);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
     /**
      * Set all voxel elements in volume to empty or occupied
      * @param setval    new value for all voxel elements, either empty (false) or occupied (true)
      */
     void fill(bool setval);
 
+    /**
+     * Switch between dense and sparse storage, preserving the voxel contents
+     * @param on    true for sparse bricks, false for a dense array
+     */
+    void setSparse(bool on);
+
+    /// Test whether voxels are stored in sparse bricks
+    bool isSparse(){ return sparse; }
+
+    /**
+     * Memory currently used to hold the voxels
+     * @returns bytes allocated for dense words, or for the brick table and allocated bricks
+     */
+    size_t getStorageBytes();
+
     /**
      * Obtain the dimensions of the voxel volume
      * @param dimx, dimy, dimz     number of voxels in x, y, z dimensions
@@ -110,6 +449,37 @@ public:
      */
     bool set(int x, int y, int z, bool setval);
 
+    /**
+     * Set a contiguous run of voxels along the x axis to either empty or occupied, a word at a time.
+     * Writes for different (y, z) rows never touch the same word, so rows can be filled concurrently.
+     * @param xstart    first voxel in the run, clamped to the volume
+     * @param xend      one past the last voxel in the run, clamped to the volume
+     * @param y, z      row containing the run, zero indexed
+     * @param setval    new voxel value, either empty (false) or occupied (true)
+     * @retval true if the row is within volume bounds,
+     * @retval false otherwise.
+     */
+    bool setSpan(int xstart, int xend, int y, int z, bool setval);
+
+    /**
+     * Overwrite a whole row of voxels along the x axis with packed words. Writes for different (y, z) rows
+     * never touch the same word, so rows can be written concurrently.
+     * @param y, z      row to write, zero indexed
+     * @param words     xspan words, with the voxel at x held in bit 31-(x%32) of word x/32
+     * @retval true if the row is within volume bounds,
+     * @retval false otherwise.
+     */
+    bool setRow(int y, int z, const unsigned int * words);
+
+    /**
+     * Copy a whole row of voxels along the x axis into packed words, as written by setRow
+     * @param y, z      row to read, zero indexed
+     * @param[out] words  xspan words, with the voxel at x held in bit 31-(x%32) of word x/32
+     * @retval true if the row is within volume bounds,
+     * @retval false otherwise.
+     */
+    bool getRow(int y, int z, unsigned int * words);
+
     /**
      * Get the status of a single voxel element at the specified position
      * @param x, y, z   3D location, zero indexed
@@ -118,6 +488,156 @@ public:
      */
     bool get(int x, int y, int z);
 
+    /**
+     * Unchecked version of get for loops that already stay within the volume. Bounds are asserted in debug builds only.
+     * @param x, y, z   3D location, zero indexed and within the volume
+     * @retval true if the voxel is occupied,
+     * @retval false if the voxel is empty.
+     */
+    bool getUnchecked(int x, int y, int z)
+    {
+        assert(x >= 0 && x < xdim && y >= 0 && y < ydim && z >= 0 && z < zdim);
+        return (getWord(x / voxwordbits, y, z) >> (voxwordbits - 1 - x % voxwordbits)) & 0x1u;
+    }
+
+    /**
+     * Unchecked version of set for loops that already stay within the volume. Bounds are asserted in debug builds only.
+     * Not safe for concurrent writes to the same word.
+     * @param x, y, z   3D location, zero indexed and within the volume
+     * @param setval    new voxel value, either empty (false) or occupied (true)
+     */
+    void setUnchecked(int x, int y, int z, bool setval)
+    {
+        unsigned int bit = 0x1u << (voxwordbits - 1 - x % voxwordbits);
+
+        assert(x >= 0 && x < xdim && y >= 0 && y < ydim && z >= 0 && z < zdim);
+        if(((getWord(x / voxwordbits, y, z) & bit) != 0u) != setval) // leaves shared uniform bricks alone otherwise
+        {
+            unsigned int * word = editWord(x / voxwordbits, y, z);
+            * word = setval ? (* word | bit) : (* word & ~bit);
+        }
+    }
+
+    /**
+     * Unchecked read of a packed word, with the voxel at x held in bit 31-(x%32) of word x/32 as for setRow.
+     * Bounds are asserted in debug builds only.
+     * @param w     word index along the row, less than getXSpan()
+     * @param y, z  row containing the word, within the volume
+     * @returns word holding voxels w*32 to w*32+31 of the row
+     */
+    unsigned int getWordUnchecked(int w, int y, int z)
+    {
+        assert(w >= 0 && w < xspan && y >= 0 && y < ydim && z >= 0 && z < zdim);
+        return getWord(w, y, z);
+    }
+
+    /**
+     * Unchecked write of some of the voxels of a packed word, leaving shared uniform bricks alone if nothing changes.
+     * Bounds are asserted in debug builds only. Not safe for concurrent writes to the same word.
+     * @param w     word index along the row, less than getXSpan()
+     * @param y, z  row containing the word, within the volume
+     * @param mask  voxels of the word to write, laid out as for getWordUnchecked
+     * @param bits  new values of the voxels under @a mask
+     */
+    void setWordUnchecked(int w, int y, int z, unsigned int mask, unsigned int bits)
+    {
+        unsigned int cur;
+
+        assert(w >= 0 && w < xspan && y >= 0 && y < ydim && z >= 0 && z < zdim);
+        cur = getWord(w, y, z);
+        if(((cur ^ bits) & mask) != 0u)
+            * editWord(w, y, z) = (cur & ~mask) | (bits & mask);
+    }
+
+    /**
+     * Contiguous view of the packed words of a row, for loops that scan whole rows at memory bandwidth. Valid until
+     * the volume is resized or its storage scheme changes.
+     * @param y, z  row to view, within the volume
+     * @returns getXSpan() words laid out as for setRow, or NULL if the volume is sparse, in which case the words of
+     *          a row lie in separate bricks and are read with getWordUnchecked instead
+     */
+    const unsigned int * rowWords(int y, int z)
+    {
+        assert(y >= 0 && y < ydim && z >= 0 && z < zdim);
+        if(sparse || voxgrid == NULL)
+            return NULL;
+        return (const unsigned int *) &voxgrid[((size_t) z * ydim + y) * xspan];
+    }
+
+    /**
+     * Set union with another volume of the same dimensions, applied to whole words of packed voxels at a time
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the union leaves this volume unchanged, so
+     *                  that only the region inside needs combining. Whole words and bricks around it may be combined too.
+     * @retval true if the dimensions match and the union was applied,
+     * @retval false otherwise.
+     */
+    bool unionWith(VoxelVolume * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Set intersection with another volume of the same dimensions, applied to whole words of packed voxels at a time
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the intersection leaves this volume unchanged, so
+     *                  that only the region inside needs combining. Whole words and bricks around it may be combined too.
+     * @retval true if the dimensions match and the intersection was applied,
+     * @retval false otherwise.
+     */
+    bool intersectWith(VoxelVolume * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Set difference (this volume minus other) with another volume of the same dimensions, applied to whole words of packed voxels at a time
+     * @param other     second argument, left unchanged
+     * @param lo, hi    optional inclusive voxel range outside of which the difference leaves this volume unchanged, so
+     *                  that only the region inside needs combining. Whole words and bricks around it may be combined too.
+     * @retval true if the dimensions match and the difference was applied,
+     * @retval false otherwise.
+     */
+    bool subtract(VoxelVolume * other, const int * lo = NULL, const int * hi = NULL);
+
+    /**
+     * Grow the occupied voxels outward by a structuring element, as when giving a part clearance or bulk. Box
+     * offsets are separable passes over packed words, each doubling the distance covered so far, and cross
+     * offsets are k passes of the six-neighbour step, while ball offsets threshold an exact squared Euclidean
+     * distance transform. Every pass runs in parallel over rows, through dense working copies of the volume.
+     * @param k     offset in voxels
+     * @param elem  structuring element
+     * @retval true if the offset was applied,
+     * @retval false if @a k is negative
+     */
+    bool dilate(int k, VoxelMorph elem = VoxelMorph::BOX);
+
+    /**
+     * Shrink the occupied voxels inward by a structuring element, as when making a fit-tolerance variant of a part.
+     * The outside of the volume counts as empty, so voxels within @a k of its faces are removed too. Evaluated as
+     * for dilate.
+     * @param k     offset in voxels
+     * @param elem  structuring element
+     * @retval true if the offset was applied,
+     * @retval false if @a k is negative
+     */
+    bool erode(int k, VoxelMorph elem = VoxelMorph::BOX);
+
+    /**
+     * Find the face-connected components of occupied voxels, working on runs within packed words rather than on
+     * single voxels, with slabs labelled in parallel
+     * @param[out] comps    size and bounds of each component, in order of their first voxel by z, then y, then x
+     * @returns number of components
+     */
+    int getComponents(std::vector<VoxelComponent> &comps);
+
+    /**
+     * Remove every occupied component but the largest, such as islands of noise left by csg, so they are not meshed.
+     * Ties go to the component found first.
+     * @returns number of components removed
+     */
+    int keepLargest();
+
+    /**
+     * Fill every empty component that does not reach a face of the volume, the voids trapped inside a part
+     * @returns number of voids filled
+     */
+    int fillVoids();
+
     /**
      * Find the world-space position of the centre of a voxel
      * @param x, y, z   3D location, zero indexed
@@ -125,6 +645,57 @@ public:
      */
     cgp::Point getVoxelPos(int x, int y, int z);
 
+    /**
+     * Extract the boundary shell, every occupied voxel with at least one empty face neighbour, treating the outside
+     * of the volume as empty. Whole words of packed voxels are compared against their neighbouring rows, so interior
+     * runs cost no per voxel work, and slabs are processed in parallel.
+     * @param[out] shell    resized to the dimensions and frame of this volume and set to the shell voxels,
+     *                      or NULL to only count them. Must not be this volume.
+     * @returns number of shell voxels
+     */
+    size_t getShell(VoxelVolume * shell);
+
+    /**
+     * Measure the occupied voxels, as when quoting a part. Each row is reduced a packed word at a time, counting
+     * voxels with popcount, exposed faces with popcount of the word less its shifted neighbours, and bounds from
+     * the leading and trailing occupied bits, so no per voxel work is done. Slabs are measured in parallel.
+     * @param[out] stats    counts, bounds, per-slice occupancy and world-space measures
+     */
+    void getStats(VoxelStats &stats);
+
+    /**
+     * Find the boundary shell as a compact list of voxel indices
+     * @param[out] cells    x, y, z index triples of the shell voxels, ordered by z, then y, then x
+     */
+    void getShellVoxels(std::vector<int> &cells);
+
+    /**
+     * Find the boundary shell as world-space points, as for getShellVoxels
+     * @param[out] centres  world-space centres of the surface voxels, ordered by z, then y, then x
+     */
+    void getSurfaceVoxels(std::vector<cgp::Point> &centres);
+
+    /**
+     * Find which cubic blocks of voxels hold any occupied voxel, as a coarse level over the packed words that lets a
+     * ray marcher step over empty space a block at a time
+     * @param block     edge of a block in voxels, a positive multiple of voxwordbits so that blocks cover whole words
+     * @param[out] occ  one byte per block, 1 if any voxel of the block is occupied and 0 otherwise, x fastest then y
+     * @param[out] odim number of blocks along each axis, with partial blocks at the far edges counted
+     * @retval true if the block size is valid,
+     * @retval false otherwise.
+     */
+    bool getOccupancy(int block, std::vector<unsigned char> &occ, int * odim);
+
+    /**
+     * Find the range of voxels whose centres could fall within a world-space box
+     * @param bbox      world-space axis-aligned box
+     * @param[out] lo   first voxel index in x, y and z, clipped to the volume
+     * @param[out] hi   last voxel index (inclusive) in x, y and z, clipped to the volume
+     * @retval true if the box overlaps the volume, in which case lo and hi are valid,
+     * @retval false otherwise.
+     */
+    bool getVoxelRange(cgp::BoundBox bbox, int * lo, int * hi);
+
     /**
      * Return the marching cubes vertex bit code for a voxel cell
      * (Required to shoehorn Bloyd's code into current framework - see http://paulbourke.net/geometry/polygonise/marchingsource.cpp)
@@ -133,13 +704,35 @@ public:
      */
     int getMCVertIdx(int x, int y, int z);
 
+    /**
+     * Compute the marching cubes vertex bit codes for a whole row of cells at once, by shifting and combining
+     * the packed words of the four voxel rows bounding the cells. Words whose cells are uniformly inside or
+     * outside are filled without examining individual bits.
+     * @param y, z      index of the lower, front corner of the cells in the row
+     * @param[out] codes  vertex bit code for each cell x in [0, xdim-1), must have room for xdim-1 entries
+     * @retval true if any cell in the row has a mix of inside and outside corners,
+     * @retval false if the row produces no surface (or is out of bounds)
+     */
+    bool getMCRowCodes(int y, int z, unsigned char * codes);
+
+    /**
+     * Compute marching cubes vertex bit codes for a row of cells from its four bounding voxel rows, as for
+     * getMCRowCodes, so that other stores of packed rows can supply marching cubes
+     * @param rows      packed words of the voxel rows at (y, z), (y+1, z), (y, z+1) and (y+1, z+1)
+     * @param dimx      number of voxels in x, a multiple of voxwordbits
+     * @param[out] codes  vertex bit code for each cell x in [0, dimx-1)
+     * @retval true if any cell in the row has a mix of inside and outside corners,
+     * @retval false otherwise
+     */
+    static bool rowCodes(const unsigned int * const * rows, int dimx, unsigned char * codes);
+
     /**
      * Return the marching cubes edge intersection bit code corresponding to a vertex bit code
      * (Required to shoehorn Bloyd's code into current framework - see http://paulbourke.net/geometry/polygonise/marchingsource.cpp)
      * @param vcode     vertex pattern bit code
      * @retval  edge bit code index for MC table
      */
-    int getMCEdgeIdx(int vcode);
+    static int getMCEdgeIdx(int vcode);
 
     /**
      * Return the marching cubes edge intersection corresponding to an edge bit position
@@ -147,7 +740,16 @@ public:
      * @param ebit  bit position corresponding to a cube edge
      * @retval      position in unit cube of the intersection point
      */
-    cgp::Point getMCEdgeXsect(int ebit);
+    static cgp::Point getMCEdgeXsect(int ebit);
+
+    /**
+     * Return the marching cubes edge intersection along an edge of a cell, matching DistanceField::getMCEdgeXsect
+     * so that marching cubes can run on either volume
+     * @param x, y, z   index of the cell, unused since boolean crossings are always at the edge midpoint
+     * @param ebit      bit position corresponding to a cube edge
+     * @retval          position in unit cube of the intersection point
+     */
+    cgp::Point getMCEdgeXsect(int x, int y, int z, int ebit){ return getMCEdgeXsect(ebit); }
 };
 
 #endif
@@ -0,0 +1,223 @@
+//
+// VoxelMesher
+//
+
+#include "voxmesher.h"
+#include <algorithm>
+
+using namespace std;
+
+// neighbour offset and cube corners, counterclockwise from outside, for each of the 6 cube faces
+static const int faceDir[6][3] =
+{
+    {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}
+};
+
+static const int faceCorner[6][4][3] =
+{
+    {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}}, // -x
+    {{1, 0, 0}, {1, 1, 0}, {1, 1, 1}, {1, 0, 1}}, // +x
+    {{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}}, // -y
+    {{0, 1, 0}, {0, 1, 1}, {1, 1, 1}, {1, 1, 0}}, // +y
+    {{0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}}, // -z
+    {{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}}  // +z
+};
+
+int VoxelMesher::corner(int i, int j, bool upper, int k, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts)
+{
+    int &idx = plane[upper ? 1 : 0][j * pdimx + i];
+
+    if(idx < 0) // first face to touch this corner
+    {
+        idx = (int) verts.size();
+        verts.push_back(cgp::Point(base.x + (float) i * step.i, base.y + (float) j * step.j, base.z + (float) k * step.k));
+    }
+    return idx;
+}
+
+int VoxelMesher::latticeCorner(const int * lc, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts)
+{
+    int64_t key = ((int64_t) lc[2] * (int64_t) pdimy + (int64_t) lc[1]) * (int64_t) pdimx + (int64_t) lc[0];
+    std::unordered_map<int64_t, int>::iterator it = cornermap.find(key);
+
+    if(it != cornermap.end())
+        return it->second;
+    cornermap[key] = (int) verts.size();
+    verts.push_back(cgp::Point(base.x + (float) lc[0] * step.i, base.y + (float) lc[1] * step.j, base.z + (float) lc[2] * step.k));
+    return (int) verts.size() - 1;
+}
+
+bool VoxelMesher::setLattice(VoxelVolume * vox, cgp::Point &base, cgp::Vector &step)
+{
+    int dx, dy, dz;
+    cgp::Point origin;
+    cgp::Vector diag;
+
+    vox->getDim(dx, dy, dz);
+    vox->getFrame(origin, diag);
+    if(dx <= 0 || dy <= 0 || dz <= 0)
+        return false;
+
+    // voxel centres are spaced evenly from the origin, with cube corners half a cell either side
+    step = cgp::Vector((dx > 1) ? diag.i / (float) (dx-1) : diag.i,
+                       (dy > 1) ? diag.j / (float) (dy-1) : diag.j,
+                       (dz > 1) ? diag.k / (float) (dz-1) : diag.k);
+    base = cgp::Point(origin.x - 0.5f * step.i, origin.y - 0.5f * step.j, origin.z - 0.5f * step.k);
+    pdimx = dx+1;
+    pdimy = dy+1;
+    return true;
+}
+
+void VoxelMesher::extract(VoxelVolume * vox, std::vector<cgp::Point> &verts, std::vector<int> &faces)
+{
+    cgp::Point base;
+    cgp::Vector step;
+
+    verts.clear();
+    faces.clear();
+    if(!setLattice(vox, base, step))
+        return;
+    if(greedy)
+        extractGreedy(vox, base, step, verts, faces);
+    else
+        extractFaces(vox, base, step, verts, faces);
+}
+
+bool VoxelMesher::extract(VoxelVolume * vox, STLStreamWriter &out)
+{
+    std::vector<cgp::Point> verts;
+    std::vector<int> faces;
+    cgp::Point base;
+    cgp::Vector step;
+
+    if(!setLattice(vox, base, step))
+        return out.isOpen();
+    if(greedy)
+        extractGreedy(vox, base, step, verts, faces);
+    else if(!extractFaces(vox, base, step, verts, faces, &out))
+        return false;
+    return out.append(verts, faces);
+}
+
+bool VoxelMesher::extractFaces(VoxelVolume * vox, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts, std::vector<int> &faces,
+                               STLStreamWriter * out)
+{
+    int x, y, z, f, c, nx, ny, nz, dx, dy, dz, quad[4], slab = 0;
+    std::vector<int> cells;
+
+    vox->getDim(dx, dy, dz);
+    plane[0].assign(pdimx * pdimy, -1);
+    plane[1].assign(pdimx * pdimy, -1);
+
+    // only shell voxels can expose a face, so the interior is skipped a word at a time
+    vox->getShellVoxels(cells);
+    for(int i = 0; i < (int) cells.size(); i += 3)
+    {
+        x = cells[i]; y = cells[i+1]; z = cells[i+2];
+
+        if(z > slab && out != NULL && (int) faces.size() >= voxmeshbatch) // hand on the finished layers and start afresh
+        {
+            if(!out->append(verts, faces))
+                return false;
+            verts.clear();
+            faces.clear();
+            plane[0].assign(pdimx * pdimy, -1);
+            plane[1].assign(pdimx * pdimy, -1);
+        }
+        else if(z == slab + 1) // upper plane of the previous slab becomes the lower plane of this one
+        {
+            plane[0].swap(plane[1]);
+            plane[1].assign(pdimx * pdimy, -1);
+        }
+        else if(z > slab) // no corners are shared across empty slabs
+        {
+            plane[0].assign(pdimx * pdimy, -1);
+            plane[1].assign(pdimx * pdimy, -1);
+        }
+        slab = z;
+
+        for(f = 0; f < 6; f++)
+        {
+            nx = x + faceDir[f][0]; ny = y + faceDir[f][1]; nz = z + faceDir[f][2];
+            if(nx >= 0 && nx < dx && ny >= 0 && ny < dy && nz >= 0 && nz < dz && vox->getUnchecked(nx, ny, nz))
+                continue; // face is shared with an occupied neighbour
+
+            for(c = 0; c < 4; c++)
+                quad[c] = corner(x + faceCorner[f][c][0], y + faceCorner[f][c][1], faceCorner[f][c][2] == 1,
+                                 z + faceCorner[f][c][2], base, step, verts);
+            faces.push_back(quad[0]); faces.push_back(quad[1]); faces.push_back(quad[2]);
+            faces.push_back(quad[0]); faces.push_back(quad[2]); faces.push_back(quad[3]);
+        }
+    }
+    return true;
+}
+
+void VoxelMesher::extractGreedy(VoxelVolume * vox, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts, std::vector<int> &faces)
+{
+    int dim[3], d, u, v, sgn, slice, i, j, w, h, k, c, p[3], q[3], lc[4][3], quad[4];
+    vector<char> mask;
+    bool grow;
+
+    vox->getDim(dim[0], dim[1], dim[2]);
+    cornermap.clear();
+
+    for(d = 0; d < 3; d++) // face normal axis, with (d, u, v) a cyclic permutation so that u x v points along +d
+    {
+        u = (d+1)%3;
+        v = (d+2)%3;
+        mask.assign(dim[u] * dim[v], 0);
+        for(sgn = -1; sgn <= 1; sgn += 2)
+            for(slice = 0; slice < dim[d]; slice++)
+            {
+                // exposed faces of this slice pointing along sgn * d
+                for(j = 0; j < dim[v]; j++)
+                    for(i = 0; i < dim[u]; i++)
+                    {
+                        p[d] = slice; p[u] = i; p[v] = j;
+                        q[0] = p[0]; q[1] = p[1]; q[2] = p[2];
+                        q[d] += sgn;
+                        mask[j * dim[u] + i] = vox->getUnchecked(p[0], p[1], p[2]) &&
+                                               (q[d] < 0 || q[d] >= dim[d] || !vox->getUnchecked(q[0], q[1], q[2]));
+                    }
+
+                // cover the mask with maximal rectangles, growing first along u and then along v
+                for(j = 0; j < dim[v]; j++)
+                    for(i = 0; i < dim[u]; )
+                    {
+                        if(!mask[j * dim[u] + i])
+                        {
+                            i++;
+                            continue;
+                        }
+                        for(w = 1; i + w < dim[u] && mask[j * dim[u] + i + w]; w++);
+                        grow = true;
+                        for(h = 1; grow && j + h < dim[v]; )
+                        {
+                            for(k = 0; k < w && grow; k++)
+                                grow = (mask[(j + h) * dim[u] + i + k] != 0);
+                            if(grow)
+                                h++;
+                        }
+                        for(k = 0; k < h; k++)
+                            for(c = 0; c < w; c++)
+                                mask[(j + k) * dim[u] + i + c] = 0;
+
+                        // rectangle corners, counterclockwise about +d
+                        for(c = 0; c < 4; c++)
+                            lc[c][d] = slice + ((sgn > 0) ? 1 : 0);
+                        lc[0][u] = i;     lc[0][v] = j;
+                        lc[1][u] = i + w; lc[1][v] = j;
+                        lc[2][u] = i + w; lc[2][v] = j + h;
+                        lc[3][u] = i;     lc[3][v] = j + h;
+                        for(c = 0; c < 4; c++)
+                            quad[c] = latticeCorner(lc[c], base, step, verts);
+                        if(sgn < 0) // reverse winding for faces pointing along -d
+                            std::swap(quad[1], quad[3]);
+                        faces.push_back(quad[0]); faces.push_back(quad[1]); faces.push_back(quad[2]);
+                        faces.push_back(quad[0]); faces.push_back(quad[2]); faces.push_back(quad[3]);
+                        i += w;
+                    }
+            }
+    }
+    cornermap.clear();
+}
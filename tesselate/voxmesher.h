@@ -0,0 +1,124 @@
+/**
+ * @file
+ *
+ * Extraction of the exposed block surface of a voxel volume, with each occupied voxel treated as a solid cube.
+ */
+
+#ifndef _VOXMESHER
+#define _VOXMESHER
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "vecpnt.h"
+#include "voxels.h"
+#include "stlstream.h"
+
+const int voxmeshbatch = 1 << 18; ///< triangle vertex indices gathered before the face-culled mesher hands them to a stream
+
+/**
+ * Converts a VoxelVolume into a closed triangle mesh of axis-aligned cubes in a single pass. Only faces between an
+ * occupied and an empty voxel are emitted, and cube corners are shared between faces through a per-slab index table,
+ * so the output is indexed directly and needs no vertex merging.
+ */
+class VoxelMesher
+{
+private:
+    std::vector<int> plane[2];  ///< vertex index of each lattice corner on the lower and upper planes of the current slab
+    int pdimx;                  ///< number of lattice corners along x in a plane
+    int pdimy;                  ///< number of lattice corners along y in a plane
+    bool greedy;                ///< merge coplanar exposed faces into maximal rectangles
+    std::unordered_map<int64_t, int> cornermap; ///< vertex index of each lattice corner used by greedy meshing
+
+    /**
+     * Find or create the vertex at a lattice corner of the current slab
+     * @param i, j      lattice corner position within the plane
+     * @param upper     true for the upper plane of the slab, false for the lower plane
+     * @param k         lattice corner position along z, used to place a new vertex
+     * @param base      world-space position of lattice corner (0, 0, 0)
+     * @param step      world-space spacing between lattice corners
+     * @param[out] verts vertex list, extended if the corner has no vertex yet
+     * @return index of the corner vertex
+     */
+    int corner(int i, int j, bool upper, int k, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts);
+
+    /**
+     * Find or create the vertex at a lattice corner anywhere in the volume, used when rectangles span many slabs
+     * @param lc        lattice corner position in x, y and z
+     * @param base      world-space position of lattice corner (0, 0, 0)
+     * @param step      world-space spacing between lattice corners
+     * @param[out] verts vertex list, extended if the corner has no vertex yet
+     * @return index of the corner vertex
+     */
+    int latticeCorner(const int * lc, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts);
+
+    /**
+     * Place the lattice of cube corners around the voxels of a volume
+     * @param vox           voxel volume
+     * @param[out] base     world-space position of lattice corner (0, 0, 0)
+     * @param[out] step     world-space spacing between lattice corners
+     * @retval true if the volume has voxels,
+     * @retval false if it is empty
+     */
+    bool setLattice(VoxelVolume * vox, cgp::Point &base, cgp::Vector &step);
+
+    /**
+     * Face-culled extraction with one quad per exposed voxel face
+     * @param vox           voxel volume
+     * @param base          world-space position of lattice corner (0, 0, 0)
+     * @param step          world-space spacing between lattice corners
+     * @param[out] verts    vertex positions in world space
+     * @param[out] faces    flattened triangle vertex indices
+     * @param out           stream that is handed the triangles of whole layers once voxmeshbatch indices have
+     *                      gathered, leaving only the rest in @a verts and @a faces, or NULL to keep them all
+     * @retval true if every batch was accepted by @a out,
+     * @retval false otherwise
+     */
+    bool extractFaces(VoxelVolume * vox, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts, std::vector<int> &faces,
+                      STLStreamWriter * out = NULL);
+
+    /**
+     * Greedy extraction, sweeping each axis slice by slice and covering the exposed faces with maximal rectangles
+     * @param vox           voxel volume
+     * @param base          world-space position of lattice corner (0, 0, 0)
+     * @param step          world-space spacing between lattice corners
+     * @param[out] verts    vertex positions in world space
+     * @param[out] faces    flattened triangle vertex indices
+     */
+    void extractGreedy(VoxelVolume * vox, const cgp::Point &base, const cgp::Vector &step, std::vector<cgp::Point> &verts, std::vector<int> &faces);
+
+public:
+
+    /// Default constructor
+    VoxelMesher(){ pdimx = pdimy = 0; greedy = false; }
+
+    /**
+     * Choose between one quad per exposed face and greedy merging of coplanar faces. Greedy output has far fewer
+     * triangles on flat regions, but rectangles of different sizes meet at T-junctions, so edges are not all shared.
+     * @param merge     true to merge faces into maximal rectangles
+     */
+    void setGreedy(bool merge){ greedy = merge; }
+
+    /**
+     * Extract the boundary between occupied and empty voxels. Voxels outside the volume count as empty, so the
+     * result is closed. Each voxel spans half a cell either side of its centre, as given by VoxelVolume::getVoxelPos.
+     * Triangles are wound counterclockwise when viewed from outside.
+     * @param vox           voxel volume
+     * @param[out] verts    vertex positions in world space
+     * @param[out] faces    flattened list of vertex indices, with each group of 3 indices representing a triangle
+     */
+    void extract(VoxelVolume * vox, std::vector<cgp::Point> &verts, std::vector<int> &faces);
+
+    /**
+     * Extract the boundary between occupied and empty voxels straight into an STL stream, as for extract. Face-culled
+     * triangles are handed on a few layers at a time, so the mesh is never held whole, while greedy meshing needs
+     * the whole volume swept first and hands on its triangles at the end. Corners are not shared between batches.
+     * @param vox           voxel volume
+     * @param out           open stream to append the triangles to
+     * @retval true if every triangle was accepted by @a out,
+     * @retval false otherwise
+     */
+    bool extract(VoxelVolume * vox, STLStreamWriter &out);
+};
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ * @file
+ *
+ * Run-length compressed voxel files, written and read a layer at a time
+ */
+
+#include "voxstream.h"
+#include <string.h>
+#include <atomic>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static stats::MemoryInit streamMemory("VoxelStream");
+
+static std::atomic<uint64_t> streamReaders(0);   ///< files opened by any VoxelStreamReader, numbering each
+
+/// The last two layers decompressed by a thread, and the file they came from
+struct StreamLayerCache
+{
+    uint64_t reader;                    ///< id of the reader whose file the layers are from, 0 for none
+    int z[2];                           ///< layer held in each slot, or -1
+    std::vector<unsigned int> words[2]; ///< packed words of each layer
+};
+
+static thread_local StreamLayerCache layerCache = {0, {-1, -1}, {}};
+
+bool VoxelStreamWriter::open(const std::string &filename, int dimx, int dimy, int dimz, cgp::Point corner, cgp::Vector diag)
+{
+    VoxelFileHeader hdr;
+
+    close();
+    if(dimx < 0 || dimx % voxwordbits != 0 || dimy < 0 || dimz < 0)
+    {
+        cerr << "Error VoxelStreamWriter::open: invalid dimensions (" << dimx << ", " << dimy << ", " << dimz << ")" << endl;
+        return false;
+    }
+    dim[0] = dimx; dim[1] = dimy; dim[2] = dimz;
+    xspan = dimx / voxwordbits;
+    zdone = 0;
+    layers.clear();
+    name = filename;
+
+    memset(&hdr, 0, sizeof(VoxelFileHeader));
+    memcpy(hdr.magic, voxrlemagic, 4);
+    hdr.version = voxrleversion;
+    hdr.dim[0] = dimx; hdr.dim[1] = dimy; hdr.dim[2] = dimz;
+    hdr.xspan = xspan;
+    hdr.intsize = voxwordbits;
+    hdr.origin[0] = corner.x; hdr.origin[1] = corner.y; hdr.origin[2] = corner.z;
+    hdr.diagonal[0] = diag.i; hdr.diagonal[1] = diag.j; hdr.diagonal[2] = diag.k;
+
+    fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL)
+    {
+        cerr << "Error VoxelStreamWriter::open: unable to open " << filename << endl;
+        return false;
+    }
+    ok = (fwrite(&hdr, sizeof(VoxelFileHeader), 1, fp) == 1);
+    offset = sizeof(VoxelFileHeader);
+    return ok;
+}
+
+void VoxelStreamWriter::encodeWords(const unsigned int * words, size_t n, std::vector<uint32_t> &out)
+{
+    size_t w = 0, start;
+
+    while(w < n)
+    {
+        start = w;
+        if(words[w] == 0u || words[w] == ~0u) // run of uniform words
+        {
+            while(w < n && w - start < voxrlemaxrun && words[w] == words[start])
+                w++;
+            out.push_back(((words[start] == 0u) ? voxrlezeros : voxrleones) | (uint32_t) (w - start));
+        }
+        else // words up to the next uniform one are stored as they are
+        {
+            while(w < n && w - start < voxrlemaxrun && words[w] != 0u && words[w] != ~0u)
+                w++;
+            out.push_back(voxrleliteral | (uint32_t) (w - start));
+            out.insert(out.end(), words + start, words + w);
+        }
+    }
+}
+
+bool VoxelStreamWriter::writeLayers(VoxelVolume * vox, int zlo, int zhi)
+{
+    int dx, dy, dz, numlayers = zhi - zlo + 1;
+    vector<vector<uint32_t>> encoded(max(numlayers, 0));
+
+    if(fp == NULL)
+    {
+        cerr << "Error VoxelStreamWriter::writeLayers: no file open" << endl;
+        return false;
+    }
+    vox->getDim(dx, dy, dz);
+    if(dx != dim[0] || dy != dim[1] || zlo < 0 || zhi >= dz || zdone + numlayers > dim[2])
+    {
+        cerr << "Error VoxelStreamWriter::writeLayers: layers " << zlo << " to " << zhi << " of a (" << dx << ", " << dy << ", " << dz;
+        cerr << ") volume do not fit the next layers of " << name << endl;
+        return false;
+    }
+
+    // layers are compressed concurrently and then written in order
+    #pragma omp parallel
+    {
+        vector<unsigned int> layer((size_t) xspan * dim[1]);
+
+        #pragma omp for schedule(dynamic)
+        for(int l = 0; l < numlayers; l++)
+        {
+            for(int y = 0; y < dim[1]; y++)
+                vox->getRow(y, zlo + l, &layer[(size_t) y * xspan]);
+            encodeWords(layer.data(), layer.size(), encoded[l]);
+        }
+    }
+
+    for(int l = 0; l < numlayers && ok; l++)
+    {
+        layers.push_back(offset);
+        ok = (fwrite(encoded[l].data(), sizeof(uint32_t), encoded[l].size(), fp) == encoded[l].size());
+        offset += encoded[l].size() * sizeof(uint32_t);
+    }
+    zdone += numlayers;
+    if(!ok)
+        cerr << "Error VoxelStreamWriter::writeLayers: failed writing " << name << endl;
+    return ok;
+}
+
+bool VoxelStreamWriter::close()
+{
+    uint32_t pad = 0;
+    uint64_t table;
+
+    if(fp == NULL)
+        return false;
+    if(zdone != dim[2])
+    {
+        cerr << "Error VoxelStreamWriter::close: only " << zdone << " of " << dim[2] << " layers written to " << name << endl;
+        ok = false;
+    }
+
+    // the table is aligned for reading in place from the mapping
+    if(ok && offset % sizeof(uint64_t) != 0)
+    {
+        ok = (fwrite(&pad, sizeof(uint32_t), 1, fp) == 1);
+        offset += sizeof(uint32_t);
+    }
+    table = offset;
+    if(ok && !layers.empty())
+        ok = (fwrite(layers.data(), sizeof(uint64_t), layers.size(), fp) == layers.size());
+    if(ok)
+        ok = (fwrite(&table, sizeof(uint64_t), 1, fp) == 1);
+    if(fclose(fp) != 0)
+        ok = false;
+    fp = NULL;
+    if(!ok)
+        cerr << "Error VoxelStreamWriter::close: failed writing " << name << endl;
+    return ok;
+}
+
+VoxelStreamReader::VoxelStreamReader()
+    : memtally(streamMemory)
+{
+    map = NULL;
+    maplen = 0;
+    layers = NULL;
+    table = 0;
+    id = 0;
+    dim[0] = dim[1] = dim[2] = 0;
+    xspan = 0;
+}
+
+bool VoxelStreamReader::isStreamFile(std::string filename)
+{
+    FILE * fp;
+    char magic[4];
+    bool found = false;
+
+    fp = fopen(filename.c_str(), "rb");
+    if(fp != NULL)
+    {
+        found = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, voxrlemagic, 4) == 0);
+        fclose(fp);
+    }
+    return found;
+}
+
+bool VoxelStreamReader::open(const std::string &filename)
+{
+    VoxelFileHeader hdr;
+    struct stat st;
+    uint64_t end;
+    void * mapped;
+    int fd;
+    bool valid;
+
+    close();
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        cerr << "Error VoxelStreamReader::open: unable to open " << filename << endl;
+        return false;
+    }
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(VoxelFileHeader) + sizeof(uint64_t)
+       || read(fd, &hdr, sizeof(VoxelFileHeader)) != (ssize_t) sizeof(VoxelFileHeader) || memcmp(hdr.magic, voxrlemagic, 4) != 0)
+    {
+        cerr << "Error VoxelStreamReader::open: " << filename << " is not a compressed voxel file" << endl;
+        ::close(fd);
+        return false;
+    }
+    if(hdr.version != voxrleversion || hdr.intsize != voxwordbits || hdr.xspan * voxwordbits != hdr.dim[0]
+       || hdr.dim[0] < 0 || hdr.dim[1] < 0 || hdr.dim[2] < 0)
+    {
+        cerr << "Error VoxelStreamReader::open: unsupported version or layout in " << filename << endl;
+        ::close(fd);
+        return false;
+    }
+
+    // shared read-only mapping, so pages are read from the file as rows are used and can be dropped again
+    mapped = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED)
+    {
+        cerr << "Error VoxelStreamReader::open: unable to map " << filename << endl;
+        return false;
+    }
+    map = (const char *) mapped;
+    maplen = (size_t) st.st_size;
+    dim[0] = hdr.dim[0]; dim[1] = hdr.dim[1]; dim[2] = hdr.dim[2];
+    xspan = hdr.xspan;
+    origin = cgp::Point(hdr.origin[0], hdr.origin[1], hdr.origin[2]);
+    diagonal = cgp::Vector(hdr.diagonal[0], hdr.diagonal[1], hdr.diagonal[2]);
+
+    // layers must lie in order between the header and the layer table, each with room for its row offsets
+    memcpy(&table, map + maplen - sizeof(uint64_t), sizeof(uint64_t));
+    valid = table % sizeof(uint64_t) == 0 && table + (uint64_t) dim[2] * sizeof(uint64_t) + sizeof(uint64_t) == maplen;
+    if(valid)
+    {
+        layers = (const uint64_t *) (map + table);
+        for(int z = 0; z < dim[2] && valid; z++)
+        {
+            end = (z+1 < dim[2]) ? layers[z+1] : table;
+            valid = layers[z] >= sizeof(VoxelFileHeader) && layers[z] % sizeof(uint32_t) == 0 && layers[z] <= end;
+        }
+    }
+    if(!valid)
+    {
+        cerr << "Error VoxelStreamReader::open: " << filename << " is truncated or has a malformed layer table" << endl;
+        close();
+        return false;
+    }
+    id = ++streamReaders;
+    memtally.set(maplen);
+    return true;
+}
+
+void VoxelStreamReader::close()
+{
+    if(map != NULL)
+        munmap((void *) map, maplen);
+    map = NULL;
+    maplen = 0;
+    layers = NULL;
+    table = 0;
+    id = 0;
+    dim[0] = dim[1] = dim[2] = 0;
+    xspan = 0;
+    memtally.set(0);
+}
+
+bool VoxelStreamReader::decodeLayer(int z, unsigned int * words)
+{
+    const uint32_t * tok = (const uint32_t *) (map + layers[z]);
+    const uint32_t * end = (const uint32_t *) (map + ((z+1 < dim[2]) ? layers[z+1] : table));
+    size_t w = 0, n = (size_t) xspan * dim[1];
+    uint32_t kind, len;
+
+    while(w < n && tok < end)
+    {
+        kind = *tok & voxrlekind;
+        len = *tok & voxrlemaxrun;
+        tok++;
+        if(len == 0 || len > n - w || kind == voxrlekind)
+            break;
+        if(kind == voxrleliteral)
+        {
+            if(len > (size_t) (end - tok))
+                break;
+            memcpy(words + w, tok, len * sizeof(uint32_t));
+            tok += len;
+        }
+        else
+        {
+            std::fill(words + w, words + w + len, (kind == voxrleones) ? ~0u : 0u);
+        }
+        w += len;
+    }
+    if(w < n)
+    {
+        cerr << "Error VoxelStreamReader::decodeLayer: malformed layer " << z << endl;
+        return false;
+    }
+    return true;
+}
+
+const unsigned int * VoxelStreamReader::cachedLayer(int z, int keep)
+{
+    StreamLayerCache &cache = layerCache;
+    int slot;
+
+    if(cache.reader != id) // layers of another file, or of this reader before it was reopened
+    {
+        cache.reader = id;
+        cache.z[0] = cache.z[1] = -1;
+    }
+    for(slot = 0; slot < 2; slot++)
+        if(cache.z[slot] == z)
+            return cache.words[slot].data();
+
+    slot = (cache.z[0] == keep && keep >= 0) ? 1 : 0;
+    cache.words[slot].resize((size_t) xspan * dim[1]);
+    cache.z[slot] = -1;
+    if(!decodeLayer(z, cache.words[slot].data()))
+        return NULL;
+    cache.z[slot] = z;
+    return cache.words[slot].data();
+}
+
+bool VoxelStreamReader::getRow(int y, int z, unsigned int * words)
+{
+    const unsigned int * layer;
+
+    if(map == NULL || y < 0 || y >= dim[1] || z < 0 || z >= dim[2])
+    {
+        cerr << "Error VoxelStreamReader::getRow: row (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+    layer = cachedLayer(z, -1);
+    if(layer == NULL)
+        return false;
+    memcpy(words, layer + (size_t) y * xspan, xspan * sizeof(unsigned int));
+    return true;
+}
+
+bool VoxelStreamReader::readLayers(VoxelVolume * vox, int zlo, int zhi)
+{
+    int dx, dy, dz;
+    bool valid = true;
+
+    vox->getDim(dx, dy, dz);
+    if(map == NULL || dx != dim[0] || dy != dim[1] || zlo < 0 || zhi >= dim[2] || zhi - zlo + 1 > dz)
+    {
+        cerr << "Error VoxelStreamReader::readLayers: layers " << zlo << " to " << zhi << " do not fit a (" << dx << ", " << dy << ", " << dz << ") volume" << endl;
+        return false;
+    }
+
+    // decompressed straight into the volume, rather than through the layer caches
+    #pragma omp parallel reduction(&&:valid)
+    {
+        vector<unsigned int> layer((size_t) xspan * dim[1]);
+
+        #pragma omp for schedule(dynamic)
+        for(int z = zlo; z <= zhi; z++)
+        {
+            if(!decodeLayer(z, layer.data()))
+            {
+                valid = false;
+                continue;
+            }
+            for(int y = 0; y < dim[1]; y++)
+                vox->setRow(y, z - zlo, &layer[(size_t) y * xspan]);
+        }
+    }
+    return valid;
+}
+
+bool VoxelStreamReader::readVolume(VoxelVolume * vox)
+{
+    vox->setDim(dim[0], dim[1], dim[2]);
+    vox->setFrame(origin, diagonal);
+    return dim[2] == 0 || readLayers(vox, 0, dim[2]-1);
+}
+
+bool VoxelStreamReader::getMCRowCodes(int y, int z, unsigned char * codes)
+{
+    const unsigned int * lower, * upper, * rows[4];
+
+    if(map == NULL || y < 0 || y >= dim[1]-1 || z < 0 || z >= dim[2]-1)
+    {
+        cerr << "Error VoxelStreamReader::getMCRowCodes: row (" << y << ", " << z << ") out of bounds" << endl;
+        return false;
+    }
+
+    // rows at (y, z), (y+1, z), (y, z+1), (y+1, z+1), from layers that stay cached for the rest of the cell layer
+    lower = cachedLayer(z, z+1);
+    upper = (lower != NULL) ? cachedLayer(z+1, z) : NULL;
+    if(upper == NULL)
+        return false;
+    rows[0] = lower + (size_t) y * xspan;
+    rows[1] = rows[0] + xspan;
+    rows[2] = upper + (size_t) y * xspan;
+    rows[3] = rows[2] + xspan;
+    return VoxelVolume::rowCodes(rows, dim[0], codes);
+}
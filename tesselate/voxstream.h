@@ -0,0 +1,217 @@
+#ifndef _VOXELSTREAM
+#define _VOXELSTREAM
+/**
+ * @file
+ *
+ * Run-length compressed voxel files, written and read a layer at a time
+ */
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include "voxels.h"
+#include "common/memory.h"
+
+const char voxrlemagic[4] = {'T', 'V', 'X', 'R'}; ///< identifies a run-length compressed voxel file
+const int voxrleversion = 1;                     ///< current compressed voxel file layout
+const uint32_t voxrlezeros = 0x00000000u;        ///< run token kind for a run of empty words
+const uint32_t voxrleones = 0x40000000u;         ///< run token kind for a run of full words
+const uint32_t voxrleliteral = 0x80000000u;      ///< run token kind for words stored as they are
+const uint32_t voxrlekind = 0xc0000000u;         ///< bits of a run token giving its kind, the rest being its length
+const uint32_t voxrlemaxrun = 0x3fffffffu;       ///< longest run of words a single token can cover
+
+/**
+ * Writes a compressed voxel file a few layers at a time, so that a volume can be saved while it is being produced
+ * in slabs without ever holding all of it. The file starts with a VoxelFileHeader carrying voxrlemagic, followed
+ * by each z layer in turn and then a table of layer offsets. A layer is its packed words, row after row, as 32-bit
+ * tokens: a kind in the top two bits and a length of words in the rest, with literal tokens followed by their words.
+ * Runs carry on across rows, so an empty or full layer is a single token. The file ends with the 64-bit offset of
+ * the layer table.
+ */
+class VoxelStreamWriter
+{
+private:
+    FILE * fp;                      ///< file being written, or NULL when closed
+    std::string name;               ///< name of the file, for messages
+    int dim[3];                     ///< number of voxels in x (padded), y and z dimensions
+    int xspan;                      ///< number of words per x row
+    int zdone;                      ///< number of layers written so far
+    uint64_t offset;                ///< bytes written so far
+    std::vector<uint64_t> layers;   ///< file offset of each layer written
+    bool ok;                        ///< no write has failed since open
+
+public:
+
+    /// Default constructor, with no file open
+    VoxelStreamWriter(){ fp = NULL; ok = false; zdone = 0; offset = 0; xspan = 0; dim[0] = dim[1] = dim[2] = 0; }
+
+    /// Destructor, which closes any file still open
+    ~VoxelStreamWriter(){ close(); }
+
+    VoxelStreamWriter(const VoxelStreamWriter &) = delete;
+    VoxelStreamWriter & operator=(const VoxelStreamWriter &) = delete;
+
+    /**
+     * Start a compressed voxel file and write its header, closing any file already open
+     * @param filename  name of the file
+     * @param dimx, dimy, dimz  number of voxels in x, y and z, with x padded as by VoxelVolume::setDim
+     * @param corner, diag  frame of the whole volume, as for VoxelVolume::setFrame
+     * @retval true if the file was opened,
+     * @retval false otherwise
+     */
+    bool open(const std::string &filename, int dimx, int dimy, int dimz, cgp::Point corner, cgp::Vector diag);
+
+    /**
+     * Compress and append the next layers of the volume, which may be a slab holding only some of its layers
+     * @param vox       volume with the same x and y dimensions as the file
+     * @param zlo, zhi  inclusive range of layers of @a vox, which become the next zhi-zlo+1 layers of the file
+     * @retval true if the layers were written,
+     * @retval false if the dimensions do not match, the file would overflow or a write failed
+     */
+    bool writeLayers(VoxelVolume * vox, int zlo, int zhi);
+
+    /// Number of layers written so far
+    int getLayers(){ return zdone; }
+
+    /**
+     * Write the layer table and close the file, which must have every layer written
+     * @retval true if the whole file was written,
+     * @retval false otherwise, or if no file was open
+     */
+    bool close();
+
+    /**
+     * Compress packed words into run tokens
+     * @param words     words to compress
+     * @param n         number of words
+     * @param[out] out  run tokens appended for the words
+     */
+    static void encodeWords(const unsigned int * words, size_t n, std::vector<uint32_t> &out);
+};
+
+/**
+ * Reads a compressed voxel file written by VoxelStreamWriter. The file is memory mapped read only, so that only the
+ * compressed pages in use are resident, and layers are decompressed on demand. Each thread keeps the last two layers
+ * it decompressed, which is all a sweep of marching cubes cells needs, so VoxelStreamReader supplies row codes in the
+ * manner of VoxelVolume and Mesh::marchingCubes can extract a surface from the file without decompressing it into a
+ * volume. Concurrent reads are safe.
+ */
+class VoxelStreamReader
+{
+private:
+    const char * map;               ///< mapped file, or NULL when closed
+    size_t maplen;                  ///< length of the mapping in bytes
+    int dim[3];                     ///< number of voxels in x (padded), y and z dimensions
+    int xspan;                      ///< number of words per x row
+    cgp::Point origin;              ///< corner point of the volume in world space
+    cgp::Vector diagonal;           ///< diagonal extent of the volume in world space
+    const uint64_t * layers;        ///< file offset of each layer, within the mapping
+    uint64_t table;                 ///< file offset of the layer table, which bounds the last layer
+    uint64_t id;                    ///< distinguishes each file opened, for the per-thread layer caches
+    stats::MemoryTally memtally;    ///< bytes of the mapping
+
+    /**
+     * Decompress a layer
+     * @param z         layer, within the volume
+     * @param[out] words  xspan * ydim packed words, row after row
+     * @retval true if the layer was decompressed,
+     * @retval false if its tokens are malformed, which is reported
+     */
+    bool decodeLayer(int z, unsigned int * words);
+
+    /**
+     * Find a decompressed layer in the cache of the calling thread, decompressing it if it is not there
+     * @param z         layer, within the volume
+     * @param keep      another layer that must stay cached alongside it, or -1
+     * @returns packed words of the layer, valid until the thread asks for a third layer, or NULL if it is malformed
+     */
+    const unsigned int * cachedLayer(int z, int keep);
+
+public:
+
+    /// Default constructor, with no file open
+    VoxelStreamReader();
+
+    /// Destructor, which unmaps any open file
+    ~VoxelStreamReader(){ close(); }
+
+    VoxelStreamReader(const VoxelStreamReader &) = delete;
+    VoxelStreamReader & operator=(const VoxelStreamReader &) = delete;
+
+    /**
+     * Test whether a file is a compressed voxel file, by its magic number
+     * @param filename  name of the file
+     */
+    static bool isStreamFile(std::string filename);
+
+    /**
+     * Map a compressed voxel file and check its layer table, closing any file already open
+     * @param filename  name of the file
+     * @retval true if the file was opened,
+     * @retval false if it is missing, not a compressed voxel file, or truncated
+     */
+    bool open(const std::string &filename);
+
+    /// Unmap the file
+    void close();
+
+    /**
+     * Obtain the dimensions of the voxel volume
+     * @param dimx, dimy, dimz     number of voxels in x, y, z dimensions
+     */
+    void getDim(int &dimx, int &dimy, int &dimz){ dimx = dim[0]; dimy = dim[1]; dimz = dim[2]; }
+
+    /// Number of packed words per x row
+    int getXSpan(){ return xspan; }
+
+    /**
+     * Obtain the frame of the volume, as for VoxelVolume::getFrame
+     * @param[out] corner   corner point of the volume in world space
+     * @param[out] diag     diagonal extent of the volume in world space
+     */
+    void getFrame(cgp::Point &corner, cgp::Vector &diag){ corner = origin; diag = diagonal; }
+
+    /**
+     * Decompress an x row
+     * @param y, z          row to read
+     * @param[out] words    xspan packed words, as for VoxelVolume::getRow
+     * @retval true if the row was read,
+     * @retval false if it is out of bounds or its tokens are malformed
+     */
+    bool getRow(int y, int z, unsigned int * words);
+
+    /**
+     * Decompress layers into a volume, which may be a slab holding only some of the layers of the file
+     * @param[out] vox  volume with the same x and y dimensions as the file
+     * @param zlo, zhi  inclusive range of layers of the file, written to layers 0 onwards of @a vox
+     * @retval true if the layers were read,
+     * @retval false otherwise
+     */
+    bool readLayers(VoxelVolume * vox, int zlo, int zhi);
+
+    /**
+     * Decompress the whole file into a volume, taking its dimensions and frame
+     * @param[out] vox  volume to overwrite
+     * @retval true if the volume was read,
+     * @retval false otherwise
+     */
+    bool readVolume(VoxelVolume * vox);
+
+    /**
+     * Compute the marching cubes vertex bit codes for a row of cells, as for VoxelVolume::getMCRowCodes
+     * @param y, z      index of the lower, front corner of the cells in the row
+     * @param[out] codes  vertex bit code for each cell x in [0, xdim-1)
+     * @retval true if any cell in the row has a mix of inside and outside corners,
+     * @retval false if the row produces no surface (or is out of bounds or malformed)
+     */
+    bool getMCRowCodes(int y, int z, unsigned char * codes);
+
+    /// Marching cubes edge bit code of a vertex bit code, as for VoxelVolume::getMCEdgeIdx
+    int getMCEdgeIdx(int vcode){ return VoxelVolume::getMCEdgeIdx(vcode); }
+
+    /// Marching cubes edge intersection, always at the edge midpoint, as for VoxelVolume::getMCEdgeXsect
+    cgp::Point getMCEdgeXsect(int x, int y, int z, int ebit){ return VoxelVolume::getMCEdgeXsect(ebit); }
+};
+
+#endif
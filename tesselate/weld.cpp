@@ -0,0 +1,246 @@
+//
+// Weld
+//
+
+#include "weld.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+const uint64_t weldaxismask = (((uint64_t) 1) << weldaxisbits) - 1; ///< mask for one axis of a packed cell key
+
+/// Scramble a packed cell key so that neighbouring cells spread across the hash table (splitmix64 finaliser)
+static uint64_t mixKey(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return key;
+}
+
+void VertexWelder::sortKeys()
+{
+    int n = (int) keys.size(), numblocks, numbuckets = 1 << weldradixbits;
+    vector<uint64_t> tkeys(n);
+    vector<int> torder(n), hist, total(numbuckets);
+
+    numblocks = (n + weldblocksize - 1) / weldblocksize;
+    hist.resize(numblocks * numbuckets);
+    for(int shift = 0; shift < 3 * weldaxisbits; shift += weldradixbits)
+    {
+        std::fill(hist.begin(), hist.end(), 0);
+
+        // per block digit counts, so that each block scatters to its own disjoint range
+        #pragma omp parallel for
+        for(int b = 0; b < numblocks; b++)
+        {
+            int * h = &hist[b * numbuckets];
+            for(int i = b * weldblocksize; i < std::min(n, (b+1) * weldblocksize); i++)
+                h[(keys[i] >> shift) & (numbuckets - 1)]++;
+        }
+
+        std::fill(total.begin(), total.end(), 0);
+        for(int b = 0; b < numblocks; b++)
+            for(int d = 0; d < numbuckets; d++)
+                total[d] += hist[b * numbuckets + d];
+        if(*std::max_element(total.begin(), total.end()) == n) // every key shares this digit
+            continue;
+
+        // exclusive prefix sum in digit-major, block-minor order keeps the sort stable
+        int offset = 0;
+        for(int d = 0; d < numbuckets; d++)
+            for(int b = 0; b < numblocks; b++)
+            {
+                int count = hist[b * numbuckets + d];
+                hist[b * numbuckets + d] = offset;
+                offset += count;
+            }
+
+        #pragma omp parallel for
+        for(int b = 0; b < numblocks; b++)
+        {
+            int * h = &hist[b * numbuckets];
+            for(int i = b * weldblocksize; i < std::min(n, (b+1) * weldblocksize); i++)
+            {
+                int pos = h[(keys[i] >> shift) & (numbuckets - 1)]++;
+                tkeys[pos] = keys[i];
+                torder[pos] = order[i];
+            }
+        }
+        keys.swap(tkeys);
+        order.swap(torder);
+    }
+}
+
+void VertexWelder::buildTable(const std::vector<int> &cellstart)
+{
+    int numcells = (int) cellstart.size() - 1, size = 1;
+    WeldCell empty;
+
+    // keep the load factor at or below one half so that probe sequences stay short
+    while(size < 2 * numcells)
+        size *= 2;
+    empty.key = 0; empty.first = -1; empty.end = -1;
+    table.assign(size, empty);
+    tablemask = (uint64_t) (size - 1);
+
+    for(int c = 0; c < numcells; c++)
+    {
+        uint64_t key = keys[cellstart[c]], slot = mixKey(key) & tablemask;
+        while(table[slot].first >= 0)
+            slot = (slot + 1) & tablemask;
+        table[slot].key = key;
+        table[slot].first = cellstart[c];
+        table[slot].end = cellstart[c+1];
+    }
+}
+
+const WeldCell * VertexWelder::findCell(uint64_t key) const
+{
+    uint64_t slot = mixKey(key) & tablemask;
+
+    while(table[slot].first >= 0)
+    {
+        if(table[slot].key == key)
+            return &table[slot];
+        slot = (slot + 1) & tablemask;
+    }
+    return NULL;
+}
+
+int VertexWelder::weld(const std::vector<cgp::Point> &verts, float eps, std::vector<int> &remap, std::vector<cgp::Point> &welded)
+{
+    int n = (int) verts.size(), numwelded = 0;
+    float minx = HUGE_VALF, miny = HUGE_VALF, minz = HUGE_VALF;
+    float maxx = -HUGE_VALF, maxy = -HUGE_VALF, maxz = -HUGE_VALF;
+    float extent, cell, epssq;
+    vector<int> cellstart, nbrstart, nbrs, rep;
+
+    remap.clear();
+    welded.clear();
+    if(n == 0)
+        return 0;
+
+    #pragma omp parallel for reduction(min:minx,miny,minz) reduction(max:maxx,maxy,maxz)
+    for(int v = 0; v < n; v++)
+    {
+        minx = std::min(minx, verts[v].x); maxx = std::max(maxx, verts[v].x);
+        miny = std::min(miny, verts[v].y); maxy = std::max(maxy, verts[v].y);
+        minz = std::min(minz, verts[v].z); maxz = std::max(maxz, verts[v].z);
+    }
+
+    // cells must be at least eps wide, and widen further if the grid would overflow the key bits,
+    // leaving a spare cell at each end so that neighbour coordinates never wrap
+    extent = std::max(maxx - minx, std::max(maxy - miny, maxz - minz));
+    epssq = std::max(eps, 0.0f) * std::max(eps, 0.0f);
+    cell = std::max(std::max(eps, 0.0f), extent / (float) (weldaxismask - 2));
+    if(cell <= 0.0f) // all vertices coincide
+        cell = 1.0f;
+
+    keys.resize(n);
+    order.resize(n);
+    #pragma omp parallel for
+    for(int v = 0; v < n; v++)
+    {
+        uint64_t ix = 1 + std::min((uint64_t) ((verts[v].x - minx) / cell), weldaxismask - 2);
+        uint64_t iy = 1 + std::min((uint64_t) ((verts[v].y - miny) / cell), weldaxismask - 2);
+        uint64_t iz = 1 + std::min((uint64_t) ((verts[v].z - minz) / cell), weldaxismask - 2);
+        keys[v] = (ix << (2 * weldaxisbits)) | (iy << weldaxisbits) | iz;
+        order[v] = v;
+    }
+    sortKeys();
+
+    // runs of equal keys in the sorted list are the occupied cells
+    for(int s = 0; s < n; s++)
+        if(s == 0 || keys[s] != keys[s-1])
+            cellstart.push_back(s);
+    cellstart.push_back(n);
+    buildTable(cellstart);
+
+    // gather, for each vertex, the earlier vertices within tolerance, counting first and then filling.
+    // Neighbouring cells are looked up once per cell and shared by all the vertices it holds.
+    nbrstart.assign(n + 1, 0);
+    for(int pass = 0; pass < 2; pass++)
+    {
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(int c = 0; c < (int) cellstart.size() - 1; c++)
+        {
+            const WeldCell * adj[27];
+            int numadj = 0;
+            uint64_t key = keys[cellstart[c]];
+
+            for(int dx = -1; dx <= 1; dx++)
+                for(int dy = -1; dy <= 1; dy++)
+                    for(int dz = -1; dz <= 1; dz++)
+                    {
+                        // unsigned wraparound subtracts for negative offsets, and the spare cells stop borrows between axes
+                        uint64_t nkey = key + (uint64_t) (int64_t) dx * (((uint64_t) 1) << (2 * weldaxisbits))
+                                            + (uint64_t) (int64_t) dy * (((uint64_t) 1) << weldaxisbits) + (uint64_t) (int64_t) dz;
+                        const WeldCell * nc = findCell(nkey);
+                        if(nc != NULL)
+                            adj[numadj++] = nc;
+                    }
+
+            for(int s = cellstart[c]; s < cellstart[c+1]; s++)
+            {
+                int v = order[s], count = 0;
+                const cgp::Point &p = verts[v];
+
+                for(int a = 0; a < numadj; a++)
+                    for(int t = adj[a]->first; t < adj[a]->end; t++)
+                    {
+                        int u = order[t];
+                        if(u >= v)
+                            continue;
+                        float ex = verts[u].x - p.x, ey = verts[u].y - p.y, ez = verts[u].z - p.z;
+                        if(ex*ex + ey*ey + ez*ez <= epssq)
+                        {
+                            if(pass == 1)
+                                nbrs[nbrstart[v] + count] = u;
+                            count++;
+                        }
+                    }
+                if(pass == 0)
+                    nbrstart[v+1] = count;
+                else
+                    std::sort(nbrs.begin() + nbrstart[v], nbrs.begin() + nbrstart[v] + count);
+            }
+        }
+
+        if(pass == 0)
+        {
+            for(int v = 0; v < n; v++)
+                nbrstart[v+1] += nbrstart[v];
+            nbrs.resize(nbrstart[n]);
+        }
+    }
+
+    // in vertex order, join the first earlier representative within tolerance
+    rep.resize(n);
+    for(int v = 0; v < n; v++)
+    {
+        rep[v] = v;
+        for(int k = nbrstart[v]; k < nbrstart[v+1]; k++)
+            if(rep[nbrs[k]] == nbrs[k])
+            {
+                rep[v] = nbrs[k];
+                break;
+            }
+    }
+
+    remap.resize(n);
+    for(int v = 0; v < n; v++)
+    {
+        if(rep[v] == v)
+        {
+            remap[v] = numwelded++;
+            welded.push_back(verts[v]);
+        }
+        else
+            remap[v] = remap[rep[v]];
+    }
+    return numwelded;
+}
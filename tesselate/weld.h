@@ -0,0 +1,76 @@
+/**
+ * @file
+ *
+ * Tolerance based vertex welding over a uniform spatial hash, used to remove coincident vertices from meshes.
+ */
+
+#ifndef _WELD
+#define _WELD
+
+#include <vector>
+#include <stdint.h>
+#include "vecpnt.h"
+
+const int weldaxisbits = 21;        ///< bits per axis in a packed cell key, so that a key fits in 63 bits
+const int weldradixbits = 8;        ///< key bits sorted per radix pass
+const int weldblocksize = 65536;    ///< vertices per block when histogramming and scattering in parallel
+const float weldreltol = 1.0e-5f;   ///< default weld distance as a fraction of the bounding box diagonal
+
+/**
+ * A non-empty cell of the welding grid, as stored in an open addressing hash table
+ */
+struct WeldCell
+{
+    uint64_t key;   ///< packed cell coordinates
+    int first;      ///< first sorted position of the vertices in the cell, -1 for an empty slot
+    int end;        ///< one past the last sorted position of the vertices in the cell
+};
+
+/**
+ * Welds vertices that lie within a distance tolerance of each other. Vertices are binned into a grid with cells
+ * at least as wide as the tolerance, so every neighbour within tolerance lies in one of the 27 surrounding cells.
+ * Binning is a parallel radix sort on packed cell keys, and the occupied cells are found through a compact open
+ * addressing table. Neighbour gathering runs in parallel, and a final linear pass in vertex order makes each
+ * vertex join the first earlier representative within tolerance. The result does not depend on the thread count.
+ */
+class VertexWelder
+{
+private:
+    std::vector<uint64_t> keys;     ///< packed cell key for each sorted position
+    std::vector<int> order;         ///< vertex index for each sorted position
+    std::vector<WeldCell> table;    ///< occupied cells, indexed by hashed key with linear probing
+    uint64_t tablemask;             ///< table size minus one, the size being a power of two
+
+    /// Stable parallel least significant digit radix sort of keys, carrying order along
+    void sortKeys();
+
+    /**
+     * Fill the hash table with the occupied cells
+     * @param cellstart first sorted position of each run of equal keys, followed by the number of keys
+     */
+    void buildTable(const std::vector<int> &cellstart);
+
+    /**
+     * Find an occupied cell
+     * @param key   packed cell coordinates
+     * @returns pointer to the table entry, or NULL if no vertex falls in the cell
+     */
+    const WeldCell * findCell(uint64_t key) const;
+
+public:
+
+    /// Default constructor
+    VertexWelder(){ tablemask = 0; }
+
+    /**
+     * Weld a list of vertices
+     * @param verts         vertex positions
+     * @param eps           weld distance, with 0 merging only exactly coincident vertices
+     * @param[out] remap    index into welded for each input vertex
+     * @param[out] welded   surviving vertices, each the first occurrence of its group, in input order
+     * @returns number of welded vertices
+     */
+    int weld(const std::vector<cgp::Point> &verts, float eps, std::vector<int> &remap, std::vector<cgp::Point> &welded);
+};
+
+#endif
@@ -0,0 +1,189 @@
+//
+// Winding
+//
+
+#include "winding.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+const float windinv4pi = 0.0795774715f; ///< 1 / (4 pi), converts solid angle to winding number
+
+void WindingTree::clear()
+{
+    nodes.clear();
+    tverts.clear();
+}
+
+void WindingTree::build(const std::vector<cgp::Point> &verts, const std::vector<int> &faces)
+{
+    int t, p, numtris;
+    vector<int> order;
+    vector<float> cent;
+
+    clear();
+    numtris = (int) faces.size() / 3;
+    if(numtris == 0)
+        return;
+
+    // triangles are gathered in original order, split reorders them
+    tverts.resize(9 * numtris);
+    cent.resize(3 * numtris);
+    order.resize(numtris);
+    for(t = 0; t < numtris; t++)
+    {
+        cent[3*t] = cent[3*t+1] = cent[3*t+2] = 0.0f;
+        for(p = 0; p < 3; p++)
+        {
+            const cgp::Point &v = verts[faces[3*t+p]];
+            tverts[9*t+3*p] = v.x; tverts[9*t+3*p+1] = v.y; tverts[9*t+3*p+2] = v.z;
+            cent[3*t] += v.x / 3.0f; cent[3*t+1] += v.y / 3.0f; cent[3*t+2] += v.z / 3.0f;
+        }
+        order[t] = t;
+    }
+
+    nodes.reserve(2 * (numtris / windleafsize + 1));
+    nodes.push_back(WindingNode());
+    split(0, 0, numtris, order, cent);
+
+    // store triangle vertices in leaf order for coherent access during queries
+    vector<float> sorted(9 * numtris);
+    for(t = 0; t < numtris; t++)
+        for(p = 0; p < 9; p++)
+            sorted[9*t+p] = tverts[9*order[t]+p];
+    tverts.swap(sorted);
+}
+
+void WindingTree::split(int node, int start, int end, std::vector<int> &order, std::vector<float> &cent)
+{
+    WindingNode nd;
+    float cmin[3], cmax[3], area, totarea = 0.0f, r;
+    int i, a, p, axis, mid;
+
+    // area weighted moments of the cluster
+    for(a = 0; a < 3; a++)
+    {
+        nd.cent[a] = nd.normal[a] = 0.0f;
+        cmin[a] = HUGE_VALF;
+        cmax[a] = -HUGE_VALF;
+    }
+    for(i = start; i < end; i++)
+    {
+        const float * v = &tverts[9*order[i]];
+        float e1[3], e2[3], n[3];
+
+        for(a = 0; a < 3; a++)
+        {
+            e1[a] = v[3+a] - v[a];
+            e2[a] = v[6+a] - v[a];
+        }
+        n[0] = 0.5f * (e1[1] * e2[2] - e1[2] * e2[1]);
+        n[1] = 0.5f * (e1[2] * e2[0] - e1[0] * e2[2]);
+        n[2] = 0.5f * (e1[0] * e2[1] - e1[1] * e2[0]);
+        area = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        totarea += area;
+        for(a = 0; a < 3; a++)
+        {
+            nd.normal[a] += n[a];
+            nd.cent[a] += area * cent[3*order[i]+a];
+            cmin[a] = std::min(cmin[a], cent[3*order[i]+a]);
+            cmax[a] = std::max(cmax[a], cent[3*order[i]+a]);
+        }
+    }
+    for(a = 0; a < 3; a++)
+        nd.cent[a] = (totarea > 0.0f) ? nd.cent[a] / totarea : 0.5f * (cmin[a] + cmax[a]);
+
+    // bounding sphere about the centroid
+    nd.radius = 0.0f;
+    for(i = start; i < end; i++)
+        for(p = 0; p < 3; p++)
+        {
+            const float * v = &tverts[9*order[i]+3*p];
+            r = (v[0]-nd.cent[0])*(v[0]-nd.cent[0]) + (v[1]-nd.cent[1])*(v[1]-nd.cent[1]) + (v[2]-nd.cent[2])*(v[2]-nd.cent[2]);
+            nd.radius = std::max(nd.radius, r);
+        }
+    nd.radius = sqrtf(nd.radius);
+
+    nd.first = start;
+    nd.count = end - start;
+    if(nd.count <= windleafsize)
+    {
+        nodes[node] = nd;
+        return;
+    }
+
+    // median split along the axis with the widest spread of centroids
+    axis = 0;
+    for(a = 1; a < 3; a++)
+        if(cmax[a] - cmin[a] > cmax[axis] - cmin[axis])
+            axis = a;
+    mid = (start + end) / 2;
+    std::nth_element(&order[start], &order[mid], &order[0] + end, [&](int t0, int t1)
+    {
+        return cent[3*t0+axis] < cent[3*t1+axis];
+    });
+
+    nd.first = (int) nodes.size();
+    nd.count = 0;
+    nodes[node] = nd;
+    nodes.push_back(WindingNode());
+    nodes.push_back(WindingNode());
+    split(nd.first, start, mid, order, cent);
+    split(nd.first+1, mid, end, order, cent);
+}
+
+float WindingTree::solidAngle(int t, const float * q) const
+{
+    const float * v = &tverts[9*t];
+    float a[3], b[3], c[3], la, lb, lc, det, div;
+
+    // Van Oosterom and Strackee formula
+    for(int i = 0; i < 3; i++)
+    {
+        a[i] = v[i] - q[i];
+        b[i] = v[3+i] - q[i];
+        c[i] = v[6+i] - q[i];
+    }
+    la = sqrtf(a[0]*a[0] + a[1]*a[1] + a[2]*a[2]);
+    lb = sqrtf(b[0]*b[0] + b[1]*b[1] + b[2]*b[2]);
+    lc = sqrtf(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]);
+    det = a[0] * (b[1]*c[2] - b[2]*c[1]) - a[1] * (b[0]*c[2] - b[2]*c[0]) + a[2] * (b[0]*c[1] - b[1]*c[0]);
+    div = la*lb*lc + (a[0]*b[0] + a[1]*b[1] + a[2]*b[2]) * lc + (b[0]*c[0] + b[1]*c[1] + b[2]*c[2]) * la
+          + (c[0]*a[0] + c[1]*a[1] + c[2]*a[2]) * lb;
+    return 2.0f * atan2f(det, div);
+}
+
+float WindingTree::windingNumber(cgp::Point pnt) const
+{
+    int stack[128];
+    int top = 0, i;
+    float q[3] = {pnt.x, pnt.y, pnt.z}, w = 0.0f, d[3], dist;
+
+    if(nodes.empty())
+        return 0.0f;
+
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const WindingNode &n = nodes[stack[--top]];
+
+        d[0] = n.cent[0] - q[0]; d[1] = n.cent[1] - q[1]; d[2] = n.cent[2] - q[2];
+        dist = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+        if(dist > windbeta * n.radius) // far field, the whole cluster acts as a dipole
+        {
+            w += (d[0]*n.normal[0] + d[1]*n.normal[1] + d[2]*n.normal[2]) / (dist * dist * dist);
+        }
+        else if(n.count > 0) // leaf
+        {
+            for(i = n.first; i < n.first + n.count; i++)
+                w += solidAngle(i, q);
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first+1;
+        }
+    }
+    return w * windinv4pi;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file
+ *
+ * Hierarchical generalized winding number over triangles, used for robust containment queries against meshes
+ * that are not watertight.
+ */
+
+#ifndef _WINDING
+#define _WINDING
+
+#include <vector>
+#include "vecpnt.h"
+
+const int windleafsize = 8;     ///< maximum number of triangles stored in a leaf cluster
+const float windbeta = 2.0f;    ///< clusters further away than this multiple of their radius use the dipole approximation
+
+/**
+ * A cluster of triangles in a winding number hierarchy. Interior nodes store the index of their first child,
+ * with the second child immediately following it. Leaf nodes store a contiguous range of triangles.
+ */
+struct WindingNode
+{
+    float cent[3];      ///< area weighted centroid of the cluster triangles
+    float normal[3];    ///< sum of the area weighted triangle normals
+    float radius;       ///< distance from the centroid to the furthest cluster vertex
+    int first;          ///< index of first child for interior nodes, or first triangle for leaf nodes
+    int count;          ///< number of triangles in a leaf, 0 for interior nodes
+};
+
+/**
+ * Generalized winding number (Jacobson et al. 2013) accelerated by a cluster hierarchy (Barill et al. 2018).
+ * Nearby clusters sum the exact solid angle of their triangles, while distant clusters are treated as a single
+ * dipole, giving roughly logarithmic cost per query. The winding number is close to 1 inside a closed, outward
+ * facing mesh and 0 outside, and degrades gracefully for holes, cracks and triangle soups.
+ */
+class WindingTree
+{
+private:
+    std::vector<WindingNode> nodes; ///< flattened tree, root at index 0
+    std::vector<float> tverts;      ///< 9 floats (3 vertices) per triangle, in leaf order
+
+    /**
+     * Recursively partition a range of triangles and emit clusters
+     * @param node      index of the node covering the range
+     * @param start     first triangle (in order) of the range
+     * @param end       one past the last triangle of the range
+     * @param order     original triangle index for each position
+     * @param cent      triangle centroids, indexed by original triangle
+     */
+    void split(int node, int start, int end, std::vector<int> &order, std::vector<float> &cent);
+
+    /**
+     * Exact solid angle subtended by a triangle stored in the hierarchy
+     * @param t     triangle index in leaf order
+     * @param q     query point
+     * @returns signed solid angle, positive when the query point is behind the front face
+     */
+    float solidAngle(int t, const float * q) const;
+
+public:
+
+    /// Default constructor
+    WindingTree(){}
+
+    /// Remove all clusters and triangles
+    void clear();
+
+    /// Test whether the hierarchy has been built over any triangles
+    bool empty() const { return nodes.empty(); }
+
+    /**
+     * Build the hierarchy over an indexed triangle list
+     * @param verts     vertex positions
+     * @param faces     flattened list of vertex indices, with each group of 3 indices representing a triangle
+     */
+    void build(const std::vector<cgp::Point> &verts, const std::vector<int> &faces);
+
+    /**
+     * Evaluate the generalized winding number at a point
+     * @param pnt   query point
+     * @returns winding number, approximately 1 inside and 0 outside the surface
+     */
+    float windingNumber(cgp::Point pnt) const;
+};
+
+#endif
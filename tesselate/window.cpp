@@ -44,6 +44,11 @@
 #include "window.h"
 #include "vecpnt.h"
 #include "common/str.h"
+#include "common/timer.h"
+#include "common/trace.h"
+#include "common/counters.h"
+#include "common/memory.h"
+#include "common/parallel.h"
 #include <QMessageBox>
 
 #include <cmath>
@@ -96,6 +101,14 @@ Window::Window()
     checkLat->setChecked(true);
     paramLayout->addWidget(checkLat);
 
+    // check box for coarse previews ahead of full resolution voxelisation
+    checkProgressive = new QCheckBox(tr("Progressive Voxelize"));
+    checkProgressive->setChecked(true);
+    paramLayout->addWidget(checkProgressive);
+    previewlevel = 0;
+    previewlen = 0.0f;
+    voxlen = 0.1f;
+
     // control point index selection
     QGroupBox *selGroup = new QGroupBox(tr("Control Point Selection"));
     QGridLayout *selLayout = new QGridLayout;
@@ -209,6 +222,20 @@ Window::Window()
     demoButton->setEnabled(true);
     paramLayout->addWidget(demoButton);
 
+    // progress and cancellation of background stages
+    stageBar = new QProgressBar();
+    stageBar->setRange(0, 100);
+    stageBar->setValue(0);
+    stageBar->setVisible(false);
+    paramLayout->addWidget(stageBar);
+    cancelButton = new QPushButton(tr("Cancel"));
+    cancelButton->setEnabled(false);
+    paramLayout->addWidget(cancelButton);
+
+    pipeline = new Pipeline(perspectiveView->getScene(), this);
+    perspectiveView->getScene()->setHistory(true); // so that stages can be undone from the edit menu
+    sceneButtons = {loadButton, loadGridButton, voxButton, marchButton, smoothButton, defButton, shrinkButton, demoButton};
+
     // panel for demo label
     demoLabel = new QLabel();
     demoLabel->setText("");
@@ -221,6 +248,7 @@ Window::Window()
 
     // signal to slot connections
     connect(perspectiveView, SIGNAL(signalRepaintAllGL()), this, SLOT(repaintAllGL()));
+    connect(perspectiveView, SIGNAL(signalPickedCP(int, int, int)), this, SLOT(pickCP(int, int, int)));
     connect(checkModel, SIGNAL(stateChanged(int)), this, SLOT(showModel(int)));
     connect(checkLat, SIGNAL(stateChanged(int)), this, SLOT(showLat(int)));
     connect(loadButton, &QPushButton::clicked, this, &Window::loadPress);
@@ -231,12 +259,18 @@ Window::Window()
     connect(defButton, &QPushButton::clicked, this, &Window::defPress);
     connect(shrinkButton, &QPushButton::clicked, this, &Window::shrinkPress);
     connect(demoButton, &QPushButton::clicked, this, &Window::demoMode);
+    connect(cancelButton, &QPushButton::clicked, this, &Window::cancelPress);
+    connect(pipeline, &Pipeline::progress, this, &Window::stageProgress);
+    connect(pipeline, &Pipeline::finished, this, &Window::stageFinished);
     connect(iEdit, SIGNAL(editingFinished()), this, SLOT(lineEditChange()));
     connect(jEdit, SIGNAL(editingFinished()), this, SLOT(lineEditChange()));
     connect(kEdit, SIGNAL(editingFinished()), this, SLOT(lineEditChange()));
     connect(xtrslider, SIGNAL(valueChanged(int)), this, SLOT(sliderChange(int)));
     connect(ytrslider, SIGNAL(valueChanged(int)), this, SLOT(sliderChange(int)));
     connect(ztrslider, SIGNAL(valueChanged(int)), this, SLOT(sliderChange(int)));
+    connect(xtrslider, SIGNAL(sliderReleased()), this, SLOT(sliderRelease()));
+    connect(ytrslider, SIGNAL(sliderReleased()), this, SLOT(sliderRelease()));
+    connect(ztrslider, SIGNAL(sliderReleased()), this, SLOT(sliderRelease()));
 
     paramPanel->setLayout(paramLayout);
     mainLayout->addWidget(perspectiveView, 0, 1);
@@ -269,16 +303,25 @@ void Window::mouseMoveEvent(QMouseEvent *event)
 
 void Window::repaintAllGL()
 {
-    perspectiveView->repaint();
+    perspectiveView->requestRedraw();
 }
 
 void Window::saveFile()
 {
+    if(pipeline->busy()) // the mesh is still being computed
+    {
+        QMessageBox msgBox;
+        msgBox.setText("Wait for the current stage to finish before saving");
+        msgBox.exec();
+        return;
+    }
+
     if(!tessfilename.isEmpty()) // save directly if we already have a file name
     {
         std::string outfile = tessfilename.toUtf8().constData();
         if(!endsWith(outfile, ".stl"))
             outfile = outfile + ".stl";
+        commitDeform(); // export what is shown
         if(!perspectiveView->getScene()->getMesh()->writeSTL(outfile)) // error message
         {
             QMessageBox msgBox;
@@ -297,6 +340,14 @@ void Window::saveAs()
 {
     QFileDialog::Options options;
     QString selectedFilter;
+
+    if(pipeline->busy()) // the mesh is still being computed
+    {
+        QMessageBox msgBox;
+        msgBox.setText("Wait for the current stage to finish before saving");
+        msgBox.exec();
+        return;
+    }
     tessfilename = QFileDialog::getSaveFileName(this,
                                                 tr("Save Tesselation"),
                                                 "~/",
@@ -308,6 +359,7 @@ void Window::saveAs()
         std::string outfile = tessfilename.toUtf8().constData();
         if(!endsWith(outfile, ".stl"))
             outfile = outfile + ".stl";
+        commitDeform(); // export what is shown
         if(!perspectiveView->getScene()->getMesh()->writeSTL(outfile)) // error message
         {
             QMessageBox msgBox;
@@ -349,9 +401,24 @@ void Window::sliderChange(int value)
         trs.z = (float) value / sliderange;
         perspectiveView->getDef()->setCP(cpi, cpj, cpk, trs);
     }
-    perspectiveView->setGeometryUpdate(true);
+    perspectiveView->setLatticeUpdate();
     repaintAllGL();
 }
+void Window::sliderRelease()
+{
+    commitDeform();
+}
+
+void Window::commitDeform()
+{
+    // dragging only warps the drawn mesh on the GPU, so the deformation reaches the mesh here
+    if(defButton->isEnabled() && !pipeline->busy())
+    {
+        perspectiveView->getScene()->deform(perspectiveView->getDef());
+        perspectiveView->getScene()->recordStage("deform");
+    }
+}
+
 void Window::lineEditChange()
 {
     bool ok;
@@ -391,6 +458,24 @@ void Window::lineEditChange()
         }
     }
 
+    syncCPSliders();
+    perspectiveView->setLatticeUpdate();
+    repaintAllGL();
+}
+
+void Window::pickCP(int i, int j, int k)
+{
+    cpi = i; cpj = j; cpk = k;
+    iEdit->setText(QString::number(cpi, 'i', 0));
+    jEdit->setText(QString::number(cpj, 'i', 0));
+    kEdit->setText(QString::number(cpk, 'i', 0));
+    syncCPSliders();
+    perspectiveView->setLatticeUpdate();
+    repaintAllGL();
+}
+
+void Window::syncCPSliders()
+{
     // adjust sliders to match new cp position
     cgp::Point trs = perspectiveView->getDef()->getCP(cpi, cpj, cpk);
     xtrslider->blockSignals(true); // block signals to prevent slider signalling a change in value
@@ -402,9 +487,6 @@ void Window::lineEditChange()
     ztrslider->blockSignals(true); // block signals to prevent slider signalling a change in value
     ztrslider->setValue(int(std::round(trs.z * sliderange)));
     ztrslider->blockSignals(false);
-
-    perspectiveView->setGeometryUpdate(true);
-    repaintAllGL();
 }
 
 void Window::showParamOptions()
@@ -412,48 +494,312 @@ void Window::showParamOptions()
     paramPanel->setVisible(showParamAct->isChecked());
 }
 
-void Window::voxPress()
+void Window::toggleTimings()
 {
-    perspectiveView->getScene()->voxelise(0.1f);
+    if(pipeline->busy()) // timers may not be switched while any are running
+    {
+        timingAct->setChecked(stats::isTimingEnabled());
+        QMessageBox msgBox;
+        msgBox.setText("Wait for the current stage to finish before changing timing collection");
+        msgBox.exec();
+        return;
+    }
+    stats::enableTimers(timingAct->isChecked());
+}
+
+void Window::toggleGPU()
+{
+    Scene * scene = perspectiveView->getScene();
+
+    if(pipeline->busy()) // the running stage may already be using the device
+    {
+        gpuAct->setChecked(!gpuAct->isChecked());
+        QMessageBox msgBox;
+        msgBox.setText("Wait for the current stage to finish before changing where it runs");
+        msgBox.exec();
+        return;
+    }
+    if(gpuAct->isChecked() && !scene->hasGPUVoxeliser())
+    {
+        // without OpenCL the leaves can still be rasterised with OpenGL
+        if(scene->hasGLVoxeliser())
+        {
+            scene->setGPUVoxelise(false);
+            scene->setGPUIsosurface(false);
+            scene->setGLVoxelise(true);
+            return;
+        }
+        gpuAct->setChecked(false);
+        QMessageBox msgBox;
+        msgBox.setText("No OpenCL device or OpenGL context was found, so voxelisation stays on the CPU");
+        msgBox.exec();
+        return;
+    }
+    scene->setGPUVoxelise(gpuAct->isChecked());
+    scene->setGPUIsosurface(gpuAct->isChecked());
+    scene->setGLVoxelise(false);
+}
+
+void Window::toggleRayMarch()
+{
+    perspectiveView->getScene()->setRayMarchVoxels(marchAct->isChecked());
     perspectiveView->setGeometryUpdate(true);
-    marchButton->setEnabled(true); // only now can marching cubes be applied
-    repaintAllGL();
+    perspectiveView->requestRedraw();
 }
 
-void Window::marchPress()
+void Window::toggleRadiance()
 {
-    perspectiveView->getScene()->isoextract();
+    perspectiveView->getRenderer()->setRadianceScaling(radianceAct->isChecked());
+    perspectiveView->requestRedraw();
+}
+
+void Window::reportTimings()
+{
+    stats::reportTimes();
+    stats::reportCounters();
+    stats::reportMemory("viewer");
+}
+
+void Window::writeTrace()
+{
+    QMessageBox msgBox;
+
+    if(pipeline->busy()) // running stages would still be adding events
+    {
+        msgBox.setText("Wait for the current stage to finish before writing a trace");
+        msgBox.exec();
+        return;
+    }
+    QString filename = QFileDialog::getSaveFileName(this, tr("Write Trace"), "~/", tr("Chrome Trace (*.json)"));
+    if(!filename.isEmpty() && !stats::writeTrace(filename.toUtf8().constData()))
+    {
+        msgBox.setText("Unable to write trace, see the console for details");
+        msgBox.exec();
+    }
+}
+
+void Window::setThreadCount()
+{
+    bool ok;
+    int threads;
+
+    if(pipeline->busy()) // the running stage has already sized its thread team
+    {
+        QMessageBox msgBox;
+        msgBox.setText("Wait for the current stage to finish before changing the number of threads");
+        msgBox.exec();
+        return;
+    }
+    threads = QInputDialog::getInt(this, tr("Threads"), tr("Threads used by each stage:"), parallel::getThreads(),
+                                   1, parallel::getHardwareThreads(), 1, &ok);
+    if(ok)
+        parallel::setThreads(threads);
+}
+
+void Window::fitVoxelSize()
+{
+    QMessageBox msgBox;
+    ResolutionEstimate est;
+    bool ok;
+    double seconds;
+
+    if(pipeline->busy()) // sampling evaluates the tree that the running stage is using
+    {
+        msgBox.setText("Wait for the current stage to finish before fitting the voxel size");
+        msgBox.exec();
+        return;
+    }
+    seconds = QInputDialog::getDouble(this, tr("Fit Voxel Size"), tr("Seconds allowed to voxelise and extract the surface:"),
+                                      60.0, 0.1, 86400.0, 1, &ok);
+    if(!ok)
+        return;
+    if(!perspectiveView->getScene()->tuneResolution(seconds, stats::getMemoryBudget(), est))
+    {
+        msgBox.setText("No voxel size is predicted to fit the budget");
+        msgBox.exec();
+        return;
+    }
+    voxlen = est.voxlen;
+    msgBox.setText(QString("Voxel size %1, predicted to take %2s and %3MB for %4 triangles")
+                   .arg(est.voxlen).arg(est.seconds, 0, 'f', 1).arg((qulonglong) (est.bytes / (1024 * 1024))).arg((qulonglong) est.triangles));
+    msgBox.exec();
+}
+
+void Window::showPartStats()
+{
+    QMessageBox msgBox;
+    VoxelStats vs;
+
+    if(pipeline->busy()) // the volume is still being computed
+    {
+        msgBox.setText("Wait for the current stage to finish before measuring the part");
+        msgBox.exec();
+        return;
+    }
+    perspectiveView->getScene()->getVox()->getStats(vs);
+    if(vs.occupied == 0)
+        msgBox.setText("The voxel volume is empty");
+    else
+        msgBox.setText(QString("Occupied voxels: %1\nVolume: %2\nSurface area: %3\nBounds: (%4, %5, %6) to (%7, %8, %9)")
+                       .arg((qulonglong) vs.occupied).arg(vs.volume).arg(vs.area)
+                       .arg(vs.bounds.min.x).arg(vs.bounds.min.y).arg(vs.bounds.min.z)
+                       .arg(vs.bounds.max.x).arg(vs.bounds.max.y).arg(vs.bounds.max.z));
+    msgBox.exec();
+}
+
+void Window::undoStage()
+{
+    stepHistory(false);
+}
+
+void Window::redoStage()
+{
+    stepHistory(true);
+}
+
+void Window::stepHistory(bool forward)
+{
+    Scene * scene = perspectiveView->getScene();
+    QMessageBox msgBox;
+    bool stepped;
+
+    if(pipeline->busy()) // the scene belongs to the running stage
+    {
+        msgBox.setText("Wait for the current stage to finish before undoing or redoing a stage");
+        msgBox.exec();
+        return;
+    }
+    stepped = forward ? scene->redo() : scene->undo();
+    if(!stepped)
+        return;
+
+    // later stages apply to whatever representation the snapshot holds
+    marchButton->setEnabled(scene->getRep() != SceneRep::TREE);
+    smoothButton->setEnabled(scene->getRep() == SceneRep::ISOSURFACE);
+    defButton->setEnabled(scene->getRep() == SceneRep::ISOSURFACE);
+    perspectiveView->setDeformPreview(scene->getRep() == SceneRep::ISOSURFACE);
     perspectiveView->setGeometryUpdate(true);
-    smoothButton->setEnabled(true); // only now can smoothing be applied
     repaintAllGL();
 }
 
+void Window::voxPress()
+{
+    if(checkProgressive->isChecked()) // coarsest level first, with each finished level starting the next
+    {
+        previewlevel = 0;
+        previewlen = voxlen;
+        runStage(PipelineStage::PREVIEW, previewlen * (float) previewfactors[0]);
+    }
+    else
+        runStage(PipelineStage::VOXELISE, voxlen);
+}
+
+void Window::marchPress()
+{
+    runStage(PipelineStage::ISOEXTRACT, voxlen);
+}
+
 void Window::smoothPress()
 {
-    perspectiveView->getScene()->smooth();
-    perspectiveView->setGeometryUpdate(true);
-    defButton->setEnabled(true); // only now can deformation be applied
-    repaintAllGL();
+    runStage(PipelineStage::SMOOTH, voxlen);
 }
 
 void Window::defPress()
 {
-    perspectiveView->getScene()->deform(perspectiveView->getDef());
-    perspectiveView->setGeometryUpdate(true);
+    runStage(PipelineStage::DEFORM, voxlen);
+}
+
+void Window::cancelPress()
+{
+    pipeline->cancel();
+    cancelButton->setEnabled(false);
+}
+
+void Window::stageProgress(int percent)
+{
+    stageBar->setValue(percent);
+}
+
+void Window::runStage(PipelineStage stage, float voxlen)
+{
+    // the display keeps the last completed representation while the scene is handed to the worker
+    perspectiveView->setSceneBusy(true);
+    if(!pipeline->start(stage, voxlen, perspectiveView->getDef()))
+    {
+        perspectiveView->setSceneBusy(false);
+        return;
+    }
+
+    sceneEnabled.clear();
+    for(QPushButton * button : sceneButtons)
+    {
+        sceneEnabled.push_back(button->isEnabled());
+        button->setEnabled(false);
+    }
+    stageBar->setVisible(true);
+    cancelButton->setEnabled(true);
+}
+
+void Window::stageFinished(PipelineStage stage, bool complete)
+{
+    for(int b = 0; b < (int) sceneButtons.size(); b++)
+        sceneButtons[b]->setEnabled(sceneEnabled[b]);
+    stageBar->setVisible(false);
+    cancelButton->setEnabled(false);
+    perspectiveView->setSceneBusy(false);
+
+    switch(stage)
+    {
+        case PipelineStage::VOXELISE:
+            marchButton->setEnabled(complete); // only now can marching cubes be applied
+            break;
+        case PipelineStage::ISOEXTRACT:
+            if(complete)
+                smoothButton->setEnabled(true); // only now can smoothing be applied
+            break;
+        case PipelineStage::SMOOTH:
+            if(complete)
+            {
+                defButton->setEnabled(true); // only now can deformation be applied
+                perspectiveView->setDeformPreview(true);
+            }
+            break;
+        case PipelineStage::DEFORM:
+            break;
+        case PipelineStage::PREVIEW:
+            if(complete)
+            {
+                int levels = (int) (sizeof(previewfactors) / sizeof(previewfactors[0]));
+
+                perspectiveView->requestRedraw(true); // show this level before the scene goes back to the worker
+                if(previewlevel < levels) // preview level, so carry on with the next finer one
+                {
+                    previewlevel++;
+                    runStage(PipelineStage::PREVIEW, previewlen * (float) (previewlevel < levels ? previewfactors[previewlevel] : 1));
+                    return;
+                }
+                marchButton->setEnabled(true);
+                smoothButton->setEnabled(true); // full resolution isosurface is in place
+                perspectiveView->getScene()->recordStage("voxelise");
+            }
+            break;
+    }
     repaintAllGL();
 }
 
 void Window::loadPress()
 {
     QString filename = QFileDialog::getOpenFileName(this,
-                                                    tr("Open STL model"), "",
-                                                    tr("STL Models (*.stl *.STL);;All Files (*)"));
+                                                    tr("Open mesh model"), "",
+                                                    tr("Mesh Models (*.stl *.STL *.obj *.OBJ);;All Files (*)"));
     perspectiveView->getScene()->expensiveScene(filename.toStdString());
+    perspectiveView->getScene()->clearHistory(); // a new part starts a new history
     perspectiveView->setGeometryUpdate(true);
     voxButton->setEnabled(true);
     marchButton->setEnabled(false);
     smoothButton->setEnabled(false);
     defButton->setEnabled(false);
+    perspectiveView->setDeformPreview(false);
     repaintAllGL();
 }
 
@@ -478,23 +824,41 @@ void Window::shrinkPress()
 
 void Window::demoMode()
 {
-    /// basic demo
+    static const char * steps[][2] = {
+        /// basic demo
+        {"meshes/triangle/10mm_test_cube.stl", "Basic: Load cube"},
+        {"meshes/triangle/sphere.stl", "Basic: Load sphere"},
+        {"meshes/triangle/hygrometer.stl", "Basic: Load hygrometer"},
+        {"meshes/triangle/Single_Barrel.stl", "Basic: Load barrel"},
+        {"meshes/triangle/bunny.stl", "Basic: Load bunny"}};
+    const int numsteps = (int) (sizeof(steps) / sizeof(steps[0]));
+    QMessageBox msgBox;
+
+    if(pipeline->busy()) // the scene belongs to the running stage
+    {
+        msgBox.setText("Wait for the current stage to finish before starting the demo");
+        msgBox.exec();
+        return;
+    }
 
-    // cube
-    loadModelDemo("meshes/triangle/10mm_test_cube.stl", "Basic: Load cube");
-    // sphere
-    loadModelDemo("meshes/triangle/sphere.stl", "Basic: Load sphere");
-    // hygrometer
-    loadModelDemo("meshes/triangle/hygrometer.stl", "Basic: Load hygrometer");
-    // barrel
-    loadModelDemo("meshes/triangle/Single_Barrel.stl", "Basic: Load barrel");
-    // bunny
-    loadModelDemo("meshes/triangle/bunny.stl", "Basic: Load bunny");
+    // later steps load in the background while earlier ones are on display
+    prefetch.clear();
+    for(int i = 0; i < numsteps; i++)
+        prefetch.queue(steps[i][0]);
+    for(int i = 0; i < numsteps; i++)
+        loadModelDemo(steps[i][0], steps[i][1]);
 }
 
 void Window::loadModelDemo(string filename, string txtDisplay)
 {
-    perspectiveView->getScene()->loadSTLScene(filename);
+    Scene * scene = perspectiveView->getScene();
+    bool loaded;
+    Mesh * object = prefetch.take(filename, loaded);
+
+    if(object != NULL)
+        scene->setMeshScene(object);
+    else // not queued ahead
+        scene->loadSTLScene(filename);
     resetView();
     demoLabel->setText(txtDisplay.c_str());
     paramPanel->repaint();
@@ -533,6 +897,61 @@ void Window::createActions()
     showParamAct->setChecked(true);
     showParamAct->setStatusTip(tr("Hide/Show Parameters"));
     connect(showParamAct, SIGNAL(triggered()), this, SLOT(showParamOptions()));
+
+    timingAct = new QAction(tr("Collect Timings"), this);
+    timingAct->setCheckable(true);
+    timingAct->setChecked(stats::isTimingEnabled());
+    timingAct->setStatusTip(tr("Time each pipeline stage and draw call"));
+    connect(timingAct, SIGNAL(triggered()), this, SLOT(toggleTimings()));
+
+    gpuAct = new QAction(tr("Use GPU"), this);
+    gpuAct->setCheckable(true);
+    gpuAct->setChecked(false);
+    gpuAct->setStatusTip(tr("Voxelise and extract the isosurface on an OpenCL device, drawing the surface without a copy through the CPU"));
+    connect(gpuAct, SIGNAL(triggered()), this, SLOT(toggleGPU()));
+
+    marchAct = new QAction(tr("Ray March Voxels"), this);
+    marchAct->setCheckable(true);
+    marchAct->setChecked(false);
+    marchAct->setStatusTip(tr("Preview voxels by ray marching the packed volume on the GPU rather than drawing a cube per surface voxel"));
+    connect(marchAct, SIGNAL(triggered()), this, SLOT(toggleRayMarch()));
+
+    radianceAct = new QAction(tr("Radiance Scaling"), this);
+    radianceAct->setCheckable(true);
+    radianceAct->setChecked(false);
+    radianceAct->setStatusTip(tr("Shade meshes by radiance scaling, which brings out surface detail, at half resolution while the view moves"));
+    connect(radianceAct, SIGNAL(triggered()), this, SLOT(toggleRadiance()));
+
+    reportAct = new QAction(tr("Report Timings"), this);
+    reportAct->setStatusTip(tr("Print total time and calls per stage, and memory held per subsystem"));
+    connect(reportAct, SIGNAL(triggered()), this, SLOT(reportTimings()));
+
+    traceAct = new QAction(tr("Write Trace..."), this);
+    traceAct->setStatusTip(tr("Save per-thread events as Chrome trace JSON"));
+    traceAct->setEnabled(stats::isTracingEnabled());
+    connect(traceAct, SIGNAL(triggered()), this, SLOT(writeTrace()));
+
+    statsAct = new QAction(tr("Part Statistics"), this);
+    statsAct->setStatusTip(tr("Show the volume, exposed surface area and bounds of the voxelised part"));
+    connect(statsAct, SIGNAL(triggered()), this, SLOT(showPartStats()));
+
+    undoAct = new QAction(tr("&Undo Stage"), this);
+    undoAct->setShortcuts(QKeySequence::Undo);
+    undoAct->setStatusTip(tr("Return the part to its state before the last stage"));
+    connect(undoAct, SIGNAL(triggered()), this, SLOT(undoStage()));
+
+    redoAct = new QAction(tr("&Redo Stage"), this);
+    redoAct->setShortcuts(QKeySequence::Redo);
+    redoAct->setStatusTip(tr("Return to the result of the last undone stage"));
+    connect(redoAct, SIGNAL(triggered()), this, SLOT(redoStage()));
+
+    threadsAct = new QAction(tr("Threads..."), this);
+    threadsAct->setStatusTip(tr("Choose the number of threads used by voxelisation, csg and surface extraction"));
+    connect(threadsAct, SIGNAL(triggered()), this, SLOT(setThreadCount()));
+
+    fitVoxelAct = new QAction(tr("Fit Voxel Size..."), this);
+    fitVoxelAct->setStatusTip(tr("Choose the finest voxel size predicted to voxelise and extract within a time budget"));
+    connect(fitVoxelAct, SIGNAL(triggered()), this, SLOT(fitVoxelSize()));
 }
 
 void Window::createMenus()
@@ -542,6 +961,19 @@ void Window::createMenus()
     // fileMenu->addAction(openAct);
     fileMenu->addAction(saveAct);
     fileMenu->addAction(saveAsAct);
+    editMenu = menuBar()->addMenu(tr("&Edit"));
+    editMenu->addAction(undoAct);
+    editMenu->addAction(redoAct);
     viewMenu = menuBar()->addMenu(tr("&View"));
     viewMenu->addAction(showParamAct);
+    viewMenu->addAction(gpuAct);
+    viewMenu->addAction(marchAct);
+    viewMenu->addAction(radianceAct);
+    viewMenu->addAction(statsAct);
+    viewMenu->addAction(threadsAct);
+    viewMenu->addAction(fitVoxelAct);
+    viewMenu->addSeparator();
+    viewMenu->addAction(timingAct);
+    viewMenu->addAction(reportAct);
+    viewMenu->addAction(traceAct);
 }
@@ -42,6 +42,8 @@
 #define WINDOW_H
 
 #include "glwidget.h"
+#include "pipeline.h"
+#include "prefetch.h"
 #include <QWidget>
 #include <QtWidgets>
 #include <string>
@@ -70,8 +72,8 @@ public:
     /// constructor
     Window();
 
-    /// destructor
-    ~Window(){};
+    /// destructor, which stops any running stage before the scene goes away
+    ~Window(){ delete pipeline; }
 
     /// provides ideal size for window
     QSize sizeHint() const;
@@ -87,7 +89,7 @@ public:
 
 public slots:
 
-    /// force re-rendering of scene
+    /// re-render the scene if anything drawn has changed since the last frame
     void repaintAllGL();
 
     /// new file menu item
@@ -111,12 +113,51 @@ public slots:
     /// make parameter panel visible
     void showParamOptions();
 
+    /// start or stop collecting stage timings, which is refused while a stage is running
+    void toggleTimings();
+
+    /// voxelise and extract isosurfaces on an OpenCL device, or stop, which is refused while a stage is running
+    void toggleGPU();
+
+    /// draw voxel volumes by ray marching them on the GPU, or as cubes at their surface voxels
+    void toggleRayMarch();
+
+    /// shade meshes by radiance scaling, or by Phong
+    void toggleRadiance();
+
+    /// print the total time and call count of each timed stage, and the memory held by each subsystem, to stdout
+    void reportTimings();
+
+    /// write recorded trace events as Chrome trace JSON, which is refused while a stage is running
+    void writeTrace();
+
+    /// show the volume, surface area and extents of the voxelised part, which is refused while a stage is running
+    void showPartStats();
+
+    /// return the scene to its state before the last stage, which is refused while a stage is running
+    void undoStage();
+
+    /// repeat the last undone stage from its recorded result, which is refused while a stage is running
+    void redoStage();
+
+    /// choose the number of threads used by later stages, which is refused while a stage is running
+    void setThreadCount();
+
+    /// choose the finest voxel size predicted to fit a time budget and the memory budget, which is refused while a stage is running
+    void fitVoxelSize();
+
     /// handle change in line-edit parameters values
     void lineEditChange();
 
+    /// select control point (@a i, @a j, @a k) after it is picked in the view
+    void pickCP(int i, int j, int k);
+
     /// handle change in slider position
     void sliderChange(int value);
 
+    /// commit the previewed deformation once a slider is released
+    void sliderRelease();
+
     /// voxelise csg tree
     void voxPress();
 
@@ -129,6 +170,15 @@ public slots:
     /// deform isosurface
     void defPress();
 
+    /// stop the running stage
+    void cancelPress();
+
+    /// show the progress of the running stage
+    void stageProgress(int percent);
+
+    /// hand the scene back to the interface once a stage finishes, enabling whichever stage may follow
+    void stageFinished(PipelineStage stage, bool complete);
+
     /// load model
     void loadPress();
 
@@ -141,6 +191,11 @@ public slots:
     // display demo label
     void demoMode();
 
+    /**
+     * Show one demo step, taking its mesh from the prefetcher when it was queued ahead
+     * @param filename      mesh file of the step
+     * @param txtDisplay    label shown with it
+     */
     void loadModelDemo(string filename, string txtDisplay);
 
     void resetView();
@@ -156,6 +211,16 @@ protected:
     /// Handle changes in parameter settings
     void optionsChanged();
 
+    /// Apply the previewed deformation to the mesh itself, if deformation is enabled and no stage is running
+    void commitDeform();
+
+    /**
+     * Start a stage in the background, disabling the controls that would use the scene until it finishes
+     * @param stage     which stage to run
+     * @param voxlen    voxel side length, used by voxelise only
+     */
+    void runStage(PipelineStage stage, float voxlen = 0.0f);
+
 private:
     GLWidget * perspectiveView; ///< openGL render view
     QWidget * paramPanel;       ///< side panel for user access to parameters
@@ -163,6 +228,7 @@ private:
     // param panel sub components
     QCheckBox * checkModel; ///< determine whether loaded model should be displayed or not
     QCheckBox * checkLat; ///< determine whether ffd lattice should be displayed or not
+    QCheckBox * checkProgressive; ///< determine whether voxelisation shows coarse previews first
     QPushButton * voxButton; ///< button to activate voxelisation
     QPushButton * marchButton; ///< button to activate marching cubes
     QPushButton * smoothButton; ///< button to activate smoothing
@@ -171,8 +237,19 @@ private:
     QPushButton * loadGridButton; ///< button to voxel grid
     QPushButton * demoButton; ///< button to voxel grid
     QPushButton * shrinkButton; ///< button to shrink mesh
+    QPushButton * cancelButton; ///< button to stop the running stage
+    QProgressBar * stageBar; ///< progress of the running stage
     QLabel * demoLabel;
 
+    // background stages
+    Pipeline * pipeline;    ///< runs the expensive scene stages off the GUI thread
+    Prefetcher prefetch;    ///< loads the meshes of the demo steps ahead of the step showing them
+    std::vector<QPushButton *> sceneButtons; ///< buttons that use the scene, disabled while a stage runs
+    std::vector<bool> sceneEnabled; ///< enabled state of each scene button when the running stage started
+    int previewlevel;       ///< index into previewfactors of the running progressive level, past the end for full resolution
+    float previewlen;       ///< full resolution voxel side length of the progressive voxelisation
+    float voxlen;           ///< voxel side length used by the voxelise button, as chosen by fitVoxelSize
+
     // active control point
     int cpi, cpj, cpk;    ///< coordinates of currently active ffd control point
     int latdx, latdy, latdz; ///< order of the ffd lattice in each dimension
@@ -185,6 +262,18 @@ private:
     QAction *saveAsAct;     ///< save as menu response
     QMenu *viewMenu;        ///< view menu response
     QAction *showParamAct;  ///< toggle param panel menu response
+    QAction *timingAct;     ///< toggle stage timing menu response
+    QAction *gpuAct;        ///< toggle device voxelisation and extraction menu response
+    QAction *marchAct;      ///< toggle ray marched voxel preview menu response
+    QAction *radianceAct;   ///< toggle radiance scaled shading menu response
+    QAction *reportAct;     ///< report stage timings menu response
+    QAction *traceAct;      ///< write trace events menu response
+    QAction *statsAct;      ///< part statistics menu response
+    QAction *threadsAct;    ///< thread count menu response
+    QAction *fitVoxelAct;   ///< fit voxel size to a budget menu response
+    QMenu *editMenu;        ///< edit menu response
+    QAction *undoAct;       ///< undo stage menu response
+    QAction *redoAct;       ///< redo stage menu response
 
     QString tessfilename; ///< name of tesselation file for output
 
@@ -196,6 +285,15 @@ private:
 
     /// init menu
     void createMenus();
+
+    /// move the control point sliders to the position of the active control point, without signalling a change
+    void syncCPSliders();
+
+    /**
+     * Restore a recorded stage and enable the stage buttons that apply to it
+     * @param forward   true to redo, false to undo
+     */
+    void stepHistory(bool forward);
 };
 
 #endif
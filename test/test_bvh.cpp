@@ -0,0 +1,458 @@
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <test/testutil.h>
+#include "test_bvh.h"
+#include <stdio.h>
+#include <cstdint>
+#include <sstream>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "common/counters.h"
+
+using namespace std;
+
+void TestBVH::setUp()
+{
+    bvh = new BVH();
+}
+
+void TestBVH::tearDown()
+{
+    delete bvh;
+}
+
+void TestBVH::testSphereParity()
+{
+    vector<cgp::Point> verts;
+    vector<int> faces;
+    int i, j, a, b, c, d, slices = 40, stacks = 40;
+    float la, lo, sqd, rad = 3.0f;
+    cgp::Point pnt;
+    cgp::BoundBox bbox;
+
+    // latitude-longitude sphere
+    for(i = 0; i <= stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            la = PI * (float) i / (float) stacks;
+            lo = PI2 * (float) j / (float) slices;
+            verts.push_back(cgp::Point(rad*sinf(la)*cosf(lo), rad*sinf(la)*sinf(lo), rad*cosf(la)));
+        }
+    for(i = 0; i < stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            a = i*slices+j; b = i*slices+(j+1)%slices; c = (i+1)*slices+j; d = (i+1)*slices+(j+1)%slices;
+            faces.push_back(a); faces.push_back(c); faces.push_back(b);
+            faces.push_back(b); faces.push_back(c); faces.push_back(d);
+        }
+
+    bvh->build(verts, faces);
+    CPPUNIT_ASSERT(bvh->getNumTris() == 2 * slices * stacks);
+    bvh->getBounds(bbox);
+    CPPUNIT_ASSERT(bbox.min == cgp::Point(-rad, -rad, -rad));
+    CPPUNIT_ASSERT(bbox.max == cgp::Point(rad, rad, rad));
+
+    // points clearly inside cross an odd number of times, points clearly outside an even number
+    srand(7);
+    for(i = 0; i < 1000; i++)
+    {
+        pnt = cgp::Point((float) (rand()%1000-500) / 100.0f, (float) (rand()%1000-500) / 100.0f, (float) (rand()%1000-500) / 100.0f);
+        sqd = pnt.x*pnt.x + pnt.y*pnt.y + pnt.z*pnt.z;
+        if(sqd < 0.99f * rad * rad)
+            CPPUNIT_ASSERT(bvh->countHits(pnt, cgp::Vector(0.3f, 0.71f, 0.2f))%2 == 1);
+        else if(sqd > 1.01f * rad * rad)
+            CPPUNIT_ASSERT(bvh->countHits(pnt, cgp::Vector(0.3f, 0.71f, 0.2f))%2 == 0);
+    }
+
+    bvh->clear();
+    CPPUNIT_ASSERT(bvh->empty());
+    CPPUNIT_ASSERT(bvh->countHits(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 0.0f, 0.0f)) == 0);
+    cerr << "BVH SPHERE PARITY PASSED" << endl;
+}
+
+void TestBVH::testMeshContainment()
+{
+    Mesh mesh;
+    cgp::Point inside = cgp::Point(0.6f, 0.2f, 0.3f);
+
+    mesh.validTetTest();
+    CPPUNIT_ASSERT(mesh.pointContainment(inside));
+    CPPUNIT_ASSERT(!mesh.pointContainment(cgp::Point(2.0f, 2.0f, 2.0f)));
+
+    // moving the mesh must rebuild the world-space hierarchy
+    mesh.setTranslation(cgp::Vector(5.0f, 0.0f, 0.0f));
+    CPPUNIT_ASSERT(!mesh.pointContainment(inside));
+    CPPUNIT_ASSERT(mesh.pointContainment(cgp::Point(5.6f, 0.2f, 0.3f)));
+    CPPUNIT_ASSERT(fabs(mesh.getWorldVerts()[0].x - ((* mesh.getVerts())[0].x + 5.0f)) < 1.0e-5f);
+
+    // multiple rays from the fixed direction table vote consistently
+    mesh.setRaySamples(7);
+    CPPUNIT_ASSERT(mesh.pointContainment(cgp::Point(5.6f, 0.2f, 0.3f)));
+    CPPUNIT_ASSERT(!mesh.pointContainment(inside));
+    cerr << "BVH MESH CONTAINMENT PASSED" << endl << endl;
+}
+
+void TestBVH::testAlignedContainment()
+{
+    Mesh mesh;
+    VoxelVolume vox(32, 4, 4, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(31.0f, 3.0f, 3.0f)); // rows are whole words
+    const float coords[] = {-0.5f, 0.0f, 1.0f, 1.5f, 2.0f, 3.0f};
+    int mismatch = 0;
+
+    // a cube from 0.5 to 2.5 tiled by unit squares, so that rays along an axis from points on the half grid run
+    // through the edges and vertices shared by its triangles
+    vox.fill(false);
+    for(int z = 1; z <= 2; z++)
+        for(int y = 1; y <= 2; y++)
+            for(int x = 1; x <= 2; x++)
+                vox.set(x, y, z, true);
+    mesh.voxelSurface(&vox);
+    for(int samples : {1, 3})
+    {
+        mesh.setRaySamples(samples);
+        for(float x : coords)
+            for(float y : coords)
+                for(float z : coords)
+                {
+                    bool inside = x > 0.5f && x < 2.5f && y > 0.5f && y < 2.5f && z > 0.5f && z < 2.5f;
+                    if(mesh.pointContainment(cgp::Point(x, y, z)) != inside)
+                        mismatch++;
+                }
+    }
+    CPPUNIT_ASSERT(mismatch == 0);
+    cerr << "BVH ALIGNED CONTAINMENT PASSED" << endl << endl;
+}
+
+void TestBVH::testScanVoxelise()
+{
+    Mesh mesh;
+    int x, y, z, dx, dy, dz, occupied = 0, mismatch = 0;
+
+    // offset frame so that voxel rows do not run exactly along tetrahedron faces
+    VoxelVolume vox(32, 24, 24, cgp::Point(-0.37f, -0.41f, -0.29f), cgp::Vector(2.03f, 2.03f, 2.03f));
+
+    mesh.validTetTest();
+    vox.fill(true); // must be overwritten
+    mesh.scanVoxelise(&vox);
+    vox.getDim(dx, dy, dz);
+    for(z = 0; z < dz; z++)
+        for(y = 0; y < dy; y++)
+            for(x = 0; x < dx; x++)
+            {
+                if(vox.get(x, y, z))
+                    occupied++;
+                if(vox.get(x, y, z) != mesh.pointContainment(vox.getVoxelPos(x, y, z)))
+                    mismatch++;
+            }
+    CPPUNIT_ASSERT(occupied > 0);
+    CPPUNIT_ASSERT(mismatch == 0);
+    cerr << "BVH SCAN VOXELISE PASSED" << endl << endl;
+}
+
+void TestBVH::testWindingNumber()
+{
+    WindingTree tree;
+    vector<cgp::Point> verts;
+    vector<int> faces;
+    int i, j, a, b, c, d, hole, slices = 40, stacks = 40;
+    float la, lo, sqd, w, rad = 3.0f;
+    cgp::Point pnt;
+
+    // latitude-longitude sphere, facing outwards
+    for(i = 0; i <= stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            la = PI * (float) i / (float) stacks;
+            lo = PI2 * (float) j / (float) slices;
+            verts.push_back(cgp::Point(rad*sinf(la)*cosf(lo), rad*sinf(la)*sinf(lo), rad*cosf(la)));
+        }
+    for(i = 0; i < stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            a = i*slices+j; b = i*slices+(j+1)%slices; c = (i+1)*slices+j; d = (i+1)*slices+(j+1)%slices;
+            faces.push_back(a); faces.push_back(c); faces.push_back(b);
+            faces.push_back(b); faces.push_back(c); faces.push_back(d);
+        }
+
+    for(hole = 0; hole < 2; hole++)
+    {
+        tree.build(verts, faces);
+        CPPUNIT_ASSERT(fabs(tree.windingNumber(cgp::Point(0.0f, 0.0f, 0.0f)) - 1.0f) < 0.1f);
+
+        srand(7);
+        for(i = 0; i < 1000; i++)
+        {
+            pnt = cgp::Point((float) (rand()%1000-500) / 100.0f, (float) (rand()%1000-500) / 100.0f, (float) (rand()%1000-500) / 100.0f);
+            sqd = pnt.x*pnt.x + pnt.y*pnt.y + pnt.z*pnt.z;
+            w = tree.windingNumber(pnt);
+            if(sqd < 0.9f * rad * rad)
+                CPPUNIT_ASSERT(w > 0.5f);
+            else if(sqd > 1.1f * rad * rad)
+                CPPUNIT_ASSERT(w < 0.5f);
+        }
+
+        // cut a band of 100 quads out of the sphere, which breaks ray parity but not the winding number
+        faces.erase(faces.begin() + 6 * 900, faces.begin() + 6 * 1000);
+    }
+
+    tree.clear();
+    CPPUNIT_ASSERT(tree.empty());
+    CPPUNIT_ASSERT(tree.windingNumber(cgp::Point(0.0f, 0.0f, 0.0f)) == 0.0f);
+
+    // selectable as the mesh containment query
+    Mesh mesh;
+    mesh.validTetTest();
+    mesh.setContainment(MeshContainment::WINDING);
+    CPPUNIT_ASSERT(mesh.pointContainment(cgp::Point(0.6f, 0.2f, 0.3f)));
+    CPPUNIT_ASSERT(!mesh.pointContainment(cgp::Point(2.0f, 2.0f, 2.0f)));
+    cerr << "BVH WINDING NUMBER PASSED" << endl << endl;
+}
+
+void TestBVH::testBatchContainment()
+{
+    Sphere sph(cgp::Point(0.1f, 0.2f, 0.0f), 0.7f);
+    Cylinder cyl(cgp::Point(-0.5f, 0.0f, 0.1f), cgp::Point(0.6f, 0.3f, -0.2f), 0.4f);
+    Square sq(cgp::Point(-0.3f, -0.4f, -0.2f), 0.8f);
+    Mesh mesh;
+    BaseShape * shapes[4] = {&sph, &cyl, &sq, &mesh};
+    vector<cgp::Point> pts;
+    uint8_t inside[1000];
+    int mismatch = 0, occupied = 0;
+
+    mesh.validTetTest();
+    srand(11);
+    for(int i = 0; i < 1000; i++)
+        pts.push_back(cgp::Point((float) rand() / RAND_MAX * 2.0f - 1.0f, (float) rand() / RAND_MAX * 2.0f - 1.0f,
+                                 (float) rand() / RAND_MAX * 2.0f - 1.0f));
+    for(int s = 0; s < 4; s++)
+    {
+        shapes[s]->containment(&pts[0], pts.size(), inside);
+        for(int i = 0; i < (int) pts.size(); i++)
+        {
+            if(inside[i])
+                occupied++;
+            if((inside[i] != 0) != shapes[s]->pointContainment(pts[i]))
+                mismatch++;
+        }
+    }
+    CPPUNIT_ASSERT(occupied > 0);
+    CPPUNIT_ASSERT(mismatch == 0);
+    cerr << "BVH BATCH CONTAINMENT PASSED" << endl << endl;
+}
+
+void TestBVH::testClosestDistance()
+{
+    vector<cgp::Point> verts;
+    vector<int> faces = {0, 1, 2, 0, 2, 3};
+
+    // unit square in the z = 0 plane, split into two triangles
+    verts.push_back(cgp::Point(0.0f, 0.0f, 0.0f));
+    verts.push_back(cgp::Point(1.0f, 0.0f, 0.0f));
+    verts.push_back(cgp::Point(1.0f, 1.0f, 0.0f));
+    verts.push_back(cgp::Point(0.0f, 1.0f, 0.0f));
+    bvh->build(verts, faces);
+
+    CPPUNIT_ASSERT(fabs(bvh->closestDistance(cgp::Point(0.3f, 0.6f, 2.0f), 10.0f) - 2.0f) < 1.0e-5f); // face
+    CPPUNIT_ASSERT(fabs(bvh->closestDistance(cgp::Point(0.5f, 0.5f, -0.5f), 10.0f) - 0.5f) < 1.0e-5f); // shared diagonal
+    CPPUNIT_ASSERT(fabs(bvh->closestDistance(cgp::Point(3.0f, 0.5f, 0.0f), 10.0f) - 2.0f) < 1.0e-5f); // edge
+    CPPUNIT_ASSERT(fabs(bvh->closestDistance(cgp::Point(-3.0f, -4.0f, 0.0f), 10.0f) - 5.0f) < 1.0e-5f); // vertex
+    CPPUNIT_ASSERT(bvh->closestDistance(cgp::Point(0.5f, 0.5f, 5.0f), 3.0f) == 3.0f); // beyond the search
+    CPPUNIT_ASSERT(fabs(bvh->closestDistance(cgp::Point(0.5f, 0.5f, 0.0f), 10.0f)) < 1.0e-5f); // on the surface
+
+    bvh->clear();
+    CPPUNIT_ASSERT(bvh->closestDistance(cgp::Point(0.0f, 0.0f, 0.0f), 4.0f) == 4.0f);
+    cerr << "BVH CLOSEST DISTANCE PASSED" << endl << endl;
+}
+
+void TestBVH::testClosestHit()
+{
+    vector<cgp::Point> verts;
+    vector<int> faces;
+    vector<BVHHit> hits;
+    BVHRayHit hit;
+    MeshPick pick;
+    Mesh mesh;
+    int i, j, a, b, c, d, slices = 30, stacks = 30, numhit = 0;
+    float la, lo, rad = 3.0f;
+
+    // latitude-longitude sphere, as for testSphereParity
+    for(i = 0; i <= stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            la = PI * (float) i / (float) stacks;
+            lo = PI2 * (float) j / (float) slices;
+            verts.push_back(cgp::Point(rad*sinf(la)*cosf(lo), rad*sinf(la)*sinf(lo), rad*cosf(la)));
+        }
+    for(i = 0; i < stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            a = i*slices+j; b = i*slices+(j+1)%slices; c = (i+1)*slices+j; d = (i+1)*slices+(j+1)%slices;
+            faces.push_back(a); faces.push_back(c); faces.push_back(b);
+            faces.push_back(b); faces.push_back(c); faces.push_back(d);
+        }
+    bvh->build(verts, faces);
+
+    // rays from outside and inside the sphere, towards it and away from it
+    srand(11);
+    for(i = 0; i < 1000; i++)
+    {
+        cgp::Point o(8.0f * (float) rand() / (float) RAND_MAX - 4.0f, 8.0f * (float) rand() / (float) RAND_MAX - 4.0f,
+                     8.0f * (float) rand() / (float) RAND_MAX - 4.0f);
+        cgp::Vector dir(2.0f * (float) rand() / (float) RAND_MAX - 1.0f, 2.0f * (float) rand() / (float) RAND_MAX - 1.0f,
+                        2.0f * (float) rand() / (float) RAND_MAX - 1.0f);
+        float tmin = HUGE_VALF;
+
+        hits.clear();
+        bvh->rayHits(o, dir, hits);
+        for(BVHHit &h: hits)
+            tmin = std::min(tmin, h.t);
+        CPPUNIT_ASSERT(bvh->closestHit(o, dir, hit) == !hits.empty());
+        if(hits.empty())
+            continue;
+        numhit++;
+        CPPUNIT_ASSERT(hit.t == tmin);
+        CPPUNIT_ASSERT(hit.u >= 0.0f && hit.v >= 0.0f && hit.u + hit.v <= 1.0f);
+
+        const cgp::Point &p0 = verts[faces[3*hit.tri]], &p1 = verts[faces[3*hit.tri+1]], &p2 = verts[faces[3*hit.tri+2]];
+        float w = 1.0f - hit.u - hit.v;
+        cgp::Point bary(w*p0.x + hit.u*p1.x + hit.v*p2.x, w*p0.y + hit.u*p1.y + hit.v*p2.y, w*p0.z + hit.u*p1.z + hit.v*p2.z);
+        cgp::Point along(o.x + hit.t*dir.i, o.y + hit.t*dir.j, o.z + hit.t*dir.k);
+        CPPUNIT_ASSERT(fabs(bary.x - along.x) + fabs(bary.y - along.y) + fabs(bary.z - along.z) < 1.0e-4f);
+    }
+    CPPUNIT_ASSERT(numhit > 100);
+    CPPUNIT_ASSERT(!bvh->closestHit(cgp::Point(0.0f, 0.0f, 10.0f), cgp::Vector(0.0f, 0.0f, 1.0f), hit));
+
+    // picking a transformed mesh reports the world-space hit at its distance along the ray
+    mesh.validTetTest();
+    mesh.setTranslation(cgp::Vector(5.0f, 0.0f, 0.0f));
+    CPPUNIT_ASSERT(mesh.pickRay(cgp::Point(5.25f, 0.25f, -10.0f), cgp::Vector(0.0f, 0.0f, 2.0f), pick));
+    CPPUNIT_ASSERT(fabs(pick.pnt.z) < 1.0e-5f && fabs(pick.dist - 10.0f) < 1.0e-5f);
+    CPPUNIT_ASSERT(fabs(pick.bary[0] + pick.bary[1] + pick.bary[2] - 1.0f) < 1.0e-5f);
+    CPPUNIT_ASSERT(!mesh.pickRay(cgp::Point(0.25f, 0.25f, -10.0f), cgp::Vector(0.0f, 0.0f, 1.0f), pick));
+    cerr << "BVH CLOSEST HIT PASSED" << endl << endl;
+}
+
+//#if 0 /* Disabled since it crashes the whole test suite */
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBVH, TestSet::perBuild());
+//#endif
+
+/// Order crossings by triangle, so that lists gathered in different traversal orders compare equal
+static void sortHits(vector<BVHHit> &hits)
+{
+    std::sort(hits.begin(), hits.end(), [](const BVHHit &h0, const BVHHit &h1){ return h0.tri < h1.tri; });
+}
+
+void TestBVH::testPacketHits()
+{
+    vector<cgp::Point> verts;
+    vector<int> faces;
+    vector<BVHHit> single, packet[bvhpacket];
+    cgp::Point origins[bvhpacket];
+    cgp::Vector dirs[2] = {cgp::Vector(1.0f, 0.0f, 0.0f), cgp::Vector(0.3f, 0.71f, 0.2f)};
+    int i, j, a, b, c, d, r, slices = 40, stacks = 40, total = 0;
+    float la, lo, rad = 3.0f;
+
+    for(i = 0; i <= stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            la = PI * (float) i / (float) stacks;
+            lo = PI2 * (float) j / (float) slices;
+            verts.push_back(cgp::Point(rad*sinf(la)*cosf(lo), rad*sinf(la)*sinf(lo), rad*cosf(la)));
+        }
+    for(i = 0; i < stacks; i++)
+        for(j = 0; j < slices; j++)
+        {
+            a = i*slices+j; b = i*slices+(j+1)%slices; c = (i+1)*slices+j; d = (i+1)*slices+(j+1)%slices;
+            faces.push_back(a); faces.push_back(c); faces.push_back(b);
+            faces.push_back(b); faces.push_back(c); faces.push_back(d);
+        }
+    bvh->build(verts, faces);
+
+    // packets of every size, from origins inside, outside and beyond the sphere
+    srand(11);
+    for(const cgp::Vector &dir : dirs)
+        for(int n = 1; n <= bvhpacket; n++)
+            for(int trial = 0; trial < 20; trial++)
+            {
+                for(r = 0; r < n; r++)
+                {
+                    origins[r] = cgp::Point((float) (rand()%800-400) / 100.0f, (float) (rand()%800-400) / 100.0f, (float) (rand()%800-400) / 100.0f);
+                    packet[r].clear();
+                }
+                bvh->packetHits(origins, n, dir, packet);
+                for(r = 0; r < n; r++)
+                {
+                    single.clear();
+                    bvh->rayHits(origins[r], dir, single);
+                    sortHits(single);
+                    sortHits(packet[r]);
+                    CPPUNIT_ASSERT(single.size() == packet[r].size());
+                    for(i = 0; i < (int) single.size(); i++)
+                    {
+                        CPPUNIT_ASSERT(fabsf(single[i].t - packet[r][i].t) <= 1.0e-5f * std::max(single[i].t, 1.0f)); // fused multiplies may differ
+                        CPPUNIT_ASSERT(single[i].tri == packet[r][i].tri);
+                        CPPUNIT_ASSERT(single[i].front == packet[r][i].front);
+                    }
+                    total += (int) single.size();
+                }
+            }
+    CPPUNIT_ASSERT(total > 0);
+
+    // whole layers of rows through a mesh, more than one packet at a time
+    Mesh mesh;
+    cgp::BoundBox bbox;
+    int dx, dy, dz;
+    VoxelVolume vox(32, 24, 24, cgp::Point(-0.37f, -0.41f, -0.29f), cgp::Vector(2.03f, 2.03f, 2.03f));
+    vector<vector<int>> rows;
+    vector<int> spans;
+
+    mesh.validTetTest();
+    mesh.getBounds(bbox);
+    vox.getDim(dx, dy, dz);
+    rows.resize(dy);
+    for(int z = 0; z < dz; z++)
+    {
+        mesh.scanRows(&vox, bbox, 0, z, dy, rows.data());
+        for(int y = 0; y < dy; y++)
+        {
+            mesh.scanRow(&vox, bbox, y, z, spans);
+            CPPUNIT_ASSERT(spans == rows[y]);
+        }
+    }
+    cerr << "BVH PACKET HITS PASSED" << endl << endl;
+}
+
+void TestBVH::testQueryCounters()
+{
+    vector<cgp::Point> verts = {cgp::Point(0.0f, 0.0f, 0.0f), cgp::Point(1.0f, 0.0f, 0.0f), cgp::Point(0.0f, 1.0f, 0.0f)};
+    vector<int> faces = {0, 1, 2};
+    Sphere sphere(cgp::Point(0.0f, 0.0f, 0.0f), 1.0f);
+    cgp::Point pts[10];
+    uint8_t inside[10];
+
+    stats::resetCounters();
+    bvh->build(verts, faces);
+    CPPUNIT_ASSERT(bvh->countHits(cgp::Point(0.2f, 0.2f, -1.0f), cgp::Vector(0.0f, 0.0f, 1.0f)) == 1);
+    for(int i = 0; i < 10; i++)
+        pts[i] = cgp::Point(0.2f * (float) i, 0.0f, 0.0f);
+    sphere.containment(pts, 10, inside);
+    sphere.pointContainment(pts[0]);
+
+    if(stats::isCountingEnabled())
+    {
+        // a single triangle is one leaf, tested once
+        CPPUNIT_ASSERT(stats::getCount(stats::Counter::RAY_TRIANGLE_TESTS) == 1);
+        CPPUNIT_ASSERT(stats::getCount(stats::Counter::BVH_NODES_VISITED) >= 1);
+        CPPUNIT_ASSERT(stats::getCount(stats::Counter::SPHERE_CONTAINMENT) == 11);
+        CPPUNIT_ASSERT(stats::getCount(stats::Counter::MESH_CONTAINMENT) == 0);
+        stats::resetCounters();
+    }
+    for(int c = 0; c < (int) stats::Counter::COUNT; c++)
+        CPPUNIT_ASSERT(stats::getCount((stats::Counter) c) == 0);
+    cerr << "BVH QUERY COUNTERS PASSED" << endl << endl;
+}
@@ -0,0 +1,92 @@
+#ifndef TILER_TEST_BVH_H
+#define TILER_TEST_BVH_H
+
+#include <string>
+#include <cppunit/extensions/HelperMacros.h>
+#include "tesselate/mesh.h"
+#include "tesselate/winding.h"
+
+/// Test code for @ref BVH
+class TestBVH : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestBVH);
+    CPPUNIT_TEST(testSphereParity);
+    CPPUNIT_TEST(testMeshContainment);
+    CPPUNIT_TEST(testAlignedContainment);
+    CPPUNIT_TEST(testScanVoxelise);
+    CPPUNIT_TEST(testWindingNumber);
+    CPPUNIT_TEST(testBatchContainment);
+    CPPUNIT_TEST(testClosestDistance);
+    CPPUNIT_TEST(testClosestHit);
+    CPPUNIT_TEST(testPacketHits);
+    CPPUNIT_TEST(testQueryCounters);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    BVH * bvh;
+
+public:
+
+    /// Initialization before unit tests
+    void setUp();
+
+    /// Tidying up after unit tests
+    void tearDown();
+
+    /**
+     * Compare ray crossing parity against analytic containment for a tesselated sphere
+     */
+    void testSphereParity();
+
+    /**
+     * Check that mesh containment queries track changes to the mesh transform
+     */
+    void testMeshContainment();
+
+    /**
+     * Check containment of points whose rays along the axes would pass through the edges and vertices shared by the
+     * triangles of an axis-aligned cube
+     */
+    void testAlignedContainment();
+
+    /**
+     * Check that row parity voxelisation agrees with per-voxel containment
+     */
+    void testScanVoxelise();
+
+    /**
+     * Check winding number containment on a closed sphere and on one with a band of triangles removed
+     */
+    void testWindingNumber();
+
+    /**
+     * Check that batched containment agrees with single point queries for every shape type
+     */
+    void testBatchContainment();
+
+    /**
+     * Check closest triangle distances against known distances to a square, including the vertex, edge and
+     * face regions of its triangles, and check that searches stop at the maximum distance
+     */
+    void testClosestDistance();
+
+    /**
+     * Check that the nearest ray crossing matches the nearest of all crossings, that its barycentric weights
+     * reconstruct the hit point, and that Mesh::pickRay reports the hit in world space
+     */
+    void testClosestHit();
+
+    /**
+     * Check that packets of rays through the wide hierarchy find exactly the crossings of single rays, for axis
+     * aligned and oblique directions, and that Mesh::scanRows matches Mesh::scanRow row by row
+     */
+    void testPacketHits();
+
+    /**
+     * Check that query counters total the ray-triangle tests, node visits and containment queries made, or stay at
+     * zero when counting is not compiled in
+     */
+    void testQueryCounters();
+};
+
+#endif /* !TILER_TEST_BVH_H */
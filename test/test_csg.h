@@ -13,6 +13,35 @@ class TestCSG : public CppUnit::TestFixture
 //    CPPUNIT_TEST(testSimpleCSG);
 //    CPPUNIT_TEST(testIntersectCSG);
 //    CPPUNIT_TEST(testExpensiveCSG);
+    CPPUNIT_TEST(testStreamCSG);
+    CPPUNIT_TEST(testStageCache);
+    CPPUNIT_TEST(testStageProgress);
+    CPPUNIT_TEST(testSceneFile);
+    CPPUNIT_TEST(testSimplifyCSG);
+    CPPUNIT_TEST(testAdaptiveVoxelise);
+    CPPUNIT_TEST(testIncrementalEdit);
+    CPPUNIT_TEST(testProgressive);
+    CPPUNIT_TEST(testMemoryBudget);
+    CPPUNIT_TEST(testScratchRelease);
+    CPPUNIT_TEST(testVoxelSceneReload);
+    CPPUNIT_TEST(testVoxeliseToFile);
+    CPPUNIT_TEST(testExtractSlabs);
+    CPPUNIT_TEST(testGPUVoxelise);
+    CPPUNIT_TEST(testNodeKinds);
+    CPPUNIT_TEST(testPrimitiveRows);
+    CPPUNIT_TEST(testMeshInstances);
+    CPPUNIT_TEST(testParallel);
+    CPPUNIT_TEST(testDeterministicReduce);
+    CPPUNIT_TEST(testPartBatch);
+    CPPUNIT_TEST(testSharedSubtrees);
+    CPPUNIT_TEST(testSnapshots);
+    CPPUNIT_TEST(testSessions);
+    CPPUNIT_TEST(testPublishing);
+    CPPUNIT_TEST(testDexelCSG);
+    CPPUNIT_TEST(testResolutionTuning);
+    CPPUNIT_TEST(testPrefetch);
+    CPPUNIT_TEST(testLazyStages);
+    CPPUNIT_TEST(testSubtreeInstances);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -40,6 +69,170 @@ public:
      * Run expensiveScene and test voxel validity
      */
     void testExpensiveCSG();
+
+    /**
+     * Check that row-by-row evaluation of a compiled tree matches the recursive walk
+     */
+    void testStreamCSG();
+
+    /**
+     * Check that repeated voxelise and isoextract stages are served from the cache, and that changing the tree misses it
+     */
+    void testStageCache();
+
+    /**
+     * Check that voxelise reports full progress when it completes, and stops with the tree representation when cancelled
+     */
+    void testStageProgress();
+
+    /**
+     * Check that a scene file describing the sample scene voxelises identically to it, and that malformed files are rejected
+     */
+    void testSceneFile();
+
+    /**
+     * Check that simplifying trees with disjoint, redundant and chained operations leaves their voxels unchanged
+     */
+    void testSimplifyCSG();
+
+    /**
+     * Check that octree refinement of leaves produces the same voxels as testing every voxel centre
+     */
+    void testAdaptiveVoxelise();
+
+    /**
+     * Check that replacing shapes and re-running the pipeline on the dirty region alone matches a full run on the edited scene
+     */
+    void testIncrementalEdit();
+
+    /**
+     * Check that progressive voxelisation publishes coarse levels first and finishes with the same result as a direct run
+     */
+    void testProgressive();
+
+    /**
+     * Check that voxel storage is counted, and that a memory budget moves voxelisation to streaming and then sparse
+     * bricks without changing the result, or refuses it when even that does not fit
+     */
+    void testMemoryBudget();
+
+    /**
+     * Check that repeated walks give the same voxels and that no intermediate volumes outlive voxelisation
+     */
+    void testScratchRelease();
+
+    /**
+     * Check that reloading voxel block scenes, and replacing them with other scenes, does not accumulate meshes
+     */
+    void testVoxelSceneReload();
+
+    /**
+     * Check that voxelising into a compressed file a slab at a time matches voxelise, and that extracting from the file matches isoextract
+     */
+    void testVoxeliseToFile();
+
+    /**
+     * Check that out of core extraction hands on slabs that join without cracks into the surface isoextract gives,
+     * and that bands of layers extracted separately join into the same surface
+     */
+    void testExtractSlabs();
+
+    /**
+     * Check that voxelising on an OpenCL device, or on the CPU when there is none, gives the volume of the tree walk
+     */
+    void testGPUVoxelise();
+
+    /**
+     * Check that nodes and shapes report their kind, and that inline containment agrees with pointContainment
+     */
+    void testNodeKinds();
+
+    /**
+     * Check that primitives voxelised a word at a time over their row spans match pointContainment voxel by voxel,
+     * both streamed and by the tree walk
+     */
+    void testPrimitiveRows();
+
+    /**
+     * Check that mesh references share one asset per file, that a placed instance voxelises as a mesh holding the
+     * transformed vertices, and that changing the file invalidates its asset
+     */
+    void testMeshInstances();
+
+    /**
+     * Check that parallel loops cover their range once, that task groups nest inside a parallel region, that
+     * per-thread values reduce to the serial result, and that the thread count can be set and restored
+     */
+    void testParallel();
+
+    /**
+     * Check that parallel reductions of floating point sums, and the mesh and voxel checksums built on them, are
+     * bit for bit the same for any number of threads and inside a running parallel region
+     */
+    void testDeterministicReduce();
+
+    /**
+     * Check that a batch of parts writes the same surfaces as processing each part in its own scene, whether the
+     * parts share the team or run in turn, and that failed parts and malformed job files are reported
+     */
+    void testPartBatch();
+
+    /**
+     * Check that evaluating repeated subtrees once gives the same volume as evaluating every occurrence, by the
+     * walk and by the row program, and that the shared volumes are kept through an edit elsewhere in the tree
+     */
+    void testSharedSubtrees();
+
+    /**
+     * Check that stage snapshots restore the voxels and isosurface exactly, that undo and redo follow the branch
+     * last taken, that unchanged arrays are shared between snapshots, and that sparse volumes round trip
+     */
+    void testSnapshots();
+
+    /**
+     * Check that a session written to a binary archive reads back into a scene with the same tree, settings, volume
+     * and isosurface, including shared mesh assets and sparse volumes, that a lattice round trips alike, and that a
+     * stream that is not a session is rejected without changing the scene
+     */
+    void testSessions();
+
+    /**
+     * Check that published views stay unchanged while the scene moves on, share unchanged arrays with the history,
+     * and can be read by another thread while stages run
+     */
+    void testPublishing();
+
+    /**
+     * Check that evaluating the tree as span lists per row matches the recursive walk over packed volumes, with and
+     * without parity scans of mesh rows
+     */
+    void testDexelCSG();
+
+    /**
+     * Check that the predicted dimensions and triangle count at a voxel size match those of a full run, that a tuned
+     * voxel size fits its memory budget while a finer one does not, and that tuning without a budget is refused
+     */
+    void testResolutionTuning();
+
+    /**
+     * Check that prefetched meshes match those loaded directly whichever order they are taken in, that unqueued and
+     * unreadable files are reported, and that prefetching with a voxel size leaves every stage of a later run cached
+     */
+    void testPrefetch();
+
+    /**
+     * Check that require builds only the stages that are stale, that changing the smoothing or lattice out of order
+     * rebuilds from the kept isosurfaces to the same result as running the stages afresh, and that tree edits and
+     * direct stage runs invalidate what depends on them
+     */
+    void testLazyStages();
+
+    /**
+     * Check that subtrees defined once and placed by scene files voxelise as the same shapes with their transforms
+     * baked in, before and after a session round trip, that batched containment matches single points, and that
+     * bounds, distances and singular transforms are handled
+     */
+    void testSubtreeInstances();
 };
 
 #endif /* !TILER_TEST_CSG_H */
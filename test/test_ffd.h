@@ -12,6 +12,11 @@ class TestFFD : public CppUnit::TestFixture
     CPPUNIT_TEST(testCorners);
     CPPUNIT_TEST(testCenter);
     CPPUNIT_TEST(testIdentity);
+    CPPUNIT_TEST(testLocalNormals);
+    CPPUNIT_TEST(testBatchDeform);
+    CPPUNIT_TEST(testEmbedding);
+    CPPUNIT_TEST(testPickCP);
+    CPPUNIT_TEST(testBSpline);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -39,6 +44,33 @@ public:
      * Place random points in an undeformed FFD lattice and make sure that they are return unchanged
      */
     void testIdentity();
+
+    /**
+     * Deform part of a mesh and check that the locally updated normals match a full recomputation
+     */
+    void testLocalNormals();
+
+    /**
+     * Check that batch deformation matches single point deformation, including points outside the lattice and a partial final batch
+     */
+    void testBatchDeform();
+
+    /**
+     * Check that deformation through cached lattice weights tracks direct deformation over a sequence of control point moves
+     */
+    void testEmbedding();
+
+    /**
+     * Check that a ray picks the first control point sphere it meets, including moved control points, and picks
+     * nothing when it passes between the spheres or points away from them
+     */
+    void testPickCP();
+
+    /**
+     * Check that a fine B-spline lattice is the identity at rest, that moving a control point only moves points in the
+     * cells around it, and that batch and cached deformation match single point deformation
+     */
+    void testBSpline();
 };
 
 #endif /* !TILER_TEST_FFD_H */
@@ -8,7 +8,13 @@
 #include <cstdint>
 #include <sstream>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
+#include <map>
+#include <tuple>
+#include "tesselate/clvoxels.h"
+#include "common/parallel.h"
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -45,6 +51,473 @@ void TestMC::testSimpleMC()
     cerr << "MARCHING CUBES SIMPLE TEST PASSED" << endl << endl;
 }
 
+/// Enclosed volume of a closed, consistently wound mesh, as a sum of signed tetrahedra against the origin
+static float meshVolume(Mesh &mesh)
+{
+    vector<cgp::Point> &verts = * mesh.getVerts();
+    vector<Triangle> &tris = * mesh.getCubeTriangles();
+    double vol = 0.0;
+
+    for(int t = 0; t < (int) tris.size(); t++)
+    {
+        cgp::Point &a = verts[tris[t].v[0]], &b = verts[tris[t].v[1]], &c = verts[tris[t].v[2]];
+        vol += a.x * (b.y * c.z - b.z * c.y) - a.y * (b.x * c.z - b.z * c.x) + a.z * (b.x * c.y - b.y * c.x);
+    }
+    return (float) fabs(vol / 6.0);
+}
+
+void TestMC::testParallelMC()
+{
+    Mesh serial, threaded;
+    VoxelVolume vox(32, 32, 70, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(31.0f, 31.0f, 69.0f)); // several slabs of cells
+
+    cerr << endl << "PARALLEL MARCHING CUBES TEST" << endl;
+    for(int z = 0; z < 70; z++) // torus about the x axis, whose hole and rim both cross slab boundaries
+        for(int y = 0; y < 32; y++)
+            for(int x = 0; x < 32; x++)
+            {
+                float r = sqrtf((float) ((y-16)*(y-16) + (z-35)*(z-35))) - 9.0f;
+                vox.set(x, y, z, r * r + (x-16)*(x-16) <= 16.0f);
+            }
+
+    parallel::setThreads(1);
+    serial.marchingCubes(&vox);
+    parallel::setThreads(4);
+    threaded.marchingCubes(&vox);
+    parallel::setThreads(0);
+
+    CPPUNIT_ASSERT(serial.getNumFaces() > 0);
+    CPPUNIT_ASSERT_EQUAL(serial.getNumVerts(), threaded.getNumVerts());
+    CPPUNIT_ASSERT_EQUAL(serial.getNumFaces(), threaded.getNumFaces());
+    CPPUNIT_ASSERT(serial.basicValidity());
+    CPPUNIT_ASSERT(serial.manifoldValidity());
+    CPPUNIT_ASSERT(threaded.basicValidity());
+    CPPUNIT_ASSERT(threaded.manifoldValidity());
+    cerr << "PARALLEL MARCHING CUBES TEST PASSED" << endl << endl;
+}
+
+void TestMC::testBlockSurface()
+{
+    Mesh mesh;
+    VoxelVolume vox(32, 4, 4, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(31.0f, 3.0f, 3.0f)); // unit cells
+    cgp::Point first = cgp::Point(1.1f, 1.2f, 0.9f), second = cgp::Point(2.1f, 1.2f, 0.9f); // off the quad diagonals
+
+    // single voxel gives a closed cube
+    vox.set(1, 1, 1, true);
+    mesh.voxelSurface(&vox);
+    CPPUNIT_ASSERT(mesh.getNumVerts() == 8);
+    CPPUNIT_ASSERT(mesh.getNumFaces() == 12);
+    CPPUNIT_ASSERT(mesh.pointContainment(first));
+    CPPUNIT_ASSERT(!mesh.pointContainment(second));
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+
+    // neighbouring voxel removes the shared face from both cubes
+    vox.set(2, 1, 1, true);
+    mesh.voxelSurface(&vox);
+    CPPUNIT_ASSERT(mesh.getNumVerts() == 12);
+    CPPUNIT_ASSERT(mesh.getNumFaces() == 20);
+    CPPUNIT_ASSERT(mesh.pointContainment(second));
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+
+    // greedy meshing turns a solid row of voxels into a single box
+    vox.set(3, 1, 1, true);
+    vox.set(4, 1, 1, true);
+    mesh.voxelSurface(&vox, true);
+    CPPUNIT_ASSERT(mesh.getNumVerts() == 8);
+    CPPUNIT_ASSERT(mesh.getNumFaces() == 12);
+    CPPUNIT_ASSERT(mesh.pointContainment(cgp::Point(3.7f, 1.2f, 0.9f)));
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+    cerr << "BLOCK SURFACE TEST PASSED" << endl << endl;
+}
+
+void TestMC::testSTLStream()
+{
+    TempDirectory tmp("mctmp");
+    Mesh mesh, streamed;
+    VoxelMesher mesher;
+    STLStreamWriter out;
+    VoxelVolume vox(128, 128, 128, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(127.0f, 127.0f, 127.0f)); // unit cells
+    vector<cgp::Point> verts;
+    vector<int> faces;
+    uint32_t count;
+    size_t numt;
+    FILE * fp;
+
+    // a sphere large enough that the face-culled mesher hands on more than one batch
+    for(int z = 0; z < 128; z++)
+        for(int y = 0; y < 128; y++)
+            for(int x = 0; x < 128; x++)
+                vox.set(x, y, z, (x-64)*(x-64) + (y-64)*(y-64) + (z-64)*(z-64) <= 56*56);
+    mesher.extract(&vox, verts, faces);
+    numt = faces.size() / 3;
+    CPPUNIT_ASSERT((int) faces.size() > voxmeshbatch);
+    mesh.voxelSurface(&vox);
+
+    CPPUNIT_ASSERT(out.open("mctmp/blocks.stl"));
+    CPPUNIT_ASSERT(mesher.extract(&vox, out));
+    CPPUNIT_ASSERT(out.getNumTriangles() == numt);
+    CPPUNIT_ASSERT(out.close());
+    CPPUNIT_ASSERT(streamed.readSTL("mctmp/blocks.stl"));
+    CPPUNIT_ASSERT(streamed.getNumFaces() == (int) numt);
+    CPPUNIT_ASSERT(streamed.getNumVerts() == mesh.getNumVerts());
+    CPPUNIT_ASSERT(streamed.manifoldValidity());
+    CPPUNIT_ASSERT(fabs(meshVolume(streamed) - meshVolume(mesh)) < 1.0e-4f * meshVolume(mesh));
+
+    // repeated batches fill the buffer several times over, and the count covers them all
+    CPPUNIT_ASSERT(out.open("mctmp/repeat.stl"));
+    for(int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT(out.append(verts, faces));
+    CPPUNIT_ASSERT(3 * numt * stlrecordsize > stlstreambytes);
+    CPPUNIT_ASSERT(out.close());
+    fp = fopen("mctmp/repeat.stl", "rb");
+    CPPUNIT_ASSERT(fp != NULL);
+    CPPUNIT_ASSERT(fseek(fp, stlheadersize, SEEK_SET) == 0 && fread(&count, sizeof(uint32_t), 1, fp) == 1);
+    CPPUNIT_ASSERT(count == 3 * numt);
+    CPPUNIT_ASSERT(fseek(fp, 0, SEEK_END) == 0 && ftell(fp) == (long) (stlheadersize + 4 + 3 * numt * stlrecordsize));
+    fclose(fp);
+
+    // nothing is accepted once the file is closed
+    CPPUNIT_ASSERT(!out.append(verts, faces));
+    CPPUNIT_ASSERT(!out.close());
+    CPPUNIT_ASSERT(!out.open("mctmp/missing/blocks.stl"));
+    cerr << "STL STREAM TEST PASSED" << endl << endl;
+}
+
+void TestMC::testSmoothing()
+{
+    Mesh mesh;
+    VoxelVolume vox(32, 32, 32, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(31.0f, 31.0f, 31.0f)); // unit cells
+    float original, laplacian, taubin;
+
+    for(int z = 0; z < 32; z++)
+        for(int y = 0; y < 32; y++)
+            for(int x = 0; x < 32; x++)
+                vox.set(x, y, z, (x-16)*(x-16) + (y-16)*(y-16) + (z-16)*(z-16) <= 100);
+
+    mesh.marchingCubes(&vox);
+    original = meshVolume(mesh);
+    mesh.laplacianSmooth(10, 0.5f);
+    laplacian = meshVolume(mesh);
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+
+    mesh.marchingCubes(&vox);
+    mesh.taubinSmooth(10, 0.5f);
+    taubin = meshVolume(mesh);
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+
+    CPPUNIT_ASSERT(laplacian < original);
+    CPPUNIT_ASSERT(fabs(taubin - original) < 0.5f * fabs(laplacian - original));
+    cerr << "SMOOTHING TEST PASSED" << endl << endl;
+}
+
+void TestMC::testDecimation()
+{
+    Mesh mesh;
+    MeshDecimator decimator;
+    MeshTopology reduced;
+    VoxelVolume vox(32, 32, 32, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(31.0f, 31.0f, 31.0f)); // unit cells
+    std::vector<cgp::Point> verts;
+    std::vector<cgp::Vector> norms;
+    std::vector<int> faces;
+    double vol = 0.0;
+    float original;
+    int numtris, c, l;
+
+    for(int z = 0; z < 32; z++)
+        for(int y = 0; y < 32; y++)
+            for(int x = 0; x < 32; x++)
+                vox.set(x, y, z, (x-16)*(x-16) + (y-16)*(y-16) + (z-16)*(z-16) <= 100);
+    mesh.marchingCubes(&vox);
+    original = meshVolume(mesh);
+    numtris = mesh.getNumFaces();
+
+    // a quarter of the triangles, still closed and manifold, with about the same volume and every vertex near the sphere
+    decimator.decimate(mesh.getTopology(), mesh.getWorldVerts(), numtris / 4, verts, norms, faces);
+    CPPUNIT_ASSERT((int) faces.size() / 3 <= numtris / 4);
+    CPPUNIT_ASSERT((int) norms.size() == (int) verts.size());
+    reduced.build((int) verts.size(), faces);
+    for(c = 0; c < (int) faces.size(); c++)
+        CPPUNIT_ASSERT(reduced.twin(c) >= 0);
+    for(int t = 0; t < (int) faces.size() / 3; t++)
+    {
+        cgp::Point &a = verts[faces[3*t]], &b = verts[faces[3*t+1]], &e = verts[faces[3*t+2]];
+        vol += a.x * (b.y * e.z - b.z * e.y) - a.y * (b.x * e.z - b.z * e.x) + a.z * (b.x * e.y - b.y * e.x);
+    }
+    CPPUNIT_ASSERT(fabs(fabs(vol / 6.0) - original) < 0.05f * original);
+    for(int v = 0; v < (int) verts.size(); v++)
+    {
+        float dx = verts[v].x - 16.0f, dy = verts[v].y - 16.0f, dz = verts[v].z - 16.0f;
+        CPPUNIT_ASSERT(fabs(sqrt(dx*dx + dy*dy + dz*dz) - 10.0f) < 1.0f);
+    }
+
+    // display levels get successively coarser
+    for(l = 1; l <= meshlodlevels; l++)
+        CPPUNIT_ASSERT(mesh.getNumLODFaces(l) < mesh.getNumLODFaces(l-1));
+    cerr << "DECIMATION TEST PASSED" << endl << endl;
+}
+
+/// Vertex indices of a mesh, 3 per triangle
+static std::vector<int> meshFaces(Mesh &mesh)
+{
+    vector<Triangle> &tris = * mesh.getCubeTriangles();
+    std::vector<int> faces;
+
+    for(int t = 0; t < (int) tris.size(); t++)
+        faces.insert(faces.end(), tris[t].v, tris[t].v + 3);
+    return faces;
+}
+
+void TestMC::testCacheOrder()
+{
+    Mesh mesh, ordered;
+    VoxelVolume vox(32, 32, 32, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(31.0f, 31.0f, 31.0f)); // unit cells
+    TempDirectory tmp("mctmp");
+    float scanratio, orderedratio, original;
+    int v, numverts, numtris;
+
+    for(int z = 0; z < 32; z++)
+        for(int y = 0; y < 32; y++)
+            for(int x = 0; x < 32; x++)
+                vox.set(x, y, z, (x-16)*(x-16) + (y-16)*(y-16) + (z-16)*(z-16) <= 100);
+    mesh.marchingCubes(&vox);
+    numverts = mesh.getNumVerts();
+    numtris = mesh.getNumFaces();
+    original = meshVolume(mesh);
+    scanratio = VertexCacheOptimiser::missRatio(meshFaces(mesh), numverts, vcachesize);
+
+    // the reordering is applied on export, and the file holds the same closed surface with fewer cache misses
+    mesh.setCacheOrder(true);
+    CPPUNIT_ASSERT(mesh.writeMeshFile("mctmp/ordered.msh"));
+    CPPUNIT_ASSERT(ordered.readMeshFile("mctmp/ordered.msh"));
+    CPPUNIT_ASSERT(ordered.getNumVerts() == numverts && ordered.getNumFaces() == numtris);
+    CPPUNIT_ASSERT(ordered.manifoldValidity());
+    CPPUNIT_ASSERT(fabs(meshVolume(ordered) - original) < 1.0e-3f * original);
+    orderedratio = VertexCacheOptimiser::missRatio(meshFaces(ordered), numverts, vcachesize);
+    CPPUNIT_ASSERT(orderedratio < 0.8f * scanratio);
+
+    // vertices are numbered by first use, so the triangles walk the vertex array forwards
+    std::vector<int> faces = meshFaces(ordered);
+    for(v = 0; v < (int) faces.size() && faces[v] <= v; v++);
+    CPPUNIT_ASSERT(v == (int) faces.size());
+    cerr << "CACHE ORDER TEST PASSED" << endl << endl;
+}
+
+/// Largest distance of a mesh vertex from the surface of a sphere
+static float sphereError(Mesh &mesh, const cgp::Point &c, float r)
+{
+    float worst = 0.0f;
+    cgp::Vector delvec;
+
+    for(const cgp::Point &p : * mesh.getVerts())
+    {
+        delvec.diff(c, p);
+        worst = std::max(worst, (float) fabs(delvec.length() - r));
+    }
+    return worst;
+}
+
+void TestMC::testDistanceField()
+{
+    Mesh mesh;
+    Sphere ball(cgp::Point(8.0f, 8.0f, 8.0f), 5.3f);
+    DistanceField field(16, 16, 16, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(15.0f, 15.0f, 15.0f), 3.0f); // unit cells
+    VoxelVolume vox;
+    float interpolated, midpoint;
+
+    for(int z = 0; z < 16; z++)
+        for(int y = 0; y < 16; y++)
+            for(int x = 0; x < 16; x++)
+                field.set(x, y, z, ball.signedDistance(field.getVoxelPos(x, y, z), field.getBand()));
+    CPPUNIT_ASSERT(field.get(8, 8, 8) == -3.0f); // clamped to the band
+    CPPUNIT_ASSERT(fabs(field.get(8, 8, 14) - 0.7f) < 1.0e-5f);
+
+    mesh.marchingCubes(&field);
+    CPPUNIT_ASSERT(mesh.getNumFaces() > 0);
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+    interpolated = sphereError(mesh, cgp::Point(8.0f, 8.0f, 8.0f), 5.3f);
+
+    // the same occupancy without the distances
+    field.toVoxels(&vox);
+    CPPUNIT_ASSERT(vox.get(8, 8, 8) && !vox.get(8, 8, 14) && !vox.get(20, 8, 8)); // x is padded to a whole word
+    mesh.marchingCubes(&vox);
+    CPPUNIT_ASSERT(mesh.manifoldValidity());
+    midpoint = sphereError(mesh, cgp::Point(8.0f, 8.0f, 8.0f), 5.3f);
+
+    CPPUNIT_ASSERT(interpolated < 0.1f);
+    CPPUNIT_ASSERT(interpolated < 0.5f * midpoint);
+    cerr << "DISTANCE FIELD MC TEST PASSED" << endl << endl;
+}
+
 //#if 0 /* Disabled since it crashes the whole test suite */
+void TestMC::testDeviceSurface()
+{
+    Mesh mesh;
+    CLVoxeliser cl;
+    VoxelVolume vox(64, 64, 64, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(63.0f, 63.0f, 63.0f)); // unit cells
+    vector<unsigned int> dverts, dindices;
+    map<tuple<float, float, float>, int> cpuvert;
+    map<tuple<int, int, int>, int> cputri;
+    vector<int> remap;
+    int vol, numverts, numtris, dx, dy, dz;
+
+    cerr << "START DEVICE SURFACE TEST" << endl;
+    for(int z = 0; z < 64; z++)
+        for(int y = 0; y < 64; y++)
+            for(int x = 0; x < 64; x++)
+                vox.set(x, y, z, (x-31)*(x-31) + (y-32)*(y-32) + (z-30)*(z-30) <= 25*25);
+    mesh.marchingCubes(&vox);
+
+    // a scene extracts on the CPU when there is no device, and later when the mesh is asked for when there is one
+    csg->voxelise(2.0f); // empty scene
+    csg->getVox()->getDim(dx, dy, dz);
+    csg->getVox()->set(dx/2, dy/2, dz/2, true);
+    csg->setGPUIsosurface(true);
+    CPPUNIT_ASSERT(csg->isoextract());
+    CPPUNIT_ASSERT(csg->getMesh()->getNumVerts() == 6);
+    CPPUNIT_ASSERT(csg->getMesh()->getNumFaces() == 8);
+    csg->setGPUIsosurface(false);
+
+    if(!cl.available())
+    {
+        int dummy;
+        CPPUNIT_ASSERT(!cl.begin(&vox));
+        CPPUNIT_ASSERT(!cl.surfaceCounts(0, dummy, dummy));
+        cerr << "DEVICE SURFACE TEST PASSED WITHOUT A DEVICE" << endl << endl;
+        return;
+    }
+
+    CPPUNIT_ASSERT(cl.begin(&vox));
+    vol = cl.takeVolume();
+    CPPUNIT_ASSERT(vol >= 0);
+    CPPUNIT_ASSERT(cl.upload(vol, &vox));
+    CPPUNIT_ASSERT(cl.surfaceCounts(vol, numverts, numtris));
+    CPPUNIT_ASSERT(numverts == mesh.getNumVerts());
+    CPPUNIT_ASSERT(numtris == mesh.getNumFaces());
+    CPPUNIT_ASSERT(cl.readSurface(dverts, dindices));
+    cl.end();
+
+    // vertices are numbered differently, but sit at the same edge midpoints by the same arithmetic
+    vector<cgp::Point> &verts = * mesh.getVerts();
+    vector<Triangle> &tris = * mesh.getCubeTriangles();
+    for(int v = 0; v < (int) verts.size(); v++)
+        cpuvert[make_tuple(verts[v].x, verts[v].y, verts[v].z)] = v;
+    remap.resize(numverts);
+    for(int v = 0; v < numverts; v++)
+    {
+        float p[3];
+        memcpy(p, &dverts[4 * v], sizeof(p));
+        auto it = cpuvert.find(make_tuple(p[0], p[1], p[2]));
+        CPPUNIT_ASSERT(it != cpuvert.end());
+        remap[v] = it->second;
+
+        // normals point away from the sphere centre
+        uint32_t n = dverts[4 * v + 3];
+        float nx = (float) ((int32_t) (n << 22) >> 22), ny = (float) ((int32_t) (n << 12) >> 22), nz = (float) ((int32_t) (n << 2) >> 22);
+        CPPUNIT_ASSERT(nx * (p[0] - 31.0f) + ny * (p[1] - 32.0f) + nz * (p[2] - 30.0f) > 0.0f);
+    }
+
+    // and the same triangles with the same winding, whichever corner they start from
+    for(int t = 0; t < (int) tris.size(); t++)
+    {
+        const int * c = tris[t].v;
+        int first = (c[0] < c[1] && c[0] < c[2]) ? 0 : ((c[1] < c[2]) ? 1 : 2);
+        cputri[make_tuple(c[first], c[(first+1)%3], c[(first+2)%3])]++;
+    }
+    for(int t = 0; t < numtris; t++)
+    {
+        int c[3] = {remap[dindices[3*t]], remap[dindices[3*t+1]], remap[dindices[3*t+2]]};
+        int first = (c[0] < c[1] && c[0] < c[2]) ? 0 : ((c[1] < c[2]) ? 1 : 2);
+        auto it = cputri.find(make_tuple(c[first], c[(first+1)%3], c[(first+2)%3]));
+        CPPUNIT_ASSERT(it != cputri.end() && it->second > 0);
+        it->second--;
+    }
+    cerr << "DEVICE SURFACE TEST PASSED ON " << cl.getDeviceName() << endl << endl;
+}
+
+/**
+ * Count the triangles of a mesh that face away from a point inside it
+ * @param mesh  mesh to examine
+ * @param c     point the surface encloses
+ * @returns number of triangles whose winding normal points away from @a c
+ */
+static int outwardFaces(Mesh &mesh, const cgp::Point &c)
+{
+    vector<cgp::Point> &verts = * mesh.getVerts();
+    vector<Triangle> &tris = * mesh.getCubeTriangles();
+    int outward = 0;
+
+    for(int t = 0; t < (int) tris.size(); t++)
+    {
+        cgp::Point &a = verts[tris[t].v[0]], &b = verts[tris[t].v[1]], &d = verts[tris[t].v[2]];
+        cgp::Vector e1, e2, n, out;
+        e1.diff(a, b);
+        e2.diff(a, d);
+        n.cross(e1, e2);
+        out.diff(c, a);
+        outward += (n.dot(out) > 0.0f);
+    }
+    return outward;
+}
+
+void TestMC::testDualSurface()
+{
+    const int dim = 40;
+    Mesh mc, nets, dual;
+    cgp::Point centre(20.0f, 20.0f, 20.0f), corner(20.0f - 7.3f, 20.0f - 7.8f, 20.0f - 7.55f);
+    Sphere ball(centre, 13.3f);
+    DistanceField field(dim, dim, dim, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(dim - 1.0f, dim - 1.0f, dim - 1.0f), 3.0f); // unit cells
+    VoxelVolume vox;
+    float mccorner = 1.0e6f, dualcorner = 1.0e6f;
+    int dx, dy, dz;
+
+    // one voxel gives a cube with a vertex in each of the eight cells around it and a quad across each crossed edge
+    csg->setDualSurface(true);
+    csg->voxelise(1.0f); // empty scene
+    csg->getVox()->getDim(dx, dy, dz);
+    csg->getVox()->set(dx/2, dy/2, dz/2, true);
+    csg->isoextract();
+    CPPUNIT_ASSERT(csg->getMesh()->getNumVerts() == 8);
+    CPPUNIT_ASSERT(csg->getMesh()->getNumFaces() == 12);
+    CPPUNIT_ASSERT(csg->getMesh()->pointContainment(csg->getVox()->getVoxelPos(dx/2, dy/2, dz/2)));
+    CPPUNIT_ASSERT(csg->getMesh()->manifoldValidity());
+
+    // a sphere across several slabs is stitched into one closed surface, wound as marching cubes winds it
+    for(int z = 0; z < dim; z++)
+        for(int y = 0; y < dim; y++)
+            for(int x = 0; x < dim; x++)
+                field.set(x, y, z, ball.signedDistance(field.getVoxelPos(x, y, z), field.getBand()));
+    field.toVoxels(&vox);
+    mc.marchingCubes(&vox);
+    nets.surfaceNets(&vox);
+    CPPUNIT_ASSERT(nets.manifoldValidity());
+    CPPUNIT_ASSERT(outwardFaces(mc, centre) * 10 > mc.getNumFaces() * 9); // terrace steps may face slightly inwards
+    CPPUNIT_ASSERT(outwardFaces(nets, centre) == nets.getNumFaces());
+    CPPUNIT_ASSERT(fabs(meshVolume(nets) - meshVolume(mc)) < 0.05f * meshVolume(mc));
+    dual.dualContouring(&field);
+    CPPUNIT_ASSERT(dual.manifoldValidity());
+    CPPUNIT_ASSERT(outwardFaces(dual, centre) == dual.getNumFaces());
+    CPPUNIT_ASSERT(sphereError(dual, centre, 13.3f) < 0.1f);
+
+    // an exact box distance, whose corners dual contouring approaches markedly more closely than edge crossings do
+    for(int z = 0; z < dim; z++)
+        for(int y = 0; y < dim; y++)
+            for(int x = 0; x < dim; x++)
+            {
+                float q[3] = {fabsf(x - centre.x) - 7.3f, fabsf(y - centre.y) - 7.8f, fabsf(z - centre.z) - 7.55f}, outside = 0.0f;
+                for(int a = 0; a < 3; a++)
+                    outside += std::max(q[a], 0.0f) * std::max(q[a], 0.0f);
+                field.set(x, y, z, std::min(sqrtf(outside) + std::min(std::max(q[0], std::max(q[1], q[2])), 0.0f), field.getBand()));
+            }
+    mc.marchingCubes(&field);
+    dual.dualContouring(&field);
+    CPPUNIT_ASSERT(dual.manifoldValidity());
+    for(const cgp::Point &p : * mc.getVerts())
+        mccorner = std::min(mccorner, cgp::Vector(p.x - corner.x, p.y - corner.y, p.z - corner.z).length());
+    for(const cgp::Point &p : * dual.getVerts())
+        dualcorner = std::min(dualcorner, cgp::Vector(p.x - corner.x, p.y - corner.y, p.z - corner.z).length());
+    CPPUNIT_ASSERT(dualcorner < 0.6f * mccorner);
+    cerr << "DUAL SURFACE TEST PASSED" << endl << endl;
+}
+
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMC, TestSet::perBuild());
 //#endif
@@ -10,6 +10,15 @@ class TestMC : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestMC);
     CPPUNIT_TEST(testSimpleMC);
+    CPPUNIT_TEST(testParallelMC);
+    CPPUNIT_TEST(testBlockSurface);
+    CPPUNIT_TEST(testSTLStream);
+    CPPUNIT_TEST(testSmoothing);
+    CPPUNIT_TEST(testDecimation);
+    CPPUNIT_TEST(testCacheOrder);
+    CPPUNIT_TEST(testDistanceField);
+    CPPUNIT_TEST(testDeviceSurface);
+    CPPUNIT_TEST(testDualSurface);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -27,6 +36,58 @@ public:
      * Run simple set and get validity tests on marching cubes
      */
     void testSimpleMC();
+
+    /**
+     * Extract a volume spanning several slabs with one thread and with several, and check that both give the same
+     * closed, manifold surface
+     */
+    void testParallelMC();
+
+    /**
+     * Check that the block surface mesher emits only exposed faces and shares their vertices
+     */
+    void testBlockSurface();
+
+    /**
+     * Stream block surface batches and repeated batches past the buffer size into binary STL files, and check that
+     * the triangle count is filled in and that the file reads back as the same closed surface
+     */
+    void testSTLStream();
+
+    /**
+     * Smooth a marching cubes sphere and check that Taubin smoothing preserves its volume where Laplacian smoothing shrinks it
+     */
+    void testSmoothing();
+
+    /**
+     * Decimate a marching cubes sphere and check that the result stays closed and manifold and close to the sphere,
+     * and that the display levels of detail get successively coarser
+     */
+    void testDecimation();
+
+    /**
+     * Export a marching cubes sphere in vertex cache order and check that the surface is unchanged, that fewer
+     * vertices miss a simulated cache, and that vertices are numbered by first use
+     */
+    void testCacheOrder();
+
+    /**
+     * Extract a sphere from a distance field and from its thresholded voxels, and check that interpolated
+     * crossings put the surface much closer to the true sphere than edge midpoints do
+     */
+    void testDistanceField();
+
+    /**
+     * Extract a sphere on an OpenCL device, when there is one, and check that it has the vertices and triangles of
+     * Mesh::marchingCubes with outward normals, and that a scene asked for a device surface still hands out the CPU mesh
+     */
+    void testDeviceSurface();
+
+    /**
+     * Extract dual surfaces of a single voxel, a sphere spanning several slabs and a box, and check that they are
+     * closed, wound outwards like marching cubes, and that dual contouring keeps the corners of the box sharper
+     */
+    void testDualSurface();
 };
 
 #endif /* !TILER_TEST_MC_H */
@@ -11,6 +11,21 @@ class TestMesh : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestMesh);
 //    CPPUNIT_TEST(testMeshing);
+    CPPUNIT_TEST(testWeld);
+    CPPUNIT_TEST(testMeshImport);
+    CPPUNIT_TEST(testTopology);
+    CPPUNIT_TEST(testManifoldReport);
+    CPPUNIT_TEST(testFaceNorms);
+    CPPUNIT_TEST(testBatchedVectors);
+    CPPUNIT_TEST(testBoxFit);
+    CPPUNIT_TEST(testLogFilter);
+    CPPUNIT_TEST(testMergeMeshes);
+    CPPUNIT_TEST(testNormalPalette);
+    CPPUNIT_TEST(testMeshBoolean);
+    CPPUNIT_TEST(testCompressedMesh);
+    CPPUNIT_TEST(testCompressedHeaders);
+    CPPUNIT_TEST(testSlicing);
+    CPPUNIT_TEST(testSharedHandoff);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -29,6 +44,94 @@ public:
      * @pre bunny.stl must be located in the project root directory
      */
     void testMeshing();
+
+    /**
+     * Check that vertex welding merges points within tolerance, including across grid cell boundaries,
+     * and keeps apart points just beyond it
+     */
+    void testWeld();
+
+    /**
+     * Read a tetrahedron from ASCII STL and from OBJ with polygon and negative index faces, and round trip
+     * one through binary STL and the indexed mesh file
+     */
+    void testMeshImport();
+
+    /**
+     * Check vertex neighbours and half-edge twins on closed, open and overlapping tetrahedra
+     */
+    void testTopology();
+
+    /**
+     * Check that the manifold validity report attributes failing triangles to boundaries, pinched vertices and duplicates
+     */
+    void testManifoldReport();
+
+    /**
+     * Check that face normals, held apart from the packed triangle indices, are unit length and outward facing when
+     * derived and after round trips through binary STL and the reordering indexed mesh file
+     */
+    void testFaceNorms();
+
+    /**
+     * Check that the batched point and vector operations agree with the per-element cgp::Point and cgp::Vector ones
+     */
+    void testBatchedVectors();
+
+    /**
+     * Check that fitting meshes larger and smaller than a vertex chunk to a box centres them and scales their longest
+     * side to fit, with one thread and with several
+     */
+    void testBoxFit();
+
+    /**
+     * Check that diagnostic messages are filtered by level and module, and that filtered messages are not evaluated
+     */
+    void testLogFilter();
+
+    /**
+     * Check that merged parts keep their triangles, with indices rebased, and that only vertices where the parts
+     * overlap are welded
+     */
+    void testMergeMeshes();
+
+    /**
+     * Check that the normal palette keeps one entry per packed normal in order of first insertion, whether normals
+     * arrive one at a time or in a parallel batch
+     */
+    void testNormalPalette();
+
+    /**
+     * Check that set operations on the surfaces of overlapping boxes, including boxes sharing faces, give closed
+     * surfaces enclosing the expected volumes
+     */
+    void testMeshBoolean();
+
+    /**
+     * Check that a compressed isosurface spanning several blocks decodes to the same triangles, each possibly starting
+     * from another corner, with positions within half a quantisation step, that it reads back from a file smaller than
+     * the indexed mesh file, and that damaged data is rejected
+     */
+    void testCompressedMesh();
+
+    /**
+     * Check that compressed meshes cut short anywhere, including within a block's last value, are rejected, and that
+     * headers claiming more vertices or triangles than the data could hold are refused before anything is allocated
+     */
+    void testCompressedHeaders();
+
+    /**
+     * Check that slicing a closed isosurface gives one closed counterclockwise contour per layer enclosing the area
+     * of the sphere's cross-section, that voxel slices outline rings as an outer contour and a clockwise hole with
+     * the exact voxel area, keeping diagonally touching voxels apart, and that layers reach a CLI file in order
+     */
+    void testSlicing();
+
+    /**
+     * Check that a mesh published to shared memory is read in place with the same arrays and bytes as its indexed mesh
+     * file, that a second payload waits until the first is released, and that a larger voxel payload grows the segment
+     */
+    void testSharedHandoff();
 };
 
 #endif /* !TILER_TEST_MESH_H */
@@ -0,0 +1,145 @@
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <test/testutil.h>
+#include "test_perf.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <sys/resource.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "common/timer.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const float perfvoxlen = 0.1f;  ///< voxel side length of every scenario, as used by the viewer
+const int perfrepeats = 3;      ///< runs per scenario, of which the fastest is compared
+
+/// Voxel grids bundled in meshes/voxel, leaving out voxelisedgrid, which the voxeliser overwrites
+static const char * perfgrids[] = {"keyPiece", "voxelisedgrid_hat", "voxelisedgrid_hygrometer_v2",
+                                   "voxelisedgrid_sphere", "voxelisedgrid_v3"};
+
+/// Start a new peak resident memory measurement, where the kernel allows it
+static void resetPeakMemory()
+{
+    ofstream clear("/proc/self/clear_refs");
+    clear << "5"; // resets the high water mark, on Linux only
+}
+
+/// Peak resident memory in megabytes since the last reset, or since the process started if it could not be reset
+static double peakMemory()
+{
+    ifstream status("/proc/self/status");
+    string line;
+    struct rusage usage;
+
+    while(getline(status, line))
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            return atof(line.c_str() + 6) / 1024.0;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double) usage.ru_maxrss / 1024.0; // kilobytes on Linux
+}
+
+/**
+ * Run a scenario several times on fresh scenes
+ * @param load  builds the scene tree, which is timed with the rest of the pipeline
+ * @returns the fastest run, the peak memory of any run and the final triangle count
+ */
+static PerfMeasure runScenario(const function<void(Scene &)> &load)
+{
+    PerfMeasure result;
+
+    result.seconds = numeric_limits<double>::max();
+    result.peakmb = 0.0;
+    result.triangles = 0;
+    for(int r = 0; r < perfrepeats; r++)
+    {
+        Scene scene;
+        scene.setStreamCSG(true); // no voxel grid is written alongside the result
+
+        resetPeakMemory();
+        auto start = stats::clock_type::now();
+        load(scene);
+        scene.voxelise(perfvoxlen);
+        scene.isoextract();
+        scene.smooth();
+        result.seconds = min(result.seconds, chrono::duration<double>(stats::clock_type::now() - start).count());
+        result.peakmb = max(result.peakmb, peakMemory());
+        result.triangles = scene.getMesh()->getNumFaces();
+    }
+    return result;
+}
+
+void TestPerf::checkBaseline(const string &name, const PerfMeasure &result)
+{
+    const po::variables_map &vm = testGetOptions();
+    string filename = vm["perf-baseline"].as<string>();
+    double tolerance = vm["perf-tolerance"].as<double>();
+    map<string, PerfMeasure> baseline;
+    ifstream infile(filename);
+    string line;
+
+    cerr << "PERF " << name << ": " << result.seconds << "s, " << result.peakmb << "MB, " << result.triangles << " triangles" << endl;
+
+    // one scenario per line, as "name seconds peakmb triangles", with # comments
+    while(getline(infile, line))
+    {
+        istringstream row(line);
+        string entry;
+        PerfMeasure m;
+        if(line.empty() || line[0] == '#')
+            continue;
+        CPPUNIT_ASSERT_MESSAGE("malformed baseline line: " + line, (bool) (row >> entry >> m.seconds >> m.peakmb >> m.triangles));
+        baseline[entry] = m;
+    }
+    infile.close();
+
+    if(baseline.count(name) == 0 || vm.count("perf-update"))
+    {
+        baseline[name] = result;
+        ofstream outfile(filename);
+        outfile << "# scenario seconds peak_mb triangles, from tilertest --test=perf\n";
+        for(const auto &entry: baseline)
+            outfile << entry.first << ' ' << entry.second.seconds << ' ' << entry.second.peakmb << ' ' << entry.second.triangles << '\n';
+        CPPUNIT_ASSERT_MESSAGE("unable to write " + filename, (bool) outfile);
+        cerr << "PERF " << name << " recorded as the baseline in " << filename << endl;
+        return;
+    }
+
+    const PerfMeasure &base = baseline[name];
+    ostringstream msg;
+    msg << name << " against baseline " << base.seconds << "s, " << base.peakmb << "MB, " << base.triangles
+        << " triangles (rerun with --perf-update if the change is intended)";
+    CPPUNIT_ASSERT_MESSAGE("slower: " + msg.str(), result.seconds <= base.seconds * (1.0 + tolerance));
+    CPPUNIT_ASSERT_MESSAGE("more memory: " + msg.str(), result.peakmb <= base.peakmb * (1.0 + tolerance));
+    CPPUNIT_ASSERT_MESSAGE("different triangle count: " + msg.str(), result.triangles == base.triangles);
+}
+
+void TestPerf::testSampleScene()
+{
+    checkBaseline("sampleScene", runScenario([](Scene &scene){ scene.sampleScene(); }));
+}
+
+void TestPerf::testExpensiveScene()
+{
+    checkBaseline("expensiveScene", runScenario([](Scene &scene){ scene.expensiveScene("meshes/triangle/bunny.stl"); }));
+}
+
+void TestPerf::testVoxelMeshScenes()
+{
+    for(const char * grid: perfgrids)
+    {
+        string filename = string("meshes/voxel/") + grid;
+        checkBaseline(string("voxelMeshScene_") + grid, runScenario([&](Scene &scene){ scene.voxelMeshScene(filename); }));
+    }
+}
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestPerf, TestSet::perPerformance());
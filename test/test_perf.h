@@ -0,0 +1,57 @@
+#ifndef TILER_TEST_PERF_H
+#define TILER_TEST_PERF_H
+
+
+#include <string>
+#include <cppunit/extensions/HelperMacros.h>
+#include "tesselate/csg.h"
+
+/// Measurements of one pipeline scenario
+struct PerfMeasure
+{
+    double seconds;     ///< wall time of the fastest run, from loading the scene to smoothing its isosurface
+    double peakmb;      ///< peak resident memory during the runs, in megabytes
+    long triangles;     ///< triangles in the final isosurface
+};
+
+/**
+ * Performance regression checks on whole pipeline runs, compared against a baseline file recorded on the same
+ * machine. Selected with --test=perf, and not part of the build, commit or nightly suites, since timings vary
+ * between machines.
+ */
+class TestPerf : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestPerf);
+    CPPUNIT_TEST(testSampleScene);
+    CPPUNIT_TEST(testExpensiveScene);
+    CPPUNIT_TEST(testVoxelMeshScenes);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+
+    /**
+     * Compare a scenario against its baseline entry, recording it instead if there is none or an update was asked for
+     * @param name      scenario name
+     * @param result    measurements of the scenario
+     */
+    void checkBaseline(const std::string &name, const PerfMeasure &result);
+
+public:
+
+    /**
+     * Time the sample scene through voxelisation, isosurface extraction and smoothing
+     */
+    void testSampleScene();
+
+    /**
+     * Time expensiveScene on the bunny, which is dominated by mesh containment
+     */
+    void testExpensiveScene();
+
+    /**
+     * Time voxelMeshScene on each bundled voxel grid
+     */
+    void testVoxelMeshScenes();
+};
+
+#endif /* !TILER_TEST_PERF_H */
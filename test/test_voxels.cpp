@@ -4,11 +4,17 @@
 
 #include <test/testutil.h>
 #include "test_voxels.h"
+#include "common/pages.h"
 #include <stdio.h>
 #include <cstdint>
 #include <sstream>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <tuple>
+#include <algorithm>
+#include <unistd.h>
+#include <math.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -87,6 +93,1216 @@ void TestVoxels::testVoxelRegistration()
     cerr << "VOXEL REGISTRATION PASSED" << endl << endl;
 }
 
+void TestVoxels::testVoxelSetOps()
+{
+    VoxelVolume * other, * small;
+    int x, y, z, v;
+
+    vox->setDim(96, 8, 8);
+    other = new VoxelVolume(96, 8, 8, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f));
+
+    // spans crossing word boundaries
+    CPPUNIT_ASSERT(vox->setSpan(5, 70, 3, 4, true));
+    for(x = 0; x < 96; x++)
+        CPPUNIT_ASSERT(vox->get(x, 3, 4) == (x >= 5 && x < 70));
+    CPPUNIT_ASSERT(!vox->get(10, 4, 4));
+    CPPUNIT_ASSERT(vox->setSpan(-10, 200, 3, 4, false)); // clamped to the row
+    for(x = 0; x < 96; x++)
+        CPPUNIT_ASSERT(!vox->get(x, 3, 4));
+    CPPUNIT_ASSERT(!vox->setSpan(0, 10, 8, 0, true));
+
+    // compare word-level operators with the corresponding single voxel logic
+    srand(11);
+    for(v = 0; v < 3; v++)
+    {
+        bool ref[96][8][8];
+
+        vox->fill(false);
+        other->fill(false);
+        for(z = 0; z < 8; z++)
+            for(y = 0; y < 8; y++)
+                for(x = 0; x < 96; x++)
+                {
+                    if(rand()%2)
+                        vox->set(x, y, z, true);
+                    if(rand()%2)
+                        other->set(x, y, z, true);
+                    if(v == 0)
+                        ref[x][y][z] = vox->get(x, y, z) || other->get(x, y, z);
+                    else if(v == 1)
+                        ref[x][y][z] = vox->get(x, y, z) && other->get(x, y, z);
+                    else
+                        ref[x][y][z] = vox->get(x, y, z) && !other->get(x, y, z);
+                }
+
+        if(v == 0)
+            CPPUNIT_ASSERT(vox->unionWith(other));
+        else if(v == 1)
+            CPPUNIT_ASSERT(vox->intersectWith(other));
+        else
+            CPPUNIT_ASSERT(vox->subtract(other));
+        for(z = 0; z < 8; z++)
+            for(y = 0; y < 8; y++)
+                for(x = 0; x < 96; x++)
+                    CPPUNIT_ASSERT(vox->get(x, y, z) == ref[x][y][z]);
+    }
+
+    // mismatched volumes are rejected
+    small = new VoxelVolume(32, 8, 8, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f));
+    CPPUNIT_ASSERT(!vox->unionWith(small));
+    delete small;
+    delete other;
+    cerr << "VOXEL SET OPERATIONS PASSED" << endl << endl;
+}
+
+void TestVoxels::testVoxelRange()
+{
+    cgp::BoundBox bbox;
+    int lo[3], hi[3];
+
+    vox->setDim(64, 64, 64);
+    vox->setFrame(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(63.0f, 63.0f, 63.0f)); // unit spacing between voxel centres
+
+    // interior box is widened conservatively to the enclosing voxels
+    bbox.includePnt(cgp::Point(10.5f, 20.0f, 30.2f));
+    bbox.includePnt(cgp::Point(12.5f, 21.0f, 40.8f));
+    CPPUNIT_ASSERT(vox->getVoxelRange(bbox, lo, hi));
+    CPPUNIT_ASSERT(lo[0] == 10 && hi[0] == 13);
+    CPPUNIT_ASSERT(lo[1] == 20 && hi[1] == 21);
+    CPPUNIT_ASSERT(lo[2] == 30 && hi[2] == 41);
+
+    // partially overlapping box is clipped
+    bbox.reset();
+    bbox.includePnt(cgp::Point(-100.0f, 60.0f, -5.0f));
+    bbox.includePnt(cgp::Point(5.0f, 100.0f, 100.0f));
+    CPPUNIT_ASSERT(vox->getVoxelRange(bbox, lo, hi));
+    CPPUNIT_ASSERT(lo[0] == 0 && hi[0] == 5);
+    CPPUNIT_ASSERT(lo[1] == 60 && hi[1] == 63);
+    CPPUNIT_ASSERT(lo[2] == 0 && hi[2] == 63);
+
+    // disjoint and empty boxes
+    bbox.reset();
+    bbox.includePnt(cgp::Point(70.0f, 10.0f, 10.0f));
+    CPPUNIT_ASSERT(!vox->getVoxelRange(bbox, lo, hi));
+    bbox.reset();
+    CPPUNIT_ASSERT(!vox->getVoxelRange(bbox, lo, hi));
+    cerr << "VOXEL RANGE PASSED" << endl << endl;
+}
+
+void TestVoxels::testVoxelFile()
+{
+    TempDirectory tmp("voxtmp");
+    VoxelVolume * loaded;
+    cgp::Point corner;
+    cgp::Vector diag;
+    int x, y, z, dx, dy, dz;
+
+    vox->setDim(70, 20, 10);
+    vox->setFrame(cgp::Point(-1.0f, -2.0f, -3.0f), cgp::Vector(4.0f, 5.0f, 6.0f));
+    srand(5);
+    for(z = 0; z < 10; z++)
+        for(y = 0; y < 20; y++)
+            for(x = 0; x < 70; x++)
+                vox->set(x, y, z, rand()%3 == 0);
+    CPPUNIT_ASSERT(vox->writeVoxels("voxtmp/test.vox"));
+    CPPUNIT_ASSERT(VoxelVolume::isVoxelFile("voxtmp/test.vox"));
+    CPPUNIT_ASSERT(!VoxelVolume::isVoxelFile("voxtmp/missing.vox"));
+
+    loaded = new VoxelVolume();
+    CPPUNIT_ASSERT(loaded->readVoxels("voxtmp/test.vox"));
+    loaded->getDim(dx, dy, dz);
+    CPPUNIT_ASSERT(dx == 96 && dy == 20 && dz == 10);
+    loaded->getFrame(corner, diag);
+    CPPUNIT_ASSERT(corner == cgp::Point(-1.0f, -2.0f, -3.0f));
+    CPPUNIT_ASSERT(diag == cgp::Vector(4.0f, 5.0f, 6.0f));
+    for(z = 0; z < dz; z++)
+        for(y = 0; y < dy; y++)
+            for(x = 0; x < dx; x++)
+                CPPUNIT_ASSERT(loaded->get(x, y, z) == vox->get(x, y, z));
+
+    // edits to a loaded volume are private to it
+    loaded->fill(true);
+    delete loaded;
+    loaded = new VoxelVolume();
+    CPPUNIT_ASSERT(loaded->readVoxels("voxtmp/test.vox"));
+    CPPUNIT_ASSERT(loaded->get(0, 0, 0) == vox->get(0, 0, 0));
+    loaded->setDim(8, 8, 8); // replaces the mapping
+    CPPUNIT_ASSERT(!loaded->get(0, 0, 0));
+    delete loaded;
+
+    CPPUNIT_ASSERT(!vox->readVoxels("voxtmp/missing.vox"));
+    cerr << "VOXEL FILE PASSED" << endl << endl;
+}
+
+void TestVoxels::testMCRowCodes()
+{
+    unsigned char codes[127];
+    int x, y, z, mismatches = 0;
+
+    // 100 voxels per row are padded to 128, with a solid block and noise spanning word boundaries
+    vox->setDim(100, 6, 5);
+    vox->fill(false);
+    for(z = 1; z < 4; z++)
+        for(y = 1; y < 5; y++)
+            CPPUNIT_ASSERT(vox->setSpan(20, 80, y, z, true));
+    srand(7);
+    for(x = 0; x < 200; x++)
+        vox->set(rand()%100, rand()%6, 3, (bool) (rand()%2));
+
+    for(z = 0; z < 4; z++)
+        for(y = 0; y < 5; y++)
+        {
+            bool active = vox->getMCRowCodes(y, z, codes), mixed = false;
+            for(x = 0; x < 127; x++)
+            {
+                int vcode = vox->getMCVertIdx(x, y, z);
+                if(vcode != 0 && vcode != 255)
+                    mixed = true;
+                if(codes[x] != vcode)
+                    mismatches++;
+            }
+            CPPUNIT_ASSERT(active == mixed);
+        }
+    CPPUNIT_ASSERT(mismatches == 0);
+
+    // uniform rows are skipped
+    vox->fill(true);
+    CPPUNIT_ASSERT(!vox->getMCRowCodes(2, 2, codes));
+    CPPUNIT_ASSERT(codes[0] == 0 && codes[126] == 0);
+    CPPUNIT_ASSERT(!vox->getMCRowCodes(5, 0, codes));
+    cerr << "MC ROW CODES PASSED" << endl << endl;
+}
+
+void TestVoxels::testSparseVolume()
+{
+    VoxelVolume * dense, * other;
+    unsigned char dcodes[127], scodes[127];
+    int x, y, z, i, op, mismatches = 0;
+
+    // 20 rows in y and z leave partially covered bricks on the far sides
+    vox->setDim(128, 20, 20);
+    vox->setSparse(true);
+    CPPUNIT_ASSERT(vox->isSparse());
+    dense = new VoxelVolume(128, 20, 20, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f));
+    other = new VoxelVolume(128, 20, 20, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f));
+
+    // an empty sparse volume holds no bricks, only the brick table
+    CPPUNIT_ASSERT(vox->getStorageBytes() < dense->getStorageBytes() / 4);
+
+    for(op = 0; op < 3; op++)
+    {
+        // same edits applied to both, solid blocks give uniform bricks and noise gives mixed ones
+        vox->fill(false); dense->fill(false); other->fill(false);
+        for(z = 0; z < 16; z++)
+            for(y = 0; y < 16; y++)
+            {
+                CPPUNIT_ASSERT(vox->setSpan(0, 64, y, z, true));
+                CPPUNIT_ASSERT(dense->setSpan(0, 64, y, z, true));
+            }
+        for(i = 0; i < 300; i++)
+        {
+            x = rand()%128; y = rand()%20; z = rand()%20;
+            bool val = (bool) (rand()%2);
+            vox->set(x, y, z, val);
+            dense->set(x, y, z, val);
+            other->set(rand()%128, rand()%20, rand()%20, true);
+        }
+        for(z = 8; z < 20; z++)
+            for(y = 0; y < 20; y++)
+                other->setSpan(32, 128, y, z, true);
+
+        // alternate which operand is sparse
+        other->setSparse(op == 1);
+        if(op == 0)
+        {
+            CPPUNIT_ASSERT(vox->unionWith(other));
+            CPPUNIT_ASSERT(dense->unionWith(other));
+        }
+        else if(op == 1)
+        {
+            CPPUNIT_ASSERT(vox->intersectWith(other));
+            CPPUNIT_ASSERT(dense->intersectWith(other));
+        }
+        else
+        {
+            CPPUNIT_ASSERT(vox->subtract(other));
+            CPPUNIT_ASSERT(dense->subtract(other));
+        }
+        other->setSparse(false);
+
+        for(z = 0; z < 20; z++)
+            for(y = 0; y < 20; y++)
+            {
+                for(x = 0; x < 128; x++)
+                    if(vox->get(x, y, z) != dense->get(x, y, z))
+                        mismatches++;
+                if(y < 19 && z < 19)
+                {
+                    CPPUNIT_ASSERT(vox->getMCRowCodes(y, z, scodes) == dense->getMCRowCodes(y, z, dcodes));
+                    if(memcmp(scodes, dcodes, 127) != 0)
+                        mismatches++;
+                }
+            }
+    }
+    CPPUNIT_ASSERT(mismatches == 0);
+
+    // converting back preserves contents
+    vox->setSparse(false);
+    CPPUNIT_ASSERT(!vox->isSparse());
+    for(z = 0; z < 20; z++)
+        for(y = 0; y < 20; y++)
+            for(x = 0; x < 128; x++)
+                if(vox->get(x, y, z) != dense->get(x, y, z))
+                    mismatches++;
+    CPPUNIT_ASSERT(mismatches == 0);
+
+    delete dense;
+    delete other;
+}
+
+void TestVoxels::testSurfaceVoxels()
+{
+    std::vector<cgp::Point> centres, expected;
+    std::vector<int> cells;
+    VoxelVolume shell;
+    int x, y, z, i, pass, d, count;
+    const int off[6][3] = {{-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+
+    // 70 voxels along x leave a partially used last word, whose padding must not hide the end of a row
+    vox->setDim(70, 18, 12);
+    vox->setFrame(cgp::Point(-1.0f, -1.0f, -1.0f), cgp::Vector(2.0f, 2.0f, 2.0f));
+    for(z = 2; z < 10; z++)
+        for(y = 0; y < 18; y++)
+            CPPUNIT_ASSERT(vox->setSpan(5, 70, y, z, true));
+    for(i = 0; i < 200; i++)
+        vox->set(rand()%70, rand()%18, rand()%12, (bool) (rand()%2));
+
+    for(z = 0; z < 12; z++)
+        for(y = 0; y < 18; y++)
+            for(x = 0; x < 70; x++)
+                if(vox->get(x, y, z))
+                {
+                    bool exposed = false;
+
+                    for(d = 0; d < 6 && !exposed; d++)
+                    {
+                        int nx = x + off[d][0], ny = y + off[d][1], nz = z + off[d][2];
+                        exposed = (nx < 0 || nx >= 70 || ny < 0 || ny >= 18 || nz < 0 || nz >= 12 || !vox->get(nx, ny, nz));
+                    }
+                    if(exposed)
+                        expected.push_back(vox->getVoxelPos(x, y, z));
+                }
+    CPPUNIT_ASSERT(!expected.empty());
+
+    for(pass = 0; pass < 2; pass++)
+    {
+        vox->setSparse(pass == 1);
+        vox->getSurfaceVoxels(centres);
+        CPPUNIT_ASSERT(centres.size() == expected.size());
+        for(i = 0; i < (int) expected.size(); i++)
+        {
+            CPPUNIT_ASSERT(centres[i].x == expected[i].x);
+            CPPUNIT_ASSERT(centres[i].y == expected[i].y);
+            CPPUNIT_ASSERT(centres[i].z == expected[i].z);
+        }
+
+        // the shell bitmap holds exactly the listed voxels
+        CPPUNIT_ASSERT(vox->getShell(NULL) == expected.size());
+        CPPUNIT_ASSERT(vox->getShell(&shell) == expected.size());
+        vox->getShellVoxels(cells);
+        CPPUNIT_ASSERT(cells.size() == 3 * expected.size());
+        for(i = 0; i < (int) cells.size(); i += 3)
+            CPPUNIT_ASSERT(shell.get(cells[i], cells[i+1], cells[i+2]));
+        for(z = 0, count = 0; z < 12; z++)
+            for(y = 0; y < 18; y++)
+                for(x = 0; x < 70; x++)
+                    count += (int) shell.get(x, y, z);
+        CPPUNIT_ASSERT(count == (int) expected.size());
+    }
+    vox->setSparse(false);
+}
+
 //#if 0 /* Disabled since it crashes the whole test suite */
+void TestVoxels::testUncheckedAccess()
+{
+    vector<unsigned int> words;
+    int x, y, z, mismatches = 0;
+
+    vox->setDim(70, 9, 11);
+    words.resize(vox->getXSpan());
+    for(int sparse = 0; sparse < 2; sparse++)
+    {
+        vox->setSparse(sparse == 1);
+        vox->fill(false);
+        for(z = 0; z < 11; z++)
+            for(y = 0; y < 9; y++)
+                for(x = 0; x < 70; x++)
+                    if((x * 7 + y * 3 + z) % 5 == 0)
+                        vox->setUnchecked(x, y, z, true);
+        vox->set(69, 8, 10, true);
+        vox->setUnchecked(69, 8, 10, false);
+
+        for(z = 0; z < 11; z++)
+            for(y = 0; y < 9; y++)
+            {
+                const unsigned int * row = vox->rowWords(y, z);
+                CPPUNIT_ASSERT((row == NULL) == vox->isSparse());
+                CPPUNIT_ASSERT(vox->getRow(y, z, words.data()));
+                for(int w = 0; w < vox->getXSpan(); w++)
+                {
+                    if(vox->getWordUnchecked(w, y, z) != words[w] || (row != NULL && row[w] != words[w]))
+                        mismatches++;
+                }
+                for(x = 0; x < 70; x++)
+                {
+                    bool expect = (x * 7 + y * 3 + z) % 5 == 0 && !(x == 69 && y == 8 && z == 10);
+                    if(vox->getUnchecked(x, y, z) != expect || vox->get(x, y, z) != expect)
+                        mismatches++;
+                }
+            }
+    }
+    CPPUNIT_ASSERT(mismatches == 0);
+}
+
+void TestVoxels::testMortonVolume()
+{
+    MortonVolume morton(5, 6, 7);
+    VoxelVolume back;
+    vector<int> rowcells, mortoncells;
+    int x, y, z, dx, dy, dz, mismatches = 0;
+
+    // dimensions are kept exactly
+    morton.getDim(dx, dy, dz);
+    CPPUNIT_ASSERT(dx == 5 && dy == 6 && dz == 7);
+    CPPUNIT_ASSERT(morton.set(4, 5, 6, true) && morton.get(4, 5, 6) && !morton.get(3, 5, 6));
+
+    // a solid block crossing superblocks, with noise, so that full, empty and mixed bricks all occur
+    vox->setDim(70, 40, 45);
+    for(z = 2; z < 41; z++)
+        for(y = 3; y < 37; y++)
+            vox->setSpan(1, 66, y, z, true);
+    for(int i = 0; i < 500; i++)
+        vox->set(rand()%70, rand()%40, rand()%45, (bool) (rand()%2));
+    vox->getDim(dx, dy, dz);
+    morton.fromVolume(vox);
+
+    back.setDim(dx, dy, dz);
+    CPPUNIT_ASSERT(morton.toVolume(&back));
+    for(z = 0; z < dz; z++)
+        for(y = 0; y < dy; y++)
+            for(x = 0; x < dx; x++)
+            {
+                if(back.getUnchecked(x, y, z) != vox->getUnchecked(x, y, z))
+                    mismatches++;
+                if(x < dx-1 && y < dy-1 && z < dz-1 && morton.getMCVertIdx(x, y, z) != vox->getMCVertIdx(x, y, z))
+                    mismatches++;
+            }
+    CPPUNIT_ASSERT(mismatches == 0);
+
+    // the same shell, in a different order
+    vox->getShellVoxels(rowcells);
+    morton.getShellVoxels(mortoncells);
+    CPPUNIT_ASSERT(rowcells.size() == mortoncells.size());
+    vector<std::tuple<int, int, int>> rowset, mortonset;
+    for(int i = 0; i < (int) rowcells.size(); i += 3)
+    {
+        rowset.push_back(std::make_tuple(rowcells[i+2], rowcells[i+1], rowcells[i]));
+        mortonset.push_back(std::make_tuple(mortoncells[i+2], mortoncells[i+1], mortoncells[i]));
+    }
+    sort(rowset.begin(), rowset.end());
+    sort(mortonset.begin(), mortonset.end());
+    CPPUNIT_ASSERT(rowset == mortonset);
+
+    back.setDim(dx+1, dy, dz);
+    CPPUNIT_ASSERT(!morton.toVolume(&back));
+}
+
+void TestVoxels::testVoxelStream()
+{
+    TempDirectory tmp("voxtmp");
+    VoxelStreamWriter writer;
+    VoxelStreamReader reader;
+    VoxelVolume slab, back, sphere(64, 64, 64, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(63.0f, 63.0f, 63.0f));
+    Mesh direct, streamed;
+    ContentHash directhash, streamedhash;
+    cgp::Point corner;
+    cgp::Vector diag;
+    int x, y, z, dx, dy, dz;
+    FILE * fp;
+    long compressed;
+
+    // noise spanning word boundaries beside uniform runs, written as two slabs of uneven depth
+    vox->setDim(100, 12, 9);
+    vox->setFrame(cgp::Point(-1.0f, -2.0f, -3.0f), cgp::Vector(4.0f, 5.0f, 6.0f));
+    srand(11);
+    for(z = 0; z < 9; z++)
+        for(y = 0; y < 12; y++)
+            for(x = 0; x < 100; x++)
+                vox->set(x, y, z, (x < 40 && y > 3) || (x > 60 && rand()%3 == 0));
+    vox->getDim(dx, dy, dz);
+    vox->getFrame(corner, diag);
+    CPPUNIT_ASSERT(writer.open("voxtmp/test.tvxr", dx, dy, dz, corner, diag));
+    CPPUNIT_ASSERT(writer.writeLayers(vox, 0, 4));
+    slab.setDim(dx, dy, 4);
+    for(z = 0; z < 4; z++)
+        for(y = 0; y < dy; y++)
+            for(x = 0; x < dx; x++)
+                slab.set(x, y, z, vox->get(x, y, z + 5));
+    CPPUNIT_ASSERT(!writer.writeLayers(&sphere, 0, 3)); // wrong dimensions
+    CPPUNIT_ASSERT(writer.writeLayers(&slab, 0, 3));
+    CPPUNIT_ASSERT(writer.getLayers() == 9);
+    CPPUNIT_ASSERT(!writer.writeLayers(&slab, 0, 0)); // past the last layer
+    CPPUNIT_ASSERT(writer.close());
+    CPPUNIT_ASSERT(VoxelStreamReader::isStreamFile("voxtmp/test.tvxr"));
+    CPPUNIT_ASSERT(!VoxelVolume::isVoxelFile("voxtmp/test.tvxr"));
+
+    CPPUNIT_ASSERT(reader.open("voxtmp/test.tvxr"));
+    CPPUNIT_ASSERT(reader.readVolume(&back));
+    back.getDim(x, y, z);
+    CPPUNIT_ASSERT(x == dx && y == dy && z == dz);
+    back.getFrame(corner, diag);
+    CPPUNIT_ASSERT(corner == cgp::Point(-1.0f, -2.0f, -3.0f));
+    CPPUNIT_ASSERT(diag == cgp::Vector(4.0f, 5.0f, 6.0f));
+    for(z = 0; z < dz; z++)
+        for(y = 0; y < dy; y++)
+            for(x = 0; x < dx; x++)
+                CPPUNIT_ASSERT(back.get(x, y, z) == vox->get(x, y, z));
+    reader.close();
+
+    // a solid sphere compresses to a small fraction of its dense size, and extracts to the same surface
+    for(z = 0; z < 64; z++)
+        for(y = 0; y < 64; y++)
+            for(x = 0; x < 64; x++)
+                sphere.set(x, y, z, (x-32)*(x-32) + (y-32)*(y-32) + (z-32)*(z-32) <= 400);
+    sphere.getFrame(corner, diag);
+    CPPUNIT_ASSERT(writer.open("voxtmp/sphere.tvxr", 64, 64, 64, corner, diag));
+    CPPUNIT_ASSERT(writer.writeLayers(&sphere, 0, 63));
+    CPPUNIT_ASSERT(writer.close());
+    fp = fopen("voxtmp/sphere.tvxr", "rb");
+    fseek(fp, 0, SEEK_END);
+    compressed = ftell(fp);
+    fclose(fp);
+    CPPUNIT_ASSERT(compressed * 2 < (long) sphere.getStorageBytes());
+
+    CPPUNIT_ASSERT(reader.open("voxtmp/sphere.tvxr"));
+    direct.marchingCubes(&sphere);
+    streamed.marchingCubes(&reader);
+    CPPUNIT_ASSERT(streamed.getNumFaces() == direct.getNumFaces() && direct.getNumFaces() > 0);
+    direct.hashContent(directhash);
+    streamed.hashContent(streamedhash);
+    CPPUNIT_ASSERT(directhash.value() == streamedhash.value());
+
+    // incomplete, missing and truncated files
+    CPPUNIT_ASSERT(writer.open("voxtmp/short.tvxr", 64, 64, 64, corner, diag));
+    CPPUNIT_ASSERT(writer.writeLayers(&sphere, 0, 10));
+    CPPUNIT_ASSERT(!writer.close());
+    CPPUNIT_ASSERT(!reader.open("voxtmp/short.tvxr"));
+    CPPUNIT_ASSERT(!reader.open("voxtmp/missing.tvxr"));
+    CPPUNIT_ASSERT(truncate("voxtmp/sphere.tvxr", compressed - 100) == 0);
+    CPPUNIT_ASSERT(!reader.open("voxtmp/sphere.tvxr"));
+}
+
+void TestVoxels::testMorphology()
+{
+    VoxelVolume orig, result;
+    const VoxelMorph elems[3] = {VoxelMorph::BOX, VoxelMorph::CROSS, VoxelMorph::BALL};
+    const int pointcounts[3] = {125, 25, 33}; // voxels within 2 of a point by Chebyshev, Manhattan and Euclidean distance
+    int dx, dy, dz;
+
+    // a single voxel grows into each element and a box offset closes back onto it
+    for(int e = 0; e < 3; e++)
+    {
+        int count = 0;
+
+        vox->setDim(64, 9, 9);
+        vox->set(31, 4, 4, true);
+        CPPUNIT_ASSERT(vox->dilate(2, elems[e]));
+        for(int z = 0; z < 9; z++)
+            for(int y = 0; y < 9; y++)
+                for(int x = 0; x < 64; x++)
+                    count += vox->get(x, y, z);
+        CPPUNIT_ASSERT(count == pointcounts[e] && vox->get(33, 4, 4) && vox->get(29, 4, 4));
+    }
+    CPPUNIT_ASSERT(vox->erode(2, VoxelMorph::BALL));
+    CPPUNIT_ASSERT(vox->get(31, 4, 4) && !vox->get(30, 4, 4) && !vox->get(31, 5, 4));
+    CPPUNIT_ASSERT(!vox->erode(-1));
+
+    // offsets beyond the row window of the distance transform
+    int ballcount = 0, count = 0;
+    for(dz = -9; dz <= 9; dz++)
+        for(dy = -9; dy <= 9; dy++)
+            for(dx = -9; dx <= 9; dx++)
+                ballcount += (dx * dx + dy * dy + dz * dz <= 81);
+    vox->setDim(64, 21, 21);
+    vox->set(31, 10, 10, true);
+    CPPUNIT_ASSERT(vox->dilate(9, VoxelMorph::BALL));
+    for(int z = 0; z < 21; z++)
+        for(int y = 0; y < 21; y++)
+            for(int x = 0; x < 64; x++)
+                count += vox->get(x, y, z);
+    CPPUNIT_ASSERT(count == ballcount);
+    CPPUNIT_ASSERT(vox->erode(9, VoxelMorph::BALL) && vox->get(31, 10, 10) && !vox->get(31, 10, 9));
+
+    // random blobs across word boundaries, compared with a search of every neighbourhood
+    srand(23);
+    orig.setDim(64, 12, 10);
+    for(int b = 0; b < 12; b++)
+    {
+        int cx = rand() % 64, cy = rand() % 12, cz = rand() % 10, r = 1 + rand() % 3;
+        for(int z = cz - r; z <= cz + r; z++)
+            for(int y = cy - r; y <= cy + r; y++)
+                orig.setSpan(cx - r, cx + r, y, z, true);
+    }
+    for(int sparse = 0; sparse < 2; sparse++)
+        for(int e = 0; e < 3; e++)
+            for(int k = 1; k <= 3; k++)
+                for(int grow = 0; grow < 2; grow++)
+                {
+                    result.setSparse(sparse == 1);
+                    result.setDim(64, 12, 10);
+                    for(int z = 0; z < 10; z++)
+                        for(int y = 0; y < 12; y++)
+                            for(int x = 0; x < 64; x++)
+                                result.set(x, y, z, orig.get(x, y, z));
+                    CPPUNIT_ASSERT(grow ? result.dilate(k, elems[e]) : result.erode(k, elems[e]));
+
+                    for(int z = 0; z < 10; z++)
+                        for(int y = 0; y < 12; y++)
+                            for(int x = 0; x < 64; x++)
+                            {
+                                bool any = false, all = true;
+                                for(dz = -k; dz <= k; dz++)
+                                    for(dy = -k; dy <= k; dy++)
+                                        for(dx = -k; dx <= k; dx++)
+                                        {
+                                            bool inside = (e == 0) || (e == 1 && abs(dx) + abs(dy) + abs(dz) <= k) ||
+                                                          (e == 2 && dx * dx + dy * dy + dz * dz <= k * k);
+                                            if(!inside)
+                                                continue;
+                                            bool occ = x + dx >= 0 && x + dx < 64 && y + dy >= 0 && y + dy < 12 &&
+                                                       z + dz >= 0 && z + dz < 10 && orig.get(x + dx, y + dy, z + dz);
+                                            any = any || occ;
+                                            all = all && occ;
+                                        }
+                                CPPUNIT_ASSERT(result.get(x, y, z) == (grow ? any : all));
+                            }
+                }
+}
+
+void TestVoxels::testVoxelStats()
+{
+    VoxelStats vs;
+    int x, y, z;
+
+    vox->setDim(64, 20, 20);
+    vox->setFrame(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(63.0f, 19.0f, 19.0f)); // unit spacing between voxel centres
+    vox->getStats(vs);
+    CPPUNIT_ASSERT(vs.occupied == 0 && vs.exposed() == 0 && vs.lo[0] == -1 && vs.hi[2] == -1 && vs.volume == 0.0);
+    CPPUNIT_ASSERT(vs.slices.size() == 20);
+
+    // a 6 x 4 x 7 box across the first word boundary
+    for(z = 3; z <= 9; z++)
+        for(y = 2; y <= 5; y++)
+            for(x = 30; x <= 35; x++)
+                vox->set(x, y, z, true);
+    vox->getStats(vs);
+    CPPUNIT_ASSERT(vs.occupied == 168 && vs.faces[0] == 56 && vs.faces[1] == 84 && vs.faces[2] == 48);
+    CPPUNIT_ASSERT(vs.lo[0] == 30 && vs.lo[1] == 2 && vs.lo[2] == 3 && vs.hi[0] == 35 && vs.hi[1] == 5 && vs.hi[2] == 9);
+    CPPUNIT_ASSERT(fabs(vs.volume - 168.0) < 1.0e-6 && fabs(vs.area - 188.0) < 1.0e-6);
+    CPPUNIT_ASSERT(fabs(vs.bounds.min.x - 29.5f) < 1.0e-4f && fabs(vs.bounds.min.y - 1.5f) < 1.0e-4f && fabs(vs.bounds.min.z - 2.5f) < 1.0e-4f);
+    CPPUNIT_ASSERT(fabs(vs.bounds.max.x - 35.5f) < 1.0e-4f && fabs(vs.bounds.max.y - 5.5f) < 1.0e-4f && fabs(vs.bounds.max.z - 9.5f) < 1.0e-4f);
+    CPPUNIT_ASSERT(vs.slices[2] == 0 && vs.slices[3] == 24 && vs.slices[9] == 24 && vs.slices[10] == 0);
+
+    // the outside of the volume counts as empty
+    vox->set(63, 19, 19, true);
+    vox->getStats(vs);
+    CPPUNIT_ASSERT(vs.occupied == 169 && vs.exposed() == 194 && vs.hi[0] == 63 && vs.hi[1] == 19 && vs.hi[2] == 19);
+
+    // scattered voxels, for dense and sparse storage
+    for(int s = 0; s < 2; s++)
+    {
+        size_t count = 0, faces[3] = {0, 0, 0};
+        int lo[3] = {1000, 1000, 1000}, hi[3] = {-1, -1, -1};
+
+        vox->setSparse(s == 1);
+        vox->setDim(96, 21, 19);
+        vox->setFrame(cgp::Point(-1.0f, -2.0f, -3.0f), cgp::Vector(4.0f, 5.0f, 6.0f));
+        for(z = 0; z < 19; z++)
+            for(y = 0; y < 21; y++)
+                for(x = 0; x < 96; x++)
+                    if((x * 7 + y * 13 + z * 29) % 11 < 4 && x > 2 && y < 20)
+                        vox->set(x, y, z, true);
+        for(z = 0; z < 19; z++)
+            for(y = 0; y < 21; y++)
+                for(x = 0; x < 96; x++)
+                    if(vox->get(x, y, z))
+                    {
+                        int p[3] = {x, y, z}, dim[3] = {96, 21, 19};
+
+                        count++;
+                        for(int a = 0; a < 3; a++)
+                        {
+                            lo[a] = std::min(lo[a], p[a]);
+                            hi[a] = std::max(hi[a], p[a]);
+                            for(int d = -1; d <= 1; d += 2)
+                            {
+                                int q[3] = {x, y, z};
+
+                                q[a] += d;
+                                if(q[a] < 0 || q[a] >= dim[a] || !vox->get(q[0], q[1], q[2]))
+                                    faces[a]++;
+                            }
+                        }
+                    }
+        vox->getStats(vs);
+        CPPUNIT_ASSERT(vs.occupied == count && vs.faces[0] == faces[0] && vs.faces[1] == faces[1] && vs.faces[2] == faces[2]);
+        for(int a = 0; a < 3; a++)
+            CPPUNIT_ASSERT(vs.lo[a] == lo[a] && vs.hi[a] == hi[a]);
+        CPPUNIT_ASSERT(fabs(vs.volume - (double) count * (4.0 / 95.0) * (5.0 / 20.0) * (6.0 / 18.0)) < 1.0e-6 * vs.volume);
+    }
+    vox->setSparse(false);
+}
+
+void TestVoxels::testComponents()
+{
+    std::vector<VoxelComponent> comps;
+    int x, y, z;
+
+    // flood fill voxels of a value from a seed, clearing them in a copy, and report the size and whether a face is reached
+    auto flood = [](std::vector<char> &grid, int dx, int dy, int dz, int sx, int sy, int sz, size_t &size, bool &border)
+    {
+        std::vector<int> stack(1, (sz * dy + sy) * dx + sx);
+        char val = grid[stack[0]];
+
+        size = 0;
+        border = false;
+        grid[stack[0]] = 2;
+        while(!stack.empty())
+        {
+            int c = stack.back(), p[3] = {c % dx, (c / dx) % dy, c / (dx * dy)}, dim[3] = {dx, dy, dz};
+            stack.pop_back();
+            size++;
+            for(int a = 0; a < 3; a++)
+                for(int d = -1; d <= 1; d += 2)
+                {
+                    int q[3] = {p[0], p[1], p[2]};
+                    q[a] += d;
+                    if(q[a] < 0 || q[a] >= dim[a])
+                    {
+                        border = true;
+                        continue;
+                    }
+                    int n = (q[2] * dy + q[1]) * dx + q[0];
+                    if(grid[n] == val)
+                    {
+                        grid[n] = 2;
+                        stack.push_back(n);
+                    }
+                }
+        }
+    };
+
+    for(int s = 0; s < 2; s++)
+    {
+        vox->setSparse(s == 1);
+
+        // hollow box with an island in its void and another outside it
+        vox->setDim(96, 40, 40);
+        for(z = 5; z <= 30; z++)
+            for(y = 5; y <= 30; y++)
+                for(x = 10; x <= 60; x++)
+                    if(x < 12 || x > 58 || y < 7 || y > 28 || z < 7 || z > 28)
+                        vox->set(x, y, z, true);
+        for(z = 1; z <= 3; z++)
+            for(y = 1; y <= 3; y++)
+                for(x = 80; x <= 83; x++)
+                    vox->set(x, y, z, true);
+        for(z = 15; z <= 17; z++)
+            for(y = 15; y <= 17; y++)
+                for(x = 30; x <= 34; x++) // crosses the word boundary
+                    vox->set(x, y, z, true);
+
+        size_t shell = 51 * 26 * 26 - 47 * 22 * 22;
+        CPPUNIT_ASSERT(vox->getComponents(comps) == 3);
+        CPPUNIT_ASSERT(comps[0].size == 36 && comps[0].lo[0] == 80 && comps[0].hi[0] == 83 && comps[0].lo[2] == 1 && !comps[0].border);
+        CPPUNIT_ASSERT(comps[1].size == shell && comps[1].lo[1] == 5 && comps[1].hi[1] == 30 && comps[1].hi[2] == 30);
+        CPPUNIT_ASSERT(comps[2].size == 45 && comps[2].lo[0] == 30 && comps[2].hi[0] == 34);
+
+        CPPUNIT_ASSERT(vox->fillVoids() == 1);
+        CPPUNIT_ASSERT(vox->get(40, 20, 20) && vox->get(12, 7, 7) && !vox->get(9, 20, 20));
+        CPPUNIT_ASSERT(vox->getComponents(comps) == 2 && comps[1].size == 51 * 26 * 26);
+        CPPUNIT_ASSERT(vox->keepLargest() == 1);
+        CPPUNIT_ASSERT(!vox->get(81, 2, 2) && vox->get(10, 5, 5));
+        CPPUNIT_ASSERT(vox->getComponents(comps) == 1 && vox->fillVoids() == 0 && vox->keepLargest() == 0);
+
+        vox->fill(false);
+        CPPUNIT_ASSERT(vox->getComponents(comps) == 0 && vox->keepLargest() == 0);
+
+        // scattered voxels against flood fills, over several slabs
+        const int dx = 64, dy = 13, dz = 3 * voxlabelslab + 5;
+        std::vector<char> grid(dx * dy * dz);
+        vox->setDim(dx, dy, dz);
+        srand(17 + s);
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+                for(x = 0; x < dx; x++)
+                {
+                    grid[(z * dy + y) * dx + x] = (rand() % 100) < 45;
+                    vox->set(x, y, z, grid[(z * dy + y) * dx + x] != 0);
+                }
+
+        std::vector<size_t> sizes;
+        std::vector<char> work = grid;
+        for(int c = 0; c < dx * dy * dz; c++)
+            if(work[c] == 1)
+            {
+                size_t size;
+                bool border;
+                flood(work, dx, dy, dz, c % dx, (c / dx) % dy, c / (dx * dy), size, border);
+                sizes.push_back(size);
+            }
+        CPPUNIT_ASSERT(vox->getComponents(comps) == (int) sizes.size() && sizes.size() > 1);
+        for(int c = 0; c < (int) sizes.size(); c++)
+            CPPUNIT_ASSERT(comps[c].size == sizes[c]);
+
+        // voids are the empty components clear of the faces
+        work = grid;
+        int voids = 0;
+        for(int c = 0; c < dx * dy * dz; c++)
+            if(work[c] == 0)
+            {
+                size_t size;
+                bool border;
+                std::vector<char> before = work;
+                flood(work, dx, dy, dz, c % dx, (c / dx) % dy, c / (dx * dy), size, border);
+                if(!border)
+                {
+                    voids++;
+                    for(int v = 0; v < dx * dy * dz; v++)
+                        if(work[v] == 2 && before[v] == 0)
+                            grid[v] = 1;
+                }
+            }
+        CPPUNIT_ASSERT(vox->fillVoids() == voids && voids > 0);
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+                for(x = 0; x < dx; x++)
+                    CPPUNIT_ASSERT(vox->get(x, y, z) == (grid[(z * dy + y) * dx + x] != 0));
+
+        size_t largest = *std::max_element(sizes.begin(), sizes.end()), filled = 0;
+        vox->keepLargest();
+        CPPUNIT_ASSERT(vox->getComponents(comps) == 1 && comps[0].size >= largest);
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+                for(x = 0; x < dx; x++)
+                    filled += vox->get(x, y, z);
+        CPPUNIT_ASSERT(filled == comps[0].size);
+    }
+    vox->setSparse(false);
+}
+
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestVoxels, TestSet::perBuild());
 //#endif
+
+void TestVoxels::testVDB()
+{
+    TempDirectory tmp("vdbtmp");
+    VoxelVolume part(96, 40, 24, cgp::Point(-1.0f, 2.0f, 0.5f), cgp::Vector(9.5f, 3.9f, 2.3f)), back;
+    DistanceField field(20, 16, 12, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.9f, 1.5f, 1.1f), 0.3f), fieldback;
+    const unsigned char header[8] = {0x20, 0x42, 0x44, 0x56, 0, 0, 0, 0};
+    FILE * fp;
+
+    // the signature alone marks a file as OpenVDB
+    fp = fopen("vdbtmp/header.vdb", "wb");
+    CPPUNIT_ASSERT(fp != NULL && fwrite(header, 1, 8, fp) == 8);
+    fclose(fp);
+    CPPUNIT_ASSERT(VoxelVolume::isVDBFile("vdbtmp/header.vdb"));
+    CPPUNIT_ASSERT(!VoxelVolume::isVDBFile("vdbtmp/missing.vdb"));
+
+    // a full brick, a partial one crossing a word boundary and a few single voxels, with the rest left empty
+    part.setSparse(true);
+    for(int z = 8; z < 16; z++)
+        for(int y = 8; y < 16; y++)
+            part.setSpan(32, 64, y, z, true);
+    for(int z = 3; z < 7; z++)
+        for(int y = 20; y < 33; y++)
+            part.setSpan(60, 71, y, z, true);
+    part.set(1, 1, 1, true);
+    part.set(95, 39, 23, true);
+    for(int z = 0; z < 12; z++)
+        for(int y = 0; y < 16; y++)
+            for(int x = 0; x < 20; x++)
+                field.set(x, y, z, 0.1f * (sqrtf((float) ((x - 9) * (x - 9) + (y - 8) * (y - 8) + (z - 6) * (z - 6))) - 4.0f));
+
+#ifdef TESS_OPENVDB
+    int dx, dy, dz, bdim[3], occupied = 0, found = 0, mismatch = 0;
+    cgp::Point corner;
+    cgp::Vector diag;
+
+    // index of the voxel of a volume with the given frame and dimensions whose centre is nearest a point
+    auto nearest = [](cgp::Point corner, cgp::Vector diag, const int * dim, cgp::Point p, int * idx)
+    {
+        const float pos[3] = {p.x - corner.x, p.y - corner.y, p.z - corner.z}, extent[3] = {diag.i, diag.j, diag.k};
+        bool inside = true;
+        for(int a = 0; a < 3; a++)
+        {
+            idx[a] = (int) lroundf(pos[a] / extent[a] * (float) (dim[a] - 1));
+            inside = inside && idx[a] >= 0 && idx[a] < dim[a];
+        }
+        return inside;
+    };
+
+    CPPUNIT_ASSERT(part.writeVDB("vdbtmp/part.vdb"));
+    CPPUNIT_ASSERT(VoxelVolume::isVDBFile("vdbtmp/part.vdb"));
+    CPPUNIT_ASSERT(back.readVDB("vdbtmp/part.vdb"));
+    CPPUNIT_ASSERT(back.isSparse());
+    back.getDim(bdim[0], bdim[1], bdim[2]);
+    back.getFrame(corner, diag);
+    part.getDim(dx, dy, dz);
+    for(int z = 0; z < dz; z++)
+        for(int y = 0; y < dy; y++)
+            for(int x = 0; x < dx; x++)
+                if(part.get(x, y, z))
+                {
+                    int idx[3];
+                    occupied++;
+                    if(nearest(corner, diag, bdim, part.getVoxelPos(x, y, z), idx) && back.get(idx[0], idx[1], idx[2]))
+                        found++;
+                }
+    for(int z = 0; z < bdim[2]; z++)
+        for(int y = 0; y < bdim[1]; y++)
+            for(int x = 0; x < bdim[0]; x++)
+                found -= (int) back.get(x, y, z);
+    CPPUNIT_ASSERT(occupied > 0 && found == 0);
+
+    CPPUNIT_ASSERT(field.writeVDB("vdbtmp/field.vdb"));
+    CPPUNIT_ASSERT(fieldback.readVDB("vdbtmp/field.vdb"));
+    CPPUNIT_ASSERT(fabs(fieldback.getBand() - 0.3f) < 1.0e-6f);
+    fieldback.getDim(bdim[0], bdim[1], bdim[2]);
+    fieldback.getFrame(corner, diag);
+    for(int z = 0; z < 12; z++)
+        for(int y = 0; y < 16; y++)
+            for(int x = 0; x < 20; x++)
+            {
+                int idx[3];
+                if(fabs(field.get(x, y, z)) < 0.3f && (!nearest(corner, diag, bdim, field.getVoxelPos(x, y, z), idx)
+                   || fabs(fieldback.get(idx[0], idx[1], idx[2]) - field.get(x, y, z)) > 1.0e-6f))
+                    mismatch++;
+            }
+    CPPUNIT_ASSERT(mismatch == 0);
+#else
+    CPPUNIT_ASSERT(!part.writeVDB("vdbtmp/part.vdb"));
+    CPPUNIT_ASSERT(!back.readVDB("vdbtmp/header.vdb"));
+    CPPUNIT_ASSERT(!field.writeVDB("vdbtmp/field.vdb"));
+    CPPUNIT_ASSERT(!fieldback.readVDB("vdbtmp/header.vdb"));
+#endif
+    cerr << "VOXEL VDB PASSED" << endl << endl;
+}
+
+void TestVoxels::testDexels()
+{
+    DexelVolume a, b, sphere, back;
+    VoxelVolume va, vb, packed, ball(512, 48, 48, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(511.0f, 47.0f, 47.0f));
+    Mesh direct, spans;
+    ContentHash directhash, spanshash;
+    cgp::Point corner;
+    cgp::Vector diag;
+    vector<int> row;
+    int x, y, z, dx, dy, dz, lo[3] = {0, 2, 1}, hi[3] = {95, 9, 5};
+
+    cerr << "START VOXEL DEXELS" << endl;
+    a.setDim(70, 12, 7);
+    a.getDim(dx, dy, dz);
+    CPPUNIT_ASSERT(dx == 96 && dy == 12 && dz == 7); // padded to whole words as for VoxelVolume
+    b.setDim(70, 12, 7);
+    va.setDim(70, 12, 7);
+    vb.setDim(70, 12, 7);
+
+    // random spans, unclipped and touching, against the same spans set voxel by voxel
+    srand(23);
+    for(int op = 0; op < 3; op++)
+    {
+        a.clear(); b.clear();
+        va.fill(false); vb.fill(false);
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+                for(int v = 0; v < 2; v++)
+                {
+                    int start = -5 + rand() % 8;
+
+                    row.clear();
+                    while(start < dx + 5)
+                    {
+                        int len = 1 + rand() % 20;
+                        row.push_back(start);
+                        row.push_back(start + len);
+                        start += len + rand() % 12; // a gap of 0 touches the previous span
+                    }
+                    CPPUNIT_ASSERT((v == 0 ? a : b).setRow(y, z, row));
+                    for(size_t s = 0; s < row.size(); s += 2)
+                        (v == 0 ? va : vb).setSpan(row[s], row[s+1], y, z, true);
+                }
+        CPPUNIT_ASSERT(!a.setRow(dy, 0, row));
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+            {
+                const vector<int> &spans = a.getRow(y, z);
+                for(size_t s = 2; s < spans.size(); s += 2)
+                    CPPUNIT_ASSERT(spans[s] > spans[s-1]); // merged where they touched
+                for(x = 0; x < dx; x++)
+                    CPPUNIT_ASSERT(a.get(x, y, z) == va.get(x, y, z));
+            }
+
+        if(op == 0)
+        {
+            CPPUNIT_ASSERT(a.unionWith(&b, lo, hi));
+            va.unionWith(&vb, lo, hi);
+        }
+        else if(op == 1)
+        {
+            CPPUNIT_ASSERT(a.intersectWith(&b, lo, hi));
+            va.intersectWith(&vb, lo, hi);
+        }
+        else
+        {
+            CPPUNIT_ASSERT(a.subtract(&b, lo, hi));
+            va.subtract(&vb, lo, hi);
+        }
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+                for(x = 0; x < dx; x++)
+                    CPPUNIT_ASSERT(a.get(x, y, z) == va.get(x, y, z));
+
+        a.toVoxels(&packed);
+        back.fromVoxels(&packed);
+        for(z = 0; z < dz; z++)
+            for(y = 0; y < dy; y++)
+            {
+                CPPUNIT_ASSERT(back.getRow(y, z) == a.getRow(y, z));
+                for(x = 0; x < dx; x++)
+                    CPPUNIT_ASSERT(packed.get(x, y, z) == va.get(x, y, z));
+            }
+    }
+    back.setDim(70, 12, 8);
+    CPPUNIT_ASSERT(!a.unionWith(&back)); // mismatched dimensions
+
+    // a solid ellipsoid, long along the rows, is held in less than its packed storage and extracts to the same surface
+    for(z = 0; z < 48; z++)
+        for(y = 0; y < 48; y++)
+            for(x = 0; x < 512; x++)
+                ball.set(x, y, z, (x-256)*(x-256) / 100 + (y-24)*(y-24) + (z-24)*(z-24) <= 400);
+    sphere.fromVoxels(&ball);
+    sphere.getFrame(corner, diag);
+    CPPUNIT_ASSERT(corner == cgp::Point(0.0f, 0.0f, 0.0f) && diag == cgp::Vector(511.0f, 47.0f, 47.0f));
+    CPPUNIT_ASSERT(sphere.getVoxelPos(5, 6, 7) == ball.getVoxelPos(5, 6, 7));
+    CPPUNIT_ASSERT(sphere.getStorageBytes() < ball.getStorageBytes());
+    direct.marchingCubes(&ball);
+    spans.marchingCubes(&sphere);
+    CPPUNIT_ASSERT(spans.getNumFaces() == direct.getNumFaces() && direct.getNumFaces() > 0);
+    direct.hashContent(directhash);
+    spans.hashContent(spanshash);
+    CPPUNIT_ASSERT(directhash.value() == spanshash.value());
+    cerr << "VOXEL DEXELS PASSED" << endl << endl;
+}
+
+void TestVoxels::testOccupancy()
+{
+    VoxelVolume vox;
+    vector<unsigned char> occ, sparseocc;
+    int odim[3], set[4][3] = {{0, 0, 0}, {95, 33, 2}, {40, 70, 69}, {63, 31, 31}};
+
+    cerr << "START VOXEL OCCUPANCY" << endl;
+    vox.setDim(100, 71, 70);
+    for(int i = 0; i < 4; i++)
+        vox.set(set[i][0], set[i][1], set[i][2], true);
+
+    for(int sparse = 0; sparse < 2; sparse++)
+    {
+        vox.setSparse(sparse == 1);
+        CPPUNIT_ASSERT(vox.getOccupancy(32, occ, odim));
+        CPPUNIT_ASSERT(odim[0] == 4 && odim[1] == 3 && odim[2] == 3);
+        CPPUNIT_ASSERT((int) occ.size() == odim[0] * odim[1] * odim[2]);
+        for(int bz = 0; bz < odim[2]; bz++)
+            for(int by = 0; by < odim[1]; by++)
+                for(int bx = 0; bx < odim[0]; bx++)
+                {
+                    bool any = false;
+
+                    for(int i = 0; i < 4; i++)
+                        any = any || (set[i][0] / 32 == bx && set[i][1] / 32 == by && set[i][2] / 32 == bz);
+                    CPPUNIT_ASSERT((occ[((size_t) bz * odim[1] + by) * odim[0] + bx] != 0) == any);
+                }
+        if(sparse == 1)
+            CPPUNIT_ASSERT(occ == sparseocc);
+        sparseocc = occ;
+
+        CPPUNIT_ASSERT(vox.getOccupancy(64, occ, odim));
+        CPPUNIT_ASSERT(odim[0] == 2 && odim[1] == 2 && odim[2] == 2);
+        CPPUNIT_ASSERT(occ[0] != 0 && occ[1] != 0 && occ[2] == 0 && occ[3] == 0);
+        CPPUNIT_ASSERT(occ[4] == 0 && occ[5] == 0 && occ[6] != 0 && occ[7] == 0);
+    }
+    CPPUNIT_ASSERT(!vox.getOccupancy(16, occ, odim));
+    CPPUNIT_ASSERT(!vox.getOccupancy(0, occ, odim));
+}
+
+void TestVoxels::testPagePolicies()
+{
+    parallel::PagePlacement placement;
+    parallel::HugePages huge;
+    int dims[2][3] = {{256, 256, 260}, {40, 30, 20}}; // one over pagesmin with a partial slab at the end, one on the heap
+
+    cerr << "START VOXEL PAGE POLICIES" << endl;
+    CPPUNIT_ASSERT(parallel::parsePagePlacement("interleave", placement) && placement == parallel::PagePlacement::INTERLEAVE);
+    CPPUNIT_ASSERT(parallel::parsePagePlacement("first-touch", placement) && placement == parallel::PagePlacement::FIRST_TOUCH);
+    CPPUNIT_ASSERT(!parallel::parsePagePlacement("remote", placement) && placement == parallel::PagePlacement::FIRST_TOUCH);
+    CPPUNIT_ASSERT(parallel::parseHugePages("explicit", huge) && huge == parallel::HugePages::EXPLICIT);
+    CPPUNIT_ASSERT(!parallel::parseHugePages("1g", huge) && huge == parallel::HugePages::EXPLICIT);
+
+    for(int p = 0; p <= (int) parallel::PagePlacement::INTERLEAVE; p++)
+        for(int h = 0; h <= (int) parallel::HugePages::EXPLICIT; h++)
+        {
+            parallel::setPagePlacement((parallel::PagePlacement) p);
+            parallel::setHugePages((parallel::HugePages) h);
+            CPPUNIT_ASSERT(parallel::getPagePlacement() == (parallel::PagePlacement) p);
+            CPPUNIT_ASSERT(parallel::getHugePages() == (parallel::HugePages) h);
+
+            for(int d = 0; d < 2; d++)
+            {
+                VoxelVolume vol(dims[d][0], dims[d][1], dims[d][2], cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f));
+                int last[3] = {dims[d][0] - 1, dims[d][1] - 1, dims[d][2] - 1};
+
+                CPPUNIT_ASSERT(!vol.get(0, 0, 0) && !vol.get(last[0], last[1], last[2]));
+                CPPUNIT_ASSERT(!vol.get(last[0] / 2, last[1], last[2]) && !vol.get(0, last[1] / 2, last[2] / 2));
+                vol.fill(true);
+                CPPUNIT_ASSERT(vol.get(0, 0, 0) && vol.get(last[0], last[1], last[2]));
+                CPPUNIT_ASSERT(vol.get(last[0] / 2, last[1], last[2]) && vol.get(0, last[1] / 2, last[2] / 2));
+                vol.set(last[0], last[1], last[2], false);
+                vol.setSparse(true);
+                vol.setSparse(false);
+                CPPUNIT_ASSERT(vol.get(0, 0, 0) && !vol.get(last[0], last[1], last[2]));
+                vol.setDim(dims[d][0], dims[d][1], dims[d][2]); // reuses the storage, refilled with zeroes
+                CPPUNIT_ASSERT(!vol.get(0, 0, 0) && !vol.get(last[0] / 2, last[1] / 2, last[2] / 2));
+            }
+
+            // an odd size straight from the allocator, over a partial huge page
+            size_t bytes = parallel::pagesmin + 12345;
+            unsigned char * arr = (unsigned char *) parallel::allocPages(bytes, 4096);
+            CPPUNIT_ASSERT(arr != NULL);
+            CPPUNIT_ASSERT(arr[0] == 0 && arr[bytes / 2] == 0 && arr[bytes - 1] == 0);
+            parallel::fillPages(arr, 7, bytes, 4096);
+            CPPUNIT_ASSERT(arr[0] == 7 && arr[bytes - 1] == 7);
+            parallel::advisePages(arr + 1, bytes - 1);
+            parallel::freePages(arr, bytes);
+        }
+    parallel::setPagePlacement(parallel::PagePlacement::FIRST_TOUCH);
+    parallel::setHugePages(parallel::HugePages::TRANSPARENT);
+}
+
+/// Compare a random block of side N with a volume holding the same voxels
+template<int N> static void checkVoxelBlock(unsigned int seed)
+{
+    VoxelBlock<N> block, shifted, copy;
+    VoxelVolume vol(N, N, N, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector((float) (std::max(N, 32)-1), (float) (N-1), (float) (N-1))); // unit cells, rows padded to 32
+    VoxelMesher mesher;
+    Mesh mesh;
+    std::vector<cgp::Point> verts, bverts;
+    std::vector<int> faces, bfaces;
+    int x, y, z, f, nfaces = 0, h = N / 2;
+    auto occupied = [&vol](int vx, int vy, int vz){ return vx >= 0 && vx < N && vy >= 0 && vy < N && vz >= 0 && vz < N && vol.get(vx, vy, vz); };
+
+    // a ball with noise on its surface, giving many kinds of marching cubes cell, and a few voxels on the block faces
+    srand(seed);
+    for(z = 0; z < N; z++)
+        for(y = 0; y < N; y++)
+            for(x = 0; x < N; x++)
+            {
+                int r2 = (x-h)*(x-h) + (y-h)*(y-h) + (z-h)*(z-h);
+                bool occ = r2 < (N*N)/8 || (r2 < (N*N)/4 && rand() % 3 == 0) || (x == N-1 && rand() % 4 == 0);
+                block.set(x, y, z, occ);
+                vol.set(x, y, z, occ);
+            }
+    CPPUNIT_ASSERT(!block.empty() && !block.full());
+
+    // neighbours across rows and planes, with voxels outside the block empty
+    block.template neighbour<1, -1, 1>(shifted);
+    for(z = 0; z < N; z++)
+        for(y = 0; y < N; y++)
+            for(x = 0; x < N; x++)
+            {
+                CPPUNIT_ASSERT(block.get(x, y, z) == vol.get(x, y, z));
+                CPPUNIT_ASSERT(shifted.get(x, y, z) == occupied(x+1, y-1, z+1));
+                if(block.get(x, y, z))
+                    for(f = 0; f < 6; f++)
+                        nfaces += !occupied(x + (f == 1) - (f == 0), y + (f == 3) - (f == 2), z + (f == 5) - (f == 4));
+            }
+    CPPUNIT_ASSERT(block.countFaces() == nfaces);
+
+    // boolean operations
+    copy = block;
+    copy.subtract(shifted);
+    copy |= shifted;
+    shifted |= block;
+    CPPUNIT_ASSERT(copy == shifted);
+    copy &= block;
+    CPPUNIT_ASSERT(copy == block);
+    copy ^= block;
+    CPPUNIT_ASSERT(copy.empty() && copy != block);
+    copy.invert();
+    CPPUNIT_ASSERT(copy.full() && copy.count() == VoxelBlock<N>::size);
+
+    // the same face-culled mesh as the volume mesher, and the same marching cubes surface as the volume
+    mesher.extract(&vol, verts, faces);
+    block.extractFaces(cgp::Point(-0.5f, -0.5f, -0.5f), cgp::Vector(1.0f, 1.0f, 1.0f), bverts, bfaces);
+    CPPUNIT_ASSERT((int) bfaces.size() == 6 * nfaces && bfaces.size() == faces.size() && bverts.size() == verts.size());
+    // voxels on the +x face would be closed off by the padding of the volume rows, but not by the block
+    for(z = 0; z < N; z++)
+        for(y = 0; y < N; y++)
+        {
+            block.set(N-1, y, z, false);
+            vol.set(N-1, y, z, false);
+        }
+    mesh.marchingCubes(&vol);
+    bverts.clear();
+    bfaces.clear();
+    block.marchingCubes(cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f), bverts, bfaces);
+    CPPUNIT_ASSERT((int) bverts.size() == mesh.getNumVerts() && (int) bfaces.size() == 3 * mesh.getNumFaces());
+    verts = * mesh.getVerts();
+    auto less = [](const cgp::Point &a, const cgp::Point &b){ return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z); };
+    std::sort(verts.begin(), verts.end(), less);
+    std::sort(bverts.begin(), bverts.end(), less);
+    for(x = 0; x < (int) verts.size(); x++)
+        CPPUNIT_ASSERT(verts[x].x == bverts[x].x && verts[x].y == bverts[x].y && verts[x].z == bverts[x].z);
+
+    // round trips through dense and sparse volumes, at an origin clipped in -y, +y and +z
+    for(int sparse = 0; sparse < 2; sparse++)
+    {
+        VoxelVolume big(N + 8, N - 3, N - 5, cgp::Point(0.0f, 0.0f, 0.0f), cgp::Vector(1.0f, 1.0f, 1.0f));
+        int ox = (N < 32) ? 32 - N : ((N == 32) ? 32 : 64), oy = -2, oz = 1, bx, by, bz; // the widest block also clipped in +x
+
+        big.setSparse(sparse == 1);
+        CPPUNIT_ASSERT(!block.writeVolume(&big, N < 32 ? N / 2 : 16, 0, 0));
+        big.getDim(bx, by, bz);
+        CPPUNIT_ASSERT(block.writeVolume(&big, ox, oy, oz));
+        for(z = 0; z < N; z++)
+            for(y = 0; y < N; y++)
+                for(x = 0; x < N; x++)
+                    CPPUNIT_ASSERT((ox+x < bx && oy+y >= 0 && oy+y < by && oz+z < bz ? big.get(ox+x, oy+y, oz+z) : false) == (block.get(x, y, z) && ox+x < bx && oy+y >= 0 && oy+y < by && oz+z < bz));
+        CPPUNIT_ASSERT(big.get(ox-1, 5, 5) == false);
+        CPPUNIT_ASSERT(copy.readVolume(&big, ox, oy, oz));
+        for(z = 0; z < N; z++)
+            for(y = 0; y < N; y++)
+                for(x = 0; x < N; x++)
+                    CPPUNIT_ASSERT(copy.get(x, y, z) == (ox+x < bx && oy+y >= 0 && oy+y < by && oz+z < bz && big.get(ox+x, oy+y, oz+z)));
+        CPPUNIT_ASSERT(copy.readVolume(&big, 0, 0, 0) && copy.empty());
+    }
+}
+
+void TestVoxels::testVoxelBlock()
+{
+    cerr << "START VOXEL BLOCK" << endl;
+    checkVoxelBlock<8>(11);
+    checkVoxelBlock<16>(12);
+    checkVoxelBlock<32>(13);
+    checkVoxelBlock<64>(14);
+    cerr << "VOXEL BLOCK TEST PASSED" << endl << endl;
+}
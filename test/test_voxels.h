@@ -5,6 +5,12 @@
 #include <string>
 #include <cppunit/extensions/HelperMacros.h>
 #include "tesselate/voxels.h"
+#include "tesselate/mortonvol.h"
+#include "tesselate/voxblock.h"
+#include "tesselate/voxstream.h"
+#include "tesselate/mesh.h"
+#include "tesselate/distfield.h"
+#include "tesselate/dexels.h"
 
 /// Test code for @ref VoxelVolume
 class TestVoxels : public CppUnit::TestFixture
@@ -12,6 +18,23 @@ class TestVoxels : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestVoxels);
     CPPUNIT_TEST(testVoxelSet);
     CPPUNIT_TEST(testVoxelRegistration);
+    CPPUNIT_TEST(testVoxelSetOps);
+    CPPUNIT_TEST(testVoxelRange);
+    CPPUNIT_TEST(testVoxelFile);
+    CPPUNIT_TEST(testMCRowCodes);
+    CPPUNIT_TEST(testSparseVolume);
+    CPPUNIT_TEST(testSurfaceVoxels);
+    CPPUNIT_TEST(testUncheckedAccess);
+    CPPUNIT_TEST(testMortonVolume);
+    CPPUNIT_TEST(testVoxelStream);
+    CPPUNIT_TEST(testMorphology);
+    CPPUNIT_TEST(testVoxelStats);
+    CPPUNIT_TEST(testComponents);
+    CPPUNIT_TEST(testVDB);
+    CPPUNIT_TEST(testDexels);
+    CPPUNIT_TEST(testOccupancy);
+    CPPUNIT_TEST(testPagePolicies);
+    CPPUNIT_TEST(testVoxelBlock);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -34,6 +57,106 @@ public:
      * Check correspondence of voxel elements to 3D position
      */
     void testVoxelRegistration();
+
+    /**
+     * Check span fills and word-level boolean set operations against single voxel access
+     */
+    void testVoxelSetOps();
+
+    /**
+     * Check conversion of world-space boxes to clipped voxel index ranges
+     */
+    void testVoxelRange();
+
+    /**
+     * Check that volumes survive a round trip through the binary voxel file format
+     */
+    void testVoxelFile();
+
+    /**
+     * Check bulk row marching cubes codes against per-cell codes
+     */
+    void testMCRowCodes();
+
+    /**
+     * Check that sparse brick storage matches dense storage under edits, set operations and marching cubes codes
+     */
+    void testSparseVolume();
+
+    /**
+     * Check word-level boundary shell extraction, as points, index lists and a bitmap, against per-voxel neighbour tests,
+     * for dense and sparse storage
+     */
+    void testSurfaceVoxels();
+
+    /**
+     * Check that the unchecked voxel, word and row accessors agree with the bounds checked ones, for dense and sparse
+     * storage
+     */
+    void testUncheckedAccess();
+
+    /**
+     * Check that Morton ordered bricks round trip the flat row layout and agree with it on cell codes and the shell
+     */
+    void testMortonVolume();
+
+    /**
+     * Check that compressed voxel files written a slab at a time read back exactly, compress uniform runs, give the
+     * same marching cubes surface as the volume, and reject malformed use
+     */
+    void testVoxelStream();
+
+    /**
+     * Check dilation and erosion by box, cross and ball elements against per-voxel neighbourhood tests, for dense and
+     * sparse storage, with the outside of the volume counted as empty
+     */
+    void testMorphology();
+
+    /**
+     * Check voxel counts, exposed faces, bounds and world-space measures against a box spanning a word boundary,
+     * a voxel on the volume corner, and per-voxel counts over dense and sparse volumes
+     */
+    void testVoxelStats();
+
+    /**
+     * Check connected components, keeping the largest and filling voids against a hollow part with islands and
+     * against per-voxel flood fills of scattered voxels spanning several labelling slabs, for dense and sparse storage
+     */
+    void testComponents();
+
+    /**
+     * Check that OpenVDB files are recognised, and that a sparse volume with full, empty and partial bricks and a
+     * distance field come back from OpenVDB grids with the same voxels at the same world positions. Builds without
+     * OPENVDB must refuse instead.
+     */
+    void testVDB();
+
+    /**
+     * Check that span set operations match those of packed volumes on random rows with spans touching the row ends
+     * and word boundaries, that spans convert to and from packed words exactly, and that marching cubes on spans
+     * gives the same surface as on the packed volume, which needs more storage for long rows
+     */
+    void testDexels();
+
+    /**
+     * Check that block occupancy for ray marching marks exactly the blocks holding an occupied voxel, with partial
+     * blocks at the far edges, for dense and sparse storage, and that block sizes which split words are refused
+     */
+    void testOccupancy();
+
+    /**
+     * Check that dense volumes large enough for placed pages, and arrays straight from the page allocator, start zeroed
+     * and fill and convert correctly under every combination of NUMA placement and huge pages, and that the option
+     * names parse
+     */
+    void testPagePolicies();
+
+    /**
+     * Check that fixed-size blocks of each supported side agree with a volume of the same voxels on neighbours, exposed
+     * faces, the face-culled mesh and the marching cubes surface, and copy to and from dense and sparse volumes at
+     * clipped and word-aligned origins
+     */
+    void testVoxelBlock();
 };
 
 #endif /* !TILER_TEST_VOXEL_H */
@@ -18,6 +18,7 @@ namespace TestSet
     std::string perBuild()   { return "build"; }
     std::string perCommit()  { return "commit"; }
     std::string perNightly() { return "nightly"; }
+    std::string perPerformance() { return "perf"; }
 };
 
 static po::variables_map g_vm;
@@ -16,6 +16,7 @@ namespace TestSet
     std::string perBuild();
     std::string perCommit();
     std::string perNightly();
+    std::string perPerformance();
 };
 
 /// Return the command-line options passed to the test executable
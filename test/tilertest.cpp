@@ -47,6 +47,13 @@ static po::variables_map processOptions(int argc, const char **argv)
         ("verbose,v",                                 "Show result of each test as it runs");
     desc.add(test);
 
+    po::options_description perf("Performance options");
+    perf.add_options()
+        ("perf-baseline", po::value<std::string>()->default_value("perf_baseline.txt"), "Baseline file compared against by --test=perf")
+        ("perf-tolerance", po::value<double>()->default_value(0.2), "Fraction by which time and memory may exceed the baseline")
+        ("perf-update",                               "Record the measurements as the new baseline instead of comparing");
+    desc.add(perf);
+
 #if HAVE_OPENCL
     po::options_description cl("OpenCL options");
     CLH::addOptions(cl);
@@ -87,16 +94,19 @@ int main(int argc, const char **argv)
         CppUnit::TestSuite *buildSuite = new CppUnit::TestSuite("build");
         CppUnit::TestSuite *commitSuite = new CppUnit::TestSuite("commit");
         CppUnit::TestSuite *nightlySuite = new CppUnit::TestSuite("nightly");
+        CppUnit::TestSuite *perfSuite = new CppUnit::TestSuite("perf");
 
         CppUnit::TestFactoryRegistry::getRegistry().addTestToSuite(rootSuite);
         CppUnit::TestFactoryRegistry::getRegistry(TestSet::perBuild()).addTestToSuite(buildSuite);
         CppUnit::TestFactoryRegistry::getRegistry(TestSet::perCommit()).addTestToSuite(commitSuite);
         CppUnit::TestFactoryRegistry::getRegistry(TestSet::perNightly()).addTestToSuite(nightlySuite);
+        CppUnit::TestFactoryRegistry::getRegistry(TestSet::perPerformance()).addTestToSuite(perfSuite);
 
         // Chain the subsuites, so that the bigger ones run the smaller ones too
         commitSuite->addTest(buildSuite);
         nightlySuite->addTest(commitSuite);
         rootSuite->addTest(nightlySuite);
+        rootSuite->addTest(perfSuite); // timings depend on the machine, so perf stands apart from the chain
 
         if (vm.count("list"))
         {